@@ -22,6 +22,7 @@
 
 #include "Shaders/StreamingStructs.h"
 #include "Shaders/StreamingDefines.h"
+#include "ThreadPool.h"
 
 #include "DirectXTex\DirectXTex\DirectXTex.h"
 
@@ -47,13 +48,29 @@ struct PerFrameConstants
 };
 
 
-App::App(ID3D11Device *d3dDevice, unsigned int activeLights, unsigned int msaaSamples)
+App::App(ID3D11Device *d3dDevice, unsigned int activeLights, unsigned int msaaSamples,
+         unsigned int surfacesPerPixel, bool compactMergeNodes, unsigned int nodePoolPercent, bool hiZ)
     : mMSAASamples(msaaSamples)
+    , mSurfacesPerPixel(surfacesPerPixel)
+    , mWideCoverage(msaaSamples > 8)
+    , mCompactMergeNodes(compactMergeNodes && !mWideCoverage)
+    , mNodePoolPercent(nodePoolPercent)
+    , mHiZ(hiZ)
+    , mTiledLightCulling(true)
+    , mResolveCompaction(true)
     , mTotalTime(0.0f)
     , mActiveLights(0)
+    , mLightsMoved(true)
     , mLightBuffer(0)
     , mDepthBufferReadOnlyDSV(0)
+    , mComplexPixelArgs(0)
+    , mComplexPixelArgsUAV(0)
+    , mFrameEpoch(0)
+    , mThreadPool(new StreamingCpu::ThreadPool())
+    , mClusterLightIndexCapacity(0)
 {
+    memset(&mSnapshotCamera, 0, sizeof(mSnapshotCamera));
+
     std::string msaaSamplesStr;
     {
         std::ostringstream oss;
@@ -61,9 +78,23 @@ App::App(ID3D11Device *d3dDevice, unsigned int activeLights, unsigned int msaaSa
         msaaSamplesStr = oss.str();
     }
 
+    assert(mSurfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           mSurfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_GPU);
+    std::string surfacesPerPixelStr;
+    {
+        std::ostringstream oss;
+        oss << mSurfacesPerPixel;
+        surfacesPerPixelStr = oss.str();
+    }
+
     // Set up macros
     D3D10_SHADER_MACRO defines[] = {
         {"MSAA_SAMPLES", msaaSamplesStr.c_str()},
+        {"STREAMING_MAX_SURFACES_PER_PIXEL", surfacesPerPixelStr.c_str()},
+        {"STREAMING_COMPACT_MERGE_NODE", mCompactMergeNodes ? "1" : "0"},
+        {"STREAMING_WIDE_COVERAGE", mWideCoverage ? "1" : "0"},
+        {"STREAMING_NODE_POOL", mNodePoolPercent > 0 ? "1" : "0"},
+        {"STREAMING_HIZ", mHiZ ? "1" : "0"},
         {0, 0}
     };
 
@@ -79,6 +110,17 @@ App::App(ID3D11Device *d3dDevice, unsigned int activeLights, unsigned int msaaSa
 
     mStreamingGBufferPS = new PixelShader(d3dDevice, L"Shaders/StreamingGBuffer.fx", "StreamingGBufferPS", defines);
     mStreamingResolvePS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolvePS", defines);
+    mStreamingResolveTiledPS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveTiledPS", defines);
+    mStreamingResolveClusteredPS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveClusteredPS", defines);
+    mStreamingLightCullCS = new ComputeShader(d3dDevice, L"Shaders/StreamingLightCull.fx", "StreamingLightCullCS", defines);
+    mStreamingResolveSimplePS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveSimplePS", defines);
+    mStreamingResolveSimpleTiledPS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveSimpleTiledPS", defines);
+    mStreamingResolveSimpleClusteredPS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveSimpleClusteredPS", defines);
+    mStreamingResolveComplexCS = new ComputeShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveComplexCS", defines);
+    mStreamingResolveComplexTiledCS = new ComputeShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveComplexTiledCS", defines);
+    mStreamingResolveComplexClusteredCS = new ComputeShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingResolveComplexClusteredCS", defines);
+    mStreamingComplexPixelVS = new VertexShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingComplexPixelVS", defines);
+    mStreamingComplexPixelPS = new PixelShader(d3dDevice, L"Shaders/StreamingResolve.fx", "StreamingComplexPixelPS", defines);
 
     mStreamingGBufferNdiPS = new PixelShader(d3dDevice, L"Shaders/StreamingGBufferNdi.fx", "StreamingGBufferPS", defines);
 
@@ -199,6 +241,21 @@ App::App(ID3D11Device *d3dDevice, unsigned int activeLights, unsigned int msaaSa
         d3dDevice->CreateBuffer(&desc, 0, &mPerFrameConstants);
     }
 
+    // Indirect arguments of the compacted resolve, counted up by StreamingResolveSimplePS
+    {
+        CD3D11_BUFFER_DESC desc(
+            sizeof(UINT) * STREAMING_COMPLEX_ARGS_COUNT,
+            D3D11_BIND_UNORDERED_ACCESS,
+            D3D11_USAGE_DEFAULT,
+            0,
+            D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS | D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS);
+        d3dDevice->CreateBuffer(&desc, 0, &mComplexPixelArgs);
+
+        CD3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc(mComplexPixelArgs, DXGI_FORMAT_R32_TYPELESS, 0,
+                                                  STREAMING_COMPLEX_ARGS_COUNT, D3D11_BUFFER_UAV_FLAG_RAW);
+        d3dDevice->CreateUnorderedAccessView(mComplexPixelArgs, &uavDesc, &mComplexPixelArgsUAV);
+    }
+
     // Create sampler state
     {
         CD3D11_SAMPLER_DESC desc(D3D11_DEFAULT);
@@ -234,6 +291,8 @@ App::~App()
     SAFE_RELEASE(mDepthBufferReadOnlyDSV);
     delete mLightBuffer;
     SAFE_RELEASE(mDiffuseSampler);
+    SAFE_RELEASE(mComplexPixelArgsUAV);
+    SAFE_RELEASE(mComplexPixelArgs);
     SAFE_RELEASE(mPerFrameConstants);
     SAFE_RELEASE(mLightingBlendState);
     SAFE_RELEASE(mGeometryBlendState);
@@ -266,6 +325,17 @@ App::~App()
     delete mGeometryVS;
     delete mStreamingGBufferPS;
     delete mStreamingResolvePS;
+    delete mStreamingResolveTiledPS;
+    delete mStreamingResolveClusteredPS;
+    delete mStreamingLightCullCS;
+    delete mStreamingResolveSimplePS;
+    delete mStreamingResolveSimpleTiledPS;
+    delete mStreamingResolveSimpleClusteredPS;
+    delete mStreamingResolveComplexCS;
+    delete mStreamingResolveComplexTiledCS;
+    delete mStreamingResolveComplexClusteredCS;
+    delete mStreamingComplexPixelVS;
+    delete mStreamingComplexPixelPS;
     delete mStreamingSkyboxPS;
     for (int i = 0; i < GPUQ_COUNT; i++) {
         SAFE_RELEASE(mQuery[i][0]);
@@ -374,18 +444,75 @@ void App::OnD3D11ResizedSwapChain(ID3D11Device* d3dDevice,
     mGBufferSRV.back() = mDepthBuffer->GetShaderResource();
 
     // Uav used for streaming SBAA
-    mMergeUav = shared_ptr<StructuredBuffer<MergeNodePacked> >(new StructuredBuffer<MergeNodePacked>(
-        d3dDevice, mGBufferWidth * mGBufferHeight * STREAMING_MAX_SURFACES_PER_PIXEL,
-        D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE));
+    // The node pool hands out blocks with the hidden counter of the merge buffer
+    unsigned mergeNodeCount = GetMergeBufferNodeCount(mGBufferWidth, mGBufferHeight, mSurfacesPerPixel);
+    UINT mergeUavFlags = 0;
+    if (mNodePoolPercent > 0) {
+        unsigned poolBlocks = (unsigned)((unsigned long long)mGBufferWidth * mGBufferHeight * mNodePoolPercent / 100);
+        mergeNodeCount = GetPooledMergeBufferNodeCount(mGBufferWidth, mGBufferHeight, mSurfacesPerPixel, poolBlocks);
+        mergeUavFlags = D3D11_BUFFER_UAV_FLAG_COUNTER;
+    }
+    mMergeUav.reset();
+    mMergeCompactUav.reset();
+    mMergeWideUav.reset();
+    if (mCompactMergeNodes) {
+        mMergeCompactUav = shared_ptr<StructuredBuffer<MergeNodeCompact> >(new StructuredBuffer<MergeNodeCompact>(
+            d3dDevice, mergeNodeCount, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE,
+            false, mergeUavFlags));
+    } else if (mWideCoverage) {
+        mMergeWideUav = shared_ptr<StructuredBuffer<MergeNodeWide> >(new StructuredBuffer<MergeNodeWide>(
+            d3dDevice, mergeNodeCount, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE,
+            false, mergeUavFlags));
+    } else {
+        mMergeUav = shared_ptr<StructuredBuffer<MergeNodePacked> >(new StructuredBuffer<MergeNodePacked>(
+            d3dDevice, mergeNodeCount, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE,
+            false, mergeUavFlags));
+    }
+
+    // Recreated at the new size by the next tiled streaming resolve
+    mTileLightLists.reset();
+
+    // An offset and a count per cluster; SetupLightClusters sizes the indices
+    {
+        unsigned tilesX = GetClusterTilesX(mGBufferWidth, STREAMING_CLUSTER_TILE_DIM);
+        unsigned tilesY = GetClusterTilesY(mGBufferHeight, STREAMING_CLUSTER_TILE_DIM);
+        mClusterRanges = shared_ptr<StructuredBuffer<unsigned int> >(new StructuredBuffer<unsigned int>(
+            d3dDevice, tilesX * tilesY * STREAMING_CLUSTER_SLICES * 2, D3D11_BIND_SHADER_RESOURCE, true));
+        mClusterLightIndices.reset();
+        mClusterLightIndexCapacity = 0;
+    }
+
+    // Room for every pixel, StreamingResolveSimplePS does not check
+    mComplexPixels = shared_ptr<StructuredBuffer<ComplexPixel> >(new StructuredBuffer<ComplexPixel>(
+        d3dDevice, mGBufferWidth * mGBufferHeight, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE));
 
     mCountTexture = (shared_ptr<Texture2D>(new Texture2D(
         d3dDevice, mGBufferWidth, mGBufferHeight, DXGI_FORMAT_R32_UINT,
         D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS)));
+    // Clears the new count texture on the next frame
+    mFrameEpoch = 0;
 
 #if defined(STREAMING_USE_LIST_TEXTURE)
     mListTexture = (shared_ptr<Texture2D>(new Texture2D(
         d3dDevice, mGBufferWidth, mGBufferHeight, DXGI_FORMAT_R32_UINT,
         D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS)));
+
+    // Only read for pixels that allocated a block this frame, so it is never cleared
+    mPoolIndexTexture.reset();
+    if (mNodePoolPercent > 0) {
+        mPoolIndexTexture = (shared_ptr<Texture2D>(new Texture2D(
+            d3dDevice, mGBufferWidth, mGBufferHeight, DXGI_FORMAT_R32_UINT,
+            D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS)));
+    }
+
+    // Cleared every frame by RenderGBufferStreaming
+    mHiZTiles.reset();
+    if (mHiZ) {
+        unsigned int tilesX = (mGBufferWidth + STREAMING_HIZ_TILE_DIM - 1) / STREAMING_HIZ_TILE_DIM;
+        unsigned int tilesY = (mGBufferHeight + STREAMING_HIZ_TILE_DIM - 1) / STREAMING_HIZ_TILE_DIM;
+        mHiZTiles = shared_ptr<StructuredBuffer<HiZTile> >(new StructuredBuffer<HiZTile>(
+            d3dDevice, tilesX * tilesY, D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE));
+    }
 #endif // defined(STREAMING_USE_LIST_TEXTURE)
 
 #if defined(STREAMING_DEBUG_OPTIONS)
@@ -397,9 +524,8 @@ void App::OnD3D11ResizedSwapChain(ID3D11Device* d3dDevice,
 
 void App::InitializeLightParameters(ID3D11Device* d3dDevice)
 {
-    mPointLightParameters.resize(MAX_LIGHTS);
-    mLightInitialTransform.resize(MAX_LIGHTS);
-    mPointLightPositionWorld.resize(MAX_LIGHTS);
+    static_assert(sizeof(PointLight) == sizeof(StreamingCpu::PointLight), "PointLight layouts differ");
+    mLightStore.Resize(MAX_LIGHTS);
 
     // Use a constant seed for consistency
     std::tr1::mt19937 rng(1337);
@@ -416,8 +542,8 @@ void App::InitializeLightParameters(ID3D11Device* d3dDevice)
     const float attenuationStartFactor = 0.8f;
 
     // NOTE(ebk) - this is a hack to get light #0 always shining on the teapot.
-    PointLight &params = mPointLightParameters[0];
-    PointLightInitTransform &init = mLightInitialTransform[0];
+    PointLight params;
+    PointLightInitTransform init;
     init.radius = std::sqrt(radiusNormDist(rng)) * maxRadius;
     init.angle = angleDist(rng);
     init.height = heightDist(rng);
@@ -426,11 +552,10 @@ void App::InitializeLightParameters(ID3D11Device* d3dDevice)
     params.color = intensityDist(rng) * HueToRGB(hueDist(rng));
     params.attenuationEnd = 100.0f;
     params.attenuationBegin = 0.8 * 100.0f;
+    mLightStore.SetLight(0, init.radius, init.angle, init.height, init.animationSpeed,
+                         reinterpret_cast<const StreamingCpu::PointLight&>(params));
 
     for (unsigned int i = 1; i < MAX_LIGHTS; ++i) {
-        PointLight& params = mPointLightParameters[i];
-        PointLightInitTransform& init = mLightInitialTransform[i];
-
         init.radius = std::sqrt(radiusNormDist(rng)) * maxRadius;
         init.angle = angleDist(rng);
         init.height = heightDist(rng);
@@ -441,6 +566,17 @@ void App::InitializeLightParameters(ID3D11Device* d3dDevice)
         params.color = intensityDist(rng) * HueToRGB(hueDist(rng));
         params.attenuationEnd = attenuationDist(rng);
         params.attenuationBegin = attenuationStartFactor * params.attenuationEnd;
+        mLightStore.SetLight(i, init.radius, init.angle, init.height, init.animationSpeed,
+                             reinterpret_cast<const StreamingCpu::PointLight&>(params));
+    }
+}
+
+
+void App::SetTiledLightCulling(bool tiledLightCulling)
+{
+    mTiledLightCulling = tiledLightCulling;
+    if (!mTiledLightCulling) {
+        mTileLightLists.reset();
     }
 }
 
@@ -450,7 +586,18 @@ void App::SetActiveLights(ID3D11Device* d3dDevice, unsigned int activeLights)
     mActiveLights = activeLights;
 
     delete mLightBuffer;
-    mLightBuffer = new StructuredBuffer<PointLight>(d3dDevice, activeLights, D3D11_BIND_SHADER_RESOURCE, true);
+    mLightBuffer = 0;
+    mLightRing.reset();
+    mLightRingBuffer.reset();
+    if (StructuredRingBuffer<PointLight>::IsSupported(d3dDevice)) {
+        // Every allocation is a frame's lights, so the ring only ever has LIGHT_UPLOAD_FRAMES views
+        mLightRingBuffer = shared_ptr<StructuredRingBuffer<PointLight> >(new StructuredRingBuffer<PointLight>(
+            d3dDevice, LIGHT_UPLOAD_FRAMES * activeLights));
+        mLightRing = shared_ptr<StreamingCpu::UploadRing>(new StreamingCpu::UploadRing(
+            mLightRingBuffer.get(), LIGHT_UPLOAD_FRAMES));
+    } else {
+        mLightBuffer = new StructuredBuffer<PointLight>(d3dDevice, activeLights, D3D11_BIND_SHADER_RESOURCE, true);
+    }
     
     // Make sure all the active lights are set up
     Move(0.0f);
@@ -461,15 +608,8 @@ void App::Move(float elapsedTime)
 {
     mTotalTime += elapsedTime;
 
-    // Update positions of active lights
-    for (unsigned int i = 0; i < mActiveLights; ++i) {
-        const PointLightInitTransform& initTransform = mLightInitialTransform[i];
-        float angle = initTransform.angle + mTotalTime * initTransform.animationSpeed;
-        mPointLightPositionWorld[i] = D3DXVECTOR3(
-            initTransform.radius * std::cos(angle),
-            initTransform.height,
-            initTransform.radius * std::sin(angle));
-    }
+    // SetupLights places the active lights at mTotalTime
+    mLightsMoved = true;
 }
 
 
@@ -485,6 +625,18 @@ void App::Render(ID3D11DeviceContext* d3dDeviceContext,
 {
     D3DXMATRIXA16 cameraProj = *viewerCamera->GetProjMatrix();
     D3DXMATRIXA16 cameraView = *viewerCamera->GetViewMatrix();
+
+#if STREAMING_EPOCH_COUNTS
+    // Count words of the last frame read as empty, so the resolve does not
+    // clear them. Only a wrapped epoch could match a stale word again.
+    if (mFrameEpoch == 0 || mFrameEpoch == STREAMING_EPOCH_MAX) {
+        const UINT zeros[4] = {0, 0, 0, 0};
+        d3dDeviceContext->ClearUnorderedAccessViewUint(mCountTexture->GetUnorderedAccess(), zeros);
+        mFrameEpoch = 1;
+    } else {
+        ++mFrameEpoch;
+    }
+#endif // STREAMING_EPOCH_COUNTS
     
     D3DXMATRIXA16 cameraViewInv;
     D3DXMatrixInverse(&cameraViewInv, 0, &cameraView);
@@ -508,13 +660,20 @@ void App::Render(ID3D11DeviceContext* d3dDeviceContext,
 
         constants->mFramebufferDimensionsX = mGBufferWidth;
         constants->mFramebufferDimensionsY = mGBufferHeight;
-        constants->mFramebufferDimensionsZ = 0;     // Unused
+        constants->mFramebufferDimensionsZ = mFrameEpoch;
         constants->mFramebufferDimensionsW = 0;     // Unused
 
         constants->mUI = *ui;
 
         d3dDeviceContext->Unmap(mPerFrameConstants, 0);
     }
+    {
+        D3DXMATRIXA16 cameraWorldView = worldMatrix * cameraView;
+        memcpy(mSnapshotCamera.worldView, &cameraWorldView, sizeof(mSnapshotCamera.worldView));
+        memcpy(mSnapshotCamera.proj, &cameraProj, sizeof(mSnapshotCamera.proj));
+        mSnapshotCamera.nearFar[0] = viewerCamera->GetFarClip();
+        mSnapshotCamera.nearFar[1] = viewerCamera->GetNearClip();
+    }
     // Geometry phase
     if (mesh_opaque.IsLoaded()) {
         mesh_opaque.ComputeInFrustumFlags(cameraWorldViewProj);
@@ -524,7 +683,8 @@ void App::Render(ID3D11DeviceContext* d3dDeviceContext,
     }
 
     // Setup lights
-    ID3D11ShaderResourceView *lightBufferSRV = SetupLights(d3dDeviceContext, cameraView);
+    ID3D11ShaderResourceView *lightBufferSRV = SetupLights(d3dDeviceContext, cameraView,
+        ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI_CLUSTERED);
     // Forward rendering takes a different path here
     if (ui->lightCullTechnique == CULL_FORWARD_NONE) {
         StartTimer(d3dDeviceContext, mQuery[GPUQ_FORWARD]);
@@ -535,19 +695,41 @@ void App::Render(ID3D11DeviceContext* d3dDeviceContext,
         RenderForward(d3dDeviceContext, mesh_opaque, mesh_alpha, lightBufferSRV, viewerCamera, viewport, ui, true);
         StopTimer(d3dDeviceContext, mQuery[GPUQ_FORWARD]);
     } else if (ui->lightCullTechnique == CULL_STREAMING_SBAA ||
-               ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI) {
+               ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI ||
+               ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI_CLUSTERED) {
 
         PixelShader *gBufferPS = ui->lightCullTechnique == CULL_STREAMING_SBAA ? mStreamingGBufferPS :
                                                            mStreamingGBufferNdiPS;
 
-        PixelShader *resolvePS = mStreamingResolvePS;
+        // The clusters replace the tile lists
+        bool clusteredLights = ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI_CLUSTERED;
+        bool tiledLights = mTiledLightCulling && !clusteredLights;
+        PixelShader *resolvePS = clusteredLights ? mStreamingResolveClusteredPS :
+                                 tiledLights ? mStreamingResolveTiledPS : mStreamingResolvePS;
+        ComputeShader *complexCS = 0;
+        if (UseResolveCompaction()) {
+            resolvePS = clusteredLights ? mStreamingResolveSimpleClusteredPS :
+                        tiledLights ? mStreamingResolveSimpleTiledPS : mStreamingResolveSimplePS;
+            complexCS = clusteredLights ? mStreamingResolveComplexClusteredCS :
+                        tiledLights ? mStreamingResolveComplexTiledCS : mStreamingResolveComplexCS;
+        }
+
+        // Only depends on the lights, so the CPU can build it before the g-buffer
+        if (clusteredLights) {
+            SetupLightClusters(d3dDeviceContext, cameraProj, viewerCamera);
+        }
 
         StartTimer(d3dDeviceContext, mQuery[GPUQ_FORWARD]);
         RenderGBufferStreaming(d3dDeviceContext, mesh_opaque, mesh_alpha, viewerCamera, viewport, ui, gBufferPS);
         StopTimer(d3dDeviceContext, mQuery[GPUQ_FORWARD]);
 
+        // Culling is part of the resolve cost
         StartTimer(d3dDeviceContext, mQuery[GPUQ_RESOLVE]);
-        ComputeLightingStreaming(d3dDeviceContext, backBuffer, lightBufferSRV, skybox, viewport, ui, resolvePS);
+        if (tiledLights) {
+            CullLightsStreaming(d3dDeviceContext, lightBufferSRV);
+        }
+        ComputeLightingStreaming(d3dDeviceContext, backBuffer, lightBufferSRV, skybox, viewport, ui, resolvePS,
+                                 complexCS);
         StopTimer(d3dDeviceContext, mQuery[GPUQ_RESOLVE]);
 
         return;
@@ -570,28 +752,114 @@ void App::Render(ID3D11DeviceContext* d3dDeviceContext,
 
 
 ID3D11ShaderResourceView * App::SetupLights(ID3D11DeviceContext* d3dDeviceContext,
-                                            const D3DXMATRIXA16& cameraView)
+                                            const D3DXMATRIXA16& cameraView,
+                                            bool viewLights)
 {
-    // Transform light world positions into view space and store in our parameters array
-    D3DXVec3TransformCoordArray(&mPointLightParameters[0].positionView, sizeof(PointLight),
-        &mPointLightPositionWorld[0], sizeof(D3DXVECTOR3), &cameraView, mActiveLights);
+    // Animate the lights at mTotalTime and transform them into view space
+    StreamingCpu::LightAnimationFrame frame;
+    frame.time = mTotalTime;
+    memcpy(frame.worldToView, &cameraView, sizeof(frame.worldToView));
+
+    // Straight into the shader buffer, which is write-combined, so nothing reads it back. The clusters
+    // need the lights on the CPU too, copying them is cheaper than animating them twice.
+    unsigned int lightOffset = 0;
+    StreamingCpu::PointLight* destination = 0;
+    if (viewLights) {
+        mViewLights.resize(mActiveLights);
+        destination = &mViewLights[0];
+    } else {
+        destination = reinterpret_cast<StreamingCpu::PointLight*>(MapLights(d3dDeviceContext, lightOffset));
+    }
+    mLightStore.Animate(frame, mActiveLights, destination, StreamingCpu::GetMaxSimdLevel(), mThreadPool.get());
+
+    // NOTE(ebk) - this is a hack to get light #0 always shining on the teapot
+    // while the animation is paused.
+    if (!mLightsMoved) {
+        const D3DXVECTOR3 teapot(4.744f, 3.208f, -4.43f);
+        D3DXVECTOR3 teapotView;
+        D3DXVec3TransformCoord(&teapotView, &teapot, &cameraView);
+        memcpy(destination[0].positionView, &teapotView, sizeof(destination[0].positionView));
+    }
+    mLightsMoved = false;
 
-    // NOTE(ebk) - this is a hack to get light #0 always shining on the teapot.
-    mPointLightPositionWorld[0] = D3DXVECTOR3(4.744, 3.208, -4.43);
-    
-    // Copy light list into shader buffer
-    {
-        PointLight* light = mLightBuffer->MapDiscard(d3dDeviceContext);
-        for (unsigned int i = 0; i < mActiveLights; ++i) {
-            light[i] = mPointLightParameters[i];
-        }
-        mLightBuffer->Unmap(d3dDeviceContext);
+    if (viewLights) {
+        PointLight* light = MapLights(d3dDeviceContext, lightOffset);
+        memcpy(light, destination, mActiveLights * sizeof(PointLight));
     }
-    
+
+    if (mLightRing) {
+        mLightRing->Unmap();
+        return mLightRingBuffer->GetShaderResource(lightOffset, mActiveLights);
+    }
+    mLightBuffer->Unmap(d3dDeviceContext);
     return mLightBuffer->GetShaderResource();
 }
 
 
+PointLight* App::MapLights(ID3D11DeviceContext* d3dDeviceContext, unsigned int& lightOffset)
+{
+    if (!mLightRing) {
+        lightOffset = 0;
+        return mLightBuffer->MapDiscard(d3dDeviceContext);
+    }
+
+    // The last frame's fence goes in with this frame's lights, after every draw that read its own
+    if (mLightRing->IsFrameOpen()) {
+        mLightRing->EndFrame();
+    }
+    mLightRing->BeginFrame();
+
+    // The ring holds LIGHT_UPLOAD_FRAMES frames of lights, so this always fits
+    unsigned char* lights = mLightRing->Allocate(mActiveLights * sizeof(PointLight), sizeof(PointLight),
+                                                 lightOffset);
+    assert(lights);
+    return reinterpret_cast<PointLight*>(lights);
+}
+
+
+void App::SetupLightClusters(ID3D11DeviceContext* d3dDeviceContext,
+                             const D3DXMATRIXA16& cameraProj,
+                             const CFirstPersonCamera* viewerCamera)
+{
+    // NOTE: Complementary Z => swap near/far back, like mCameraNearFar
+    StreamingCpu::ViewConstants view;
+    view.proj11 = cameraProj._11;
+    view.proj22 = cameraProj._22;
+    view.nearZ = viewerCamera->GetFarClip();
+    view.farZ = viewerCamera->GetNearClip();
+    view.width = mGBufferWidth;
+    view.height = mGBufferHeight;
+
+    mLightClusterStats = StreamingCpu::LightClusterStats();
+    mLightClusters.Build(view, &mViewLights[0], mActiveLights, 0, StreamingCpu::GetMaxSimdLevel(), mThreadPool.get(),
+                         mLightClusterStats);
+
+    const std::vector<unsigned>& ranges = mLightClusters.GetClusterRanges();
+    const std::vector<unsigned>& indices = mLightClusters.GetLightIndices();
+    {
+        unsigned int* mapped = mClusterRanges->MapDiscard(d3dDeviceContext);
+        memcpy(mapped, &ranges[0], ranges.size() * sizeof(unsigned int));
+        mClusterRanges->Unmap(d3dDeviceContext);
+    }
+
+    // Dynamic buffers cannot be empty, and grow by half again when too small
+    unsigned int indexCount = static_cast<unsigned int>(indices.size());
+    if (!mClusterLightIndices || indexCount > mClusterLightIndexCapacity) {
+        mClusterLightIndexCapacity = std::max(indexCount + indexCount / 2, 1024u);
+        ID3D11Device* d3dDevice = 0;
+        d3dDeviceContext->GetDevice(&d3dDevice);
+        mClusterLightIndices = shared_ptr<StructuredBuffer<unsigned int> >(new StructuredBuffer<unsigned int>(
+            d3dDevice, mClusterLightIndexCapacity, D3D11_BIND_SHADER_RESOURCE, true));
+        SAFE_RELEASE(d3dDevice);
+    }
+    if (indexCount > 0) {
+        unsigned int* mapped = mClusterLightIndices->MapDiscard(d3dDeviceContext);
+        memcpy(mapped, &indices[0], indexCount * sizeof(unsigned int));
+        mClusterLightIndices->Unmap(d3dDeviceContext);
+    }
+}
+
+
 ID3D11ShaderResourceView * App::RenderForward(ID3D11DeviceContext* d3dDeviceContext,
                                               CDXUTSDKMesh& mesh_opaque,
                                               CDXUTSDKMesh& mesh_alpha,
@@ -941,6 +1209,7 @@ void App::RenderSkyboxAndToneMap(ID3D11DeviceContext* d3dDeviceContext,
     case CULL_COMPUTE_SHADER_TILE:
     case CULL_STREAMING_SBAA:
     case CULL_STREAMING_SBAA_NDI:
+    case CULL_STREAMING_SBAA_NDI_CLUSTERED:
         litViews[1] = mLitBufferCS->GetShaderResource();
         break;
     default:
@@ -988,28 +1257,38 @@ void App::RenderGBufferStreaming(ID3D11DeviceContext* d3dDeviceContext,
     d3dDeviceContext->PSSetSamplers(0, 1, &mDiffuseSampler);
 
 #if defined(STREAMING_USE_LIST_TEXTURE)
-    int uavCount = 3;
-    ID3D11UnorderedAccessView* unorderedAccessViews[3] = {
-        mMergeUav->GetUnorderedAccess(),
+    int uavCount = mHiZTiles ? 5 : (mPoolIndexTexture ? 4 : 3);
+    ID3D11UnorderedAccessView* unorderedAccessViews[5] = {
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess(),
-        mListTexture->GetUnorderedAccess() };
+        mListTexture->GetUnorderedAccess(),
+        mPoolIndexTexture ? mPoolIndexTexture->GetUnorderedAccess() : 0,
+        mHiZTiles ? mHiZTiles->GetUnorderedAccess() : 0 };
+
+    // Tiles only become more occluded during a frame
+    if (mHiZTiles) {
+        const UINT zeros[4] = {0, 0, 0, 0};
+        d3dDeviceContext->ClearUnorderedAccessViewUint(mHiZTiles->GetUnorderedAccess(), zeros);
+    }
 #else // !defined(STREAMING_USE_LIST_TEXTURE)
 #if defined(STREAMING_DEBUG_OPTIONS)
     int uavCount = 3;
     ID3D11UnorderedAccessView* unorderedAccessViews[3] = {
-        mMergeUav->GetUnorderedAccess(),
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess(),
         mStatsUav->GetUnorderedAccess() };
 #else // !defined(STREAMING_DEBUG_OPTIONS)
     int uavCount = 2;
     ID3D11UnorderedAccessView* unorderedAccessViews[2] = {
-        mMergeUav->GetUnorderedAccess(),
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess() };
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
 #endif // !defined(STREAMING_USE_LIST_TEXTURE)
 
     d3dDeviceContext->OMSetDepthStencilState(mDepthState, 0);
-    d3dDeviceContext->OMSetRenderTargetsAndUnorderedAccessViews(1, &mGBufferRTV.at(1), mDepthBufferStreaming->GetDepthStencil(), 3, uavCount, unorderedAccessViews, 0);
+    // Empties the node pool (the merge buffer counter) for the new frame
+    UINT uavInitialCounts[5] = {0, (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1};
+    d3dDeviceContext->OMSetRenderTargetsAndUnorderedAccessViews(1, &mGBufferRTV.at(1), mDepthBufferStreaming->GetDepthStencil(), 3, uavCount, unorderedAccessViews, uavInitialCounts);
     d3dDeviceContext->OMSetBlendState(mGeometryBlendState, 0, 0xFFFFFFFF);
 
     // Render opaque geometry
@@ -1031,13 +1310,86 @@ void App::RenderGBufferStreaming(ID3D11DeviceContext* d3dDeviceContext,
 }
 
 
+bool App::UseResolveCompaction() const
+{
+#if defined(STREAMING_DEBUG_OPTIONS)
+    // The visualizations come from StreamingResolvePS
+    return false;
+#else // !defined(STREAMING_DEBUG_OPTIONS)
+    // Without MSAA the resolve only shades the closest surface anyway
+    return mResolveCompaction && mMSAASamples > 1;
+#endif // !defined(STREAMING_DEBUG_OPTIONS)
+}
+
+
+void App::CullLightsStreaming(ID3D11DeviceContext* d3dDeviceContext,
+                             ID3D11ShaderResourceView *lightBufferSRV)
+{
+    unsigned int dispatchWidth = (mGBufferWidth + COMPUTE_SHADER_TILE_GROUP_DIM - 1) / COMPUTE_SHADER_TILE_GROUP_DIM;
+    unsigned int dispatchHeight = (mGBufferHeight + COMPUTE_SHADER_TILE_GROUP_DIM - 1) / COMPUTE_SHADER_TILE_GROUP_DIM;
+
+    // One list per tile, each with room for every light
+    if (!mTileLightLists) {
+        ID3D11Device* d3dDevice = 0;
+        d3dDeviceContext->GetDevice(&d3dDevice);
+        mTileLightLists = shared_ptr<StructuredBuffer<unsigned int> >(new StructuredBuffer<unsigned int>(
+            d3dDevice, dispatchWidth * dispatchHeight * (MAX_LIGHTS + 1),
+            D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE));
+        SAFE_RELEASE(d3dDevice);
+    }
+
+    d3dDeviceContext->CSSetConstantBuffers(0, 1, &mPerFrameConstants);
+    d3dDeviceContext->CSSetShaderResources(5, 1, &lightBufferSRV);
+
+    // Same slots as the G-buffer and resolve pixel shaders
+#if defined(STREAMING_USE_LIST_TEXTURE)
+    int uavCount = mPoolIndexTexture ? 4 : 3;
+    ID3D11UnorderedAccessView* unorderedAccessViews[4] = {
+        GetMergeUnorderedAccess(),
+        mCountTexture->GetUnorderedAccess(),
+        mListTexture->GetUnorderedAccess(),
+        mPoolIndexTexture ? mPoolIndexTexture->GetUnorderedAccess() : 0 };
+#else // !defined(STREAMING_USE_LIST_TEXTURE)
+#if defined(STREAMING_DEBUG_OPTIONS)
+    int uavCount = 3;
+    ID3D11UnorderedAccessView* unorderedAccessViews[4] = {
+        GetMergeUnorderedAccess(),
+        mCountTexture->GetUnorderedAccess(),
+        mStatsUav->GetUnorderedAccess() };
+#else // !defined(STREAMING_DEBUG_OPTIONS)
+    int uavCount = 2;
+    ID3D11UnorderedAccessView* unorderedAccessViews[4] = {
+        GetMergeUnorderedAccess(),
+        mCountTexture->GetUnorderedAccess() };
+#endif // !defined(STREAMING_DEBUG_OPTIONS)
+#endif // !defined(STREAMING_USE_LIST_TEXTURE)
+
+    // Keep the node pool counter
+    UINT uavInitialCounts[4] = {(UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1};
+    d3dDeviceContext->CSSetUnorderedAccessViews(3, uavCount, unorderedAccessViews, uavInitialCounts);
+
+    ID3D11UnorderedAccessView *tileLightListsUAV = mTileLightLists->GetUnorderedAccess();
+    d3dDeviceContext->CSSetUnorderedAccessViews(1, 1, &tileLightListsUAV, 0);
+    d3dDeviceContext->CSSetShader(mStreamingLightCullCS->GetShader(), 0, 0);
+    d3dDeviceContext->Dispatch(dispatchWidth, dispatchHeight, 1);
+
+    // The resolve binds the same buffers to the output merger
+    ID3D11UnorderedAccessView *nullUAVs[6] = {0, 0, 0, 0, 0, 0};
+    d3dDeviceContext->CSSetUnorderedAccessViews(1, 6, nullUAVs, 0);
+    ID3D11ShaderResourceView *nullSRV = 0;
+    d3dDeviceContext->CSSetShaderResources(5, 1, &nullSRV);
+    d3dDeviceContext->CSSetShader(0, 0, 0);
+}
+
+
 void App::ComputeLightingStreaming(ID3D11DeviceContext* d3dDeviceContext,
                           ID3D11RenderTargetView* backBuffer,
                           ID3D11ShaderResourceView *lightBufferSRV,
                           ID3D11ShaderResourceView* skybox,
                           const D3D11_VIEWPORT* viewport,
                           const UIConstants* ui,
-                          PixelShader *pixelShader)
+                          PixelShader *pixelShader,
+                          ComputeShader *complexCS)
 {
     // Clear
     const float zeros[4] = {0.0f, 0.0f, 0.0f, 0.0f};
@@ -1057,67 +1409,148 @@ void App::ComputeLightingStreaming(ID3D11DeviceContext* d3dDeviceContext,
     d3dDeviceContext->PSSetShaderResources(6, 1, &skybox);
     d3dDeviceContext->PSSetShaderResources(0, static_cast<UINT>(mGBufferSRV.size()), &mGBufferSRV.front());
     d3dDeviceContext->PSSetShaderResources(5, 1, &lightBufferSRV);
+    if (mTileLightLists) {
+        ID3D11ShaderResourceView *tileLightListsSRV = mTileLightLists->GetShaderResource();
+        d3dDeviceContext->PSSetShaderResources(7, 1, &tileLightListsSRV);
+    }
+    ID3D11ShaderResourceView *clusterSRVs[2] = {0, 0};
+    if (ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI_CLUSTERED) {
+        clusterSRVs[0] = mClusterRanges->GetShaderResource();
+        clusterSRVs[1] = mClusterLightIndices->GetShaderResource();
+        d3dDeviceContext->PSSetShaderResources(9, 2, clusterSRVs);
+    }
 
 #if defined(STREAMING_USE_LIST_TEXTURE)
-    int uavCount = 3;
-    ID3D11UnorderedAccessView* unorderedAccessViews[3] = {
-        mMergeUav->GetUnorderedAccess(),
+    int uavCount = mPoolIndexTexture ? 4 : 3;
+    ID3D11UnorderedAccessView* unorderedAccessViews[4] = {
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess(),
-        mListTexture->GetUnorderedAccess() };
+        mListTexture->GetUnorderedAccess(),
+        mPoolIndexTexture ? mPoolIndexTexture->GetUnorderedAccess() : 0 };
 #else // !defined(STREAMING_USE_LIST_TEXTURE)
 #if defined(STREAMING_DEBUG_OPTIONS)
     int uavCount = 3;
     ID3D11UnorderedAccessView* unorderedAccessViews[4] = {
-        mMergeUav->GetUnorderedAccess(),
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess(),
         mStatsUav->GetUnorderedAccess() };
 #else // !defined(STREAMING_DEBUG_OPTIONS)
     int uavCount = 2;
     ID3D11UnorderedAccessView* unorderedAccessViews[3] = {
-        mMergeUav->GetUnorderedAccess(),
+        GetMergeUnorderedAccess(),
         mCountTexture->GetUnorderedAccess() };
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
 #endif // !defined(STREAMING_USE_LIST_TEXTURE)
 
-    d3dDeviceContext->OMSetRenderTargetsAndUnorderedAccessViews(1, &backBuffer, 0, 3, uavCount, unorderedAccessViews, 0);
+    // The compacted resolve adds the complex pixel list and its arguments in front
+    UINT uavStartSlot = 3;
+    ID3D11UnorderedAccessView* resolveUnorderedAccessViews[6] = {
+        mComplexPixels->GetUnorderedAccess(),
+        mComplexPixelArgsUAV };
+    for (int i = 0; i < uavCount; ++i) {
+        resolveUnorderedAccessViews[2 + i] = unorderedAccessViews[i];
+    }
+    if (complexCS) {
+        const UINT complexPixelArgs[STREAMING_COMPLEX_ARGS_COUNT] = {0, 1, 0, 0, 0, 1, 1};
+        d3dDeviceContext->UpdateSubresource(mComplexPixelArgs, 0, 0, complexPixelArgs, 0, 0);
+        uavStartSlot = 1;
+    }
+
+    UINT uavInitialCounts[6] = {(UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1};
+    d3dDeviceContext->OMSetRenderTargetsAndUnorderedAccessViews(1, &backBuffer, 0, uavStartSlot, uavCount + 3 - uavStartSlot,
+        &resolveUnorderedAccessViews[uavStartSlot - 1], uavInitialCounts);
     d3dDeviceContext->OMSetBlendState(mGeometryBlendState, 0, 0xFFFFFFFF);
 
     // Do pixel frequency shading
     d3dDeviceContext->PSSetShader(pixelShader->GetShader(), 0, 0);
     mSkyboxMesh.Render(d3dDeviceContext);
 
+    if (complexCS) {
+        d3dDeviceContext->OMSetRenderTargets(0, 0, 0);
+
+        // Resolve the complex pixels densely packed
+        d3dDeviceContext->CSSetConstantBuffers(0, 1, &mPerFrameConstants);
+        d3dDeviceContext->CSSetShaderResources(5, 1, &lightBufferSRV);
+        if (mTileLightLists) {
+            ID3D11ShaderResourceView *tileLightListsSRV = mTileLightLists->GetShaderResource();
+            d3dDeviceContext->CSSetShaderResources(7, 1, &tileLightListsSRV);
+        }
+        d3dDeviceContext->CSSetShaderResources(9, 2, clusterSRVs);
+        d3dDeviceContext->CSSetUnorderedAccessViews(1, uavCount + 2, resolveUnorderedAccessViews, uavInitialCounts);
+        d3dDeviceContext->CSSetShader(complexCS->GetShader(), 0, 0);
+        d3dDeviceContext->DispatchIndirect(mComplexPixelArgs, STREAMING_COMPLEX_ARGS_GROUPS_X * sizeof(UINT));
+
+        ID3D11UnorderedAccessView *nullUAVs[6] = {0, 0, 0, 0, 0, 0};
+        d3dDeviceContext->CSSetUnorderedAccessViews(1, 6, nullUAVs, 0);
+        d3dDeviceContext->CSSetShader(0, 0, 0);
+
+        // And write them over the first pass, one point each
+        ID3D11ShaderResourceView *complexPixelsSRV = mComplexPixels->GetShaderResource();
+        d3dDeviceContext->VSSetShaderResources(8, 1, &complexPixelsSRV);
+        d3dDeviceContext->VSSetShader(mStreamingComplexPixelVS->GetShader(), 0, 0);
+        d3dDeviceContext->PSSetShader(mStreamingComplexPixelPS->GetShader(), 0, 0);
+        d3dDeviceContext->OMSetRenderTargets(1, &backBuffer, 0);
+        d3dDeviceContext->IASetInputLayout(0);
+        d3dDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
+        d3dDeviceContext->DrawInstancedIndirect(mComplexPixelArgs, STREAMING_COMPLEX_ARGS_VERTEX_COUNT * sizeof(UINT));
+        d3dDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+        ID3D11ShaderResourceView* nullSRV = 0;
+        d3dDeviceContext->VSSetShaderResources(8, 1, &nullSRV);
+    }
+
     d3dDeviceContext->VSSetShader(0, 0, 0);
     d3dDeviceContext->GSSetShader(0, 0, 0);
     d3dDeviceContext->PSSetShader(0, 0, 0);
     d3dDeviceContext->OMSetRenderTargets(0, 0, 0);
-    ID3D11ShaderResourceView* nullSRV[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    ID3D11ShaderResourceView* nullSRV[11] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     d3dDeviceContext->VSSetShaderResources(0, 8, nullSRV);
-    d3dDeviceContext->PSSetShaderResources(0, 8, nullSRV);
-    d3dDeviceContext->CSSetShaderResources(0, 8, nullSRV);
+    d3dDeviceContext->PSSetShaderResources(0, 11, nullSRV);
+    d3dDeviceContext->CSSetShaderResources(0, 11, nullSRV);
+}
+
+
+ID3D11Buffer* App::GetMergeBuffer()
+{
+    if (mCompactMergeNodes) {
+        return mMergeCompactUav->GetBuffer();
+    }
+    return mWideCoverage ? mMergeWideUav->GetBuffer() : mMergeUav->GetBuffer();
+}
+
+
+ID3D11UnorderedAccessView* App::GetMergeUnorderedAccess()
+{
+    if (mCompactMergeNodes) {
+        return mMergeCompactUav->GetUnorderedAccess();
+    }
+    return mWideCoverage ? mMergeWideUav->GetUnorderedAccess() : mMergeUav->GetUnorderedAccess();
 }
 
 
 void App::HandleMouseEvent(ID3D11DeviceContext* d3dDeviceContext, int xPos, int yPos)
 {
 #if defined(STREAMING_DEBUG_OPTIONS)
+    // Only the MergeNodePacked layout is inspected
+    if (!mMergeUav) {
+        return;
+    }
     D3D11_MAPPED_SUBRESOURCE mergeMap = mMergeUav->Map(d3dDeviceContext);
     MergeNodePacked* merge = (MergeNodePacked*) mergeMap.pData;
 
     D3D11_MAPPED_SUBRESOURCE statsMap = mStatsUav->Map(d3dDeviceContext);
     PixelStats* stats = (PixelStats*) statsMap.pData;
 
-    const unsigned tileLogX = 0;
-    const unsigned tileLogY = 1;
-    const unsigned surfaceWidth = mGBufferWidth >> tileLogX;
-    unsigned tileAddr2D[2]  = {xPos >> tileLogX, yPos >> tileLogY};
-    unsigned tileAddr1D  = (tileAddr2D[0] + surfaceWidth * tileAddr2D[1]) << (tileLogX + tileLogY);
-    unsigned pixelAddr2D[2] = {xPos & ((1 << tileLogX) - 1), yPos & ((1 << tileLogY) - 1)};
-    unsigned pixelAddr1D = (pixelAddr2D[1] << tileLogX) | pixelAddr2D[0];
-    unsigned offsetInTile = tileAddr1D | pixelAddr1D;
+    // Same mapping as GetNodeIndex in StreamingBuffers.hlsl
+    unsigned pixelAddress = GetPixelAddress(xPos, yPos, mGBufferWidth, STREAMING_ADDRESSING,
+                                            STREAMING_TILE_LOGX, STREAMING_TILE_LOGY);
+    unsigned planeSize = GetAddressingPlaneSize(mGBufferWidth, mGBufferHeight, STREAMING_ADDRESSING,
+                                                STREAMING_TILE_LOGX, STREAMING_TILE_LOGY);
 
-    MergeNodePacked *mergeNodes[3];
-    for (unsigned i = 0; i < 3; i++) {
-        mergeNodes[i] = merge + offsetInTile + (mGBufferHeight * mGBufferWidth * i);
+    MergeNodePacked *mergeNodes[STREAMING_SURFACES_PER_PIXEL_MAX_GPU];
+    for (unsigned i = 0; i < mSurfacesPerPixel; i++) {
+        mergeNodes[i] = merge + GetNodeAddress(pixelAddress, i, planeSize, mSurfacesPerPixel,
+                                               STREAMING_PIXEL_MAJOR_NODES);
     }
 
     stats = stats + (mGBufferWidth * yPos) + xPos;;
@@ -1127,11 +1560,140 @@ void App::HandleMouseEvent(ID3D11DeviceContext* d3dDeviceContext, int xPos, int
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 }
 
+#if STREAMING_EPOCH_COUNTS
+namespace {
 
-void App::SaveBackbufferToFile(ID3D11DeviceContext* d3dDeviceContext,
+// Copies an R32_UINT texture through a staging texture into width * height words
+std::vector<unsigned> ReadBackTexture(ID3D11DeviceContext* d3dDeviceContext, ID3D11Texture2D* texture)
+{
+    ID3D11Device* d3dDevice;
+    d3dDeviceContext->GetDevice(&d3dDevice);
+
+    D3D11_TEXTURE2D_DESC desc;
+    texture->GetDesc(&desc);
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    desc.BindFlags = 0;
+    desc.MiscFlags = 0;
+    ID3D11Texture2D* staging = 0;
+    HRESULT hr = d3dDevice->CreateTexture2D(&desc, 0, &staging);
+    assert(SUCCEEDED(hr));
+
+    d3dDeviceContext->CopyResource(staging, texture);
+    D3D11_MAPPED_SUBRESOURCE map;
+    hr = d3dDeviceContext->Map(staging, 0, D3D11_MAP_READ, 0, &map);
+    assert(SUCCEEDED(hr));
+
+    std::vector<unsigned> words(desc.Width * desc.Height);
+    for (UINT y = 0; y < desc.Height; ++y) {
+        memcpy(&words[desc.Width * y], (const unsigned char*)map.pData + map.RowPitch * y,
+               desc.Width * sizeof(unsigned));
+    }
+
+    d3dDeviceContext->Unmap(staging, 0);
+    SAFE_RELEASE(staging);
+    SAFE_RELEASE(d3dDevice);
+    return words;
+}
+
+// Reads pixels the way StreamingResolvePS does
+class AppSnapshotSource : public StreamingCpu::GBufferSnapshotSource
+{
+public:
+    AppSnapshotSource(const MergeNodePacked* merge, const std::vector<unsigned>& counts,
+                      const std::vector<unsigned>& lists, unsigned width, unsigned height,
+                      unsigned surfacesPerPixel, unsigned frameEpoch)
+        : mMerge(merge), mCounts(counts), mLists(lists), mWidth(width)
+        , mSurfacesPerPixel(surfacesPerPixel), mFrameEpoch(frameEpoch)
+        , mPlaneSize(GetAddressingPlaneSize(width, height, STREAMING_ADDRESSING,
+                                            STREAMING_TILE_LOGX, STREAMING_TILE_LOGY))
+    {
+        // STREAMING_NODE_INDEX_BITS and STREAMING_NODE_COUNT_BITS of the shaders
+        mIndexBits = surfacesPerPixel < 4 ? 2 : 3;
+        mCountMask = surfacesPerPixel < 4 ? 0x3 : (surfacesPerPixel < 8 ? 0x7 : 0xF);
+    }
+
+    unsigned GetPixel(unsigned x, unsigned y, MergeNodePacked* nodes, bool& discardedSamples) const
+    {
+        const unsigned count = mCounts[x + mWidth * y];
+        discardedSamples = false;
+        if ((count >> STREAMING_EPOCH_SHIFT) != mFrameEpoch) {
+            return 0;
+        }
+
+        const unsigned nodeCount = std::min(count & mCountMask, mSurfacesPerPixel);
+#if defined(STREAMING_USE_LIST_TEXTURE)
+        const unsigned nodeList = nodeCount > 1 ? mLists[x + mWidth * y] : 0;
+#else // !defined(STREAMING_USE_LIST_TEXTURE)
+        const unsigned nodeList = (count & 0xFC) >> 2;
+#endif // !defined(STREAMING_USE_LIST_TEXTURE)
+        const unsigned pixelAddress = GetPixelAddress(x, y, mWidth, STREAMING_ADDRESSING,
+                                                      STREAMING_TILE_LOGX, STREAMING_TILE_LOGY);
+        for (unsigned i = 0; i < nodeCount; ++i) {
+            unsigned index = (nodeList >> (i * mIndexBits)) & ((1u << mIndexBits) - 1);
+            nodes[i] = mMerge[GetNodeAddress(pixelAddress, index, mPlaneSize, mSurfacesPerPixel,
+                                             STREAMING_PIXEL_MAJOR_NODES)];
+        }
+        discardedSamples = ((count >> 9) & 0x1) != 0;
+        return nodeCount;
+    }
+
+private:
+    // Not implemented
+    AppSnapshotSource& operator=(const AppSnapshotSource&);
+
+    const MergeNodePacked* mMerge;
+    const std::vector<unsigned>& mCounts;
+    const std::vector<unsigned>& mLists;
+    unsigned mWidth;
+    unsigned mSurfacesPerPixel;
+    unsigned mFrameEpoch;
+    unsigned mPlaneSize;
+    unsigned mIndexBits;
+    unsigned mCountMask;
+};
+
+} // namespace
+#endif // STREAMING_EPOCH_COUNTS
+
+bool App::SaveGBufferSnapshot(ID3D11DeviceContext* d3dDeviceContext, const char* path)
+{
+#if STREAMING_EPOCH_COUNTS
+    if (!mMergeUav || mNodePoolPercent > 0 || mFrameEpoch == 0) {
+        return false;
+    }
+
+    std::vector<unsigned> counts = ReadBackTexture(d3dDeviceContext, mCountTexture->GetTexture());
+#if defined(STREAMING_USE_LIST_TEXTURE)
+    std::vector<unsigned> lists = ReadBackTexture(d3dDeviceContext, mListTexture->GetTexture());
+#else // !defined(STREAMING_USE_LIST_TEXTURE)
+    std::vector<unsigned> lists;
+#endif // !defined(STREAMING_USE_LIST_TEXTURE)
+
+    StreamingCpu::GBufferSnapshotDesc desc;
+    desc.width = mGBufferWidth;
+    desc.height = mGBufferHeight;
+    desc.msaaSamples = mMSAASamples;
+    desc.surfacesPerPixel = mSurfacesPerPixel;
+    desc.camera = mSnapshotCamera;
+    desc.compression = StreamingCpu::GBUFFER_SNAPSHOT_COMPRESSION_LZ4;
+
+    D3D11_MAPPED_SUBRESOURCE mergeMap = mMergeUav->Map(d3dDeviceContext);
+    AppSnapshotSource source((const MergeNodePacked*) mergeMap.pData, counts, lists,
+                             mGBufferWidth, mGBufferHeight, mSurfacesPerPixel, mFrameEpoch);
+    bool written = StreamingCpu::WriteGBufferSnapshot(path, desc, source);
+    mMergeUav->Unmap(d3dDeviceContext);
+    return written;
+#else // !STREAMING_EPOCH_COUNTS
+    // The resolve has cleared the counts of the last frame by now
+    return false;
+#endif // !STREAMING_EPOCH_COUNTS
+}
+
+
+HRESULT App::CaptureBackbuffer(ID3D11DeviceContext* d3dDeviceContext,
                                ID3D11RenderTargetView* backBuffer,
-                               const char* filename,
-                               int format)
+                               DirectX::ScratchImage& image)
 {
     ID3D11Device* d3dDevice;
     d3dDeviceContext->GetDevice(&d3dDevice);
@@ -1139,9 +1701,20 @@ void App::SaveBackbufferToFile(ID3D11DeviceContext* d3dDeviceContext,
     ID3D11Resource* resource;
     backBuffer->GetResource(&resource);
 
+    HRESULT hr = DirectX::CaptureTexture(d3dDevice, d3dDeviceContext, resource, image);
+
+    SAFE_RELEASE(resource);
+    SAFE_RELEASE(d3dDevice);
+    return hr;
+}
+
+void App::SaveBackbufferToFile(ID3D11DeviceContext* d3dDeviceContext,
+                               ID3D11RenderTargetView* backBuffer,
+                               const char* filename,
+                               int format)
+{
     DirectX::ScratchImage imageResult;
-    ID3D11Texture2D* texture = static_cast<ID3D11Texture2D*>(resource);
-    HRESULT hr = DirectX::CaptureTexture(d3dDevice, d3dDeviceContext, texture, imageResult);
+    HRESULT hr = CaptureBackbuffer(d3dDeviceContext, backBuffer, imageResult);
     assert(SUCCEEDED(hr) && "Failed to capture texture");
 
     const DirectX::Image* img = imageResult.GetImages();
@@ -1159,9 +1732,6 @@ void App::SaveBackbufferToFile(ID3D11DeviceContext* d3dDeviceContext,
     MultiByteToWideChar(0, 0, filename, -1, file, 128);
     hr = SaveToTGAFile(*imageResult.GetImage( 0, 0, 0 ), file);
     assert(SUCCEEDED(hr) && ("Failed save image to file"));
-
-    SAFE_RELEASE(resource);
-    SAFE_RELEASE(d3dDevice);
 }
 
 std::wostringstream App::GetFrameTimesHeader(const UIConstants *ui)
@@ -1181,6 +1751,7 @@ std::wostringstream App::GetFrameTimesHeader(const UIConstants *ui)
         break;
     case CULL_STREAMING_SBAA:
     case CULL_STREAMING_SBAA_NDI:
+    case CULL_STREAMING_SBAA_NDI_CLUSTERED:
     default:
         oss << "forward, lighting + resolve" << std::endl;
         break;
@@ -1214,6 +1785,7 @@ std::wostringstream App::GetFrameTimes(ID3D11DeviceContext* d3dDeviceContext,
             break;
         case CULL_STREAMING_SBAA:
         case CULL_STREAMING_SBAA_NDI:
+        case CULL_STREAMING_SBAA_NDI_CLUSTERED:
         default:
             oss << "Forward:" << GetTime(d3dDeviceContext, mQuery[GPUQ_FORWARD]) << std::endl;
             oss << "Lighting + resolve:" << GetTime(d3dDeviceContext, mQuery[GPUQ_RESOLVE]) << std::endl;
@@ -1236,6 +1808,7 @@ std::wostringstream App::GetFrameTimes(ID3D11DeviceContext* d3dDeviceContext,
             break;
         case CULL_STREAMING_SBAA:
         case CULL_STREAMING_SBAA_NDI:
+        case CULL_STREAMING_SBAA_NDI_CLUSTERED:
         default:
             oss << GetTime(d3dDeviceContext, mQuery[GPUQ_FORWARD]) << ", ";
             oss << GetTime(d3dDeviceContext, mQuery[GPUQ_RESOLVE]) << std::endl;
@@ -1247,6 +1820,23 @@ std::wostringstream App::GetFrameTimes(ID3D11DeviceContext* d3dDeviceContext,
 }
 
 
+float App::GetFrameTime(ID3D11DeviceContext* d3dDeviceContext, const UIConstants* ui)
+{
+    float time = GetTime(d3dDeviceContext, mQuery[GPUQ_FORWARD]) + GetTime(d3dDeviceContext, mQuery[GPUQ_RESOLVE]);
+    switch (ui->lightCullTechnique) {
+    case CULL_DEFERRED_NONE:
+    case CULL_QUAD:
+    case CULL_QUAD_DEFERRED_LIGHTING:
+    case CULL_COMPUTE_SHADER_TILE:
+        time += GetTime(d3dDeviceContext, mQuery[GPUQ_LIGHTING]);
+        break;
+    default:
+        break;
+    }
+    return time;
+}
+
+
 void App::StartTimer(ID3D11DeviceContext *d3dDeviceContext, ID3D11Query *queries[3])
 {
     d3dDeviceContext->Begin(queries[2]);
@@ -1297,6 +1887,7 @@ std::wostringstream App::GetFrameMemoryUsage(const UIConstants *ui, unsigned &to
     switch (ui->lightCullTechnique) {
     case CULL_STREAMING_SBAA:
     case CULL_STREAMING_SBAA_NDI:
+    case CULL_STREAMING_SBAA_NDI_CLUSTERED:
     case CULL_COMPUTE_SHADER_TILE:
     case CULL_FORWARD_NONE:
     case CULL_FORWARD_PREZ_NONE:
@@ -1330,6 +1921,7 @@ std::wostringstream App::GetFrameMemoryUsage(const UIConstants *ui, unsigned &to
         break;
     case CULL_STREAMING_SBAA:
     case CULL_STREAMING_SBAA_NDI:
+    case CULL_STREAMING_SBAA_NDI_CLUSTERED:
     default:
         break;
     }
@@ -1358,14 +1950,43 @@ std::wostringstream App::GetFrameMemoryUsage(const UIConstants *ui, unsigned &to
             break;
         case CULL_STREAMING_SBAA:
         case CULL_STREAMING_SBAA_NDI:
+        case CULL_STREAMING_SBAA_NDI_CLUSTERED:
             D3D11_BUFFER_DESC desc;
-            mMergeUav->GetBuffer()->GetDesc(&desc);
+            GetMergeBuffer()->GetDesc(&desc);
             unsigned mergeUavSize = desc.ByteWidth;
             total += mergeUavSize;
-            oss << "Merge uav: " << BYTES_TO_MB(mergeUavSize) << std::endl;
+            oss << "Merge uav (" << mSurfacesPerPixel << " surfaces, " << desc.StructureByteStride
+                << " bytes/node): " << BYTES_TO_MB(mergeUavSize) << std::endl;
+#if defined(STREAMING_USE_LIST_TEXTURE)
+            if (mPoolIndexTexture) {
+                unsigned poolIndexSize = mPoolIndexTexture->GetSizeInBytes();
+                total += poolIndexSize;
+                oss << "Node pool (" << mNodePoolPercent << "% of pixels), index texture: "
+                    << BYTES_TO_MB(poolIndexSize) << std::endl;
+            }
+#endif // defined(STREAMING_USE_LIST_TEXTURE)
             unsigned nodeCountSize = mCountTexture->GetSizeInBytes();
             total += nodeCountSize;
             oss << "Count texture: " << BYTES_TO_MB(nodeCountSize) << std::endl;
+            if (ui->lightCullTechnique == CULL_STREAMING_SBAA_NDI_CLUSTERED && mClusterLightIndices) {
+                D3D11_BUFFER_DESC rangeDesc, indexDesc;
+                mClusterRanges->GetBuffer()->GetDesc(&rangeDesc);
+                mClusterLightIndices->GetBuffer()->GetDesc(&indexDesc);
+                total += rangeDesc.ByteWidth + indexDesc.ByteWidth;
+                oss << "Cluster light lists: " << BYTES_TO_MB(rangeDesc.ByteWidth + indexDesc.ByteWidth)
+                    << " (CPU build " << mLightClusterStats.GetSeconds() * 1000.0 << " ms)" << std::endl;
+            } else if (mTiledLightCulling && mTileLightLists) {
+                D3D11_BUFFER_DESC tileDesc;
+                mTileLightLists->GetBuffer()->GetDesc(&tileDesc);
+                total += tileDesc.ByteWidth;
+                oss << "Tile light lists: " << BYTES_TO_MB(tileDesc.ByteWidth) << std::endl;
+            }
+            if (UseResolveCompaction()) {
+                D3D11_BUFFER_DESC complexDesc;
+                mComplexPixels->GetBuffer()->GetDesc(&complexDesc);
+                total += complexDesc.ByteWidth;
+                oss << "Complex pixel list: " << BYTES_TO_MB(complexDesc.ByteWidth) << std::endl;
+            }
             break;
     }
 
@@ -23,9 +23,20 @@
 #include <vector>
 #include <memory>
 #include "Shaders\StreamingStructs.h"
+#include "GBufferSnapshot.h"
+#include "LightAnimation.h"
+#include "LightClusters.h"
 
 #define BYTES_TO_MB(x) x / 131072.0f
 
+namespace DirectX {
+    class ScratchImage;
+}
+
+namespace StreamingCpu {
+    class ThreadPool;
+}
+
 enum LightCullTechnique {
     CULL_FORWARD_NONE = 0,
     CULL_FORWARD_PREZ_NONE,
@@ -34,7 +45,8 @@ enum LightCullTechnique {
     CULL_QUAD_DEFERRED_LIGHTING,
     CULL_COMPUTE_SHADER_TILE,
     CULL_STREAMING_SBAA,
-    CULL_STREAMING_SBAA_NDI
+    CULL_STREAMING_SBAA_NDI,
+    CULL_STREAMING_SBAA_NDI_CLUSTERED      // NDI g-buffer, resolved with the lights of each surface's cluster
 };
 
 // NOTE: Must match shader equivalent structure
@@ -96,10 +108,20 @@ enum GPUQuery
     GPUQ_COUNT    = 3
 };
 
+// Frames in flight the light upload ring holds the lights of, see StructuredRingBuffer
+enum { LIGHT_UPLOAD_FRAMES = 3 };
+
 class App
 {
 public:
-    App(ID3D11Device* d3dDevice, unsigned int activeLights, unsigned int msaaSamples);
+    // surfacesPerPixel is the merge node count per pixel for the streaming techniques (1-4)
+    // compactMergeNodes selects the 16 byte merge node layout (STREAMING_COMPACT_MERGE_NODE)
+    // and is ignored above 8 samples, which always use STREAMING_WIDE_COVERAGE
+    // nodePoolPercent > 0 enables STREAMING_NODE_POOL with pool blocks for that percentage of pixels
+    // hiZ enables STREAMING_HIZ
+    App(ID3D11Device* d3dDevice, unsigned int activeLights, unsigned int msaaSamples,
+        unsigned int surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL,
+        bool compactMergeNodes = false, unsigned int nodePoolPercent = 0, bool hiZ = false);
 
     ~App();
     
@@ -120,18 +142,39 @@ public:
     
     void SetActiveLights(ID3D11Device* d3dDevice, unsigned int activeLights);
     unsigned int GetActiveLights() const { return mActiveLights; }
+
+    // Streaming techniques only shade the lights StreamingLightCullCS finds for each tile
+    void SetTiledLightCulling(bool tiledLightCulling);
+    bool GetTiledLightCulling() const { return mTiledLightCulling; }
+
+    // Streaming techniques resolve pixels with one surface in the full-screen pass and the
+    // others in a compacted second pass. Needs MSAA.
+    void SetResolveCompaction(bool resolveCompaction) { mResolveCompaction = resolveCompaction; }
+    bool GetResolveCompaction() const { return mResolveCompaction; }
     void HandleMouseEvent(ID3D11DeviceContext* d3dDeviceContext, int xPos, int yPos);
 
+    // Writes the streaming g-buffer of the last frame with its camera, see
+    // GBufferSnapshot.h. Only MergeNodePacked nodes without the node pool can
+    // be captured. Returns false if they cannot or the file could not be written.
+    bool SaveGBufferSnapshot(ID3D11DeviceContext* d3dDeviceContext, const char* path);
+
     void SaveBackbufferToFile(ID3D11DeviceContext* d3dDeviceContext,
                               ID3D11RenderTargetView* backBuffer,
                               const char* fileName,
                               int format);
 
+    HRESULT CaptureBackbuffer(ID3D11DeviceContext* d3dDeviceContext,
+                              ID3D11RenderTargetView* backBuffer,
+                              DirectX::ScratchImage& image);
+
     std::wostringstream GetFrameTimes(ID3D11DeviceContext* d3dDeviceContext,
                                       const UIConstants* ui,
                                       bool labels = true);
     std::wostringstream App::GetFrameTimesHeader(const UIConstants *ui);
 
+    // Sum of the pass times GetFrameTimes reports, in ms
+    float GetFrameTime(ID3D11DeviceContext* d3dDeviceContext, const UIConstants* ui);
+
     std::wostringstream GetFrameMemoryUsage(const UIConstants *ui, unsigned &total);
 
     void StartTimer(ID3D11DeviceContext *d3dDeviceContext, ID3D11Query *queries[3]);
@@ -141,13 +184,23 @@ public:
 private:
     void InitializeLightParameters(ID3D11Device* d3dDevice);
 
+    // Whichever merge buffer matches mCompactMergeNodes and mWideCoverage
+    ID3D11Buffer* GetMergeBuffer();
+    ID3D11UnorderedAccessView* GetMergeUnorderedAccess();
+
     // Notes: 
     // - Most of these functions should all be called after initializing per frame/pass constants, etc.
     //   as the shaders that they invoke bind those constant buffers.
 
-    // Set up shader light buffer
+    // Set up shader light buffer, animating the lights straight into it.
+    // viewLights also keeps them in mViewLights for the CPU.
     ID3D11ShaderResourceView * SetupLights(ID3D11DeviceContext* d3dDeviceContext,
-                                           const D3DXMATRIXA16& cameraView);
+                                           const D3DXMATRIXA16& cameraView,
+                                           bool viewLights);
+
+    // Lights of this frame to write, from mLightRing if there is one and
+    // mLightBuffer otherwise; lightOffset is where they start in the ring
+    PointLight* MapLights(ID3D11DeviceContext* d3dDeviceContext, unsigned int& lightOffset);
 
     // Forward rendering of geometry into
     ID3D11ShaderResourceView * RenderForward(ID3D11DeviceContext* d3dDeviceContext,
@@ -189,15 +242,37 @@ private:
                          const D3D11_VIEWPORT* viewport,
                          const UIConstants* ui);
 
+    // Builds the per-tile light lists of the streaming resolve from the merge nodes
+    void CullLightsStreaming(ID3D11DeviceContext* d3dDeviceContext,
+                             ID3D11ShaderResourceView *lightBufferSRV);
+
+    // Builds the cluster light lists of the streaming resolve on the CPU from
+    // the lights SetupLights kept in mViewLights, and uploads them
+    void SetupLightClusters(ID3D11DeviceContext* d3dDeviceContext,
+                            const D3DXMATRIXA16& cameraProj,
+                            const CFirstPersonCamera* viewerCamera);
+
+    bool UseResolveCompaction() const;
+
+    // With resolve compaction pixelShader is one of the StreamingResolveSimple
+    // shaders and complexCS the matching StreamingResolveComplex shader
     void ComputeLightingStreaming(ID3D11DeviceContext* d3dDeviceContext,
                                   ID3D11RenderTargetView* backBuffer,
                                   ID3D11ShaderResourceView *lightBufferSRV,
                                   ID3D11ShaderResourceView* skybox,
                                   const D3D11_VIEWPORT* viewport,
                                   const UIConstants* ui,
-                                  PixelShader* pixelShader);
+                                  PixelShader* pixelShader,
+                                  ComputeShader* complexCS);
 
     unsigned int mMSAASamples;
+    unsigned int mSurfacesPerPixel;
+    bool mWideCoverage;
+    bool mCompactMergeNodes;
+    unsigned int mNodePoolPercent;
+    bool mHiZ;
+    bool mTiledLightCulling;
+    bool mResolveCompaction;
     float mTotalTime;
 
     ID3D11InputLayout* mMeshVertexLayout;
@@ -213,6 +288,17 @@ private:
 
     PixelShader *mStreamingGBufferPS;
     PixelShader *mStreamingResolvePS;
+    PixelShader *mStreamingResolveTiledPS;
+    PixelShader *mStreamingResolveClusteredPS;
+    ComputeShader *mStreamingLightCullCS;
+    PixelShader *mStreamingResolveSimplePS;
+    PixelShader *mStreamingResolveSimpleTiledPS;
+    PixelShader *mStreamingResolveSimpleClusteredPS;
+    ComputeShader *mStreamingResolveComplexCS;
+    ComputeShader *mStreamingResolveComplexTiledCS;
+    ComputeShader *mStreamingResolveComplexClusteredCS;
+    VertexShader *mStreamingComplexPixelVS;
+    PixelShader *mStreamingComplexPixelPS;
     PixelShader *mStreamingSkyboxPS;
 
     PixelShader *mStreamingGBufferNdiPS;
@@ -242,6 +328,7 @@ private:
     PixelShader* mGPUQuadDLResolvePerSamplePS;
     
     ID3D11Buffer* mPerFrameConstants;
+    StreamingCpu::GBufferSnapshotCamera mSnapshotCamera;                    // PerFrameConstants of the last frame
     
     ID3D11RasterizerState* mRasterizerState;
     ID3D11RasterizerState* mDoubleSidedRasterizerState;
@@ -279,18 +366,47 @@ private:
 
     // Lighting state
     unsigned int mActiveLights;
-    std::vector<PointLightInitTransform> mLightInitialTransform;
-    std::vector<PointLight> mPointLightParameters;
-    std::vector<D3DXVECTOR3> mPointLightPositionWorld;
+    StreamingCpu::LightStore mLightStore;                                  // orbits, colors and attenuation
+    std::vector<StreamingCpu::PointLight> mViewLights;                     // see SetupLights
+    bool mLightsMoved;                                                     // by Move() since the last SetupLights
 
+    // Lights go to an upload ring where the runtime allows NO_OVERWRITE on
+    // shader resources, and to a WRITE_DISCARD buffer otherwise
     StructuredBuffer<PointLight>* mLightBuffer;
+    std::tr1::shared_ptr<StructuredRingBuffer<PointLight> > mLightRingBuffer;
+    std::tr1::shared_ptr<StreamingCpu::UploadRing> mLightRing;
 
     // UAVs used for streaming SBAA
-    std::tr1::shared_ptr<StructuredBuffer<MergeNodePacked> > mMergeUav;    // per-pixel merge data
+    // per-pixel merge data, only one of which is created
+    std::tr1::shared_ptr<StructuredBuffer<MergeNodePacked> > mMergeUav;
+    std::tr1::shared_ptr<StructuredBuffer<MergeNodeCompact> > mMergeCompactUav;
+    std::tr1::shared_ptr<StructuredBuffer<MergeNodeWide> > mMergeWideUav;
     std::tr1::shared_ptr<Texture2D> mCountTexture;                         // per-pixel node count
+    unsigned int mFrameEpoch;                                              // see STREAMING_EPOCH_COUNTS
+
+    // per-tile light lists, see GetTileLightListAddress(). Only allocated while
+    // a streaming technique culls per tile, CullLightsStreaming() creates them.
+    std::tr1::shared_ptr<StructuredBuffer<unsigned int> > mTileLightLists;
+
+    // per-cluster light lists, see StreamingClusters.h. The index buffer
+    // grows to the largest frame's lists.
+    std::tr1::shared_ptr<StreamingCpu::ThreadPool> mThreadPool;
+    StreamingCpu::LightClusters mLightClusters;
+    StreamingCpu::LightClusterStats mLightClusterStats;
+    std::tr1::shared_ptr<StructuredBuffer<unsigned int> > mClusterRanges;
+    std::tr1::shared_ptr<StructuredBuffer<unsigned int> > mClusterLightIndices;
+    unsigned int mClusterLightIndexCapacity;
+
+    // complex pixels of the compacted resolve and their indirect arguments,
+    // see STREAMING_COMPLEX_ARGS_COUNT
+    std::tr1::shared_ptr<StructuredBuffer<ComplexPixel> > mComplexPixels;
+    ID3D11Buffer* mComplexPixelArgs;
+    ID3D11UnorderedAccessView* mComplexPixelArgsUAV;
 
 #if defined (STREAMING_USE_LIST_TEXTURE)
     std::tr1::shared_ptr<Texture2D> mListTexture;                          // per-pixel node list
+    std::tr1::shared_ptr<Texture2D> mPoolIndexTexture;                     // per-pixel pool block
+    std::tr1::shared_ptr<StructuredBuffer<HiZTile> > mHiZTiles;            // per-tile occluders
 #endif // defined (STREAMING_USE_LIST_TEXTURE)
 
 #if defined(STREAMING_DEBUG_OPTIONS)
@@ -18,6 +18,9 @@
 #include "GBuffer.hlsl"
 #include "ShaderDefines.h"
 
+// The usual handful of lights is unrolled, the rest loops
+#define BASIC_LOOP_UNROLL_LIGHTS 16
+
 //--------------------------------------------------------------------------------------
 float4 BasicLoop(SurfaceData surface)
 {
@@ -27,7 +30,13 @@ float4 BasicLoop(SurfaceData surface)
     float3 lit = float3(0.0f, 0.0f, 0.0f);
 
     [flatten] if (surface.positionView.z < mCameraNearFar.y) {
-        [unroll] for (uint lightIndex = 0; lightIndex < min(MAX_LIGHTS, totalLights); ++lightIndex) {
+        uint lightCount = min(MAX_LIGHTS, totalLights);
+        uint lightIndex = 0;
+        [unroll] for (; lightIndex < min(BASIC_LOOP_UNROLL_LIGHTS, lightCount); ++lightIndex) {
+            PointLight light = gLight[lightIndex];
+            AccumulateBRDF(surface, light, lit);
+        }
+        [loop] for (; lightIndex < lightCount; ++lightIndex) {
             PointLight light = gLight[lightIndex];
             AccumulateBRDF(surface, light, lit);
         }
@@ -15,7 +15,10 @@
 #pragma once
 
 #include <d3d11.h>
+#include <deque>
+#include <map>
 #include <vector>
+#include "UploadRing.h"
 
 // NOTE: Ensure that T is exactly the same size/layout as the shader structure!
 template <typename T>
@@ -23,9 +26,10 @@ class StructuredBuffer
 {
 public:
     // Construct a structured buffer
+    // uavFlags are D3D11_BUFFER_UAV_FLAG_* for the unordered access view, e.g. a hidden counter
     StructuredBuffer(ID3D11Device* d3dDevice, int elements,
                      UINT bindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE,
-                     bool dynamic = false);
+                     bool dynamic = false, UINT uavFlags = 0);
     
     ~StructuredBuffer();
 
@@ -34,8 +38,7 @@ public:
     ID3D11ShaderResourceView* GetShaderResource() { return mShaderResource; }
     D3D11_MAPPED_SUBRESOURCE Map(ID3D11DeviceContext* d3dDeviceContext);
 
-    // Only valid for dynamic buffers
-    // TODO: Support NOOVERWRITE ring buffer?
+    // Only valid for dynamic buffers. For per-frame data see StructuredRingBuffer.
     T* MapDiscard(ID3D11DeviceContext* d3dDeviceContext);
     void Unmap(ID3D11DeviceContext* d3dDeviceContext);
 
@@ -55,7 +58,7 @@ private:
 
 template <typename T>
 StructuredBuffer<T>::StructuredBuffer(ID3D11Device* d3dDevice, int elements,
-                                      UINT bindFlags, bool dynamic)
+                                      UINT bindFlags, bool dynamic, UINT uavFlags)
     : mElements(elements)
     , mShaderResource(0)
     , mUnorderedAccess(0)
@@ -72,7 +75,8 @@ StructuredBuffer<T>::StructuredBuffer(ID3D11Device* d3dDevice, int elements,
     d3dDevice->CreateBuffer(&desc, 0, &mBuffer);
 
     if (bindFlags & D3D11_BIND_UNORDERED_ACCESS) {
-        d3dDevice->CreateUnorderedAccessView(mBuffer, 0, &mUnorderedAccess);
+        CD3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc(mBuffer, DXGI_FORMAT_UNKNOWN, 0, elements, uavFlags);
+        d3dDevice->CreateUnorderedAccessView(mBuffer, uavFlags ? &uavDesc : 0, &mUnorderedAccess);
     }
 
     if (bindFlags & D3D11_BIND_SHADER_RESOURCE) {
@@ -144,4 +148,218 @@ D3D11_MAPPED_SUBRESOURCE StructuredBuffer<T>::Map(ID3D11DeviceContext* d3dDevice
 
     return subresource;
 }
+
+
+// A dynamic structured buffer for an UploadRing: per-frame data goes into
+// allocations mapped NO_OVERWRITE, fenced with event queries. The shaders
+// read each allocation through a view of its own, as they size light lists
+// with GetDimensions(); views are kept per offset and size, so a ring whose
+// capacity is a multiple of its (fixed size) allocations only ever creates a
+// few.
+// NOTE: Ensure that T is exactly the same size/layout as the shader structure!
+template <typename T>
+class StructuredRingBuffer : public StreamingCpu::UploadBackend
+{
+public:
+    // The D3D 11.0 runtime only allows NO_OVERWRITE on vertex and index
+    // buffers, shader resources need the 11.1 runtime and a driver that
+    // reports MapNoOverwriteOnDynamicBufferSRV
+    static bool IsSupported(ID3D11Device* d3dDevice);
+
+    StructuredRingBuffer(ID3D11Device* d3dDevice, int elements);
+    ~StructuredRingBuffer();
+
+    // View of elements Ts at offset bytes, an allocation aligned to sizeof(T)
+    ID3D11ShaderResourceView* GetShaderResource(unsigned offset, unsigned elements);
+
+    virtual unsigned GetCapacity() const { return static_cast<unsigned>(mElements * sizeof(T)); }
+    virtual unsigned char* Map();
+    virtual void Unmap();
+    virtual void SignalFence(uint64_t fence);
+    virtual uint64_t GetCompletedFence();
+    virtual void WaitForFence(uint64_t fence);
+
+private:
+    // Not implemented
+    StructuredRingBuffer(const StructuredRingBuffer&);
+    StructuredRingBuffer& operator=(const StructuredRingBuffer&);
+
+    struct Fence
+    {
+        uint64_t value;
+        ID3D11Query* query;
+    };
+
+    // Retires the signaled fences the GPU has reached, waiting for those up
+    // to waitFence
+    void PollFences(uint64_t waitFence);
+
+    int mElements;
+    ID3D11Device* mDevice;
+    ID3D11DeviceContext* mContext;
+    ID3D11Buffer* mBuffer;
+    bool mMapped;
+    bool mDiscarded;                                    // the first map discards
+    uint64_t mCompletedFence;
+    std::deque<Fence> mFences;                          // signaled, oldest first
+    std::vector<ID3D11Query*> mFreeQueries;
+    std::map<std::pair<unsigned, unsigned>, ID3D11ShaderResourceView*> mShaderResources;
+};
+
+
+template <typename T>
+bool StructuredRingBuffer<T>::IsSupported(ID3D11Device* d3dDevice)
+{
+    // D3D11_FEATURE_D3D11_OPTIONS and its data, which the DirectX SDK headers predate
+    struct Options
+    {
+        BOOL OutputMergerLogicOp;
+        BOOL UAVOnlyRenderingForcedSampleCount;
+        BOOL DiscardAPIsSeenByDriver;
+        BOOL FlagsForUpdateAndCopySeenByDriver;
+        BOOL ClearView;
+        BOOL CopyWithOverlap;
+        BOOL ConstantBufferPartialUpdate;
+        BOOL ConstantBufferOffsetting;
+        BOOL MapNoOverwriteOnDynamicConstantBuffer;
+        BOOL MapNoOverwriteOnDynamicBufferSRV;
+        BOOL MultisampleRTVWithForcedSampleCountOne;
+        BOOL SAD4ShaderInstructions;
+        BOOL ExtendedDoublesShaderInstructions;
+        BOOL ExtendedResourceSharing;
+    };
+    const D3D11_FEATURE d3d11Options = static_cast<D3D11_FEATURE>(5);
+
+    Options options;
+    ZeroMemory(&options, sizeof(options));
+    HRESULT hr = d3dDevice->CheckFeatureSupport(d3d11Options, &options, sizeof(options));
+    return SUCCEEDED(hr) && options.MapNoOverwriteOnDynamicBufferSRV;
+}
+
+
+template <typename T>
+StructuredRingBuffer<T>::StructuredRingBuffer(ID3D11Device* d3dDevice, int elements)
+    : mElements(elements)
+    , mDevice(d3dDevice)
+    , mContext(0)
+    , mBuffer(0)
+    , mMapped(false)
+    , mDiscarded(false)
+    , mCompletedFence(0)
+{
+    mDevice->AddRef();
+    mDevice->GetImmediateContext(&mContext);
+
+    CD3D11_BUFFER_DESC desc(sizeof(T) * elements, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DYNAMIC,
+        D3D11_CPU_ACCESS_WRITE, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED, sizeof(T));
+    mDevice->CreateBuffer(&desc, 0, &mBuffer);
+}
+
+
+template <typename T>
+StructuredRingBuffer<T>::~StructuredRingBuffer()
+{
+    for (std::map<std::pair<unsigned, unsigned>, ID3D11ShaderResourceView*>::iterator i = mShaderResources.begin();
+         i != mShaderResources.end(); ++i) {
+        i->second->Release();
+    }
+    for (std::size_t i = 0; i < mFences.size(); ++i) {
+        mFences[i].query->Release();
+    }
+    for (std::size_t i = 0; i < mFreeQueries.size(); ++i) {
+        mFreeQueries[i]->Release();
+    }
+    mBuffer->Release();
+    mContext->Release();
+    mDevice->Release();
+}
+
+
+template <typename T>
+ID3D11ShaderResourceView* StructuredRingBuffer<T>::GetShaderResource(unsigned offset, unsigned elements)
+{
+    assert(offset % sizeof(T) == 0);
+    std::pair<unsigned, unsigned> key(offset, elements);
+    ID3D11ShaderResourceView*& view = mShaderResources[key];
+    if (!view) {
+        CD3D11_SHADER_RESOURCE_VIEW_DESC desc(mBuffer, DXGI_FORMAT_UNKNOWN, offset / sizeof(T), elements);
+        mDevice->CreateShaderResourceView(mBuffer, &desc, &view);
+    }
+    return view;
+}
+
+
+template <typename T>
+unsigned char* StructuredRingBuffer<T>::Map()
+{
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    mContext->Map(mBuffer, 0, mDiscarded ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD, 0,
+                  &mappedResource);
+    mDiscarded = true;
+    mMapped = true;
+    return static_cast<unsigned char*>(mappedResource.pData);
+}
+
+
+template <typename T>
+void StructuredRingBuffer<T>::Unmap()
+{
+    if (mMapped) {
+        mContext->Unmap(mBuffer, 0);
+        mMapped = false;
+    }
+}
+
+
+template <typename T>
+void StructuredRingBuffer<T>::SignalFence(uint64_t fence)
+{
+    Fence signaled = {fence, 0};
+    if (mFreeQueries.empty()) {
+        D3D11_QUERY_DESC desc = {D3D11_QUERY_EVENT, 0};
+        mDevice->CreateQuery(&desc, &signaled.query);
+    } else {
+        signaled.query = mFreeQueries.back();
+        mFreeQueries.pop_back();
+    }
+    mContext->End(signaled.query);
+    mFences.push_back(signaled);
+}
+
+
+template <typename T>
+uint64_t StructuredRingBuffer<T>::GetCompletedFence()
+{
+    PollFences(0);
+    return mCompletedFence;
+}
+
+
+template <typename T>
+void StructuredRingBuffer<T>::WaitForFence(uint64_t fence)
+{
+    PollFences(fence);
+}
+
+
+template <typename T>
+void StructuredRingBuffer<T>::PollFences(uint64_t waitFence)
+{
+    while (!mFences.empty()) {
+        Fence& oldest = mFences.front();
+        // Only flush when waiting, polling should not submit work early
+        UINT flags = oldest.value <= waitFence ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH;
+        HRESULT hr = mContext->GetData(oldest.query, 0, 0, flags);
+        if (hr != S_OK) {
+            if (oldest.value <= waitFence && SUCCEEDED(hr)) {
+                continue;
+            }
+            break;
+        }
+        mCompletedFence = oldest.value;
+        mFreeQueries.push_back(oldest.query);
+        mFences.pop_front();
+    }
+}
+
 // TODO: Constant buffers
@@ -473,7 +473,34 @@ namespace DirectX
     HRESULT CopyRectangle( _In_ const Image& srcImage, _In_ const Rect& srcRect, _In_ const Image& dstImage,
                            _In_ DWORD filter, _In_ size_t xOffset, _In_ size_t yOffset );
 
-    HRESULT ComputeMSE( _In_ const Image& image1, _In_ const Image& image2, _Out_ float& mse, _Out_writes_opt_(4) float* mseV );
+    enum CMSE_FLAGS
+    {
+        CMSE_DEFAULT                = 0,
+
+        CMSE_IGNORE_ALPHA           = 0x1,
+            // Only compares RGB, mseV[3] is 0 (e.g. for captured back buffers)
+
+        CMSE_PARALLEL               = 0x10000000,
+            // Free to use multithreading to improve performance (by default it does not use multithreading)
+    };
+
+    HRESULT ComputeMSE( _In_ const Image& image1, _In_ const Image& image2, _Out_ float& mse, _Out_writes_opt_(4) float* mseV,
+                        _In_ DWORD flags = CMSE_DEFAULT );
+
+    struct ImageQuality
+    {
+        float mse;                  // as ComputeMSE, summed over the compared channels
+        float psnr;                 // dB, peak of 1 per channel; FLT_MAX for identical images
+        float ssim;                 // mean SSIM of the luminance over 8x8 windows at a stride of 4
+        float edgeMse;              // mse over the edge pixels of the reference
+        float edgePsnr;
+        size_t edgePixels;
+    };
+
+    HRESULT ComputeImageQuality( _In_ const Image& reference, _In_ const Image& image, _In_ DWORD flags, _In_ float edgeThreshold,
+                                 _Out_ ImageQuality& quality, _Out_opt_ ScratchImage* edgeErrorMap );
+        // flags are CMSE_FLAGS. Edge pixels have a Sobel gradient of the reference luminance above edgeThreshold.
+        // edgeErrorMap receives an R8_UNORM image of the RMS channel error at edge pixels, 0 elsewhere.
 
     //---------------------------------------------------------------------------------
     // Direct3D 11 functions
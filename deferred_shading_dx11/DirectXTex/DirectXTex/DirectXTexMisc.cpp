@@ -15,42 +15,46 @@
 
 #include "directxtexp.h"
 
+#include <float.h>
+#include <math.h>
+
 namespace DirectX
 {
 
 //-------------------------------------------------------------------------------------
-static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
-                            _Out_ float& mse, _Out_writes_opt_(4) float* mseV )
-{
-    if ( !image1.pixels || !image2.pixels )
-        return E_POINTER;
+// Rows per task when splitting images across threads (CMSE_PARALLEL)
+static const size_t QUALITY_TASK_ROWS = 16;
 
-    assert( image1.width == image2.width && image1.height == image2.height );
-    assert( !IsCompressed( image1.format ) && !IsCompressed( image2.format )  );
+static const float SSIM_C1 = 0.01f * 0.01f;
+static const float SSIM_C2 = 0.03f * 0.03f;
 
-    const size_t width = image1.width;
+static float _ComputePSNR( float mse )
+{
+    return ( mse > 0.f ) ? -10.f * log10f( mse ) : FLT_MAX;
+}
 
-    ScopedAlignedArrayXMVECTOR scanline( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*width)*2, 16 ) ) );
-    if ( !scanline )
-        return E_OUTOFMEMORY;
+//-------------------------------------------------------------------------------------
+// Sum of the squared differences over rows [y0, y1)
+static bool _SumSquaredError( _In_ const Image& image1, _In_ const Image& image2, _In_ size_t y0, _In_ size_t y1,
+                              _Inout_updates_(image1.width*2) XMVECTOR* scanline, _Inout_ XMVECTOR& acc )
+{
+    const size_t width = image1.width;
 
-    const uint8_t *pSrc1 = image1.pixels;
+    const uint8_t *pSrc1 = image1.pixels + y0 * image1.rowPitch;
     const size_t rowPitch1 = image1.rowPitch;
 
-    const uint8_t *pSrc2 = image2.pixels;
+    const uint8_t *pSrc2 = image2.pixels + y0 * image2.rowPitch;
     const size_t rowPitch2 = image2.rowPitch;
 
-    XMVECTOR acc = XMVectorZero();
-
-    for( size_t h = 0; h < image1.height; ++h )
+    for( size_t h = y0; h < y1; ++h )
     {
-        XMVECTOR* ptr1 = scanline.get();
+        XMVECTOR* ptr1 = scanline;
         if ( !_LoadScanline( ptr1, width, pSrc1, rowPitch1, image1.format ) )
-            return E_FAIL;
+            return false;
 
-        XMVECTOR* ptr2 = scanline.get() + width;
+        XMVECTOR* ptr2 = scanline + width;
         if ( !_LoadScanline( ptr2, width, pSrc2, rowPitch2, image2.format ) )
-            return E_FAIL;
+            return false;
 
         for( size_t i = 0; i < width; ++i, ++ptr1, ++ptr2 )
         {
@@ -63,6 +67,65 @@ static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
         pSrc2 += rowPitch2;
     }
 
+    return true;
+}
+
+//-------------------------------------------------------------------------------------
+static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
+                            _Out_ float& mse, _Out_writes_opt_(4) float* mseV, _In_ DWORD flags )
+{
+    if ( !image1.pixels || !image2.pixels )
+        return E_POINTER;
+
+    assert( image1.width == image2.width && image1.height == image2.height );
+    assert( !IsCompressed( image1.format ) && !IsCompressed( image2.format )  );
+
+    const size_t width = image1.width;
+
+    // Tasks keep their own sums, added up in order so the result does not
+    // depend on the thread count
+    const size_t tasks = ( image1.height + QUALITY_TASK_ROWS - 1 ) / QUALITY_TASK_ROWS;
+    std::vector<XMFLOAT4> partial( tasks );
+    bool fail = false;
+    bool outOfMemory = false;
+
+#pragma omp parallel for if ( ( flags & CMSE_PARALLEL ) != 0 )
+    for( int t = 0; t < static_cast<int>( tasks ); ++t )
+    {
+        ScopedAlignedArrayXMVECTOR scanline( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*width)*2, 16 ) ) );
+        if ( !scanline )
+        {
+            outOfMemory = true;
+            continue;
+        }
+
+        const size_t y0 = t * QUALITY_TASK_ROWS;
+        const size_t y1 = std::min<size_t>( y0 + QUALITY_TASK_ROWS, image1.height );
+
+        XMVECTOR acc = XMVectorZero();
+        if ( !_SumSquaredError( image1, image2, y0, y1, scanline.get(), acc ) )
+            fail = true;
+
+        XMStoreFloat4( &partial[ t ], acc );
+    }
+
+    if ( outOfMemory )
+        return E_OUTOFMEMORY;
+
+    if ( fail )
+        return E_FAIL;
+
+    XMVECTOR acc = XMVectorZero();
+    for( size_t t = 0; t < tasks; ++t )
+    {
+        acc = XMVectorAdd( acc, XMLoadFloat4( &partial[ t ] ) );
+    }
+
+    if ( flags & CMSE_IGNORE_ALPHA )
+    {
+        acc = XMVectorSelect( acc, XMVectorZero(), g_XMSelect0001 );
+    }
+
     // MSE = sum[ (I1 - I2)^2 ] / w*h
     XMVECTOR d = XMVectorReplicate( float(image1.width * image1.height) );
     XMVECTOR v = XMVectorDivide( acc, d );
@@ -81,6 +144,93 @@ static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
     return S_OK; 
 }
 
+//-------------------------------------------------------------------------------------
+// Loads one row of both images as luminance, plus the squared error summed over
+// the compared channels
+static bool _LoadQualityRow( _In_ const Image& reference, _In_ const Image& image, _In_ size_t y, _In_ DWORD flags,
+                             _Inout_updates_(reference.width*2) XMVECTOR* scanline,
+                             _Out_writes_(reference.width) float* luma1, _Out_writes_(reference.width) float* luma2,
+                             _Out_writes_(reference.width) float* error )
+{
+    const size_t width = reference.width;
+
+    XMVECTOR* ptr1 = scanline;
+    if ( !_LoadScanline( ptr1, width, reference.pixels + y * reference.rowPitch, reference.rowPitch, reference.format ) )
+        return false;
+
+    XMVECTOR* ptr2 = scanline + width;
+    if ( !_LoadScanline( ptr2, width, image.pixels + y * image.rowPitch, image.rowPitch, image.format ) )
+        return false;
+
+    // Rec. 709 luminance of the stored values, no gamma conversion
+    static const XMVECTORF32 lumaWeights = { 0.2126f, 0.7152f, 0.0722f, 0.f };
+    const XMVECTOR errorMask = ( flags & CMSE_IGNORE_ALPHA ) ? g_XMSelect1110 : g_XMSelect1111;
+
+    for( size_t i = 0; i < width; ++i, ++ptr1, ++ptr2 )
+    {
+        XMVECTOR v = XMVectorAndInt( XMVectorSubtract( *ptr1, *ptr2 ), errorMask );
+        error[ i ] = XMVectorGetX( XMVector4Dot( v, v ) );
+        luma1[ i ] = XMVectorGetX( XMVector4Dot( *ptr1, lumaWeights ) );
+        luma2[ i ] = XMVectorGetX( XMVector4Dot( *ptr2, lumaWeights ) );
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------
+// SSIM of the 8x8 window at x, y. Each window row is two 4-wide loads.
+static float _ComputeWindowSSIM( _In_ const float* luma1, _In_ const float* luma2,
+                                 _In_ size_t width, _In_ size_t x, _In_ size_t y )
+{
+    XMVECTOR s1 = XMVectorZero();
+    XMVECTOR s2 = XMVectorZero();
+    XMVECTOR s11 = XMVectorZero();
+    XMVECTOR s22 = XMVectorZero();
+    XMVECTOR s12 = XMVectorZero();
+
+    for( size_t j = 0; j < 8; ++j )
+    {
+        const float* row1 = luma1 + ( y + j ) * width + x;
+        const float* row2 = luma2 + ( y + j ) * width + x;
+        for( size_t i = 0; i < 8; i += 4 )
+        {
+            XMVECTOR a = XMLoadFloat4( reinterpret_cast<const XMFLOAT4*>( row1 + i ) );
+            XMVECTOR b = XMLoadFloat4( reinterpret_cast<const XMFLOAT4*>( row2 + i ) );
+            s1 = XMVectorAdd( s1, a );
+            s2 = XMVectorAdd( s2, b );
+            s11 = XMVectorMultiplyAdd( a, a, s11 );
+            s22 = XMVectorMultiplyAdd( b, b, s22 );
+            s12 = XMVectorMultiplyAdd( a, b, s12 );
+        }
+    }
+
+    const float n = 1.f / 64.f;
+    const float mu1 = XMVectorGetX( XMVector4Dot( s1, g_XMOne ) ) * n;
+    const float mu2 = XMVectorGetX( XMVector4Dot( s2, g_XMOne ) ) * n;
+    const float var1 = XMVectorGetX( XMVector4Dot( s11, g_XMOne ) ) * n - mu1 * mu1;
+    const float var2 = XMVectorGetX( XMVector4Dot( s22, g_XMOne ) ) * n - mu2 * mu2;
+    const float cov = XMVectorGetX( XMVector4Dot( s12, g_XMOne ) ) * n - mu1 * mu2;
+
+    return ( ( 2.f * mu1 * mu2 + SSIM_C1 ) * ( 2.f * cov + SSIM_C2 ) ) /
+           ( ( mu1 * mu1 + mu2 * mu2 + SSIM_C1 ) * ( var1 + var2 + SSIM_C2 ) );
+}
+
+//-------------------------------------------------------------------------------------
+// Sobel gradient magnitude of the luminance, clamping at the borders
+static float _ComputeSobel( _In_reads_(width*height) const float* luma, _In_ size_t width, _In_ size_t height,
+                            _In_ size_t x, _In_ size_t y )
+{
+    const size_t x0 = ( x > 0 ) ? x - 1 : 0;
+    const size_t x1 = ( x + 1 < width ) ? x + 1 : x;
+    const float* r0 = luma + ( ( y > 0 ) ? y - 1 : 0 ) * width;
+    const float* r1 = luma + y * width;
+    const float* r2 = luma + ( ( y + 1 < height ) ? y + 1 : y ) * width;
+
+    const float gx = ( r0[x1] + 2.f * r1[x1] + r2[x1] ) - ( r0[x0] + 2.f * r1[x0] + r2[x0] );
+    const float gy = ( r2[x0] + 2.f * r2[x] + r2[x1] ) - ( r0[x0] + 2.f * r0[x] + r0[x1] );
+    return sqrtf( gx * gx + gy * gy );
+}
+
 
 //=====================================================================================
 // Entry points
@@ -195,7 +345,7 @@ HRESULT CopyRectangle( const Image& srcImage, const Rect& srcRect, const Image&
 // Computes the Mean-Squared-Error (MSE) between two images
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
-HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float* mseV  )
+HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float* mseV, DWORD flags )
 {
     if ( !image1.pixels || !image2.pixels )
         return E_POINTER;
@@ -223,7 +373,7 @@ HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float*
             if ( !img1 || !img2 )
                 return E_POINTER;
 
-            return _ComputeMSE( *img1, *img2, mse, mseV );
+            return _ComputeMSE( *img1, *img2, mse, mseV, flags );
         }
         else
         {
@@ -237,7 +387,7 @@ HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float*
             if ( !img )
                 return E_POINTER;
 
-            return _ComputeMSE( *img, image2, mse, mseV );
+            return _ComputeMSE( *img, image2, mse, mseV, flags );
         }
     }
     else
@@ -254,14 +404,149 @@ HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float*
             if ( !img )
                 return E_POINTER;
 
-            return _ComputeMSE( image1, *img, mse, mseV );
+            return _ComputeMSE( image1, *img, mse, mseV, flags );
         }
         else
         {
             // Case 4: neither image is compressed
-            return _ComputeMSE( image1, image2, mse, mseV );
+            return _ComputeMSE( image1, image2, mse, mseV, flags );
         }
     }
 }
 
+
+//-------------------------------------------------------------------------------------
+// Computes PSNR, SSIM and the error on reference edges between two images
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT ComputeImageQuality( const Image& reference, const Image& image, DWORD flags, float edgeThreshold,
+                             ImageQuality& quality, ScratchImage* edgeErrorMap )
+{
+    if ( !reference.pixels || !image.pixels )
+        return E_POINTER;
+
+    if ( reference.width != image.width || reference.height != image.height )
+        return E_INVALIDARG;
+
+    // SSIM needs at least one whole window
+    if ( reference.width < 8 || reference.height < 8 )
+        return E_INVALIDARG;
+
+    if ( IsCompressed(reference.format) || IsCompressed(image.format) )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    HRESULT hr = _ComputeMSE( reference, image, quality.mse, nullptr, flags );
+    if ( FAILED(hr) )
+        return hr;
+
+    const float channels = ( flags & CMSE_IGNORE_ALPHA ) ? 3.f : 4.f;
+    quality.psnr = _ComputePSNR( quality.mse / channels );
+
+    const size_t width = reference.width;
+    const size_t height = reference.height;
+
+    std::vector<float> luma1( width * height );
+    std::vector<float> luma2( width * height );
+    std::vector<float> error( width * height );
+
+    const size_t tasks = ( height + QUALITY_TASK_ROWS - 1 ) / QUALITY_TASK_ROWS;
+    bool fail = false;
+    bool outOfMemory = false;
+
+#pragma omp parallel for if ( ( flags & CMSE_PARALLEL ) != 0 )
+    for( int t = 0; t < static_cast<int>( tasks ); ++t )
+    {
+        ScopedAlignedArrayXMVECTOR scanline( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*width)*2, 16 ) ) );
+        if ( !scanline )
+        {
+            outOfMemory = true;
+            continue;
+        }
+
+        const size_t y1 = std::min<size_t>( ( t + 1 ) * QUALITY_TASK_ROWS, height );
+        for( size_t y = t * QUALITY_TASK_ROWS; y < y1; ++y )
+        {
+            if ( !_LoadQualityRow( reference, image, y, flags, scanline.get(),
+                                   &luma1[ y * width ], &luma2[ y * width ], &error[ y * width ] ) )
+                fail = true;
+        }
+    }
+
+    if ( outOfMemory )
+        return E_OUTOFMEMORY;
+
+    if ( fail )
+        return E_FAIL;
+
+    if ( edgeErrorMap )
+    {
+        hr = edgeErrorMap->Initialize2D( DXGI_FORMAT_R8_UNORM, width, height, 1, 1 );
+        if ( FAILED(hr) )
+            return hr;
+    }
+    const Image* map = edgeErrorMap ? edgeErrorMap->GetImage( 0, 0, 0 ) : nullptr;
+
+    // Per row sums in double, added up in order
+    const size_t ssimRows = ( height - 8 ) / 4 + 1;
+    const size_t ssimColumns = ( width - 8 ) / 4 + 1;
+    std::vector<double> ssimSums( ssimRows );
+    std::vector<double> edgeSums( height );
+    std::vector<size_t> edgeCounts( height );
+
+#pragma omp parallel for if ( ( flags & CMSE_PARALLEL ) != 0 )
+    for( int r = 0; r < static_cast<int>( ssimRows ); ++r )
+    {
+        double sum = 0.0;
+        for( size_t c = 0; c < ssimColumns; ++c )
+        {
+            sum += _ComputeWindowSSIM( &luma1[0], &luma2[0], width, c * 4, r * 4 );
+        }
+        ssimSums[ r ] = sum;
+    }
+
+#pragma omp parallel for if ( ( flags & CMSE_PARALLEL ) != 0 )
+    for( int y = 0; y < static_cast<int>( height ); ++y )
+    {
+        double sum = 0.0;
+        size_t count = 0;
+        uint8_t* pDest = map ? map->pixels + y * map->rowPitch : nullptr;
+        for( size_t x = 0; x < width; ++x )
+        {
+            const float e = error[ y * width + x ];
+            const bool edge = _ComputeSobel( &luma1[0], width, height, x, y ) > edgeThreshold;
+            if ( edge )
+            {
+                sum += e;
+                ++count;
+            }
+            if ( pDest )
+            {
+                const float rms = edge ? sqrtf( e / channels ) : 0.f;
+                pDest[ x ] = static_cast<uint8_t>( std::min<float>( rms, 1.f ) * 255.f + 0.5f );
+            }
+        }
+        edgeSums[ y ] = sum;
+        edgeCounts[ y ] = count;
+    }
+
+    double ssim = 0.0;
+    for( size_t r = 0; r < ssimRows; ++r )
+    {
+        ssim += ssimSums[ r ];
+    }
+    quality.ssim = static_cast<float>( ssim / ( ssimRows * ssimColumns ) );
+
+    double edgeError = 0.0;
+    quality.edgePixels = 0;
+    for( size_t y = 0; y < height; ++y )
+    {
+        edgeError += edgeSums[ y ];
+        quality.edgePixels += edgeCounts[ y ];
+    }
+    quality.edgeMse = quality.edgePixels ? static_cast<float>( edgeError / quality.edgePixels ) : 0.f;
+    quality.edgePsnr = _ComputePSNR( quality.edgeMse / channels );
+
+    return S_OK;
+}
+
 }; // namespace
@@ -15,7 +15,7 @@
 #ifndef SHADER_DEFINES_H
 #define SHADER_DEFINES_H
 
-#define MAX_LIGHTS_POWER 4
+#define MAX_LIGHTS_POWER 10
 #define MAX_LIGHTS (1<<MAX_LIGHTS_POWER)
 
 // This determines the tile size for light binning and associated tradeoffs
@@ -64,9 +64,53 @@ bool DepthRangesOverlap(in uint2 coords,
     return false;
 }
 
+// Returns the depth tested coverage of merge without the samples at or behind
+// 10000, which the resolve leaves to the skybox. Non-finite depths drop out too.
+//-----------------------------------------------------------------------------
+uint GetVisibleSamples(in MergeNode merge)
+{
+    uint visible = GetDepthTestedCoverage(merge);
+    float start, end;
+    GetDepthRange(merge, start, end);
+    [branch] if (!(end < 10000.0f)) {
+        uint inFront = 0;
+        [unroll] for (uint i = 0; i < MSAA_SAMPLES; i++) {
+            inFront |= EstimateDepthAtSample(merge, i) < 10000.0f ? (1u << i) : 0;
+        }
+        visible &= inFront;
+    }
+    return visible;
+}
+
+// Returns the samples where a is at least as close as b. Ties go to a, which
+// is the node earlier in the list. Disjoint depth ranges need no per-sample test.
+//-----------------------------------------------------------------------------
+uint GetCloserSamples(in MergeNode a, in MergeNode b, in uint samples)
+{
+    float aStart, aEnd, bStart, bEnd;
+    GetDepthRange(a, aStart, aEnd);
+    GetDepthRange(b, bStart, bEnd);
+
+    uint closer = 0;
+    [branch] if (aEnd < bStart) {
+        closer = samples;
+    } else if (!(bEnd < aStart)) {
+        [unroll] for (uint i = 0; i < MSAA_SAMPLES; i++) {
+            closer |= EstimateDepthAtSample(a, i) <= EstimateDepthAtSample(b, i) ? (1u << i) : 0;
+        }
+    }
+    return closer & samples;
+}
+
 // Resolve per-sample coverage accounting for interpenetrating fragments.
 // weights[i] is # of samples covered by mergeNode[i]
 // weightSum is total of weights. (1 - weightSum) is skybox contribution.
+//
+// Every sample goes to the closest surface covering it, the earliest one in
+// the list on ties. Instead of tracking the closest depth per sample, each
+// pair of surfaces removes its losing samples from a coverage mask, so only
+// the unrolled sample loops depend on MSAA_SAMPLES and nothing is indexed by
+// sample.
 //-----------------------------------------------------------------------------
 void ResolveSurfaceWeights(in uint2 coords,
                            in uint nodeList,
@@ -74,65 +118,35 @@ void ResolveSurfaceWeights(in uint2 coords,
                            in out uint weights,
                            in out float weightSum)
 {
-    // 1. For each surface, loop over samples it covers.
-    // 2. For each sample covered, check that the surface is the closest one at that sample
-    // 3. Track the closest surface at each sample
-    // 4. Count the total number of samples where each surface is unoccluded
-
-    // 2bits in here store the surface Ids. surfaceIds[i] == 3 implies the surface is uncovered.
-#if (STREAMING_MAX_SURFACES_PER_PIXEL == 4)
-    uint surfaceIds = 0x924924;
-#else //  (STREAMING_MAX_SURFACES_PER_PIXEL < 4)
-    uint surfaceIds = 0xFFFF;
-#endif // (STREAMING_MAX_SURFACES_PER_PIXEL < 4)
-
-    // array of closest depth values. this is slightly faster than using a float[8] as it avoids
-    // dynaic indexing
-    float4 closestDepths0 = float4(10000.0f, 10000.0f, 10000.0f, 10000.0f);
-    float4 closestDepths1 = float4(10000.0f, 10000.0f, 10000.0f, 10000.0f);
-
-    // 1. For each surface, loop over samples it covers.
-    [unroll] for (uint j = 0; j < nodeCount; j++) {
-
-        // 2. For each sample covered, check that the surface is the closest one at that sample
-        [unroll] for (uint i = 0; i < MSAA_SAMPLES; i++) {
+    MergeNode nodes[STREAMING_MAX_SURFACES_PER_PIXEL];
+    uint visible[STREAMING_MAX_SURFACES_PER_PIXEL];
+    [unroll] for (uint j = 0; j < STREAMING_MAX_SURFACES_PER_PIXEL; j++) {
+        nodes[j] = GetEmptyMergeNode();
+        visible[j] = 0;
+        [branch] if (j < nodeCount) {
+            nodes[j] = GetMergeNode(coords, Get2BitsInByte(nodeList, j));
+            visible[j] = GetVisibleSamples(nodes[j]);
+        }
+    }
 
-            // Load the surface from uav
-            uint tempIndex = Get2BitsInByte(nodeList, j);
-            MergeNode temp = GetMergeNode(coords, tempIndex);
-
-            // Does surface j cover sample i?
-            uint coveredSample = (1 << i);
-            uint jCovered = GetDepthTestedCoverage(temp);
-            uint jCoversi = coveredSample & jCovered;
-
-            // 3. Track the closest surface at each sample
-            if (jCoversi) {
-                // Is surfwace j the closest surface at sample i?
-                float sampleDepth = EstimateDepthAtSample(temp, i);
-                bool  sampleCloser = false;
-
-                // This is ugly, but it avoids the dynamic indexing.
-                if (i < 4) {
-                    sampleCloser = closestDepths0[i] > sampleDepth;
-                    closestDepths0[i] = sampleCloser ? sampleDepth : closestDepths0[i];
-                } else {
-                    sampleCloser = closestDepths1[i%4] > sampleDepth;
-                    closestDepths1[i % 4] = sampleCloser ? sampleDepth : closestDepths1[i % 4];
-                }
-
-                // Set surfaceIds[i] to tempIndex if this is the closest surface at this sample
-                Set2BitsInByte(surfaceIds, i, sampleCloser ? tempIndex : Get2BitsInByte(surfaceIds, i));
+    // Surfaces past nodeCount have no samples and never share one
+    [unroll] for (uint a = 0; a < STREAMING_MAX_SURFACES_PER_PIXEL; a++) {
+        [unroll] for (uint b = a + 1; b < STREAMING_MAX_SURFACES_PER_PIXEL; b++) {
+            uint shared = visible[a] & visible[b];
+            [branch] if (shared != 0) {
+                uint aCloser = GetCloserSamples(nodes[a], nodes[b], shared);
+                visible[a] &= ~(shared & ~aCloser);
+                visible[b] &= ~aCloser;
             }
         }
     }
 
-    // 4. Count the total number of samples where each surface is unoccludedwtt
-    [unroll] for (uint i = 0; i < MSAA_SAMPLES; i++) {
-        uint tempIndex = Get2BitsInByte(surfaceIds, i);
-        [flatten] if (tempIndex < STREAMING_MAX_SURFACES_PER_PIXEL) {
-            SetByteInUint(weights, tempIndex, GetByteInUint(weights, tempIndex) + 1);
-            weightSum = weightSum + 1;
+    [unroll] for (uint k = 0; k < STREAMING_MAX_SURFACES_PER_PIXEL; k++) {
+        [flatten] if (k < nodeCount) {
+            uint tempIndex = Get2BitsInByte(nodeList, k);
+            uint samples = countbits(visible[k]);
+            SetByteInUint(weights, tempIndex, GetByteInUint(weights, tempIndex) + samples);
+            weightSum = weightSum + samples;
         }
     }
 }
@@ -240,6 +254,25 @@ void UpdateMinCoverage(in uint currentCoverage, in uint currentPosition,
     }
 }
 
+// UpdateMinCoverage for STREAMING_DISCARD_POLICY, the lowest score is thrown away
+//-----------------------------------------------------------------------------
+void UpdateMinDiscardScore(in MergeNode current, in uint currentCoverage, in uint currentPosition,
+                           in out float minScore, in out uint minScorePosition)
+{
+#if STREAMING_DISCARD_POLICY == STREAMING_DISCARD_FARTHEST
+    float score = -float(currentPosition);
+#elif STREAMING_DISCARD_POLICY == STREAMING_DISCARD_LEAST_ENERGY
+    float luma = dot(current.shade.albedo.rgb, float3(0.299f, 0.587f, 0.114f));
+    float score = luma * countbits(currentCoverage);
+#else
+    float score = countbits(currentCoverage);
+#endif
+    if (currentPosition == 0 || score <= minScore) {
+        minScore = score;
+        minScorePosition = currentPosition;
+    }
+}
+
 // Returns the removedPosition in the nodeList.
 //-----------------------------------------------------------------------------
 uint OccluderFusion(in out MergeNode incoming, in uint nodeList,
@@ -249,8 +282,8 @@ uint OccluderFusion(in out MergeNode incoming, in uint nodeList,
     float occluderStart = 0.0f;
     float occluderEnd = 0.0f;
     uint occluderCoverage = 0;
-    uint minCoverageCount = countbits(0xFF);
-    uint minCoveragePosition = 0;
+    float minScore = 0.0f;
+    uint minScorePosition = 0;
     uint newInfo = 0;
 
     // Loop over all surfaces
@@ -270,6 +303,7 @@ uint OccluderFusion(in out MergeNode incoming, in uint nodeList,
 
         // if a surface is entirely occluded then we've found a slot for incoming
         if (OcclusionCheck(temp, occluderStart, occluderEnd, occluderCoverage, newInfo)) {
+            AddHiZOccluder(coords, occluderCoverage, occluderEnd);
             return i;
         }
 
@@ -277,16 +311,19 @@ uint OccluderFusion(in out MergeNode incoming, in uint nodeList,
             SetMergeNode(coords, tempIndex, temp);
         }
 
-        // track the surface that adds the least amount of new information to the pixel
-        UpdateMinCoverage(newInfo, i, minCoverageCount, minCoveragePosition);
+        // track the surface that STREAMING_DISCARD_POLICY would rather lose, by
+        // default the one that adds the least amount of new information to the pixel
+        UpdateMinDiscardScore(temp, newInfo, i, minScore, minScorePosition);
     }
 
 #if defined(STREAMING_DEBUG_OPTIONS)
     IncrementDiscardCount(coords);
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 
-    // nothing got entirely occluded. we need to throw away a surface
+    // nothing got entirely occluded. we need to throw away a surface, which
+    // may be part of the occluder the pixel gave its tile
     SetDiscardedSamples(coords, 1);
-    return minCoveragePosition;
+    RemoveHiZOccluder(coords);
+    return minScorePosition;
 }
 #endif // DEPTHTESTS_HLSL
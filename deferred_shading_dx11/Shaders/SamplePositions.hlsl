@@ -106,15 +106,24 @@ static const float g32SampleOffsets[32][2] =
     SAMPLE_OFFSET(-8, 7)
 };
 
+// The tables above are plain C++ as well, see StreamingCpu/ResolveWeights.cpp
+#if !defined(__cplusplus)
 float2 GetSamplePosition(int sampleId)
 {
-#if MSAA_SAMPLES == 2
+#if MSAA_SAMPLES == 1
+    return float2(g1SampleOffsets[sampleId][0], g1SampleOffsets[sampleId][1]);
+#elif MSAA_SAMPLES == 2
     return float2(g2SampleOffsets[sampleId][0], g2SampleOffsets[sampleId][1]);
 #elif MSAA_SAMPLES == 4
     return float2(g4SampleOffsets[sampleId][0], g4SampleOffsets[sampleId][1]);
 #elif MSAA_SAMPLES == 8
     return float2(g8SampleOffsets[sampleId][0], g8SampleOffsets[sampleId][1]);
-#endif // MSAA_SAMPLES == 8
+#elif MSAA_SAMPLES == 16
+    return float2(g16SampleOffsets[sampleId][0], g16SampleOffsets[sampleId][1]);
+#elif MSAA_SAMPLES == 32
+    return float2(g32SampleOffsets[sampleId][0], g32SampleOffsets[sampleId][1]);
+#endif // MSAA_SAMPLES == 32
 }
+#endif // !defined(__cplusplus)
 
 #endif // SAMPLE_POSITIONS_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef STREAMINGADDRESSING_H
+#define STREAMINGADDRESSING_H
+
+// Maps pixels and node indices to gMergeBuffer elements, pixels to the
+// per-tile light lists of the resolve, and packs the complex pixel list. Written in the subset of C++ and HLSL
+// that both compile, so the shaders and the CPU code share one copy. The
+// shaders pass the STREAMING_ADDRESSING macros, the CPU code can pass any
+// mapping.
+
+#include "StreamingDefines.h"
+
+inline unsigned int AlignToTile(unsigned int value, unsigned int tileLog)
+{
+    return ((value + (1u << tileLog) - 1u) >> tileLog) << tileLog;
+}
+
+// Moves the low 16 bits to the even bit positions
+inline unsigned int SpreadBits(unsigned int value)
+{
+    value &= 0x0000FFFFu;
+    value = (value | (value << 8)) & 0x00FF00FFu;
+    value = (value | (value << 4)) & 0x0F0F0F0Fu;
+    value = (value | (value << 2)) & 0x33333333u;
+    value = (value | (value << 1)) & 0x55555555u;
+    return value;
+}
+
+// Pixel addresses per node plane. Tiled mappings pad the surface to whole
+// tiles, otherwise the tiles of the last row would run into the next plane.
+inline unsigned int GetAddressingPlaneSize(unsigned int width, unsigned int height, unsigned int mapping,
+                                           unsigned int tileLogX, unsigned int tileLogY)
+{
+    if (mapping == STREAMING_ADDRESSING_LINEAR) {
+        return width * height;
+    }
+    return AlignToTile(width, tileLogX) * AlignToTile(height, tileLogY);
+}
+
+inline unsigned int GetPixelAddress(unsigned int x, unsigned int y, unsigned int width, unsigned int mapping,
+                                    unsigned int tileLogX, unsigned int tileLogY)
+{
+    if (mapping == STREAMING_ADDRESSING_LINEAR) {
+        return x + width * y;
+    }
+
+    unsigned int tilesX = AlignToTile(width, tileLogX) >> tileLogX;
+    unsigned int tileAddress = ((x >> tileLogX) + tilesX * (y >> tileLogY)) << (tileLogX + tileLogY);
+    unsigned int pixelX = x & ((1u << tileLogX) - 1u);
+    unsigned int pixelY = y & ((1u << tileLogY) - 1u);
+
+    if (mapping == STREAMING_ADDRESSING_MORTON) {
+        // Interleave the bits both sides have, the rest of the longer side goes on top
+        unsigned int common = tileLogX < tileLogY ? tileLogX : tileLogY;
+        unsigned int commonMask = (1u << common) - 1u;
+        unsigned int interleaved = SpreadBits(pixelX & commonMask) | (SpreadBits(pixelY & commonMask) << 1);
+        unsigned int rest = tileLogX > tileLogY ? (pixelX >> common) : (pixelY >> common);
+        return tileAddress | interleaved | (rest << (2 * common));
+    }
+    return tileAddress | (pixelY << tileLogX) | pixelX;
+}
+
+inline unsigned int GetNodeAddress(unsigned int pixelAddress, unsigned int index, unsigned int planeSize,
+                                   unsigned int surfacesPerPixel, unsigned int pixelMajor)
+{
+    if (pixelMajor != 0) {
+        return pixelAddress * surfacesPerPixel + index;
+    }
+    return planeSize * index + pixelAddress;
+}
+
+// StreamingLightCullCS writes one list per tileDim x tileDim tile: the light
+// count followed by up to maxLights light indices in ascending order.
+inline unsigned int GetTileLightListAddress(unsigned int x, unsigned int y, unsigned int width,
+                                            unsigned int tileDim, unsigned int maxLights)
+{
+    unsigned int tilesX = (width + tileDim - 1u) / tileDim;
+    return ((x / tileDim) + tilesX * (y / tileDim)) * (maxLights + 1u);
+}
+
+// Entries of the complex pixel list of the compacted resolve, packed like
+// PackCoords in ComputeShaderTile.hlsl
+inline unsigned int PackPixelCoords(unsigned int x, unsigned int y)
+{
+    return (y << 16u) | x;
+}
+
+inline unsigned int UnpackPixelCoordsX(unsigned int packed)
+{
+    return packed & 0xFFFFu;
+}
+
+inline unsigned int UnpackPixelCoordsY(unsigned int packed)
+{
+    return packed >> 16u;
+}
+
+#endif // STREAMINGADDRESSING_H
@@ -2,6 +2,7 @@
 #define STREAMINGBUFFERS_HLSL
 
 #include "StreamingStructs.h"
+#include "StreamingAddressing.h"
 #include "UintByteArray.hlsl"
 #include "D3DX_DXGIFormatConvert.inl"
 
@@ -16,28 +17,61 @@ RWStructuredBuffer<PixelStats> gPixelStats : register(u5);
 RWTexture2D<uint> gListTexture : register(u5);
 #endif // defined(STREAMING_USE_LIST_TEXTURE)
 
+#if STREAMING_NODE_POOL
+// Pool block of each pixel with more than one node
+RWTexture2D<uint> gPoolIndexTexture : register(u6);
+#endif // STREAMING_NODE_POOL
+
+#if STREAMING_HIZ
+// Occluded pixel count and occluder end depth per tile, see STREAMING_HIZ
+globallycoherent RWStructuredBuffer<HiZTile> gHiZTiles : register(u7);
+#endif // STREAMING_HIZ
+
 ShadeNode UnpackShadeNode(in ShadeNodePacked packed);
 ShadeNodePacked PackShadeNode(in ShadeNode shade);
 
+uint GetNodePlaneSize()
+{
+    return GetAddressingPlaneSize(mFramebufferDimensions.x, mFramebufferDimensions.y, STREAMING_ADDRESSING,
+                                  STREAMING_TILE_LOGX, STREAMING_TILE_LOGY);
+}
+
 uint GetNodeIndex(uint2 coords)
 {
-#if defined(STREAMING_TILED_ADDRESSING)
-#define AOIT_TILE_LOGX 0U
-#define AOIT_TILE_LOGY 1U
-     const uint surfaceWidth = mFramebufferDimensions.x >> AOIT_TILE_LOGX;
-     uint2 tileAddr2D  = uint2(coords[0] >> AOIT_TILE_LOGX, coords[1] >> AOIT_TILE_LOGY);
-     uint  tileAddr1D  = (tileAddr2D[0] + surfaceWidth * tileAddr2D[1]) << (AOIT_TILE_LOGX + AOIT_TILE_LOGY);
-     uint2 pixelAddr2D = uint2(coords[0] & ((1 << AOIT_TILE_LOGX) - 1), coords[1] & ((1 << AOIT_TILE_LOGY) - 1));
-     uint  pixelAddr1D = (pixelAddr2D[1] << AOIT_TILE_LOGX) | pixelAddr2D[0];
-     return tileAddr1D | pixelAddr1D;
-#else // !defined(STREAMING_TILED_ADDRESSING)
-    return (coords.x + mFramebufferDimensions.x * coords.y) * STREAMING_MAX_SURFACES_PER_PIXEL;
-#endif // !defined(STREAMING_TILED_ADDRESSING)
+    return GetPixelAddress(coords.x, coords.y, mFramebufferDimensions.x, STREAMING_ADDRESSING,
+                           STREAMING_TILE_LOGX, STREAMING_TILE_LOGY);
 }
 
 uint GetNodeIndex(uint2 coords, uint index)
 {
-    return (mFramebufferDimensions.x * mFramebufferDimensions.y * index) + GetNodeIndex(coords);
+#if STREAMING_NODE_POOL
+    // gMergeBuffer is the first node plane followed by the pool
+    if (index > 0) {
+        return GetNodePlaneSize() + gPoolIndexTexture[coords] * (STREAMING_MAX_SURFACES_PER_PIXEL - 1) + index - 1;
+    }
+    return GetNodeIndex(coords);
+#else // !STREAMING_NODE_POOL
+    return GetNodeAddress(GetNodeIndex(coords), index, GetNodePlaneSize(), STREAMING_MAX_SURFACES_PER_PIXEL,
+                          STREAMING_PIXEL_MAJOR_NODES);
+#endif // !STREAMING_NODE_POOL
+}
+
+// Called when a pixel is about to store its second node. Returns false if
+// the pool is exhausted.
+bool AllocatePoolBlock(uint2 coords)
+{
+#if STREAMING_NODE_POOL
+    uint nodes, stride;
+    gMergeBuffer.GetDimensions(nodes, stride);
+    uint poolNodes = nodes - GetNodePlaneSize();
+
+    uint block = gMergeBuffer.IncrementCounter();
+    if ((block + 1) * (STREAMING_MAX_SURFACES_PER_PIXEL - 1) > poolNodes) {
+        return false;
+    }
+    gPoolIndexTexture[coords] = block;
+#endif // STREAMING_NODE_POOL
+    return true;
 }
 
 uint GetNodeCountIndex(uint2 coords)
@@ -45,12 +79,31 @@ uint GetNodeCountIndex(uint2 coords)
     return (coords.x + mFramebufferDimensions.x * coords.y);
 }
 
+uint GetFrameEpoch()
+{
+    return mFramebufferDimensions.z;
+}
+
+// gCountTexture word of the pixel. With STREAMING_EPOCH_COUNTS a word left by
+// an earlier frame reads as an empty word of this frame, and anything written
+// back from it carries the current epoch.
+uint GetCountWord(uint2 coords)
+{
+    uint count = gCountTexture[coords];
+#if STREAMING_EPOCH_COUNTS
+    [flatten] if ((count >> STREAMING_EPOCH_SHIFT) != GetFrameEpoch()) {
+        count = GetFrameEpoch() << STREAMING_EPOCH_SHIFT;
+    }
+#endif // STREAMING_EPOCH_COUNTS
+    return count;
+}
+
 uint GetNodeCount(uint2 coords)
 {
 #if defined(STREAMING_DEBUG_OPTIONS)
     uint nodeCount = gPixelStats[GetNodeCountIndex(coords)].nodeCount;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    uint nodeCount = gCountTexture[coords] & 0x3;
+    uint nodeCount = GetCountWord(coords) & STREAMING_NODE_COUNT_MASK;
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
     return min(nodeCount, STREAMING_MAX_SURFACES_PER_PIXEL);
 }
@@ -60,9 +113,9 @@ void SetNodeCount(uint2 coords, uint value)
 #if defined(STREAMING_DEBUG_OPTIONS)
     gPixelStats[GetNodeCountIndex(coords)].nodeCount = value;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    uint count = gCountTexture[coords];
-    count = count & ~(0x3);
-    count = count | (value & 0x3);
+    uint count = GetCountWord(coords);
+    count = count & ~(STREAMING_NODE_COUNT_MASK);
+    count = count | (value & STREAMING_NODE_COUNT_MASK);
     gCountTexture[coords] = count;
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
 }
@@ -72,19 +125,35 @@ MergeNode GetMergeNode(uint2 coords, in uint index)
     MergeNodePacked packed = gMergeBuffer[GetNodeIndex(coords, index)];
     MergeNode merge;
 
+#if STREAMING_COMPACT_MERGE_NODE
+    float2 octahedral = float2(packed.zViewNormalX & 0x3FF, packed.derivativesNormalY & 0x3FF) / 1023.0f;
+    merge.normal = EncodeSphereMap(DecodeOctahedral(octahedral));
+    merge.zViewDerivatives = float2(UnpackDerivative11(packed.derivativesNormalY >> 21),
+                                    UnpackDerivative11((packed.derivativesNormalY >> 10) & 0x7FF));
+    merge.zView = UnpackZView22(packed.zViewNormalX >> 10);
+#else // !STREAMING_COMPACT_MERGE_NODE
     merge.normal = D3DX_R16G16_FLOAT_to_FLOAT2(packed.normal);
     merge.zViewDerivatives = D3DX_R16G16_FLOAT_to_FLOAT2(packed.zViewDerivatives);
     merge.zView = packed.zView;
+#endif // !STREAMING_COMPACT_MERGE_NODE
 
+#if STREAMING_WIDE_COVERAGE
+    merge.coverage = packed.coverage;
+    merge.depthTestedCoverage = packed.depthTestedCoverage;
+    merge.shade.specular.y = f16tof32(packed.specular);
+#else // !STREAMING_WIDE_COVERAGE
     merge.coverage = packed.coverage & 0xFFFF; // only take coverage data from packed.coverage
     merge.shade.specular.y = f16tof32(packed.coverage >> 16);
+#endif // !STREAMING_WIDE_COVERAGE
 
     float4 temp = D3DX_R8G8B8A8_UNORM_to_FLOAT4(packed.albedo);
     merge.shade.albedo = float4(temp.xyz, 1.0f);
     merge.shade.specular.x = temp.w;
 
 #if defined(STREAMING_DEBUG_OPTIONS)
+#if !STREAMING_WIDE_COVERAGE
     merge.depthTestedCoverage = packed.depthTestedCoverage;
+#endif // !STREAMING_WIDE_COVERAGE
     merge.shadeIndex = packed.shadeIndex;
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 
@@ -95,16 +164,30 @@ void SetMergeNode(in uint2 coords, in uint index, in MergeNode merge)
 {
     MergeNodePacked packed;
 
+#if STREAMING_COMPACT_MERGE_NODE
+    uint2 octahedral = uint2(round(EncodeOctahedral(DecodeSphereMap(merge.normal)) * 1023.0f));
+    packed.zViewNormalX = (PackZView22(merge.zView) << 10) | octahedral.x;
+    packed.derivativesNormalY = (PackDerivative11(merge.zViewDerivatives.x) << 21) |
+                                (PackDerivative11(merge.zViewDerivatives.y) << 10) | octahedral.y;
+#else // !STREAMING_COMPACT_MERGE_NODE
     packed.normal = D3DX_FLOAT2_to_R16G16_FLOAT(merge.normal);
     packed.zViewDerivatives = D3DX_FLOAT2_to_R16G16_FLOAT(merge.zViewDerivatives);
     packed.zView = merge.zView;
+#endif // !STREAMING_COMPACT_MERGE_NODE
     packed.coverage = merge.coverage;
 
     packed.albedo = D3DX_FLOAT4_to_R8G8B8A8_UNORM(float4(merge.shade.albedo.xyz, merge.shade.specular.x));
+#if STREAMING_WIDE_COVERAGE
+    packed.depthTestedCoverage = merge.depthTestedCoverage;
+    packed.specular = f32tof16(merge.shade.specular.y);
+#else // !STREAMING_WIDE_COVERAGE
     packed.coverage = packed.coverage | (asuint(f32tof16(merge.shade.specular.y)) << 16);
+#endif // !STREAMING_WIDE_COVERAGE
 
 #if defined(STREAMING_DEBUG_OPTIONS)
+#if !STREAMING_WIDE_COVERAGE
     packed.depthTestedCoverage = merge.depthTestedCoverage;
+#endif // !STREAMING_WIDE_COVERAGE
     packed.shadeIndex = merge.shadeIndex;
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 
@@ -201,7 +284,7 @@ void SetDiscardedSamples(in uint2 coords, in uint discardedSamples)
 #if defined(STREAMING_DEBUG_OPTIONS)
     gPixelStats[GetNodeCountIndex(coords)].discardedSamples = discardedSamples;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    uint temp = gCountTexture[coords];
+    uint temp = GetCountWord(coords);
     temp &= ~(0x1 << 9);
     temp |= (discardedSamples << 9);
     gCountTexture[coords] = temp;
@@ -213,10 +296,81 @@ uint GetDiscardedSamples(in uint2 coords)
 #if defined(STREAMING_DEBUG_OPTIONS)
     return gPixelStats[GetNodeCountIndex(coords)].discardedSamples;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    return (gCountTexture[coords] & (0x1 << 9)) >> 9;
+    return (GetCountWord(coords) & (0x1 << 9)) >> 9;
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
 }
 
+#if STREAMING_HIZ
+uint GetHiZTileIndex(uint2 coords)
+{
+    uint tilesX = (mFramebufferDimensions.x + STREAMING_HIZ_TILE_DIM - 1) / STREAMING_HIZ_TILE_DIM;
+    uint2 tile = coords / STREAMING_HIZ_TILE_DIM;
+    return tile.x + tilesX * tile.y;
+}
+
+// Tiles on the right and bottom edges may hold fewer pixels
+uint GetHiZTilePixels(uint2 coords)
+{
+    uint2 start = (coords / STREAMING_HIZ_TILE_DIM) * STREAMING_HIZ_TILE_DIM;
+    uint2 size = min(uint2(STREAMING_HIZ_TILE_DIM, STREAMING_HIZ_TILE_DIM), mFramebufferDimensions.xy - start);
+    return size.x * size.y;
+}
+#endif // STREAMING_HIZ
+
+// True if every pixel of the tile has an occluder that ends in front of
+// depth. Read outside the ordered section, the tile only ever grows more
+// occluded during a frame.
+bool HiZReject(uint2 coords, float depth)
+{
+#if STREAMING_HIZ
+    HiZTile tile = gHiZTiles[GetHiZTileIndex(coords)];
+    return tile.occludedPixels == GetHiZTilePixels(coords) && depth > asfloat(tile.occluderEnd);
+#else // !STREAMING_HIZ
+    return false;
+#endif // !STREAMING_HIZ
+}
+
+// Called from OccluderFusion when it finds a node behind the occluder, so
+// every surface the occluder was built from stays in the pixel. The first
+// time it covers every sample of the pixel, the pixel joins its tile, unless
+// it has discarded this frame.
+void AddHiZOccluder(uint2 coords, uint occluderCoverage, float occluderEnd)
+{
+#if STREAMING_HIZ
+#if MSAA_SAMPLES < 32
+    uint allSamples = (1 << MSAA_SAMPLES) - 1;
+#else // MSAA_SAMPLES == 32
+    uint allSamples = 0xFFFFFFFF;
+#endif // MSAA_SAMPLES == 32
+    [branch] if ((occluderCoverage & allSamples) == allSamples && GetDiscardedSamples(coords) == 0) {
+        uint count = GetCountWord(coords);
+        [branch] if ((count & (0x1 << STREAMING_HIZ_OCCLUDED_BIT)) == 0) {
+            gCountTexture[coords] = count | (0x1 << STREAMING_HIZ_OCCLUDED_BIT);
+
+            // The depth goes in before the pixel counts
+            uint index = GetHiZTileIndex(coords);
+            InterlockedMax(gHiZTiles[index].occluderEnd, asuint(occluderEnd));
+            DeviceMemoryBarrier();
+            InterlockedAdd(gHiZTiles[index].occludedPixels, 1);
+        }
+    }
+#endif // STREAMING_HIZ
+}
+
+// Called from OccluderFusion when it discards. The surface it throws away
+// may be part of the occluder, so the pixel leaves its tile. Its end depth
+// stays, but the tile cannot fill up again this frame.
+void RemoveHiZOccluder(uint2 coords)
+{
+#if STREAMING_HIZ
+    uint count = GetCountWord(coords);
+    [branch] if ((count & (0x1 << STREAMING_HIZ_OCCLUDED_BIT)) != 0) {
+        gCountTexture[coords] = count & ~(0x1 << STREAMING_HIZ_OCCLUDED_BIT);
+        InterlockedAdd(gHiZTiles[GetHiZTileIndex(coords)].occludedPixels, 0xFFFFFFFF);
+    }
+#endif // STREAMING_HIZ
+}
+
 #if defined(STREAMING_DEBUG_OPTIONS)
 
 void SetMergeCount(in uint2 coords, in uint merges)
@@ -253,12 +407,18 @@ void IncrementDiscardCount(in uint2 coords)
 uint GetNodeList(uint2 coords)
 {
 #if defined(STREAMING_USE_LIST_TEXTURE)
+#if STREAMING_EPOCH_COUNTS
+    // Never cleared, so only this frame's once the pixel has a second node.
+    // A single node is always node 0.
+    return GetNodeCount(coords) > 1 ? gListTexture[coords] : 0;
+#else // !STREAMING_EPOCH_COUNTS
     return gListTexture[coords];
+#endif // !STREAMING_EPOCH_COUNTS
 #else // !defined(STREAMING_USE_LIST_TEXTURE)
 #if defined(STREAMING_DEBUG_OPTIONS)
     return gPixelStats[GetNodeCountIndex(coords)].nodeList;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    return (gCountTexture[coords] & 0xFC) >> 2;
+    return (GetCountWord(coords) & 0xFC) >> 2;
 #endif // !defined(STREAMING_DEBUG_OPTIONS)
 #endif // !defined(STREAMING_LIST_TEXTURE)
 }
@@ -271,7 +431,7 @@ void SetNodeList(uint2 coords, in uint nodeList)
 #if defined(STREAMING_DEBUG_OPTIONS)
     gPixelStats[GetNodeCountIndex(coords)].nodeList = nodeList;
 #else // !defined(STREAMING_DEBUG_OPTIONS)
-    uint temp = gCountTexture[coords];
+    uint temp = GetCountWord(coords);
     temp &= ~0xFC;
     temp |= ((nodeList & 0x3F) << 2);
     gCountTexture[coords] = temp;
@@ -0,0 +1,47 @@
+#ifndef STREAMINGCLUSTERS_H
+#define STREAMINGCLUSTERS_H
+
+// Froxels of the clustered light lists, written in the subset of C++ and HLSL
+// that both compile, like StreamingAddressing.h. Slices are exponential in
+// view depth between the near and far planes, so each one spans the same
+// depth ratio. Clusters are numbered tile by tile, row-major, one slice after
+// the other; each has an offset and a count into one array of light indices.
+
+#include "StreamingDefines.h"
+#if defined(__cplusplus)
+#include <math.h>
+#endif // defined(__cplusplus)
+
+// Depths in front of nearZ go to the first slice, those past farZ to the last
+inline unsigned int GetClusterSlice(float zView, float nearZ, float farZ, unsigned int slices)
+{
+    float slice = log(zView / nearZ) * (float)slices / log(farZ / nearZ);
+    slice = slice > 0.0f ? slice : 0.0f;
+    unsigned int index = (unsigned int)slice;
+    return index < slices - 1u ? index : slices - 1u;
+}
+
+// View depth where slice starts, farZ for slice == slices
+inline float GetClusterSliceStart(unsigned int slice, float nearZ, float farZ, unsigned int slices)
+{
+    return nearZ * pow(farZ / nearZ, (float)slice / (float)slices);
+}
+
+inline unsigned int GetClusterTilesX(unsigned int width, unsigned int tileDim)
+{
+    return (width + tileDim - 1u) / tileDim;
+}
+
+inline unsigned int GetClusterTilesY(unsigned int height, unsigned int tileDim)
+{
+    return (height + tileDim - 1u) / tileDim;
+}
+
+// Cluster of pixel (x, y) in the first slice; slice s is s times the tile
+// count further
+inline unsigned int GetClusterIndex(unsigned int x, unsigned int y, unsigned int width, unsigned int tileDim)
+{
+    return (x / tileDim) + GetClusterTilesX(width, tileDim) * (y / tileDim);
+}
+
+#endif // STREAMINGCLUSTERS_H
@@ -15,8 +15,196 @@
 #undef STREAMING_USE_LIST_TEXTURE
 #endif // defined(STREAMING_USE_LIST_TEXTURE) && defined(STREAMING_DEBUG_OPTIONS)
 
-#define STREAMING_TILED_ADDRESSING 1
+// Tag gCountTexture words with the frame that wrote them in the top
+// STREAMING_EPOCH_BITS bits. A word of an earlier frame reads as an empty
+// pixel, so the resolve never writes gCountTexture or gListTexture. The app
+// passes the epoch in mFramebufferDimensions.z, never uses 0, and clears the
+// count texture once whenever the epoch wraps. The debug options keep the
+// counts in gPixelStats, which the resolve still clears.
+#if !defined(STREAMING_EPOCH_COUNTS)
+#define STREAMING_EPOCH_COUNTS 1
+#endif // !defined(STREAMING_EPOCH_COUNTS)
+
+#if STREAMING_EPOCH_COUNTS && defined(STREAMING_DEBUG_OPTIONS)
+#undef STREAMING_EPOCH_COUNTS
+#define STREAMING_EPOCH_COUNTS 0
+#endif // STREAMING_EPOCH_COUNTS && defined(STREAMING_DEBUG_OPTIONS)
+
+#define STREAMING_EPOCH_BITS 16
+#define STREAMING_EPOCH_SHIFT (32 - STREAMING_EPOCH_BITS)
+#define STREAMING_EPOCH_MAX ((1 << STREAMING_EPOCH_BITS) - 1)
+
+// gMergeBuffer layout, see StreamingAddressing.h. Tiled and Morton mappings
+// use tiles of 2^STREAMING_TILE_LOGX x 2^STREAMING_TILE_LOGY pixels.
+// Node-major stores node i of every pixel in plane i, pixel-major keeps the
+// nodes of a pixel together. The app may pass any of these as macros.
+#define STREAMING_ADDRESSING_LINEAR 0
+#define STREAMING_ADDRESSING_TILED 1
+#define STREAMING_ADDRESSING_MORTON 2
+
+#if !defined(STREAMING_ADDRESSING)
+#define STREAMING_ADDRESSING STREAMING_ADDRESSING_TILED
+#endif // !defined(STREAMING_ADDRESSING)
+#if !defined(STREAMING_TILE_LOGX)
+#define STREAMING_TILE_LOGX 0
+#endif // !defined(STREAMING_TILE_LOGX)
+#if !defined(STREAMING_TILE_LOGY)
+#define STREAMING_TILE_LOGY 1
+#endif // !defined(STREAMING_TILE_LOGY)
+#if !defined(STREAMING_PIXEL_MAJOR_NODES)
+#define STREAMING_PIXEL_MAJOR_NODES 0
+#endif // !defined(STREAMING_PIXEL_MAJOR_NODES)
+
+// Store merge nodes in 16 instead of 20 bytes: zView keeps 14 mantissa bits,
+// the derivatives 5, and the normal is octahedral encoded in 2x10 bits. Passed
+// in by the app like STREAMING_MAX_SURFACES_PER_PIXEL.
+#if !defined(STREAMING_COMPACT_MERGE_NODE)
+#define STREAMING_COMPACT_MERGE_NODE 0
+#endif // !defined(STREAMING_COMPACT_MERGE_NODE)
+
+#if STREAMING_COMPACT_MERGE_NODE && defined(STREAMING_DEBUG_OPTIONS)
+#error STREAMING_COMPACT_MERGE_NODE has no room for the debug fields
+#endif
+
+// Keep coverage and depth tested coverage in separate 32 bit masks instead of
+// the two low bytes of MergeNodePacked.coverage, for 16x and 32x MSAA. The
+// specular power moves to its own field, so nodes grow to 28 bytes. Passed in
+// by the app like STREAMING_COMPACT_MERGE_NODE.
+#if !defined(STREAMING_WIDE_COVERAGE)
+#define STREAMING_WIDE_COVERAGE 0
+#endif // !defined(STREAMING_WIDE_COVERAGE)
+
+#if STREAMING_WIDE_COVERAGE && STREAMING_COMPACT_MERGE_NODE
+#error STREAMING_WIDE_COVERAGE and STREAMING_COMPACT_MERGE_NODE are exclusive
+#endif
+
+#if !defined(__cplusplus) && (MSAA_SAMPLES > 8) && !STREAMING_WIDE_COVERAGE
+#error More than 8 samples need STREAMING_WIDE_COVERAGE
+#endif
+
+// MergeNode carries depthTestedCoverage as a field of its own
+#if defined(STREAMING_DEBUG_OPTIONS) || STREAMING_WIDE_COVERAGE
+#define STREAMING_SEPARATE_COVERAGE 1
+#else
+#define STREAMING_SEPARATE_COVERAGE 0
+#endif
+
+// Store the first node of every pixel in a dense plane and hand out the other
+// STREAMING_MAX_SURFACES_PER_PIXEL-1 nodes in blocks from a shared pool, once
+// a pixel gets its second surface. The pool is sized by the app and blocks
+// come from the hidden counter of gMergeBuffer. Fragments that find the pool
+// exhausted are dropped and flagged as discarded samples.
+#if !defined(STREAMING_NODE_POOL)
+#define STREAMING_NODE_POOL 0
+#endif // !defined(STREAMING_NODE_POOL)
+
+#if STREAMING_NODE_POOL && !defined(STREAMING_USE_LIST_TEXTURE)
+#error STREAMING_NODE_POOL needs STREAMING_USE_LIST_TEXTURE
+#endif
+
+// Reject fragments in StreamingGBufferPS before the ordered section when
+// they lie behind an occluder in every pixel of their tile. Once the occluder
+// OccluderFusion builds covers all samples of a pixel, the pixel sets
+// STREAMING_HIZ_OCCLUDED_BIT in its count word and adds itself to its tile
+// in gHiZTiles, one HiZTile per STREAMING_HIZ_TILE_DIM^2 pixels. A pixel
+// that discards leaves its tile and does not join again that frame. View
+// depths are positive, so their bits order like the floats. The app clears the
+// tiles every frame and passes STREAMING_HIZ like STREAMING_NODE_POOL.
+#if !defined(STREAMING_HIZ)
+#define STREAMING_HIZ 0
+#endif // !defined(STREAMING_HIZ)
+
+#if STREAMING_HIZ && !defined(STREAMING_USE_LIST_TEXTURE)
+#error STREAMING_HIZ needs STREAMING_USE_LIST_TEXTURE
+#endif
+
+#define STREAMING_HIZ_TILE_DIM 8
+#define STREAMING_HIZ_OCCLUDED_BIT 10
+
+// Node prediction, only modeled on the CPU (see StreamingCpu/NodePrediction.h):
+// a summary of last frame's depth range per slot, widened by
+// STREAMING_PREDICTION_MARGIN, tells the merge which nodes it may skip. It is
+// not in StreamingGBufferPS because StreamingBench --predict shows the summary
+// reads and writes cost more bytes than the skipped nodes save. The merge
+// kernel's PixelT::PredictNode returns one of the STREAMING_PREDICTION_LOAD,
+// FRONT and BEHIND values.
+#define STREAMING_PREDICTION_MARGIN (1.0f / 64.0f)
+#define STREAMING_PREDICTION_UNKNOWN 0xFFFFFFFF     // a slot not in use last frame
+#define STREAMING_PREDICTION_LOAD 0
+#define STREAMING_PREDICTION_FRONT 1
+#define STREAMING_PREDICTION_BEHIND 2
+
+// What OccluderFusion throws away from a full pixel when no surface is
+// entirely occluded: the one adding the fewest samples to the occluder, the
+// farthest, or the one whose new samples carry the least albedo luma. The CPU
+// model (StreamingCpu/DiscardPolicy.h) also has a least recently written
+// policy, which needs per-sample state the shaders do not keep.
+#define STREAMING_DISCARD_LEAST_COVERAGE 0
+#define STREAMING_DISCARD_FARTHEST 1
+#define STREAMING_DISCARD_LEAST_ENERGY 2
+
+#if !defined(STREAMING_DISCARD_POLICY)
+#define STREAMING_DISCARD_POLICY STREAMING_DISCARD_LEAST_COVERAGE
+#endif // !defined(STREAMING_DISCARD_POLICY)
+
+// The app passes STREAMING_MAX_SURFACES_PER_PIXEL to the shaders as a macro so
+// it can be changed without editing this file. The CPU merge supports 1 to 8
+// surfaces. The resolve stores per-surface weights in the bytes of a uint so
+// the shaders stop at 4.
+#if !defined(STREAMING_MAX_SURFACES_PER_PIXEL)
 #define STREAMING_MAX_SURFACES_PER_PIXEL 3
+#endif // !defined(STREAMING_MAX_SURFACES_PER_PIXEL)
+#define STREAMING_SURFACES_PER_PIXEL_MIN 1
+#define STREAMING_SURFACES_PER_PIXEL_MAX_GPU 4
+#define STREAMING_SURFACES_PER_PIXEL_MAX_CPU 8
+
+#if defined(__cplusplus)
+#if (STREAMING_MAX_SURFACES_PER_PIXEL < STREAMING_SURFACES_PER_PIXEL_MIN) || \
+    (STREAMING_MAX_SURFACES_PER_PIXEL > STREAMING_SURFACES_PER_PIXEL_MAX_CPU)
+#error STREAMING_MAX_SURFACES_PER_PIXEL is out of range
+#endif
+#else // !defined(__cplusplus)
+#if (STREAMING_MAX_SURFACES_PER_PIXEL < STREAMING_SURFACES_PER_PIXEL_MIN) || \
+    (STREAMING_MAX_SURFACES_PER_PIXEL > STREAMING_SURFACES_PER_PIXEL_MAX_GPU)
+#error STREAMING_MAX_SURFACES_PER_PIXEL is out of range
+#endif
+#endif // !defined(__cplusplus)
+
+// Bits per entry in the node list and bits of the count texture holding the
+// node count. The node list briefly holds STREAMING_MAX_SURFACES_PER_PIXEL+1
+// entries during a merge, which still fits a uint with 3 bit entries.
+#if (STREAMING_MAX_SURFACES_PER_PIXEL < 4)
+#define STREAMING_NODE_INDEX_BITS 2
+#define STREAMING_NODE_COUNT_BITS 2
+#elif (STREAMING_MAX_SURFACES_PER_PIXEL < 8)
+#define STREAMING_NODE_INDEX_BITS 3
+#define STREAMING_NODE_COUNT_BITS 3
+#else // (STREAMING_MAX_SURFACES_PER_PIXEL == 8)
+#define STREAMING_NODE_INDEX_BITS 3
+#define STREAMING_NODE_COUNT_BITS 4
+#endif // (STREAMING_MAX_SURFACES_PER_PIXEL == 8)
+#define STREAMING_NODE_INDEX_MASK ((1 << STREAMING_NODE_INDEX_BITS) - 1)
+#define STREAMING_NODE_COUNT_MASK ((1 << STREAMING_NODE_COUNT_BITS) - 1)
+
+// Resolve compaction: StreamingResolveSimplePS appends the pixels with more
+// than one node to gComplexPixels and counts them in the argument buffer,
+// which holds DrawInstancedIndirect arguments for StreamingComplexPixelVS
+// followed by DispatchIndirect arguments for StreamingResolveComplexCS.
+// Offsets are in uints.
+#define STREAMING_COMPLEX_PIXEL_GROUP_SIZE 64
+#define STREAMING_COMPLEX_ARGS_VERTEX_COUNT 0
+#define STREAMING_COMPLEX_ARGS_GROUPS_X 4
+#define STREAMING_COMPLEX_ARGS_COUNT 7
+
+// Clustered light lists of CULL_STREAMING_SBAA_NDI_CLUSTERED, see
+// StreamingClusters.h: STREAMING_CLUSTER_TILE_DIM pixel tiles, each cut into
+// STREAMING_CLUSTER_SLICES exponential depth slices. Lights are culled
+// against slices widened by STREAMING_CLUSTER_MARGIN, so a surface the GPU's
+// log() puts in the neighbouring slice still finds every light that reaches it.
+#define STREAMING_CLUSTER_TILE_DIM 32
+#define STREAMING_CLUSTER_SLICES 32
+#define STREAMING_CLUSTER_MARGIN (1.0f / 256.0f)
+
 #define STREAMING_COS_THETA 0.78539816339f // pi / 4
 
 #define MERGENODE_COVERAGE_BYTE 0
@@ -32,6 +32,15 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
     merge.shade.albedo = (textureDim.x == 0U ? float4(1.0f, 1.0f, 1.0f, 1.0f) : merge.shade.albedo);
     merge.shade.specular = float2(0.9f, 25.0f); // hard coded to match values from Rendering.hlsl
 
+    // Fragments behind the occluders of their whole tile would only be stored
+    // with no samples left to them or be thrown out by OccluderFusion
+    float incomingMin = 0.0f;
+    float incomingMax = 0.0f;
+    GetDepthRange(merge, incomingMin, incomingMax);
+    [branch] if (HiZReject(input.position.xy, incomingMin)) {
+        return;
+    }
+
     IntelExt_BeginPixelShaderOrdering();
 
     uint nodeIndex = GetNodeIndex(input.position.xy);
@@ -64,9 +73,6 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
 
     // merge incoming fragment with existing nodes. traverse nodes in depth order and
     // save the position where incoming fits in the list
-    float incomingMin = 0.0f;
-    float incomingMax = 0.0f;
-    GetDepthRange(merge, incomingMin, incomingMax);
     [loop][allow_uav_condition] for (uint i = 0; i < nodeCount; i++) {
 
         uint tempIndex = Get2BitsInByte(nodeList, i);
@@ -130,6 +136,10 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
             SetMergeNode(input.position.xy, incomingIndex, merge);
         }
     } else {
+        if (nodeCount == 1 && !AllocatePoolBlock(input.position.xy)) {
+            SetDiscardedSamples(input.position.xy, 1);
+            return;
+        }
         nodeCount = nodeCount + 1;
         // save the incoming fragment
         SetNodeCount(input.position.xy, nodeCount);
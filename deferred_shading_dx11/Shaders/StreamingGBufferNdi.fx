@@ -65,7 +65,7 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
     float occluderStart = 0.0f;
     float occluderEnd = 0.0f;
     uint occluderCoverage = 0;
-    uint minCoverageCount = countbits(0xFF);
+    uint minCoverageCount = countbits(0xFFFFFFFF);
     float minCoverageIndex = 0;
     bool completeOcclusion = false;
     uint removedIndex = 0;
@@ -122,7 +122,7 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
         }
 
         //  5. perform occluder fusion on temp
-        uint tempCoverage = temp.coverage;
+        uint tempCoverage = GetDepthTestedCoverage(temp);
         if (OcclusionCheck(temp, occluderStart, occluderEnd, occluderCoverage, currentCoverage)) {
             removedPosition = i;
             minCoverageIndex = i;
@@ -132,7 +132,7 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
         UpdateMinCoverage(currentCoverage, i, minCoverageCount, removedPosition);
 
         //  6. write back modified temp
-        if (tempCoverage != temp.coverage) {
+        if (tempCoverage != GetDepthTestedCoverage(temp)) {
             SetDepthTestedCoverage(gMergeBuffer[GetNodeIndex(input.position.xy, tempIndex)], GetDepthTestedCoverage(temp));
         }
     }
@@ -199,6 +199,10 @@ void StreamingGBufferPS(GeometryVSOut input, uint coverage : SV_Coverage, out fl
         }
     } else {
         // 5. save the nodeList and the incoming node.
+        if (nodeCount == 1 && !AllocatePoolBlock(input.position.xy)) {
+            SetDiscardedSamples(input.position.xy, 1);
+            return;
+        }
         nodeCount = nodeCount + 1;
         SetNodeCount(input.position.xy, nodeCount);
         SetNodeList(input.position.xy, nodeList);
@@ -0,0 +1,161 @@
+#ifndef STREAMINGLIGHTCULL_FX
+#define STREAMINGLIGHTCULL_FX
+
+#include "..\PerFrameConstants.hlsl"
+#include "..\Rendering.hlsl"
+#include "..\ShaderDefines.h"
+#include "StreamingStructs.h"
+#include "StreamingBuffers.hlsl"
+
+// Light lists read by StreamingResolveTiledPS, see GetTileLightListAddress()
+RWStructuredBuffer<uint> gTileLightLists : register(u1);
+
+groupshared uint sMinZ;
+groupshared uint sMaxZ;
+
+// One bit per light of the batch being culled
+groupshared uint sLightMask[COMPUTE_SHADER_TILE_GROUP_SIZE / 32];
+groupshared uint sTileNumLights;
+
+// Builds the light list of a tile from the merge nodes StreamingGBufferPS left
+// this frame. With STREAMING_EPOCH_COUNTS the epoch tag marks count words of
+// earlier frames as empty, so older nodes are never read. Without it this has
+// to run before the resolve clears the count and list textures. The frustum
+// test is the one ComputeShaderTileCS uses. Lights are stored in ascending
+// order, so the resolve sums the same lights in the same order as BasicLoop
+// and only skips lights that would not have contributed.
+[numthreads(COMPUTE_SHADER_TILE_GROUP_DIM, COMPUTE_SHADER_TILE_GROUP_DIM, 1)]
+void StreamingLightCullCS(uint3 groupId          : SV_GroupID,
+                          uint3 dispatchThreadId : SV_DispatchThreadID,
+                          uint3 groupThreadId    : SV_GroupThreadID)
+{
+    uint groupIndex = groupThreadId.y * COMPUTE_SHADER_TILE_GROUP_DIM + groupThreadId.x;
+
+    uint totalLights, dummy;
+    gLight.GetDimensions(totalLights, dummy);
+    totalLights = min(totalLights, MAX_LIGHTS);
+
+    uint2 globalCoords = dispatchThreadId.xy;
+
+    // Work out Z bounds for the nodes of our pixel
+    float minZSample = mCameraNearFar.y;
+    float maxZSample = mCameraNearFar.x;
+    [branch] if (all(globalCoords < mFramebufferDimensions.xy)) {
+        uint nodeCount = GetNodeCount(globalCoords);
+        [unroll] for (uint i = 0; i < STREAMING_MAX_SURFACES_PER_PIXEL; ++i) {
+            [branch] if (i < nodeCount) {
+                float viewSpaceZ = GetMergeNode(globalCoords, i).zView;
+                bool validNode =
+                     viewSpaceZ >= mCameraNearFar.x &&
+                     viewSpaceZ <  mCameraNearFar.y;
+                [flatten] if (validNode) {
+                    minZSample = min(minZSample, viewSpaceZ);
+                    maxZSample = max(maxZSample, viewSpaceZ);
+                }
+            }
+        }
+    }
+
+    if (groupIndex == 0) {
+        sTileNumLights = 0;
+        sMinZ = 0x7F7FFFFF;      // Max float
+        sMaxZ = 0;
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    if (maxZSample >= minZSample) {
+        InterlockedMin(sMinZ, asuint(minZSample));
+        InterlockedMax(sMaxZ, asuint(maxZSample));
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    float minTileZ = asfloat(sMinZ);
+    float maxTileZ = asfloat(sMaxZ);
+
+    // Work out scale/bias from [0, 1]
+    float2 tileScale = float2(mFramebufferDimensions.xy) * rcp(float(2 * COMPUTE_SHADER_TILE_GROUP_DIM));
+    float2 tileBias = tileScale - float2(groupId.xy);
+
+    // Relevant matrix columns for this tile frusta
+    float4 c1 = float4(mCameraProj._11 * tileScale.x, 0.0f, tileBias.x, 0.0f);
+    float4 c2 = float4(0.0f, -mCameraProj._22 * tileScale.y, tileBias.y, 0.0f);
+    float4 c4 = float4(0.0f, 0.0f, 1.0f, 0.0f);
+
+    // Derive frustum planes
+    float4 frustumPlanes[6];
+    // Sides
+    frustumPlanes[0] = c4 - c1;
+    frustumPlanes[1] = c4 + c1;
+    frustumPlanes[2] = c4 - c2;
+    frustumPlanes[3] = c4 + c2;
+    // Near/far
+    frustumPlanes[4] = float4(0.0f, 0.0f,  1.0f, -minTileZ);
+    frustumPlanes[5] = float4(0.0f, 0.0f, -1.0f,  maxTileZ);
+
+    // Normalize frustum planes (near/far already normalized)
+    [unroll] for (uint i = 0; i < 4; ++i) {
+        frustumPlanes[i] *= rcp(length(frustumPlanes[i].xyz));
+    }
+
+    uint listAddress = GetTileLightListAddress(globalCoords.x, globalCoords.y, mFramebufferDimensions.x,
+                                               COMPUTE_SHADER_TILE_GROUP_DIM, MAX_LIGHTS);
+
+    // Cull a batch of lights at a time. Each light finds its slot by counting
+    // the lights before it that passed, instead of appending with atomics.
+    uint maskWord = groupIndex >> 5;
+    uint maskBit = 1u << (groupIndex & 31);
+    for (uint lightBase = 0; lightBase < totalLights; lightBase += COMPUTE_SHADER_TILE_GROUP_SIZE) {
+        if (groupIndex < COMPUTE_SHADER_TILE_GROUP_SIZE / 32) {
+            sLightMask[groupIndex] = 0;
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+
+        uint lightIndex = lightBase + groupIndex;
+        bool inFrustum = false;
+        [branch] if (lightIndex < totalLights) {
+            PointLight light = gLight[lightIndex];
+
+            // Cull: point light sphere vs tile frustum
+            inFrustum = true;
+            [unroll] for (uint i = 0; i < 6; ++i) {
+                float d = dot(frustumPlanes[i], float4(light.positionView, 1.0f));
+                inFrustum = inFrustum && (d >= -light.attenuationEnd);
+            }
+        }
+
+        if (inFrustum) {
+            InterlockedOr(sLightMask[maskWord], maskBit);
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+
+        [branch] if (inFrustum) {
+            uint slot = sTileNumLights + countbits(sLightMask[maskWord] & (maskBit - 1));
+            for (uint word = 0; word < maskWord; ++word) {
+                slot += countbits(sLightMask[word]);
+            }
+            gTileLightLists[listAddress + 1 + slot] = lightIndex;
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+
+        if (groupIndex == 0) {
+            uint batchLights = 0;
+            [unroll] for (uint word = 0; word < COMPUTE_SHADER_TILE_GROUP_SIZE / 32; ++word) {
+                batchLights += countbits(sLightMask[word]);
+            }
+            sTileNumLights += batchLights;
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (groupIndex == 0) {
+        gTileLightLists[listAddress] = sTileNumLights;
+    }
+}
+
+#endif // STREAMINGLIGHTCULL_FX
@@ -4,6 +4,7 @@
 #include "..\PerFrameConstants.hlsl"
 #include "..\FullScreenTriangle.hlsl"
 #include "StreamingStructs.h"
+#include "StreamingClusters.h"
 #include "StreamingBuffers.hlsl"
 #include "BasicLoop.hlsl"
 #include "DepthTests.hlsl"
@@ -12,6 +13,25 @@
 
 TextureCube<float4> gSkyboxTexture : register(t6);
 
+// Written by StreamingLightCullCS, see GetTileLightListAddress()
+StructuredBuffer<uint> gTileLightLists : register(t7);
+
+// Built by the app from the lights alone, see StreamingClusters.h: an offset
+// and a count per cluster into gClusterLightIndices
+StructuredBuffer<uint> gClusterRanges : register(t9);
+StructuredBuffer<uint> gClusterLightIndices : register(t10);
+
+// Light loops of the resolve entry points
+#define RESOLVE_LIGHTS_ALL 0
+#define RESOLVE_LIGHTS_TILED 1
+#define RESOLVE_LIGHTS_CLUSTERED 2
+
+// Resolve compaction, see StreamingResolveSimplePS. The argument buffer layout
+// is in StreamingDefines.h.
+RWStructuredBuffer<ComplexPixel> gComplexPixels : register(u1);
+RWByteAddressBuffer gComplexPixelArgs : register(u2);
+StructuredBuffer<ComplexPixel> gResolvedComplexPixels : register(t8);
+
 // TODO: This should be somewhere else...
 struct SkyboxVSOut
 {
@@ -19,10 +39,123 @@ struct SkyboxVSOut
     float3 skyboxCoord : skyboxCoord;
 };
 
-float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
+// BasicLoop over the lights StreamingLightCullCS kept for the tile. They are in
+// ascending order, so the result matches BasicLoop bit for bit.
+float4 BasicLoopTiled(SurfaceData surface, uint tileLightList)
+{
+    uint numLights = gTileLightLists[tileLightList];
+
+    float3 lit = float3(0.0f, 0.0f, 0.0f);
+
+    [flatten] if (surface.positionView.z < mCameraNearFar.y) {
+        for (uint tileLightIndex = 0; tileLightIndex < numLights; ++tileLightIndex) {
+            PointLight light = gLight[gTileLightLists[tileLightList + 1 + tileLightIndex]];
+            AccumulateBRDF(surface, light, lit);
+        }
+    }
+    return float4(lit, 1.0f);
+}
+
+// BasicLoop over the lights of the surface's cluster. Like the tile lists they
+// are in ascending order and only leave out lights that cannot reach the
+// cluster, widened by STREAMING_CLUSTER_MARGIN, so the result matches
+// BasicLoop bit for bit. tileCluster is the tile's cluster in the first slice.
+float4 BasicLoopClustered(SurfaceData surface, uint tileCluster)
+{
+    float3 lit = float3(0.0f, 0.0f, 0.0f);
+
+    [flatten] if (surface.positionView.z < mCameraNearFar.y) {
+        uint tileCount = GetClusterTilesX(mFramebufferDimensions.x, STREAMING_CLUSTER_TILE_DIM) *
+                         GetClusterTilesY(mFramebufferDimensions.y, STREAMING_CLUSTER_TILE_DIM);
+        uint slice = GetClusterSlice(surface.positionView.z, mCameraNearFar.x, mCameraNearFar.y,
+                                     STREAMING_CLUSTER_SLICES);
+        uint cluster = tileCluster + tileCount * slice;
+        uint firstLight = gClusterRanges[cluster * 2];
+        uint numLights = gClusterRanges[cluster * 2 + 1];
+        for (uint clusterLightIndex = 0; clusterLightIndex < numLights; ++clusterLightIndex) {
+            PointLight light = gLight[gClusterLightIndices[firstLight + clusterLightIndex]];
+            AccumulateBRDF(surface, light, lit);
+        }
+    }
+    return float4(lit, 1.0f);
+}
+
+// Address of the tile's light list, or its cluster in the first slice
+uint GetLightListAddress(uint2 coords, uint lightLists)
+{
+    return lightLists == RESOLVE_LIGHTS_CLUSTERED ?
+        GetClusterIndex(coords.x, coords.y, mFramebufferDimensions.x, STREAMING_CLUSTER_TILE_DIM) :
+        GetTileLightListAddress(coords.x, coords.y, mFramebufferDimensions.x, COMPUTE_SHADER_TILE_GROUP_DIM,
+                                MAX_LIGHTS);
+}
+
+float4 ShadeSurface(SurfaceData surface, uint lightLists, uint lightList)
+{
+    if (lightLists == RESOLVE_LIGHTS_CLUSTERED) {
+        return BasicLoopClustered(surface, lightList);
+    } else if (lightLists == RESOLVE_LIGHTS_TILED) {
+        return BasicLoopTiled(surface, lightList);
+    }
+    return BasicLoop(surface);
+}
+
+// 3. and 4. for MSAA_SAMPLES > 1. Returns the weighted sum of the surface colors.
+float4 ShadeWeightedSurfaces(uint2 coords, uint nodeList, uint nodeCount, uint lightLists,
+                             uint lightList, out float weightSum, out uint surfacesShaded)
+{
+    GBuffer rawData;
+    SurfaceData surface;
+    MergeNode merge;
+    uint weights = 0;
+    float4 output = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    weightSum = 0.0f;
+    surfacesShaded = 0;
+
+    // 3. Compute weights for all surfaces.
+    ResolveSurfaceWeights(coords, nodeList, nodeCount, weights, weightSum);
+
+    // 4. Shade each surface and weight appropriately.
+    [unroll] for (uint i = 0; i < nodeCount; i++) {
+        uint tempIndex = Get2BitsInByte(nodeList, i);
+        uint tempWeight = GetByteInUint(weights, tempIndex);
+        [branch] if (tempWeight > 0) {
+            surfacesShaded++;
+
+            // Convert our data structure to Lauritzen's
+            merge = GetMergeNode(coords, tempIndex);
+            GetGBufferFromShadeAndMergeNodes(coords, merge, merge.shade, rawData);
+            surface = ComputeSurfaceDataFromGBufferData(coords, merge.zView, rawData);
+
+            output += ShadeSurface(surface, lightLists, lightList) * tempWeight;
+        }
+    }
+    return output;
+}
+
+// 5. Average surface colors to final pixel color.
+float4 FinishPixel(float4 output, float weightSum, uint nodeCount, uint discardedSamples,
+                   float3 skybox, uint lightLists, uint lightList)
+{
+    [branch] if (lightLists == RESOLVE_LIGHTS_TILED && mUI.visualizeLightCount) {
+        return float4((float(gTileLightLists[lightList]) / 255.0f).xxx, 1.0f);
+    }
+
+    // If we discarded  samples, then compute the average using the sum of all samples that 
+    // we have information about. Otherwise, use the total number of samples.
+    if (discardedSamples > 0 && nodeCount != 0) {
+        return float4(output.xyz / weightSum, 1.0f);
+    } else {
+        float skyboxWeight = MSAA_SAMPLES - weightSum;
+        return float4((output.xyz + skybox * skyboxWeight) / (float) MSAA_SAMPLES, 1.0f);
+    }
+}
+
+// lightLists is a literal, so each entry point only keeps one light loop
+float4 StreamingResolve(SkyboxVSOut input, uint lightLists)
 {
     // 1. Load indexing data for this pixel.
-    // 2. Clear indexing data (to avoid a clear on the CPU)
+    // 2. Clear indexing data (to avoid a clear on the CPU), unless the
+    //    frame epoch in the count word does that
     // 3. Compute weights for all surfaces.
     // 4. Shade each surface and weight appropriately.
     // 5. Average surface colors to final pixel color.
@@ -32,12 +165,15 @@ float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
     uint nodeIndex = GetNodeIndex(input.positionViewport.xy);
     uint nodeList  = GetNodeList(input.positionViewport.xy);
     uint discardedSamples = GetDiscardedSamples(input.positionViewport.xy);
+    uint lightList = GetLightListAddress(input.positionViewport.xy, lightLists);
 
     // 2. Clear indexing data (to avoid a clear on the CPU)
+#if !STREAMING_EPOCH_COUNTS
     gCountTexture[input.positionViewport.xy] = 0;
 #if defined(STREAMING_USE_LIST_TEXTURE)
     SetNodeList(input.positionViewport.xy, 0);
 #endif // defined(STREAMING_USE_LIST_TEXTURE)
+#endif // !STREAMING_EPOCH_COUNTS
 
     // For converting from our data structure to Lauritzen's
     GBuffer rawData;
@@ -46,13 +182,8 @@ float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
     MergeNode merge;
 
     float weightSum = 0.0f;
-    float4 lit = float4(0.0f, 0.0f, 0.0f, 0.0f);
-    uint weights = 0;
     float4 output = float4(0.0f, 0.0f, 0.0f, 0.0f);
-
-#if defined(STREAMING_DEBUG_OPTIONS)
     uint surfacesShaded = 0;
-#endif // defined(STREAMING_DEBUG_OPTIONS)
     [branch] if (nodeCount > 0) {
 
 #if MSAA_SAMPLES == 1
@@ -74,32 +205,17 @@ float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
         GetGBufferFromShadeAndMergeNodes(input.positionViewport.xy, merge, shade, rawData);
         surface = ComputeSurfaceDataFromGBufferData(input.positionViewport.xy, merge.zView, rawData);
 
+        // FinishPixel reads the result from output like the MSAA path
         weightSum = 1.0f;
-        lit = BasicLoop(surface);
+        output = ShadeSurface(surface, lightLists, lightList);
+        surfacesShaded = 1;
 
 #else // MSAA_SAMPLES > 1
 
         // 3. Compute weights for all surfaces.
-        ResolveSurfaceWeights(input.positionViewport.xy, nodeList, nodeCount, weights, weightSum);
-
         // 4. Shade each surface and weight appropriately.
-        [unroll] for (uint i = 0; i < nodeCount; i++) {
-            uint tempIndex = Get2BitsInByte(nodeList, i);
-            uint tempWeight = GetByteInUint(weights, tempIndex);
-            [branch] if (tempWeight > 0) {
-#if defined(STREAMING_DEBUG_OPTIONS)
-                surfacesShaded++;
-#endif // defined(STREAMING_DEBUG_OPTIONS)
-
-                // Convert our data structure to Lauritzen's
-                merge = GetMergeNode(input.positionViewport.xy, tempIndex);
-                shade = merge.shade;
-                GetGBufferFromShadeAndMergeNodes(input.positionViewport.xy, merge, shade, rawData);
-                surface = ComputeSurfaceDataFromGBufferData(input.positionViewport.xy, merge.zView, rawData);
-
-                output += BasicLoop(surface) * tempWeight;
-            }
-        }
+        output = ShadeWeightedSurfaces(input.positionViewport.xy, nodeList, nodeCount, lightLists,
+                                       lightList, weightSum, surfacesShaded);
 
 #endif // MSAA_SAMPLES > 1
 
@@ -132,15 +248,160 @@ float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
 #endif // defined (STREAMING_DEBUG_OPTION)
 
     // 5. Average surface colors to final pixel color.
-    // If we discarded  samples, then compute the average using the sum of all samples that 
-    // we have information about. Otherwise, use the total number of samples.
-    if (discardedSamples > 0 && nodeCount != 0) {
-        return float4(output.xyz / weightSum, 1.0f);
-    } else {
-        float skyboxWeight = MSAA_SAMPLES - weightSum;
-        float4 skybox = gSkyboxTexture.Sample(gDiffuseSampler, input.skyboxCoord);
-        return float4((output.xyz + skybox.xyz * skyboxWeight) / (float) MSAA_SAMPLES, 1.0f);
+    float4 skybox = gSkyboxTexture.Sample(gDiffuseSampler, input.skyboxCoord);
+    return FinishPixel(output, weightSum, nodeCount, discardedSamples, skybox.xyz, lightLists, lightList);
+}
+
+// First pass of the compacted resolve. Pixels with at most one node are
+// resolved as StreamingResolve would, but the weights only loop over the one
+// surface. The others are appended to gComplexPixels with their skybox sample
+// and left to StreamingResolveComplexCS, so the lanes of this pass never wait
+// on ResolveSurfaceWeights for several surfaces. Their output here is
+// replaced by StreamingComplexPixelPS. Only used with MSAA_SAMPLES > 1.
+float4 StreamingResolveSimple(SkyboxVSOut input, uint lightLists)
+{
+    uint2 coords = input.positionViewport.xy;
+    uint nodeCount = GetNodeCount(coords);
+    uint nodeList  = GetNodeList(coords);
+    uint discardedSamples = GetDiscardedSamples(coords);
+    uint lightList = GetLightListAddress(coords, lightLists);
+    float4 skybox = gSkyboxTexture.Sample(gDiffuseSampler, input.skyboxCoord);
+
+    [branch] if (nodeCount > 1) {
+        // The first pixel of every group adds the group
+        uint index;
+        gComplexPixelArgs.InterlockedAdd(STREAMING_COMPLEX_ARGS_VERTEX_COUNT * 4, 1, index);
+        if ((index % STREAMING_COMPLEX_PIXEL_GROUP_SIZE) == 0) {
+            uint groups;
+            gComplexPixelArgs.InterlockedAdd(STREAMING_COMPLEX_ARGS_GROUPS_X * 4, 1, groups);
+        }
+
+        ComplexPixel pixel;
+        pixel.coords = PackPixelCoords(coords.x, coords.y);
+        pixel.color = skybox.xyz;
+        gComplexPixels[index] = pixel;
+        return float4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    // Clear indexing data, StreamingResolveComplexCS clears the other pixels
+#if !STREAMING_EPOCH_COUNTS
+    gCountTexture[coords] = 0;
+#if defined(STREAMING_USE_LIST_TEXTURE)
+    SetNodeList(coords, 0);
+#endif // defined(STREAMING_USE_LIST_TEXTURE)
+#endif // !STREAMING_EPOCH_COUNTS
+
+    float weightSum = 0.0f;
+    uint surfacesShaded = 0;
+    float4 output = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    [branch] if (nodeCount > 0) {
+        output = ShadeWeightedSurfaces(coords, nodeList, 1, lightLists, lightList,
+                                       weightSum, surfacesShaded);
     }
+    return FinishPixel(output, weightSum, nodeCount, discardedSamples, skybox.xyz, lightLists, lightList);
+}
+
+// Second pass of the compacted resolve, one thread per complex pixel with no
+// idle lanes but the tail of the last group.
+void StreamingResolveComplex(uint index, uint lightLists)
+{
+    [branch] if (index >= gComplexPixelArgs.Load(STREAMING_COMPLEX_ARGS_VERTEX_COUNT * 4)) {
+        return;
+    }
+
+    ComplexPixel pixel = gComplexPixels[index];
+    uint2 coords = uint2(UnpackPixelCoordsX(pixel.coords), UnpackPixelCoordsY(pixel.coords));
+    uint nodeCount = GetNodeCount(coords);
+    uint nodeList  = GetNodeList(coords);
+    uint discardedSamples = GetDiscardedSamples(coords);
+    uint lightList = GetLightListAddress(coords, lightLists);
+
+#if !STREAMING_EPOCH_COUNTS
+    gCountTexture[coords] = 0;
+#if defined(STREAMING_USE_LIST_TEXTURE)
+    SetNodeList(coords, 0);
+#endif // defined(STREAMING_USE_LIST_TEXTURE)
+#endif // !STREAMING_EPOCH_COUNTS
+
+    float weightSum;
+    uint surfacesShaded;
+    float4 output = ShadeWeightedSurfaces(coords, nodeList, nodeCount, lightLists, lightList,
+                                          weightSum, surfacesShaded);
+    pixel.color = FinishPixel(output, weightSum, nodeCount, discardedSamples, pixel.color,
+                              lightLists, lightList).xyz;
+    gComplexPixels[index] = pixel;
+}
+
+struct ComplexPixelVSOut
+{
+    float4 positionViewport : SV_Position;
+    nointerpolation float3 color : color;
+};
+
+// Draws the resolved complex pixels as points over the first pass
+ComplexPixelVSOut StreamingComplexPixelVS(uint vertexId : SV_VertexID)
+{
+    ComplexPixel pixel = gResolvedComplexPixels[vertexId];
+    float2 coords = float2(UnpackPixelCoordsX(pixel.coords), UnpackPixelCoordsY(pixel.coords)) + 0.5f;
+    float2 positionScreen = coords / float2(mFramebufferDimensions.xy) * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f);
+
+    ComplexPixelVSOut output;
+    output.positionViewport = float4(positionScreen, 0.0f, 1.0f);
+    output.color = pixel.color;
+    return output;
+}
+
+float4 StreamingComplexPixelPS(ComplexPixelVSOut input) : SV_TARGET
+{
+    return float4(input.color, 1.0f);
+}
+
+float4 StreamingResolvePS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolve(input, RESOLVE_LIGHTS_ALL);
+}
+
+float4 StreamingResolveTiledPS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolve(input, RESOLVE_LIGHTS_TILED);
+}
+
+float4 StreamingResolveClusteredPS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolve(input, RESOLVE_LIGHTS_CLUSTERED);
+}
+
+float4 StreamingResolveSimplePS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolveSimple(input, RESOLVE_LIGHTS_ALL);
+}
+
+float4 StreamingResolveSimpleTiledPS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolveSimple(input, RESOLVE_LIGHTS_TILED);
+}
+
+float4 StreamingResolveSimpleClusteredPS(SkyboxVSOut input) : SV_TARGET
+{
+    return StreamingResolveSimple(input, RESOLVE_LIGHTS_CLUSTERED);
+}
+
+[numthreads(STREAMING_COMPLEX_PIXEL_GROUP_SIZE, 1, 1)]
+void StreamingResolveComplexCS(uint3 dispatchThreadId : SV_DispatchThreadID)
+{
+    StreamingResolveComplex(dispatchThreadId.x, RESOLVE_LIGHTS_ALL);
+}
+
+[numthreads(STREAMING_COMPLEX_PIXEL_GROUP_SIZE, 1, 1)]
+void StreamingResolveComplexTiledCS(uint3 dispatchThreadId : SV_DispatchThreadID)
+{
+    StreamingResolveComplex(dispatchThreadId.x, RESOLVE_LIGHTS_TILED);
+}
+
+[numthreads(STREAMING_COMPLEX_PIXEL_GROUP_SIZE, 1, 1)]
+void StreamingResolveComplexClusteredCS(uint3 dispatchThreadId : SV_DispatchThreadID)
+{
+    StreamingResolveComplex(dispatchThreadId.x, RESOLVE_LIGHTS_CLUSTERED);
 }
 
 #endif // STREAMINGRESOLVE_FX
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define STREAMINGSTRUCTS_H
 
 #include "StreamingDefines.h"
+#include "StreamingAddressing.h"
 
 #if defined(__cplusplus)
 
@@ -34,8 +35,8 @@ struct MergeNodePacked
 {
     unsigned coverage;
     unsigned zViewDerivatives;
-    unsigned normal;
     float zView;
+    unsigned normal;
     unsigned albedo;
 #if defined(STREAMING_DEBUG_OPTIONS)
     unsigned depthTestedCoverage;
@@ -43,6 +44,81 @@ struct MergeNodePacked
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 };
 
+// STREAMING_COMPACT_MERGE_NODE layout. Always declared so CPU code can compare
+// it with MergeNodePacked.
+struct MergeNodeCompact
+{
+    unsigned coverage;              // same as MergeNodePacked
+    unsigned albedo;                // same as MergeNodePacked
+    unsigned zViewNormalX;          // 22 bit zView << 10 | 10 bit octahedral normal x
+    unsigned derivativesNormalY;    // 11 bit ddx << 21 | 11 bit ddy << 10 | 10 bit octahedral normal y
+};
+
+// STREAMING_WIDE_COVERAGE layout, declared for the same reason
+struct MergeNodeWide
+{
+    unsigned coverage;
+    unsigned depthTestedCoverage;
+    unsigned zViewDerivatives;
+    float zView;
+    unsigned normal;
+    unsigned albedo;
+    unsigned specular;              // f16 specular power
+#if defined(STREAMING_DEBUG_OPTIONS)
+    unsigned shadeIndex;
+#endif // defined(STREAMING_DEBUG_OPTIONS)
+};
+
+// Packing widths for a surface count chosen at compile time. Matches the
+// STREAMING_NODE_* macros the shaders get for the same count.
+template <unsigned SurfacesPerPixel>
+struct StreamingSurfaceLayout
+{
+    static_assert(SurfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+                  SurfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU,
+                  "unsupported surfaces per pixel");
+
+    enum {
+        kSurfacesPerPixel = SurfacesPerPixel,
+        kNodeIndexBits = SurfacesPerPixel < 4 ? 2 : 3,
+        kNodeCountBits = SurfacesPerPixel < 4 ? 2 : (SurfacesPerPixel < 8 ? 3 : 4),
+        kNodeIndexMask = (1 << kNodeIndexBits) - 1,
+        kNodeCountMask = (1 << kNodeCountBits) - 1
+    };
+};
+
+// Number of MergeNodePacked in gMergeBuffer with the STREAMING_ADDRESSING the
+// shaders are compiled with
+inline unsigned GetMergeBufferNodeCount(unsigned width, unsigned height, unsigned surfacesPerPixel)
+{
+    return GetAddressingPlaneSize(width, height, STREAMING_ADDRESSING, STREAMING_TILE_LOGX, STREAMING_TILE_LOGY) *
+           surfacesPerPixel;
+}
+
+// Same with STREAMING_NODE_POOL: the first node plane plus poolBlocks blocks
+// of the remaining nodes
+inline unsigned GetPooledMergeBufferNodeCount(unsigned width, unsigned height, unsigned surfacesPerPixel,
+                                              unsigned poolBlocks)
+{
+    return GetAddressingPlaneSize(width, height, STREAMING_ADDRESSING, STREAMING_TILE_LOGX, STREAMING_TILE_LOGY) +
+           poolBlocks * (surfacesPerPixel - 1);
+}
+
+// Entry of gComplexPixels. color holds the skybox sample until
+// StreamingResolveComplexCS replaces it with the resolved pixel.
+struct ComplexPixel
+{
+    unsigned coords;            // PackPixelCoords
+    float color[3];
+};
+
+// Entry of gHiZTiles, see STREAMING_HIZ
+struct HiZTile
+{
+    unsigned occludedPixels;
+    unsigned occluderEnd;       // asuint of the largest occluder end depth
+};
+
 #if defined(STREAMING_DEBUG_OPTIONS)
 struct PixelStats
 {
@@ -83,12 +159,37 @@ struct MergeNode
     float zView;
     float2 normal;
     ShadeNode shade;
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     uint depthTestedCoverage;
+#endif // STREAMING_SEPARATE_COVERAGE
+#if defined(STREAMING_DEBUG_OPTIONS)
     uint shadeIndex;
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 };
 
+#if STREAMING_COMPACT_MERGE_NODE
+struct MergeNodePacked
+{
+    uint coverage;
+    uint albedo;
+    uint zViewNormalX;
+    uint derivativesNormalY;
+};
+#elif STREAMING_WIDE_COVERAGE
+struct MergeNodePacked
+{
+    uint coverage;
+    uint depthTestedCoverage;
+    uint zViewDerivatives;
+    float zView;
+    uint normal;
+    uint albedo;
+    uint specular;
+#if defined(STREAMING_DEBUG_OPTIONS)
+    uint shadeIndex;
+#endif // defined(STREAMING_DEBUG_OPTIONS)
+};
+#else // !STREAMING_COMPACT_MERGE_NODE && !STREAMING_WIDE_COVERAGE
 struct MergeNodePacked
 {
     uint coverage;
@@ -101,6 +202,19 @@ struct MergeNodePacked
     uint shadeIndex;
 #endif // defined(STREAMING_DEBUG_OPTIONS)
 };
+#endif // !STREAMING_COMPACT_MERGE_NODE && !STREAMING_WIDE_COVERAGE
+
+struct ComplexPixel
+{
+    uint coords;
+    float3 color;
+};
+
+struct HiZTile
+{
+    uint occludedPixels;
+    uint occluderEnd;
+};
 
 #if defined(STREAMING_DEBUG_OPTIONS)
 struct PixelStats
@@ -123,8 +237,10 @@ MergeNode GetEmptyMergeNode()
     merge.zViewDerivatives = 0;
     merge.zView = 100000.0f; // far plane distance
     merge.normal = float2(0.0f, 0.0f);
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     merge.depthTestedCoverage = 0;
+#endif // STREAMING_SEPARATE_COVERAGE
+#if defined(STREAMING_DEBUG_OPTIONS)
     merge.shadeIndex = 0;
 #endif // defined(STREAMING_DEBUG_OPTIONS)
     merge.shade.albedo = float4(0.0f, 0.0f, 0.0f, 0.0f);
@@ -132,6 +248,58 @@ MergeNode GetEmptyMergeNode()
     return merge;
 }
 
+#if STREAMING_COMPACT_MERGE_NODE
+// zView is positive, so drop the sign and round away 9 mantissa bits.
+// Clamped below the infinity exponent.
+uint PackZView22(float zView)
+{
+    return min((asuint(max(zView, 0.0f)) + 0x100) >> 9, 0x3FBFFF);
+}
+
+float UnpackZView22(uint packed)
+{
+    return asfloat(packed << 9);
+}
+
+// Half precision with 5 mantissa bits
+uint PackDerivative11(float derivative)
+{
+    uint bits = f32tof16(derivative);
+    uint magnitude = min((bits & 0x7FFF) + 0x10, 0x7BFF);
+    return ((bits >> 15) << 10) | (magnitude >> 5);
+}
+
+float UnpackDerivative11(uint packed)
+{
+    return f16tof32(((packed >> 10) << 15) | ((packed & 0x3FF) << 5));
+}
+
+float2 SignNotZero(float2 v)
+{
+    return float2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+// Returns [0, 1]
+float2 EncodeOctahedral(float3 n)
+{
+    float2 e = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+    if (n.z < 0.0f) {
+        e = (1.0f - abs(e.yx)) * SignNotZero(e);
+    }
+    return e * 0.5f + 0.5f;
+}
+
+float3 DecodeOctahedral(float2 e)
+{
+    e = e * 2.0f - 1.0f;
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f) {
+        n.xy = (1.0f - abs(n.yx)) * SignNotZero(n.xy);
+    }
+    return normalize(n);
+}
+#endif // STREAMING_COMPACT_MERGE_NODE
+
 void GetGBufferFromShadeAndMergeNodes(float2 positionViewport, MergeNode merge, ShadeNode shade, out GBuffer gBuffer)
 {
     gBuffer.normal_specular = float4(merge.normal, shade.specular.x, shade.specular.y);
@@ -141,47 +309,47 @@ void GetGBufferFromShadeAndMergeNodes(float2 positionViewport, MergeNode merge,
 
 uint GetCoverage(in MergeNode merge)
 {
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     return merge.coverage;
-#else // !defined(STREAMING_DEBUG_OPTIONS)
+#else // !STREAMING_SEPARATE_COVERAGE
     return GetByteInUint(merge.coverage, MERGENODE_COVERAGE_BYTE);
-#endif // !defined(STREAMING_DEBUG_OPTIONS)
+#endif // !STREAMING_SEPARATE_COVERAGE
 }
 
 void SetCoverage(in out MergeNode merge, in uint coverage)
 {
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     merge.coverage = coverage;
-#else // !defined(STREAMING_DEBUG_OPTIONS)
+#else // !STREAMING_SEPARATE_COVERAGE
     SetByteInUint(merge.coverage, MERGENODE_COVERAGE_BYTE, coverage);
-#endif // !defined(STREAMING_DEBUG_OPTIONS)
+#endif // !STREAMING_SEPARATE_COVERAGE
 }
 
 void SetDepthTestedCoverage(in out MergeNode merge, in uint coverage)
 {
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     merge.depthTestedCoverage = coverage;
-#else // !defined(STREAMING_DEBUG_OPTIONS)
+#else // !STREAMING_SEPARATE_COVERAGE
     SetByteInUint(merge.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, coverage);
-#endif // !defined(STREAMING_DEBUG_OPTIONS)
+#endif // !STREAMING_SEPARATE_COVERAGE
 }
 
 void SetDepthTestedCoverage(in out MergeNodePacked merge, in uint coverage)
 {
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     merge.depthTestedCoverage = coverage;
-#else // !defined(STREAMING_DEBUG_OPTIONS)
+#else // !STREAMING_SEPARATE_COVERAGE
     SetByteInUint(merge.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, coverage);
-#endif // !defined(STREAMING_DEBUG_OPTIONS)}
+#endif // !STREAMING_SEPARATE_COVERAGE
 }
 
 uint GetDepthTestedCoverage(in MergeNode merge)
 {
-#if defined(STREAMING_DEBUG_OPTIONS)
+#if STREAMING_SEPARATE_COVERAGE
     return merge.depthTestedCoverage;
-#else // !defined(STREAMING_DEBUG_OPTIONS)
+#else // !STREAMING_SEPARATE_COVERAGE
     return GetByteInUint(merge.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE);
-#endif // !defined(STREAMING_DEBUG_OPTIONS)
+#endif // !STREAMING_SEPARATE_COVERAGE
 }
 #endif // !defined(__cplusplus)
 #endif // STREAMINGSTRUCTS_H
\ No newline at end of file
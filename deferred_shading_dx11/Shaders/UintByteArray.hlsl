@@ -1,6 +1,8 @@
 #ifndef UINTBYTEARRAY_HLSL
 #define UINTBYTEARRAY_HLSL
 
+#include "StreamingDefines.h"
+
 // Sets array[index] to value. Treats value a byte.
 //--------------------------------------------------------------------------------------
 void SetByteInUint(in out uint arr, in uint index, in uint value)
@@ -25,19 +27,15 @@ uint GetByteInUint(in uint arr, in uint index)
     return (arr & (0xFF << index)) >> index;
 }
 
+// Despite the name the entry width is STREAMING_NODE_INDEX_BITS, which is 2 for up
+// to 3 surfaces per pixel.
 //--------------------------------------------------------------------------------------
 uint Get2BitsInByte(in uint arr, in uint index)
 {
     uint clearBits;
     // Convert index to bit offeset
-
-#if (defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
-    index = index * 3;
-    clearBits = 0x7;
-#else // !(defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
-    index = index * 2;
-    clearBits = 0x3;
-#endif // !(defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
+    index = index * STREAMING_NODE_INDEX_BITS;
+    clearBits = STREAMING_NODE_INDEX_MASK;
 
     // Turn array[index] to unsigned int
     return (arr & (clearBits << index)) >> index;
@@ -50,13 +48,8 @@ void Set2BitsInByte(in out uint arr, in uint index, in uint value)
     uint clearBits;
 
     // Convert index to bit offeset
-#if (defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
-    index = index * 3;
-    clearBits = 0x7;
-#else // !(defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
-    index = index * 2;
-    clearBits = 0x3;
-#endif // !(defined(STREAMING_DEBUG_OPTIONS) && (STREAMING_MAX_SURFACES_PER_PIXEL == 4))
+    index = index * STREAMING_NODE_INDEX_BITS;
+    clearBits = STREAMING_NODE_INDEX_MASK;
 
     // Clear array[index]
     arr = arr & ~(clearBits << index);
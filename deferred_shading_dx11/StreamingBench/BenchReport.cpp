@@ -0,0 +1,1053 @@
+#include "BenchReport.h"
+#include "MergeNodeCodec.h"
+#include <math.h>
+#include <string.h>
+
+using namespace StreamingCpu;
+
+double BenchRun::GetFragmentsPerSecond() const
+{
+    double seconds = binSeconds + mergeSeconds;
+    return seconds > 0.0 ? stats.fragments / seconds : 0.0;
+}
+
+uint64_t BenchRun::GetBytesTouched() const
+{
+    const uint64_t word = sizeof(unsigned);
+    uint64_t bytes = (stats.nodeLoads + stats.nodeStores) * sizeof(MergeNodePacked);
+    bytes += stats.fragments * word;                        // count
+    bytes += (stats.fragments - stats.firsts) * word;       // list
+    bytes += (stats.firsts + stats.inserts) * word;         // count writes
+    bytes += stats.discards * word;                         // discard flag
+    bytes += (stats.inserts + stats.occlusions + stats.discards) * word;  // list writes
+    return bytes;
+}
+
+LayoutError::LayoutError()
+    : nodes(0), exactMismatches(0), zViewMaxRelative(0.0), zViewSumRelative(0.0)
+    , derivativeMaxRelative(0.0), derivativeSumRelative(0.0), normalMaxDegrees(0.0), normalSumDegrees(0.0)
+{
+}
+
+static double RelativeError(float reference, float value, float minimum)
+{
+    double magnitude = fabs((double)reference);
+    return fabs((double)value - reference) / (magnitude > minimum ? magnitude : minimum);
+}
+
+void LayoutError::Add(const MergeNode& reference)
+{
+    MergeNode compact = UnpackMergeNodeCompact(PackMergeNodeCompact(reference));
+    ++nodes;
+
+    if (compact.coverage != reference.coverage ||
+        memcmp(&compact.shade, &reference.shade, sizeof(ShadeNode)) != 0) {
+        ++exactMismatches;
+    }
+
+    double zView = RelativeError(reference.zView, compact.zView, 1e-6f);
+    zViewMaxRelative = zView > zViewMaxRelative ? zView : zViewMaxRelative;
+    zViewSumRelative += zView;
+
+    for (unsigned i = 0; i < 2; ++i) {
+        // Below the smallest normal half both layouts flush towards zero
+        double derivative = RelativeError(reference.zViewDerivatives[i], compact.zViewDerivatives[i], 6.1035e-5f);
+        derivativeMaxRelative = derivative > derivativeMaxRelative ? derivative : derivativeMaxRelative;
+        derivativeSumRelative += derivative * 0.5;
+    }
+
+    float n0[3];
+    float n1[3];
+    DecodeSphereMap(reference.normal, n0);
+    DecodeSphereMap(compact.normal, n1);
+    double cosAngle = Dot3(n0, n1) / sqrt((double)Dot3(n0, n0) * Dot3(n1, n1));
+    cosAngle = cosAngle < 1.0 ? (cosAngle > -1.0 ? cosAngle : -1.0) : 1.0;
+    double degrees = acos(cosAngle) * (180.0 / 3.14159265358979323846);
+    normalMaxDegrees = degrees > normalMaxDegrees ? degrees : normalMaxDegrees;
+    normalSumDegrees += degrees;
+}
+
+static double Mean(double sum, uint64_t count)
+{
+    return count ? sum / count : 0.0;
+}
+
+static double PerFragment(uint64_t value, uint64_t fragments)
+{
+    return fragments ? (double)value / fragments : 0.0;
+}
+
+static uint64_t GetPixelCount(const BenchRun& run)
+{
+    uint64_t pixels = 0;
+    for (size_t i = 0; i < run.occupancy.size(); ++i) {
+        pixels += run.occupancy[i];
+    }
+    return pixels;
+}
+
+// Paths on Windows are full of backslashes
+static void WriteJsonString(FILE* file, const std::string& value)
+{
+    fputc('"', file);
+    for (size_t i = 0; i < value.size(); ++i) {
+        char c = value[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if ((unsigned char)c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// CSV fields only need quoting when they contain separators or quotes
+static void WriteCsvString(FILE* file, const std::string& value)
+{
+    if (value.find_first_of(",\"\n") == std::string::npos) {
+        fputs(value.c_str(), file);
+        return;
+    }
+    fputc('"', file);
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '"') {
+            fputc('"', file);
+        }
+        fputc(value[i], file);
+    }
+    fputc('"', file);
+}
+
+// Merge buffer bytes with fixed planes, and with a pool of poolBlocks
+// blocks plus its index texture
+static uint64_t GetFixedMergeBytes(const BenchConfig& config)
+{
+    return (uint64_t)GetMergeBufferNodeCount(config.width, config.height, config.surfacesPerPixel) *
+           sizeof(MergeNodePacked);
+}
+
+static uint64_t GetPooledMergeBytes(const BenchConfig& config, uint64_t poolBlocks)
+{
+    return (uint64_t)GetPooledMergeBufferNodeCount(config.width, config.height, config.surfacesPerPixel,
+                                                   (unsigned)poolBlocks) * sizeof(MergeNodePacked) +
+           (uint64_t)config.width * config.height * sizeof(unsigned);
+}
+
+// Sample counts of BenchResults::wideResolveWeights
+static const unsigned kWideSampleCounts[2] = { 16, 32 };
+
+// G-buffer targets of the deferred techniques per sample (R16G16B16A16_FLOAT,
+// R8G8B8A8_UNORM, R16G16_FLOAT) against merge nodes plus the count and list
+// textures per pixel. Depth is left out, every technique has it.
+static unsigned GetGBufferBytesPerPixel(unsigned msaaSamples)
+{
+    return msaaSamples * (8 + 4 + 4);
+}
+
+static unsigned GetStreamingBytesPerPixel(unsigned msaaSamples, unsigned surfacesPerPixel)
+{
+    unsigned nodeBytes = msaaSamples > 8 ? sizeof(MergeNodeWide) : sizeof(MergeNodePacked);
+    return surfacesPerPixel * nodeBytes + 2 * sizeof(unsigned);
+}
+
+static void PrintResolveWeights(FILE* file, unsigned msaaSamples, const char* source, const ResolveWeightsStats& w)
+{
+    fprintf(file, "  %2ux %-10s %llu pixels, %.2f surfaces/pixel, %.2f%% of shared pairs per sample, "
+                  "%.3f s vs %.3f s%s\n",
+            msaaSamples, source, (unsigned long long)w.pixels, w.pixels ? (double)w.surfaces / w.pixels : 0.0,
+            w.sharedPairs ? 100.0 * w.perSamplePairs / w.sharedPairs : 0.0, w.pairwiseSeconds, w.perSampleSeconds,
+            w.mismatches ? "  ** DIFFERS FROM PER-SAMPLE **" : "");
+}
+
+static void WriteJsonResolveWeights(FILE* file, unsigned msaaSamples, const char* source,
+                                    const ResolveWeightsStats& w)
+{
+    fprintf(file, "\n    {\n      \"msaaSamples\": %u,\n      \"source\": \"%s\",\n      \"pixels\": %llu,\n"
+                  "      \"surfaces\": %llu,\n      \"samples\": %llu,\n      \"sharedPairs\": %llu,\n"
+                  "      \"perSamplePairs\": %llu,\n      \"mismatches\": %llu,\n"
+                  "      \"pairwiseSeconds\": %.6f,\n      \"perSampleSeconds\": %.6f\n    }",
+            msaaSamples, source, (unsigned long long)w.pixels, (unsigned long long)w.surfaces,
+            (unsigned long long)w.samples, (unsigned long long)w.sharedPairs, (unsigned long long)w.perSamplePairs,
+            (unsigned long long)w.mismatches, w.pairwiseSeconds, w.perSampleSeconds);
+}
+
+void PrintReport(FILE* file, const BenchConfig& config, const BenchResults& results)
+{
+    const std::vector<BenchRun>& runs = results.runs;
+    fprintf(file, "%s: %ux%u, %u samples, %u surfaces, %u threads, %u frames x %u\n",
+            config.source.c_str(), config.width, config.height, config.msaaSamples,
+            config.surfacesPerPixel, config.threads, config.frames, config.repeat);
+    fprintf(file, "%s addressing\n", config.addressing.c_str());
+    if (config.nodePoolPercent > 0) {
+        fprintf(file, "node pool storage, blocks for %u%% of pixels\n", config.nodePoolPercent);
+    }
+    if (config.cameraPath) {
+        fprintf(file, "camera path panning %g,%g pixels per frame\n", config.cameraPan[0], config.cameraPan[1]);
+    }
+
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const BenchRun& run = runs[r];
+        const MergeStats& s = run.stats;
+        fprintf(file, "\n%s%s\n", run.name.c_str(), run.matchesReference ? "" : "  ** DIFFERS FROM REFERENCE **");
+        fprintf(file, "  fragments      %llu (%.2f M/s, bin %.3f s, merge %.3f s)\n",
+                (unsigned long long)s.fragments, run.GetFragmentsPerSecond() / 1e6,
+                run.binSeconds, run.mergeSeconds);
+        fprintf(file, "  firsts         %.4f / fragment\n", PerFragment(s.firsts, s.fragments));
+        fprintf(file, "  merges         %.4f\n", PerFragment(s.merges, s.fragments));
+        fprintf(file, "  inserts        %.4f\n", PerFragment(s.inserts, s.fragments));
+        fprintf(file, "  occlusions     %.4f\n", PerFragment(s.occlusions, s.fragments));
+        fprintf(file, "  discards       %.4f\n", PerFragment(s.discards, s.fragments));
+        fprintf(file, "  node loads     %.4f\n", PerFragment(s.nodeLoads, s.fragments));
+        fprintf(file, "  node stores    %.4f\n", PerFragment(s.nodeStores, s.fragments));
+        fprintf(file, "  bytes touched  %.1f / fragment\n", PerFragment(run.GetBytesTouched(), s.fragments));
+
+        const uint64_t pixels = GetPixelCount(run);
+        fprintf(file, "  occupancy     ");
+        for (size_t i = 0; i < run.occupancy.size(); ++i) {
+            fprintf(file, " %u:%.1f%%", (unsigned)i, pixels ? 100.0 * run.occupancy[i] / pixels : 0.0);
+        }
+        fprintf(file, "\n  discarded      %.2f%% of pixels\n", pixels ? 100.0 * run.discardedPixels / pixels : 0.0);
+    }
+
+    const LayoutError& e = results.layoutError;
+    const double savedBytes = (double)config.width * config.height * config.surfacesPerPixel *
+                              (sizeof(MergeNodePacked) - sizeof(MergeNodeCompact));
+    fprintf(file, "\ncompact merge nodes (%u vs %u bytes, %.1f MB saved)\n",
+            (unsigned)sizeof(MergeNodeCompact), (unsigned)sizeof(MergeNodePacked), savedBytes / (1024.0 * 1024.0));
+    fprintf(file, "  nodes          %llu, %llu with inexact coverage/albedo/specular\n",
+            (unsigned long long)e.nodes, (unsigned long long)e.exactMismatches);
+    fprintf(file, "  zView          max %.3g, mean %.3g relative\n",
+            e.zViewMaxRelative, Mean(e.zViewSumRelative, e.nodes));
+    fprintf(file, "  derivatives    max %.3g, mean %.3g relative\n",
+            e.derivativeMaxRelative, Mean(e.derivativeSumRelative, e.nodes));
+    fprintf(file, "  normal         max %.3f, mean %.3f degrees\n",
+            e.normalMaxDegrees, Mean(e.normalSumDegrees, e.nodes));
+
+    const NodePoolUsage& pool = results.nodePool;
+    const double pixels = (double)config.width * config.height;
+    const uint64_t fixedBytes = GetFixedMergeBytes(config);
+    const uint64_t pooledBytes = GetPooledMergeBytes(config, pool.peakBlocks);
+    fprintf(file, "\nnode pool\n");
+    fprintf(file, "  peak blocks    %llu (%.1f%% of pixels), mean %.1f%%\n",
+            (unsigned long long)pool.peakBlocks, pixels > 0.0 ? 100.0 * pool.peakBlocks / pixels : 0.0,
+            pixels > 0.0 && config.frames ? 100.0 * pool.sumBlocks / config.frames / pixels : 0.0);
+    fprintf(file, "  merge memory   fixed %.1f MB, pooled at peak %.1f MB (%.1f%% saved)\n",
+            fixedBytes / (1024.0 * 1024.0), pooledBytes / (1024.0 * 1024.0),
+            fixedBytes ? 100.0 * ((double)fixedBytes - (double)pooledBytes) / fixedBytes : 0.0);
+    if (config.nodePoolPercent > 0) {
+        fprintf(file, "  exhausted      %u of %u frames\n", pool.exhaustedFrames, config.frames);
+    }
+
+    const ResolveCompactionStats& r = results.resolveCompaction;
+    if (r.frames > 0) {
+        fprintf(file, "\nresolve compaction (%u thread groups, %ux%u pixel blocks)\n",
+                STREAMING_COMPLEX_PIXEL_GROUP_SIZE, results.resolveBlockDim, results.resolveBlockDim);
+        fprintf(file, "  complex pixels %.2f%% mean, %.2f%% min, %.2f%% max per frame (%.2f%% of covered)\n",
+                100.0 * r.GetComplexFraction(), 100.0 * r.minComplexFraction, 100.0 * r.maxComplexFraction,
+                r.coveredPixels ? 100.0 * r.complexPixels / r.coveredPixels : 0.0);
+        fprintf(file, "  nodes/complex  %.2f\n", r.complexPixels ? (double)r.complexNodes / r.complexPixels : 0.0);
+        fprintf(file, "  single pass    %.2f%% of blocks take the complex path, %.2f%% of pixels wait in them\n",
+                r.blocks ? 100.0 * r.complexBlocks / r.blocks : 0.0,
+                r.pixels ? 100.0 * r.waitingPixels / r.pixels : 0.0);
+        fprintf(file, "  compacted      %llu groups/frame, %.2f%% idle threads\n",
+                (unsigned long long)(r.complexGroups / r.frames),
+                r.complexGroups ? 100.0 * r.idleThreads / (r.complexGroups * STREAMING_COMPLEX_PIXEL_GROUP_SIZE) : 0.0);
+        fprintf(file, "  list build     %.3f s%s\n", r.buildSeconds,
+                r.mismatchedFrames ? "  ** ARGUMENTS DIFFER FROM LIST **" : "");
+    }
+
+    fprintf(file, "\nresolve weights (coverage masks, timed against the per-sample loop)\n");
+    PrintResolveWeights(file, config.msaaSamples, "reference", results.resolveWeights);
+    for (int i = 0; i < 2; ++i) {
+        PrintResolveWeights(file, kWideSampleCounts[i], "random", results.wideResolveWeights[i]);
+    }
+    fprintf(file, "  bytes/pixel   ");
+    const unsigned memorySamples[3] = { 8, 16, 32 };
+    for (int i = 0; i < 3; ++i) {
+        fprintf(file, " %ux %u G-buffer vs %u merged,", memorySamples[i], GetGBufferBytesPerPixel(memorySamples[i]),
+                GetStreamingBytesPerPixel(memorySamples[i], config.surfacesPerPixel));
+    }
+    fprintf(file, " %u surfaces\n", config.surfacesPerPixel);
+
+    if (results.lights > 0) {
+        const TiledShadingStats& l = results.lightCulling;
+        fprintf(file, "\ntiled light culling (%u lights, %ux%u tiles)\n",
+                results.lights, COMPUTE_SHADER_TILE_GROUP_DIM, COMPUTE_SHADER_TILE_GROUP_DIM);
+        fprintf(file, "  lights/tile    %.2f\n", l.tiles ? (double)l.tileLights / l.tiles : 0.0);
+        fprintf(file, "  lights/node    %.2f tiled, %.2f brute force\n",
+                l.nodes ? (double)l.tiledLights / l.nodes : 0.0, l.nodes ? (double)l.bruteForceLights / l.nodes : 0.0);
+        fprintf(file, "  shading        %.3f s tiled + %.3f s culling, %.3f s brute force\n",
+                l.tiledSeconds, l.cullSeconds, l.bruteForceSeconds);
+        fprintf(file, "  nodes          %llu, %llu differ from brute force%s\n",
+                (unsigned long long)l.nodes, (unsigned long long)l.mismatches,
+                l.mismatches ? "  ** DIFFERS FROM REFERENCE **" : "");
+    }
+
+    if (results.epochBits > 0) {
+        const EpochCountsCheck& c = results.epochCounts;
+        const double pixelFrames = (double)config.width * config.height * c.frames;
+        fprintf(file, "\nepoch counts (%u bit epoch, %u of %u frames cleared)\n", results.epochBits, c.wraps, c.frames);
+        fprintf(file, "  stale words    %.2f%% of pixels read as empty\n",
+                c.pixels ? 100.0 * c.stalePixels / c.pixels : 0.0);
+        fprintf(file, "  resolve writes %.1f MB/frame saved, clears cost %.1f MB/frame\n",
+                c.frames ? pixelFrames * 2 * sizeof(unsigned) / c.frames / (1024.0 * 1024.0) : 0.0,
+                c.frames ? (double)config.width * config.height * c.wraps * sizeof(unsigned) / c.frames /
+                           (1024.0 * 1024.0) : 0.0);
+        fprintf(file, "  pixels         %llu differ from cleared counts%s\n", (unsigned long long)c.differingPixels,
+                c.differingPixels ? "  ** DIFFERS FROM REFERENCE **" : "");
+    }
+
+    if (results.concurrent && !runs.empty()) {
+        const MergeStats& s = results.concurrentStats;
+        const ConcurrentMergeStats& c = results.concurrentMergeStats;
+        const ConcurrentMergeCheck& check = results.concurrentCheck;
+        const ConcurrentMergeCheck& serial = results.serialConcurrentCheck;
+        fprintf(file, "\nconcurrent merge (lock-free pixels vs %s tile owners)\n", runs[0].name.c_str());
+        fprintf(file, "  fragments      %.2f M/s vs %.2f M/s (merge %.3f s)\n",
+                results.concurrentSeconds > 0.0 ? s.fragments / results.concurrentSeconds / 1e6 : 0.0,
+                runs[0].GetFragmentsPerSecond() / 1e6, results.concurrentSeconds);
+        fprintf(file, "  conflicts      %.4f / fragment, %.4f writer waits\n",
+                PerFragment(c.conflicts, c.commits), PerFragment(c.writerWaits, c.commits));
+        fprintf(file, "  pixels         %.2f%% merged in another order, %llu invalid%s\n",
+                check.pixels ? 100.0 * check.differingPixels / check.pixels : 0.0,
+                (unsigned long long)check.invalidPixels, check.invalidPixels ? "  ** INVALID PIXELS **" : "");
+        fprintf(file, "  one thread     %llu pixels differ%s\n", (unsigned long long)serial.differingPixels,
+                serial.differingPixels ? "  ** DIFFERS FROM REFERENCE **" : "");
+    }
+
+    if (results.hiZ) {
+        const MergeStats& base = results.hiZBaseStats;
+        const MergeStats& s = results.hiZMergeStats;
+        const HiZStats& h = results.hiZStats;
+        const HiZCheck& check = results.hiZCheck;
+        fprintf(file, "\nhi-z rejection (%ux%u tiles)\n", STREAMING_HIZ_TILE_DIM, STREAMING_HIZ_TILE_DIM);
+        fprintf(file, "  rejected       %.2f%% of fragments, %.2f%% of tiles occluded at frame end\n",
+                h.fragments ? 100.0 * h.rejected / h.fragments : 0.0,
+                h.tiles ? 100.0 * h.occludedTiles / h.tiles : 0.0);
+        fprintf(file, "  occluders      %llu pixels joined, %llu left again after a discard\n",
+                (unsigned long long)h.occludedPixels, (unsigned long long)h.withdrawnPixels);
+        fprintf(file, "  node loads     %.3f / fragment vs %.3f, %.2f%% avoided\n",
+                PerFragment(s.nodeLoads, h.fragments), PerFragment(base.nodeLoads, h.fragments),
+                base.nodeLoads ? 100.0 * ((double)base.nodeLoads - (double)s.nodeLoads) / base.nodeLoads : 0.0);
+        fprintf(file, "  node stores    %.3f / fragment vs %.3f\n",
+                PerFragment(s.nodeStores, h.fragments), PerFragment(base.nodeStores, h.fragments));
+        fprintf(file, "  pixels         %.4f%% keep other hidden nodes, %llu resolve differently%s\n",
+                check.pixels ? 100.0 * check.differingPixels / check.pixels : 0.0,
+                (unsigned long long)check.resolveDiffers,
+                check.resolveDiffers ? "  ** DIFFERS FROM REFERENCE **" : "");
+    }
+
+    if (results.nodePrediction) {
+        const NodeSearchStats& base = results.nodeSearch;
+        const NodeSearchStats& p = results.predictedNodeSearch;
+        const MergedBuffersCheck& check = results.nodePredictionCheck;
+        fprintf(file, "\nnode prediction (%.4f depth margin)\n", STREAMING_PREDICTION_MARGIN);
+        fprintf(file, "  search loads   %.3f / fragment vs %.3f, %.2f%% avoided\n",
+                PerFragment(p.loads, p.fragments), PerFragment(base.loads, base.fragments),
+                base.loads ? 100.0 * ((double)base.loads - (double)p.loads) / base.loads : 0.0);
+        fprintf(file, "  skipped        %.3f in front, %.3f behind / fragment, %.3f steps\n",
+                PerFragment(p.skippedFront, p.fragments), PerFragment(p.skippedBehind, p.fragments),
+                PerFragment(p.steps, p.fragments));
+        fprintf(file, "  depth loads    %.3f / fragment, %.2f%% mispredicted\n",
+                PerFragment(p.depthLoads, p.fragments),
+                p.depthLoads ? 100.0 * p.mispredicted / p.depthLoads : 0.0);
+        const double bytes = (double)p.GetBytes();
+        const double baseBytes = (double)base.GetBytes();
+        fprintf(file, "  search bytes   %.2f / fragment vs %.2f, %.2f%% %s (summary %.2f, depths %.2f)\n",
+                PerFragment(p.GetBytes(), p.fragments), PerFragment(base.GetBytes(), base.fragments),
+                baseBytes ? 100.0 * fabs(baseBytes - bytes) / baseBytes : 0.0, bytes > baseBytes ? "added" : "saved",
+                PerFragment((p.summaryReads + p.summaryWrites) * sizeof(uint32_t), p.fragments),
+                PerFragment(p.depthLoads * (sizeof(uint32_t) + sizeof(float)), p.fragments));
+        fprintf(file, "  node loads     %.3f / fragment vs %.3f with occluder fusion\n",
+                PerFragment(results.nodePredictionMergeStats.nodeLoads, results.nodePredictionMergeStats.fragments),
+                PerFragment(results.nodePredictionBaseStats.nodeLoads, results.nodePredictionBaseStats.fragments));
+        fprintf(file, "  pixels         %llu differ%s\n", (unsigned long long)check.differingPixels,
+                check.differingPixels ? "  ** DIFFERS FROM REFERENCE **" : "");
+    }
+
+    if (results.discardPolicies) {
+        fprintf(file, "\ndiscard policies (against %u surfaces, %.3f discards / fragment)\n",
+                STREAMING_SURFACES_PER_PIXEL_MAX_CPU,
+                PerFragment(results.discardReferenceStats.discards, results.discardReferenceStats.fragments));
+        for (unsigned i = 0; i < DISCARD_POLICY_COUNT; ++i) {
+            const DiscardPolicyStats& s = results.discardPolicyStats[i];
+            fprintf(file, "  %-14s %.3f discards, %.3f accesses, %.1f ns / fragment, %.4f%% pixels discard, "
+                          "%.4f%% differ, %.2f dB\n",
+                    GetDiscardPolicyName((DiscardPolicy)i), PerFragment(s.merge.discards, s.merge.fragments),
+                    s.GetAccessesPerFragment(),
+                    s.merge.fragments ? 1e9 * s.seconds / s.merge.fragments : 0.0,
+                    s.pixels ? 100.0 * s.discardedPixels / s.pixels : 0.0,
+                    s.pixels ? 100.0 * s.differingPixels / s.pixels : 0.0, s.GetPsnr());
+        }
+        if (results.selectedDiscardPolicy < DISCARD_POLICY_COUNT) {
+            fprintf(file, "  cheapest at %.1f dB: %s\n", results.discardMinPsnr,
+                    GetDiscardPolicyName(results.selectedDiscardPolicy));
+        } else {
+            fprintf(file, "  cheapest at %.1f dB: none  ** NO POLICY REACHES THE PSNR **\n", results.discardMinPsnr);
+        }
+    }
+
+    if (!results.snapshot.path.empty()) {
+        const SnapshotRun& s = results.snapshot;
+        fprintf(file, "\ng-buffer snapshot (%s, %ux%u tiles)\n", s.path.c_str(), kGBufferSnapshotTileDim,
+                kGBufferSnapshotTileDim);
+        fprintf(file, "  size           %.2f MB, %.2fx smaller than the nodes in use, %.2fx than the buffers\n",
+                s.stats.fileBytes / (1024.0 * 1024.0),
+                s.stats.fileBytes ? (double)s.stats.rawBytes / s.stats.fileBytes : 0.0,
+                s.stats.fileBytes ? (double)s.gpuBytes / s.stats.fileBytes : 0.0);
+        fprintf(file, "  nodes          %llu, %.2f bytes each\n", (unsigned long long)s.stats.nodes,
+                s.stats.nodes ? (double)s.stats.fileBytes / s.stats.nodes : 0.0);
+        fprintf(file, "  write          %.1f MB/s, read %.1f MB/s (uncompressed)\n",
+                s.writeSeconds > 0.0 ? s.stats.rawBytes / s.writeSeconds / (1024.0 * 1024.0) : 0.0,
+                s.readSeconds > 0.0 ? s.stats.rawBytes / s.readSeconds / (1024.0 * 1024.0) : 0.0);
+        if (s.readBack) {
+            fprintf(file, "  pixels         %llu differ from the reference%s\n", (unsigned long long)s.differingPixels,
+                    s.differingPixels ? "  ** DIFFERS FROM REFERENCE **" : "");
+        } else {
+            fprintf(file, "  ** COULD NOT BE READ BACK **\n");
+        }
+    }
+
+    if (results.relight.lights > 0) {
+        const RelightResults& r = results.relight;
+        fprintf(file, "\nrelight (%u lights, %llu nodes from %s, loaded in %.3f s)\n", r.lights,
+                (unsigned long long)r.nodes, r.source.c_str(), r.loadSeconds);
+        fprintf(file, "  %-8s %10s %10s %12s %12s %8s %12s\n", "simd", "ms", "bin ms", "M evals/s", "lights/tile",
+                "steals", "max error");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const RelightStats& s = r.runs[i].stats;
+            const RelightError& e = r.runs[i].error;
+            fprintf(file, "  %-8s %10.2f %10.2f %12.1f %12.1f %8llu %12.3g%s\n", r.runs[i].name.c_str(),
+                    s.seconds * 1000.0, s.binning.GetSeconds() * 1000.0,
+                    s.seconds > 0.0 ? s.lightEvaluations / s.seconds / 1e6 : 0.0,
+                    s.tiles ? (double)s.tileLights / s.tiles : 0.0, (unsigned long long)s.steals, e.maxError,
+                    e.maxError > kRelightTolerance ? "  ** DIFFERS FROM SCALAR **" : "");
+        }
+    }
+
+    if (results.lightBinning.maxLights > 0) {
+        const LightBinningResults& r = results.lightBinning;
+        fprintf(file, "\nlight binning (tile depth bounds of the last frame, scaled up for the larger resolutions)\n");
+        fprintf(file, "  %8s %11s  %-8s %9s %9s %9s %12s %8s %10s %9s\n", "lights", "resolution", "simd", "ms",
+                "planes", "tiles", "lights/tile", "MB", "ref ms", "mismatch");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightBinningRun& run = r.runs[i];
+            const LightBinningStats& s = run.stats;
+            const double builds = s.builds ? (double)s.builds : 1.0;
+            // The reference only ran on the checked tiles
+            const double referenceMs = run.checkedTiles ?
+                run.referenceSeconds * 1000.0 * (double)s.tiles / builds / (double)run.checkedTiles : 0.0;
+            fprintf(file, "  %8u %5u x %-5u %-8s %9.2f %9.2f %9.2f %12.1f %8.1f %10.1f %9llu%s\n", run.lights,
+                    run.width, run.height, run.name.c_str(), s.GetSeconds() * 1000.0 / builds, s.planeSeconds * 1000.0 / builds,
+                    (s.tileSeconds + s.flattenSeconds) * 1000.0 / builds,
+                    s.tiles ? (double)s.tileLights / s.tiles : 0.0, run.listBytes / 1048576.0, referenceMs,
+                    (unsigned long long)run.mismatchedTiles,
+                    run.mismatchedTiles ? "  ** DIFFERS FROM CullTileLights **" : "");
+        }
+    }
+
+    if (results.lightClusters.maxLights > 0) {
+        const LightClusterResults& r = results.lightClusters;
+        fprintf(file, "\nlight clusters (%s, against %u pixel tiles bounded by the last frame; all, then occupied clusters)\n",
+                r.name.c_str(), COMPUTE_SHADER_TILE_GROUP_DIM);
+        fprintf(file, "  %8s %5s %6s %8s %8s %8s %8s %12s %12s %8s %8s %8s %10s %9s\n", "lights", "tile", "slices",
+                "ms", "occ ms", "tile ms", "occ %", "lights/tile", "lights/clus", "MB", "occ MB", "tile MB", "shaded",
+                "mismatch");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightClusterRun& run = r.runs[i];
+            const LightClusterStats& s = run.stats;
+            const LightClusterStats& o = run.occupiedStats;
+            const ClusteredShadingStats& c = run.shading;
+            const double builds = s.builds ? (double)s.builds : 1.0;
+            const double occupiedBuilds = o.builds ? (double)o.builds : 1.0;
+            const double tiledBuilds = run.tiledStats.builds ? (double)run.tiledStats.builds : 1.0;
+            // Lights each surface loops over with either list
+            fprintf(file, "  %8u %5u %6u %8.2f %8.2f %8.2f %8.1f %12.1f %12.1f %8.1f %8.1f %8.1f %10llu %9llu%s\n",
+                    run.lights, run.tileDim, run.slices, s.GetSeconds() * 1000.0 / builds,
+                    o.GetSeconds() * 1000.0 / occupiedBuilds, run.tiledStats.GetSeconds() * 1000.0 / tiledBuilds,
+                    o.clusters ? 100.0 * o.builtClusters / o.clusters : 0.0,
+                    c.nodes ? (double)c.tiledLights / c.nodes : 0.0, c.nodes ? (double)c.clusteredLights / c.nodes : 0.0,
+                    run.listBytes / 1048576.0, run.occupiedListBytes / 1048576.0, run.tiledListBytes / 1048576.0,
+                    (unsigned long long)c.shadedNodes, (unsigned long long)c.mismatches,
+                    c.mismatches ? "  ** DIFFERS FROM TILED **" : "");
+        }
+    }
+
+    if (results.lightBvh.maxLights > 0) {
+        const LightBvhResults& r = results.lightBvh;
+        fprintf(file, "\nlight bvh (%u pixel tiles and %ux%u clusters of the last frame against LightBins and "
+                      "LightClusters, nodes against their tile)\n",
+                COMPUTE_SHADER_TILE_GROUP_DIM, STREAMING_CLUSTER_TILE_DIM, STREAMING_CLUSTER_SLICES);
+        fprintf(file, "  %8s %8s %5s %8s %8s %8s %7s %7s %7s %8s %8s %8s %8s %10s %12s %12s %9s %9s %9s\n",
+                "lights", "nodes", "depth", "build ms", "refit ms", "rebuilds", "sah", "updated", "fresh", "tile ms",
+                "bins ms", "clus ms", "lclus ms", "boxes/clus", "lights/node", "lights/tile", "node ms", "tiled ms",
+                "mismatch");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightBvhRun& run = r.runs[i];
+            const LightBvhStats& s = run.stats;
+            const uint64_t mismatches = run.mismatchedTiles + run.mismatchedClusters + run.mismatchedNodes;
+            fprintf(file, "  %8u %8llu %5u %8.2f %8.3f %8llu %7.1f %7.1f %7.1f %8.2f %8.2f %8.2f %8.2f %10.1f %12.2f "
+                          "%12.1f %9.2f %9.2f %9llu%s\n",
+                    run.lights, (unsigned long long)s.nodes, s.depth,
+                    s.builds ? s.buildSeconds * 1000.0 / s.builds : 0.0,
+                    s.refits ? s.refitSeconds * 1000.0 / s.refits : 0.0, (unsigned long long)s.rebuilds,
+                    run.builtSahCost, run.refitSahCost, run.rebuiltSahCost, run.tileSeconds * 1000.0,
+                    run.binsSeconds * 1000.0, run.clusterSeconds * 1000.0, run.clustersSeconds * 1000.0,
+                    run.clusterQueries.queries ? (double)run.clusterQueries.nodeTests / run.clusterQueries.queries : 0.0,
+                    run.pointQueries.queries ? (double)run.pointQueries.lights / run.pointQueries.queries : 0.0,
+                    run.shadedNodes ? (double)run.tiledLights / run.shadedNodes : 0.0, run.pointSeconds * 1000.0,
+                    run.tiledShadeSeconds * 1000.0, (unsigned long long)mismatches, mismatches ? "  ** DIFFERS **" : "");
+        }
+    }
+
+    if (results.lightAnimation.maxLights > 0) {
+        const LightAnimationResults& r = results.lightAnimation;
+        fprintf(file, "\nlight animation (App::Move() orbits into view space, against the AoS loops it replaced)\n");
+        fprintf(file, "  %8s %-8s %7s %10s %10s %8s %10s %10s\n", "lights", "simd", "threads", "ms/frame", "Mlights/s",
+                "vs aos", "differing", "max error");
+        double aosSeconds = 0.0;
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightAnimationRun& run = r.runs[i];
+            const double frameSeconds = run.frames ? run.seconds / run.frames : 0.0;
+            if (run.name == "aos") {
+                aosSeconds = frameSeconds;
+            }
+            fprintf(file, "  %8u %-8s %7u %10.3f %10.1f %7.2fx %10llu %10.2g%s\n", run.lights, run.name.c_str(),
+                    run.threads, frameSeconds * 1000.0, frameSeconds > 0.0 ? run.lights / frameSeconds / 1e6 : 0.0,
+                    frameSeconds > 0.0 ? aosSeconds / frameSeconds : 0.0, (unsigned long long)run.differingLights,
+                    run.maxError, run.differingLights ? "  ** DIFFERS FROM SCALAR **" : "");
+        }
+    }
+
+    if (results.uploadRing.frames > 0) {
+        const UploadRingResults& r = results.uploadRing;
+        fprintf(file, "\nupload ring (%u frames of up to %u KB on a simulated GPU)\n", r.frames, r.frameBytes / 1024);
+        fprintf(file, "  %6s %7s %8s %8s %7s %6s %9s %9s %8s %8s %8s %8s\n", "flight", "latency", "capacity", "peak KB",
+                "padding", "wraps", "frame wt", "space wt", "fails", "ns/alloc", "reads", "corrupt");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const UploadRingRun& run = r.runs[i];
+            const UploadRingStats& s = run.ring;
+            const bool bad = run.unfenced ? run.gpu.corruptReads == 0 :
+                             run.gpu.corruptReads > 0 || s.failures > 0 || run.gpu.misuses > 0;
+            fprintf(file, "  %6u %7u %7uK %8u %6.2f%% %6llu %9llu %9llu %8llu %8.1f %8llu %8llu%s%s\n",
+                    run.framesInFlight, run.latencyFrames, run.capacity / 1024, s.peakBytes / 1024,
+                    s.bytes ? 100.0 * s.paddingBytes / s.bytes : 0.0, (unsigned long long)s.wraps,
+                    (unsigned long long)s.frameWaits, (unsigned long long)s.spaceWaits, (unsigned long long)s.failures,
+                    s.allocations ? run.seconds * 1e9 / s.allocations : 0.0,
+                    (unsigned long long)run.gpu.reads, (unsigned long long)run.gpu.corruptReads,
+                    run.unfenced ? "  (unfenced)" : "", bad ? "  ** FAILED **" : "");
+        }
+    }
+
+    if (results.formatConvert.nodes > 0) {
+        const FormatConvertResults& r = results.formatConvert;
+        const double bytes = (double)r.nodes * r.passes * sizeof(MergeNodePacked);
+        fprintf(file, "\nformat conversion (%llu nodes x %u passes, GB/s of MergeNodePacked)\n",
+                (unsigned long long)r.nodes, r.passes);
+        fprintf(file, "  %-8s %10s %10s %12s %10s\n", "simd", "unpack", "pack", "checked", "mismatch");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const FormatConvertRun& run = r.runs[i];
+            const bool differs = run.differingNodes > 0 || run.check.mismatches > 0;
+            fprintf(file, "  %-8s %10.2f %10.2f %12llu %10llu%s\n", run.name.c_str(),
+                    run.unpackSeconds > 0.0 ? bytes / run.unpackSeconds / 1e9 : 0.0,
+                    run.packSeconds > 0.0 ? bytes / run.packSeconds / 1e9 : 0.0,
+                    (unsigned long long)run.check.values,
+                    (unsigned long long)(run.differingNodes + run.check.mismatches),
+                    differs ? "  ** DIFFERS FROM SCALAR **" : "");
+        }
+    }
+
+    if (results.cacheRuns.empty()) {
+        return;
+    }
+    const CacheSimulatorDesc& d = results.cacheDesc;
+    fprintf(file, "\ncache (%u KB, %u B lines, %u ways, %u B DRAM pages, %u banks)\n",
+            d.cacheBytes / 1024, d.lineBytes, d.ways, d.pageBytes, d.banks);
+    fprintf(file, "  %-28s %8s %8s %10s %8s\n", "mapping", "lines/f", "hit", "DRAM/f", "page hit");
+    for (size_t i = 0; i < results.cacheRuns.size(); ++i) {
+        const uint64_t fragments = results.cacheRuns[i].fragments;
+        const CacheStats& c = results.cacheRuns[i].stats;
+        fprintf(file, "  %-28s %8.3f %7.2f%% %10.4f %7.2f%%\n", results.cacheRuns[i].mapping.c_str(),
+                PerFragment(c.reads + c.writes, fragments), 100.0 * c.GetHitRate(),
+                PerFragment(c.dramAccesses, fragments), 100.0 * c.GetPageHitRate());
+    }
+}
+
+bool WriteJsonReport(const char* path, const BenchConfig& config, const BenchResults& results)
+{
+    const std::vector<BenchRun>& runs = results.runs;
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    fprintf(file, "{\n  \"label\": ");
+    WriteJsonString(file, config.label);
+    fprintf(file, ",\n  \"config\": {\n    \"source\": ");
+    WriteJsonString(file, config.source);
+    fprintf(file, ",\n    \"width\": %u,\n    \"height\": %u,\n    \"msaaSamples\": %u,\n"
+                  "    \"surfacesPerPixel\": %u,\n    \"nodePoolPercent\": %u,\n    \"threads\": %u,\n"
+                  "    \"frames\": %u,\n    \"repeat\": %u,\n    \"addressing\": ",
+            config.width, config.height, config.msaaSamples, config.surfacesPerPixel,
+            config.nodePoolPercent, config.threads, config.frames, config.repeat);
+    WriteJsonString(file, config.addressing);
+    if (config.source == "synthetic") {
+        fprintf(file, ",\n    \"depthComplexity\": %g,\n    \"triangleSize\": %g,\n    \"patchCells\": %u,\n"
+                      "    \"coveragePattern\": \"%s\",\n    \"patchOrder\": \"%s\",\n    \"seed\": %u",
+                config.depthComplexity, config.triangleSize, config.patchCells,
+                config.coveragePattern.c_str(), config.patchOrder.c_str(), config.seed);
+        if (config.cameraPath) {
+            fprintf(file, ",\n    \"cameraPan\": [%g, %g]", config.cameraPan[0], config.cameraPan[1]);
+        }
+    }
+    fprintf(file, "\n  },\n  \"runs\": [");
+
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const BenchRun& run = runs[r];
+        const MergeStats& s = run.stats;
+        fprintf(file, "%s\n    {\n      \"name\": ", r ? "," : "");
+        WriteJsonString(file, run.name);
+        fprintf(file, ",\n      \"matchesReference\": %s,\n", run.matchesReference ? "true" : "false");
+        fprintf(file, "      \"binSeconds\": %.6f,\n      \"mergeSeconds\": %.6f,\n"
+                      "      \"fragmentsPerSecond\": %.1f,\n",
+                run.binSeconds, run.mergeSeconds, run.GetFragmentsPerSecond());
+        fprintf(file, "      \"fragments\": %llu,\n      \"firsts\": %llu,\n      \"merges\": %llu,\n"
+                      "      \"inserts\": %llu,\n      \"occlusions\": %llu,\n      \"discards\": %llu,\n"
+                      "      \"nodeLoads\": %llu,\n      \"nodeStores\": %llu,\n",
+                (unsigned long long)s.fragments, (unsigned long long)s.firsts, (unsigned long long)s.merges,
+                (unsigned long long)s.inserts, (unsigned long long)s.occlusions, (unsigned long long)s.discards,
+                (unsigned long long)s.nodeLoads, (unsigned long long)s.nodeStores);
+        fprintf(file, "      \"bytesTouchedPerFragment\": %.3f,\n",
+                PerFragment(run.GetBytesTouched(), s.fragments));
+        fprintf(file, "      \"occupancy\": [");
+        for (size_t i = 0; i < run.occupancy.size(); ++i) {
+            fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)run.occupancy[i]);
+        }
+        fprintf(file, "],\n      \"discardedPixels\": %llu\n    }", (unsigned long long)run.discardedPixels);
+    }
+    const LayoutError& e = results.layoutError;
+    fprintf(file, "\n  ],\n  \"compactLayout\": {\n    \"bytesPerNode\": %u,\n    \"nodes\": %llu,\n"
+                  "    \"exactMismatches\": %llu,\n    \"zViewMaxRelative\": %g,\n    \"zViewMeanRelative\": %g,\n"
+                  "    \"derivativeMaxRelative\": %g,\n    \"derivativeMeanRelative\": %g,\n"
+                  "    \"normalMaxDegrees\": %g,\n    \"normalMeanDegrees\": %g\n  },\n",
+            (unsigned)sizeof(MergeNodeCompact), (unsigned long long)e.nodes, (unsigned long long)e.exactMismatches,
+            e.zViewMaxRelative, Mean(e.zViewSumRelative, e.nodes),
+            e.derivativeMaxRelative, Mean(e.derivativeSumRelative, e.nodes),
+            e.normalMaxDegrees, Mean(e.normalSumDegrees, e.nodes));
+    fprintf(file, "  \"nodePool\": {\n    \"peakBlocks\": %llu,\n    \"sumBlocks\": %llu,\n"
+                  "    \"exhaustedFrames\": %u,\n    \"fixedBytes\": %llu,\n    \"pooledBytesAtPeak\": %llu\n  }",
+            (unsigned long long)results.nodePool.peakBlocks, (unsigned long long)results.nodePool.sumBlocks,
+            results.nodePool.exhaustedFrames,
+            (unsigned long long)GetFixedMergeBytes(config),
+            (unsigned long long)GetPooledMergeBytes(config, results.nodePool.peakBlocks));
+
+    const ResolveCompactionStats& r = results.resolveCompaction;
+    if (r.frames > 0) {
+        fprintf(file, ",\n  \"resolveCompaction\": {\n    \"groupSize\": %u,\n    \"blockDim\": %u,\n"
+                      "    \"frames\": %llu,\n"
+                      "    \"pixels\": %llu,\n    \"coveredPixels\": %llu,\n    \"complexPixels\": %llu,\n"
+                      "    \"complexNodes\": %llu,\n    \"complexGroups\": %llu,\n    \"idleThreads\": %llu,\n"
+                      "    \"blocks\": %llu,\n    \"complexBlocks\": %llu,\n    \"waitingPixels\": %llu,\n"
+                      "    \"mismatchedFrames\": %llu,\n    \"buildSeconds\": %.6f,\n    \"complexFractions\": [",
+                STREAMING_COMPLEX_PIXEL_GROUP_SIZE, results.resolveBlockDim, (unsigned long long)r.frames,
+                (unsigned long long)r.pixels, (unsigned long long)r.coveredPixels, (unsigned long long)r.complexPixels,
+                (unsigned long long)r.complexNodes, (unsigned long long)r.complexGroups, (unsigned long long)r.idleThreads,
+                (unsigned long long)r.blocks, (unsigned long long)r.complexBlocks, (unsigned long long)r.waitingPixels,
+                (unsigned long long)r.mismatchedFrames, r.buildSeconds);
+        for (size_t i = 0; i < results.complexFractions.size(); ++i) {
+            fprintf(file, "%s%.6f", i ? ", " : "", results.complexFractions[i]);
+        }
+        fprintf(file, "]\n  }");
+    }
+
+    fprintf(file, ",\n  \"resolveWeights\": [");
+    WriteJsonResolveWeights(file, config.msaaSamples, "reference", results.resolveWeights);
+    for (int i = 0; i < 2; ++i) {
+        fputc(',', file);
+        WriteJsonResolveWeights(file, kWideSampleCounts[i], "random", results.wideResolveWeights[i]);
+    }
+    fprintf(file, "\n  ]");
+
+    if (results.lights > 0) {
+        const TiledShadingStats& l = results.lightCulling;
+        fprintf(file, ",\n  \"lightCulling\": {\n    \"lights\": %u,\n    \"tileDim\": %u,\n    \"tiles\": %llu,\n"
+                      "    \"tileLights\": %llu,\n    \"nodes\": %llu,\n    \"mismatches\": %llu,\n"
+                      "    \"tiledLights\": %llu,\n    \"bruteForceLights\": %llu,\n"
+                      "    \"cullSeconds\": %.6f,\n    \"tiledSeconds\": %.6f,\n    \"bruteForceSeconds\": %.6f\n  }",
+                results.lights, COMPUTE_SHADER_TILE_GROUP_DIM, (unsigned long long)l.tiles,
+                (unsigned long long)l.tileLights, (unsigned long long)l.nodes, (unsigned long long)l.mismatches,
+                (unsigned long long)l.tiledLights, (unsigned long long)l.bruteForceLights,
+                l.cullSeconds, l.tiledSeconds, l.bruteForceSeconds);
+    }
+
+    if (results.epochBits > 0) {
+        const EpochCountsCheck& c = results.epochCounts;
+        fprintf(file, ",\n  \"epochCounts\": {\n    \"epochBits\": %u,\n    \"frames\": %u,\n    \"wraps\": %u,\n"
+                      "    \"pixels\": %llu,\n    \"stalePixels\": %llu,\n    \"differingPixels\": %llu\n  }",
+                results.epochBits, c.frames, c.wraps, (unsigned long long)c.pixels,
+                (unsigned long long)c.stalePixels, (unsigned long long)c.differingPixels);
+    }
+
+    if (results.concurrent) {
+        const ConcurrentMergeStats& c = results.concurrentMergeStats;
+        const ConcurrentMergeCheck& check = results.concurrentCheck;
+        fprintf(file, ",\n  \"concurrentMerge\": {\n    \"fragments\": %llu,\n    \"mergeSeconds\": %.6f,\n"
+                      "    \"conflicts\": %llu,\n    \"writerWaits\": %llu,\n    \"pixels\": %llu,\n"
+                      "    \"differingPixels\": %llu,\n    \"invalidPixels\": %llu,\n"
+                      "    \"serialDifferingPixels\": %llu\n  }",
+                (unsigned long long)results.concurrentStats.fragments, results.concurrentSeconds,
+                (unsigned long long)c.conflicts, (unsigned long long)c.writerWaits,
+                (unsigned long long)check.pixels, (unsigned long long)check.differingPixels,
+                (unsigned long long)check.invalidPixels,
+                (unsigned long long)results.serialConcurrentCheck.differingPixels);
+    }
+
+    if (results.hiZ) {
+        const HiZStats& h = results.hiZStats;
+        const HiZCheck& check = results.hiZCheck;
+        fprintf(file, ",\n  \"hiZ\": {\n    \"tileDim\": %u,\n    \"fragments\": %llu,\n    \"rejected\": %llu,\n"
+                      "    \"tiles\": %llu,\n    \"occludedTiles\": %llu,\n    \"occludedPixels\": %llu,\n"
+                      "    \"withdrawnPixels\": %llu,\n"
+                      "    \"nodeLoads\": %llu,\n    \"baseNodeLoads\": %llu,\n"
+                      "    \"nodeStores\": %llu,\n    \"baseNodeStores\": %llu,\n"
+                      "    \"pixels\": %llu,\n    \"differingPixels\": %llu,\n    \"resolveDiffers\": %llu\n  }",
+                STREAMING_HIZ_TILE_DIM, (unsigned long long)h.fragments, (unsigned long long)h.rejected,
+                (unsigned long long)h.tiles, (unsigned long long)h.occludedTiles,
+                (unsigned long long)h.occludedPixels, (unsigned long long)h.withdrawnPixels,
+                (unsigned long long)results.hiZMergeStats.nodeLoads,
+                (unsigned long long)results.hiZBaseStats.nodeLoads,
+                (unsigned long long)results.hiZMergeStats.nodeStores,
+                (unsigned long long)results.hiZBaseStats.nodeStores,
+                (unsigned long long)check.pixels, (unsigned long long)check.differingPixels,
+                (unsigned long long)check.resolveDiffers);
+    }
+
+    if (results.nodePrediction) {
+        const NodeSearchStats& base = results.nodeSearch;
+        const NodeSearchStats& p = results.predictedNodeSearch;
+        const MergedBuffersCheck& check = results.nodePredictionCheck;
+        fprintf(file, ",\n  \"nodePrediction\": {\n    \"margin\": %g,\n    \"fragments\": %llu,\n"
+                      "    \"steps\": %llu,\n    \"loads\": %llu,\n    \"depthLoads\": %llu,\n"
+                      "    \"mispredicted\": %llu,\n    \"skippedFront\": %llu,\n"
+                      "    \"skippedBehind\": %llu,\n    \"summaryReads\": %llu,\n    \"summaryWrites\": %llu,\n"
+                      "    \"bytes\": %llu,\n    \"baseFragments\": %llu,\n    \"baseLoads\": %llu,\n    \"baseBytes\": %llu,\n"
+                      "    \"nodeLoads\": %llu,\n    \"baseNodeLoads\": %llu,\n"
+                      "    \"pixels\": %llu,\n    \"differingPixels\": %llu,\n    \"resolveDiffers\": %llu\n  }",
+                STREAMING_PREDICTION_MARGIN, (unsigned long long)p.fragments, (unsigned long long)p.steps,
+                (unsigned long long)p.loads, (unsigned long long)p.depthLoads,
+                (unsigned long long)p.mispredicted, (unsigned long long)p.skippedFront,
+                (unsigned long long)p.skippedBehind, (unsigned long long)p.summaryReads,
+                (unsigned long long)p.summaryWrites, (unsigned long long)p.GetBytes(),
+                (unsigned long long)base.fragments, (unsigned long long)base.loads,
+                (unsigned long long)base.GetBytes(),
+                (unsigned long long)results.nodePredictionMergeStats.nodeLoads,
+                (unsigned long long)results.nodePredictionBaseStats.nodeLoads,
+                (unsigned long long)check.pixels, (unsigned long long)check.differingPixels,
+                (unsigned long long)check.resolveDiffers);
+    }
+
+    if (results.discardPolicies) {
+        fprintf(file, ",\n  \"discardPolicies\": {\n    \"minPsnr\": %g,\n    \"selected\": ", results.discardMinPsnr);
+        if (results.selectedDiscardPolicy < DISCARD_POLICY_COUNT) {
+            fprintf(file, "\"%s\"", GetDiscardPolicyName(results.selectedDiscardPolicy));
+        } else {
+            fprintf(file, "null");
+        }
+        fprintf(file, ",\n    \"referenceDiscards\": %llu,\n    \"policies\": [",
+                (unsigned long long)results.discardReferenceStats.discards);
+        for (unsigned i = 0; i < DISCARD_POLICY_COUNT; ++i) {
+            const DiscardPolicyStats& s = results.discardPolicyStats[i];
+            fprintf(file, "%s\n      {\"name\": \"%s\", \"fragments\": %llu, \"discards\": %llu, "
+                          "\"nodeLoads\": %llu, \"nodeStores\": %llu, \"stateAccesses\": %llu, "
+                          "\"seconds\": %.6f, \"pixels\": %llu, \"discardedPixels\": %llu, "
+                          "\"differingPixels\": %llu, \"rmse\": %g, \"psnr\": %.3f}",
+                    i ? "," : "", GetDiscardPolicyName((DiscardPolicy)i), (unsigned long long)s.merge.fragments,
+                    (unsigned long long)s.merge.discards, (unsigned long long)s.merge.nodeLoads,
+                    (unsigned long long)s.merge.nodeStores, (unsigned long long)s.stateAccesses, s.seconds,
+                    (unsigned long long)s.pixels, (unsigned long long)s.discardedPixels,
+                    (unsigned long long)s.differingPixels, s.GetRootMeanSquaredError(), s.GetPsnr());
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (!results.snapshot.path.empty()) {
+        const SnapshotRun& s = results.snapshot;
+        fprintf(file, ",\n  \"snapshot\": {\n    \"path\": ");
+        WriteJsonString(file, s.path);
+        fprintf(file, ",\n    \"tileDim\": %u,\n    \"nodes\": %llu,\n    \"fileBytes\": %llu,\n"
+                      "    \"rawBytes\": %llu,\n    \"gpuBytes\": %llu,\n    \"compressedTiles\": %u,\n"
+                      "    \"writeSeconds\": %.6f,\n    \"readSeconds\": %.6f,\n    \"readBack\": %s,\n"
+                      "    \"differingPixels\": %llu\n  }",
+                kGBufferSnapshotTileDim, (unsigned long long)s.stats.nodes, (unsigned long long)s.stats.fileBytes,
+                (unsigned long long)s.stats.rawBytes, (unsigned long long)s.gpuBytes, s.stats.compressedTiles,
+                s.writeSeconds, s.readSeconds, s.readBack ? "true" : "false", (unsigned long long)s.differingPixels);
+    }
+
+    if (results.relight.lights > 0) {
+        const RelightResults& r = results.relight;
+        fprintf(file, ",\n  \"relight\": {\n    \"source\": ");
+        WriteJsonString(file, r.source);
+        fprintf(file, ",\n    \"lights\": %u,\n    \"nodes\": %llu,\n    \"loadSeconds\": %.6f,\n    \"runs\": [",
+                r.lights, (unsigned long long)r.nodes, r.loadSeconds);
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const RelightStats& s = r.runs[i].stats;
+            const RelightError& e = r.runs[i].error;
+            fprintf(file, "%s\n      {\n        \"simd\": ", i ? "," : "");
+            WriteJsonString(file, r.runs[i].name);
+            fprintf(file, ",\n        \"seconds\": %.6f,\n        \"binSeconds\": %.6f,\n        \"tiles\": %llu,\n"
+                          "        \"tileLights\": %llu,\n"
+                          "        \"lightEvaluations\": %llu,\n        \"steals\": %llu,\n"
+                          "        \"differingPixels\": %llu,\n        \"maxError\": %.9g\n      }",
+                    s.seconds, s.binning.GetSeconds(), (unsigned long long)s.tiles, (unsigned long long)s.tileLights,
+                    (unsigned long long)s.lightEvaluations, (unsigned long long)s.steals,
+                    (unsigned long long)e.differingPixels, e.maxError);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.lightBinning.maxLights > 0) {
+        const LightBinningResults& r = results.lightBinning;
+        fprintf(file, ",\n  \"lightBinning\": {\n    \"maxLights\": %u,\n    \"runs\": [", r.maxLights);
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightBinningRun& run = r.runs[i];
+            const LightBinningStats& s = run.stats;
+            fprintf(file, "%s\n      {\n        \"lights\": %u,\n        \"width\": %u,\n        \"height\": %u,\n"
+                          "        \"simd\": ",
+                    i ? "," : "", run.lights, run.width, run.height);
+            WriteJsonString(file, run.name);
+            fprintf(file, ",\n        \"builds\": %llu,\n        \"tiles\": %llu,\n        \"tileLights\": %llu,\n"
+                          "        \"planeTests\": %llu,\n        \"depthTests\": %llu,\n"
+                          "        \"planeSeconds\": %.6f,\n        \"tileSeconds\": %.6f,\n"
+                          "        \"flattenSeconds\": %.6f,\n        \"listBytes\": %llu,\n"
+                          "        \"checkedTiles\": %llu,\n        \"mismatchedTiles\": %llu,\n"
+                          "        \"referenceSeconds\": %.6f\n      }",
+                    (unsigned long long)s.builds, (unsigned long long)s.tiles, (unsigned long long)s.tileLights,
+                    (unsigned long long)s.planeTests, (unsigned long long)s.depthTests, s.planeSeconds,
+                    s.tileSeconds, s.flattenSeconds, (unsigned long long)run.listBytes,
+                    (unsigned long long)run.checkedTiles, (unsigned long long)run.mismatchedTiles,
+                    run.referenceSeconds);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.lightClusters.maxLights > 0) {
+        const LightClusterResults& r = results.lightClusters;
+        fprintf(file, ",\n  \"lightClusters\": {\n    \"maxLights\": %u,\n    \"simd\": ", r.maxLights);
+        WriteJsonString(file, r.name);
+        fprintf(file, ",\n    \"runs\": [");
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightClusterRun& run = r.runs[i];
+            const LightClusterStats& s = run.stats;
+            const LightClusterStats& o = run.occupiedStats;
+            const ClusteredShadingStats& c = run.shading;
+            fprintf(file, "%s\n      {\n        \"lights\": %u,\n        \"tileDim\": %u,\n        \"slices\": %u,\n"
+                          "        \"builds\": %llu,\n        \"clusters\": %llu,\n        \"clusterLights\": %llu,\n"
+                          "        \"planeTests\": %llu,\n        \"wordTests\": %llu,\n"
+                          "        \"planeSeconds\": %.6f,\n        \"clusterSeconds\": %.6f,\n"
+                          "        \"flattenSeconds\": %.6f,\n        \"listBytes\": %llu,\n",
+                    i ? "," : "", run.lights, run.tileDim, run.slices, (unsigned long long)s.builds,
+                    (unsigned long long)s.clusters, (unsigned long long)s.clusterLights,
+                    (unsigned long long)s.planeTests, (unsigned long long)s.wordTests, s.planeSeconds,
+                    s.clusterSeconds, s.flattenSeconds, (unsigned long long)run.listBytes);
+            fprintf(file, "        \"occupiedClusters\": %llu,\n        \"occupiedClusterLights\": %llu,\n"
+                          "        \"occupiedSeconds\": %.6f,\n        \"occupiedListBytes\": %llu,\n"
+                          "        \"tiledSeconds\": %.6f,\n        \"tiledListBytes\": %llu,\n"
+                          "        \"nodes\": %llu,\n        \"tiledLights\": %llu,\n"
+                          "        \"clusteredLights\": %llu,\n        \"shadedNodes\": %llu,\n"
+                          "        \"mismatches\": %llu,\n        \"tiledShadeSeconds\": %.6f,\n"
+                          "        \"clusteredShadeSeconds\": %.6f\n      }",
+                    (unsigned long long)o.builtClusters, (unsigned long long)o.clusterLights, o.GetSeconds(),
+                    (unsigned long long)run.occupiedListBytes, run.tiledStats.GetSeconds(),
+                    (unsigned long long)run.tiledListBytes, (unsigned long long)c.nodes,
+                    (unsigned long long)c.tiledLights, (unsigned long long)c.clusteredLights,
+                    (unsigned long long)c.shadedNodes, (unsigned long long)c.mismatches, c.tiledSeconds,
+                    c.clusteredSeconds);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.lightBvh.maxLights > 0) {
+        const LightBvhResults& r = results.lightBvh;
+        fprintf(file, ",\n  \"lightBvh\": {\n    \"maxLights\": %u,\n    \"runs\": [", r.maxLights);
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightBvhRun& run = r.runs[i];
+            const LightBvhStats& s = run.stats;
+            fprintf(file, "%s\n      {\n        \"lights\": %u,\n        \"nodes\": %llu,\n        \"leaves\": %llu,\n"
+                          "        \"depth\": %u,\n        \"builds\": %llu,\n        \"buildSeconds\": %.6f,\n"
+                          "        \"refits\": %llu,\n        \"rebuilds\": %llu,\n        \"refitTasks\": %u,\n        \"refitSeconds\": %.6f,\n"
+                          "        \"builtSahCost\": %.3f,\n        \"refitSahCost\": %.3f,\n"
+                          "        \"rebuiltSahCost\": %.3f,\n",
+                    i ? "," : "", run.lights, (unsigned long long)s.nodes, (unsigned long long)s.leaves, s.depth,
+                    (unsigned long long)s.builds, s.buildSeconds, (unsigned long long)s.refits,
+                    (unsigned long long)s.rebuilds, s.refitTasks,
+                    s.refitSeconds, run.builtSahCost, run.refitSahCost, run.rebuiltSahCost);
+            const LightBvhQueryStats* queries[3] = { &run.tileQueries, &run.clusterQueries, &run.pointQueries };
+            const char* names[3] = { "tile", "cluster", "point" };
+            for (int q = 0; q < 3; ++q) {
+                fprintf(file, "        \"%sQueries\": %llu,\n        \"%sNodeTests\": %llu,\n"
+                              "        \"%sLightTests\": %llu,\n        \"%sLights\": %llu,\n",
+                        names[q], (unsigned long long)queries[q]->queries, names[q],
+                        (unsigned long long)queries[q]->nodeTests, names[q], (unsigned long long)queries[q]->lightTests,
+                        names[q], (unsigned long long)queries[q]->lights);
+            }
+            fprintf(file, "        \"tileSeconds\": %.6f,\n        \"binsSeconds\": %.6f,\n"
+                          "        \"clusterSeconds\": %.6f,\n        \"clustersSeconds\": %.6f,\n"
+                          "        \"mismatchedTiles\": %llu,\n        \"mismatchedClusters\": %llu,\n"
+                          "        \"shadedNodes\": %llu,\n        \"tiledLights\": %llu,\n"
+                          "        \"mismatchedNodes\": %llu,\n        \"pointSeconds\": %.6f,\n"
+                          "        \"tiledShadeSeconds\": %.6f\n      }",
+                    run.tileSeconds, run.binsSeconds, run.clusterSeconds, run.clustersSeconds,
+                    (unsigned long long)run.mismatchedTiles, (unsigned long long)run.mismatchedClusters,
+                    (unsigned long long)run.shadedNodes, (unsigned long long)run.tiledLights,
+                    (unsigned long long)run.mismatchedNodes, run.pointSeconds, run.tiledShadeSeconds);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.lightAnimation.maxLights > 0) {
+        const LightAnimationResults& r = results.lightAnimation;
+        fprintf(file, ",\n  \"lightAnimation\": {\n    \"maxLights\": %u,\n    \"runs\": [", r.maxLights);
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const LightAnimationRun& run = r.runs[i];
+            fprintf(file, "%s\n      {\n        \"lights\": %u,\n        \"simd\": ", i ? "," : "", run.lights);
+            WriteJsonString(file, run.name);
+            fprintf(file, ",\n        \"threads\": %u,\n        \"frames\": %u,\n        \"seconds\": %.6f,\n"
+                          "        \"differingLights\": %llu,\n        \"maxError\": %g\n      }",
+                    run.threads, run.frames, run.seconds, (unsigned long long)run.differingLights, run.maxError);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.uploadRing.frames > 0) {
+        const UploadRingResults& r = results.uploadRing;
+        fprintf(file, ",\n  \"uploadRing\": {\n    \"frames\": %u,\n    \"frameBytes\": %u,\n    \"runs\": [",
+                r.frames, r.frameBytes);
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const UploadRingRun& run = r.runs[i];
+            const UploadRingStats& s = run.ring;
+            const CpuUploadStats& g = run.gpu;
+            fprintf(file, "%s\n      {\n        \"framesInFlight\": %u,\n        \"latencyFrames\": %u,\n"
+                          "        \"capacity\": %u,\n        \"unfenced\": %s,\n        \"allocations\": %llu,\n"
+                          "        \"bytes\": %llu,\n        \"paddingBytes\": %llu,\n        \"wraps\": %llu,\n"
+                          "        \"maps\": %llu,\n        \"frameWaits\": %llu,\n        \"spaceWaits\": %llu,\n"
+                          "        \"failures\": %llu,\n        \"peakBytes\": %u,\n        \"gpuWaits\": %llu,\n"
+                          "        \"reads\": %llu,\n        \"readBytes\": %llu,\n        \"corruptReads\": %llu,\n"
+                          "        \"misuses\": %llu,\n        \"seconds\": %.6f\n      }",
+                    i ? "," : "", run.framesInFlight, run.latencyFrames, run.capacity, run.unfenced ? "true" : "false",
+                    (unsigned long long)s.allocations, (unsigned long long)s.bytes,
+                    (unsigned long long)s.paddingBytes, (unsigned long long)s.wraps, (unsigned long long)s.maps,
+                    (unsigned long long)s.frameWaits, (unsigned long long)s.spaceWaits,
+                    (unsigned long long)s.failures, s.peakBytes, (unsigned long long)g.waits,
+                    (unsigned long long)g.reads, (unsigned long long)g.readBytes, (unsigned long long)g.corruptReads,
+                    (unsigned long long)g.misuses, run.seconds);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (results.formatConvert.nodes > 0) {
+        const FormatConvertResults& r = results.formatConvert;
+        fprintf(file, ",\n  \"formatConvert\": {\n    \"nodes\": %llu,\n    \"passes\": %u,\n"
+                      "    \"nodeBytes\": %u,\n    \"runs\": [",
+                (unsigned long long)r.nodes, r.passes, (unsigned)sizeof(MergeNodePacked));
+        for (size_t i = 0; i < r.runs.size(); ++i) {
+            const FormatConvertRun& run = r.runs[i];
+            fprintf(file, "%s\n      {\n        \"simd\": ", i ? "," : "");
+            WriteJsonString(file, run.name);
+            fprintf(file, ",\n        \"unpackSeconds\": %.6f,\n        \"packSeconds\": %.6f,\n"
+                          "        \"differingNodes\": %llu,\n        \"checkedValues\": %llu,\n"
+                          "        \"checkMismatches\": %llu\n      }",
+                    run.unpackSeconds, run.packSeconds, (unsigned long long)run.differingNodes,
+                    (unsigned long long)run.check.values, (unsigned long long)run.check.mismatches);
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+
+    if (!results.cacheRuns.empty()) {
+        const CacheSimulatorDesc& d = results.cacheDesc;
+        fprintf(file, ",\n  \"cache\": {\n    \"cacheBytes\": %u,\n    \"lineBytes\": %u,\n    \"ways\": %u,\n"
+                      "    \"pageBytes\": %u,\n    \"banks\": %u,\n    \"mappings\": [",
+                d.cacheBytes, d.lineBytes, d.ways, d.pageBytes, d.banks);
+        for (size_t i = 0; i < results.cacheRuns.size(); ++i) {
+            const CacheStats& c = results.cacheRuns[i].stats;
+            fprintf(file, "%s\n      {\n        \"mapping\": ", i ? "," : "");
+            WriteJsonString(file, results.cacheRuns[i].mapping);
+            fprintf(file, ",\n        \"fragments\": %llu,\n        \"reads\": %llu,\n        \"writes\": %llu,\n        \"readHits\": %llu,\n"
+                          "        \"writeHits\": %llu,\n        \"writebacks\": %llu,\n"
+                          "        \"dramAccesses\": %llu,\n        \"pageHits\": %llu,\n"
+                          "        \"hitRate\": %.6f,\n        \"pageHitRate\": %.6f\n      }",
+                    (unsigned long long)results.cacheRuns[i].fragments,
+                    (unsigned long long)c.reads, (unsigned long long)c.writes, (unsigned long long)c.readHits,
+                    (unsigned long long)c.writeHits, (unsigned long long)c.writebacks,
+                    (unsigned long long)c.dramAccesses, (unsigned long long)c.pageHits,
+                    c.GetHitRate(), c.GetPageHitRate());
+        }
+        fprintf(file, "\n    ]\n  }");
+    }
+    fprintf(file, "\n}\n");
+
+    bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
+
+bool AppendCsvReport(const char* path, const BenchConfig& config, const BenchResults& results)
+{
+    const std::vector<BenchRun>& runs = results.runs;
+    const LayoutError& layoutError = results.layoutError;
+    FILE* file = fopen(path, "a");
+    if (!file) {
+        return false;
+    }
+
+    // Occupancy columns go up to the largest surface count so rows from
+    // different configurations line up.
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        fprintf(file, "label,source,width,height,msaaSamples,surfacesPerPixel,nodePoolPercent,addressing,threads,frames,repeat,"
+                      "depthComplexity,triangleSize,patchCells,coveragePattern,patchOrder,seed,"
+                      "name,matchesReference,binSeconds,mergeSeconds,fragmentsPerSecond,"
+                      "fragments,firsts,merges,inserts,occlusions,discards,nodeLoads,nodeStores,"
+                      "bytesTouchedPerFragment,discardedPixels,compactZViewMaxRelative,"
+                      "compactDerivativeMaxRelative,compactNormalMaxDegrees,poolPeakBlocks,"
+                      "fixedMergeBytes,pooledMergeBytesAtPeak");
+        for (unsigned i = 0; i <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU; ++i) {
+            fprintf(file, ",occupancy%u", i);
+        }
+        fprintf(file, "\n");
+    }
+
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const BenchRun& run = runs[r];
+        const MergeStats& s = run.stats;
+        WriteCsvString(file, config.label);
+        fputc(',', file);
+        WriteCsvString(file, config.source);
+        fprintf(file, ",%u,%u,%u,%u,%u,", config.width, config.height, config.msaaSamples,
+                config.surfacesPerPixel, config.nodePoolPercent);
+        WriteCsvString(file, config.addressing);
+        fprintf(file, ",%u,%u,%u,%g,%g,%u,%s,%s,%u,",
+                config.threads, config.frames, config.repeat, config.depthComplexity,
+                config.triangleSize, config.patchCells, config.coveragePattern.c_str(),
+                config.patchOrder.c_str(), config.seed);
+        WriteCsvString(file, run.name);
+        fprintf(file, ",%d,%.6f,%.6f,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%llu",
+                run.matchesReference ? 1 : 0, run.binSeconds, run.mergeSeconds, run.GetFragmentsPerSecond(),
+                (unsigned long long)s.fragments, (unsigned long long)s.firsts, (unsigned long long)s.merges,
+                (unsigned long long)s.inserts, (unsigned long long)s.occlusions, (unsigned long long)s.discards,
+                (unsigned long long)s.nodeLoads, (unsigned long long)s.nodeStores,
+                PerFragment(run.GetBytesTouched(), s.fragments), (unsigned long long)run.discardedPixels);
+        fprintf(file, ",%g,%g,%g,%llu,%llu,%llu", layoutError.zViewMaxRelative,
+                layoutError.derivativeMaxRelative, layoutError.normalMaxDegrees,
+                (unsigned long long)results.nodePool.peakBlocks, (unsigned long long)GetFixedMergeBytes(config),
+                (unsigned long long)GetPooledMergeBytes(config, results.nodePool.peakBlocks));
+        for (unsigned i = 0; i <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU; ++i) {
+            fprintf(file, ",%llu", (unsigned long long)(i < run.occupancy.size() ? run.occupancy[i] : 0));
+        }
+        fprintf(file, "\n");
+    }
+
+    bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
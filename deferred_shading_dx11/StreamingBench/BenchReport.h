@@ -0,0 +1,399 @@
+#ifndef STREAMINGBENCH_BENCHREPORT_H
+#define STREAMINGBENCH_BENCHREPORT_H
+
+#include "CacheSimulator.h"
+#include "ConcurrentMerge.h"
+#include "DiscardPolicy.h"
+#include "EpochCounts.h"
+#include "FormatConvertSimd.h"
+#include "GBufferSnapshot.h"
+#include "HiZ.h"
+#include "LightBinning.h"
+#include "LightAnimation.h"
+#include "LightBvh.h"
+#include "LightClusters.h"
+#include "LightCulling.h"
+#include "MergeKernel.h"
+#include "NodePrediction.h"
+#include "Relight.h"
+#include "ResolveCompaction.h"
+#include "ResolveWeights.h"
+#include "UploadRing.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// The last frame's reference buffers written as a g-buffer snapshot and read
+// back
+struct SnapshotRun
+{
+    std::string path;                   // empty unless --snapshot
+    StreamingCpu::GBufferSnapshotStats stats;
+    uint64_t gpuBytes;                  // count, list and merge buffers the snapshot replaces
+    double writeSeconds;
+    double readSeconds;                 // all tiles decoded once
+    bool readBack;                      // opened and every tile decoded
+    uint64_t differingPixels;
+
+    SnapshotRun() : gpuBytes(0), writeSeconds(0.0), readSeconds(0.0), readBack(false), differingPixels(0) {}
+};
+
+// One RelightEngine::Shade() of the last frame
+struct RelightRun
+{
+    std::string name;                   // simd level
+    StreamingCpu::RelightStats stats;
+    StreamingCpu::RelightError error;   // against the scalar run, which comes first
+};
+
+// Largest error a lane kernel may have against the scalar one, from its powf()
+const double kRelightTolerance = 1e-4;
+
+struct RelightResults
+{
+    std::string source;                 // snapshot path or "buffers"
+    unsigned lights;                    // 0 unless --relight
+    uint64_t nodes;                     // nodes that cover a sample
+    double loadSeconds;
+    std::vector<RelightRun> runs;
+
+    RelightResults() : lights(0), nodes(0), loadSeconds(0.0) {}
+};
+
+// LightBins::Build() of one light count, resolution and level
+struct LightBinningRun
+{
+    unsigned lights;
+    unsigned width;
+    unsigned height;
+    std::string name;                       // simd level
+    StreamingCpu::LightBinningStats stats;
+    uint64_t listBytes;                     // tile ranges and light indices
+    uint64_t checkedTiles;                  // compared with CullTileLights()
+    uint64_t mismatchedTiles;
+    double referenceSeconds;                // CullTileLights() on the checked tiles
+
+    LightBinningRun()
+        : lights(0), width(0), height(0), listBytes(0), checkedTiles(0), mismatchedTiles(0), referenceSeconds(0.0) {}
+};
+
+struct LightBinningResults
+{
+    unsigned maxLights;                     // 0 unless --light-binning
+    std::vector<LightBinningRun> runs;
+
+    LightBinningResults() : maxLights(0) {}
+};
+
+// LightClusters::Build() of one light count and froxel grid, and the lights
+// per surface of its lists against the tile lists of LightBins
+struct LightClusterRun
+{
+    unsigned lights;
+    unsigned tileDim;
+    unsigned slices;
+    StreamingCpu::LightClusterStats stats;          // every cluster, as the app builds them
+    StreamingCpu::LightClusterStats occupiedStats;  // only the clusters holding a node
+    StreamingCpu::LightBinningStats tiledStats;     // COMPUTE_SHADER_TILE_GROUP_DIM tiles
+    uint64_t listBytes;                             // cluster ranges and light indices
+    uint64_t occupiedListBytes;
+    uint64_t tiledListBytes;
+    StreamingCpu::ClusteredShadingStats shading;
+
+    LightClusterRun() : lights(0), tileDim(0), slices(0), listBytes(0), occupiedListBytes(0), tiledListBytes(0) {}
+};
+
+struct LightClusterResults
+{
+    unsigned maxLights;                     // 0 unless --light-clusters
+    std::string name;                       // simd level
+    std::vector<LightClusterRun> runs;
+
+    LightClusterResults() : maxLights(0) {}
+};
+
+// LightBvh over one light count: built, refit over a second of orbiting, and
+// queried for the tile lists of LightBins, the cluster lists of LightClusters
+// and the lights of single nodes, each compared with what it stands in for
+struct LightBvhRun
+{
+    unsigned lights;
+    unsigned refitFrames;
+    StreamingCpu::LightBvhStats stats;
+    double builtSahCost;
+    double refitSahCost;                            // after the last frame's LightBvh::Update()
+    double rebuiltSahCost;                          // of a fresh build on the last frame
+    StreamingCpu::LightBvhQueryStats tileQueries;   // COMPUTE_SHADER_TILE_GROUP_DIM tiles
+    StreamingCpu::LightBvhQueryStats clusterQueries;
+    StreamingCpu::LightBvhQueryStats pointQueries;
+    double tileSeconds;
+    double binsSeconds;                             // LightBins::Build() of the same lists
+    double clusterSeconds;
+    double clustersSeconds;                         // LightClusters::Build() of the same lists
+    uint64_t mismatchedTiles;
+    uint64_t mismatchedClusters;
+    uint64_t shadedNodes;                           // nodes shaded with their point query and their tile list
+    uint64_t tiledLights;                           // lights of those tile lists
+    uint64_t mismatchedNodes;
+    double pointSeconds;                            // queries and shading
+    double tiledShadeSeconds;
+
+    LightBvhRun()
+        : lights(0), refitFrames(0), builtSahCost(0.0), refitSahCost(0.0), rebuiltSahCost(0.0)
+        , tileSeconds(0.0), binsSeconds(0.0), clusterSeconds(0.0), clustersSeconds(0.0)
+        , mismatchedTiles(0), mismatchedClusters(0), shadedNodes(0), tiledLights(0), mismatchedNodes(0)
+        , pointSeconds(0.0), tiledShadeSeconds(0.0) {}
+};
+
+struct LightBvhResults
+{
+    unsigned maxLights;                     // 0 unless --light-bvh
+    std::vector<LightBvhRun> runs;
+
+    LightBvhResults() : maxLights(0) {}
+};
+
+// LightStore::Animate() of one light count, level and thread count, or the
+// AoS loops it replaced
+struct LightAnimationRun
+{
+    unsigned lights;
+    std::string name;                       // simd level, "aos" for the old loops
+    unsigned threads;
+    unsigned frames;
+    double seconds;
+    uint64_t differingLights;               // last frame, from scalar's in any bit
+    double maxError;                        // last frame, largest coordinate off the AoS loops'
+
+    LightAnimationRun() : lights(0), threads(0), frames(0), seconds(0.0), differingLights(0), maxError(0.0) {}
+};
+
+struct LightAnimationResults
+{
+    unsigned maxLights;                     // 0 unless --light-animation
+    std::vector<LightAnimationRun> runs;
+
+    LightAnimationResults() : maxLights(0) {}
+};
+
+// UploadRing over one CpuUploadBackend
+struct UploadRingRun
+{
+    unsigned framesInFlight;
+    unsigned latencyFrames;                 // frames the simulated GPU finishes behind
+    unsigned capacity;                      // bytes
+    bool unfenced;                          // the backend ignores fences, reads must corrupt
+    StreamingCpu::UploadRingStats ring;
+    StreamingCpu::CpuUploadStats gpu;
+    double seconds;                         // of the ring alone, without filling or reading the allocations
+
+    UploadRingRun() : framesInFlight(0), latencyFrames(0), capacity(0), unfenced(false), seconds(0.0) {}
+};
+
+struct UploadRingResults
+{
+    unsigned frames;                        // 0 unless --upload-ring
+    unsigned frameBytes;                    // most bytes a frame allocates
+    std::vector<UploadRingRun> runs;
+
+    UploadRingResults() : frames(0), frameBytes(0) {}
+};
+
+// FormatConvertFunctions of one level over the last frame's merge buffer
+struct FormatConvertRun
+{
+    std::string name;                           // simd level
+    double unpackSeconds;
+    double packSeconds;
+    uint64_t differingNodes;                    // unpacked or repacked nodes that differ from scalar
+    StreamingCpu::FormatConvertCheck check;     // CheckFormatConvert()
+
+    FormatConvertRun() : unpackSeconds(0.0), packSeconds(0.0), differingNodes(0) {}
+};
+
+struct FormatConvertResults
+{
+    uint64_t nodes;                     // per pass, 0 unless --format-convert
+    unsigned passes;
+    std::vector<FormatConvertRun> runs;
+
+    FormatConvertResults() : nodes(0), passes(0) {}
+};
+
+// What was replayed, echoed into every report so results can be compared
+// across commits.
+struct BenchConfig
+{
+    std::string label;          // free form, e.g. a commit hash
+    std::string source;         // "synthetic" or the trace path
+    unsigned width;
+    unsigned height;
+    unsigned msaaSamples;
+    unsigned surfacesPerPixel;
+    unsigned nodePoolPercent;   // 0 for fixed storage
+    std::string addressing;     // GetAddressMappingName() of the merge buffers
+    unsigned threads;
+    unsigned frames;
+    unsigned repeat;
+
+    // Synthetic streams only
+    float depthComplexity;
+    float triangleSize;
+    unsigned patchCells;
+    std::string coveragePattern;
+    std::string patchOrder;
+    unsigned seed;
+    bool cameraPath;
+    float cameraPan[2];         // pixels per frame
+};
+
+// One merge implementation over all frames
+struct BenchRun
+{
+    std::string name;
+    StreamingCpu::MergeStats stats;
+    double binSeconds;
+    double mergeSeconds;
+
+    // Pixels by final node count (0 to surfacesPerPixel), summed over frames
+    std::vector<uint64_t> occupancy;
+    uint64_t discardedPixels;
+
+    // Final buffers equal those of the first run for every frame
+    bool matchesReference;
+
+    double GetFragmentsPerSecond() const;
+
+    // Memory traffic the counters imply, ignoring caches. Nodes move whole;
+    // every execution reads the count, non-empty pixels also read the list,
+    // and each store path writes the words it changes.
+    uint64_t GetBytesTouched() const;
+};
+
+// Error of the 16 byte MergeNodeCompact layout against MergeNodePacked over
+// the nodes the reference run left in use
+struct LayoutError
+{
+    uint64_t nodes;
+    uint64_t exactMismatches;           // coverage, albedo and specular differ
+    double zViewMaxRelative;
+    double zViewSumRelative;
+    double derivativeMaxRelative;       // relative to max(|d|, smallest normal half)
+    double derivativeSumRelative;
+    double normalMaxDegrees;
+    double normalSumDegrees;
+
+    LayoutError();
+
+    // reference is an unpacked MergeNodePacked
+    void Add(const MergeNode& reference);
+};
+
+// Overflow blocks the pooled storage (STREAMING_NODE_POOL) needs. Every
+// pixel that gets a second node takes one block, whichever storage ran.
+struct NodePoolUsage
+{
+    uint64_t peakBlocks;        // most blocks one frame used
+    uint64_t sumBlocks;
+    unsigned exhaustedFrames;   // frames that dropped fragments for lack of blocks
+
+    NodePoolUsage() : peakBlocks(0), sumBlocks(0), exhaustedFrames(0) {}
+
+    void AddFrame(uint64_t blocks, bool exhausted)
+    {
+        peakBlocks = blocks > peakBlocks ? blocks : peakBlocks;
+        sumBlocks += blocks;
+        exhaustedFrames += exhausted ? 1 : 0;
+    }
+};
+
+// Cache behaviour of one gMergeBuffer address mapping on the reference
+// access stream (see MergeAccessTrace.h). The cache is flushed every frame.
+struct CacheRun
+{
+    std::string mapping;
+    uint64_t fragments;
+    StreamingCpu::CacheStats stats;
+};
+
+struct BenchResults
+{
+    std::vector<BenchRun> runs;
+    LayoutError layoutError;
+    NodePoolUsage nodePool;
+    StreamingCpu::CacheSimulatorDesc cacheDesc;
+    std::vector<CacheRun> cacheRuns;    // empty unless --cache-sim
+
+    // Tiled light culling of the reference buffers against brute force shading
+    unsigned lights;                    // 0 unless --lights
+    StreamingCpu::TiledShadingStats lightCulling;
+
+    // Complex pixels of the compacted resolve in the reference buffers
+    unsigned resolveBlockDim;           // pixels one single pass resolve thread covers
+    StreamingCpu::ResolveCompactionStats resolveCompaction;
+    std::vector<double> complexFractions;   // per frame
+
+    // ResolveSurfaceWeights with coverage masks against the per-sample loop,
+    // on the reference buffers and on random pixels at 16x and 32x
+    StreamingCpu::ResolveWeightsStats resolveWeights;
+    StreamingCpu::ResolveWeightsStats wideResolveWeights[2];
+
+    // EpochMergeBuffers against the reference buffers every frame
+    unsigned epochBits;                 // 0 unless --epoch-bits
+    StreamingCpu::EpochCountsCheck epochCounts;
+
+    // ConcurrentMergeEngine on all threads and on one, checked against the
+    // reference buffers every frame
+    bool concurrent;                    // false unless --concurrent
+    StreamingCpu::MergeStats concurrentStats;
+    StreamingCpu::ConcurrentMergeStats concurrentMergeStats;
+    double concurrentSeconds;
+    StreamingCpu::ConcurrentMergeCheck concurrentCheck;
+    StreamingCpu::ConcurrentMergeCheck serialConcurrentCheck;
+
+    // HiZMergeBuffers every frame, with the rejection against without
+    bool hiZ;                           // false unless --hiz
+    StreamingCpu::MergeStats hiZBaseStats;
+    StreamingCpu::MergeStats hiZMergeStats;
+    StreamingCpu::HiZStats hiZStats;
+    StreamingCpu::HiZCheck hiZCheck;
+
+    // PredictedMergeBuffers every frame, with the prediction against without
+    bool nodePrediction;                // false unless --predict
+    StreamingCpu::MergeStats nodePredictionBaseStats;
+    StreamingCpu::MergeStats nodePredictionMergeStats;
+    StreamingCpu::NodeSearchStats nodeSearch;
+    StreamingCpu::NodeSearchStats predictedNodeSearch;
+    StreamingCpu::MergedBuffersCheck nodePredictionCheck;
+
+    // DiscardPolicyComparison every frame
+    bool discardPolicies;               // false unless --discard-policies
+    double discardMinPsnr;
+    StreamingCpu::DiscardPolicyStats discardPolicyStats[StreamingCpu::DISCARD_POLICY_COUNT];
+    StreamingCpu::MergeStats discardReferenceStats;
+    StreamingCpu::DiscardPolicy selectedDiscardPolicy;  // DISCARD_POLICY_COUNT if none reaches the PSNR
+
+    SnapshotRun snapshot;
+    RelightResults relight;
+    LightBinningResults lightBinning;
+    LightClusterResults lightClusters;
+    LightBvhResults lightBvh;
+    LightAnimationResults lightAnimation;
+    UploadRingResults uploadRing;
+    FormatConvertResults formatConvert;
+
+    BenchResults()
+        : lights(0), resolveBlockDim(4), epochBits(0), concurrent(false), concurrentSeconds(0.0), hiZ(false)
+        , nodePrediction(false), discardPolicies(false), discardMinPsnr(0.0)
+        , selectedDiscardPolicy(StreamingCpu::DISCARD_POLICY_COUNT) {}
+};
+
+void PrintReport(FILE* file, const BenchConfig& config, const BenchResults& results);
+
+bool WriteJsonReport(const char* path, const BenchConfig& config, const BenchResults& results);
+
+// Appends one row per run, writing the header first if the file is new.
+bool AppendCsvReport(const char* path, const BenchConfig& config, const BenchResults& results);
+
+#endif // STREAMINGBENCH_BENCHREPORT_H
@@ -0,0 +1,1843 @@
+// Replays fragment streams through the CPU streaming merge and reports
+// throughput, merge counters and final node occupancy, so changes to the
+// merge can be tracked without a GPU. Streams are either synthetic (see
+// FragmentGenerator.h), a fragment trace, or a raw dump of Fragment structs.
+
+#include "BenchReport.h"
+#include "ConcurrentMerge.h"
+#include "DiscardPolicy.h"
+#include "EpochCounts.h"
+#include "FormatConvertSimd.h"
+#include "FragmentGenerator.h"
+#include "FragmentTrace.h"
+#include "GBufferSnapshot.h"
+#include "HiZ.h"
+#include "LightAnimation.h"
+#include "LightBinning.h"
+#include "LightBvh.h"
+#include "LightClusters.h"
+#include "LightCulling.h"
+#include "MappedFile.h"
+#include "MergeAccessTrace.h"
+#include "MergeEngine.h"
+#include "NodePrediction.h"
+#include "Relight.h"
+#include "ResolveCompaction.h"
+#include "ResolveWeights.h"
+#include "Timer.h"
+#include "UploadRing.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace StreamingCpu;
+
+namespace {
+
+struct Options
+{
+    const char* tracePath;
+    const char* writeTracePath;
+    bool writeTraceLz4;
+    const char* snapshotPath;
+    const char* jsonPath;
+    const char* csvPath;
+    const char* label;
+    const char* simd;           // "all" or a GetSimdLevelName() name
+    unsigned surfacesPerPixel;
+    unsigned nodePoolPercent;
+    unsigned threads;
+    unsigned frames;
+    unsigned repeat;
+    unsigned warmup;
+    unsigned lights;
+    unsigned relightLights;
+    unsigned binningLights;
+    unsigned clusterLights;
+    unsigned bvhLights;
+    unsigned animationLights;
+    unsigned epochBits;
+    AddressMapping addressing;
+    bool cacheSim;
+    bool concurrent;
+    bool hiZ;
+    bool predict;
+    bool discardPolicies;
+    double discardMinPsnr;
+    bool formatConvert;
+    unsigned uploadFrames;
+    std::vector<AddressMapping> cacheMappings;  // empty for GetDefaultCacheMappings()
+    CacheSimulatorDesc cache;
+    FragmentGeneratorDesc generator;
+
+    Options()
+        : tracePath(0), writeTracePath(0), writeTraceLz4(false), snapshotPath(0), jsonPath(0), csvPath(0), label("")
+        , simd("all"), surfacesPerPixel(STREAMING_MAX_SURFACES_PER_PIXEL), nodePoolPercent(0)
+        , threads(0), frames(4)
+        , repeat(1), warmup(1), lights(0), relightLights(0), binningLights(0), clusterLights(0)
+        , bvhLights(0), animationLights(0)
+        , epochBits(2), cacheSim(false), concurrent(false)
+        , hiZ(false), predict(false), discardPolicies(false), discardMinPsnr(40.0)
+        , formatConvert(false), uploadFrames(0)
+    {
+    }
+};
+
+// Fans the reference access stream out to one cache model per mapping
+class CacheModels : public MergeAccessSink
+{
+public:
+    ~CacheModels()
+    {
+        for (size_t i = 0; i < mModels.size(); ++i) {
+            delete mModels[i];
+        }
+    }
+
+    void Add(MergeCacheModel* model) { mModels.push_back(model); }
+    size_t GetCount() const { return mModels.size(); }
+    const MergeCacheModel& Get(size_t i) const { return *mModels[i]; }
+
+    void Flush()
+    {
+        for (size_t i = 0; i < mModels.size(); ++i) {
+            mModels[i]->Flush();
+        }
+    }
+
+    virtual void OnAccess(MergeResource resource, unsigned x, unsigned y, unsigned index, bool write)
+    {
+        for (size_t i = 0; i < mModels.size(); ++i) {
+            mModels[i]->OnAccess(resource, x, y, index, write);
+        }
+    }
+
+private:
+    std::vector<MergeCacheModel*> mModels;
+};
+
+// Linear, the shaders' current 1x2 tiles, and 8x8 tiles and Morton blocks
+// (one 64 pixel GPU tile), each node-major and pixel-major
+void GetDefaultCacheMappings(std::vector<AddressMapping>& mappings)
+{
+    const AddressMapping layouts[] = {
+        AddressMapping(STREAMING_ADDRESSING_LINEAR, 0, 0, false),
+        AddressMapping(STREAMING_ADDRESSING_TILED, 0, 1, false),
+        AddressMapping(STREAMING_ADDRESSING_TILED, 3, 3, false),
+        AddressMapping(STREAMING_ADDRESSING_MORTON, 3, 3, false),
+    };
+    for (unsigned i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+        mappings.push_back(layouts[i]);
+        mappings.push_back(layouts[i]);
+        mappings.back().pixelMajor = true;
+    }
+}
+
+// The app's camera: 45 degree vertical field of view, near and far at 0.05 and 300
+ViewConstants GetViewConstants(unsigned width, unsigned height)
+{
+    ViewConstants view;
+    view.proj22 = 1.0f / tanf(0.3926991f);
+    view.proj11 = view.proj22 * (float)height / (float)width;
+    view.nearZ = 0.05f;
+    view.farZ = 300.0f;
+    view.width = width;
+    view.height = height;
+    return view;
+}
+
+// Point lights spread through the view frustum around the synthetic surfaces
+// (zView 1 to 100), with radii that cover a few hundred pixels on average
+float NextFloat(uint32_t& state, float low, float high)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+}
+
+void GenerateLights(const ViewConstants& view, unsigned count, unsigned seed, std::vector<PointLight>& lights)
+{
+    uint32_t state = seed * 2654435761u + 1u;
+    lights.resize(count);
+    for (unsigned i = 0; i < count; ++i) {
+        PointLight& light = lights[i];
+        float z = NextFloat(state, 1.0f, 110.0f);
+        light.positionView[0] = NextFloat(state, -1.1f, 1.1f) * z / view.proj11;
+        light.positionView[1] = NextFloat(state, -1.1f, 1.1f) * z / view.proj22;
+        light.positionView[2] = z;
+        light.attenuationEnd = NextFloat(state, 2.0f, 20.0f);
+        light.attenuationBegin = 0.8f * light.attenuationEnd;
+        float intensity = NextFloat(state, 0.1f, 0.5f);
+        for (int c = 0; c < 3; ++c) {
+            light.color[c] = intensity * NextFloat(state, 0.0f, 1.0f);
+        }
+    }
+}
+
+// Where frames come from
+class FrameSource
+{
+public:
+    FrameSource() : mKind(SOURCE_SYNTHETIC), mWidth(0), mHeight(0), mMsaaSamples(0), mFrameCount(0) {}
+
+    bool Open(const Options& options)
+    {
+        mGenerator = options.generator;
+        if (!options.tracePath) {
+            mKind = SOURCE_SYNTHETIC;
+            mWidth = mGenerator.width;
+            mHeight = mGenerator.height;
+            mMsaaSamples = mGenerator.msaaSamples;
+            mFrameCount = options.frames;
+            return true;
+        }
+
+        if (mTrace.Open(options.tracePath)) {
+            const FragmentTraceHeader& header = mTrace.GetHeader();
+            mKind = SOURCE_TRACE;
+            mWidth = header.width;
+            mHeight = header.height;
+            mMsaaSamples = header.msaaSamples;
+            mFrameCount = mTrace.GetFrameCount();
+            return true;
+        }
+
+        // Anything else has to be a bare Fragment array holding one frame
+        if (!mRaw.Open(options.tracePath) || mRaw.GetSize() % sizeof(Fragment) != 0) {
+            fprintf(stderr, "%s is neither a fragment trace nor a Fragment array\n", options.tracePath);
+            return false;
+        }
+        mKind = SOURCE_RAW;
+        mWidth = 0;
+        mHeight = 0;
+        const Fragment* fragments = (const Fragment*)mRaw.GetData();
+        const size_t count = mRaw.GetSize() / sizeof(Fragment);
+        unsigned coverage = 0;
+        for (size_t i = 0; i < count; ++i) {
+            mWidth = fragments[i].x + 1u > mWidth ? fragments[i].x + 1u : mWidth;
+            mHeight = fragments[i].y + 1u > mHeight ? fragments[i].y + 1u : mHeight;
+            coverage |= fragments[i].coverage;
+        }
+        mMsaaSamples = 1;
+        while (mMsaaSamples < 8 && (coverage >> mMsaaSamples) != 0) {
+            mMsaaSamples *= 2;
+        }
+        mFrameCount = 1;
+        return true;
+    }
+
+    bool IsSynthetic() const { return mKind == SOURCE_SYNTHETIC; }
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    unsigned GetMsaaSamples() const { return mMsaaSamples; }
+    unsigned GetFrameCount() const { return mFrameCount; }
+
+    bool LoadFrame(unsigned frame, std::vector<Fragment>& fragments)
+    {
+        fragments.clear();
+        if (mKind == SOURCE_SYNTHETIC) {
+            return GenerateFragments(mGenerator, frame, fragments);
+        }
+        if (mKind == SOURCE_RAW) {
+            const Fragment* data = (const Fragment*)mRaw.GetData();
+            fragments.assign(data, data + mRaw.GetSize() / sizeof(Fragment));
+            return CheckFragments(fragments);
+        }
+        for (unsigned chunk = mTrace.GetFrameFirstChunk(frame); chunk < mTrace.GetFrameFirstChunk(frame + 1); ++chunk) {
+            const Fragment* data = mTrace.GetChunkFragments(chunk, mScratch);
+            if (!data) {
+                return false;
+            }
+            fragments.insert(fragments.end(), data, data + mTrace.GetChunkHeader(chunk).fragmentCount);
+        }
+        return CheckFragments(fragments);
+    }
+
+private:
+    // The merge indexes its buffers with the fragment coordinates unchecked,
+    // so a trace or dump has to stay inside its resolution and sample count
+    bool CheckFragments(const std::vector<Fragment>& fragments) const
+    {
+        const unsigned sampleMask = mMsaaSamples < 32 ? (1u << mMsaaSamples) - 1 : 0xFFFFFFFF;
+        for (size_t i = 0; i < fragments.size(); ++i) {
+            const Fragment& fragment = fragments[i];
+            if (fragment.x >= mWidth || fragment.y >= mHeight || (fragment.coverage & ~sampleMask) != 0) {
+                fprintf(stderr, "fragment %u at %u,%u with coverage 0x%x is outside %ux%u with %u samples\n",
+                        (unsigned)i, fragment.x, fragment.y, fragment.coverage, mWidth, mHeight, mMsaaSamples);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    enum Kind { SOURCE_SYNTHETIC, SOURCE_TRACE, SOURCE_RAW };
+
+    Kind mKind;
+    FragmentGeneratorDesc mGenerator;
+    FragmentTraceReader mTrace;
+    FragmentTraceScratch mScratch;
+    MappedFile mRaw;
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mMsaaSamples;
+    unsigned mFrameCount;
+};
+
+void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: StreamingBench [options]\n"
+        "  --trace PATH             replay a fragment trace or raw Fragment dump\n"
+        "  --width N --height N     synthetic resolution (1920x1080)\n"
+        "  --msaa N                 synthetic samples per pixel, 1/2/4/8 (4)\n"
+        "  --depth-complexity F     synthetic fragments per pixel (3)\n"
+        "  --triangle-size F        synthetic triangle size in pixels (8)\n"
+        "  --patch-cells N          synthetic surfaces are up to NxN quads (8)\n"
+        "  --normal-jitter F        per-triangle normal jitter in radians (0.1)\n"
+        "  --coverage raster|full|random\n"
+        "  --order random|front-to-back|back-to-front\n"
+        "  --seed N\n"
+        "  --camera-path DX,DY      synthetic frames replay one scene panned by DX,DY\n"
+        "                           pixels per frame instead of a new scene each\n"
+        "  --frames N               synthetic frames (4)\n"
+        "  --surfaces N             surfaces per pixel, 1 to 8 (%u)\n"
+        "  --node-pool N            pooled node storage with blocks for N%% of pixels,\n"
+        "                           0 for fixed planes (0)\n"
+        "  --addressing MAPPING     merge buffer layout: linear, tiled:WxH or morton:WxH,\n"
+        "                           optionally :pixel for pixel-major nodes (%s)\n"
+        "  --simd all|scalar|avx2|avx512\n"
+        "  --threads N              0 for one per hardware thread (0)\n"
+        "  --repeat N               merges per frame (1)\n"
+        "  --warmup N               untimed merges of the first frame (1)\n"
+        "  --lights N               check tiled light culling of the resolve against\n"
+        "                           shading N synthetic lights per node, 0 to skip (0)\n"
+        "  --relight N              relight the last frame with N synthetic lights at\n"
+        "                           every simd level, 0 to skip (0)\n"
+        "  --light-binning N        bin 1K, 4K, ... up to N synthetic lights, filling\n"
+        "                           the volume of 1K, into the tiles of the last frame\n"
+        "                           at 1x, 2x and 4x its resolution with every simd\n"
+        "                           level, 0 to skip (0)\n"
+        "  --light-clusters N       assign 1K, 4K, ... up to N synthetic lights to\n"
+        "                           clusters of several froxel grids over the last\n"
+        "                           frame and compare the lights per surface and the\n"
+        "                           shading with its tiles, 0 to skip (0)\n"
+        "  --light-bvh N            build a light BVH over 1K, 16K, ... up to N\n"
+        "                           synthetic lights, refit it over a second of\n"
+        "                           orbiting and check its tile, cluster and per-node\n"
+        "                           queries against the lists they replace, 0 to\n"
+        "                           skip (0)\n"
+        "  --light-animation N      animate and transform 1K, 16K, ... up to N lights\n"
+        "                           with the app's orbits at every simd level, on one\n"
+        "                           thread and on all, against the AoS loops, 0 to\n"
+        "                           skip (0)\n"
+        "  --upload-ring N          upload N frames of per-frame data through a\n"
+        "                           NO_OVERWRITE ring on a simulated GPU, checking no\n"
+        "                           read sees a later frame's data, 0 to skip (0)\n"
+        "  --epoch-bits N           check epoch tagged node counts against cleared ones,\n"
+        "                           wrapping the epoch every 2^N-1 frames, 0 to skip (2)\n"
+        "  --write-trace PATH       save the replayed frames as a trace\n"
+        "  --lz4                    compress the saved trace\n"
+        "  --snapshot PATH          save the last frame as a g-buffer snapshot and check\n"
+        "                           it reads back (fixed storage only)\n"
+        "  --json PATH              write results as JSON\n"
+        "  --csv PATH               append results to a CSV file\n"
+        "  --label TEXT             tag for the JSON/CSV results\n"
+        "  --concurrent             also merge with threads sharing pixels through a\n"
+        "                           lock-free header word (fixed storage only)\n"
+        "  --hiz                    also merge rejecting fragments behind the occluders\n"
+        "                           of their 8x8 tile (fixed storage only)\n"
+        "  --predict                also merge skipping the nodes last frame's depth\n"
+        "                           ranges place away from the fragment once their depth\n"
+        "                           agrees, which must match the buffers merged without,\n"
+        "                           and count the bytes moved including the summary\n"
+        "                           (fixed storage only, best with --camera-path)\n"
+        "  --discard-policies       also merge with each policy for what a full pixel\n"
+        "                           throws away and compare the resolved albedo with\n"
+        "                           8 surfaces per pixel (fixed storage only)\n"
+        "  --discard-psnr DB        quality bar the cheapest policy is picked at (40)\n"
+        "  --format-convert         check the batch node conversions of every simd level\n"
+        "                           against scalar and time them on the last frame\n"
+        "  --cache-sim              simulate the cache hit rate of merge buffer layouts\n"
+        "  --cache-mapping MAPPING  layout to simulate, repeatable (linear, tiled 1x2,\n"
+        "                           tiled 8x8 and morton 8x8, node- and pixel-major)\n"
+        "  --cache-kb N             cache size (256)\n"
+        "  --cache-line N           line size in bytes (64)\n"
+        "  --cache-ways N           associativity (16)\n"
+        "  --dram-page N            DRAM page size in bytes (4096)\n",
+        STREAMING_MAX_SURFACES_PER_PIXEL, GetAddressMappingName(AddressMapping()).c_str());
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+    FragmentGeneratorDesc& g = options.generator;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : 0;
+
+        if (strcmp(arg, "--lz4") == 0) {
+            options.writeTraceLz4 = true;
+            continue;
+        }
+        if (strcmp(arg, "--cache-sim") == 0) {
+            options.cacheSim = true;
+            continue;
+        }
+        if (strcmp(arg, "--concurrent") == 0) {
+            options.concurrent = true;
+            continue;
+        }
+        if (strcmp(arg, "--hiz") == 0) {
+            options.hiZ = true;
+            continue;
+        }
+        if (strcmp(arg, "--predict") == 0) {
+            options.predict = true;
+            continue;
+        }
+        if (strcmp(arg, "--discard-policies") == 0) {
+            options.discardPolicies = true;
+            continue;
+        }
+        if (strcmp(arg, "--format-convert") == 0) {
+            options.formatConvert = true;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "unknown option or missing value: %s\n", arg);
+            return false;
+        }
+        ++i;
+
+        if (strcmp(arg, "--trace") == 0) options.tracePath = value;
+        else if (strcmp(arg, "--write-trace") == 0) options.writeTracePath = value;
+        else if (strcmp(arg, "--snapshot") == 0) options.snapshotPath = value;
+        else if (strcmp(arg, "--json") == 0) options.jsonPath = value;
+        else if (strcmp(arg, "--csv") == 0) options.csvPath = value;
+        else if (strcmp(arg, "--label") == 0) options.label = value;
+        else if (strcmp(arg, "--simd") == 0) options.simd = value;
+        else if (strcmp(arg, "--surfaces") == 0) options.surfacesPerPixel = atoi(value);
+        else if (strcmp(arg, "--node-pool") == 0) options.nodePoolPercent = atoi(value);
+        else if (strcmp(arg, "--threads") == 0) options.threads = atoi(value);
+        else if (strcmp(arg, "--frames") == 0) options.frames = atoi(value);
+        else if (strcmp(arg, "--repeat") == 0) options.repeat = atoi(value);
+        else if (strcmp(arg, "--warmup") == 0) options.warmup = atoi(value);
+        else if (strcmp(arg, "--lights") == 0) options.lights = atoi(value);
+        else if (strcmp(arg, "--relight") == 0) options.relightLights = atoi(value);
+        else if (strcmp(arg, "--light-binning") == 0) options.binningLights = atoi(value);
+        else if (strcmp(arg, "--light-clusters") == 0) options.clusterLights = atoi(value);
+        else if (strcmp(arg, "--light-bvh") == 0) options.bvhLights = atoi(value);
+        else if (strcmp(arg, "--light-animation") == 0) options.animationLights = atoi(value);
+        else if (strcmp(arg, "--upload-ring") == 0) options.uploadFrames = atoi(value);
+        else if (strcmp(arg, "--epoch-bits") == 0) options.epochBits = atoi(value);
+        else if (strcmp(arg, "--discard-psnr") == 0) options.discardMinPsnr = atof(value);
+        else if (strcmp(arg, "--width") == 0) g.width = atoi(value);
+        else if (strcmp(arg, "--height") == 0) g.height = atoi(value);
+        else if (strcmp(arg, "--msaa") == 0) g.msaaSamples = atoi(value);
+        else if (strcmp(arg, "--depth-complexity") == 0) g.depthComplexity = (float)atof(value);
+        else if (strcmp(arg, "--triangle-size") == 0) g.triangleSize = (float)atof(value);
+        else if (strcmp(arg, "--patch-cells") == 0) g.patchCells = atoi(value);
+        else if (strcmp(arg, "--normal-jitter") == 0) g.normalJitter = (float)atof(value);
+        else if (strcmp(arg, "--seed") == 0) g.seed = atoi(value);
+        else if (strcmp(arg, "--cache-kb") == 0) options.cache.cacheBytes = atoi(value) * 1024;
+        else if (strcmp(arg, "--cache-line") == 0) options.cache.lineBytes = atoi(value);
+        else if (strcmp(arg, "--cache-ways") == 0) options.cache.ways = atoi(value);
+        else if (strcmp(arg, "--dram-page") == 0) options.cache.pageBytes = atoi(value);
+        else if (strcmp(arg, "--addressing") == 0 || strcmp(arg, "--cache-mapping") == 0) {
+            AddressMapping mapping;
+            if (!ParseAddressMapping(value, mapping)) {
+                fprintf(stderr, "unknown address mapping: %s\n", value);
+                return false;
+            }
+            if (strcmp(arg, "--addressing") == 0) {
+                options.addressing = mapping;
+            } else {
+                options.cacheSim = true;
+                options.cacheMappings.push_back(mapping);
+            }
+        } else if (strcmp(arg, "--camera-path") == 0) {
+            if (sscanf(value, "%f,%f", &g.cameraPan[0], &g.cameraPan[1]) != 2) {
+                fprintf(stderr, "--camera-path takes DX,DY: %s\n", value);
+                return false;
+            }
+            g.cameraPath = true;
+        } else if (strcmp(arg, "--coverage") == 0) {
+            if (strcmp(value, "raster") == 0) g.coveragePattern = COVERAGE_PATTERN_RASTER;
+            else if (strcmp(value, "full") == 0) g.coveragePattern = COVERAGE_PATTERN_FULL;
+            else if (strcmp(value, "random") == 0) g.coveragePattern = COVERAGE_PATTERN_RANDOM;
+            else return false;
+        } else if (strcmp(arg, "--order") == 0) {
+            if (strcmp(value, "random") == 0) g.patchOrder = PATCH_ORDER_RANDOM;
+            else if (strcmp(value, "front-to-back") == 0) g.patchOrder = PATCH_ORDER_FRONT_TO_BACK;
+            else if (strcmp(value, "back-to-front") == 0) g.patchOrder = PATCH_ORDER_BACK_TO_FRONT;
+            else return false;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (options.surfacesPerPixel < STREAMING_SURFACES_PER_PIXEL_MIN ||
+        options.surfacesPerPixel > STREAMING_SURFACES_PER_PIXEL_MAX_CPU) {
+        fprintf(stderr, "--surfaces must be in [%u, %u]\n",
+                STREAMING_SURFACES_PER_PIXEL_MIN, STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+        return false;
+    }
+    if (options.nodePoolPercent > 100) {
+        fprintf(stderr, "--node-pool must be in [0, 100]\n");
+        return false;
+    }
+    if (options.epochBits > STREAMING_EPOCH_BITS) {
+        fprintf(stderr, "--epoch-bits must be in [0, %u]\n", STREAMING_EPOCH_BITS);
+        return false;
+    }
+    if (options.concurrent && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--concurrent does not model the node pool\n");
+        return false;
+    }
+    if (options.hiZ && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--hiz does not model the node pool\n");
+        return false;
+    }
+    if (options.predict && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--predict does not model the node pool\n");
+        return false;
+    }
+    if (options.discardPolicies && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--discard-policies does not model the node pool\n");
+        return false;
+    }
+    if (options.snapshotPath && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--snapshot does not read the node pool\n");
+        return false;
+    }
+    if (options.relightLights > 0 && options.nodePoolPercent > 0) {
+        fprintf(stderr, "--relight does not read the node pool\n");
+        return false;
+    }
+    const CacheSimulatorDesc& c = options.cache;
+    if ((c.lineBytes & (c.lineBytes - 1)) != 0 || (c.pageBytes & (c.pageBytes - 1)) != 0 ||
+        c.lineBytes == 0 || c.pageBytes < c.lineBytes || c.ways == 0 || c.cacheBytes < c.lineBytes * c.ways) {
+        fprintf(stderr, "--cache-line and --dram-page must be powers of two, the page no smaller than a line,\n"
+                        "and the cache must hold at least one set\n");
+        return false;
+    }
+    if (options.repeat == 0 || options.frames == 0) {
+        fprintf(stderr, "--repeat and --frames must be at least 1\n");
+        return false;
+    }
+    return true;
+}
+
+// Levels to run, reference (scalar) first
+bool GetSimdLevels(const char* name, std::vector<SimdLevel>& levels)
+{
+    const SimdLevel all[] = { SIMD_LEVEL_SCALAR, SIMD_LEVEL_AVX2, SIMD_LEVEL_AVX512 };
+    for (unsigned i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+        if (all[i] > GetMaxSimdLevel()) {
+            continue;
+        }
+        if (strcmp(name, "all") == 0 || strcmp(name, GetSimdLevelName(all[i])) == 0) {
+            levels.push_back(all[i]);
+        }
+    }
+    if (levels.empty()) {
+        fprintf(stderr, "simd level %s is unknown or not supported (max %s)\n",
+                name, GetSimdLevelName(GetMaxSimdLevel()));
+        return false;
+    }
+    return true;
+}
+
+// Compares what the resolve would read: counts, lists, discard flags and the
+// nodes in use. Unused nodes hold whatever earlier frames left.
+bool BuffersMatch(const MergeBuffers& a, const MergeBuffers& b)
+{
+    if (a.GetCountTexture() != b.GetCountTexture() || a.GetListTexture() != b.GetListTexture()) {
+        return false;
+    }
+    for (unsigned y = 0; y < a.GetHeight(); ++y) {
+        for (unsigned x = 0; x < a.GetWidth(); ++x) {
+            for (unsigned i = 0; i < a.GetNodeCount(x, y); ++i) {
+                const MergeNodePacked& nodeA = a.GetMergeBuffer()[a.GetNodeIndex(x, y, i)];
+                const MergeNodePacked& nodeB = b.GetMergeBuffer()[b.GetNodeIndex(x, y, i)];
+                if (memcmp(&nodeA, &nodeB, sizeof(MergeNodePacked)) != 0) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void AddLayoutError(const MergeBuffers& buffers, LayoutError& layoutError)
+{
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                layoutError.Add(UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]));
+            }
+        }
+    }
+}
+
+// Pixels that took a pool block this frame. With fixed storage these are the
+// pixels a pool would have given one.
+unsigned GetPoolBlocks(const MergeBuffers& buffers)
+{
+    if (buffers.GetStorage() == MERGE_STORAGE_POOLED) {
+        unsigned requested = buffers.GetPoolBlocksRequested();
+        return requested < buffers.GetPoolBlocks() ? requested : buffers.GetPoolBlocks();
+    }
+    unsigned blocks = 0;
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            blocks += buffers.GetNodeCount(x, y) > 1 ? 1 : 0;
+        }
+    }
+    return blocks;
+}
+
+// Pixels of the reference buffers in list order
+class MergeBuffersSnapshotSource : public GBufferSnapshotSource
+{
+public:
+    explicit MergeBuffersSnapshotSource(const MergeBuffers& buffers) : mBuffers(buffers) {}
+
+    unsigned GetPixel(unsigned x, unsigned y, MergeNodePacked* nodes, bool& discardedSamples) const
+    {
+        const unsigned indexBits = mBuffers.GetSurfacesPerPixel() < 4 ? 2 : 3;
+        const unsigned nodeCount = mBuffers.GetNodeCount(x, y);
+        const unsigned nodeList = mBuffers.GetListTexture()[mBuffers.GetNodeCountIndex(x, y)];
+        for (unsigned i = 0; i < nodeCount; ++i) {
+            unsigned index = (nodeList >> (i * indexBits)) & ((1u << indexBits) - 1);
+            nodes[i] = mBuffers.GetMergeBuffer()[mBuffers.GetNodeIndex(x, y, index)];
+        }
+        discardedSamples = mBuffers.GetDiscardedSamples(x, y);
+        return nodeCount;
+    }
+
+private:
+    // Not implemented
+    MergeBuffersSnapshotSource& operator=(const MergeBuffersSnapshotSource&);
+
+    const MergeBuffers& mBuffers;
+};
+
+// Writes the buffers, decodes every tile once for timing and then compares
+// them with the buffers
+bool WriteAndCheckSnapshot(const char* path, const MergeBuffers& buffers, unsigned msaaSamples,
+                           const ViewConstants& view, SnapshotRun& run)
+{
+    GBufferSnapshotDesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.width = buffers.GetWidth();
+    desc.height = buffers.GetHeight();
+    desc.msaaSamples = msaaSamples;
+    desc.surfacesPerPixel = buffers.GetSurfacesPerPixel();
+    desc.compression = GBUFFER_SNAPSHOT_COMPRESSION_LZ4;
+    GBufferSnapshotCamera& camera = desc.camera;
+    camera.worldView[0] = camera.worldView[5] = camera.worldView[10] = camera.worldView[15] = 1.0f;
+    camera.proj[0] = view.proj11;
+    camera.proj[5] = view.proj22;
+    camera.proj[11] = 1.0f;
+    camera.nearFar[0] = view.farZ;
+    camera.nearFar[1] = view.nearZ;
+
+    run.path = path;
+    run.gpuBytes = (uint64_t)buffers.GetCountTexture().size() * sizeof(unsigned) * 2 +
+                   buffers.GetMergeBuffer().size() * sizeof(MergeNodePacked);
+    Timer timer;
+    if (!WriteGBufferSnapshot(path, desc, MergeBuffersSnapshotSource(buffers), &run.stats)) {
+        return false;
+    }
+    run.writeSeconds = timer.GetSeconds();
+
+    GBufferSnapshotReader reader;
+    if (!reader.Open(path)) {
+        return true;
+    }
+    GBufferSnapshotScratch scratch;
+    GBufferSnapshotTile tile;
+    bool readBack = true;
+    timer.Reset();
+    for (unsigned i = 0; i < reader.GetTileCount(); ++i) {
+        readBack = reader.GetTile(i, scratch, tile) && readBack;
+    }
+    run.readSeconds = timer.GetSeconds();
+    if (!readBack) {
+        return true;
+    }
+
+    const MergeBuffersSnapshotSource source(buffers);
+    for (unsigned i = 0; i < reader.GetTileCount(); ++i) {
+        reader.GetTile(i, scratch, tile);
+        for (unsigned y = 0; y < tile.height; ++y) {
+            for (unsigned x = 0; x < tile.width; ++x) {
+                const unsigned p = x + tile.width * y;
+                MergeNodePacked nodes[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+                bool discardedSamples;
+                unsigned nodeCount = source.GetPixel(tile.x + x, tile.y + y, nodes, discardedSamples);
+                bool matches = (tile.pixels[p] & GBUFFER_SNAPSHOT_COUNT_MASK) == nodeCount &&
+                               ((tile.pixels[p] & GBUFFER_SNAPSHOT_DISCARDED) != 0) == discardedSamples &&
+                               (nodeCount == 0 || memcmp(&tile.nodes[tile.firstNodes[p]], nodes,
+                                                         nodeCount * sizeof(MergeNodePacked)) == 0);
+                run.differingPixels += matches ? 0 : 1;
+            }
+        }
+    }
+    run.readBack = true;
+    return true;
+}
+
+// Relights the last frame once per level, scalar first, from the snapshot if
+// one was written and read back, else from the buffers
+void RunRelight(const MergeBuffers& buffers, unsigned msaaSamples, const ViewConstants& view,
+                const char* snapshotPath, unsigned lightCount, unsigned seed, const std::vector<SimdLevel>& levels,
+                ThreadPool* threadPool, RelightResults& results)
+{
+    RelightEngine engine;
+    Timer timer;
+    GBufferSnapshotReader reader;
+    if (snapshotPath && reader.Open(snapshotPath) && engine.Load(reader, threadPool)) {
+        results.source = snapshotPath;
+    } else {
+        engine.Load(MergeBuffersSnapshotSource(buffers), buffers.GetWidth(), buffers.GetHeight(), msaaSamples, view,
+                    threadPool);
+        results.source = "buffers";
+    }
+    results.loadSeconds = timer.GetSeconds();
+    results.lights = lightCount;
+    results.nodes = engine.GetNodeCount();
+
+    std::vector<PointLight> lights;
+    GenerateLights(engine.GetView(), lightCount, seed, lights);
+
+    std::vector<SimdLevel> order(1, SIMD_LEVEL_SCALAR);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i] != SIMD_LEVEL_SCALAR) {
+            order.push_back(levels[i]);
+        }
+    }
+    std::vector<float> reference;
+    for (size_t i = 0; i < order.size(); ++i) {
+        RelightRun run;
+        run.name = GetSimdLevelName(order[i]);
+        engine.Shade(&lights[0], lightCount, order[i], threadPool, run.stats);
+        if (i == 0) {
+            reference = engine.GetOutput();
+        } else {
+            CompareRelight(engine.GetOutput(), reference, run.error);
+        }
+        results.runs.push_back(run);
+    }
+}
+
+// Bounds of the tiles of a frame scale times as wide and high, each taken
+// from the tile of buffers under its center
+void ScaleTileDepthBounds(const std::vector<TileDepthBounds>& bounds, unsigned tilesX, unsigned scale,
+                          const ViewConstants& scaledView, unsigned tileDim, std::vector<TileDepthBounds>& scaled)
+{
+    const unsigned scaledTilesX = (scaledView.width + tileDim - 1) / tileDim;
+    const unsigned scaledTilesY = (scaledView.height + tileDim - 1) / tileDim;
+    scaled.resize(scaledTilesX * scaledTilesY);
+    for (unsigned y = 0; y < scaledTilesY; ++y) {
+        for (unsigned x = 0; x < scaledTilesX; ++x) {
+            const unsigned sourceX = (x * tileDim + tileDim / 2) / scale / tileDim;
+            const unsigned sourceY = (y * tileDim + tileDim / 2) / scale / tileDim;
+            scaled[x + scaledTilesX * y] = bounds[sourceX + tilesX * sourceY];
+        }
+    }
+}
+
+// Bins 1K, 4K, ... up to maxLights lights into the tiles of the last frame
+// at 1x, 2x and 4x its resolution, passes times per level, scalar first, and
+// compares the lists of a spread of tiles with CullTileLights()
+void RunLightBinning(const MergeBuffers& buffers, const ViewConstants& view, unsigned maxLights, unsigned seed,
+                     unsigned passes, const std::vector<SimdLevel>& levels, ThreadPool* threadPool,
+                     LightBinningResults& results)
+{
+    const unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM;
+    std::vector<TileDepthBounds> frameBounds;
+    GetTileDepthBounds(buffers, view, tileDim, frameBounds);
+    const unsigned frameTilesX = (view.width + tileDim - 1) / tileDim;
+    results.maxLights = maxLights;
+
+    std::vector<SimdLevel> order(1, SIMD_LEVEL_SCALAR);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i] != SIMD_LEVEL_SCALAR) {
+            order.push_back(levels[i]);
+        }
+    }
+
+    LightBins bins(tileDim);
+    std::vector<PointLight> lights;
+    std::vector<TileDepthBounds> bounds;
+    std::vector<unsigned> reference;
+    for (unsigned lightCount = maxLights < 1024 ? maxLights : 1024; ; lightCount *= 4) {
+        lightCount = lightCount < maxLights ? lightCount : maxLights;
+        // Radii shrink past 1K lights so all of them fill the same volume
+        GenerateLights(view, lightCount, seed, lights);
+        const float radiusScale = lightCount > 1024 ? (float)pow(1024.0 / lightCount, 1.0 / 3.0) : 1.0f;
+        for (unsigned i = 0; i < lightCount; ++i) {
+            lights[i].attenuationBegin *= radiusScale;
+            lights[i].attenuationEnd *= radiusScale;
+        }
+        for (unsigned scale = 1; scale <= 4; scale *= 2) {
+            ViewConstants scaledView = view;
+            scaledView.width *= scale;
+            scaledView.height *= scale;
+            ScaleTileDepthBounds(frameBounds, frameTilesX, scale, scaledView, tileDim, bounds);
+            const unsigned tilesX = (scaledView.width + tileDim - 1) / tileDim;
+            const unsigned tileCount = (unsigned)bounds.size();
+
+            // About 2^24 reference sphere tests per light count and resolution
+            const uint64_t tests = (uint64_t)tileCount * (lightCount > 0 ? lightCount : 1);
+            const unsigned stride = tests > (1u << 24) ? (unsigned)(tests >> 24) + 1 : 1;
+            std::vector<unsigned> referenceOffsets(1, 0);
+            reference.resize((tileCount + stride - 1) / stride * (size_t)lightCount + 1);
+            Timer timer;
+            for (unsigned tile = 0; tile < tileCount; tile += stride) {
+                const unsigned offset = referenceOffsets.back();
+                const unsigned count = CullTileLights(tile % tilesX, tile / tilesX, tileDim, bounds[tile].minZ,
+                                                      bounds[tile].maxZ, scaledView, lights.empty() ? 0 : &lights[0],
+                                                      lightCount, &reference[offset]);
+                referenceOffsets.push_back(offset + count);
+            }
+            const double referenceSeconds = timer.GetSeconds();
+
+            for (size_t i = 0; i < order.size(); ++i) {
+                LightBinningRun run;
+                run.lights = lightCount;
+                run.width = scaledView.width;
+                run.height = scaledView.height;
+                run.name = GetSimdLevelName(order[i]);
+                run.referenceSeconds = referenceSeconds;
+                for (unsigned pass = 0; pass < passes; ++pass) {
+                    bins.Build(scaledView, &bounds[0], lights.empty() ? 0 : &lights[0], lightCount, order[i],
+                               threadPool, run.stats);
+                }
+                run.listBytes = (bins.GetTileRanges().size() + bins.GetLightIndices().size()) * sizeof(unsigned);
+
+                for (unsigned tile = 0, checked = 0; tile < tileCount; tile += stride, ++checked) {
+                    const unsigned count = referenceOffsets[checked + 1] - referenceOffsets[checked];
+                    const unsigned tileX = tile % tilesX;
+                    const unsigned tileY = tile / tilesX;
+                    const bool matches = bins.GetLightCount(tileX, tileY) == count &&
+                                         (count == 0 || memcmp(bins.GetLights(tileX, tileY),
+                                                               &reference[referenceOffsets[checked]],
+                                                               count * sizeof(unsigned)) == 0);
+                    run.checkedTiles++;
+                    run.mismatchedTiles += matches ? 0 : 1;
+                }
+                results.runs.push_back(run);
+            }
+        }
+        if (lightCount >= maxLights) {
+            break;
+        }
+    }
+}
+
+// Assigns 1K, 4K, ... up to maxLights lights, sized like RunLightBinning's,
+// to the clusters of a few froxel grids passes times with the best of levels,
+// once for every cluster and once for those holding a node of the last frame,
+// and compares them with its tile lists. Shades a spread of rows with both.
+void RunLightClusters(const MergeBuffers& buffers, const ViewConstants& view, unsigned maxLights, unsigned seed,
+                      unsigned passes, const std::vector<SimdLevel>& levels, ThreadPool* threadPool,
+                      LightClusterResults& results)
+{
+    const SimdLevel level = levels.back();
+    results.maxLights = maxLights;
+    results.name = GetSimdLevelName(level);
+
+    const unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM;
+    std::vector<TileDepthBounds> bounds;
+    GetTileDepthBounds(buffers, view, tileDim, bounds);
+    uint64_t frameNodes = 0;
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            frameNodes += buffers.GetNodeCount(x, y);
+        }
+    }
+
+    const unsigned grids[][2] = { { 16, 16 }, { 16, 32 }, { 32, 16 }, { 32, 32 }, { 32, 64 }, { 64, 32 } };
+    LightBins bins(tileDim);
+    std::vector<PointLight> lights;
+    std::vector<unsigned char> occupied;
+    for (unsigned lightCount = maxLights < 1024 ? maxLights : 1024; ; lightCount *= 4) {
+        lightCount = lightCount < maxLights ? lightCount : maxLights;
+        GenerateLights(view, lightCount, seed, lights);
+        const float radiusScale = lightCount > 1024 ? (float)pow(1024.0 / lightCount, 1.0 / 3.0) : 1.0f;
+        for (unsigned i = 0; i < lightCount; ++i) {
+            lights[i].attenuationBegin *= radiusScale;
+            lights[i].attenuationEnd *= radiusScale;
+        }
+        const PointLight* lightData = lights.empty() ? 0 : &lights[0];
+
+        LightBinningStats tiledStats;
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            bins.Build(view, &bounds[0], lightData, lightCount, level, threadPool, tiledStats);
+        }
+
+        // About 2^23 light evaluations of each list per grid
+        const uint64_t tiledEvaluations = tiledStats.tiles ? frameNodes * tiledStats.tileLights / tiledStats.tiles : 0;
+        const unsigned shadeRowStride = tiledEvaluations > (1u << 23) ? (unsigned)(tiledEvaluations >> 23) + 1 : 1;
+
+        for (unsigned g = 0; g < sizeof(grids) / sizeof(grids[0]); ++g) {
+            LightClusterRun run;
+            run.lights = lightCount;
+            run.tileDim = grids[g][0];
+            run.slices = grids[g][1];
+            run.tiledStats = tiledStats;
+            run.tiledListBytes = (bins.GetTileRanges().size() + bins.GetLightIndices().size()) * sizeof(unsigned);
+
+            LightClusters clusters(run.tileDim, run.slices);
+            for (unsigned pass = 0; pass < passes; ++pass) {
+                clusters.Build(view, lightData, lightCount, 0, level, threadPool, run.stats);
+            }
+            run.listBytes = (clusters.GetClusterRanges().size() + clusters.GetLightIndices().size()) * sizeof(unsigned);
+
+            GetOccupiedClusters(buffers, view, run.tileDim, run.slices, occupied);
+            for (unsigned pass = 0; pass < passes; ++pass) {
+                clusters.Build(view, lightData, lightCount, &occupied[0], level, threadPool, run.occupiedStats);
+            }
+            run.occupiedListBytes =
+                (clusters.GetClusterRanges().size() + clusters.GetLightIndices().size()) * sizeof(unsigned);
+
+            CompareClusteredShading(buffers, view, lightData, bins, clusters, shadeRowStride, threadPool, run.shading);
+            results.runs.push_back(run);
+        }
+        if (lightCount >= maxLights) {
+            break;
+        }
+    }
+}
+
+// Turns each light of base about the vertical axis through the middle of
+// GenerateLights()'s volume at its own speed, like App::Move()
+void MoveLights(const std::vector<PointLight>& base, const std::vector<float>& speeds, float time,
+                std::vector<PointLight>& lights)
+{
+    const float centerZ = 55.5f;
+    lights = base;
+    for (size_t i = 0; i < base.size(); ++i) {
+        const float angle = speeds[i] * time;
+        const float c = cosf(angle);
+        const float s = sinf(angle);
+        const float x = base[i].positionView[0];
+        const float z = base[i].positionView[2] - centerZ;
+        lights[i].positionView[0] = c * x - s * z;
+        lights[i].positionView[2] = centerZ + s * x + c * z;
+    }
+}
+
+// Builds a LightBvh over 1K, 16K, ... up to maxLights lights, sized like
+// RunLightBinning's, passes times, updates it over 60 frames of the lights
+// orbiting and queries it for the tile lists of the last frame, the clusters
+// of the app's grid and a spread of rows of nodes. Each query is compared
+// with the lists of LightBins and LightClusters or, for nodes, with shading
+// the node with its tile's list.
+void RunLightBvh(const MergeBuffers& buffers, const ViewConstants& view, unsigned maxLights, unsigned seed,
+                 unsigned passes, SimdLevel level, ThreadPool* threadPool, LightBvhResults& results)
+{
+    const unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM;
+    const unsigned tilesX = (view.width + tileDim - 1) / tileDim;
+    const unsigned tileCount = tilesX * ((view.height + tileDim - 1) / tileDim);
+    const unsigned refitFrames = 60;
+    const unsigned threadCount = threadPool->GetThreadCount();
+    std::vector<TileDepthBounds> bounds;
+    GetTileDepthBounds(buffers, view, tileDim, bounds);
+    uint64_t frameNodes = 0;
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            frameNodes += buffers.GetNodeCount(x, y);
+        }
+    }
+    results.maxLights = maxLights;
+
+    LightBvh bvh;
+    LightBvh rebuilt;
+    LightBins bins(tileDim);
+    LightClusters clusters;
+    std::vector<PointLight> base;
+    std::vector<PointLight> lights;
+    std::vector<float> speeds;
+    std::vector<std::vector<unsigned> > threadLists(threadCount);
+    for (unsigned lightCount = maxLights < 1024 ? maxLights : 1024; ; lightCount *= 16) {
+        lightCount = lightCount < maxLights ? lightCount : maxLights;
+        GenerateLights(view, lightCount, seed, base);
+        const float radiusScale = lightCount > 1024 ? (float)pow(1024.0 / lightCount, 1.0 / 3.0) : 1.0f;
+        uint32_t state = seed * 2246822519u + 1u;
+        speeds.resize(lightCount);
+        for (unsigned i = 0; i < lightCount; ++i) {
+            base[i].attenuationBegin *= radiusScale;
+            base[i].attenuationEnd *= radiusScale;
+            speeds[i] = NextFloat(state, -0.5f, 0.5f);
+        }
+
+        LightBvhRun run;
+        run.lights = lightCount;
+        run.refitFrames = refitFrames;
+        const PointLight* lightData = base.empty() ? 0 : &base[0];
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            bvh.Build(lightData, lightCount, threadPool, run.stats);
+        }
+        run.builtSahCost = bvh.GetSahCost();
+        for (unsigned frame = 1; frame <= refitFrames; ++frame) {
+            MoveLights(base, speeds, frame / 60.0f, lights);
+            lightData = lights.empty() ? 0 : &lights[0];
+            bvh.Update(lightData, lightCount, threadPool, run.stats);
+        }
+        run.refitSahCost = bvh.GetSahCost();
+        LightBvhStats rebuiltStats;
+        rebuilt.Build(lightData, lightCount, threadPool, rebuiltStats);
+        run.rebuiltSahCost = rebuilt.GetSahCost();
+
+        // Tile lists
+        LightBinningStats binningStats;
+        bins.Build(view, &bounds[0], lightData, lightCount, level, threadPool, binningStats);
+        run.binsSeconds = binningStats.GetSeconds();
+        std::vector<LightBvhQueryStats> queryStats(threadCount);
+        std::vector<uint64_t> mismatches(threadCount, 0);
+        Timer timer;
+        threadPool->ParallelFor(tileCount, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+            std::vector<unsigned>& list = threadLists[threadIndex];
+            for (unsigned tile = begin; tile < end; ++tile) {
+                const unsigned tileX = tile % tilesX;
+                const unsigned tileY = tile / tilesX;
+                float planes[6][4];
+                GetTileFrustumPlanes(tileX, tileY, tileDim, bounds[tile].minZ, bounds[tile].maxZ, view, planes);
+                bvh.QueryPlanes(planes, 6, list, queryStats[threadIndex]);
+                const unsigned count = bins.GetLightCount(tileX, tileY);
+                mismatches[threadIndex] += list.size() == count &&
+                    (count == 0 || memcmp(&list[0], bins.GetLights(tileX, tileY), count * sizeof(unsigned)) == 0) ? 0 : 1;
+            }
+        });
+        run.tileSeconds = timer.GetSeconds();
+        for (unsigned i = 0; i < threadCount; ++i) {
+            run.tileQueries.Add(queryStats[i]);
+            run.mismatchedTiles += mismatches[i];
+            queryStats[i] = LightBvhQueryStats();
+            mismatches[i] = 0;
+        }
+
+        // Cluster lists of the app's grid
+        LightClusterStats clusterStats;
+        clusters.Build(view, lightData, lightCount, 0, level, threadPool, clusterStats);
+        run.clustersSeconds = clusterStats.GetSeconds();
+        const unsigned clusterTiles = clusters.GetTilesX() * clusters.GetTilesY();
+        timer.Reset();
+        threadPool->ParallelFor(clusters.GetClusterCount(), 16, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+            std::vector<unsigned>& list = threadLists[threadIndex];
+            for (unsigned cluster = begin; cluster < end; ++cluster) {
+                const unsigned tile = cluster % clusterTiles;
+                float minZ, maxZ;
+                GetClusterDepthBounds(cluster / clusterTiles, clusters.GetSlices(), view, minZ, maxZ);
+                float planes[6][4];
+                GetTileFrustumPlanes(tile % clusters.GetTilesX(), tile / clusters.GetTilesX(), clusters.GetTileDim(),
+                                     minZ, maxZ, view, planes);
+                bvh.QueryPlanes(planes, 6, list, queryStats[threadIndex]);
+                const unsigned count = clusters.GetLightCount(cluster);
+                mismatches[threadIndex] += list.size() == count &&
+                    (count == 0 || memcmp(&list[0], clusters.GetLights(cluster), count * sizeof(unsigned)) == 0) ? 0 : 1;
+            }
+        });
+        run.clusterSeconds = timer.GetSeconds();
+        for (unsigned i = 0; i < threadCount; ++i) {
+            run.clusterQueries.Add(queryStats[i]);
+            run.mismatchedClusters += mismatches[i];
+            queryStats[i] = LightBvhQueryStats();
+            mismatches[i] = 0;
+        }
+
+        // Nodes of every shadeRowStride-th row, about 2^23 tile list light evaluations
+        const uint64_t tiledEvaluations = frameNodes * binningStats.tileLights / (tileCount ? tileCount : 1);
+        const unsigned shadeRowStride = tiledEvaluations > (1u << 23) ? (unsigned)(tiledEvaluations >> 23) + 1 : 1;
+        const unsigned shadeRows = (buffers.GetHeight() + shadeRowStride - 1) / shadeRowStride;
+        std::vector<LightBvhRun> threadRuns(threadCount);
+        std::vector<float> tiledLit((size_t)buffers.GetWidth() * buffers.GetHeight() *
+                                    buffers.GetSurfacesPerPixel() * 3);
+        for (int pointLists = 0; pointLists < 2; ++pointLists) {
+            timer.Reset();
+            threadPool->ParallelFor(shadeRows, 1, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+                std::vector<unsigned>& list = threadLists[threadIndex];
+                LightBvhRun& local = threadRuns[threadIndex];
+                for (unsigned row = begin; row < end; ++row) {
+                    const unsigned y = row * shadeRowStride;
+                    for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+                        for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                            const MergeNode merge =
+                                UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]);
+                            if (!(merge.zView < view.farZ)) {
+                                continue;
+                            }
+                            const SurfaceData surface = ComputeSurfaceData(x, y, merge, view);
+                            const unsigned* nodeLights = bins.GetLights(x / tileDim, y / tileDim);
+                            unsigned count = bins.GetLightCount(x / tileDim, y / tileDim);
+                            if (pointLists) {
+                                bvh.QueryPoint(surface.positionView, list, local.pointQueries);
+                                nodeLights = list.empty() ? 0 : &list[0];
+                                count = (unsigned)list.size();
+                            }
+                            float lit[3] = { 0.0f, 0.0f, 0.0f };
+                            for (unsigned l = 0; l < count; ++l) {
+                                AccumulateBRDF(surface, lightData[nodeLights[l]], lit);
+                            }
+                            float* tiled = &tiledLit[((size_t)buffers.GetNodeCountIndex(x, y) *
+                                                      buffers.GetSurfacesPerPixel() + i) * 3];
+                            if (pointLists) {
+                                local.mismatchedNodes += memcmp(lit, tiled, sizeof(lit)) != 0 ? 1 : 0;
+                            } else {
+                                memcpy(tiled, lit, sizeof(lit));
+                                local.shadedNodes++;
+                                local.tiledLights += count;
+                            }
+                        }
+                    }
+                }
+            });
+            if (pointLists) {
+                run.pointSeconds = timer.GetSeconds();
+            } else {
+                run.tiledShadeSeconds = timer.GetSeconds();
+            }
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            run.pointQueries.Add(threadRuns[i].pointQueries);
+            run.shadedNodes += threadRuns[i].shadedNodes;
+            run.tiledLights += threadRuns[i].tiledLights;
+            run.mismatchedNodes += threadRuns[i].mismatchedNodes;
+        }
+        results.runs.push_back(run);
+        if (lightCount >= maxLights) {
+            break;
+        }
+    }
+}
+
+// App::Move() and SetupLights() before LightStore: cosf() and sinf() into an
+// array of world positions, D3DXVec3TransformCoordArray() into the light
+// parameters and a copy of those into the mapped buffer
+struct AosLightOrbit
+{
+    float radius;
+    float angle;
+    float height;
+    float animationSpeed;
+};
+
+void AnimateAosLights(const std::vector<AosLightOrbit>& orbits, const LightAnimationFrame& frame,
+                      std::vector<float>& world, std::vector<PointLight>& parameters, PointLight* destination)
+{
+    const size_t count = orbits.size();
+    for (size_t i = 0; i < count; ++i) {
+        const float angle = orbits[i].angle + frame.time * orbits[i].animationSpeed;
+        world[i * 3 + 0] = orbits[i].radius * cosf(angle);
+        world[i * 3 + 1] = orbits[i].height;
+        world[i * 3 + 2] = orbits[i].radius * sinf(angle);
+    }
+    const float (*m)[4] = frame.worldToView;
+    for (size_t i = 0; i < count; ++i) {
+        const float* p = &world[i * 3];
+        const float w = p[0] * m[0][3] + p[1] * m[1][3] + p[2] * m[2][3] + m[3][3];
+        for (int j = 0; j < 3; ++j) {
+            parameters[i].positionView[j] = (p[0] * m[0][j] + p[1] * m[1][j] + p[2] * m[2][j] + m[3][j]) / w;
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        destination[i] = parameters[i];
+    }
+}
+
+// Animates 1K, 16K, 256K, ... up to maxLights lights with the orbits of
+// App::InitializeLightParameters() for passes * 16 frames, with the
+// LightStore of every level, scalar first, on one thread and on threadPool,
+// and with the AoS loops it replaced. Every level's last frame is compared
+// with scalar's bit for bit and with the AoS one's positions.
+void RunLightAnimation(unsigned maxLights, unsigned seed, unsigned passes, const std::vector<SimdLevel>& levels,
+                       ThreadPool* threadPool, LightAnimationResults& results)
+{
+    const unsigned frames = passes * 16;
+    results.maxLights = maxLights;
+
+    std::vector<SimdLevel> order(1, SIMD_LEVEL_SCALAR);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i] != SIMD_LEVEL_SCALAR) {
+            order.push_back(levels[i]);
+        }
+    }
+
+    // A camera above the lights looking down into them, a minute in
+    LightAnimationFrame frame;
+    frame.time = 60.0f;
+    {
+        const float yaw = 0.6f;
+        const float pitch = -0.35f;
+        const float eye[3] = { -40.0f, 25.0f, -90.0f };
+        const float axes[3][3] = {
+            { cosf(yaw), 0.0f, -sinf(yaw) },
+            { sinf(yaw) * sinf(pitch), cosf(pitch), cosf(yaw) * sinf(pitch) },
+            { sinf(yaw) * cosf(pitch), -sinf(pitch), cosf(yaw) * cosf(pitch) }
+        };
+        for (int j = 0; j < 3; ++j) {
+            for (int i = 0; i < 3; ++i) {
+                frame.worldToView[i][j] = axes[j][i];
+            }
+            frame.worldToView[3][j] = -(eye[0] * axes[j][0] + eye[1] * axes[j][1] + eye[2] * axes[j][2]);
+            frame.worldToView[j][3] = 0.0f;
+        }
+        frame.worldToView[3][3] = 1.0f;
+    }
+
+    ThreadPool singleThread(1);
+    LightStore store;
+    std::vector<AosLightOrbit> orbits;
+    std::vector<float> world;
+    std::vector<PointLight> parameters;
+    std::vector<PointLight> aos;
+    std::vector<PointLight> scalar;
+    std::vector<PointLight> mapped;
+    for (unsigned lightCount = maxLights < 1024 ? maxLights : 1024; ; lightCount *= 16) {
+        lightCount = lightCount < maxLights ? lightCount : maxLights;
+        uint32_t state = seed * 2654435761u + 1u;
+        store.Resize(lightCount);
+        orbits.resize(lightCount);
+        parameters.resize(lightCount);
+        for (unsigned i = 0; i < lightCount; ++i) {
+            AosLightOrbit& orbit = orbits[i];
+            orbit.radius = sqrtf(NextFloat(state, 0.0f, 1.0f)) * 100.0f + 1e-3f;
+            orbit.angle = NextFloat(state, 0.0f, 6.2831853f);
+            orbit.height = NextFloat(state, 0.0f, 20.0f);
+            orbit.animationSpeed = (NextFloat(state, 0.0f, 1.0f) < 0.5f ? -1.0f : 1.0f) *
+                                   NextFloat(state, 2.0f, 20.0f) / orbit.radius;
+            PointLight& light = parameters[i];
+            const float intensity = NextFloat(state, 0.1f, 0.5f);
+            for (int c = 0; c < 3; ++c) {
+                light.color[c] = intensity * NextFloat(state, 0.0f, 1.0f);
+            }
+            light.attenuationEnd = NextFloat(state, 2.0f, 150.0f);
+            light.attenuationBegin = 0.8f * light.attenuationEnd;
+            store.SetLight(i, orbit.radius, orbit.angle, orbit.height, orbit.animationSpeed, light);
+        }
+        world.resize((size_t)lightCount * 3);
+        aos.resize(lightCount);
+        scalar.resize(lightCount);
+        mapped.resize(lightCount);
+
+        LightAnimationFrame frameAt = frame;
+        LightAnimationRun aosRun;
+        aosRun.lights = lightCount;
+        aosRun.name = "aos";
+        aosRun.threads = 1;
+        aosRun.frames = frames;
+        Timer timer;
+        for (unsigned f = 0; f < frames; ++f) {
+            frameAt.time = frame.time + f / 60.0f;
+            AnimateAosLights(orbits, frameAt, world, parameters, mapped.empty() ? 0 : &mapped[0]);
+        }
+        aosRun.seconds = timer.GetSeconds();
+        aos = mapped;
+        results.runs.push_back(aosRun);
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (int pooled = 0; pooled < 2; ++pooled) {
+                ThreadPool* pool = pooled ? threadPool : &singleThread;
+                if (pooled && threadPool->GetThreadCount() == 1) {
+                    continue;
+                }
+                LightAnimationRun run;
+                run.lights = lightCount;
+                run.name = GetSimdLevelName(order[i]);
+                run.threads = pool->GetThreadCount();
+                run.frames = frames;
+                mapped.assign(lightCount, PointLight());
+                timer.Reset();
+                for (unsigned f = 0; f < frames; ++f) {
+                    frameAt.time = frame.time + f / 60.0f;
+                    store.Animate(frameAt, lightCount, mapped.empty() ? 0 : &mapped[0], order[i], pool);
+                }
+                run.seconds = timer.GetSeconds();
+
+                if (i == 0 && pooled == 0) {
+                    scalar = mapped;
+                }
+                for (unsigned l = 0; l < lightCount; ++l) {
+                    run.differingLights += memcmp(&mapped[l], &scalar[l], sizeof(PointLight)) != 0 ? 1 : 0;
+                    for (int j = 0; j < 3; ++j) {
+                        const double error = fabs((double)mapped[l].positionView[j] - aos[l].positionView[j]);
+                        run.maxError = error > run.maxError ? error : run.maxError;
+                    }
+                }
+                results.runs.push_back(run);
+            }
+        }
+        if (lightCount >= maxLights) {
+            break;
+        }
+    }
+}
+
+// Reports every signaled fence finished at once, so the ring reuses bytes
+// the GPU may still read. The reads it corrupts show the check works.
+class UnfencedUploadBackend : public CpuUploadBackend
+{
+public:
+    UnfencedUploadBackend(unsigned capacity, unsigned latencyFrames)
+        : CpuUploadBackend(capacity, latencyFrames), mSignaledFence(0) {}
+
+    virtual void SignalFence(uint64_t fence)
+    {
+        CpuUploadBackend::SignalFence(fence);
+        mSignaledFence = fence;
+    }
+    virtual uint64_t GetCompletedFence() { return mSignaledFence; }
+    virtual void WaitForFence(uint64_t) {}
+
+private:
+    uint64_t mSignaledFence;
+};
+
+// Uploads frames of the app's per-frame data through an UploadRing on a
+// CpuUploadBackend, for 1 to 3 frames in flight and a GPU 0 to 3 frames
+// behind, with a ring holding that many frames and with one holding a single
+// frame, which has to wait for room. Every allocation is filled and read
+// back by the backend when its frame finishes. One last run leaves out the
+// fences and has to corrupt reads. Each run is timed again without filling
+// or reading, for the cost of the ring alone.
+void RunUploadRing(unsigned frames, unsigned seed, UploadRingResults& results)
+{
+    // Lights, per-frame constants, cluster ranges and up to 128K cluster light indices
+    enum { kAllocations = 4 };
+    const unsigned sizes[kAllocations] = { 1024 * 32, 256, 8160 * 8, 1 << 19 };
+    const unsigned alignments[kAllocations] = { 32, 256, 4, 4 };
+    unsigned frameBytes = 0;
+    unsigned slack = 0;
+    for (unsigned i = 0; i < kAllocations; ++i) {
+        frameBytes += sizes[i];
+        slack += alignments[i];
+    }
+    // Alignment, and padding to the end of the ring at most once a frame
+    const unsigned frameCapacity = frameBytes + slack + sizes[kAllocations - 1];
+    results.frames = frames;
+    results.frameBytes = frameBytes;
+
+    for (unsigned config = 0; config <= 3 * 4 * 2; ++config) {
+        const bool unfenced = config == 3 * 4 * 2;
+        UploadRingRun run;
+        run.framesInFlight = unfenced ? 3 : 1 + config / 8;
+        run.latencyFrames = unfenced ? 3 : config / 2 % 4;
+        run.capacity = frameCapacity * (config % 2 == 0 && !unfenced ? run.framesInFlight : 1);
+        run.unfenced = unfenced;
+
+        for (int timed = 0; timed < 2; ++timed) {
+            CpuUploadBackend* backend = unfenced ? new UnfencedUploadBackend(run.capacity, run.latencyFrames) :
+                                                   new CpuUploadBackend(run.capacity, run.latencyFrames);
+            UploadRing ring(backend, run.framesInFlight);
+            uint32_t state = seed * 2246822519u + 1u;
+            unsigned offsets[kAllocations];
+            unsigned allocated[kAllocations];
+            Timer timer;
+            for (unsigned frame = 0; frame < frames; ++frame) {
+                ring.BeginFrame();
+                for (unsigned i = 0; i < kAllocations; ++i) {
+                    allocated[i] = i == kAllocations - 1 ? (unsigned)NextFloat(state, 0.0f, (float)sizes[i]) & ~3u :
+                                                           sizes[i];
+                    unsigned char* data = ring.Allocate(allocated[i], alignments[i], offsets[i]);
+                    if (data && !timed) {
+                        memset(data, (unsigned char)(frame * kAllocations + i), allocated[i]);
+                    }
+                    allocated[i] = data ? allocated[i] : 0;
+                }
+                ring.Unmap();
+                for (unsigned i = 0; i < kAllocations && !timed; ++i) {
+                    if (allocated[i] > 0) {
+                        backend->Read(offsets[i], allocated[i]);
+                    }
+                }
+                ring.EndFrame();
+            }
+            if (timed) {
+                run.seconds = timer.GetSeconds();
+            } else {
+                // Finish every frame, checking their reads
+                backend->WaitForFence(ring.GetFence() - 1);
+                run.ring = ring.GetStats();
+                run.gpu = backend->GetStats();
+            }
+            delete backend;
+        }
+        results.runs.push_back(run);
+    }
+}
+
+// Unpacks and repacks every node of the merge buffer passes times per
+// level, scalar first, and compares the results with scalar's
+void RunFormatConvert(const MergeBuffers& buffers, unsigned passes, const std::vector<SimdLevel>& levels,
+                      FormatConvertResults& results)
+{
+    const std::vector<MergeNodePacked>& packed = buffers.GetMergeBuffer();
+    results.nodes = packed.size();
+    results.passes = passes;
+
+    std::vector<SimdLevel> order(1, SIMD_LEVEL_SCALAR);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        if (levels[i] != SIMD_LEVEL_SCALAR) {
+            order.push_back(levels[i]);
+        }
+    }
+    std::vector<MergeNode> reference(packed.size());
+    std::vector<MergeNodePacked> referencePacked(packed.size());
+    std::vector<MergeNode> nodes(packed.size());
+    std::vector<MergeNodePacked> repacked(packed.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const FormatConvertFunctions& functions = GetFormatConvertFunctions(order[i]);
+        FormatConvertRun run;
+        run.name = GetSimdLevelName(order[i]);
+
+        // One pass untimed, so no level pays for touching the arrays first
+        functions.unpackMergeNodes(&packed[0], packed.size(), &nodes[0]);
+        functions.packMergeNodes(&nodes[0], nodes.size(), &repacked[0]);
+
+        Timer timer;
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            functions.unpackMergeNodes(&packed[0], packed.size(), &nodes[0]);
+        }
+        run.unpackSeconds = timer.GetSeconds();
+        timer.Reset();
+        for (unsigned pass = 0; pass < passes; ++pass) {
+            functions.packMergeNodes(&nodes[0], nodes.size(), &repacked[0]);
+        }
+        run.packSeconds = timer.GetSeconds();
+
+        if (i == 0) {
+            reference = nodes;
+            referencePacked = repacked;
+        } else {
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                const bool differs = memcmp(&nodes[n], &reference[n], sizeof(MergeNode)) != 0 ||
+                                     memcmp(&repacked[n], &referencePacked[n], sizeof(MergeNodePacked)) != 0;
+                run.differingNodes += differs ? 1 : 0;
+            }
+            CheckFormatConvert(order[i], run.check);
+        }
+        results.runs.push_back(run);
+    }
+}
+
+void AddOccupancy(const MergeBuffers& buffers, BenchRun& run)
+{
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            run.occupancy[buffers.GetNodeCount(x, y)]++;
+            run.discardedPixels += buffers.GetDiscardedSamples(x, y) ? 1 : 0;
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<SimdLevel> levels;
+    if (!GetSimdLevels(options.simd, levels)) {
+        return 1;
+    }
+
+    FrameSource source;
+    if (!source.Open(options)) {
+        return 1;
+    }
+    if (source.GetFrameCount() == 0 || source.GetWidth() == 0 || source.GetHeight() == 0) {
+        fprintf(stderr, "nothing to replay\n");
+        return 1;
+    }
+
+    FragmentTraceWriter traceWriter;
+    if (options.writeTracePath &&
+        !traceWriter.Open(options.writeTracePath, source.GetWidth(), source.GetHeight(), source.GetMsaaSamples(),
+                          options.writeTraceLz4 ? FRAGMENT_TRACE_COMPRESSION_LZ4 : FRAGMENT_TRACE_COMPRESSION_NONE)) {
+        fprintf(stderr, "could not create %s\n", options.writeTracePath);
+        return 1;
+    }
+
+    ThreadPool threadPool(options.threads);
+    std::vector<MergeEngine*> engines;
+    BenchResults results;
+    std::vector<BenchRun>& runs = results.runs;
+    runs.resize(levels.size());
+    const MergeStorage storage = options.nodePoolPercent > 0 ? MERGE_STORAGE_POOLED : MERGE_STORAGE_FIXED;
+    const unsigned poolBlocks = (unsigned)((uint64_t)source.GetWidth() * source.GetHeight() *
+                                           options.nodePoolPercent / 100);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        engines.push_back(new MergeEngine(source.GetWidth(), source.GetHeight(), &threadPool,
+                                          options.surfacesPerPixel, 32, 32, storage, poolBlocks,
+                                          options.addressing));
+        engines[i]->SetSimdLevel(levels[i]);
+        runs[i].name = GetSimdLevelName(levels[i]);
+        runs[i].occupancy.assign(options.surfacesPerPixel + 1, 0);
+        runs[i].discardedPixels = 0;
+        runs[i].matchesReference = true;
+    }
+
+    // The access stream only depends on the fragments, so one trace feeds
+    // every mapping
+    MergeBuffers* traceBuffers = 0;
+    CacheModels cacheModels;
+    MergeStats traceStats;
+    if (options.cacheSim) {
+        if (options.cacheMappings.empty()) {
+            GetDefaultCacheMappings(options.cacheMappings);
+        }
+        traceBuffers = new MergeBuffers(source.GetWidth(), source.GetHeight(), options.surfacesPerPixel);
+        for (size_t i = 0; i < options.cacheMappings.size(); ++i) {
+            cacheModels.Add(new MergeCacheModel(source.GetWidth(), source.GetHeight(), options.surfacesPerPixel,
+                                                options.cacheMappings[i], options.cache));
+        }
+    }
+
+    // Tiled light culling runs on the reference buffers after each frame
+    const ViewConstants view = GetViewConstants(source.GetWidth(), source.GetHeight());
+    std::vector<PointLight> lights;
+    TileLightLists* tileLightLists = 0;
+    if (options.lights > 0) {
+        GenerateLights(view, options.lights, options.generator.seed, lights);
+        tileLightLists = new TileLightLists(source.GetWidth(), source.GetHeight(), options.lights);
+    }
+    results.lights = options.lights;
+    ComplexPixelList complexPixels;
+
+    // Lock-free merge against the tile owner runs. On one thread it must
+    // match them exactly, on all threads pixels may differ by merge order.
+    ThreadPool serialPool(1);
+    ConcurrentMergeEngine* concurrentEngine = 0;
+    ConcurrentMergeEngine* serialEngine = 0;
+    if (options.concurrent) {
+        concurrentEngine = new ConcurrentMergeEngine(source.GetWidth(), source.GetHeight(), &threadPool,
+                                                     options.surfacesPerPixel);
+        serialEngine = new ConcurrentMergeEngine(source.GetWidth(), source.GetHeight(), &serialPool,
+                                                 options.surfacesPerPixel);
+    }
+    results.concurrent = options.concurrent;
+
+    // Never cleared but when the epoch wraps, see STREAMING_EPOCH_COUNTS
+    EpochMergeBuffers* epochBuffers = 0;
+    MergeStats epochStats;
+    if (options.epochBits > 0) {
+        epochBuffers = new EpochMergeBuffers(source.GetWidth(), source.GetHeight(), options.epochBits,
+                                             options.surfacesPerPixel);
+    }
+    results.epochBits = options.epochBits;
+
+    // Report only: rejecting a fragment the merge would have averaged into a
+    // hidden node legitimately changes the buffers
+    HiZMergeBuffers* hiZBuffers = 0;
+    if (options.hiZ) {
+        hiZBuffers = new HiZMergeBuffers(source.GetWidth(), source.GetHeight(), source.GetMsaaSamples(),
+                                         options.surfacesPerPixel);
+    }
+    results.hiZ = options.hiZ;
+
+    PredictedMergeBuffers* predictedBuffers = 0;
+    if (options.predict) {
+        predictedBuffers = new PredictedMergeBuffers(source.GetWidth(), source.GetHeight(),
+                                                     options.surfacesPerPixel);
+    }
+    results.nodePrediction = options.predict;
+
+    DiscardPolicyComparison* discardPolicies = 0;
+    if (options.discardPolicies) {
+        discardPolicies = new DiscardPolicyComparison(source.GetWidth(), source.GetHeight(),
+                                                      options.surfacesPerPixel, source.GetMsaaSamples());
+    }
+    results.discardPolicies = options.discardPolicies;
+    results.discardMinPsnr = options.discardMinPsnr;
+
+    std::vector<Fragment> fragments;
+    bool ok = true;
+    for (unsigned frame = 0; frame < source.GetFrameCount() && ok; ++frame) {
+        if (!source.LoadFrame(frame, fragments)) {
+            fprintf(stderr, "could not load frame %u\n", frame);
+            ok = false;
+            break;
+        }
+        if (traceWriter.IsOpen()) {
+            traceWriter.Write(fragments.empty() ? 0 : &fragments[0], fragments.size());
+            traceWriter.EndFrame();
+        }
+        if (fragments.empty()) {
+            continue;
+        }
+
+        if (frame == 0) {
+            for (size_t e = 0; e < engines.size(); ++e) {
+                for (unsigned i = 0; i < options.warmup; ++i) {
+                    engines[e]->Clear();
+                    engines[e]->Merge(&fragments[0], fragments.size());
+                }
+                engines[e]->ResetStats();
+            }
+        }
+
+        // Engines take turns so they all see the same cache state
+        for (unsigned i = 0; i < options.repeat; ++i) {
+            for (size_t e = 0; e < engines.size(); ++e) {
+                engines[e]->Clear();
+                engines[e]->Merge(&fragments[0], fragments.size());
+            }
+        }
+
+        for (size_t e = 0; e < engines.size(); ++e) {
+            AddOccupancy(engines[e]->GetBuffers(), runs[e]);
+            if (e > 0 && !BuffersMatch(engines[0]->GetBuffers(), engines[e]->GetBuffers())) {
+                runs[e].matchesReference = false;
+            }
+        }
+        AddLayoutError(engines[0]->GetBuffers(), results.layoutError);
+        const MergeBuffers& reference = engines[0]->GetBuffers();
+        results.nodePool.AddFrame(GetPoolBlocks(reference),
+                                  reference.GetPoolBlocksRequested() > reference.GetPoolBlocks());
+
+        ResolveCompactionStats frameCompaction;
+        GatherResolveCompaction(reference, results.resolveBlockDim, complexPixels, &threadPool, frameCompaction);
+        results.resolveCompaction.Add(frameCompaction);
+        results.complexFractions.push_back(frameCompaction.GetComplexFraction());
+        CompareResolveWeights(reference, source.GetMsaaSamples(), &threadPool, results.resolveWeights);
+
+        if (epochBuffers) {
+            results.epochCounts.wraps += epochBuffers->BeginFrame() ? 1 : 0;
+            epochBuffers->Merge(&fragments[0], fragments.size(), epochStats);
+            CheckEpochCounts(*epochBuffers, reference, results.epochCounts);
+        }
+
+        if (hiZBuffers) {
+            hiZBuffers->Merge(&fragments[0], fragments.size());
+            CheckHiZ(*hiZBuffers, source.GetMsaaSamples(), results.hiZCheck);
+        }
+
+        if (predictedBuffers) {
+            predictedBuffers->Merge(&fragments[0], fragments.size());
+            CheckNodePrediction(*predictedBuffers, source.GetMsaaSamples(), results.nodePredictionCheck);
+        }
+
+        if (discardPolicies) {
+            discardPolicies->Merge(&fragments[0], fragments.size());
+        }
+
+        if (concurrentEngine) {
+            if (frame == 0) {
+                for (unsigned i = 0; i < options.warmup; ++i) {
+                    concurrentEngine->Clear();
+                    concurrentEngine->Merge(&fragments[0], fragments.size());
+                }
+                concurrentEngine->ResetStats();
+            }
+            for (unsigned i = 0; i < options.repeat; ++i) {
+                concurrentEngine->Clear();
+                concurrentEngine->Merge(&fragments[0], fragments.size());
+            }
+            CheckConcurrentMerge(*concurrentEngine, reference, results.concurrentCheck);
+
+            serialEngine->Clear();
+            serialEngine->Merge(&fragments[0], fragments.size());
+            CheckConcurrentMerge(*serialEngine, reference, results.serialConcurrentCheck);
+        }
+
+        if (tileLightLists) {
+            CompareTiledShading(reference, view, &lights[0], options.lights, *tileLightLists, &threadPool,
+                                results.lightCulling);
+        }
+
+        if (traceBuffers) {
+            traceBuffers->Clear();
+            cacheModels.Flush();
+            TraceMergeAccesses(*traceBuffers, &fragments[0], fragments.size(), cacheModels, traceStats);
+        }
+    }
+    delete traceBuffers;
+    delete tileLightLists;
+    if (concurrentEngine) {
+        results.concurrentStats = concurrentEngine->GetStats();
+        results.concurrentMergeStats = concurrentEngine->GetConcurrentStats();
+        results.concurrentSeconds = concurrentEngine->GetMergeSeconds();
+    }
+    delete concurrentEngine;
+    delete serialEngine;
+    delete epochBuffers;
+    if (hiZBuffers) {
+        results.hiZBaseStats = hiZBuffers->GetStats();
+        results.hiZMergeStats = hiZBuffers->GetHiZMergeStats();
+        results.hiZStats = hiZBuffers->GetHiZStats();
+    }
+    delete hiZBuffers;
+    if (predictedBuffers) {
+        results.nodePredictionBaseStats = predictedBuffers->GetStats();
+        results.nodePredictionMergeStats = predictedBuffers->GetPredictedMergeStats();
+        results.nodeSearch = predictedBuffers->GetSearchStats();
+        results.predictedNodeSearch = predictedBuffers->GetPredictedSearchStats();
+    }
+    delete predictedBuffers;
+    if (discardPolicies) {
+        for (unsigned i = 0; i < DISCARD_POLICY_COUNT; ++i) {
+            results.discardPolicyStats[i] = discardPolicies->GetStats((DiscardPolicy)i);
+        }
+        results.discardReferenceStats = discardPolicies->GetReferenceStats();
+        results.selectedDiscardPolicy = discardPolicies->SelectPolicy(options.discardMinPsnr);
+    }
+    delete discardPolicies;
+
+    if (ok && options.snapshotPath &&
+        !WriteAndCheckSnapshot(options.snapshotPath, engines[0]->GetBuffers(), source.GetMsaaSamples(), view,
+                               results.snapshot)) {
+        fprintf(stderr, "could not write %s\n", options.snapshotPath);
+        ok = false;
+    }
+    if (ok && options.relightLights > 0) {
+        RunRelight(engines[0]->GetBuffers(), source.GetMsaaSamples(), view, options.snapshotPath,
+                   options.relightLights, options.generator.seed, levels, &threadPool, results.relight);
+    }
+
+    if (ok && options.binningLights > 0) {
+        RunLightBinning(engines[0]->GetBuffers(), view, options.binningLights, options.generator.seed,
+                        options.repeat, levels, &threadPool, results.lightBinning);
+    }
+
+    if (ok && options.clusterLights > 0) {
+        RunLightClusters(engines[0]->GetBuffers(), view, options.clusterLights, options.generator.seed,
+                         options.repeat, levels, &threadPool, results.lightClusters);
+    }
+
+    if (ok && options.bvhLights > 0) {
+        RunLightBvh(engines[0]->GetBuffers(), view, options.bvhLights, options.generator.seed, options.repeat,
+                    levels.back(), &threadPool, results.lightBvh);
+    }
+
+    if (ok && options.animationLights > 0) {
+        RunLightAnimation(options.animationLights, options.generator.seed, options.repeat, levels, &threadPool,
+                          results.lightAnimation);
+    }
+
+    if (ok && options.uploadFrames > 0) {
+        RunUploadRing(options.uploadFrames, options.generator.seed, results.uploadRing);
+    }
+
+    if (ok && options.formatConvert) {
+        RunFormatConvert(engines[0]->GetBuffers(), options.repeat > 4 ? options.repeat : 4, levels,
+                         results.formatConvert);
+    }
+
+    // The CPU merge stops at 8 samples, wide coverage is checked on random pixels
+    const unsigned wideSamples[2] = { 16, 32 };
+    for (int i = 0; i < 2; ++i) {
+        CompareRandomResolveWeights(wideSamples[i], options.surfacesPerPixel, 1 << 16, options.generator.seed,
+                                    results.wideResolveWeights[i]);
+    }
+
+    results.cacheDesc = options.cache;
+    for (size_t i = 0; i < cacheModels.GetCount(); ++i) {
+        CacheRun cacheRun;
+        cacheRun.mapping = GetAddressMappingName(cacheModels.Get(i).GetMapping());
+        cacheRun.fragments = traceStats.fragments;
+        cacheRun.stats = cacheModels.Get(i).GetCache().GetStats();
+        results.cacheRuns.push_back(cacheRun);
+    }
+
+    if (traceWriter.IsOpen() && !traceWriter.Close()) {
+        fprintf(stderr, "writing %s failed\n", options.writeTracePath);
+        ok = false;
+    }
+
+    for (size_t e = 0; e < engines.size(); ++e) {
+        runs[e].stats = engines[e]->GetStats();
+        runs[e].binSeconds = engines[e]->GetBinSeconds();
+        runs[e].mergeSeconds = engines[e]->GetMergeSeconds();
+        delete engines[e];
+    }
+    engines.clear();
+
+    BenchConfig config;
+    config.label = options.label;
+    config.source = options.tracePath ? options.tracePath : "synthetic";
+    config.width = source.GetWidth();
+    config.height = source.GetHeight();
+    config.msaaSamples = source.GetMsaaSamples();
+    config.surfacesPerPixel = options.surfacesPerPixel;
+    config.nodePoolPercent = options.nodePoolPercent;
+    config.addressing = GetAddressMappingName(options.addressing);
+    config.threads = threadPool.GetThreadCount();
+    config.frames = source.GetFrameCount();
+    config.repeat = options.repeat;
+    config.depthComplexity = options.generator.depthComplexity;
+    config.triangleSize = options.generator.triangleSize;
+    config.patchCells = options.generator.patchCells;
+    config.coveragePattern = GetCoveragePatternName(options.generator.coveragePattern);
+    config.patchOrder = GetPatchOrderName(options.generator.patchOrder);
+    config.seed = options.generator.seed;
+    config.cameraPath = options.generator.cameraPath;
+    config.cameraPan[0] = options.generator.cameraPan[0];
+    config.cameraPan[1] = options.generator.cameraPan[1];
+    if (!source.IsSynthetic()) {
+        config.depthComplexity = 0.0f;
+        config.triangleSize = 0.0f;
+        config.patchCells = 0;
+        config.coveragePattern = "";
+        config.patchOrder = "";
+        config.seed = 0;
+        config.cameraPath = false;
+    }
+
+    PrintReport(stdout, config, results);
+
+    if (options.jsonPath && !WriteJsonReport(options.jsonPath, config, results)) {
+        fprintf(stderr, "could not write %s\n", options.jsonPath);
+        ok = false;
+    }
+    if (options.csvPath && !AppendCsvReport(options.csvPath, config, results)) {
+        fprintf(stderr, "could not write %s\n", options.csvPath);
+        ok = false;
+    }
+
+    for (size_t e = 0; e < runs.size(); ++e) {
+        ok = ok && runs[e].matchesReference;
+    }
+    ok = ok && results.lightCulling.mismatches == 0;
+    ok = ok && results.resolveCompaction.mismatchedFrames == 0;
+    ok = ok && results.resolveWeights.mismatches == 0;
+    ok = ok && results.wideResolveWeights[0].mismatches == 0 && results.wideResolveWeights[1].mismatches == 0;
+    ok = ok && results.epochCounts.differingPixels == 0;
+    ok = ok && results.hiZCheck.resolveDiffers == 0;
+    ok = ok && results.nodePredictionCheck.differingPixels == 0;
+    ok = ok && results.concurrentCheck.invalidPixels == 0 && results.serialConcurrentCheck.differingPixels == 0;
+    ok = ok && (!options.snapshotPath || (results.snapshot.readBack && results.snapshot.differingPixels == 0));
+    for (size_t i = 0; i < results.lightBinning.runs.size(); ++i) {
+        ok = ok && results.lightBinning.runs[i].mismatchedTiles == 0;
+    }
+    for (size_t i = 0; i < results.lightClusters.runs.size(); ++i) {
+        ok = ok && results.lightClusters.runs[i].shading.mismatches == 0;
+    }
+    for (size_t i = 0; i < results.lightBvh.runs.size(); ++i) {
+        const LightBvhRun& run = results.lightBvh.runs[i];
+        ok = ok && run.mismatchedTiles == 0 && run.mismatchedClusters == 0 && run.mismatchedNodes == 0;
+    }
+    for (size_t i = 0; i < results.lightAnimation.runs.size(); ++i) {
+        ok = ok && results.lightAnimation.runs[i].differingLights == 0;
+    }
+    for (size_t i = 0; i < results.uploadRing.runs.size(); ++i) {
+        const UploadRingRun& run = results.uploadRing.runs[i];
+        ok = ok && run.ring.failures == 0 && run.gpu.misuses == 0 &&
+             (run.unfenced ? run.gpu.corruptReads > 0 : run.gpu.corruptReads == 0);
+    }
+    for (size_t i = 1; i < results.relight.runs.size(); ++i) {
+        ok = ok && results.relight.runs[i].error.maxError <= kRelightTolerance;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include "AddressMapping.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+std::string GetAddressMappingName(const AddressMapping& mapping)
+{
+    char name[64];
+    const char* order = mapping.pixelMajor ? "pixel-major" : "node-major";
+    switch (mapping.mapping) {
+        case STREAMING_ADDRESSING_LINEAR:
+            sprintf(name, "linear %s", order);
+            break;
+        case STREAMING_ADDRESSING_TILED:
+        case STREAMING_ADDRESSING_MORTON:
+            sprintf(name, "%s %ux%u %s", mapping.mapping == STREAMING_ADDRESSING_TILED ? "tiled" : "morton",
+                    1u << mapping.tileLogX, 1u << mapping.tileLogY, order);
+            break;
+        default:
+            sprintf(name, "unknown %s", order);
+            break;
+    }
+    return name;
+}
+
+static bool ParseTileSide(const char* text, char** end, unsigned& tileLog)
+{
+    unsigned long side = strtoul(text, end, 10);
+    if (*end == text) {
+        return false;
+    }
+    for (tileLog = 0; tileLog <= 8; ++tileLog) {
+        if (side == (1ul << tileLog)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseAddressMapping(const char* text, AddressMapping& mapping)
+{
+    AddressMapping result(STREAMING_ADDRESSING_LINEAR, 0, 0, false);
+    const char* rest = 0;
+    if (strncmp(text, "linear", 6) == 0) {
+        rest = text + 6;
+    } else {
+        if (strncmp(text, "tiled:", 6) == 0) {
+            result.mapping = STREAMING_ADDRESSING_TILED;
+        } else if (strncmp(text, "morton:", 7) == 0) {
+            result.mapping = STREAMING_ADDRESSING_MORTON;
+        } else {
+            return false;
+        }
+        char* end = 0;
+        if (!ParseTileSide(strchr(text, ':') + 1, &end, result.tileLogX) || *end != 'x' ||
+            !ParseTileSide(end + 1, &end, result.tileLogY)) {
+            return false;
+        }
+        rest = end;
+    }
+
+    if (strcmp(rest, ":pixel") == 0) {
+        result.pixelMajor = true;
+    } else if (*rest != '\0' && strcmp(rest, ":node") != 0) {
+        return false;
+    }
+    mapping = result;
+    return true;
+}
+
+} // namespace StreamingCpu
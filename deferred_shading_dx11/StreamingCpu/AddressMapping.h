@@ -0,0 +1,56 @@
+#ifndef STREAMINGCPU_ADDRESSMAPPING_H
+#define STREAMINGCPU_ADDRESSMAPPING_H
+
+// Runtime choice of the gMergeBuffer layout in Shaders/StreamingAddressing.h.
+// The default is the layout the shaders are compiled with.
+
+#include "../Shaders/StreamingAddressing.h"
+#include <string>
+
+namespace StreamingCpu {
+
+struct AddressMapping
+{
+    unsigned mapping;           // STREAMING_ADDRESSING_*
+    unsigned tileLogX;
+    unsigned tileLogY;
+    bool pixelMajor;
+
+    AddressMapping()
+        : mapping(STREAMING_ADDRESSING), tileLogX(STREAMING_TILE_LOGX), tileLogY(STREAMING_TILE_LOGY)
+        , pixelMajor(STREAMING_PIXEL_MAJOR_NODES != 0)
+    {
+    }
+
+    AddressMapping(unsigned mapping, unsigned tileLogX, unsigned tileLogY, bool pixelMajor)
+        : mapping(mapping), tileLogX(tileLogX), tileLogY(tileLogY), pixelMajor(pixelMajor)
+    {
+    }
+
+    unsigned GetPlaneSize(unsigned width, unsigned height) const
+    {
+        return GetAddressingPlaneSize(width, height, mapping, tileLogX, tileLogY);
+    }
+
+    unsigned GetPixelAddress(unsigned x, unsigned y, unsigned width) const
+    {
+        return ::GetPixelAddress(x, y, width, mapping, tileLogX, tileLogY);
+    }
+
+    unsigned GetNodeAddress(unsigned pixelAddress, unsigned index, unsigned planeSize,
+                            unsigned surfacesPerPixel) const
+    {
+        return ::GetNodeAddress(pixelAddress, index, planeSize, surfacesPerPixel, pixelMajor ? 1 : 0);
+    }
+};
+
+// e.g. "tiled 1x2 node-major"
+std::string GetAddressMappingName(const AddressMapping& mapping);
+
+// Parses "linear", "tiled:WxH" or "morton:WxH" with an optional ":pixel" or
+// ":node" (the default) suffix. Tile sides must be powers of two up to 256.
+bool ParseAddressMapping(const char* text, AddressMapping& mapping);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_ADDRESSMAPPING_H
@@ -0,0 +1,95 @@
+#include "CacheSimulator.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+static unsigned Log2(unsigned value)
+{
+    unsigned log = 0;
+    while ((1u << (log + 1)) <= value) {
+        ++log;
+    }
+    return log;
+}
+
+CacheSimulator::CacheSimulator(const CacheSimulatorDesc& desc)
+    : mDesc(desc), mTime(0)
+{
+    assert(desc.lineBytes > 0 && (desc.lineBytes & (desc.lineBytes - 1)) == 0);
+    assert(desc.pageBytes >= desc.lineBytes && (desc.pageBytes & (desc.pageBytes - 1)) == 0);
+    assert(desc.ways > 0 && desc.banks > 0);
+
+    mLineShift = Log2(desc.lineBytes);
+    mPageShift = Log2(desc.pageBytes);
+    mSets = desc.cacheBytes / (desc.lineBytes * desc.ways);
+    mSets = mSets > 0 ? mSets : 1;
+    Flush();
+}
+
+void CacheSimulator::Flush()
+{
+    Line empty = { 0, 0, false };
+    mLines.assign((size_t)mSets * mDesc.ways, empty);
+    mOpenPages.assign(mDesc.banks, 0);
+}
+
+void CacheSimulator::Access(uint64_t address, unsigned bytes, bool write)
+{
+    uint64_t first = address >> mLineShift;
+    uint64_t last = (address + (bytes > 0 ? bytes - 1 : 0)) >> mLineShift;
+    for (uint64_t line = first; line <= last; ++line) {
+        AccessLine(line, write);
+    }
+}
+
+void CacheSimulator::AccessLine(uint64_t line, bool write)
+{
+    ++mTime;
+    if (write) {
+        ++mStats.writes;
+    } else {
+        ++mStats.reads;
+    }
+
+    Line* set = &mLines[(size_t)(line % mSets) * mDesc.ways];
+    Line* victim = set;
+    for (unsigned i = 0; i < mDesc.ways; ++i) {
+        if (set[i].tag == line + 1) {
+            set[i].lastUse = mTime;
+            set[i].dirty = set[i].dirty || write;
+            if (write) {
+                ++mStats.writeHits;
+            } else {
+                ++mStats.readHits;
+            }
+            return;
+        }
+        if (set[i].lastUse < victim->lastUse) {
+            victim = &set[i];
+        }
+    }
+
+    // Write allocate. Full line writes still fetch, the merge never writes
+    // whole lines.
+    if (victim->tag != 0 && victim->dirty) {
+        ++mStats.writebacks;
+        AccessDram(victim->tag - 1);
+    }
+    AccessDram(line);
+    victim->tag = line + 1;
+    victim->lastUse = mTime;
+    victim->dirty = write;
+}
+
+void CacheSimulator::AccessDram(uint64_t line)
+{
+    uint64_t page = line >> (mPageShift - mLineShift);
+    uint64_t& openPage = mOpenPages[(size_t)(page % mDesc.banks)];
+    ++mStats.dramAccesses;
+    if (openPage == page + 1) {
+        ++mStats.pageHits;
+    }
+    openPage = page + 1;
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,90 @@
+#ifndef STREAMINGCPU_CACHESIMULATOR_H
+#define STREAMINGCPU_CACHESIMULATOR_H
+
+// Trace driven model of a set associative write-back cache in front of DRAM
+// with one open page per bank. Only meant for comparing access patterns, so
+// there is no timing, prefetching or coalescing.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+struct CacheSimulatorDesc
+{
+    unsigned cacheBytes;
+    unsigned lineBytes;         // power of two
+    unsigned ways;
+    unsigned pageBytes;         // DRAM page (row) size, power of two
+    unsigned banks;
+
+    CacheSimulatorDesc()
+        : cacheBytes(256 * 1024), lineBytes(64), ways(16), pageBytes(4096), banks(16)
+    {
+    }
+};
+
+struct CacheStats
+{
+    uint64_t reads;             // line accesses
+    uint64_t writes;
+    uint64_t readHits;
+    uint64_t writeHits;
+    uint64_t writebacks;        // dirty lines evicted
+    uint64_t dramAccesses;      // misses plus writebacks
+    uint64_t pageHits;          // DRAM accesses to the open page of their bank
+
+    CacheStats() : reads(0), writes(0), readHits(0), writeHits(0), writebacks(0), dramAccesses(0), pageHits(0) {}
+
+    double GetHitRate() const
+    {
+        uint64_t accesses = reads + writes;
+        return accesses ? (double)(readHits + writeHits) / accesses : 0.0;
+    }
+
+    double GetPageHitRate() const
+    {
+        return dramAccesses ? (double)pageHits / dramAccesses : 0.0;
+    }
+};
+
+class CacheSimulator
+{
+public:
+    explicit CacheSimulator(const CacheSimulatorDesc& desc = CacheSimulatorDesc());
+
+    // Touches every line in [address, address + bytes)
+    void Access(uint64_t address, unsigned bytes, bool write);
+
+    // Empties the cache and closes all pages
+    void Flush();
+
+    const CacheStats& GetStats() const { return mStats; }
+    void ResetStats() { mStats = CacheStats(); }
+    const CacheSimulatorDesc& GetDesc() const { return mDesc; }
+
+private:
+    struct Line
+    {
+        uint64_t tag;           // line address + 1, 0 for empty
+        uint64_t lastUse;
+        bool dirty;
+    };
+
+    void AccessLine(uint64_t line, bool write);
+    void AccessDram(uint64_t line);
+
+    CacheSimulatorDesc mDesc;
+    unsigned mLineShift;
+    unsigned mPageShift;
+    unsigned mSets;
+    uint64_t mTime;
+    std::vector<Line> mLines;           // mSets x ways
+    std::vector<uint64_t> mOpenPages;   // page + 1 per bank, 0 for closed
+    CacheStats mStats;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_CACHESIMULATOR_H
@@ -0,0 +1,285 @@
+#include "ConcurrentMerge.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <assert.h>
+#include <string.h>
+#include <thread>
+
+namespace StreamingCpu {
+
+static_assert(sizeof(MergeNodePacked) % sizeof(uint32_t) == 0, "MergeNodePacked is not whole words");
+
+// Fragments handed to a thread at a time. Small, so neighbouring fragments of
+// a triangle end up on different threads the way they would on a GPU.
+static const unsigned kFragmentGrain = 64;
+
+static const uint64_t kSequenceOne = (uint64_t)1 << kConcurrentSequenceShift;
+static const unsigned kCountWordMask = (1u << kConcurrentCountBits) - 1;
+
+// One attempt at merging a fragment into a pixel, with the accessors
+// MergeFragment() expects. Nothing shared is written before Commit().
+template <unsigned SurfacesPerPixel>
+class ConcurrentPixel
+{
+public:
+    typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+    ConcurrentPixel(ConcurrentMergeEngine& engine, unsigned x, unsigned y)
+        : mHeader(engine.GetHeader(x, y)), mNodeWords(engine.GetNodeWords(x, y))
+    {
+    }
+
+    // Takes the header a new attempt starts from, waiting out a writer
+    void Begin(ConcurrentMergeStats& stats)
+    {
+        for (;;) {
+            mSnapshot = mHeader.load(std::memory_order_acquire);
+            if ((mSnapshot & kSequenceOne) == 0) {
+                break;
+            }
+            stats.writerWaits++;
+            std::this_thread::yield();
+        }
+        mNodeList = (unsigned)mSnapshot;
+        mCountWord = (unsigned)(mSnapshot >> kConcurrentCountShift) & kCountWordMask;
+        mLoadedNodes = 0;
+        mDirtyNodes = 0;
+    }
+
+    // Publishes the attempt if nobody committed to the pixel since Begin()
+    bool Commit()
+    {
+        // Orders the node reads before the CAS, see the header comment
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t expected = mSnapshot;
+        if (!mHeader.compare_exchange_strong(expected, mSnapshot + kSequenceOne, std::memory_order_relaxed)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (unsigned index = 0; index < SurfacesPerPixel; ++index) {
+            if (mDirtyNodes & (1u << index)) {
+                uint32_t words[ConcurrentMergeEngine::kNodeWords];
+                memcpy(words, &mNodes[index], sizeof(words));
+                for (unsigned i = 0; i < ConcurrentMergeEngine::kNodeWords; ++i) {
+                    mNodeWords[index * ConcurrentMergeEngine::kNodeWords + i].store(words[i],
+                                                                                  std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // The sequence number wraps through the top of the word
+        uint64_t sequence = (mSnapshot >> kConcurrentSequenceShift) + 2;
+        mHeader.store((sequence << kConcurrentSequenceShift) |
+                      ((uint64_t)mCountWord << kConcurrentCountShift) | mNodeList,
+                      std::memory_order_release);
+        return true;
+    }
+
+    unsigned GetNodeCount() const
+    {
+        unsigned nodeCount = mCountWord & Layout::kNodeCountMask;
+        return nodeCount < SurfacesPerPixel ? nodeCount : SurfacesPerPixel;
+    }
+
+    void SetNodeCount(unsigned value)
+    {
+        mCountWord = (mCountWord & ~(unsigned)Layout::kNodeCountMask) | (value & Layout::kNodeCountMask);
+    }
+
+    unsigned GetNodeList() const { return mNodeList; }
+    void SetNodeList(unsigned nodeList) { mNodeList = nodeList; }
+
+    MergeNode GetMergeNode(unsigned index)
+    {
+        if ((mLoadedNodes & (1u << index)) == 0) {
+            uint32_t words[ConcurrentMergeEngine::kNodeWords];
+            for (unsigned i = 0; i < ConcurrentMergeEngine::kNodeWords; ++i) {
+                words[i] = mNodeWords[index * ConcurrentMergeEngine::kNodeWords + i].load(std::memory_order_relaxed);
+            }
+            memcpy(&mNodes[index], words, sizeof(words));
+            mLoadedNodes |= 1u << index;
+        }
+        return UnpackMergeNode(mNodes[index]);
+    }
+
+    void SetMergeNode(unsigned index, const MergeNode& merge)
+    {
+        mNodes[index] = PackMergeNode(merge);
+        mLoadedNodes |= 1u << index;
+        mDirtyNodes |= 1u << index;
+    }
+
+    bool AllocatePoolBlock() { return true; }
+
+    void SetDiscardedSamples(unsigned discardedSamples)
+    {
+        mCountWord = (mCountWord & ~(0x1u << 9)) | (discardedSamples << 9);
+    }
+
+    void AddHiZOccluder(unsigned, float) {}
+    unsigned PredictNode(unsigned, float, float) const { return STREAMING_PREDICTION_LOAD; }
+
+private:
+    std::atomic<uint64_t>& mHeader;
+    std::atomic<uint32_t>* mNodeWords;
+    uint64_t mSnapshot;
+    unsigned mNodeList;
+    unsigned mCountWord;
+    unsigned mLoadedNodes;
+    unsigned mDirtyNodes;
+    MergeNodePacked mNodes[SurfacesPerPixel];
+};
+
+template <unsigned SurfacesPerPixel>
+static void MergeFragmentsConcurrent(ConcurrentMergeEngine& engine, const Fragment* fragments, size_t count,
+                                     MergeStats& stats, ConcurrentMergeStats& concurrentStats)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const MergeNode incoming = GetIncomingMergeNode(fragments[i]);
+        ConcurrentPixel<SurfacesPerPixel> pixel(engine, fragments[i].x, fragments[i].y);
+        for (;;) {
+            MergeStats attempt;
+            pixel.Begin(concurrentStats);
+            MergeFragment(pixel, incoming, attempt);
+            if (pixel.Commit()) {
+                stats.Add(attempt);
+                concurrentStats.commits++;
+                break;
+            }
+            concurrentStats.conflicts++;
+        }
+    }
+}
+
+ConcurrentMergeEngine::ConcurrentMergeEngine(unsigned width, unsigned height, ThreadPool* threadPool,
+                                             unsigned surfacesPerPixel)
+    : mWidth(width), mHeight(height), mSurfacesPerPixel(surfacesPerPixel), mThreadPool(threadPool)
+    , mHeaders((size_t)width * height)
+    , mNodeWords((size_t)width * height * surfacesPerPixel * kNodeWords)
+    , mThreadStats(threadPool->GetThreadCount())
+    , mThreadConcurrentStats(threadPool->GetThreadCount())
+    , mMergeSeconds(0.0)
+{
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+    mNodeCountMask = surfacesPerPixel < 4 ? 0x3 : (surfacesPerPixel < 8 ? 0x7 : 0xF);
+
+    // Indexed by surfacesPerPixel - 1
+    static const MergeFunction functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+        MergeFragmentsConcurrent<1>, MergeFragmentsConcurrent<2>, MergeFragmentsConcurrent<3>,
+        MergeFragmentsConcurrent<4>, MergeFragmentsConcurrent<5>, MergeFragmentsConcurrent<6>,
+        MergeFragmentsConcurrent<7>, MergeFragmentsConcurrent<8>
+    };
+    mMergeFunction = functions[surfacesPerPixel - 1];
+
+    Clear();
+}
+
+void ConcurrentMergeEngine::Clear()
+{
+    // Nodes are only read through a header that lists them
+    for (size_t i = 0; i < mHeaders.size(); ++i) {
+        mHeaders[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void ConcurrentMergeEngine::ResetStats()
+{
+    mStats.Reset();
+    mConcurrentStats = ConcurrentMergeStats();
+    mMergeSeconds = 0.0;
+}
+
+void ConcurrentMergeEngine::Merge(const Fragment* fragments, size_t fragmentCount)
+{
+    if (fragmentCount == 0) {
+        return;
+    }
+    assert(fragmentCount <= 0xFFFFFFFFu);
+
+    for (size_t i = 0; i < mThreadStats.size(); ++i) {
+        mThreadStats[i].Reset();
+        mThreadConcurrentStats[i] = ConcurrentMergeStats();
+    }
+
+    Timer timer;
+    mThreadPool->ParallelFor((unsigned)fragmentCount, kFragmentGrain, [&](unsigned begin, unsigned end,
+                                                                          unsigned threadIndex) {
+        mMergeFunction(*this, &fragments[begin], end - begin, mThreadStats[threadIndex],
+                       mThreadConcurrentStats[threadIndex]);
+    });
+    mMergeSeconds += timer.GetSeconds();
+
+    for (size_t i = 0; i < mThreadStats.size(); ++i) {
+        mStats.Add(mThreadStats[i]);
+        mConcurrentStats.Add(mThreadConcurrentStats[i]);
+    }
+}
+
+unsigned ConcurrentMergeEngine::GetNodeCount(unsigned x, unsigned y) const
+{
+    unsigned nodeCount = (unsigned)(LoadHeader(x, y) >> kConcurrentCountShift) & mNodeCountMask;
+    return nodeCount < mSurfacesPerPixel ? nodeCount : mSurfacesPerPixel;
+}
+
+unsigned ConcurrentMergeEngine::GetNodeList(unsigned x, unsigned y) const
+{
+    return (unsigned)LoadHeader(x, y);
+}
+
+bool ConcurrentMergeEngine::GetDiscardedSamples(unsigned x, unsigned y) const
+{
+    return ((LoadHeader(x, y) >> kConcurrentCountShift) & (0x1u << 9)) != 0;
+}
+
+MergeNodePacked ConcurrentMergeEngine::GetMergeNode(unsigned x, unsigned y, unsigned index) const
+{
+    const std::atomic<uint32_t>* nodeWords = &mNodeWords[((size_t)(x + mWidth * y) * mSurfacesPerPixel + index) *
+                                                         kNodeWords];
+    uint32_t words[kNodeWords];
+    for (unsigned i = 0; i < kNodeWords; ++i) {
+        words[i] = nodeWords[i].load(std::memory_order_relaxed);
+    }
+    MergeNodePacked packed;
+    memcpy(&packed, words, sizeof(words));
+    return packed;
+}
+
+void CheckConcurrentMerge(const ConcurrentMergeEngine& engine, const MergeBuffers& reference,
+                          ConcurrentMergeCheck& check)
+{
+    const unsigned surfacesPerPixel = engine.GetSurfacesPerPixel();
+    const unsigned indexBits = surfacesPerPixel < 4 ? 2 : 3;
+    const unsigned indexMask = (1u << indexBits) - 1;
+    assert(reference.GetSurfacesPerPixel() == surfacesPerPixel);
+
+    for (unsigned y = 0; y < engine.GetHeight(); ++y) {
+        for (unsigned x = 0; x < engine.GetWidth(); ++x) {
+            const unsigned nodeCount = engine.GetNodeCount(x, y);
+            const unsigned nodeList = engine.GetNodeList(x, y);
+            const unsigned referenceList = reference.GetListTexture()[reference.GetNodeCountIndex(x, y)];
+
+            unsigned listed = 0;
+            bool valid = true;
+            bool matches = nodeCount == reference.GetNodeCount(x, y) &&
+                           engine.GetDiscardedSamples(x, y) == reference.GetDiscardedSamples(x, y);
+            for (unsigned i = 0; i < nodeCount; ++i) {
+                unsigned index = (nodeList >> (i * indexBits)) & indexMask;
+                valid = valid && index < surfacesPerPixel && (listed & (1u << index)) == 0;
+                listed |= 1u << index;
+                if (valid && matches) {
+                    unsigned referenceIndex = (referenceList >> (i * indexBits)) & indexMask;
+                    MergeNodePacked node = engine.GetMergeNode(x, y, index);
+                    matches = memcmp(&node, &reference.GetMergeBuffer()[reference.GetNodeIndex(x, y, referenceIndex)],
+                                     sizeof(node)) == 0;
+                }
+            }
+            check.pixels++;
+            check.invalidPixels += valid ? 0 : 1;
+            check.differingPixels += valid && matches ? 0 : 1;
+        }
+    }
+}
+
+} // namespace StreamingCpu
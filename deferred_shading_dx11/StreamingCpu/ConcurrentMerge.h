@@ -0,0 +1,151 @@
+#ifndef STREAMINGCPU_CONCURRENTMERGE_H
+#define STREAMINGCPU_CONCURRENTMERGE_H
+
+// Streaming g-buffer merge for hardware without pixel shader ordering, where
+// fragments of one pixel are merged by different threads at the same time.
+// MergeEngine avoids that by giving every tile to one thread; here threads
+// take fragments in submission order as they come and share pixels.
+//
+// Each pixel has one 64 bit header word holding what gListTexture and
+// gCountTexture hold, plus a sequence number. A fragment runs MergeFragment()
+// on a private copy of the pixel, reading nodes only as the merge asks for
+// them, then commits with a CAS of the header it started from to the next
+// (odd) sequence number. Only the winner of that CAS writes nodes, after which
+// it publishes the new header with an even sequence number. A thread that
+// loses the CAS saw a pixel that has changed since, so it merges again from
+// the new state. Node reads are seqlock reads: a header that is still the one
+// a copy started from proves no node it read was being written.
+//
+// Nodes live in pixel-major fixed planes, the node pool is not modeled. With
+// one thread the result is that of MergeEngine; with more, fragments of a
+// pixel merge in whatever order their threads commit.
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+// Header word: the node list in bits 0-31, the count texture word (node
+// count and the discard bit 9) in bits 32-41, and a sequence number in the
+// bits above that is odd while a thread writes the nodes of the pixel.
+enum {
+    kConcurrentCountShift = 32,
+    kConcurrentCountBits = 10,
+    kConcurrentSequenceShift = kConcurrentCountShift + kConcurrentCountBits
+};
+
+struct ConcurrentMergeStats
+{
+    uint64_t commits;           // one per fragment
+    uint64_t conflicts;         // merges redone after losing the header CAS
+    uint64_t writerWaits;       // copies that found a write in progress and waited
+
+    ConcurrentMergeStats() : commits(0), conflicts(0), writerWaits(0) {}
+
+    void Add(const ConcurrentMergeStats& other)
+    {
+        commits += other.commits;
+        conflicts += other.conflicts;
+        writerWaits += other.writerWaits;
+    }
+};
+
+class ConcurrentMergeEngine
+{
+public:
+    // surfacesPerPixel picks the kernel instantiation at runtime (1 to 8).
+    ConcurrentMergeEngine(unsigned width, unsigned height, ThreadPool* threadPool,
+                          unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL);
+
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    unsigned GetSurfacesPerPixel() const { return mSurfacesPerPixel; }
+
+    // Start of a new frame. Not thread safe with Merge.
+    void Clear();
+
+    // Runs StreamingGBufferPS on the fragments, handing them to the threads
+    // in small consecutive batches.
+    void Merge(const Fragment* fragments, size_t fragmentCount);
+
+    // Pixel state once Merge has returned
+    unsigned GetNodeCount(unsigned x, unsigned y) const;
+    unsigned GetNodeList(unsigned x, unsigned y) const;
+    bool GetDiscardedSamples(unsigned x, unsigned y) const;
+    MergeNodePacked GetMergeNode(unsigned x, unsigned y, unsigned index) const;
+
+    // Totals since the last ResetStats
+    const MergeStats& GetStats() const { return mStats; }
+    const ConcurrentMergeStats& GetConcurrentStats() const { return mConcurrentStats; }
+    double GetMergeSeconds() const { return mMergeSeconds; }
+    void ResetStats();
+
+    // Storage the per-pixel transactions work on
+    enum { kNodeWords = sizeof(MergeNodePacked) / sizeof(uint32_t) };
+    std::atomic<uint64_t>& GetHeader(unsigned x, unsigned y) { return mHeaders[x + mWidth * y]; }
+    std::atomic<uint32_t>* GetNodeWords(unsigned x, unsigned y)
+    {
+        return &mNodeWords[((size_t)(x + mWidth * y) * mSurfacesPerPixel) * kNodeWords];
+    }
+
+private:
+    // Not implemented
+    ConcurrentMergeEngine(const ConcurrentMergeEngine&);
+    ConcurrentMergeEngine& operator=(const ConcurrentMergeEngine&);
+
+    typedef void (*MergeFunction)(ConcurrentMergeEngine& engine, const Fragment* fragments, size_t count,
+                                  MergeStats& stats, ConcurrentMergeStats& concurrentStats);
+
+    uint64_t LoadHeader(unsigned x, unsigned y) const
+    {
+        return mHeaders[x + mWidth * y].load(std::memory_order_relaxed);
+    }
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mSurfacesPerPixel;
+    unsigned mNodeCountMask;
+    ThreadPool* mThreadPool;
+    MergeFunction mMergeFunction;
+
+    std::vector<std::atomic<uint64_t> > mHeaders;
+    std::vector<std::atomic<uint32_t> > mNodeWords;
+
+    std::vector<MergeStats> mThreadStats;
+    std::vector<ConcurrentMergeStats> mThreadConcurrentStats;
+    MergeStats mStats;
+    ConcurrentMergeStats mConcurrentStats;
+    double mMergeSeconds;
+};
+
+// Pixels of the engine against the buffers MergeEngine left for the same
+// fragments, node by node in list order
+struct ConcurrentMergeCheck
+{
+    uint64_t pixels;
+    uint64_t differingPixels;   // count, discard bit or a node differs
+    uint64_t invalidPixels;     // count out of range or a node listed twice
+
+    ConcurrentMergeCheck() : pixels(0), differingPixels(0), invalidPixels(0) {}
+
+    void Add(const ConcurrentMergeCheck& other)
+    {
+        pixels += other.pixels;
+        differingPixels += other.differingPixels;
+        invalidPixels += other.invalidPixels;
+    }
+};
+
+void CheckConcurrentMerge(const ConcurrentMergeEngine& engine, const MergeBuffers& reference,
+                          ConcurrentMergeCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_CONCURRENTMERGE_H
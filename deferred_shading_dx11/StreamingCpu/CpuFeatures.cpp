@@ -0,0 +1,97 @@
+#include "CpuFeatures.h"
+
+#if defined(STREAMINGCPU_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif // defined(STREAMINGCPU_X86)
+
+namespace StreamingCpu {
+
+#if defined(STREAMINGCPU_X86)
+static void Cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = (unsigned)info[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Which register state the OS saves on context switches
+static unsigned long long GetXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static SimdLevel DetectSimdLevel()
+{
+    unsigned regs[4];
+    Cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+    if (maxLeaf < 7) {
+        return SIMD_LEVEL_SCALAR;
+    }
+
+    Cpuid(1, 0, regs);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    bool f16c = (regs[2] & (1 << 29)) != 0;
+    if (!osxsave || !avx || !f16c) {
+        return SIMD_LEVEL_SCALAR;
+    }
+
+    unsigned long long xcr0 = GetXcr0();
+    if ((xcr0 & 0x6) != 0x6) {
+        return SIMD_LEVEL_SCALAR;
+    }
+
+    Cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1 << 5)) != 0;
+    bool avx512f = (regs[1] & (1 << 16)) != 0;
+    if (!avx2) {
+        return SIMD_LEVEL_SCALAR;
+    }
+
+#if defined(STREAMINGCPU_AVX512)
+    if (avx512f && (xcr0 & 0xE6) == 0xE6) {
+        return SIMD_LEVEL_AVX512;
+    }
+#else
+    (void)avx512f;
+#endif
+    return SIMD_LEVEL_AVX2;
+}
+#endif // defined(STREAMINGCPU_X86)
+
+SimdLevel GetMaxSimdLevel()
+{
+#if defined(STREAMINGCPU_X86)
+    return DetectSimdLevel();
+#else
+    return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SIMD_LEVEL_AVX2: return "avx2";
+        case SIMD_LEVEL_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,29 @@
+#ifndef STREAMINGCPU_CPUFEATURES_H
+#define STREAMINGCPU_CPUFEATURES_H
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define STREAMINGCPU_X86 1
+#endif
+
+// AVX-512 intrinsics need VS2017 or gcc/clang
+#if defined(STREAMINGCPU_X86) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1910))
+#define STREAMINGCPU_AVX512 1
+#endif
+
+namespace StreamingCpu {
+
+enum SimdLevel
+{
+    SIMD_LEVEL_SCALAR,
+    SIMD_LEVEL_AVX2,    // 8 lanes, needs F16C too
+    SIMD_LEVEL_AVX512,  // 16 lanes
+};
+
+// Highest level both the compiler and the CPU/OS support
+SimdLevel GetMaxSimdLevel();
+
+const char* GetSimdLevelName(SimdLevel level);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_CPUFEATURES_H
@@ -0,0 +1,217 @@
+#include "DiscardPolicy.h"
+#include "ResolveWeights.h"
+#include "Timer.h"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// Gives MergeFragment the policy of a pixel
+template <typename DiscardT>
+struct StatelessDiscardSource
+{
+    DiscardT Get(unsigned, unsigned) const { return DiscardT(); }
+};
+
+struct LeastRecentDiscardSource
+{
+    LeastRecentDiscardSource(std::vector<uint32_t>& writers, unsigned width, uint64_t& accesses)
+        : writers(writers), width(width), accesses(accesses) {}
+
+    LeastRecentDiscard Get(unsigned x, unsigned y) const
+    {
+        return LeastRecentDiscard(writers[x + (size_t)width * y], accesses);
+    }
+
+    std::vector<uint32_t>& writers;
+    unsigned width;
+    uint64_t& accesses;
+
+private:
+    // Not implemented
+    LeastRecentDiscardSource& operator=(const LeastRecentDiscardSource&);
+};
+
+template <unsigned SurfacesPerPixel, typename SourceT>
+void MergeWithPolicy(MergeBuffers& buffers, const SourceT& source, const Fragment* fragments, size_t count,
+                     MergeStats& stats)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const Fragment& fragment = fragments[i];
+        MergeBuffers::Pixel<SurfacesPerPixel> pixel(buffers, fragment.x, fragment.y);
+        auto discard = source.Get(fragment.x, fragment.y);
+        MergeFragment(pixel, GetIncomingMergeNode(fragment), discard, stats);
+    }
+}
+
+} // namespace
+
+const char* GetDiscardPolicyName(DiscardPolicy policy)
+{
+    switch (policy) {
+    case DISCARD_LEAST_COVERAGE: return "least-coverage";
+    case DISCARD_FARTHEST: return "farthest";
+    case DISCARD_LEAST_ENERGY: return "least-energy";
+    case DISCARD_LEAST_RECENT: return "least-recent";
+    default: return "unknown";
+    }
+}
+
+const double DiscardPolicyStats::kExactPsnr = 100.0;
+
+double DiscardPolicyStats::GetAccessesPerFragment() const
+{
+    if (merge.fragments == 0) {
+        return 0.0;
+    }
+    return (double)(merge.nodeLoads + merge.nodeStores + stateAccesses) / (double)merge.fragments;
+}
+
+double DiscardPolicyStats::GetRootMeanSquaredError() const
+{
+    return pixels ? sqrt(squaredError / (3.0 * (double)pixels)) : 0.0;
+}
+
+double DiscardPolicyStats::GetPsnr() const
+{
+    const double rmse = GetRootMeanSquaredError();
+    if (rmse == 0.0) {
+        return kExactPsnr;
+    }
+    const double psnr = -20.0 * log10(rmse);
+    return psnr < kExactPsnr ? psnr : kExactPsnr;
+}
+
+template <unsigned SurfacesPerPixel>
+void DiscardPolicyComparison::MergeFragments(DiscardPolicyComparison& comparison, DiscardPolicy policy,
+                                             const Fragment* fragments, size_t count)
+{
+    MergeBuffers& buffers = comparison.mBuffers;
+    DiscardPolicyStats& stats = comparison.mStats[policy];
+    switch (policy) {
+    case DISCARD_LEAST_COVERAGE:
+        MergeWithPolicy<SurfacesPerPixel>(buffers, StatelessDiscardSource<LeastCoverageDiscard>(),
+                                          fragments, count, stats.merge);
+        break;
+    case DISCARD_FARTHEST:
+        MergeWithPolicy<SurfacesPerPixel>(buffers, StatelessDiscardSource<FarthestDiscard>(),
+                                          fragments, count, stats.merge);
+        break;
+    case DISCARD_LEAST_ENERGY:
+        MergeWithPolicy<SurfacesPerPixel>(buffers, StatelessDiscardSource<LeastEnergyDiscard>(),
+                                          fragments, count, stats.merge);
+        break;
+    case DISCARD_LEAST_RECENT:
+        MergeWithPolicy<SurfacesPerPixel>(buffers,
+                                          LeastRecentDiscardSource(comparison.mWriters, buffers.GetWidth(),
+                                                                   stats.stateAccesses),
+                                          fragments, count, stats.merge);
+        break;
+    default:
+        assert(false);
+    }
+}
+
+DiscardPolicyComparison::DiscardPolicyComparison(unsigned width, unsigned height, unsigned surfacesPerPixel,
+                                                 unsigned msaaSamples)
+    : mMsaaSamples(msaaSamples)
+    , mBuffers(width, height, surfacesPerPixel)
+    , mReference(width, height, STREAMING_SURFACES_PER_PIXEL_MAX_CPU)
+    , mWriters((size_t)width * height, LeastRecentDiscard::kNoWriters)
+{
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+
+    // Indexed by surfacesPerPixel - 1
+    static const MergeFunction functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+        MergeFragments<1>, MergeFragments<2>, MergeFragments<3>, MergeFragments<4>,
+        MergeFragments<5>, MergeFragments<6>, MergeFragments<7>, MergeFragments<8>
+    };
+    mMergeFunction = functions[surfacesPerPixel - 1];
+}
+
+void DiscardPolicyComparison::Merge(const Fragment* fragments, size_t fragmentCount)
+{
+    mReference.Clear();
+    MergeWithPolicy<STREAMING_SURFACES_PER_PIXEL_MAX_CPU>(mReference, StatelessDiscardSource<LeastCoverageDiscard>(),
+                                                          fragments, fragmentCount, mReferenceStats);
+    Resolve(mReference, mReferenceColors);
+
+    for (unsigned policy = 0; policy < DISCARD_POLICY_COUNT; ++policy) {
+        mBuffers.Clear();
+        std::fill(mWriters.begin(), mWriters.end(), (uint32_t)LeastRecentDiscard::kNoWriters);
+
+        Timer timer;
+        mMergeFunction(*this, (DiscardPolicy)policy, fragments, fragmentCount);
+        mStats[policy].seconds += timer.GetSeconds();
+
+        Compare((DiscardPolicy)policy);
+    }
+}
+
+void DiscardPolicyComparison::Resolve(const MergeBuffers& buffers, std::vector<float>& colors) const
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    colors.assign((size_t)width * height * 3, 0.0f);
+
+    MergeNodePacked nodes[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+    unsigned weights[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            float* color = &colors[(x + (size_t)width * y) * 3];
+            const unsigned visible = GetResolvedNodes(buffers, x, y, mMsaaSamples, nodes, weights);
+            for (unsigned i = 0; i < visible; ++i) {
+                const MergeNode merge = UnpackMergeNode(nodes[i]);
+                const float weight = (float)weights[i] / (float)mMsaaSamples;
+                for (unsigned c = 0; c < 3; ++c) {
+                    color[c] += weight * merge.shade.albedo[c];
+                }
+            }
+        }
+    }
+}
+
+void DiscardPolicyComparison::Compare(DiscardPolicy policy)
+{
+    DiscardPolicyStats& stats = mStats[policy];
+    Resolve(mBuffers, mColors);
+
+    const unsigned width = mBuffers.GetWidth();
+    const unsigned height = mBuffers.GetHeight();
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            const size_t offset = (x + (size_t)width * y) * 3;
+            bool differs = false;
+            for (unsigned c = 0; c < 3; ++c) {
+                const double error = (double)mColors[offset + c] - (double)mReferenceColors[offset + c];
+                stats.squaredError += error * error;
+                differs = differs || error != 0.0;
+            }
+            stats.pixels++;
+            stats.differingPixels += differs ? 1 : 0;
+            stats.discardedPixels += mBuffers.GetDiscardedSamples(x, y) ? 1 : 0;
+        }
+    }
+}
+
+DiscardPolicy DiscardPolicyComparison::SelectPolicy(double minPsnr) const
+{
+    DiscardPolicy selected = DISCARD_POLICY_COUNT;
+    for (unsigned policy = 0; policy < DISCARD_POLICY_COUNT; ++policy) {
+        const DiscardPolicyStats& stats = mStats[policy];
+        if (stats.GetPsnr() < minPsnr) {
+            continue;
+        }
+        if (selected == DISCARD_POLICY_COUNT ||
+            stats.GetAccessesPerFragment() < mStats[selected].GetAccessesPerFragment()) {
+            selected = (DiscardPolicy)policy;
+        }
+    }
+    return selected;
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,177 @@
+#ifndef STREAMINGCPU_DISCARDPOLICY_H
+#define STREAMINGCPU_DISCARDPOLICY_H
+
+// What OccluderFusion throws away from a full pixel when no surface is
+// entirely occluded. LeastCoverageDiscard (MergeKernel.h) is the shader's
+// UpdateMinCoverage; FarthestDiscard and LeastEnergyDiscard are the other
+// values of STREAMING_DISCARD_POLICY. LeastRecentDiscard keeps, per pixel,
+// which slot last wrote each sample and throws away the surface that is the
+// latest writer of the fewest samples. That is a word of state per pixel the
+// shaders do not have, so it is CPU only.
+//
+// DiscardPolicyComparison merges every frame once per policy and once with
+// STREAMING_SURFACES_PER_PIXEL_MAX_CPU surfaces as the reference, and
+// compares the albedo each resolves to, with the skybox black.
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+enum DiscardPolicy
+{
+    DISCARD_LEAST_COVERAGE,
+    DISCARD_FARTHEST,
+    DISCARD_LEAST_ENERGY,
+    DISCARD_LEAST_RECENT,
+    DISCARD_POLICY_COUNT
+};
+
+const char* GetDiscardPolicyName(DiscardPolicy policy);
+
+// The last surface in the list, which is the incoming one when it is
+// behind the rest
+struct FarthestDiscard
+{
+    float Score(const MergeNode&, unsigned, unsigned position, unsigned) const { return -(float)position; }
+    void OnStore(unsigned, unsigned) {}
+    void OnReplace(unsigned, unsigned) {}
+};
+
+// Albedo luma times the samples a surface adds, so dark surfaces go first
+struct LeastEnergyDiscard
+{
+    float Score(const MergeNode& node, unsigned newInfo, unsigned, unsigned) const
+    {
+        const float luma = 0.299f * node.shade.albedo[0] + 0.587f * node.shade.albedo[1] +
+                           0.114f * node.shade.albedo[2];
+        return luma * (float)CountBits(newInfo);
+    }
+    void OnStore(unsigned, unsigned) {}
+    void OnReplace(unsigned, unsigned) {}
+};
+
+// writers holds the slot that last wrote each of 8 samples in 4 bits,
+// kNoWriter for none. Every hook reads or writes it once, counted in
+// accesses.
+class LeastRecentDiscard
+{
+public:
+    enum { kNoWriters = 0xFFFFFFFF, kNoWriter = 0xF };
+
+    LeastRecentDiscard(uint32_t& writers, uint64_t& accesses) : mWriters(writers), mAccesses(accesses) {}
+
+    // Samples the surface is the latest writer of, all of them for the incoming one
+    float Score(const MergeNode& node, unsigned, unsigned, unsigned index) const
+    {
+        mAccesses++;
+        if (index == kIncomingNodeIndex) {
+            return (float)CountBits(GetCoverage(node));
+        }
+        unsigned samples = 0;
+        for (unsigned s = 0; s < 8; ++s) {
+            samples += ((mWriters >> (s * 4)) & 0xF) == index;
+        }
+        return (float)samples;
+    }
+
+    void OnStore(unsigned index, unsigned coverage)
+    {
+        mAccesses++;
+        for (unsigned s = 0; s < 8; ++s) {
+            if (coverage & (1u << s)) {
+                mWriters = (mWriters & ~(0xFu << (s * 4))) | (index << (s * 4));
+            }
+        }
+    }
+
+    // The samples of the surface that had the slot are no longer written by it
+    void OnReplace(unsigned index, unsigned coverage)
+    {
+        for (unsigned s = 0; s < 8; ++s) {
+            if (((mWriters >> (s * 4)) & 0xF) == index) {
+                mWriters |= 0xFu << (s * 4);
+            }
+        }
+        OnStore(index, coverage);
+    }
+
+private:
+    uint32_t& mWriters;
+    uint64_t& mAccesses;
+};
+
+struct DiscardPolicyStats
+{
+    MergeStats merge;
+    uint64_t stateAccesses;     // LeastRecentDiscard words read or written
+    uint64_t discardedPixels;   // pixels with discarded samples, summed over frames
+    uint64_t pixels;            // compared with the reference
+    uint64_t differingPixels;   // resolved albedo differs in any channel
+    double squaredError;        // over the RGB channels of those pixels
+    double seconds;             // merging
+
+    DiscardPolicyStats()
+        : stateAccesses(0), discardedPixels(0), pixels(0), differingPixels(0), squaredError(0.0), seconds(0.0) {}
+
+    // Node loads and stores plus policy state per fragment
+    double GetAccessesPerFragment() const;
+    double GetRootMeanSquaredError() const;
+    // Albedo peaks at 1. An exact match reports kExactPsnr.
+    double GetPsnr() const;
+
+    static const double kExactPsnr;
+};
+
+class DiscardPolicyComparison
+{
+public:
+    DiscardPolicyComparison(unsigned width, unsigned height, unsigned surfacesPerPixel, unsigned msaaSamples);
+
+    // Merges a frame with each policy and the reference, starting from empty
+    // buffers, and adds up the stats
+    void Merge(const Fragment* fragments, size_t fragmentCount);
+
+    const DiscardPolicyStats& GetStats(DiscardPolicy policy) const { return mStats[policy]; }
+    const MergeStats& GetReferenceStats() const { return mReferenceStats; }
+
+    // The policy with the fewest accesses per fragment among those at or above
+    // minPsnr, DISCARD_POLICY_COUNT if there is none. Ties keep the earlier.
+    DiscardPolicy SelectPolicy(double minPsnr) const;
+
+private:
+    // Not implemented
+    DiscardPolicyComparison(const DiscardPolicyComparison&);
+    DiscardPolicyComparison& operator=(const DiscardPolicyComparison&);
+
+    typedef void (*MergeFunction)(DiscardPolicyComparison& comparison, DiscardPolicy policy,
+                                  const Fragment* fragments, size_t count);
+
+    template <unsigned SurfacesPerPixel>
+    static void MergeFragments(DiscardPolicyComparison& comparison, DiscardPolicy policy,
+                               const Fragment* fragments, size_t count);
+
+    // Albedo resolve of every pixel of buffers, RGB
+    void Resolve(const MergeBuffers& buffers, std::vector<float>& colors) const;
+
+    // mBuffers against the reference
+    void Compare(DiscardPolicy policy);
+
+    unsigned mMsaaSamples;
+    MergeFunction mMergeFunction;
+    MergeBuffers mBuffers;                  // merged with each policy in turn
+    MergeBuffers mReference;
+    std::vector<uint32_t> mWriters;         // LeastRecentDiscard, one per pixel
+    std::vector<float> mReferenceColors;
+    std::vector<float> mColors;
+    DiscardPolicyStats mStats[DISCARD_POLICY_COUNT];
+    MergeStats mReferenceStats;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_DISCARDPOLICY_H
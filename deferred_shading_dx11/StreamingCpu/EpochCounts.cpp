@@ -0,0 +1,102 @@
+#include "EpochCounts.h"
+#include <assert.h>
+#include <algorithm>
+#include <string.h>
+
+namespace StreamingCpu {
+
+template <unsigned SurfacesPerPixel>
+static void MergeFragmentsEpoch(EpochMergeBuffers& buffers, const Fragment* fragments, size_t count,
+                                MergeStats& stats)
+{
+    for (size_t i = 0; i < count; ++i) {
+        EpochMergeBuffers::Pixel<SurfacesPerPixel> pixel(buffers, fragments[i].x, fragments[i].y);
+        MergeFragment(pixel, GetIncomingMergeNode(fragments[i]), stats);
+    }
+}
+
+EpochMergeBuffers::EpochMergeBuffers(unsigned width, unsigned height, unsigned epochBits,
+                                     unsigned surfacesPerPixel)
+    : mWidth(width), mHeight(height), mSurfacesPerPixel(surfacesPerPixel)
+    , mPlaneSize(width * height), mEpochBits(epochBits), mEpochShift(32 - epochBits), mEpoch(0)
+{
+    assert(epochBits >= 1 && epochBits <= STREAMING_EPOCH_BITS);
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+    mNodeCountMask = surfacesPerPixel < 4 ? 0x3 : (surfacesPerPixel < 8 ? 0x7 : 0xF);
+
+    // Indexed by surfacesPerPixel - 1
+    static const MergeFunction functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+        MergeFragmentsEpoch<1>, MergeFragmentsEpoch<2>, MergeFragmentsEpoch<3>, MergeFragmentsEpoch<4>,
+        MergeFragmentsEpoch<5>, MergeFragmentsEpoch<6>, MergeFragmentsEpoch<7>, MergeFragmentsEpoch<8>
+    };
+    mMergeFunction = functions[surfacesPerPixel - 1];
+
+    // Lists start out invalid, so reading one no merge wrote this frame shows
+    mMergeBuffer.resize((size_t)mPlaneSize * surfacesPerPixel);
+    mListTexture.resize(mPlaneSize, 0xFFFFFFFFu);
+    mCountTexture.resize(mPlaneSize, 0);
+}
+
+bool EpochMergeBuffers::BeginFrame()
+{
+    if (mEpoch == 0 || mEpoch == GetMaxEpoch()) {
+        std::fill(mCountTexture.begin(), mCountTexture.end(), 0);
+        mEpoch = 1;
+        return true;
+    }
+    ++mEpoch;
+    return false;
+}
+
+void EpochMergeBuffers::Merge(const Fragment* fragments, size_t fragmentCount, MergeStats& stats)
+{
+    mMergeFunction(*this, fragments, fragmentCount, stats);
+}
+
+unsigned EpochMergeBuffers::GetNodeCount(unsigned x, unsigned y) const
+{
+    unsigned nodeCount = GetCountWord(x + mWidth * y) & mNodeCountMask;
+    return nodeCount < mSurfacesPerPixel ? nodeCount : mSurfacesPerPixel;
+}
+
+unsigned EpochMergeBuffers::GetNodeList(unsigned x, unsigned y) const
+{
+    return GetNodeCount(x, y) > 1 ? mListTexture[x + mWidth * y] : 0;
+}
+
+bool EpochMergeBuffers::GetDiscardedSamples(unsigned x, unsigned y) const
+{
+    return (GetCountWord(x + mWidth * y) & (0x1u << 9)) != 0;
+}
+
+void CheckEpochCounts(const EpochMergeBuffers& buffers, const MergeBuffers& reference, EpochCountsCheck& check)
+{
+    const unsigned indexBits = buffers.GetSurfacesPerPixel() < 4 ? 2 : 3;
+    const unsigned indexMask = (1u << indexBits) - 1;
+    assert(reference.GetSurfacesPerPixel() == buffers.GetSurfacesPerPixel());
+
+    check.frames++;
+    for (unsigned y = 0; y < buffers.GetHeight(); ++y) {
+        for (unsigned x = 0; x < buffers.GetWidth(); ++x) {
+            const unsigned nodeCount = buffers.GetNodeCount(x, y);
+            const unsigned nodeList = buffers.GetNodeList(x, y);
+            const unsigned referenceList = reference.GetListTexture()[reference.GetNodeCountIndex(x, y)];
+
+            bool matches = nodeCount == reference.GetNodeCount(x, y) &&
+                           buffers.GetDiscardedSamples(x, y) == reference.GetDiscardedSamples(x, y);
+            for (unsigned i = 0; i < nodeCount && matches; ++i) {
+                unsigned index = (nodeList >> (i * indexBits)) & indexMask;
+                unsigned referenceIndex = (referenceList >> (i * indexBits)) & indexMask;
+                matches = memcmp(&buffers.GetMergeNode(x, y, index),
+                                 &reference.GetMergeBuffer()[reference.GetNodeIndex(x, y, referenceIndex)],
+                                 sizeof(MergeNodePacked)) == 0;
+            }
+            check.pixels++;
+            check.stalePixels += (buffers.GetStoredCountWord(x, y) >> buffers.GetEpochShift()) != buffers.GetEpoch();
+            check.differingPixels += matches ? 0 : 1;
+        }
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,152 @@
+#ifndef STREAMINGCPU_EPOCHCOUNTS_H
+#define STREAMINGCPU_EPOCHCOUNTS_H
+
+// CPU model of STREAMING_EPOCH_COUNTS: gCountTexture words carry the epoch of
+// the frame that wrote them and are never cleared by the resolve. A word of
+// another epoch reads as an empty pixel, and gListTexture is only read once a
+// pixel has a second node this frame. BeginFrame() does what App::Render does
+// with the epoch, including the clear when it wraps.
+//
+// The epoch width is a parameter so a few frames are enough to wrap it; the
+// shaders use STREAMING_EPOCH_BITS. Fragments merge serially, in the order
+// MergeEngine merges the fragments of a pixel.
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class EpochMergeBuffers
+{
+public:
+    // epochBits of 1 to STREAMING_EPOCH_BITS
+    EpochMergeBuffers(unsigned width, unsigned height, unsigned epochBits = STREAMING_EPOCH_BITS,
+                      unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL);
+
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    unsigned GetSurfacesPerPixel() const { return mSurfacesPerPixel; }
+    unsigned GetEpoch() const { return mEpoch; }
+    unsigned GetEpochShift() const { return mEpochShift; }
+    unsigned GetMaxEpoch() const { return (1u << mEpochBits) - 1; }
+
+    // Advances the epoch. Returns true if it wrapped and the count texture
+    // was cleared.
+    bool BeginFrame();
+
+    void Merge(const Fragment* fragments, size_t fragmentCount, MergeStats& stats);
+
+    // What StreamingResolvePS reads for the pixel
+    unsigned GetNodeCount(unsigned x, unsigned y) const;
+    unsigned GetNodeList(unsigned x, unsigned y) const;
+    bool GetDiscardedSamples(unsigned x, unsigned y) const;
+    const MergeNodePacked& GetMergeNode(unsigned x, unsigned y, unsigned index) const
+    {
+        return mMergeBuffer[(size_t)index * mWidth * mHeight + x + mWidth * y];
+    }
+
+    // Count word as stored, whatever its epoch
+    unsigned GetStoredCountWord(unsigned x, unsigned y) const { return mCountTexture[x + mWidth * y]; }
+
+    // GetCountWord from StreamingBuffers.hlsl
+    unsigned GetCountWord(unsigned countIndex) const
+    {
+        unsigned count = mCountTexture[countIndex];
+        return (count >> mEpochShift) == mEpoch ? count : mEpoch << mEpochShift;
+    }
+
+    template <unsigned SurfacesPerPixel>
+    class Pixel
+    {
+    public:
+        typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+        Pixel(EpochMergeBuffers& buffers, unsigned x, unsigned y)
+            : mBuffers(buffers), mCountIndex(x + buffers.mWidth * y) {}
+
+        unsigned GetNodeCount() const
+        {
+            unsigned nodeCount = mBuffers.GetCountWord(mCountIndex) & Layout::kNodeCountMask;
+            return nodeCount < SurfacesPerPixel ? nodeCount : SurfacesPerPixel;
+        }
+
+        void SetNodeCount(unsigned value)
+        {
+            unsigned count = mBuffers.GetCountWord(mCountIndex);
+            mBuffers.mCountTexture[mCountIndex] = (count & ~(unsigned)Layout::kNodeCountMask) |
+                                                  (value & Layout::kNodeCountMask);
+        }
+
+        unsigned GetNodeList() const { return GetNodeCount() > 1 ? mBuffers.mListTexture[mCountIndex] : 0; }
+        void SetNodeList(unsigned nodeList) { mBuffers.mListTexture[mCountIndex] = nodeList; }
+
+        MergeNode GetMergeNode(unsigned index) const
+        {
+            return UnpackMergeNode(mBuffers.mMergeBuffer[index * mBuffers.mPlaneSize + mCountIndex]);
+        }
+
+        void SetMergeNode(unsigned index, const MergeNode& merge)
+        {
+            mBuffers.mMergeBuffer[index * mBuffers.mPlaneSize + mCountIndex] = PackMergeNode(merge);
+        }
+
+        bool AllocatePoolBlock() { return true; }
+
+        void SetDiscardedSamples(unsigned discardedSamples)
+        {
+            unsigned count = mBuffers.GetCountWord(mCountIndex);
+            mBuffers.mCountTexture[mCountIndex] = (count & ~(0x1u << 9)) | (discardedSamples << 9);
+        }
+
+        void AddHiZOccluder(unsigned, float) {}
+        unsigned PredictNode(unsigned, float, float) const { return STREAMING_PREDICTION_LOAD; }
+
+    private:
+        EpochMergeBuffers& mBuffers;
+        unsigned mCountIndex;
+    };
+
+private:
+    // Not implemented
+    EpochMergeBuffers(const EpochMergeBuffers&);
+    EpochMergeBuffers& operator=(const EpochMergeBuffers&);
+
+    typedef void (*MergeFunction)(EpochMergeBuffers& buffers, const Fragment* fragments, size_t count,
+                                  MergeStats& stats);
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mSurfacesPerPixel;
+    unsigned mNodeCountMask;
+    unsigned mPlaneSize;
+    unsigned mEpochBits;
+    unsigned mEpochShift;
+    unsigned mEpoch;
+    MergeFunction mMergeFunction;
+    std::vector<MergeNodePacked> mMergeBuffer;  // node-major planes
+    std::vector<unsigned> mCountTexture;
+    std::vector<unsigned> mListTexture;
+};
+
+// Epoch tagged buffers against buffers that were cleared for the frame
+struct EpochCountsCheck
+{
+    unsigned frames;
+    unsigned wraps;             // frames that cleared the count texture
+    uint64_t pixels;
+    uint64_t stalePixels;       // words no fragment wrote this frame, read as empty
+    uint64_t differingPixels;   // count, discard bit or a node in list order differs
+
+    EpochCountsCheck() : frames(0), wraps(0), pixels(0), stalePixels(0), differingPixels(0) {}
+};
+
+// Call once per frame after both merged the same fragments
+void CheckEpochCounts(const EpochMergeBuffers& buffers, const MergeBuffers& reference, EpochCountsCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_EPOCHCOUNTS_H
@@ -0,0 +1,116 @@
+#ifndef STREAMINGCPU_FORMATCONVERT_H
+#define STREAMINGCPU_FORMATCONVERT_H
+
+// Scalar C++ versions of the f32tof16/f16tof32 intrinsics and the
+// D3DX_DXGIFormatConvert.inl helpers used by StreamingBuffers.hlsl.
+// float -> half rounds to nearest even, handles denormals and keeps NaNs
+// quiet, which matches the D3D11 conversion rules and F16C.
+
+#include <math.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+inline unsigned AsUint(float value)
+{
+    unsigned result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+inline float AsFloat(unsigned value)
+{
+    float result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+inline unsigned F32ToF16(float value)
+{
+    unsigned bits = AsUint(value);
+    unsigned sign = (bits >> 16) & 0x8000;
+    bits &= 0x7FFFFFFF;
+
+    unsigned result;
+    if (bits >= 0x47800000) {
+        // Inf/NaN or too large for a half. NaN payloads are truncated and quieted.
+        result = bits > 0x7F800000 ? (0x7E00 | ((bits >> 13) & 0x3FF)) : 0x7C00;
+    } else if (bits < 0x38800000) {
+        // Half denormal or zero. Adding the magic number lines the 10 mantissa
+        // bits up at the bottom of the float and the FPU does the rounding.
+        const unsigned denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        result = AsUint(AsFloat(bits) + AsFloat(denormMagic)) - denormMagic;
+    } else {
+        unsigned mantissaOdd = (bits >> 13) & 1;
+        bits -= (127 - 15) << 23;
+        bits += 0xFFF;
+        bits += mantissaOdd;
+        result = bits >> 13;
+    }
+    return result | sign;
+}
+
+inline float F16ToF32(unsigned value)
+{
+    const unsigned shiftedExponent = 0x7C00 << 13;
+    unsigned bits = (value & 0x7FFF) << 13;
+    unsigned exponent = bits & shiftedExponent;
+    bits += (127 - 15) << 23;
+
+    if (exponent == shiftedExponent) {
+        // Inf/NaN, NaNs come back quiet
+        bits += (128 - 16) << 23;
+        bits |= (bits & 0x007FFFFF) ? 0x00400000 : 0;
+    } else if (exponent == 0) {
+        bits += 1 << 23;
+        bits = AsUint(AsFloat(bits) - AsFloat(113 << 23));
+    }
+    return AsFloat(bits | ((value & 0x8000) << 16));
+}
+
+// HLSL saturate() flushes NaN to 0.
+inline float Saturate(float value)
+{
+    return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+}
+
+inline unsigned FloatToUnorm8(float value)
+{
+    return (unsigned)floorf(Saturate(value) * 255.0f + 0.5f);
+}
+
+inline float Unorm8ToFloat(unsigned value)
+{
+    return (float)(value & 0xFF) / 255.0f;
+}
+
+inline unsigned FLOAT2_to_R16G16_FLOAT(const float input[2])
+{
+    return F32ToF16(input[0]) | (F32ToF16(input[1]) << 16);
+}
+
+inline void R16G16_FLOAT_to_FLOAT2(unsigned packed, float output[2])
+{
+    output[0] = F16ToF32(packed & 0x0000FFFF);
+    output[1] = F16ToF32(packed >> 16);
+}
+
+inline unsigned FLOAT4_to_R8G8B8A8_UNORM(const float input[4])
+{
+    return FloatToUnorm8(input[0]) |
+          (FloatToUnorm8(input[1]) << 8) |
+          (FloatToUnorm8(input[2]) << 16) |
+          (FloatToUnorm8(input[3]) << 24);
+}
+
+inline void R8G8B8A8_UNORM_to_FLOAT4(unsigned packed, float output[4])
+{
+    output[0] = Unorm8ToFloat(packed);
+    output[1] = Unorm8ToFloat(packed >> 8);
+    output[2] = Unorm8ToFloat(packed >> 16);
+    output[3] = Unorm8ToFloat(packed >> 24);
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_FORMATCONVERT_H
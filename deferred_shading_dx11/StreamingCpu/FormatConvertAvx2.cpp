@@ -0,0 +1,355 @@
+// See MergeKernelAvx2.cpp for why the includes come before the pragma.
+#include "FormatConvertSimd.h"
+
+#if defined(STREAMINGCPU_X86)
+
+#include <immintrin.h>
+#include <stddef.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,f16c"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace StreamingCpu {
+
+namespace {
+
+// Word offsets of the fields the nodes are gathered by
+static_assert(sizeof(MergeNodePacked) == 20 && sizeof(MergeNode) == 48,
+              "the gathers below assume MergeNode without STREAMING_DEBUG_OPTIONS");
+enum
+{
+    kPackedWords = sizeof(MergeNodePacked) / 4,
+    kPackedCoverage = offsetof(MergeNodePacked, coverage) / 4,
+    kPackedDerivatives = offsetof(MergeNodePacked, zViewDerivatives) / 4,
+    kPackedZView = offsetof(MergeNodePacked, zView) / 4,
+    kPackedNormal = offsetof(MergeNodePacked, normal) / 4,
+    kPackedAlbedo = offsetof(MergeNodePacked, albedo) / 4,
+    kNodeWords = sizeof(MergeNode) / 4,
+    kNodeCoverage = offsetof(MergeNode, coverage) / 4,
+    kNodeDerivatives = offsetof(MergeNode, zViewDerivatives) / 4,
+    kNodeZView = offsetof(MergeNode, zView) / 4,
+    kNodeNormal = offsetof(MergeNode, normal) / 4,
+    kNodeAlbedo = offsetof(MergeNode, shade) / 4,
+    kNodeSpecular = kNodeAlbedo + 4
+};
+
+// Low and high 16 bits of 8 words as halves
+inline void HalvesToFloats(__m256i words, __m256& low, __m256& high)
+{
+    __m256i halves = _mm256_packus_epi32(_mm256_and_si256(words, _mm256_set1_epi32(0xFFFF)),
+                                         _mm256_srli_epi32(words, 16));
+    halves = _mm256_permute4x64_epi64(halves, _MM_SHUFFLE(3, 1, 2, 0));
+    low = _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+    high = _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1));
+}
+
+inline __m256i FloatsToHalves(__m256 value)
+{
+    return _mm256_cvtepu16_epi32(_mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+}
+
+// FloatToUnorm8. max returns its second operand for NaN, so NaN saturates to
+// 0 like Saturate().
+inline __m256i FloatsToUnorm8(__m256 value)
+{
+    value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    value = _mm256_add_ps(_mm256_mul_ps(value, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f));
+    return _mm256_cvttps_epi32(_mm256_floor_ps(value));
+}
+
+inline __m256 Unorm8ToFloats(__m256i bytes)
+{
+    return _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(bytes, _mm256_set1_epi32(0xFF))),
+                         _mm256_set1_ps(255.0f));
+}
+
+// Word offsets of 8 consecutive structs of stride words. Lanes at or past
+// count repeat the last struct so the gathers stay inside the array.
+inline __m256i GetGatherOffsets(size_t count, int stride)
+{
+    const int last = count < 8 ? (int)count - 1 : 7;
+    const __m256i lanes = _mm256_min_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(last));
+    return _mm256_mullo_epi32(lanes, _mm256_set1_epi32(stride));
+}
+
+void Float2ToR16G16FloatAvx2(const float* input, size_t count, unsigned* output)
+{
+    // The halves of 8 floats in order are 4 words with x in the low bits
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i*)(output + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(input + i * 2), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < count; ++i) {
+        output[i] = FLOAT2_to_R16G16_FLOAT(input + i * 2);
+    }
+}
+
+void R16G16FloatToFloat2Avx2(const unsigned* input, size_t count, float* output)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_ps(output + i * 2, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(input + i))));
+    }
+    for (; i < count; ++i) {
+        R16G16_FLOAT_to_FLOAT2(input[i], output + i * 2);
+    }
+}
+
+void Float4ToR8G8B8A8UnormAvx2(const float* input, size_t count, unsigned* output)
+{
+    const __m256i shifts = _mm256_setr_epi32(0, 8, 16, 24, 0, 8, 16, 24);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Two words per vector, their channels shifted into place and added up
+        __m256i words[4];
+        for (int v = 0; v < 4; ++v) {
+            words[v] = _mm256_sllv_epi32(FloatsToUnorm8(_mm256_loadu_ps(input + (i + v * 2) * 4)), shifts);
+        }
+        const __m256i sum = _mm256_hadd_epi32(_mm256_hadd_epi32(words[0], words[1]),
+                                              _mm256_hadd_epi32(words[2], words[3]));
+        // sum holds words 0, 2, 4, 6 | 1, 3, 5, 7
+        _mm256_storeu_si256((__m256i*)(output + i),
+                            _mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+    }
+    for (; i < count; ++i) {
+        output[i] = FLOAT4_to_R8G8B8A8_UNORM(input + i * 4);
+    }
+}
+
+void R8G8B8A8UnormToFloat4Avx2(const unsigned* input, size_t count, float* output)
+{
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(input + i)));
+        _mm256_storeu_ps(output + i * 4, Unorm8ToFloats(bytes));
+    }
+    for (; i < count; ++i) {
+        R8G8B8A8_UNORM_to_FLOAT4(input[i], output + i * 4);
+    }
+}
+
+// Rows become columns. Shuffles move bits, so NaNs come through untouched.
+inline void Transpose8x8(__m256 rows[8])
+{
+    __m256 t[8], s[8];
+    for (int i = 0; i < 4; ++i) {
+        t[i * 2] = _mm256_unpacklo_ps(rows[i * 2], rows[i * 2 + 1]);
+        t[i * 2 + 1] = _mm256_unpackhi_ps(rows[i * 2], rows[i * 2 + 1]);
+    }
+    for (int i = 0; i < 2; ++i) {
+        s[i * 4] = _mm256_shuffle_ps(t[i * 4], t[i * 4 + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        s[i * 4 + 1] = _mm256_shuffle_ps(t[i * 4], t[i * 4 + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        s[i * 4 + 2] = _mm256_shuffle_ps(t[i * 4 + 1], t[i * 4 + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        s[i * 4 + 3] = _mm256_shuffle_ps(t[i * 4 + 1], t[i * 4 + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2f128_ps(s[i], s[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2f128_ps(s[i], s[i + 4], 0x31);
+    }
+}
+
+// The lanes holding the words of one packed node
+inline __m256i GetPackedWordMask()
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(kPackedWords), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// The kNodeWords words of lanes nodes, one vector per word
+void LoadNodeWords(const MergeNode* input, size_t lanes, __m256 words[kNodeWords])
+{
+    const float* in = (const float*)input;
+    if (lanes == 8) {
+        __m256 rows[8];
+        for (int i = 0; i < 8; ++i) {
+            rows[i] = _mm256_loadu_ps(in + i * kNodeWords);
+        }
+        Transpose8x8(rows);
+        for (int w = 0; w < 8; ++w) {
+            words[w] = rows[w];
+        }
+        for (int i = 0; i < 8; ++i) {
+            rows[i] = _mm256_castps128_ps256(_mm_loadu_ps(in + i * kNodeWords + 8));
+        }
+        Transpose8x8(rows);
+        for (int w = 8; w < kNodeWords; ++w) {
+            words[w] = rows[w - 8];
+        }
+    } else {
+        const __m256i offsets = GetGatherOffsets(lanes, kNodeWords);
+        for (int w = 0; w < kNodeWords; ++w) {
+            words[w] = _mm256_i32gather_ps(in + w, offsets, 4);
+        }
+    }
+}
+
+// The kPackedWords words of the first lanes of remaining packed nodes, one
+// vector per word
+void LoadPackedWords(const MergeNodePacked* input, size_t remaining, __m256i words[kPackedWords])
+{
+    const float* in = (const float*)input;
+    const size_t lanes = remaining < 8 ? remaining : 8;
+    if (lanes == 8) {
+        // Each row reads on into the next node. The last one only keeps to its
+        // own words when there is no next node, since maskload is much slower.
+        __m256 rows[8];
+        for (int i = 0; i < 7; ++i) {
+            rows[i] = _mm256_loadu_ps(in + i * kPackedWords);
+        }
+        rows[7] = remaining > 8 ? _mm256_loadu_ps(in + 7 * kPackedWords)
+                                : _mm256_maskload_ps(in + 7 * kPackedWords, GetPackedWordMask());
+        Transpose8x8(rows);
+        for (int w = 0; w < kPackedWords; ++w) {
+            words[w] = _mm256_castps_si256(rows[w]);
+        }
+    } else {
+        const __m256i offsets = GetGatherOffsets(lanes, kPackedWords);
+        for (int w = 0; w < kPackedWords; ++w) {
+            words[w] = _mm256_i32gather_epi32((const int*)input + w, offsets, 4);
+        }
+    }
+}
+
+void StoreNodeWords(const __m256 words[kNodeWords], size_t lanes, MergeNode* output)
+{
+    float* out = (float*)output;
+    if (lanes == 8) {
+        __m256 rows[8];
+        for (int w = 0; w < 8; ++w) {
+            rows[w] = words[w];
+        }
+        Transpose8x8(rows);
+        for (int i = 0; i < 8; ++i) {
+            _mm256_storeu_ps(out + i * kNodeWords, rows[i]);
+        }
+        for (int w = 0; w < 8; ++w) {
+            rows[w] = w + 8 < kNodeWords ? words[w + 8] : _mm256_setzero_ps();
+        }
+        Transpose8x8(rows);
+        for (int i = 0; i < 8; ++i) {
+            _mm_storeu_ps(out + i * kNodeWords + 8, _mm256_castps256_ps128(rows[i]));
+        }
+    } else {
+        // Moved as words so NaN bits are never touched by a float register
+        unsigned columns[kNodeWords][8];
+        for (int w = 0; w < kNodeWords; ++w) {
+            _mm256_storeu_ps((float*)columns[w], words[w]);
+        }
+        unsigned* outWords = (unsigned*)output;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (int w = 0; w < kNodeWords; ++w) {
+                outWords[lane * kNodeWords + w] = columns[w][lane];
+            }
+        }
+    }
+}
+
+void StorePackedWords(const __m256i words[kPackedWords], size_t remaining, MergeNodePacked* output)
+{
+    unsigned* out = (unsigned*)output;
+    const size_t lanes = remaining < 8 ? remaining : 8;
+    if (lanes == 8) {
+        // Each row is stored whole over the start of the next node, which the
+        // next store writes again. The last row only keeps to its own words
+        // when there is no next node.
+        __m256 rows[8];
+        for (int w = 0; w < 8; ++w) {
+            rows[w] = w < kPackedWords ? _mm256_castsi256_ps(words[w]) : _mm256_setzero_ps();
+        }
+        Transpose8x8(rows);
+        for (int i = 0; i < 7; ++i) {
+            _mm256_storeu_ps((float*)out + i * kPackedWords, rows[i]);
+        }
+        if (remaining > 8) {
+            _mm256_storeu_ps((float*)out + 7 * kPackedWords, rows[7]);
+        } else {
+            _mm256_maskstore_ps((float*)out + 7 * kPackedWords, GetPackedWordMask(), rows[7]);
+        }
+    } else {
+        unsigned columns[kPackedWords][8];
+        for (int w = 0; w < kPackedWords; ++w) {
+            _mm256_storeu_si256((__m256i*)columns[w], words[w]);
+        }
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (int w = 0; w < kPackedWords; ++w) {
+                out[lane * kPackedWords + w] = columns[w][lane];
+            }
+        }
+    }
+}
+
+void PackMergeNodesAvx2(const MergeNode* input, size_t count, MergeNodePacked* output)
+{
+    for (size_t i = 0; i < count; i += 8) {
+        const size_t lanes = count - i < 8 ? count - i : 8;
+        __m256 in[kNodeWords];
+        LoadNodeWords(input + i, lanes, in);
+
+        // albedo.rgb and specular[0] go into the RGBA8 word
+        __m256i albedo = FloatsToUnorm8(in[kNodeAlbedo]);
+        albedo = _mm256_or_si256(albedo, _mm256_slli_epi32(FloatsToUnorm8(in[kNodeAlbedo + 1]), 8));
+        albedo = _mm256_or_si256(albedo, _mm256_slli_epi32(FloatsToUnorm8(in[kNodeAlbedo + 2]), 16));
+        albedo = _mm256_or_si256(albedo, _mm256_slli_epi32(FloatsToUnorm8(in[kNodeSpecular]), 24));
+
+        __m256i out[kPackedWords];
+        out[kPackedCoverage] = _mm256_or_si256(_mm256_castps_si256(in[kNodeCoverage]),
+                                               _mm256_slli_epi32(FloatsToHalves(in[kNodeSpecular + 1]), 16));
+        out[kPackedDerivatives] = _mm256_or_si256(FloatsToHalves(in[kNodeDerivatives]),
+                                                  _mm256_slli_epi32(FloatsToHalves(in[kNodeDerivatives + 1]), 16));
+        out[kPackedZView] = _mm256_castps_si256(in[kNodeZView]);
+        out[kPackedNormal] = _mm256_or_si256(FloatsToHalves(in[kNodeNormal]),
+                                             _mm256_slli_epi32(FloatsToHalves(in[kNodeNormal + 1]), 16));
+        out[kPackedAlbedo] = albedo;
+        StorePackedWords(out, count - i, output + i);
+    }
+}
+
+void UnpackMergeNodesAvx2(const MergeNodePacked* input, size_t count, MergeNode* output)
+{
+    for (size_t i = 0; i < count; i += 8) {
+        const size_t lanes = count - i < 8 ? count - i : 8;
+        __m256i in[kPackedWords];
+        LoadPackedWords(input + i, count - i, in);
+
+        __m256 out[kNodeWords];
+        __m256 unused;
+        out[kNodeCoverage] = _mm256_castsi256_ps(_mm256_and_si256(in[kPackedCoverage], _mm256_set1_epi32(0xFFFF)));
+        HalvesToFloats(in[kPackedCoverage], unused, out[kNodeSpecular + 1]);
+        HalvesToFloats(in[kPackedDerivatives], out[kNodeDerivatives], out[kNodeDerivatives + 1]);
+        out[kNodeZView] = _mm256_castsi256_ps(in[kPackedZView]);
+        HalvesToFloats(in[kPackedNormal], out[kNodeNormal], out[kNodeNormal + 1]);
+        for (int c = 0; c < 3; ++c) {
+            out[kNodeAlbedo + c] = Unorm8ToFloats(_mm256_srli_epi32(in[kPackedAlbedo], c * 8));
+        }
+        out[kNodeAlbedo + 3] = _mm256_set1_ps(1.0f);
+        out[kNodeSpecular] = Unorm8ToFloats(_mm256_srli_epi32(in[kPackedAlbedo], 24));
+        StoreNodeWords(out, lanes, output + i);
+    }
+}
+
+} // namespace
+
+const FormatConvertFunctions kFormatConvertAvx2 = {
+    Float2ToR16G16FloatAvx2,
+    R16G16FloatToFloat2Avx2,
+    Float4ToR8G8B8A8UnormAvx2,
+    R8G8B8A8UnormToFloat4Avx2,
+    PackMergeNodesAvx2,
+    UnpackMergeNodesAvx2
+};
+
+} // namespace StreamingCpu
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // defined(STREAMINGCPU_X86)
@@ -0,0 +1,252 @@
+#include "FormatConvertSimd.h"
+#include <string.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+namespace {
+
+void Float2ToR16G16FloatScalar(const float* input, size_t count, unsigned* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = FLOAT2_to_R16G16_FLOAT(input + i * 2);
+    }
+}
+
+void R16G16FloatToFloat2Scalar(const unsigned* input, size_t count, float* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        R16G16_FLOAT_to_FLOAT2(input[i], output + i * 2);
+    }
+}
+
+void Float4ToR8G8B8A8UnormScalar(const float* input, size_t count, unsigned* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = FLOAT4_to_R8G8B8A8_UNORM(input + i * 4);
+    }
+}
+
+void R8G8B8A8UnormToFloat4Scalar(const unsigned* input, size_t count, float* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        R8G8B8A8_UNORM_to_FLOAT4(input[i], output + i * 4);
+    }
+}
+
+void PackMergeNodesScalar(const MergeNode* input, size_t count, MergeNodePacked* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = PackMergeNode(input[i]);
+    }
+}
+
+void UnpackMergeNodesScalar(const MergeNodePacked* input, size_t count, MergeNode* output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = UnpackMergeNode(input[i]);
+    }
+}
+
+const FormatConvertFunctions& gBestFunctions = GetFormatConvertFunctions(GetMaxSimdLevel());
+
+// xorshift32, so the check does not depend on rand()
+unsigned NextRandom(unsigned& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Floats around every place the conversions round: each half and the
+// midpoint to the next one, each 8 bit unorm step and the midpoint to the
+// next one, a few ulps either way and with either sign, then a sweep over the
+// whole bit range including NaNs and infinities.
+void GetCheckFloats(std::vector<float>& floats)
+{
+    std::vector<unsigned> bits;
+    for (unsigned h = 0; h < 0x7C00; ++h) {
+        const unsigned value = AsUint(F16ToF32(h));
+        const unsigned next = AsUint(F16ToF32(h + 1));
+        const unsigned midpoint = AsUint((F16ToF32(h) + F16ToF32(h + 1)) * 0.5f);
+        for (unsigned ulp = 0; ulp < 3; ++ulp) {
+            bits.push_back(value + ulp);
+            bits.push_back(midpoint - ulp);
+            bits.push_back(midpoint + ulp);
+            bits.push_back(next - ulp);
+        }
+    }
+    for (unsigned k = 0; k < 256; ++k) {
+        const unsigned midpoint = AsUint((k + 0.5f) / 255.0f);
+        const unsigned value = AsUint(k / 255.0f);
+        for (unsigned ulp = 0; ulp < 3; ++ulp) {
+            bits.push_back(midpoint - ulp);
+            bits.push_back(midpoint + ulp);
+            bits.push_back(value - ulp);
+            bits.push_back(value + ulp);
+        }
+    }
+    for (uint64_t b = 0; b <= 0xFFFFFFFFull; b += 4099) {
+        bits.push_back((unsigned)b);
+    }
+    const unsigned specials[] = { 0x00000000, 0x00000001, 0x007FFFFF, 0x00800000, 0x3F800000, 0x3F7FFFFF,
+                                  0x477FE000, 0x477FEFFF, 0x477FF000, 0x47800000, 0x7F7FFFFF, 0x7F800000,
+                                  0x7F800001, 0x7FC00000, 0x7FFFFFFF };
+    for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); ++i) {
+        bits.push_back(specials[i]);
+    }
+
+    floats.resize(bits.size() * 2);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        floats[i * 2] = AsFloat(bits[i]);
+        floats[i * 2 + 1] = AsFloat(bits[i] | 0x80000000);
+    }
+}
+
+template <typename T>
+void CompareBits(const std::vector<T>& values, const std::vector<T>& reference, size_t valueSize,
+                 FormatConvertCheck& check)
+{
+    const size_t count = values.size() * sizeof(T) / valueSize;
+    const unsigned char* a = (const unsigned char*)&values[0];
+    const unsigned char* b = (const unsigned char*)&reference[0];
+    for (size_t i = 0; i < count; ++i) {
+        check.mismatches += memcmp(a + i * valueSize, b + i * valueSize, valueSize) != 0 ? 1 : 0;
+    }
+    check.values += count;
+}
+
+} // namespace
+
+const FormatConvertFunctions kFormatConvertScalar = {
+    Float2ToR16G16FloatScalar,
+    R16G16FloatToFloat2Scalar,
+    Float4ToR8G8B8A8UnormScalar,
+    R8G8B8A8UnormToFloat4Scalar,
+    PackMergeNodesScalar,
+    UnpackMergeNodesScalar
+};
+
+const FormatConvertFunctions& GetFormatConvertFunctions(SimdLevel level)
+{
+    SimdLevel maxLevel = GetMaxSimdLevel();
+    if (level > maxLevel) {
+        level = maxLevel;
+    }
+
+    switch (level) {
+#if defined(STREAMINGCPU_X86)
+        case SIMD_LEVEL_AVX512:
+        case SIMD_LEVEL_AVX2: return kFormatConvertAvx2;
+#endif // defined(STREAMINGCPU_X86)
+        default: return kFormatConvertScalar;
+    }
+}
+
+void PackMergeNodes(const MergeNode* input, size_t count, MergeNodePacked* output)
+{
+    gBestFunctions.packMergeNodes(input, count, output);
+}
+
+void UnpackMergeNodes(const MergeNodePacked* input, size_t count, MergeNode* output)
+{
+    gBestFunctions.unpackMergeNodes(input, count, output);
+}
+
+void CheckFormatConvert(SimdLevel level, FormatConvertCheck& check)
+{
+    const FormatConvertFunctions& f = GetFormatConvertFunctions(level);
+    const FormatConvertFunctions& s = kFormatConvertScalar;
+
+    std::vector<float> floats;
+    GetCheckFloats(floats);
+    floats.resize(floats.size() / 4 * 4);
+
+    // Every half in both words, and every byte in every channel
+    std::vector<unsigned> words(1 << 16);
+    for (unsigned i = 0; i < words.size(); ++i) {
+        words[i] = i | (((i * 0x9E37u) & 0xFFFF) << 16);
+    }
+
+    // Odd lengths so the tails are covered too
+    std::vector<unsigned> packed[2];
+    std::vector<float> unpacked[2];
+    for (size_t length = floats.size() / 2 - 5; length <= floats.size() / 2; length += 5) {
+        packed[0].resize(length);
+        packed[1].resize(length);
+        f.float2ToR16G16Float(&floats[0], length, &packed[0][0]);
+        s.float2ToR16G16Float(&floats[0], length, &packed[1][0]);
+        CompareBits(packed[0], packed[1], sizeof(unsigned), check);
+    }
+    for (size_t length = floats.size() / 4 - 9; length <= floats.size() / 4; length += 9) {
+        packed[0].resize(length);
+        packed[1].resize(length);
+        f.float4ToR8G8B8A8Unorm(&floats[0], length, &packed[0][0]);
+        s.float4ToR8G8B8A8Unorm(&floats[0], length, &packed[1][0]);
+        CompareBits(packed[0], packed[1], sizeof(unsigned), check);
+    }
+    for (size_t length = words.size() - 3; length <= words.size(); length += 3) {
+        unpacked[0].resize(length * 2);
+        unpacked[1].resize(length * 2);
+        f.r16G16FloatToFloat2(&words[0], length, &unpacked[0][0]);
+        s.r16G16FloatToFloat2(&words[0], length, &unpacked[1][0]);
+        CompareBits(unpacked[0], unpacked[1], sizeof(float), check);
+
+        unpacked[0].resize(length * 4);
+        unpacked[1].resize(length * 4);
+        f.r8G8B8A8UnormToFloat4(&words[0], length, &unpacked[0][0]);
+        s.r8G8B8A8UnormToFloat4(&words[0], length, &unpacked[1][0]);
+        CompareBits(unpacked[0], unpacked[1], sizeof(float), check);
+    }
+
+    // Nodes built from the same values, in batches of 1 to 17
+    unsigned state = 0x2545F491;
+    std::vector<MergeNode> nodes(floats.size() / 8);
+    std::vector<MergeNodePacked> packedNodes[2];
+    packedNodes[0].resize(nodes.size());
+    packedNodes[1].resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const float* v = &floats[i * 8];
+        MergeNode& merge = nodes[i];
+        merge.coverage = NextRandom(state) & 0xFFFF;
+        merge.zViewDerivatives[0] = v[0];
+        merge.zViewDerivatives[1] = v[1];
+        merge.zView = v[2];
+        merge.normal[0] = v[3];
+        merge.normal[1] = v[4];
+        merge.shade.albedo[0] = v[5];
+        merge.shade.albedo[1] = v[6];
+        merge.shade.albedo[2] = v[7];
+        merge.shade.albedo[3] = 1.0f;
+        merge.shade.specular[0] = floats[(i * 8 + 11) % floats.size()];
+        merge.shade.specular[1] = floats[(i * 8 + 13) % floats.size()];
+    }
+    for (size_t i = 0; i < nodes.size();) {
+        size_t batch = 1 + NextRandom(state) % 17;
+        batch = batch < nodes.size() - i ? batch : nodes.size() - i;
+        f.packMergeNodes(&nodes[i], batch, &packedNodes[0][i]);
+        s.packMergeNodes(&nodes[i], batch, &packedNodes[1][i]);
+        i += batch;
+    }
+    CompareBits(packedNodes[0], packedNodes[1], sizeof(MergeNodePacked), check);
+
+    // Random words unpack to the same nodes
+    std::vector<MergeNode> unpackedNodes[2];
+    unpackedNodes[0].resize(nodes.size());
+    unpackedNodes[1].resize(nodes.size());
+    unsigned* randomWords = (unsigned*)&packedNodes[0][0];
+    for (size_t i = 0; i < nodes.size() * sizeof(MergeNodePacked) / sizeof(unsigned); ++i) {
+        randomWords[i] = NextRandom(state);
+    }
+    for (size_t i = 0; i < nodes.size();) {
+        size_t batch = 1 + NextRandom(state) % 17;
+        batch = batch < nodes.size() - i ? batch : nodes.size() - i;
+        f.unpackMergeNodes(&packedNodes[0][i], batch, &unpackedNodes[0][i]);
+        s.unpackMergeNodes(&packedNodes[0][i], batch, &unpackedNodes[1][i]);
+        i += batch;
+    }
+    CompareBits(unpackedNodes[0], unpackedNodes[1], sizeof(MergeNode), check);
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,56 @@
+#ifndef STREAMINGCPU_FORMATCONVERTSIMD_H
+#define STREAMINGCPU_FORMATCONVERTSIMD_H
+
+// Array versions of the FormatConvert.h conversions and of PackMergeNode()
+// and UnpackMergeNode(), for the CPU tools that go over many nodes at once.
+// The AVX2 level converts 8 values at a time with F16C for the halves and
+// gives the same bits as the scalar functions, NaNs and denormals included.
+// CheckFormatConvert() compares the two on every half and on the rounding
+// boundaries of every half and 8 bit unorm. F16C is VEX encoded like AVX2,
+// so there is no separate SSE level; AVX-512 uses the AVX2 functions.
+
+#include "CpuFeatures.h"
+#include "MergeNodeCodec.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace StreamingCpu {
+
+// count is in packed words and nodes. The float arrays hold 2 or 4 floats per
+// word, like the arguments of the D3DX helpers.
+struct FormatConvertFunctions
+{
+    void (*float2ToR16G16Float)(const float* input, size_t count, unsigned* output);
+    void (*r16G16FloatToFloat2)(const unsigned* input, size_t count, float* output);
+    void (*float4ToR8G8B8A8Unorm)(const float* input, size_t count, unsigned* output);
+    void (*r8G8B8A8UnormToFloat4)(const unsigned* input, size_t count, float* output);
+    void (*packMergeNodes)(const MergeNode* input, size_t count, MergeNodePacked* output);
+    void (*unpackMergeNodes)(const MergeNodePacked* input, size_t count, MergeNode* output);
+};
+
+extern const FormatConvertFunctions kFormatConvertScalar;
+#if defined(STREAMINGCPU_X86)
+extern const FormatConvertFunctions kFormatConvertAvx2;
+#endif // defined(STREAMINGCPU_X86)
+
+// Falls back to the best supported level below the one requested
+const FormatConvertFunctions& GetFormatConvertFunctions(SimdLevel level);
+
+// With the best level the CPU supports, picked once at startup
+void PackMergeNodes(const MergeNode* input, size_t count, MergeNodePacked* output);
+void UnpackMergeNodes(const MergeNodePacked* input, size_t count, MergeNode* output);
+
+struct FormatConvertCheck
+{
+    uint64_t values;            // conversions compared
+    uint64_t mismatches;        // results whose bits differ from the scalar level
+
+    FormatConvertCheck() : values(0), mismatches(0) {}
+};
+
+// Every function of level against the scalar ones
+void CheckFormatConvert(SimdLevel level, FormatConvertCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_FORMATCONVERTSIMD_H
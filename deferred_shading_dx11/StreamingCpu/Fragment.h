@@ -0,0 +1,43 @@
+#ifndef STREAMINGCPU_FRAGMENT_H
+#define STREAMINGCPU_FRAGMENT_H
+
+#include "MergeNodeCodec.h"
+
+namespace StreamingCpu {
+
+// Everything StreamingGBufferPS knows about a fragment before it enters the
+// ordered section.
+struct Fragment
+{
+    unsigned short x;
+    unsigned short y;
+    unsigned coverage;          // SV_Coverage
+    float zView;
+    float zViewDerivatives[2];  // ddx_fine, ddy_fine of zView
+    float normal[2];            // sphere map encoded
+    float albedo[4];
+    float specular[2];
+};
+
+// Builds the incoming MergeNode the same way the start of StreamingGBufferPS does.
+inline MergeNode GetIncomingMergeNode(const Fragment& fragment)
+{
+    MergeNode merge = GetEmptyMergeNode();
+    SetCoverage(merge, fragment.coverage);
+    SetDepthTestedCoverage(merge, fragment.coverage);
+    merge.zView = fragment.zView;
+    merge.zViewDerivatives[0] = fragment.zViewDerivatives[0];
+    merge.zViewDerivatives[1] = fragment.zViewDerivatives[1];
+    merge.normal[0] = fragment.normal[0];
+    merge.normal[1] = fragment.normal[1];
+    for (int i = 0; i < 4; ++i) {
+        merge.shade.albedo[i] = fragment.albedo[i];
+    }
+    merge.shade.specular[0] = fragment.specular[0];
+    merge.shade.specular[1] = fragment.specular[1];
+    return merge;
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_FRAGMENT_H
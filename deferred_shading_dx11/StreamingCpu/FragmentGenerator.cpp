@@ -0,0 +1,350 @@
+#include "FragmentGenerator.h"
+#include "SphereMap.h"
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+namespace StreamingCpu {
+
+// Vertices are snapped to 1/16 pixel, the unit the D3D sample positions use
+static const int kSubpixelBits = 4;
+static const int kSubpixel = 1 << kSubpixelBits;
+
+// Standard D3D11 sample positions in 1/16 pixel from the pixel center
+static const int kSamplePositions1[][2] = { { 0, 0 } };
+static const int kSamplePositions2[][2] = { { 4, 4 }, { -4, -4 } };
+static const int kSamplePositions4[][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+static const int kSamplePositions8[][2] = {
+    { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 }
+};
+
+static const float kMinDepth = 1.0f;
+static const float kMaxDepth = 100.0f;
+
+// Small and the same on every compiler, unlike the <random> distributions
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : mState(seed ? seed : 0x6D2B79F5u) {}
+
+    uint32_t NextUint()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    // [0, 1)
+    float NextFloat() { return (NextUint() >> 8) * (1.0f / 16777216.0f); }
+    float NextFloat(float low, float high) { return low + (high - low) * NextFloat(); }
+    unsigned NextUint(unsigned low, unsigned high) { return low + NextUint() % (high - low + 1); }
+
+private:
+    uint32_t mState;
+};
+
+struct Patch
+{
+    float origin[2];
+    float u[2];                 // one cell along each grid axis, in pixels
+    float v[2];
+    unsigned cellsU;
+    unsigned cellsV;
+    float depth;                // zView at origin
+    float depthGradient[2];     // per pixel
+    float normal[3];
+    float albedo[4];
+    float specular[2];
+};
+
+struct Rasterizer
+{
+    const FragmentGeneratorDesc* desc;
+    const int (*samples)[2];
+    Random* random;
+    std::vector<Fragment>* fragments;
+};
+
+static void Normalize(float v[3])
+{
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+}
+
+static int64_t EdgeFunction(const int a[2], const int b[2], int64_t x, int64_t y)
+{
+    return (int64_t)(b[0] - a[0]) * (y - a[1]) - (int64_t)(b[1] - a[1]) * (x - a[0]);
+}
+
+// Each shared edge is walked in opposite directions by its two triangles, so
+// exactly one of them owns samples that lie on it.
+static bool IsOwnedEdge(const int a[2], const int b[2])
+{
+    int dx = b[0] - a[0];
+    int dy = b[1] - a[1];
+    return dy > 0 || (dy == 0 && dx < 0);
+}
+
+static bool IsInside(const int v[3][2], const bool owned[3], int64_t x, int64_t y)
+{
+    for (int e = 0; e < 3; ++e) {
+        int64_t w = EdgeFunction(v[e], v[(e + 1) % 3], x, y);
+        if (w < 0 || (w == 0 && !owned[e])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void RasterizeTriangle(Rasterizer& r, const Patch& patch, const float positions[3][2], const float normal[3])
+{
+    const FragmentGeneratorDesc& desc = *r.desc;
+
+    int v[3][2];
+    for (int i = 0; i < 3; ++i) {
+        v[i][0] = (int)floorf(positions[i][0] * kSubpixel + 0.5f);
+        v[i][1] = (int)floorf(positions[i][1] * kSubpixel + 0.5f);
+    }
+    int64_t area = EdgeFunction(v[0], v[1], v[2][0], v[2][1]);
+    if (area == 0) {
+        return;
+    }
+    if (area < 0) {
+        std::swap(v[1][0], v[2][0]);
+        std::swap(v[1][1], v[2][1]);
+    }
+    bool owned[3];
+    for (int e = 0; e < 3; ++e) {
+        owned[e] = IsOwnedEdge(v[e], v[(e + 1) % 3]);
+    }
+
+    int minX = std::min(v[0][0], std::min(v[1][0], v[2][0])) >> kSubpixelBits;
+    int minY = std::min(v[0][1], std::min(v[1][1], v[2][1])) >> kSubpixelBits;
+    int maxX = std::max(v[0][0], std::max(v[1][0], v[2][0])) >> kSubpixelBits;
+    int maxY = std::max(v[0][1], std::max(v[1][1], v[2][1])) >> kSubpixelBits;
+    minX = std::max(minX, 0);
+    minY = std::max(minY, 0);
+    maxX = std::min(maxX, (int)desc.width - 1);
+    maxY = std::min(maxY, (int)desc.height - 1);
+
+    Fragment fragment;
+    EncodeSphereMap(normal, fragment.normal);
+    fragment.zViewDerivatives[0] = patch.depthGradient[0];
+    fragment.zViewDerivatives[1] = patch.depthGradient[1];
+    for (int i = 0; i < 4; ++i) {
+        fragment.albedo[i] = patch.albedo[i];
+    }
+    fragment.specular[0] = patch.specular[0];
+    fragment.specular[1] = patch.specular[1];
+
+    const unsigned allSamples = (1u << desc.msaaSamples) - 1;
+    for (int y = minY; y <= maxY; ++y) {
+        for (int x = minX; x <= maxX; ++x) {
+            const int64_t centerX = (int64_t)x * kSubpixel + kSubpixel / 2;
+            const int64_t centerY = (int64_t)y * kSubpixel + kSubpixel / 2;
+
+            unsigned coverage = 0;
+            if (desc.coveragePattern == COVERAGE_PATTERN_RASTER) {
+                for (unsigned s = 0; s < desc.msaaSamples; ++s) {
+                    if (IsInside(v, owned, centerX + r.samples[s][0], centerY + r.samples[s][1])) {
+                        coverage |= 1u << s;
+                    }
+                }
+            } else if (IsInside(v, owned, centerX, centerY)) {
+                coverage = allSamples;
+                if (desc.coveragePattern == COVERAGE_PATTERN_RANDOM) {
+                    coverage = r.random->NextUint() & allSamples;
+                    coverage = coverage ? coverage : 1u << (r.random->NextUint() % desc.msaaSamples);
+                }
+            }
+            if (coverage == 0) {
+                continue;
+            }
+
+            const float dx = x + 0.5f - patch.origin[0];
+            const float dy = y + 0.5f - patch.origin[1];
+            fragment.x = (unsigned short)x;
+            fragment.y = (unsigned short)y;
+            fragment.coverage = coverage;
+            fragment.zView = patch.depth + patch.depthGradient[0] * dx + patch.depthGradient[1] * dy;
+            r.fragments->push_back(fragment);
+        }
+    }
+}
+
+static void RasterizePatch(Rasterizer& r, const Patch& patch)
+{
+    const float jitter = r.desc->normalJitter;
+    for (unsigned j = 0; j < patch.cellsV; ++j) {
+        for (unsigned i = 0; i < patch.cellsU; ++i) {
+            float corners[4][2];
+            for (unsigned c = 0; c < 4; ++c) {
+                float a = (float)(i + (c & 1));
+                float b = (float)(j + (c >> 1));
+                corners[c][0] = patch.origin[0] + a * patch.u[0] + b * patch.v[0];
+                corners[c][1] = patch.origin[1] + a * patch.u[1] + b * patch.v[1];
+            }
+
+            static const int kTriangles[2][3] = { { 0, 1, 2 }, { 2, 1, 3 } };
+            for (int t = 0; t < 2; ++t) {
+                float positions[3][2];
+                for (int k = 0; k < 3; ++k) {
+                    positions[k][0] = corners[kTriangles[t][k]][0];
+                    positions[k][1] = corners[kTriangles[t][k]][1];
+                }
+                float normal[3];
+                for (int k = 0; k < 3; ++k) {
+                    normal[k] = patch.normal[k] + r.random->NextFloat(-jitter, jitter);
+                }
+                Normalize(normal);
+                RasterizeTriangle(r, patch, positions, normal);
+            }
+        }
+    }
+}
+
+static Patch GeneratePatch(const FragmentGeneratorDesc& desc, Random& random)
+{
+    Patch patch;
+    patch.cellsU = random.NextUint(1, desc.patchCells);
+    patch.cellsV = random.NextUint(1, desc.patchCells);
+
+    const float angle = random.NextFloat(0.0f, 6.2831853f);
+    patch.u[0] = desc.triangleSize * cosf(angle);
+    patch.u[1] = desc.triangleSize * sinf(angle);
+    patch.v[0] = -patch.u[1];
+    patch.v[1] = patch.u[0];
+
+    // Let patches hang over the edges so the borders get the same density
+    const float extent = desc.triangleSize * desc.patchCells;
+    patch.origin[0] = random.NextFloat(-extent, desc.width + extent);
+    patch.origin[1] = random.NextFloat(-extent, desc.height + extent);
+
+    // Tilted planes, but never so steep they cross the near plane
+    patch.depth = random.NextFloat(kMinDepth * 2.0f, kMaxDepth);
+    const float maxGradient = (patch.depth - kMinDepth) / (4.0f * extent);
+    patch.depthGradient[0] = random.NextFloat(-maxGradient, maxGradient);
+    patch.depthGradient[1] = random.NextFloat(-maxGradient, maxGradient);
+
+    // Facing the camera, which looks down +z
+    patch.normal[0] = random.NextFloat(-1.0f, 1.0f);
+    patch.normal[1] = random.NextFloat(-1.0f, 1.0f);
+    patch.normal[2] = -random.NextFloat(0.25f, 1.0f);
+    Normalize(patch.normal);
+
+    for (int i = 0; i < 3; ++i) {
+        patch.albedo[i] = random.NextFloat();
+    }
+    patch.albedo[3] = 1.0f;
+    patch.specular[0] = random.NextFloat();
+    patch.specular[1] = random.NextFloat(1.0f, 64.0f);
+    return patch;
+}
+
+struct PatchRange
+{
+    float depth;
+    size_t first;
+    size_t count;
+};
+
+static bool IsCloser(const PatchRange& a, const PatchRange& b)
+{
+    return a.depth < b.depth;
+}
+
+static bool IsFarther(const PatchRange& a, const PatchRange& b)
+{
+    return a.depth > b.depth;
+}
+
+bool GenerateFragments(const FragmentGeneratorDesc& desc, unsigned frame, std::vector<Fragment>& fragments)
+{
+    fragments.clear();
+
+    const int (*samples)[2] = 0;
+    switch (desc.msaaSamples) {
+        case 1: samples = kSamplePositions1; break;
+        case 2: samples = kSamplePositions2; break;
+        case 4: samples = kSamplePositions4; break;
+        case 8: samples = kSamplePositions8; break;
+        default: return false;
+    }
+    if (desc.width == 0 || desc.height == 0 || desc.width > 65536 || desc.height > 65536 ||
+        !(desc.depthComplexity > 0.0f) || !(desc.triangleSize >= 1.0f) || desc.patchCells == 0) {
+        return false;
+    }
+
+    Random random(desc.seed * 0x9E3779B9u ^ (desc.cameraPath ? 0u : (frame + 1) * 0x85EBCA6Bu));
+    const size_t target = (size_t)(desc.depthComplexity * desc.width * desc.height);
+
+    std::vector<Fragment> generated;
+    generated.reserve(target + target / 8);
+    Rasterizer r;
+    r.desc = &desc;
+    r.samples = samples;
+    r.random = &random;
+    r.fragments = &generated;
+
+    std::vector<PatchRange> patches;
+    while (generated.size() < target) {
+        Patch patch = GeneratePatch(desc, random);
+
+        // On a camera path each patch gets its own generator, so what it
+        // rasterizes on screen does not change the patches after it
+        Random patchRandom(desc.cameraPath ? random.NextUint() : 0);
+        if (desc.cameraPath) {
+            patch.origin[0] += desc.cameraPan[0] * frame;
+            patch.origin[1] += desc.cameraPan[1] * frame;
+            r.random = &patchRandom;
+        }
+
+        PatchRange range;
+        range.depth = patch.depth;
+        range.first = generated.size();
+        RasterizePatch(r, patch);
+        range.count = generated.size() - range.first;
+        if (range.count > 0) {
+            patches.push_back(range);
+        }
+    }
+
+    if (desc.patchOrder == PATCH_ORDER_RANDOM) {
+        fragments.swap(generated);
+        return true;
+    }
+
+    std::stable_sort(patches.begin(), patches.end(),
+                     desc.patchOrder == PATCH_ORDER_FRONT_TO_BACK ? IsCloser : IsFarther);
+    fragments.reserve(generated.size());
+    for (size_t i = 0; i < patches.size(); ++i) {
+        const Fragment* first = &generated[patches[i].first];
+        fragments.insert(fragments.end(), first, first + patches[i].count);
+    }
+    return true;
+}
+
+const char* GetCoveragePatternName(CoveragePattern pattern)
+{
+    switch (pattern) {
+        case COVERAGE_PATTERN_RASTER: return "raster";
+        case COVERAGE_PATTERN_FULL: return "full";
+        case COVERAGE_PATTERN_RANDOM: return "random";
+        default: return "unknown";
+    }
+}
+
+const char* GetPatchOrderName(PatchOrder order)
+{
+    switch (order) {
+        case PATCH_ORDER_RANDOM: return "random";
+        case PATCH_ORDER_FRONT_TO_BACK: return "front-to-back";
+        case PATCH_ORDER_BACK_TO_FRONT: return "back-to-front";
+        default: return "unknown";
+    }
+}
+
+} // namespace StreamingCpu
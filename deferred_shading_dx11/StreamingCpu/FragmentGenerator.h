@@ -0,0 +1,66 @@
+#ifndef STREAMINGCPU_FRAGMENTGENERATOR_H
+#define STREAMINGCPU_FRAGMENTGENERATOR_H
+
+// Synthetic fragment streams for running the merge without a scene. Surfaces
+// are planar patches tessellated into triangles that share edges, rasterized
+// with the D3D sample positions and top-left rule, so neighbouring triangles
+// produce the disjoint partial coverage that StreamingGBufferPS merges.
+
+#include "Fragment.h"
+#include <vector>
+
+namespace StreamingCpu {
+
+enum CoveragePattern
+{
+    COVERAGE_PATTERN_RASTER,    // sample coverage from the triangle edges
+    COVERAGE_PATTERN_FULL,      // every covered pixel gets all samples
+    COVERAGE_PATTERN_RANDOM,    // random sample subsets, like alpha to coverage
+};
+
+enum PatchOrder
+{
+    PATCH_ORDER_RANDOM,
+    PATCH_ORDER_FRONT_TO_BACK,
+    PATCH_ORDER_BACK_TO_FRONT,
+};
+
+struct FragmentGeneratorDesc
+{
+    unsigned width;
+    unsigned height;
+    unsigned msaaSamples;       // 1, 2, 4 or 8
+    float depthComplexity;      // fragments per pixel to generate
+    float triangleSize;         // triangle leg length in pixels
+    unsigned patchCells;        // patches are up to patchCells x patchCells quads
+    float normalJitter;         // per-triangle normal perturbation in radians
+    CoveragePattern coveragePattern;
+    PatchOrder patchOrder;
+    unsigned seed;
+
+    // Without a camera path every frame is a new scene. With one every frame
+    // draws the same patches in the same order, moved by cameraPan pixels
+    // per frame, like replaying a panning camera over a static scene. Only
+    // the patches at the end of the frame come and go with the coverage.
+    bool cameraPath;
+    float cameraPan[2];
+
+    FragmentGeneratorDesc()
+        : width(1920), height(1080), msaaSamples(4), depthComplexity(3.0f), triangleSize(8.0f)
+        , patchCells(8), normalJitter(0.1f), coveragePattern(COVERAGE_PATTERN_RASTER)
+        , patchOrder(PATCH_ORDER_RANDOM), seed(1), cameraPath(false)
+    {
+        cameraPan[0] = cameraPan[1] = 0.0f;
+    }
+};
+
+// Fragments of one frame in submission order. The same desc and frame always
+// give the same stream. Returns false for an unsupported desc.
+bool GenerateFragments(const FragmentGeneratorDesc& desc, unsigned frame, std::vector<Fragment>& fragments);
+
+const char* GetCoveragePatternName(CoveragePattern pattern);
+const char* GetPatchOrderName(PatchOrder order);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_FRAGMENTGENERATOR_H
@@ -0,0 +1,316 @@
+#include "FragmentTrace.h"
+#include "Lz4Block.h"
+#include <assert.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+static_assert(sizeof(Fragment) == 52, "FragmentTrace stores Fragment as is, bump FRAGMENT_TRACE_VERSION");
+static_assert(sizeof(FragmentTraceHeader) == 56, "unexpected padding");
+static_assert(sizeof(FragmentTraceChunkHeader) == 32, "unexpected padding");
+
+static const unsigned kChunkAlignment = 64;
+
+// Byte i of every fragment goes to plane i. Neighbouring fragments mostly
+// share high bytes, which LZ4 then finds as long runs.
+static void ShuffleFragments(const Fragment* fragments, size_t count, unsigned char* out)
+{
+    const unsigned char* in = (const unsigned char*)fragments;
+    for (size_t byte = 0; byte < sizeof(Fragment); ++byte) {
+        for (size_t i = 0; i < count; ++i) {
+            *out++ = in[i * sizeof(Fragment) + byte];
+        }
+    }
+}
+
+// Writes whole fragments in order so the output stays in cache
+static void UnshuffleFragments(const unsigned char* in, size_t count, Fragment* fragments)
+{
+    unsigned char* out = (unsigned char*)fragments;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t byte = 0; byte < sizeof(Fragment); ++byte) {
+            *out++ = in[byte * count + i];
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------
+FragmentTraceWriter::FragmentTraceWriter()
+    : mFile(0), mFailed(false), mCompression(FRAGMENT_TRACE_COMPRESSION_NONE)
+    , mFragmentsPerChunk(kDefaultFragmentsPerChunk), mFrameHasFragments(false), mOffset(0)
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+FragmentTraceWriter::~FragmentTraceWriter()
+{
+    Close();
+}
+
+bool FragmentTraceWriter::Open(const char* path, unsigned width, unsigned height, unsigned msaaSamples,
+                               FragmentTraceCompression compression, unsigned fragmentsPerChunk)
+{
+    Close();
+    assert(fragmentsPerChunk > 0);
+
+#if defined(_MSC_VER)
+    if (fopen_s(&mFile, path, "wb") != 0) {
+        mFile = 0;
+    }
+#else
+    mFile = fopen(path, "wb");
+#endif
+    if (!mFile) {
+        return false;
+    }
+
+    memset(&mHeader, 0, sizeof(mHeader));
+    mHeader.magic = FRAGMENT_TRACE_MAGIC;
+    mHeader.version = FRAGMENT_TRACE_VERSION;
+    mHeader.headerSize = sizeof(FragmentTraceHeader);
+    mHeader.fragmentSize = sizeof(Fragment);
+    mHeader.width = width;
+    mHeader.height = height;
+    mHeader.msaaSamples = msaaSamples;
+
+    mFailed = false;
+    mCompression = compression;
+    mFragmentsPerChunk = fragmentsPerChunk;
+    mFrameHasFragments = false;
+    mOffset = 0;
+    mPending.clear();
+    mPending.reserve(fragmentsPerChunk);
+    mChunkOffsets.clear();
+
+    // Placeholder, Close() writes the real header
+    FragmentTraceHeader empty;
+    memset(&empty, 0, sizeof(empty));
+    return WriteBytes(&empty, sizeof(empty));
+}
+
+bool FragmentTraceWriter::Write(const Fragment* fragments, size_t count)
+{
+    assert(mFile);
+    while (count > 0) {
+        size_t room = mFragmentsPerChunk - mPending.size();
+        size_t take = count < room ? count : room;
+        mPending.insert(mPending.end(), fragments, fragments + take);
+        fragments += take;
+        count -= take;
+        mFrameHasFragments = true;
+        if (mPending.size() == mFragmentsPerChunk && !FlushChunk()) {
+            return false;
+        }
+    }
+    return !mFailed;
+}
+
+bool FragmentTraceWriter::EndFrame()
+{
+    assert(mFile);
+    if (mFrameHasFragments) {
+        FlushChunk();
+    } else {
+        WriteChunk(FRAGMENT_TRACE_COMPRESSION_NONE, 0, 0, 0);
+    }
+    mHeader.frameCount++;
+    mFrameHasFragments = false;
+    return !mFailed;
+}
+
+bool FragmentTraceWriter::Close()
+{
+    if (!mFile) {
+        return false;
+    }
+    if (mFrameHasFragments) {
+        EndFrame();
+    }
+
+    mHeader.chunkCount = mChunkOffsets.size();
+    mHeader.chunkTableOffset = mOffset;
+    if (!mChunkOffsets.empty()) {
+        WriteBytes(&mChunkOffsets[0], mChunkOffsets.size() * sizeof(uint64_t));
+    }
+    if (fseek(mFile, 0, SEEK_SET) != 0 || fwrite(&mHeader, sizeof(mHeader), 1, mFile) != 1) {
+        mFailed = true;
+    }
+    if (fclose(mFile) != 0) {
+        mFailed = true;
+    }
+    mFile = 0;
+    return !mFailed;
+}
+
+bool FragmentTraceWriter::WriteBytes(const void* data, size_t size)
+{
+    if (!mFailed && fwrite(data, 1, size, mFile) != size) {
+        mFailed = true;
+    }
+    mOffset += size;
+    return !mFailed;
+}
+
+bool FragmentTraceWriter::FlushChunk()
+{
+    if (mPending.empty()) {
+        return !mFailed;
+    }
+
+    const size_t rawSize = mPending.size() * sizeof(Fragment);
+    const void* payload = &mPending[0];
+    size_t storedSize = rawSize;
+    FragmentTraceCompression compression = FRAGMENT_TRACE_COMPRESSION_NONE;
+
+    if (mCompression == FRAGMENT_TRACE_COMPRESSION_LZ4) {
+        mShuffled.resize(rawSize);
+        ShuffleFragments(&mPending[0], mPending.size(), &mShuffled[0]);
+        // Only keep the compressed chunk if it is actually smaller
+        mCompressed.resize(rawSize);
+        size_t compressedSize = Lz4Compress(&mShuffled[0], rawSize, &mCompressed[0], rawSize - 1);
+        if (compressedSize != 0) {
+            payload = &mCompressed[0];
+            storedSize = compressedSize;
+            compression = FRAGMENT_TRACE_COMPRESSION_LZ4;
+        }
+    }
+
+    WriteChunk(compression, (uint32_t)mPending.size(), payload, storedSize);
+    mHeader.fragmentCount += mPending.size();
+    mPending.clear();
+    return !mFailed;
+}
+
+void FragmentTraceWriter::WriteChunk(FragmentTraceCompression compression, uint32_t fragmentCount,
+                                     const void* payload, size_t storedSize)
+{
+    static const unsigned char zeros[kChunkAlignment] = { 0 };
+    size_t padding = (size_t)((kChunkAlignment - mOffset % kChunkAlignment) % kChunkAlignment);
+    WriteBytes(zeros, padding);
+
+    FragmentTraceChunkHeader chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.magic = FRAGMENT_TRACE_CHUNK_MAGIC;
+    chunk.compression = compression;
+    chunk.frame = mHeader.frameCount;
+    chunk.fragmentCount = fragmentCount;
+    chunk.storedSize = (uint32_t)storedSize;
+
+    mChunkOffsets.push_back(mOffset);
+    WriteBytes(&chunk, sizeof(chunk));
+    if (storedSize > 0) {
+        WriteBytes(payload, storedSize);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+FragmentTraceReader::FragmentTraceReader()
+{
+    Close();
+}
+
+void FragmentTraceReader::Close()
+{
+    mFile.Close();
+    memset(&mHeader, 0, sizeof(mHeader));
+    mChunks.clear();
+    mFrameFirstChunks.assign(1, 0);
+}
+
+bool FragmentTraceReader::Open(const char* path)
+{
+    Close();
+    if (!mFile.Open(path)) {
+        return false;
+    }
+
+    const unsigned char* data = mFile.GetData();
+    const uint64_t size = mFile.GetSize();
+    if (size < sizeof(FragmentTraceHeader)) {
+        Close();
+        return false;
+    }
+    memcpy(&mHeader, data, sizeof(mHeader));
+
+    const FragmentTraceHeader& h = mHeader;
+    bool valid = h.magic == FRAGMENT_TRACE_MAGIC && h.version == FRAGMENT_TRACE_VERSION &&
+                 h.headerSize >= sizeof(FragmentTraceHeader) && h.fragmentSize == sizeof(Fragment) &&
+                 h.chunkTableOffset >= h.headerSize && h.chunkTableOffset <= size &&
+                 h.chunkCount <= (size - h.chunkTableOffset) / sizeof(uint64_t);
+    if (!valid) {
+        Close();
+        return false;
+    }
+
+    mChunks.resize((size_t)h.chunkCount);
+    mFrameFirstChunks.clear();
+    uint64_t fragmentCount = 0;
+    for (size_t i = 0; i < mChunks.size(); ++i) {
+        uint64_t offset;
+        memcpy(&offset, data + h.chunkTableOffset + i * sizeof(uint64_t), sizeof(offset));
+        if (offset % kChunkAlignment != 0 || offset < h.headerSize ||
+            offset + sizeof(FragmentTraceChunkHeader) > h.chunkTableOffset) {
+            Close();
+            return false;
+        }
+
+        // Frames follow each other without gaps, starting at 0
+        const FragmentTraceChunkHeader* chunk = (const FragmentTraceChunkHeader*)(data + offset);
+        const uint64_t rawSize = (uint64_t)chunk->fragmentCount * sizeof(Fragment);
+        bool chunkValid = chunk->magic == FRAGMENT_TRACE_CHUNK_MAGIC &&
+                          chunk->storedSize <= h.chunkTableOffset - offset - sizeof(FragmentTraceChunkHeader) &&
+                          chunk->frame < h.frameCount &&
+                          (i == 0 ? chunk->frame == 0 : chunk->frame == mChunks[i - 1]->frame ||
+                                                        chunk->frame == mChunks[i - 1]->frame + 1);
+        if (chunkValid && chunk->compression == FRAGMENT_TRACE_COMPRESSION_NONE) {
+            chunkValid = chunk->storedSize == rawSize;
+        } else if (chunkValid) {
+            // Also keeps a corrupt count from sizing the decode buffers
+            chunkValid = chunk->compression == FRAGMENT_TRACE_COMPRESSION_LZ4 && chunk->fragmentCount > 0 &&
+                         rawSize <= Lz4DecompressBound(chunk->storedSize);
+        }
+        if (!chunkValid) {
+            Close();
+            return false;
+        }
+
+        if (i == 0 || chunk->frame != mChunks[i - 1]->frame) {
+            mFrameFirstChunks.push_back((unsigned)i);
+        }
+        mChunks[i] = chunk;
+        fragmentCount += chunk->fragmentCount;
+    }
+
+    // Every frame of the header needs a chunk
+    if (mFrameFirstChunks.size() != h.frameCount) {
+        Close();
+        return false;
+    }
+    mFrameFirstChunks.push_back((unsigned)mChunks.size());
+
+    if (fragmentCount != h.fragmentCount) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+const Fragment* FragmentTraceReader::GetChunkFragments(unsigned chunkIndex, FragmentTraceScratch& scratch) const
+{
+    const FragmentTraceChunkHeader& chunk = *mChunks[chunkIndex];
+    const unsigned char* payload = (const unsigned char*)(&chunk + 1);
+    if (chunk.compression == FRAGMENT_TRACE_COMPRESSION_NONE) {
+        return (const Fragment*)payload;
+    }
+
+    const size_t rawSize = (size_t)chunk.fragmentCount * sizeof(Fragment);
+    scratch.shuffled.resize(rawSize);
+    scratch.fragments.resize(chunk.fragmentCount);
+    if (!Lz4Decompress(payload, chunk.storedSize, &scratch.shuffled[0], rawSize)) {
+        return 0;
+    }
+    UnshuffleFragments(&scratch.shuffled[0], chunk.fragmentCount, &scratch.fragments[0]);
+    return &scratch.fragments[0];
+}
+
+} // namespace StreamingCpu
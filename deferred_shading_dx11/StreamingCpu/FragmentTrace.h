@@ -0,0 +1,159 @@
+#ifndef STREAMINGCPU_FRAGMENTTRACE_H
+#define STREAMINGCPU_FRAGMENTTRACE_H
+
+// Binary capture of the fragment stream that feeds StreamingGBufferPS, so it
+// can be replayed into any merge implementation without rendering.
+//
+// Layout (little endian):
+//   FragmentTraceHeader
+//   chunks, each a FragmentTraceChunkHeader followed by its payload and
+//     starting on a 64 byte boundary
+//   chunk table, one uint64_t file offset per chunk
+//
+// A chunk holds fragments of one frame in submission order. Every frame has
+// at least one chunk, a frame without fragments an empty one, so the chunk
+// table accounts for every frame of the header. Uncompressed
+// payloads are Fragment arrays that the reader hands out straight from the
+// mapping. Compressed payloads are byte shuffled (byte i of every fragment
+// together) and then LZ4 block compressed. The header is written last so an
+// interrupted capture fails to open.
+
+#include "Fragment.h"
+#include "MappedFile.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+enum
+{
+    FRAGMENT_TRACE_MAGIC = 0x54464753,          // "SGFT"
+    FRAGMENT_TRACE_CHUNK_MAGIC = 0x4B4E4843,    // "CHNK"
+    FRAGMENT_TRACE_VERSION = 1
+};
+
+enum FragmentTraceCompression
+{
+    FRAGMENT_TRACE_COMPRESSION_NONE = 0,
+    FRAGMENT_TRACE_COMPRESSION_LZ4 = 1,
+};
+
+struct FragmentTraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(FragmentTraceHeader), for later versions to grow it
+    uint32_t fragmentSize;      // sizeof(Fragment)
+    uint32_t width;
+    uint32_t height;
+    uint32_t msaaSamples;
+    uint32_t frameCount;
+    uint64_t fragmentCount;
+    uint64_t chunkCount;
+    uint64_t chunkTableOffset;
+};
+
+struct FragmentTraceChunkHeader
+{
+    uint32_t magic;
+    uint32_t compression;       // FragmentTraceCompression
+    uint32_t frame;
+    uint32_t fragmentCount;
+    uint32_t storedSize;        // payload bytes following this header
+    uint32_t reserved[3];
+};
+
+class FragmentTraceWriter
+{
+public:
+    enum { kDefaultFragmentsPerChunk = 16384 };
+
+    FragmentTraceWriter();
+    ~FragmentTraceWriter();
+
+    bool Open(const char* path, unsigned width, unsigned height, unsigned msaaSamples,
+              FragmentTraceCompression compression = FRAGMENT_TRACE_COMPRESSION_NONE,
+              unsigned fragmentsPerChunk = kDefaultFragmentsPerChunk);
+
+    // Appends to the current frame.
+    bool Write(const Fragment* fragments, size_t count);
+
+    // Later fragments belong to the next frame.
+    bool EndFrame();
+
+    // Ends the current frame if it has fragments, then writes the chunk table
+    // and header. Returns false if any write failed along the way.
+    bool Close();
+
+    bool IsOpen() const { return mFile != 0; }
+
+private:
+    // Not implemented
+    FragmentTraceWriter(const FragmentTraceWriter&);
+    FragmentTraceWriter& operator=(const FragmentTraceWriter&);
+
+    bool FlushChunk();
+    void WriteChunk(FragmentTraceCompression compression, uint32_t fragmentCount,
+                    const void* payload, size_t storedSize);
+    bool WriteBytes(const void* data, size_t size);
+
+    FILE* mFile;
+    bool mFailed;
+    FragmentTraceHeader mHeader;
+    FragmentTraceCompression mCompression;
+    unsigned mFragmentsPerChunk;
+    bool mFrameHasFragments;
+    uint64_t mOffset;
+
+    std::vector<Fragment> mPending;
+    std::vector<uint64_t> mChunkOffsets;
+    std::vector<unsigned char> mShuffled;
+    std::vector<unsigned char> mCompressed;
+};
+
+// Per-thread decode buffers for FragmentTraceReader::GetChunkFragments
+struct FragmentTraceScratch
+{
+    std::vector<Fragment> fragments;
+    std::vector<unsigned char> shuffled;
+};
+
+class FragmentTraceReader
+{
+public:
+    FragmentTraceReader();
+
+    // Validates the header, chunk table and every chunk header against the
+    // file size, so chunk access afterwards only fails on corrupt payloads.
+    bool Open(const char* path);
+    void Close();
+
+    const FragmentTraceHeader& GetHeader() const { return mHeader; }
+    unsigned GetChunkCount() const { return (unsigned)mChunks.size(); }
+    const FragmentTraceChunkHeader& GetChunkHeader(unsigned chunk) const { return *mChunks[chunk]; }
+
+    // Chunks of frame are [GetFrameFirstChunk(frame), GetFrameFirstChunk(frame + 1))
+    unsigned GetFrameCount() const { return (unsigned)mFrameFirstChunks.size() - 1; }
+    unsigned GetFrameFirstChunk(unsigned frame) const { return mFrameFirstChunks[frame]; }
+
+    // Uncompressed chunks point into the mapping, others are decoded into
+    // scratch. Returns 0 for a corrupt chunk. Thread safe as long as each
+    // thread passes its own scratch.
+    const Fragment* GetChunkFragments(unsigned chunk, FragmentTraceScratch& scratch) const;
+
+private:
+    // Not implemented
+    FragmentTraceReader(const FragmentTraceReader&);
+    FragmentTraceReader& operator=(const FragmentTraceReader&);
+
+    MappedFile mFile;
+    FragmentTraceHeader mHeader;
+    std::vector<const FragmentTraceChunkHeader*> mChunks;
+    std::vector<unsigned> mFrameFirstChunks;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_FRAGMENTTRACE_H
@@ -0,0 +1,462 @@
+#include "GBufferSnapshot.h"
+#include "Lz4Block.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+static_assert(sizeof(MergeNodePacked) == 20, "GBufferSnapshot stores MergeNodePacked as is, bump GBUFFER_SNAPSHOT_VERSION");
+static_assert(offsetof(MergeNodePacked, coverage) == 0 && offsetof(MergeNodePacked, zViewDerivatives) == 4 &&
+              offsetof(MergeNodePacked, zView) == 8 && offsetof(MergeNodePacked, normal) == 12 &&
+              offsetof(MergeNodePacked, albedo) == 16, "residuals are taken word by word");
+static_assert(sizeof(GBufferSnapshotHeader) == 200, "unexpected padding");
+static_assert(sizeof(GBufferSnapshotTileHeader) == 16, "unexpected padding");
+
+static const unsigned kTileAlignment = 64;
+static const unsigned kNodeWords = sizeof(MergeNodePacked) / sizeof(uint32_t);
+
+// Pixel bytes keep the nodes behind them 4 byte aligned
+static size_t GetPixelBytesSize(unsigned pixels)
+{
+    return (pixels + 3) & ~3u;
+}
+
+static inline uint32_t SubtractHalves(uint32_t a, uint32_t b)
+{
+    return ((a - b) & 0xFFFF) | (((a >> 16) - (b >> 16)) << 16);
+}
+
+static inline uint32_t AddHalves(uint32_t a, uint32_t b)
+{
+    return ((a + b) & 0xFFFF) | (((a >> 16) + (b >> 16)) << 16);
+}
+
+static inline uint32_t SubtractBytes(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0;
+    for (unsigned i = 0; i < 32; i += 8) {
+        result |= (((a >> i) - (b >> i)) & 0xFF) << i;
+    }
+    return result;
+}
+
+static inline uint32_t AddBytes(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0;
+    for (unsigned i = 0; i < 32; i += 8) {
+        result |= (((a >> i) + (b >> i)) & 0xFF) << i;
+    }
+    return result;
+}
+
+// Words in MergeNodePacked order: coverage, zViewDerivatives, zView, normal, albedo.
+// zView goes through as bits so NaN payloads survive.
+static void GetResidual(const uint32_t* node, const uint32_t* predicted, uint32_t* residual)
+{
+    residual[0] = node[0] ^ predicted[0];
+    residual[1] = SubtractHalves(node[1], predicted[1]);
+    residual[2] = node[2] - predicted[2];
+    residual[3] = SubtractHalves(node[3], predicted[3]);
+    residual[4] = SubtractBytes(node[4], predicted[4]);
+}
+
+static void AddResidual(const uint32_t* residual, const uint32_t* predicted, uint32_t* node)
+{
+    node[0] = residual[0] ^ predicted[0];
+    node[1] = AddHalves(residual[1], predicted[1]);
+    node[2] = residual[2] + predicted[2];
+    node[3] = AddHalves(residual[3], predicted[3]);
+    node[4] = AddBytes(residual[4], predicted[4]);
+}
+
+// Fills firstNodes from the pixel bytes. Returns the node count, or ~0u if a
+// pixel has more than surfacesPerPixel nodes.
+static unsigned GetFirstNodes(const uint8_t* pixels, unsigned pixelCount, unsigned surfacesPerPixel,
+                              unsigned* firstNodes)
+{
+    unsigned nodeCount = 0;
+    for (unsigned p = 0; p < pixelCount; ++p) {
+        unsigned count = pixels[p] & GBUFFER_SNAPSHOT_COUNT_MASK;
+        if (count > surfacesPerPixel) {
+            return ~0u;
+        }
+        firstNodes[p] = nodeCount;
+        nodeCount += count;
+    }
+    return nodeCount;
+}
+
+// Node the one at list position k of pixel (x, y) is predicted from, or
+// node itself for the first node of the tile (predicted from zero)
+static unsigned GetPredictorNode(const uint8_t* pixels, const unsigned* firstNodes, unsigned width,
+                                 unsigned x, unsigned y, unsigned k, unsigned node)
+{
+    const unsigned p = x + width * y;
+    if (x > 0 && (pixels[p - 1] & GBUFFER_SNAPSHOT_COUNT_MASK) > k) {
+        return firstNodes[p - 1] + k;
+    }
+    if (y > 0 && (pixels[p - width] & GBUFFER_SNAPSHOT_COUNT_MASK) > k) {
+        return firstNodes[p - width] + k;
+    }
+    return node > 0 ? node - 1 : node;
+}
+
+// Residual byte b of node i goes to plane b
+static void EncodeNodes(const uint8_t* pixels, const unsigned* firstNodes, unsigned width, unsigned height,
+                        const MergeNodePacked* nodes, unsigned nodeCount, unsigned char* out)
+{
+    static const uint32_t zero[kNodeWords] = { 0 };
+    unsigned node = 0;
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            unsigned count = pixels[x + width * y] & GBUFFER_SNAPSHOT_COUNT_MASK;
+            for (unsigned k = 0; k < count; ++k, ++node) {
+                unsigned predictor = GetPredictorNode(pixels, firstNodes, width, x, y, k, node);
+                uint32_t words[kNodeWords];
+                uint32_t predicted[kNodeWords];
+                uint32_t residual[kNodeWords];
+                memcpy(words, &nodes[node], sizeof(words));
+                memcpy(predicted, predictor == node ? zero : (const uint32_t*)&nodes[predictor], sizeof(predicted));
+                GetResidual(words, predicted, residual);
+
+                const unsigned char* bytes = (const unsigned char*)residual;
+                for (unsigned b = 0; b < sizeof(MergeNodePacked); ++b) {
+                    out[b * nodeCount + node] = bytes[b];
+                }
+            }
+        }
+    }
+}
+
+static void DecodeNodes(const uint8_t* pixels, const unsigned* firstNodes, unsigned width, unsigned height,
+                        const unsigned char* in, unsigned nodeCount, MergeNodePacked* nodes)
+{
+    static const uint32_t zero[kNodeWords] = { 0 };
+    unsigned node = 0;
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            unsigned count = pixels[x + width * y] & GBUFFER_SNAPSHOT_COUNT_MASK;
+            for (unsigned k = 0; k < count; ++k, ++node) {
+                uint32_t residual[kNodeWords];
+                unsigned char* bytes = (unsigned char*)residual;
+                for (unsigned b = 0; b < sizeof(MergeNodePacked); ++b) {
+                    bytes[b] = in[b * nodeCount + node];
+                }
+
+                unsigned predictor = GetPredictorNode(pixels, firstNodes, width, x, y, k, node);
+                uint32_t predicted[kNodeWords];
+                uint32_t words[kNodeWords];
+                memcpy(predicted, predictor == node ? zero : (const uint32_t*)&nodes[predictor], sizeof(predicted));
+                AddResidual(residual, predicted, words);
+                memcpy(&nodes[node], words, sizeof(words));
+            }
+        }
+    }
+}
+
+namespace {
+
+class SnapshotFile
+{
+public:
+    SnapshotFile() : mFile(0), mFailed(false), mOffset(0) {}
+    ~SnapshotFile() { Close(); }
+
+    bool Open(const char* path)
+    {
+#if defined(_MSC_VER)
+        if (fopen_s(&mFile, path, "wb") != 0) {
+            mFile = 0;
+        }
+#else
+        mFile = fopen(path, "wb");
+#endif
+        return mFile != 0;
+    }
+
+    bool Close()
+    {
+        if (mFile && fclose(mFile) != 0) {
+            mFailed = true;
+        }
+        mFile = 0;
+        return !mFailed;
+    }
+
+    void Write(const void* data, size_t size)
+    {
+        if (!mFailed && size > 0 && fwrite(data, 1, size, mFile) != size) {
+            mFailed = true;
+        }
+        mOffset += size;
+    }
+
+    void Align()
+    {
+        static const unsigned char zeros[kTileAlignment] = { 0 };
+        Write(zeros, (size_t)((kTileAlignment - mOffset % kTileAlignment) % kTileAlignment));
+    }
+
+    void WriteAt(uint64_t offset, const void* data, size_t size)
+    {
+        if (fseek(mFile, (long)offset, SEEK_SET) != 0 || fwrite(data, 1, size, mFile) != size) {
+            mFailed = true;
+        }
+    }
+
+    uint64_t GetOffset() const { return mOffset; }
+
+private:
+    // Not implemented
+    SnapshotFile(const SnapshotFile&);
+    SnapshotFile& operator=(const SnapshotFile&);
+
+    FILE* mFile;
+    bool mFailed;
+    uint64_t mOffset;
+};
+
+} // namespace
+
+//--------------------------------------------------------------------------------------
+bool WriteGBufferSnapshot(const char* path, const GBufferSnapshotDesc& desc, const GBufferSnapshotSource& source,
+                          GBufferSnapshotStats* stats)
+{
+    assert(desc.surfacesPerPixel >= 1 && desc.surfacesPerPixel <= GBUFFER_SNAPSHOT_COUNT_MASK);
+    SnapshotFile file;
+    if (!file.Open(path)) {
+        return false;
+    }
+
+    const unsigned tileDim = kGBufferSnapshotTileDim;
+    const unsigned tilesX = (desc.width + tileDim - 1) / tileDim;
+    const unsigned tilesY = (desc.height + tileDim - 1) / tileDim;
+
+    GBufferSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GBUFFER_SNAPSHOT_MAGIC;
+    header.version = GBUFFER_SNAPSHOT_VERSION;
+    header.headerSize = sizeof(GBufferSnapshotHeader);
+    header.nodeSize = sizeof(MergeNodePacked);
+    header.width = desc.width;
+    header.height = desc.height;
+    header.msaaSamples = desc.msaaSamples;
+    header.surfacesPerPixel = desc.surfacesPerPixel;
+    header.tileDim = tileDim;
+    header.tileCount = tilesX * tilesY;
+    header.camera = desc.camera;
+
+    // Placeholder, the real header goes in last
+    GBufferSnapshotHeader empty;
+    memset(&empty, 0, sizeof(empty));
+    file.Write(&empty, sizeof(empty));
+
+    std::vector<uint64_t> tileOffsets;
+    std::vector<unsigned char> raw;
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> compressed;
+    std::vector<unsigned> firstNodes(tileDim * tileDim);
+    std::vector<MergeNodePacked> nodes(tileDim * tileDim * desc.surfacesPerPixel);
+    GBufferSnapshotStats snapshotStats;
+
+    for (unsigned tileY = 0; tileY < tilesY; ++tileY) {
+        for (unsigned tileX = 0; tileX < tilesX; ++tileX) {
+            const unsigned startX = tileX * tileDim;
+            const unsigned startY = tileY * tileDim;
+            const unsigned width = desc.width - startX < tileDim ? desc.width - startX : tileDim;
+            const unsigned height = desc.height - startY < tileDim ? desc.height - startY : tileDim;
+            const unsigned pixelCount = width * height;
+            const size_t pixelBytesSize = GetPixelBytesSize(pixelCount);
+
+            // Pixel bytes, then the nodes in list order
+            raw.assign(pixelBytesSize, 0);
+            unsigned nodeCount = 0;
+            for (unsigned y = 0; y < height; ++y) {
+                for (unsigned x = 0; x < width; ++x) {
+                    bool discardedSamples = false;
+                    unsigned count = source.GetPixel(startX + x, startY + y, &nodes[nodeCount], discardedSamples);
+                    assert(count <= desc.surfacesPerPixel);
+                    raw[x + width * y] = (uint8_t)(count | (discardedSamples ? GBUFFER_SNAPSHOT_DISCARDED : 0));
+                    firstNodes[x + width * y] = nodeCount;
+                    nodeCount += count;
+                }
+            }
+            const size_t nodeBytes = nodeCount * sizeof(MergeNodePacked);
+            raw.resize(pixelBytesSize + nodeBytes);
+            if (nodeCount > 0) {
+                memcpy(&raw[pixelBytesSize], &nodes[0], nodeBytes);
+            }
+
+            const unsigned char* payload = &raw[0];
+            size_t storedSize = raw.size();
+            GBufferSnapshotCompression compression = GBUFFER_SNAPSHOT_COMPRESSION_NONE;
+            if (desc.compression == GBUFFER_SNAPSHOT_COMPRESSION_LZ4) {
+                encoded.resize(pixelCount + nodeBytes);
+                memcpy(&encoded[0], &raw[0], pixelCount);
+                if (nodeCount > 0) {
+                    EncodeNodes(&raw[0], &firstNodes[0], width, height, &nodes[0], nodeCount, &encoded[pixelCount]);
+                }
+                // Only keep the compressed tile if it is actually smaller
+                compressed.resize(raw.size());
+                size_t compressedSize = Lz4Compress(&encoded[0], encoded.size(), &compressed[0], raw.size() - 1);
+                if (compressedSize != 0) {
+                    payload = &compressed[0];
+                    storedSize = compressedSize;
+                    compression = GBUFFER_SNAPSHOT_COMPRESSION_LZ4;
+                    snapshotStats.compressedTiles++;
+                }
+            }
+
+            file.Align();
+            GBufferSnapshotTileHeader tile;
+            tile.magic = GBUFFER_SNAPSHOT_TILE_MAGIC;
+            tile.compression = compression;
+            tile.nodeCount = nodeCount;
+            tile.storedSize = (uint32_t)storedSize;
+            tileOffsets.push_back(file.GetOffset());
+            file.Write(&tile, sizeof(tile));
+            file.Write(payload, storedSize);
+
+            header.nodeCount += nodeCount;
+            snapshotStats.rawBytes += raw.size();
+        }
+    }
+
+    header.tileTableOffset = file.GetOffset();
+    file.Write(&tileOffsets[0], tileOffsets.size() * sizeof(uint64_t));
+    snapshotStats.nodes = header.nodeCount;
+    snapshotStats.fileBytes = file.GetOffset();
+    file.WriteAt(0, &header, sizeof(header));
+    if (stats) {
+        *stats = snapshotStats;
+    }
+    return file.Close();
+}
+
+//--------------------------------------------------------------------------------------
+GBufferSnapshotReader::GBufferSnapshotReader()
+{
+    Close();
+}
+
+void GBufferSnapshotReader::Close()
+{
+    mFile.Close();
+    memset(&mHeader, 0, sizeof(mHeader));
+    mTilesX = 0;
+    mTiles.clear();
+}
+
+bool GBufferSnapshotReader::Open(const char* path)
+{
+    Close();
+    if (!mFile.Open(path)) {
+        return false;
+    }
+
+    const unsigned char* data = mFile.GetData();
+    const uint64_t size = mFile.GetSize();
+    if (size < sizeof(GBufferSnapshotHeader)) {
+        Close();
+        return false;
+    }
+    memcpy(&mHeader, data, sizeof(mHeader));
+
+    const GBufferSnapshotHeader& h = mHeader;
+    bool valid = h.magic == GBUFFER_SNAPSHOT_MAGIC && h.version == GBUFFER_SNAPSHOT_VERSION &&
+                 h.headerSize >= sizeof(GBufferSnapshotHeader) && h.nodeSize == sizeof(MergeNodePacked) &&
+                 h.surfacesPerPixel >= 1 && h.surfacesPerPixel <= GBUFFER_SNAPSHOT_COUNT_MASK &&
+                 h.tileDim > 0 && h.tileDim <= 256 && h.width > 0 && h.height > 0 &&
+                 h.tileTableOffset >= h.headerSize && h.tileTableOffset <= size &&
+                 h.tileCount <= (size - h.tileTableOffset) / sizeof(uint64_t);
+    if (valid) {
+        mTilesX = (h.width + h.tileDim - 1) / h.tileDim;
+        valid = (uint64_t)mTilesX * ((h.height + h.tileDim - 1) / h.tileDim) == h.tileCount;
+    }
+    if (!valid) {
+        Close();
+        return false;
+    }
+
+    mTiles.resize(h.tileCount);
+    uint64_t nodeCount = 0;
+    for (unsigned i = 0; i < h.tileCount; ++i) {
+        uint64_t offset;
+        memcpy(&offset, data + h.tileTableOffset + i * sizeof(uint64_t), sizeof(offset));
+        if (offset % kTileAlignment != 0 || offset < h.headerSize ||
+            offset + sizeof(GBufferSnapshotTileHeader) > h.tileTableOffset) {
+            Close();
+            return false;
+        }
+
+        const GBufferSnapshotTileHeader* tile = (const GBufferSnapshotTileHeader*)(data + offset);
+        const unsigned startX = (i % mTilesX) * h.tileDim;
+        const unsigned startY = (i / mTilesX) * h.tileDim;
+        const unsigned pixelCount = (h.width - startX < h.tileDim ? h.width - startX : h.tileDim) *
+                                    (h.height - startY < h.tileDim ? h.height - startY : h.tileDim);
+        bool tileValid = tile->magic == GBUFFER_SNAPSHOT_TILE_MAGIC &&
+                         tile->storedSize <= h.tileTableOffset - offset - sizeof(GBufferSnapshotTileHeader) &&
+                         tile->nodeCount <= pixelCount * h.surfacesPerPixel;
+        if (tileValid && tile->compression == GBUFFER_SNAPSHOT_COMPRESSION_NONE) {
+            tileValid = tile->storedSize == GetPixelBytesSize(pixelCount) + tile->nodeCount * sizeof(MergeNodePacked);
+        } else if (tileValid) {
+            tileValid = tile->compression == GBUFFER_SNAPSHOT_COMPRESSION_LZ4;
+        }
+        if (!tileValid) {
+            Close();
+            return false;
+        }
+        mTiles[i] = tile;
+        nodeCount += tile->nodeCount;
+    }
+
+    if (nodeCount != h.nodeCount) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool GBufferSnapshotReader::GetTile(unsigned tileIndex, GBufferSnapshotScratch& scratch,
+                                    GBufferSnapshotTile& out) const
+{
+    const GBufferSnapshotTileHeader& tile = *mTiles[tileIndex];
+    const unsigned tileDim = mHeader.tileDim;
+    out.x = (tileIndex % mTilesX) * tileDim;
+    out.y = (tileIndex / mTilesX) * tileDim;
+    out.width = mHeader.width - out.x < tileDim ? mHeader.width - out.x : tileDim;
+    out.height = mHeader.height - out.y < tileDim ? mHeader.height - out.y : tileDim;
+    out.nodeCount = tile.nodeCount;
+
+    const unsigned pixelCount = out.width * out.height;
+    const unsigned char* payload = (const unsigned char*)(&tile + 1);
+    scratch.firstNodes.resize(pixelCount);
+    out.firstNodes = &scratch.firstNodes[0];
+    if (tile.compression == GBUFFER_SNAPSHOT_COMPRESSION_NONE) {
+        out.pixels = payload;
+        out.nodes = (const MergeNodePacked*)(payload + GetPixelBytesSize(pixelCount));
+        return GetFirstNodes(out.pixels, pixelCount, mHeader.surfacesPerPixel, &scratch.firstNodes[0]) ==
+               tile.nodeCount;
+    }
+
+    const size_t nodeBytes = tile.nodeCount * sizeof(MergeNodePacked);
+    scratch.payload.resize(pixelCount + nodeBytes);
+    if (!Lz4Decompress(payload, tile.storedSize, &scratch.payload[0], scratch.payload.size()) ||
+        GetFirstNodes(&scratch.payload[0], pixelCount, mHeader.surfacesPerPixel, &scratch.firstNodes[0]) !=
+        tile.nodeCount) {
+        return false;
+    }
+    out.pixels = &scratch.payload[0];
+    out.nodes = 0;
+    if (tile.nodeCount > 0) {
+        scratch.nodes.resize(tile.nodeCount);
+        DecodeNodes(out.pixels, &scratch.firstNodes[0], out.width, out.height, &scratch.payload[pixelCount],
+                    tile.nodeCount, &scratch.nodes[0]);
+        out.nodes = &scratch.nodes[0];
+    }
+    return true;
+}
+
+} // namespace StreamingCpu
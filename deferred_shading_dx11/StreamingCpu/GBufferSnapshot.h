@@ -0,0 +1,174 @@
+#ifndef STREAMINGCPU_GBUFFERSNAPSHOT_H
+#define STREAMINGCPU_GBUFFERSNAPSHOT_H
+
+// One frame of the streaming g-buffer as the resolve sees it, with the camera
+// it was rendered with, so lighting can be tried on captured frames without
+// rasterizing them again.
+//
+// Layout (little endian):
+//   GBufferSnapshotHeader
+//   tiles of kGBufferSnapshotTileDim^2 pixels in row-major tile order, each a
+//     GBufferSnapshotTileHeader followed by its payload and starting on a
+//     64 byte boundary
+//   tile table, one uint64_t file offset per tile
+//
+// A tile payload is one byte per pixel in row-major order (node count and
+// GBUFFER_SNAPSHOT_DISCARDED), padded to 4 bytes, then the MergeNodePacked
+// nodes of its pixels in list order. The reader hands uncompressed tiles out
+// straight from the mapping. Compressed tiles store the nodes as residuals
+// against a predicted node: the node at the same list position in the pixel
+// to the left, else above, else the node before it. zView is delta coded on
+// its bits, the half floats of normal and derivatives per half, albedo per
+// byte, and coverage is XORed. The residuals are byte shuffled behind the
+// pixel bytes and LZ4 block compressed. The header is written last so an
+// interrupted capture fails to open.
+//
+// This header only depends on the shader structs, so the app can include it.
+
+#include "../Shaders/StreamingStructs.h"
+#include "MappedFile.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+enum
+{
+    GBUFFER_SNAPSHOT_MAGIC = 0x53424753,        // "SGBS"
+    GBUFFER_SNAPSHOT_TILE_MAGIC = 0x454C4954,   // "TILE"
+    GBUFFER_SNAPSHOT_VERSION = 1,
+
+    GBUFFER_SNAPSHOT_COUNT_MASK = 0x0F,         // pixel byte: node count
+    GBUFFER_SNAPSHOT_DISCARDED = 0x80           // pixel byte: bit 9 of the count word
+};
+
+enum GBufferSnapshotCompression
+{
+    GBUFFER_SNAPSHOT_COMPRESSION_NONE = 0,
+    GBUFFER_SNAPSHOT_COMPRESSION_LZ4 = 1,       // predicted, shuffled and LZ4 compressed
+};
+
+// PerFrameConstants of the captured frame, D3DX row-major matrices
+struct GBufferSnapshotCamera
+{
+    float worldView[16];        // mCameraWorldView
+    float proj[16];             // mCameraProj
+    float nearFar[2];           // mCameraNearFar, far first for complementary Z
+    float reserved[2];
+};
+
+struct GBufferSnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;        // sizeof(GBufferSnapshotHeader), for later versions to grow it
+    uint32_t nodeSize;          // sizeof(MergeNodePacked)
+    uint32_t width;
+    uint32_t height;
+    uint32_t msaaSamples;
+    uint32_t surfacesPerPixel;
+    uint32_t tileDim;
+    uint32_t tileCount;
+    uint64_t nodeCount;
+    uint64_t tileTableOffset;
+    GBufferSnapshotCamera camera;
+};
+
+struct GBufferSnapshotTileHeader
+{
+    uint32_t magic;
+    uint32_t compression;       // GBufferSnapshotCompression
+    uint32_t nodeCount;
+    uint32_t storedSize;        // payload bytes following this header
+};
+
+// Pixels of the frame to capture
+class GBufferSnapshotSource
+{
+public:
+    virtual ~GBufferSnapshotSource() {}
+
+    // Copies the nodes of the pixel in list order, returns how many
+    virtual unsigned GetPixel(unsigned x, unsigned y, MergeNodePacked* nodes, bool& discardedSamples) const = 0;
+};
+
+struct GBufferSnapshotDesc
+{
+    unsigned width;
+    unsigned height;
+    unsigned msaaSamples;
+    unsigned surfacesPerPixel;
+    GBufferSnapshotCamera camera;
+    GBufferSnapshotCompression compression;
+};
+
+struct GBufferSnapshotStats
+{
+    uint64_t nodes;
+    uint64_t rawBytes;          // tile payloads uncompressed
+    uint64_t fileBytes;
+    unsigned compressedTiles;   // tiles that came out smaller compressed
+
+    GBufferSnapshotStats() : nodes(0), rawBytes(0), fileBytes(0), compressedTiles(0) {}
+};
+
+enum { kGBufferSnapshotTileDim = 16 };
+
+bool WriteGBufferSnapshot(const char* path, const GBufferSnapshotDesc& desc, const GBufferSnapshotSource& source,
+                          GBufferSnapshotStats* stats = 0);
+
+// A tile as the reader hands it out
+struct GBufferSnapshotTile
+{
+    unsigned x;                 // first pixel
+    unsigned y;
+    unsigned width;
+    unsigned height;
+    unsigned nodeCount;
+    const uint8_t* pixels;      // width * height pixel bytes
+    const unsigned* firstNodes; // index of the first node of each pixel
+    const MergeNodePacked* nodes;
+};
+
+// Per-thread decode buffers for GBufferSnapshotReader::GetTile
+struct GBufferSnapshotScratch
+{
+    std::vector<unsigned char> payload;
+    std::vector<unsigned> firstNodes;
+    std::vector<MergeNodePacked> nodes;
+};
+
+class GBufferSnapshotReader
+{
+public:
+    GBufferSnapshotReader();
+
+    // Validates the header, tile table and every tile header against the
+    // file size, so tile access afterwards only fails on corrupt payloads.
+    bool Open(const char* path);
+    void Close();
+
+    const GBufferSnapshotHeader& GetHeader() const { return mHeader; }
+    unsigned GetTileCount() const { return (unsigned)mTiles.size(); }
+    unsigned GetTilesX() const { return mTilesX; }
+
+    // Uncompressed tiles point into the mapping, others are decoded into
+    // scratch. Returns false for a corrupt tile. Thread safe as long as each
+    // thread passes its own scratch.
+    bool GetTile(unsigned tile, GBufferSnapshotScratch& scratch, GBufferSnapshotTile& out) const;
+
+private:
+    // Not implemented
+    GBufferSnapshotReader(const GBufferSnapshotReader&);
+    GBufferSnapshotReader& operator=(const GBufferSnapshotReader&);
+
+    MappedFile mFile;
+    GBufferSnapshotHeader mHeader;
+    unsigned mTilesX;
+    std::vector<const GBufferSnapshotTileHeader*> mTiles;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_GBUFFERSNAPSHOT_H
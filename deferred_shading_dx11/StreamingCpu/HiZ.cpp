@@ -0,0 +1,170 @@
+#include "HiZ.h"
+#include <assert.h>
+#include <algorithm>
+#include <string.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// MergeBuffers::Pixel that hands its occluders to the tiles
+template <unsigned SurfacesPerPixel>
+class HiZPixel
+{
+public:
+    typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+    HiZPixel(MergeBuffers& merge, HiZMergeBuffers& buffers, unsigned x, unsigned y)
+        : mPixel(merge, x, y), mBuffers(buffers), mX(x), mY(y) {}
+
+    unsigned GetNodeCount() const { return mPixel.GetNodeCount(); }
+    void SetNodeCount(unsigned value) { mPixel.SetNodeCount(value); }
+    unsigned GetNodeList() const { return mPixel.GetNodeList(); }
+    void SetNodeList(unsigned nodeList) { mPixel.SetNodeList(nodeList); }
+    MergeNode GetMergeNode(unsigned index) const { return mPixel.GetMergeNode(index); }
+    void SetMergeNode(unsigned index, const MergeNode& merge) { mPixel.SetMergeNode(index, merge); }
+    bool AllocatePoolBlock() { return mPixel.AllocatePoolBlock(); }
+    void SetDiscardedSamples(unsigned discardedSamples)
+    {
+        mPixel.SetDiscardedSamples(discardedSamples);
+        if (discardedSamples) {
+            mBuffers.RemoveOccluder(mX, mY);
+        }
+    }
+
+    void AddHiZOccluder(unsigned occluderCoverage, float occluderEnd)
+    {
+        mBuffers.AddOccluder(mX, mY, occluderCoverage, occluderEnd);
+    }
+
+    unsigned PredictNode(unsigned, float, float) const { return STREAMING_PREDICTION_LOAD; }
+
+private:
+    MergeBuffers::Pixel<SurfacesPerPixel> mPixel;
+    HiZMergeBuffers& mBuffers;
+    unsigned mX;
+    unsigned mY;
+};
+
+} // namespace
+
+template <unsigned SurfacesPerPixel>
+void HiZMergeBuffers::MergeFragments(HiZMergeBuffers& buffers, const Fragment* fragments, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const Fragment& fragment = fragments[i];
+        const MergeNode incoming = GetIncomingMergeNode(fragment);
+        MergeBuffers::Pixel<SurfacesPerPixel> pixel(buffers.mBuffers, fragment.x, fragment.y);
+        MergeFragment(pixel, incoming, buffers.mStats);
+
+        // StreamingGBufferPS tests the tile before the ordered section
+        float incomingMin, incomingMax;
+        GetDepthRange(incoming, incomingMin, incomingMax);
+        buffers.mHiZStats.fragments++;
+        if (buffers.Reject(fragment.x, fragment.y, incomingMin)) {
+            buffers.mHiZStats.rejected++;
+            continue;
+        }
+        HiZPixel<SurfacesPerPixel> hiZPixel(buffers.mHiZBuffers, buffers, fragment.x, fragment.y);
+        MergeFragment(hiZPixel, incoming, buffers.mHiZMergeStats);
+    }
+}
+
+HiZMergeBuffers::HiZMergeBuffers(unsigned width, unsigned height, unsigned msaaSamples,
+                                 unsigned surfacesPerPixel)
+    : mWidth(width), mHeight(height)
+    , mAllSamples((1u << msaaSamples) - 1)
+    , mTilesX((width + STREAMING_HIZ_TILE_DIM - 1) / STREAMING_HIZ_TILE_DIM)
+    , mTilesY((height + STREAMING_HIZ_TILE_DIM - 1) / STREAMING_HIZ_TILE_DIM)
+    , mBuffers(width, height, surfacesPerPixel)
+    , mHiZBuffers(width, height, surfacesPerPixel)
+    , mTiles((size_t)mTilesX * mTilesY)
+    , mOccludedPixels((size_t)width * height)
+{
+    assert(msaaSamples >= 1 && msaaSamples <= 8);
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+
+    // Indexed by surfacesPerPixel - 1
+    static const MergeFunction functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+        MergeFragments<1>, MergeFragments<2>, MergeFragments<3>, MergeFragments<4>,
+        MergeFragments<5>, MergeFragments<6>, MergeFragments<7>, MergeFragments<8>
+    };
+    mMergeFunction = functions[surfacesPerPixel - 1];
+}
+
+void HiZMergeBuffers::Merge(const Fragment* fragments, size_t fragmentCount)
+{
+    // What the app clears every frame
+    mBuffers.Clear();
+    mHiZBuffers.Clear();
+    HiZTile empty = {0, 0};
+    std::fill(mTiles.begin(), mTiles.end(), empty);
+    std::fill(mOccludedPixels.begin(), mOccludedPixels.end(), 0);
+
+    mMergeFunction(*this, fragments, fragmentCount);
+
+    for (unsigned y = 0; y < mTilesY; ++y) {
+        for (unsigned x = 0; x < mTilesX; ++x) {
+            unsigned pixelX = x * STREAMING_HIZ_TILE_DIM;
+            unsigned pixelY = y * STREAMING_HIZ_TILE_DIM;
+            mHiZStats.tiles++;
+            mHiZStats.occludedTiles += mTiles[x + mTilesX * y].occludedPixels == GetTilePixels(pixelX, pixelY);
+        }
+    }
+}
+
+unsigned HiZMergeBuffers::GetTilePixels(unsigned x, unsigned y) const
+{
+    // Tiles on the right and bottom edges may hold fewer pixels
+    unsigned startX = x - x % STREAMING_HIZ_TILE_DIM;
+    unsigned startY = y - y % STREAMING_HIZ_TILE_DIM;
+    const unsigned tileDim = STREAMING_HIZ_TILE_DIM;
+    return std::min(tileDim, mWidth - startX) * std::min(tileDim, mHeight - startY);
+}
+
+bool HiZMergeBuffers::Reject(unsigned x, unsigned y, float depth) const
+{
+    const HiZTile& tile = mTiles[GetTileIndex(x, y)];
+    float occluderEnd;
+    memcpy(&occluderEnd, &tile.occluderEnd, sizeof(occluderEnd));
+    return tile.occludedPixels == GetTilePixels(x, y) && depth > occluderEnd;
+}
+
+void HiZMergeBuffers::AddOccluder(unsigned x, unsigned y, unsigned occluderCoverage, float occluderEnd)
+{
+    // A pixel that discarded may have lost part of any occluder it had
+    uint8_t& occluded = mOccludedPixels[x + mWidth * y];
+    if ((occluderCoverage & mAllSamples) != mAllSamples || occluded || mHiZBuffers.GetDiscardedSamples(x, y)) {
+        return;
+    }
+    occluded = 1;
+
+    // View depths are positive, so their bits order like the floats
+    unsigned occluderEndBits;
+    memcpy(&occluderEndBits, &occluderEnd, sizeof(occluderEndBits));
+    HiZTile& tile = mTiles[GetTileIndex(x, y)];
+    tile.occluderEnd = std::max(tile.occluderEnd, occluderEndBits);
+    tile.occludedPixels++;
+    mHiZStats.occludedPixels++;
+}
+
+void HiZMergeBuffers::RemoveOccluder(unsigned x, unsigned y)
+{
+    uint8_t& occluded = mOccludedPixels[x + mWidth * y];
+    if (!occluded) {
+        return;
+    }
+    occluded = 0;
+
+    // The end stays, but the tile cannot fill up again this frame
+    mTiles[GetTileIndex(x, y)].occludedPixels--;
+    mHiZStats.withdrawnPixels++;
+}
+
+void CheckHiZ(const HiZMergeBuffers& buffers, unsigned msaaSamples, HiZCheck& check)
+{
+    CheckMergedBuffers(buffers.GetHiZBuffers(), buffers.GetBuffers(), msaaSamples, check);
+}
+
+} // namespace StreamingCpu
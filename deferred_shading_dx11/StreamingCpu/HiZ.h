@@ -0,0 +1,111 @@
+#ifndef STREAMINGCPU_HIZ_H
+#define STREAMINGCPU_HIZ_H
+
+// CPU model of STREAMING_HIZ. When OccluderFusion finds a node behind the
+// occluder it built and that occluder covers every sample, the pixel joins
+// its tile, whose occluder end is the largest of its pixels'. A fragment that
+// starts behind that end in a tile all of whose pixels have joined is
+// rejected before StreamingGBufferPS reads anything of the pixel. A pixel
+// that discards may have thrown away part of its occluder, so it leaves the
+// tile and cannot join again.
+//
+// Every frame is merged twice in submission order, once as is and once with
+// the rejection, so a tile sees the occluders of the fragments before it
+// like on the GPU. The merge occludes most rejected fragments anyway, but it
+// may also have averaged one into a hidden node or dropped a node to make
+// room for it; CheckHiZ counts the pixels where that changes what the
+// resolve sees, which must be none.
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include "ResolveWeights.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+struct HiZStats
+{
+    uint64_t fragments;
+    uint64_t rejected;          // fragments HiZReject turned away
+    uint64_t occludedPixels;    // pixels that joined their tile
+    uint64_t withdrawnPixels;   // pixels that left it again when they discarded
+    uint64_t tiles;
+    uint64_t occludedTiles;     // tiles all of whose pixels joined, at the end of the frame
+
+    HiZStats() : fragments(0), rejected(0), occludedPixels(0), withdrawnPixels(0), tiles(0), occludedTiles(0) {}
+};
+
+class HiZMergeBuffers
+{
+public:
+    // msaaSamples of 1 to 8, what the fragments were rasterized with
+    HiZMergeBuffers(unsigned width, unsigned height, unsigned msaaSamples,
+                    unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL);
+
+    unsigned GetTilesX() const { return mTilesX; }
+    unsigned GetTilesY() const { return mTilesY; }
+
+    // Merges a frame both ways, starting from empty buffers and tiles
+    void Merge(const Fragment* fragments, size_t fragmentCount);
+
+    // Buffers of the last frame without and with the rejection
+    const MergeBuffers& GetBuffers() const { return mBuffers; }
+    const MergeBuffers& GetHiZBuffers() const { return mHiZBuffers; }
+
+    // Totals over all frames
+    const MergeStats& GetStats() const { return mStats; }
+    const MergeStats& GetHiZMergeStats() const { return mHiZMergeStats; }
+    const HiZStats& GetHiZStats() const { return mHiZStats; }
+
+    // HiZReject from StreamingBuffers.hlsl
+    bool Reject(unsigned x, unsigned y, float depth) const;
+
+    // AddHiZOccluder from StreamingBuffers.hlsl
+    void AddOccluder(unsigned x, unsigned y, unsigned occluderCoverage, float occluderEnd);
+
+    // RemoveHiZOccluder from StreamingBuffers.hlsl
+    void RemoveOccluder(unsigned x, unsigned y);
+
+private:
+    // Not implemented
+    HiZMergeBuffers(const HiZMergeBuffers&);
+    HiZMergeBuffers& operator=(const HiZMergeBuffers&);
+
+    typedef void (*MergeFunction)(HiZMergeBuffers& buffers, const Fragment* fragments, size_t count);
+
+    template <unsigned SurfacesPerPixel>
+    static void MergeFragments(HiZMergeBuffers& buffers, const Fragment* fragments, size_t count);
+
+    unsigned GetTileIndex(unsigned x, unsigned y) const
+    {
+        return x / STREAMING_HIZ_TILE_DIM + mTilesX * (y / STREAMING_HIZ_TILE_DIM);
+    }
+    unsigned GetTilePixels(unsigned x, unsigned y) const;
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mAllSamples;
+    unsigned mTilesX;
+    unsigned mTilesY;
+    MergeFunction mMergeFunction;
+    MergeBuffers mBuffers;
+    MergeBuffers mHiZBuffers;
+    std::vector<HiZTile> mTiles;
+    std::vector<uint8_t> mOccludedPixels;   // STREAMING_HIZ_OCCLUDED_BIT of the count word
+    MergeStats mStats;
+    MergeStats mHiZMergeStats;
+    HiZStats mHiZStats;
+};
+
+// Last frame with the rejection against the one without
+typedef MergedBuffersCheck HiZCheck;
+
+// Call once per frame after Merge
+void CheckHiZ(const HiZMergeBuffers& buffers, unsigned msaaSamples, HiZCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_HIZ_H
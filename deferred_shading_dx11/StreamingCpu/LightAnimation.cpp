@@ -0,0 +1,166 @@
+#include "LightAnimation.h"
+#include "ThreadPool.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// Both lane widths
+enum { kLightStorePadding = 16 };
+
+// Constants of the lane kernels, see LightAnimationLanes.inl
+const float kInvTwoPi = 1.591549367e-01f;
+const float kTwoPiHi = 6.28125f;                // few enough bits that k * kTwoPiHi is exact
+const float kTwoPiLo = 1.935307169e-03f;
+const float kPi = 3.141592741e+00f;
+const float kHalfPi = 1.570796371e+00f;
+
+void SinCosScalar(float angle, float& sine, float& cosine)
+{
+    const float k = floorf(angle * kInvTwoPi + 0.5f);
+    float r = (angle - k * kTwoPiHi) - k * kTwoPiLo;
+    bool flip = false;
+    if (r > kHalfPi) {
+        r = kPi - r;
+        flip = true;
+    } else if (r < -kHalfPi) {
+        r = -kPi - r;
+        flip = true;
+    }
+
+    const float x2 = r * r;
+    float s = -2.505210839e-08f;
+    s = 2.755731922e-06f + x2 * s;
+    s = -1.984126984e-04f + x2 * s;
+    s = 8.333333333e-03f + x2 * s;
+    s = -1.666666667e-01f + x2 * s;
+    sine = r + (r * x2) * s;
+
+    float c = 2.087675699e-09f;
+    c = -2.755731922e-07f + x2 * c;
+    c = 2.480158730e-05f + x2 * c;
+    c = -1.388888889e-03f + x2 * c;
+    c = 4.166666667e-02f + x2 * c;
+    c = -5.000000000e-01f + x2 * c;
+    c = 1.0f + x2 * c;
+    cosine = flip ? 0.0f - c : c;
+}
+
+void AnimateScalar(const LightStoreLanes& lights, const LightAnimationFrame& frame, unsigned begin, unsigned end,
+                   PointLight* destination)
+{
+    const float* plane[LIGHT_STORE_PLANE_COUNT];
+    for (unsigned p = 0; p < LIGHT_STORE_PLANE_COUNT; ++p) {
+        plane[p] = lights.planes + (size_t)p * lights.stride;
+    }
+    const float (*m)[4] = frame.worldToView;
+
+    for (unsigned i = begin; i < end; ++i) {
+        float sine, cosine;
+        SinCosScalar(plane[LIGHT_STORE_ANGLE][i] + frame.time * plane[LIGHT_STORE_SPEED][i], sine, cosine);
+        const float world[3] = {
+            plane[LIGHT_STORE_RADIUS][i] * cosine,
+            plane[LIGHT_STORE_HEIGHT][i],
+            plane[LIGHT_STORE_RADIUS][i] * sine
+        };
+
+        PointLight light;
+        for (int j = 0; j < 3; ++j) {
+            light.positionView[j] = ((world[0] * m[0][j] + world[1] * m[1][j]) + world[2] * m[2][j]) + m[3][j];
+        }
+        light.attenuationBegin = plane[LIGHT_STORE_ATTENUATION_BEGIN][i];
+        light.color[0] = plane[LIGHT_STORE_COLOR_R][i];
+        light.color[1] = plane[LIGHT_STORE_COLOR_G][i];
+        light.color[2] = plane[LIGHT_STORE_COLOR_B][i];
+        light.attenuationEnd = plane[LIGHT_STORE_ATTENUATION_END][i];
+        destination[i] = light;
+    }
+}
+
+} // namespace
+
+const LightAnimationFunctions kLightAnimationScalar = {
+    AnimateScalar
+};
+
+const LightAnimationFunctions& GetLightAnimationFunctions(SimdLevel level)
+{
+    SimdLevel maxLevel = GetMaxSimdLevel();
+    if (level > maxLevel) {
+        level = maxLevel;
+    }
+
+    switch (level) {
+#if defined(STREAMINGCPU_AVX512)
+        case SIMD_LEVEL_AVX512: return kLightAnimationAvx512;
+#endif // defined(STREAMINGCPU_AVX512)
+#if defined(STREAMINGCPU_X86)
+        case SIMD_LEVEL_AVX2: return kLightAnimationAvx2;
+#endif // defined(STREAMINGCPU_X86)
+        default: return kLightAnimationScalar;
+    }
+}
+
+LightStore::LightStore()
+    : mCount(0), mStride(0)
+{
+}
+
+void LightStore::Resize(unsigned count)
+{
+    const unsigned stride = (count + kLightStorePadding - 1) / kLightStorePadding * kLightStorePadding;
+    std::vector<float> planes((size_t)LIGHT_STORE_PLANE_COUNT * stride, 0.0f);
+    const unsigned kept = count < mCount ? count : mCount;
+    for (unsigned p = 0; p < LIGHT_STORE_PLANE_COUNT && kept > 0; ++p) {
+        memcpy(&planes[(size_t)p * stride], &mPlanes[(size_t)p * mStride], kept * sizeof(float));
+    }
+    mPlanes.swap(planes);
+    mCount = count;
+    mStride = stride;
+}
+
+void LightStore::SetLight(unsigned index, float radius, float angle, float height, float animationSpeed,
+                          const PointLight& light)
+{
+    assert(index < mCount);
+    float* plane = &mPlanes[index];
+    plane[LIGHT_STORE_RADIUS * mStride] = radius;
+    plane[LIGHT_STORE_ANGLE * mStride] = angle;
+    plane[LIGHT_STORE_HEIGHT * mStride] = height;
+    plane[LIGHT_STORE_SPEED * mStride] = animationSpeed;
+    plane[LIGHT_STORE_ATTENUATION_BEGIN * mStride] = light.attenuationBegin;
+    plane[LIGHT_STORE_COLOR_R * mStride] = light.color[0];
+    plane[LIGHT_STORE_COLOR_G * mStride] = light.color[1];
+    plane[LIGHT_STORE_COLOR_B * mStride] = light.color[2];
+    plane[LIGHT_STORE_ATTENUATION_END * mStride] = light.attenuationEnd;
+}
+
+LightStoreLanes LightStore::GetLanes() const
+{
+    LightStoreLanes lanes = { mPlanes.empty() ? 0 : &mPlanes[0], mStride };
+    return lanes;
+}
+
+void LightStore::Animate(const LightAnimationFrame& frame, unsigned count, PointLight* destination, SimdLevel level,
+                         ThreadPool* threadPool) const
+{
+    assert(count <= mCount);
+    const LightAnimationFunctions& functions = GetLightAnimationFunctions(level);
+    const LightStoreLanes lanes = GetLanes();
+    if (count < kLightAnimationParallelLights || threadPool->GetThreadCount() == 1) {
+        functions.animate(lanes, frame, 0, count, destination);
+        return;
+    }
+
+    // Ranges of whole lanes, so only the last one has a partial lane
+    const unsigned grain = kLightAnimationParallelLights / 4;
+    threadPool->ParallelFor((count + grain - 1) / grain, 1, [&](unsigned begin, unsigned end, unsigned) {
+        const unsigned last = end * grain < count ? end * grain : count;
+        functions.animate(lanes, frame, begin * grain, last, destination);
+    });
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,110 @@
+#ifndef STREAMINGCPU_LIGHTANIMATION_H
+#define STREAMINGCPU_LIGHTANIMATION_H
+
+// The light animation of App::Move() and the view transform of
+// App::SetupLights() in one pass over SoA planes, for counts far past
+// MAX_LIGHTS. Each light orbits the vertical axis: at time t it is at angle
+// angle + t * animationSpeed, radius from the axis and height above the
+// floor. Animate() turns that into a view space PointLight written straight
+// to the destination, a mapped upload buffer in the app, once per light and
+// in order, so write-combined memory sees whole sequential lines.
+//
+// Sines and cosines come from polynomials on [-pi/2, pi/2] after reducing the
+// angle by 2 pi, within a few float ulps of sinf() and cosf() for the angles
+// of the app. The lane kernels run the same operations in the same order as
+// the scalar one, so every level writes the same bits.
+
+#include "CpuFeatures.h"
+#include "Lighting.h"
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+enum LightStorePlane
+{
+    LIGHT_STORE_RADIUS,
+    LIGHT_STORE_ANGLE,
+    LIGHT_STORE_HEIGHT,
+    LIGHT_STORE_SPEED,          // animationSpeed, radians per second
+    LIGHT_STORE_ATTENUATION_BEGIN,
+    LIGHT_STORE_COLOR_R,
+    LIGHT_STORE_COLOR_G,
+    LIGHT_STORE_COLOR_B,
+    LIGHT_STORE_ATTENUATION_END,
+    LIGHT_STORE_PLANE_COUNT
+};
+
+// Lights below this many go to the calling thread alone
+enum { kLightAnimationParallelLights = 16384 };
+
+// One frame of Animate(): the time and the row-vector world to view matrix,
+// as D3DXMATRIX lays it out. The last column must be (0, 0, 0, 1), which
+// every view matrix has, so the transform needs no divide.
+struct LightAnimationFrame
+{
+    float time;
+    float worldToView[4][4];
+};
+
+// count lights in planes of stride floats each, padded so that loads of the
+// widest lanes past count stay inside
+struct LightStoreLanes
+{
+    const float* planes;
+    unsigned stride;
+};
+
+struct LightAnimationFunctions
+{
+    // Writes lights [begin, end) to destination[begin, end)
+    void (*animate)(const LightStoreLanes& lights, const LightAnimationFrame& frame, unsigned begin, unsigned end,
+                    PointLight* destination);
+};
+
+extern const LightAnimationFunctions kLightAnimationScalar;
+#if defined(STREAMINGCPU_X86)
+extern const LightAnimationFunctions kLightAnimationAvx2;
+#endif // defined(STREAMINGCPU_X86)
+#if defined(STREAMINGCPU_AVX512)
+extern const LightAnimationFunctions kLightAnimationAvx512;
+#endif // defined(STREAMINGCPU_AVX512)
+
+// Falls back to the best supported level below the one requested
+const LightAnimationFunctions& GetLightAnimationFunctions(SimdLevel level);
+
+class LightStore
+{
+public:
+    LightStore();
+
+    // Keeps the lights below count that were set
+    void Resize(unsigned count);
+    unsigned GetCount() const { return mCount; }
+
+    // The orbit of App::Move(), and the color and attenuation of light;
+    // its positionView is not used
+    void SetLight(unsigned index, float radius, float angle, float height, float animationSpeed,
+                  const PointLight& light);
+
+    // Writes the first count lights at frame to destination, across the
+    // threads of threadPool past kLightAnimationParallelLights lights
+    void Animate(const LightAnimationFrame& frame, unsigned count, PointLight* destination, SimdLevel level,
+                 ThreadPool* threadPool) const;
+
+    LightStoreLanes GetLanes() const;
+
+private:
+    // Not implemented
+    LightStore(const LightStore&);
+    LightStore& operator=(const LightStore&);
+
+    unsigned mCount;
+    unsigned mStride;
+    std::vector<float> mPlanes;                     // LIGHT_STORE_PLANE_COUNT planes of mStride floats
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTANIMATION_H
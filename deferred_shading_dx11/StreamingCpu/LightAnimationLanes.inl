@@ -0,0 +1,95 @@
+// Lane parallel version of the LightAnimationFunctions. V is one of the
+// *Lanes structs (SimdLanesAvx2.h, SimdLanesAvx512.h). Included by the per-ISA
+// translation units after their target pragma, like MergeKernelLanes.inl.
+// Each lane is a light and goes through the operations of AnimateScalar() in
+// the same order; the matrix and polynomial constants are splatted.
+
+namespace StreamingCpu {
+
+template <typename V>
+struct LightAnimationLanes
+{
+    typedef typename V::Float Float;
+    typedef typename V::Mask Mask;
+
+    static void SinCos(Float angle, Float& sine, Float& cosine)
+    {
+        const Float k = V::Floor(V::Add(V::Mul(angle, V::Splat(1.591549367e-01f)), V::Splat(0.5f)));
+        Float r = V::Sub(V::Sub(angle, V::Mul(k, V::Splat(6.28125f))), V::Mul(k, V::Splat(1.935307169e-03f)));
+        const Mask upper = V::GreaterMask(r, V::Splat(1.570796371e+00f));
+        const Mask lower = V::LessMask(r, V::Splat(-1.570796371e+00f));
+        r = V::Select(upper, V::Sub(V::Splat(3.141592741e+00f), r),
+                      V::Select(lower, V::Sub(V::Splat(-3.141592741e+00f), r), r));
+
+        const Float x2 = V::Mul(r, r);
+        Float s = V::Splat(-2.505210839e-08f);
+        s = V::Add(V::Splat(2.755731922e-06f), V::Mul(x2, s));
+        s = V::Add(V::Splat(-1.984126984e-04f), V::Mul(x2, s));
+        s = V::Add(V::Splat(8.333333333e-03f), V::Mul(x2, s));
+        s = V::Add(V::Splat(-1.666666667e-01f), V::Mul(x2, s));
+        sine = V::Add(r, V::Mul(V::Mul(r, x2), s));
+
+        Float c = V::Splat(2.087675699e-09f);
+        c = V::Add(V::Splat(-2.755731922e-07f), V::Mul(x2, c));
+        c = V::Add(V::Splat(2.480158730e-05f), V::Mul(x2, c));
+        c = V::Add(V::Splat(-1.388888889e-03f), V::Mul(x2, c));
+        c = V::Add(V::Splat(4.166666667e-02f), V::Mul(x2, c));
+        c = V::Add(V::Splat(-5.000000000e-01f), V::Mul(x2, c));
+        c = V::Add(V::Splat(1.0f), V::Mul(x2, c));
+        const Float negC = V::Sub(V::Splat(0.0f), c);
+        cosine = V::Select(upper, negC, V::Select(lower, negC, c));
+    }
+
+    // begin is a multiple of kWidth, and the planes are padded past end
+    static void Animate(const LightStoreLanes& lights, const LightAnimationFrame& frame, unsigned begin,
+                        unsigned end, PointLight* destination)
+    {
+        const float* plane[LIGHT_STORE_PLANE_COUNT];
+        for (unsigned p = 0; p < LIGHT_STORE_PLANE_COUNT; ++p) {
+            plane[p] = lights.planes + (size_t)p * lights.stride;
+        }
+        Float m[4][3];
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                m[i][j] = V::Splat(frame.worldToView[i][j]);
+            }
+        }
+        const Float time = V::Splat(frame.time);
+
+        for (unsigned i = begin; i < end; i += V::kWidth) {
+            Float sine, cosine;
+            SinCos(V::Add(V::LoadFloat(plane[LIGHT_STORE_ANGLE] + i),
+                          V::Mul(time, V::LoadFloat(plane[LIGHT_STORE_SPEED] + i))), sine, cosine);
+            const Float radius = V::LoadFloat(plane[LIGHT_STORE_RADIUS] + i);
+            const Float world[3] = {
+                V::Mul(radius, cosine),
+                V::LoadFloat(plane[LIGHT_STORE_HEIGHT] + i),
+                V::Mul(radius, sine)
+            };
+
+            float view[3][V::kWidth];
+            for (int j = 0; j < 3; ++j) {
+                V::StoreFloat(view[j], V::Add(V::Add(V::Add(V::Mul(world[0], m[0][j]), V::Mul(world[1], m[1][j])),
+                                                     V::Mul(world[2], m[2][j])), m[3][j]));
+            }
+
+            // Whole lights in order, so the mapped buffer is written sequentially
+            const unsigned lanes = end - i < (unsigned)V::kWidth ? end - i : (unsigned)V::kWidth;
+            for (unsigned lane = 0; lane < lanes; ++lane) {
+                PointLight light;
+                light.positionView[0] = view[0][lane];
+                light.positionView[1] = view[1][lane];
+                light.positionView[2] = view[2][lane];
+                light.attenuationBegin = plane[LIGHT_STORE_ATTENUATION_BEGIN][i + lane];
+                light.color[0] = plane[LIGHT_STORE_COLOR_R][i + lane];
+                light.color[1] = plane[LIGHT_STORE_COLOR_G][i + lane];
+                light.color[2] = plane[LIGHT_STORE_COLOR_B][i + lane];
+                light.attenuationEnd = plane[LIGHT_STORE_ATTENUATION_END][i + lane];
+                destination[i + lane] = light;
+            }
+        }
+        V::End();
+    }
+};
+
+} // namespace StreamingCpu
@@ -0,0 +1,249 @@
+#include "LightBinning.h"
+#include "FormatConvert.h"
+#include "LightCulling.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <assert.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+enum LightPlane
+{
+    LIGHT_PLANE_X,
+    LIGHT_PLANE_Y,
+    LIGHT_PLANE_Z,
+    LIGHT_PLANE_NEG_RADIUS,
+    LIGHT_PLANE_NEAR_DOT,       // Dot3 of the near plane and the position
+    LIGHT_PLANE_FAR_DOT,
+    LIGHT_PLANE_COUNT
+};
+
+void TestLightPlanesScalar(const LightBinLights& lights, const float planes[2][4], uint64_t* mask)
+{
+    for (unsigned word = 0; word < lights.count / kLightBinWordBits; ++word) {
+        uint64_t bits = 0;
+        for (unsigned bit = 0; bit < kLightBinWordBits; ++bit) {
+            const unsigned i = word * kLightBinWordBits + bit;
+            const float position[3] = { lights.x[i], lights.y[i], lights.z[i] };
+            bool inside = true;
+            for (int p = 0; p < 2; ++p) {
+                float d = Dot3(planes[p], position) + planes[p][3];
+                inside = inside && (d >= lights.negRadius[i]);
+            }
+            bits |= (uint64_t)(inside ? 1 : 0) << bit;
+        }
+        mask[word] = bits;
+    }
+}
+
+unsigned CullTileScalar(const LightBinLights& lights, const LightBinTile& tile, unsigned* tileLights,
+                        uint64_t& depthTests)
+{
+    unsigned count = 0;
+    for (unsigned word = 0; word < lights.count / kLightBinWordBits; ++word) {
+        uint64_t bits = tile.columnMask[word] & tile.rowMask[word];
+        if (bits == 0) {
+            continue;
+        }
+        uint64_t inside = 0;
+        for (unsigned bit = 0; bit < kLightBinWordBits; ++bit) {
+            const unsigned i = word * kLightBinWordBits + bit;
+            const bool nearInside = lights.nearDot[i] + tile.nearDistance >= lights.negRadius[i];
+            const bool farInside = lights.farDot[i] + tile.farDistance >= lights.negRadius[i];
+            inside |= (uint64_t)(nearInside && farInside ? 1 : 0) << bit;
+        }
+        count += AppendLightBits(bits & inside, word * kLightBinWordBits, tileLights + count);
+        depthTests += kLightBinWordBits;
+    }
+    return count;
+}
+
+} // namespace
+
+const LightBinningFunctions kLightBinningScalar = {
+    TestLightPlanesScalar,
+    CullTileScalar
+};
+
+const LightBinningFunctions& GetLightBinningFunctions(SimdLevel level)
+{
+    SimdLevel maxLevel = GetMaxSimdLevel();
+    if (level > maxLevel) {
+        level = maxLevel;
+    }
+
+    switch (level) {
+#if defined(STREAMINGCPU_AVX512)
+        case SIMD_LEVEL_AVX512: return kLightBinningAvx512;
+#endif // defined(STREAMINGCPU_AVX512)
+#if defined(STREAMINGCPU_X86)
+        case SIMD_LEVEL_AVX2: return kLightBinningAvx2;
+#endif // defined(STREAMINGCPU_X86)
+        default: return kLightBinningScalar;
+    }
+}
+
+void GetTileDepthBounds(const MergeBuffers& buffers, const ViewConstants& view, unsigned tileDim,
+                        std::vector<TileDepthBounds>& bounds)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    const unsigned tilesX = (width + tileDim - 1) / tileDim;
+    const unsigned tilesY = (height + tileDim - 1) / tileDim;
+
+    // Empty tiles keep bounds that reject every light
+    const TileDepthBounds empty = { 3.40282347e+38f, 0.0f };
+    bounds.assign(tilesX * tilesY, empty);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            TileDepthBounds& tile = bounds[x / tileDim + tilesX * (y / tileDim)];
+            for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                float viewSpaceZ = buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)].zView;
+                if (viewSpaceZ >= view.nearZ && viewSpaceZ < view.farZ) {
+                    tile.minZ = viewSpaceZ < tile.minZ ? viewSpaceZ : tile.minZ;
+                    tile.maxZ = viewSpaceZ > tile.maxZ ? viewSpaceZ : tile.maxZ;
+                }
+            }
+        }
+    }
+}
+
+LightBinLights SetLightBinLights(const PointLight* lights, unsigned lightCount, std::vector<float>& planes)
+{
+    const unsigned count = (lightCount + kLightBinWordBits - 1) / kLightBinWordBits * kLightBinWordBits;
+
+    // Near and far planes of GetTileFrustumPlanes() without their distance,
+    // which is all that depends on the tile
+    const float nearNormal[3] = { 0.0f, 0.0f, 1.0f };
+    const float farNormal[3] = { 0.0f, 0.0f, -1.0f };
+
+    planes.assign(LIGHT_PLANE_COUNT * count, 0.0f);
+    float* plane[LIGHT_PLANE_COUNT];
+    for (unsigned p = 0; p < LIGHT_PLANE_COUNT; ++p) {
+        plane[p] = count > 0 ? &planes[p * count] : 0;
+    }
+    for (unsigned i = 0; i < lightCount; ++i) {
+        const PointLight& light = lights[i];
+        plane[LIGHT_PLANE_X][i] = light.positionView[0];
+        plane[LIGHT_PLANE_Y][i] = light.positionView[1];
+        plane[LIGHT_PLANE_Z][i] = light.positionView[2];
+        plane[LIGHT_PLANE_NEG_RADIUS][i] = -light.attenuationEnd;
+        plane[LIGHT_PLANE_NEAR_DOT][i] = Dot3(nearNormal, light.positionView);
+        plane[LIGHT_PLANE_FAR_DOT][i] = Dot3(farNormal, light.positionView);
+    }
+    for (unsigned i = lightCount; i < count; ++i) {
+        plane[LIGHT_PLANE_NEG_RADIUS][i] = AsFloat(0x7FC00000);
+    }
+
+    const LightBinLights soa = {
+        plane[LIGHT_PLANE_X],
+        plane[LIGHT_PLANE_Y],
+        plane[LIGHT_PLANE_Z],
+        plane[LIGHT_PLANE_NEG_RADIUS],
+        plane[LIGHT_PLANE_NEAR_DOT],
+        plane[LIGHT_PLANE_FAR_DOT],
+        count
+    };
+    return soa;
+}
+
+LightBins::LightBins(unsigned tileDim)
+    : mTileDim(tileDim), mTilesX(0), mTilesY(0), mWords(0)
+{
+    assert(tileDim > 0);
+}
+
+void LightBins::Build(const ViewConstants& view, const TileDepthBounds* bounds, const PointLight* lights,
+                      unsigned lightCount, SimdLevel level, ThreadPool* threadPool, LightBinningStats& stats)
+{
+    mTilesX = (view.width + mTileDim - 1) / mTileDim;
+    mTilesY = (view.height + mTileDim - 1) / mTileDim;
+    const unsigned tileCount = mTilesX * mTilesY;
+
+    Timer timer;
+    const LightBinLights soa = SetLightBinLights(lights, lightCount, mLightPlanes);
+    const unsigned count = soa.count;
+    mWords = count / kLightBinWordBits;
+
+    // A mask per column, then one per row
+    const LightBinningFunctions& functions = GetLightBinningFunctions(level);
+    mMasks.resize((size_t)(mTilesX + mTilesY) * mWords + 1);
+    threadPool->ParallelFor(mTilesX + mTilesY, 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            const bool column = i < mTilesX;
+            float frustumPlanes[6][4];
+            GetTileFrustumPlanes(column ? i : 0, column ? 0 : i - mTilesX, mTileDim, 0.0f, 0.0f, view,
+                                 frustumPlanes);
+            functions.testPlanes(soa, column ? &frustumPlanes[0] : &frustumPlanes[2], &mMasks[(size_t)i * mWords]);
+        }
+    });
+    stats.planeSeconds += timer.GetSeconds();
+
+    // Each thread appends the lists of its tiles to its own array
+    timer.Reset();
+    mTileRanges.resize(tileCount * 2);
+    mTileSources.resize(tileCount * 2);
+    mThreadIndices.resize(threadPool->GetThreadCount());
+    mThreadScratch.resize(threadPool->GetThreadCount());
+    for (size_t i = 0; i < mThreadIndices.size(); ++i) {
+        mThreadIndices[i].clear();
+        mThreadScratch[i].resize(count + 1);
+    }
+    std::vector<uint64_t> depthTests(threadPool->GetThreadCount(), 0);
+    threadPool->ParallelFor(tileCount, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+        std::vector<unsigned>& indices = mThreadIndices[threadIndex];
+        unsigned* scratch = &mThreadScratch[threadIndex][0];
+        for (unsigned tile = begin; tile < end; ++tile) {
+            const unsigned tileX = tile % mTilesX;
+            const unsigned tileY = tile / mTilesX;
+            float frustumPlanes[6][4];
+            GetTileFrustumPlanes(tileX, tileY, mTileDim, bounds[tile].minZ, bounds[tile].maxZ, view, frustumPlanes);
+
+            LightBinTile binTile;
+            binTile.columnMask = &mMasks[(size_t)tileX * mWords];
+            binTile.rowMask = &mMasks[(size_t)(mTilesX + tileY) * mWords];
+            binTile.nearDistance = frustumPlanes[4][3];
+            binTile.farDistance = frustumPlanes[5][3];
+            const unsigned tileLights = functions.cullTile(soa, binTile, scratch, depthTests[threadIndex]);
+
+            mTileSources[tile * 2] = threadIndex;
+            mTileSources[tile * 2 + 1] = (unsigned)indices.size();
+            mTileRanges[tile * 2 + 1] = tileLights;
+            indices.insert(indices.end(), scratch, scratch + tileLights);
+        }
+    });
+    stats.tileSeconds += timer.GetSeconds();
+
+    // Lists in tile order
+    timer.Reset();
+    unsigned offset = 0;
+    for (unsigned tile = 0; tile < tileCount; ++tile) {
+        mTileRanges[tile * 2] = offset;
+        offset += mTileRanges[tile * 2 + 1];
+    }
+    mLightIndices.resize(offset);
+    threadPool->ParallelFor(tileCount, 16, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned tile = begin; tile < end; ++tile) {
+            const unsigned tileLights = mTileRanges[tile * 2 + 1];
+            if (tileLights > 0) {
+                const std::vector<unsigned>& indices = mThreadIndices[mTileSources[tile * 2]];
+                memcpy(&mLightIndices[mTileRanges[tile * 2]], &indices[mTileSources[tile * 2 + 1]],
+                       tileLights * sizeof(unsigned));
+            }
+        }
+    });
+    stats.flattenSeconds += timer.GetSeconds();
+
+    stats.builds++;
+    stats.tiles += tileCount;
+    stats.tileLights += offset;
+    stats.planeTests += (uint64_t)(mTilesX + mTilesY) * lightCount;
+    for (size_t i = 0; i < depthTests.size(); ++i) {
+        stats.depthTests += depthTests[i];
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,189 @@
+#ifndef STREAMINGCPU_LIGHTBINNING_H
+#define STREAMINGCPU_LIGHTBINNING_H
+
+// Tile light lists for scenes of tens of thousands of lights, with the same
+// contents as CullTileLights() on every tile. The left and right planes of a
+// tile only depend on its column and the top and bottom ones on its row, so
+// each light is tested against those once per column and once per row, in
+// SoA lanes, into bit masks of kLightBinWordBits lights per word. A tile
+// ANDs the masks of its column and row and only tests the words with lights
+// left against its near and far planes. Every test is the same float
+// operations as CullTileLights(), so the lists match it bit for bit at every
+// level.
+//
+// The lists are flat, with no MAX_LIGHTS cap: a uint2 of offset and count per
+// tile, row-major, into one array of light indices, each list ascending.
+
+#include "../ShaderDefines.h"
+#include "CpuFeatures.h"
+#include "Lighting.h"
+#include "MergeBuffers.h"
+#include <stdint.h>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+enum { kLightBinWordBits = 64 };
+
+// count lights in SoA planes, count a multiple of kLightBinWordBits.
+// negRadius is -attenuationEnd; padding lights have a NaN one, so they fail
+// every test. nearDot and farDot are Dot3() of the normals of the near and
+// far planes with the position.
+struct LightBinLights
+{
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* negRadius;
+    const float* nearDot;
+    const float* farDot;
+    unsigned count;
+};
+
+// The masks of a tile's column and row, and the distances of its near and
+// far planes
+struct LightBinTile
+{
+    const uint64_t* columnMask;
+    const uint64_t* rowMask;
+    float nearDistance;
+    float farDistance;
+};
+
+struct LightBinningFunctions
+{
+    // Sets bit i of word i / kLightBinWordBits of mask when light i is within
+    // its radius of the inner side of both planes, like the loop of
+    // CullTileLights()
+    void (*testPlanes)(const LightBinLights& lights, const float planes[2][4], uint64_t* mask);
+
+    // Writes the lights in both masks that pass the near and far planes to
+    // tileLights in ascending order and returns how many did. Adds the lights
+    // of the words it tested to depthTests.
+    unsigned (*cullTile)(const LightBinLights& lights, const LightBinTile& tile, unsigned* tileLights,
+                         uint64_t& depthTests);
+};
+
+extern const LightBinningFunctions kLightBinningScalar;
+#if defined(STREAMINGCPU_X86)
+extern const LightBinningFunctions kLightBinningAvx2;
+#endif // defined(STREAMINGCPU_X86)
+#if defined(STREAMINGCPU_AVX512)
+extern const LightBinningFunctions kLightBinningAvx512;
+#endif // defined(STREAMINGCPU_AVX512)
+
+// Falls back to the best supported level below the one requested
+const LightBinningFunctions& GetLightBinningFunctions(SimdLevel level);
+
+// Lays lights out in planes as LightBinLights, padded to whole words
+LightBinLights SetLightBinLights(const PointLight* lights, unsigned lightCount, std::vector<float>& planes);
+
+// bits != 0
+inline unsigned CountTrailingZeros(uint64_t bits)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    if ((unsigned)bits != 0) {
+        _BitScanForward(&index, (unsigned long)bits);
+        return index;
+    }
+    _BitScanForward(&index, (unsigned long)(bits >> 32));
+    return index + 32;
+#else
+    return (unsigned)__builtin_ctzll(bits);
+#endif
+}
+
+// Writes first plus the index of every set bit, in ascending order
+inline unsigned AppendLightBits(uint64_t bits, unsigned first, unsigned* tileLights)
+{
+    unsigned count = 0;
+    while (bits != 0) {
+        tileLights[count++] = first + CountTrailingZeros(bits);
+        bits &= bits - 1;
+    }
+    return count;
+}
+
+// View depths of the nodes in use of a tile, as StreamingLightCullCS bounds
+// them. Empty tiles have minZ above maxZ, which rejects every light.
+struct TileDepthBounds
+{
+    float minZ;
+    float maxZ;
+};
+
+// Bounds of every tileDim tile of buffers, row-major
+void GetTileDepthBounds(const MergeBuffers& buffers, const ViewConstants& view, unsigned tileDim,
+                        std::vector<TileDepthBounds>& bounds);
+
+struct LightBinningStats
+{
+    uint64_t builds;
+    uint64_t tiles;
+    uint64_t tileLights;        // sum of the list lengths
+    uint64_t planeTests;        // lights tested against a column's or a row's planes
+    uint64_t depthTests;        // lights left for the near and far planes of a tile
+    double planeSeconds;        // column and row masks
+    double tileSeconds;         // tile lists
+    double flattenSeconds;      // gathering the lists into one array
+
+    LightBinningStats()
+        : builds(0), tiles(0), tileLights(0), planeTests(0), depthTests(0)
+        , planeSeconds(0.0), tileSeconds(0.0), flattenSeconds(0.0) {}
+
+    double GetSeconds() const { return planeSeconds + tileSeconds + flattenSeconds; }
+};
+
+class LightBins
+{
+public:
+    explicit LightBins(unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM);
+
+    // bounds holds every tile of the view.width x view.height frame, row-major
+    void Build(const ViewConstants& view, const TileDepthBounds* bounds, const PointLight* lights,
+               unsigned lightCount, SimdLevel level, ThreadPool* threadPool, LightBinningStats& stats);
+
+    unsigned GetTileDim() const { return mTileDim; }
+    unsigned GetTilesX() const { return mTilesX; }
+    unsigned GetTilesY() const { return mTilesY; }
+
+    unsigned GetLightCount(unsigned tileX, unsigned tileY) const
+    {
+        return mTileRanges[(tileX + mTilesX * tileY) * 2 + 1];
+    }
+    const unsigned* GetLights(unsigned tileX, unsigned tileY) const
+    {
+        return mLightIndices.empty() ? 0 : &mLightIndices[0] + mTileRanges[(tileX + mTilesX * tileY) * 2];
+    }
+
+    // What a GPU would read: offset and count per tile, and the indices
+    const std::vector<unsigned>& GetTileRanges() const { return mTileRanges; }
+    const std::vector<unsigned>& GetLightIndices() const { return mLightIndices; }
+
+private:
+    // Not implemented
+    LightBins(const LightBins&);
+    LightBins& operator=(const LightBins&);
+
+    unsigned mTileDim;
+    unsigned mTilesX;
+    unsigned mTilesY;
+    unsigned mWords;                                // mask words per column or row
+    std::vector<float> mLightPlanes;                // x, y, z, negRadius, nearDot, farDot
+    std::vector<uint64_t> mMasks;                   // columns, then rows
+    std::vector<unsigned> mTileRanges;
+    std::vector<unsigned> mLightIndices;
+    std::vector<unsigned> mTileSources;             // thread and offset of each list before flattening
+    std::vector<std::vector<unsigned> > mThreadIndices;
+    std::vector<std::vector<unsigned> > mThreadScratch; // room for every light
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTBINNING_H
@@ -0,0 +1,35 @@
+// See MergeKernelAvx2.cpp for why the includes come before the pragma.
+#include "LightBinning.h"
+
+#if defined(STREAMINGCPU_X86)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,f16c"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "SimdLanesAvx2.h"
+#include "LightBinningLanes.inl"
+
+namespace StreamingCpu {
+
+const LightBinningFunctions kLightBinningAvx2 = {
+    LightBinningLanes<Avx2Lanes>::TestPlanes,
+    LightBinningLanes<Avx2Lanes>::CullTile
+};
+
+} // namespace StreamingCpu
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // defined(STREAMINGCPU_X86)
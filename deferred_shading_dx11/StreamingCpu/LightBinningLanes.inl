@@ -0,0 +1,74 @@
+// Lane parallel versions of the LightBinningFunctions. V is one of the *Lanes
+// structs (SimdLanesAvx2.h, SimdLanesAvx512.h). Included by the per-ISA
+// translation units after their target pragma, like MergeKernelLanes.inl.
+// Each lane is a light, and the planes are splatted, so every distance goes
+// through the operations of CullTileLights() in the same order.
+
+namespace StreamingCpu {
+
+template <typename V>
+struct LightBinningLanes
+{
+    typedef typename V::Float Float;
+
+    static void TestPlanes(const LightBinLights& lights, const float planes[2][4], uint64_t* mask)
+    {
+        Float plane[2][4];
+        for (int p = 0; p < 2; ++p) {
+            for (int i = 0; i < 4; ++i) {
+                plane[p][i] = V::Splat(planes[p][i]);
+            }
+        }
+
+        for (unsigned word = 0; word < lights.count / kLightBinWordBits; ++word) {
+            uint64_t bits = 0;
+            for (unsigned bit = 0; bit < kLightBinWordBits; bit += V::kWidth) {
+                const unsigned i = word * kLightBinWordBits + bit;
+                const Float x = V::LoadFloat(lights.x + i);
+                const Float y = V::LoadFloat(lights.y + i);
+                const Float z = V::LoadFloat(lights.z + i);
+                const Float negRadius = V::LoadFloat(lights.negRadius + i);
+                unsigned inside = ~0u;
+                for (int p = 0; p < 2; ++p) {
+                    const Float dot = V::Add(V::Add(V::Mul(plane[p][0], x), V::Mul(plane[p][1], y)),
+                                             V::Mul(plane[p][2], z));
+                    inside &= V::GreaterEqual(V::Add(dot, plane[p][3]), negRadius);
+                }
+                bits |= (uint64_t)inside << bit;
+            }
+            mask[word] = bits;
+        }
+        V::End();
+    }
+
+    static unsigned CullTile(const LightBinLights& lights, const LightBinTile& tile, unsigned* tileLights,
+                             uint64_t& depthTests)
+    {
+        const Float nearDistance = V::Splat(tile.nearDistance);
+        const Float farDistance = V::Splat(tile.farDistance);
+
+        unsigned count = 0;
+        for (unsigned word = 0; word < lights.count / kLightBinWordBits; ++word) {
+            const uint64_t bits = tile.columnMask[word] & tile.rowMask[word];
+            if (bits == 0) {
+                continue;
+            }
+            uint64_t inside = 0;
+            for (unsigned bit = 0; bit < kLightBinWordBits; bit += V::kWidth) {
+                const unsigned i = word * kLightBinWordBits + bit;
+                const Float negRadius = V::LoadFloat(lights.negRadius + i);
+                const unsigned nearInside = V::GreaterEqual(V::Add(V::LoadFloat(lights.nearDot + i), nearDistance),
+                                                            negRadius);
+                const unsigned farInside = V::GreaterEqual(V::Add(V::LoadFloat(lights.farDot + i), farDistance),
+                                                           negRadius);
+                inside |= (uint64_t)(nearInside & farInside) << bit;
+            }
+            count += AppendLightBits(bits & inside, word * kLightBinWordBits, tileLights + count);
+            depthTests += kLightBinWordBits;
+        }
+        V::End();
+        return count;
+    }
+};
+
+} // namespace StreamingCpu
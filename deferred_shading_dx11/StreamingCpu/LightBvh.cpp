@@ -0,0 +1,419 @@
+#include "LightBvh.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// Box of a light's sphere, grown by a few ulps so that rounding in the box
+// tests never rejects a light the exact tests of the leaves would keep
+inline void GetLightBounds(const PointLight& light, float boundsMin[3], float boundsMax[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        const float slack = (fabsf(light.positionView[i]) + light.attenuationEnd) * (1.0f / 65536.0f);
+        boundsMin[i] = light.positionView[i] - light.attenuationEnd - slack;
+        boundsMax[i] = light.positionView[i] + light.attenuationEnd + slack;
+    }
+}
+
+inline void SetSphere(const PointLight& light, float sphere[4])
+{
+    sphere[0] = light.positionView[0];
+    sphere[1] = light.positionView[1];
+    sphere[2] = light.positionView[2];
+    sphere[3] = light.attenuationEnd;
+}
+
+inline void ClearBounds(float boundsMin[3], float boundsMax[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        boundsMin[i] = 3.40282347e+38f;
+        boundsMax[i] = -3.40282347e+38f;
+    }
+}
+
+inline void GrowBounds(const float otherMin[3], const float otherMax[3], float boundsMin[3], float boundsMax[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        boundsMin[i] = otherMin[i] < boundsMin[i] ? otherMin[i] : boundsMin[i];
+        boundsMax[i] = otherMax[i] > boundsMax[i] ? otherMax[i] : boundsMax[i];
+    }
+}
+
+inline float GetHalfArea(const float boundsMin[3], const float boundsMax[3])
+{
+    const float x = boundsMax[0] - boundsMin[0];
+    const float y = boundsMax[1] - boundsMin[1];
+    const float z = boundsMax[2] - boundsMin[2];
+    return x * y + y * z + z * x;
+}
+
+// Some point of the box is within the inner side of every plane
+inline bool BoxInsidePlanes(const LightBvhNode& node, const float planes[][4], unsigned planeCount)
+{
+    for (unsigned p = 0; p < planeCount; ++p) {
+        float d = planes[p][3];
+        for (int i = 0; i < 3; ++i) {
+            d += planes[p][i] * (planes[p][i] >= 0.0f ? node.boundsMax[i] : node.boundsMin[i]);
+        }
+        if (d < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool BoxContains(const LightBvhNode& node, const float position[3])
+{
+    return position[0] >= node.boundsMin[0] && position[0] <= node.boundsMax[0] &&
+           position[1] >= node.boundsMin[1] && position[1] <= node.boundsMax[1] &&
+           position[2] >= node.boundsMin[2] && position[2] <= node.boundsMax[2];
+}
+
+} // namespace
+
+LightBvh::LightBvh()
+    : mBuiltSahCost(0.0), mDepth(0)
+{
+}
+
+void LightBvh::Build(const PointLight* lights, unsigned lightCount, ThreadPool* threadPool, LightBvhStats& stats)
+{
+    Timer timer;
+    mNodes.clear();
+    mRefitTasks.clear();
+    mTopNodes.clear();
+    mDepth = 0;
+    mLightOrder.resize(lightCount);
+    mBuildBounds.resize((size_t)lightCount * 6);
+    threadPool->ParallelFor(lightCount, 4096, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            mLightOrder[i] = i;
+            GetLightBounds(lights[i], &mBuildBounds[(size_t)i * 6], &mBuildBounds[(size_t)i * 6 + 3]);
+        }
+    });
+
+    if (lightCount > 0) {
+        mNodes.reserve(2 * ((lightCount + kLightBvhLeafLights - 1) / kLightBvhLeafLights));
+        BuildNode(0, lightCount, 1);
+    }
+    mBuildBounds.clear();
+    mSpheres.resize((size_t)lightCount * 4);
+    threadPool->ParallelFor(lightCount, 4096, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            SetSphere(lights[mLightOrder[i]], &mSpheres[(size_t)i * 4]);
+        }
+    });
+
+    // Subtrees of about an eighth of a thread's share of the nodes for Refit(),
+    // the nodes above them refit last
+    const unsigned nodeCount = (unsigned)mNodes.size();
+    const unsigned taskNodes = std::max(nodeCount / (threadPool->GetThreadCount() * 8), 64u);
+    std::vector<unsigned> stack;
+    if (nodeCount > 0) {
+        stack.push_back(0);
+    }
+    while (!stack.empty()) {
+        const unsigned node = stack.back();
+        stack.pop_back();
+        const unsigned end = GetSubtreeEnd(node);
+        if (end - node <= taskNodes || mNodes[node].count > 0) {
+            RefitTask task = { node, end };
+            mRefitTasks.push_back(task);
+        } else {
+            mTopNodes.push_back(node);
+            stack.push_back(mNodes[node].first);
+            stack.push_back(node + 1);
+        }
+    }
+
+    mBuiltSahCost = GetSahCost();
+    stats.buildSeconds += timer.GetSeconds();
+    stats.builds++;
+    stats.nodes = nodeCount;
+    stats.leaves = nodeCount > 0 ? nodeCount / 2 + 1 : 0;
+    stats.depth = mDepth;
+    stats.refitTasks = (unsigned)mRefitTasks.size();
+}
+
+unsigned LightBvh::BuildNode(unsigned begin, unsigned end, unsigned depth)
+{
+    assert(depth < kLightBvhMaxDepth);
+    const unsigned node = (unsigned)mNodes.size();
+    mNodes.push_back(LightBvhNode());
+    mDepth = depth > mDepth ? depth : mDepth;
+
+    float boundsMin[3], boundsMax[3];
+    float centerMin[3], centerMax[3];
+    ClearBounds(boundsMin, boundsMax);
+    ClearBounds(centerMin, centerMax);
+    for (unsigned i = begin; i < end; ++i) {
+        const float* lightBounds = &mBuildBounds[(size_t)mLightOrder[i] * 6];
+        GrowBounds(lightBounds, lightBounds + 3, boundsMin, boundsMax);
+        float center[3];
+        for (int j = 0; j < 3; ++j) {
+            center[j] = 0.5f * (lightBounds[j] + lightBounds[j + 3]);
+        }
+        GrowBounds(center, center, centerMin, centerMax);
+    }
+    for (int i = 0; i < 3; ++i) {
+        mNodes[node].boundsMin[i] = boundsMin[i];
+        mNodes[node].boundsMax[i] = boundsMax[i];
+    }
+
+    const unsigned count = end - begin;
+    if (count <= kLightBvhLeafLights) {
+        mNodes[node].first = begin;
+        mNodes[node].count = count;
+        return node;
+    }
+
+    // Binned SAH on the centers. Past half the stack a plain median split
+    // keeps the depth within kLightBvhMaxDepth for any light count.
+    int bestAxis = -1;
+    unsigned bestSplit = 0;
+    float bestCost = 3.40282347e+38f;
+    for (int axis = 0; axis < 3 && depth < kLightBvhMaxDepth / 2; ++axis) {
+        const float extent = centerMax[axis] - centerMin[axis];
+        if (!(extent > 0.0f)) {
+            continue;
+        }
+        const float scale = (float)kLightBvhBins * 0.9999f / extent;
+        unsigned binCounts[kLightBvhBins] = { 0 };
+        float binMin[kLightBvhBins][3], binMax[kLightBvhBins][3];
+        for (unsigned b = 0; b < kLightBvhBins; ++b) {
+            ClearBounds(binMin[b], binMax[b]);
+        }
+        for (unsigned i = begin; i < end; ++i) {
+            const float* lightBounds = &mBuildBounds[(size_t)mLightOrder[i] * 6];
+            const float center = 0.5f * (lightBounds[axis] + lightBounds[axis + 3]);
+            const unsigned b = std::min((unsigned)((center - centerMin[axis]) * scale), kLightBvhBins - 1u);
+            binCounts[b]++;
+            GrowBounds(lightBounds, lightBounds + 3, binMin[b], binMax[b]);
+        }
+
+        // Cost of the right side of every split, then sweep the left side
+        float rightCost[kLightBvhBins];
+        float sideMin[3], sideMax[3];
+        unsigned sideCount = 0;
+        ClearBounds(sideMin, sideMax);
+        for (unsigned b = kLightBvhBins - 1; b > 0; --b) {
+            GrowBounds(binMin[b], binMax[b], sideMin, sideMax);
+            sideCount += binCounts[b];
+            rightCost[b] = sideCount > 0 ? GetHalfArea(sideMin, sideMax) * (float)sideCount : 0.0f;
+        }
+        sideCount = 0;
+        ClearBounds(sideMin, sideMax);
+        for (unsigned split = 1; split < kLightBvhBins; ++split) {
+            GrowBounds(binMin[split - 1], binMax[split - 1], sideMin, sideMax);
+            sideCount += binCounts[split - 1];
+            if (sideCount == 0 || sideCount == count) {
+                continue;
+            }
+            const float cost = GetHalfArea(sideMin, sideMax) * (float)sideCount + rightCost[split];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    unsigned middle;
+    if (bestAxis >= 0) {
+        const int axis = bestAxis;
+        const float minCenter = centerMin[axis];
+        const float scale = (float)kLightBvhBins * 0.9999f / (centerMax[axis] - centerMin[axis]);
+        const unsigned split = bestSplit;
+        const float* buildBounds = &mBuildBounds[0];
+        middle = (unsigned)(std::partition(&mLightOrder[0] + begin, &mLightOrder[0] + end, [=](unsigned light) {
+            const float center = 0.5f * (buildBounds[(size_t)light * 6 + axis] + buildBounds[(size_t)light * 6 + 3 + axis]);
+            return std::min((unsigned)((center - minCenter) * scale), kLightBvhBins - 1u) < split;
+        }) - &mLightOrder[0]);
+    } else {
+        // Median of the longest axis, or any half when the centers coincide
+        int axis = 0;
+        for (int i = 1; i < 3; ++i) {
+            axis = centerMax[i] - centerMin[i] > centerMax[axis] - centerMin[axis] ? i : axis;
+        }
+        middle = begin + count / 2;
+        const float* buildBounds = &mBuildBounds[0];
+        std::nth_element(&mLightOrder[0] + begin, &mLightOrder[0] + middle, &mLightOrder[0] + end,
+                         [=](unsigned a, unsigned b) {
+            return buildBounds[(size_t)a * 6 + axis] + buildBounds[(size_t)a * 6 + 3 + axis] <
+                   buildBounds[(size_t)b * 6 + axis] + buildBounds[(size_t)b * 6 + 3 + axis];
+        });
+    }
+
+    BuildNode(begin, middle, depth + 1);
+    const unsigned right = BuildNode(middle, end, depth + 1);
+    mNodes[node].first = right;
+    mNodes[node].count = 0;
+    return node;
+}
+
+unsigned LightBvh::GetSubtreeEnd(unsigned node) const
+{
+    // The rightmost leaf is the last node of a subtree
+    while (mNodes[node].count == 0) {
+        node = mNodes[node].first;
+    }
+    return node + 1;
+}
+
+void LightBvh::RefitNode(unsigned node, const PointLight* lights)
+{
+    LightBvhNode& n = mNodes[node];
+    ClearBounds(n.boundsMin, n.boundsMax);
+    if (n.count > 0) {
+        for (unsigned i = n.first; i < n.first + n.count; ++i) {
+            const PointLight& light = lights[mLightOrder[i]];
+            SetSphere(light, &mSpheres[(size_t)i * 4]);
+            float lightMin[3], lightMax[3];
+            GetLightBounds(light, lightMin, lightMax);
+            GrowBounds(lightMin, lightMax, n.boundsMin, n.boundsMax);
+        }
+    } else {
+        const LightBvhNode& left = mNodes[node + 1];
+        const LightBvhNode& right = mNodes[n.first];
+        GrowBounds(left.boundsMin, left.boundsMax, n.boundsMin, n.boundsMax);
+        GrowBounds(right.boundsMin, right.boundsMax, n.boundsMin, n.boundsMax);
+    }
+}
+
+void LightBvh::Refit(const PointLight* lights, ThreadPool* threadPool, LightBvhStats& stats)
+{
+    // Children follow their parents, so each range is refit back to front
+    Timer timer;
+    threadPool->ParallelFor((unsigned)mRefitTasks.size(), 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned task = begin; task < end; ++task) {
+            for (unsigned node = mRefitTasks[task].end; node-- > mRefitTasks[task].begin; ) {
+                RefitNode(node, lights);
+            }
+        }
+    });
+    for (size_t i = mTopNodes.size(); i-- > 0; ) {
+        RefitNode(mTopNodes[i], lights);
+    }
+    stats.refitSeconds += timer.GetSeconds();
+    stats.refits++;
+}
+
+bool LightBvh::Update(const PointLight* lights, unsigned lightCount, ThreadPool* threadPool, LightBvhStats& stats)
+{
+    if (lightCount == GetLightCount()) {
+        Refit(lights, threadPool, stats);
+        if (GetSahCost() <= mBuiltSahCost * kLightBvhRebuildRatio) {
+            return false;
+        }
+    }
+    Build(lights, lightCount, threadPool, stats);
+    stats.rebuilds++;
+    return true;
+}
+
+double LightBvh::GetSahCost() const
+{
+    if (mNodes.empty()) {
+        return 0.0;
+    }
+    double cost = 0.0;
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        cost += (double)GetHalfArea(mNodes[i].boundsMin, mNodes[i].boundsMax) * (1.0 + mNodes[i].count);
+    }
+    const double rootArea = GetHalfArea(mNodes[0].boundsMin, mNodes[0].boundsMax);
+    return rootArea > 0.0 ? cost / rootArea : (double)mNodes.size();
+}
+
+void LightBvh::QueryPlanes(const float planes[][4], unsigned planeCount, std::vector<unsigned>& lightIndices,
+                           LightBvhQueryStats& stats) const
+{
+    lightIndices.clear();
+    stats.queries++;
+    if (mNodes.empty()) {
+        return;
+    }
+
+    unsigned stack[kLightBvhMaxDepth];
+    unsigned stackSize = 0;
+    unsigned node = 0;
+    for (;;) {
+        const LightBvhNode& n = mNodes[node];
+        stats.nodeTests++;
+        if (BoxInsidePlanes(n, planes, planeCount)) {
+            if (n.count == 0) {
+                stack[stackSize++] = n.first;
+                node = node + 1;
+                continue;
+            }
+            // The loop of CullTileLights()
+            for (unsigned i = n.first; i < n.first + n.count; ++i) {
+                const float* sphere = &mSpheres[(size_t)i * 4];
+                bool inFrustum = true;
+                for (unsigned p = 0; p < planeCount; ++p) {
+                    float d = Dot3(planes[p], sphere) + planes[p][3];
+                    inFrustum = inFrustum && (d >= -sphere[3]);
+                }
+                if (inFrustum) {
+                    lightIndices.push_back(mLightOrder[i]);
+                }
+            }
+            stats.lightTests += n.count;
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        node = stack[--stackSize];
+    }
+    std::sort(lightIndices.begin(), lightIndices.end());
+    stats.lights += lightIndices.size();
+}
+
+void LightBvh::QueryPoint(const float position[3], std::vector<unsigned>& lightIndices,
+                          LightBvhQueryStats& stats) const
+{
+    lightIndices.clear();
+    stats.queries++;
+    if (mNodes.empty()) {
+        return;
+    }
+
+    unsigned stack[kLightBvhMaxDepth];
+    unsigned stackSize = 0;
+    unsigned node = 0;
+    for (;;) {
+        const LightBvhNode& n = mNodes[node];
+        stats.nodeTests++;
+        if (BoxContains(n, position)) {
+            if (n.count == 0) {
+                stack[stackSize++] = n.first;
+                node = node + 1;
+                continue;
+            }
+            // The test of AccumulateBRDF()
+            for (unsigned i = n.first; i < n.first + n.count; ++i) {
+                const float* sphere = &mSpheres[(size_t)i * 4];
+                float directionToLight[3];
+                for (int j = 0; j < 3; ++j) {
+                    directionToLight[j] = sphere[j] - position[j];
+                }
+                if (sqrtf(Dot3(directionToLight, directionToLight)) < sphere[3]) {
+                    lightIndices.push_back(mLightOrder[i]);
+                }
+            }
+            stats.lightTests += n.count;
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        node = stack[--stackSize];
+    }
+    std::sort(lightIndices.begin(), lightIndices.end());
+    stats.lights += lightIndices.size();
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,144 @@
+#ifndef STREAMINGCPU_LIGHTBVH_H
+#define STREAMINGCPU_LIGHTBVH_H
+
+// Bounding volume hierarchy over the spheres of point lights, for counts far
+// past MAX_LIGHTS. LightBins and LightClusters test every light against every
+// column, row and slice; a query here only visits the nodes whose boxes reach
+// the tile, cluster or point, so it costs about the log of the light count
+// plus the lights it returns. That pays off for sparse queries such as the
+// lights of a single node; for the long lists of whole tiles the masks of
+// LightBins stay faster.
+//
+// Build() splits on the binned surface area heuristic over the light
+// positions. Lights that move keep the tree: Refit() only recomputes the
+// boxes, splitting the tree into subtrees for the thread pool, and
+// GetSahCost() tells how far the tree has drifted from a fresh build.
+// Update() refits and builds again once the tree has drifted too far.
+//
+// Every query ends in the exact test of the loop it stands in for, and
+// returns ascending indices, so its lists match those of CullTileLights(),
+// LightClusters and BasicLoop bit for bit.
+
+#include "Lighting.h"
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+enum
+{
+    kLightBvhLeafLights = 4,    // most lights of a leaf
+    kLightBvhBins = 16,         // SAH candidates per axis
+    kLightBvhMaxDepth = 64,     // traversal stack, the build keeps the depth below it
+    kLightBvhRebuildRatio = 2   // SAH cost over that of the last build Update() rebuilds at
+};
+
+// Flattened depth first, so an interior node's left child follows it
+struct LightBvhNode
+{
+    float boundsMin[3];         // box of the spheres below the node
+    unsigned first;             // leaf: first light in GetLightOrder(), interior: right child
+    float boundsMax[3];
+    unsigned count;             // lights of a leaf, 0 for interior nodes
+};
+
+struct LightBvhStats
+{
+    uint64_t builds;
+    uint64_t refits;
+    uint64_t rebuilds;          // builds of Update()
+    uint64_t nodes;             // of the last build
+    uint64_t leaves;
+    unsigned depth;
+    unsigned refitTasks;        // subtrees a refit runs in parallel
+    double buildSeconds;
+    double refitSeconds;
+
+    LightBvhStats()
+        : builds(0), refits(0), rebuilds(0), nodes(0), leaves(0), depth(0), refitTasks(0)
+        , buildSeconds(0.0), refitSeconds(0.0) {}
+};
+
+struct LightBvhQueryStats
+{
+    uint64_t queries;
+    uint64_t nodeTests;         // boxes tested
+    uint64_t lightTests;        // spheres of the leaves reached
+    uint64_t lights;            // lights returned
+
+    LightBvhQueryStats() : queries(0), nodeTests(0), lightTests(0), lights(0) {}
+
+    void Add(const LightBvhQueryStats& other)
+    {
+        queries += other.queries;
+        nodeTests += other.nodeTests;
+        lightTests += other.lightTests;
+        lights += other.lights;
+    }
+};
+
+class LightBvh
+{
+public:
+    LightBvh();
+
+    void Build(const PointLight* lights, unsigned lightCount, ThreadPool* threadPool, LightBvhStats& stats);
+
+    // lights holds the same lights as the last Build(), moved
+    void Refit(const PointLight* lights, ThreadPool* threadPool, LightBvhStats& stats);
+
+    // Refit(), or Build() if that leaves the tree kLightBvhRebuildRatio times
+    // as costly as the last build. Returns true if it built.
+    bool Update(const PointLight* lights, unsigned lightCount, ThreadPool* threadPool, LightBvhStats& stats);
+
+    // Expected box tests plus light tests of a query, relative to the root's
+    // area, as the build estimates it
+    double GetSahCost() const;
+
+    unsigned GetLightCount() const { return (unsigned)mLightOrder.size(); }
+    const std::vector<LightBvhNode>& GetNodes() const { return mNodes; }
+    const std::vector<unsigned>& GetLightOrder() const { return mLightOrder; }
+
+    // Queries see the lights of the last Build() or Refit() and are thread
+    // safe.
+
+    // Replaces lightIndices with the lights within their radius of the inner
+    // side of every plane, the test of CullTileLights()
+    void QueryPlanes(const float planes[][4], unsigned planeCount, std::vector<unsigned>& lightIndices,
+                     LightBvhQueryStats& stats) const;
+
+    // Replaces lightIndices with the lights AccumulateBRDF() lets reach
+    // position
+    void QueryPoint(const float position[3], std::vector<unsigned>& lightIndices, LightBvhQueryStats& stats) const;
+
+private:
+    // Not implemented
+    LightBvh(const LightBvh&);
+    LightBvh& operator=(const LightBvh&);
+
+    // Nodes [begin, end) of a subtree a thread refits
+    struct RefitTask
+    {
+        unsigned begin;
+        unsigned end;
+    };
+
+    unsigned BuildNode(unsigned begin, unsigned end, unsigned depth);
+    void RefitNode(unsigned node, const PointLight* lights);
+    unsigned GetSubtreeEnd(unsigned node) const;
+
+    std::vector<LightBvhNode> mNodes;
+    std::vector<unsigned> mLightOrder;
+    std::vector<float> mSpheres;                    // position and attenuationEnd, in GetLightOrder()
+    std::vector<RefitTask> mRefitTasks;
+    std::vector<unsigned> mTopNodes;                // nodes above the tasks, parents first
+    std::vector<float> mBuildBounds;                // min and max of each light's sphere, during Build()
+    double mBuiltSahCost;
+    unsigned mDepth;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTBVH_H
@@ -0,0 +1,268 @@
+#include "LightClusters.h"
+#include "LightBinning.h"
+#include "LightCulling.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <assert.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+LightClusters::LightClusters(unsigned tileDim, unsigned slices)
+    : mTileDim(tileDim), mSlices(slices), mTilesX(0), mTilesY(0), mWords(0)
+{
+    assert(tileDim > 0 && slices > 0);
+    memset(&mView, 0, sizeof(mView));
+}
+
+void LightClusters::Build(const ViewConstants& view, const PointLight* lights, unsigned lightCount,
+                          const unsigned char* occupied, SimdLevel level, ThreadPool* threadPool,
+                          LightClusterStats& stats)
+{
+    mView = view;
+    mTilesX = GetClusterTilesX(view.width, mTileDim);
+    mTilesY = GetClusterTilesY(view.height, mTileDim);
+    const unsigned tileCount = mTilesX * mTilesY;
+    const unsigned clusterCount = tileCount * mSlices;
+
+    Timer timer;
+    const LightBinLights soa = SetLightBinLights(lights, lightCount, mLightPlanes);
+    const unsigned count = soa.count;
+    mWords = count / kLightBinWordBits;
+
+    // A mask per column, then per row, then per slice
+    const LightBinningFunctions& functions = GetLightBinningFunctions(level);
+    const unsigned sideMasks = mTilesX + mTilesY;
+    mMasks.resize((size_t)(sideMasks + mSlices) * mWords + 1);
+    threadPool->ParallelFor(sideMasks + mSlices, 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            float planes[6][4];
+            if (i < sideMasks) {
+                const bool column = i < mTilesX;
+                GetTileFrustumPlanes(column ? i : 0, column ? 0 : i - mTilesX, mTileDim, 0.0f, 0.0f, view, planes);
+                functions.testPlanes(soa, column ? &planes[0] : &planes[2], &mMasks[(size_t)i * mWords]);
+            } else {
+                float nearZ, farZ;
+                GetClusterDepthBounds(i - sideMasks, mSlices, view, nearZ, farZ);
+                const float depthPlanes[2][4] = {
+                    { 0.0f, 0.0f,  1.0f, -nearZ },
+                    { 0.0f, 0.0f, -1.0f,  farZ }
+                };
+                functions.testPlanes(soa, depthPlanes, &mMasks[(size_t)i * mWords]);
+            }
+        }
+    });
+    stats.planeSeconds += timer.GetSeconds();
+
+    // Each thread appends the lists of every slice of its tiles to its own
+    // array. The words of a tile's column and row masks with lights in both
+    // are gathered once for all of its slices.
+    timer.Reset();
+    const unsigned threadCount = threadPool->GetThreadCount();
+    mClusterRanges.resize(clusterCount * 2);
+    mClusterSources.resize(clusterCount * 2);
+    mThreadIndices.resize(threadCount);
+    mThreadScratch.resize(threadCount);
+    mThreadWords.resize(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        mThreadIndices[i].clear();
+        mThreadScratch[i].resize(count + mWords + 1);
+        mThreadWords[i].resize(mWords + 1);
+    }
+    std::vector<uint64_t> wordTests(threadCount, 0);
+    std::vector<uint64_t> builtClusters(threadCount, 0);
+    threadPool->ParallelFor(tileCount, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+        std::vector<unsigned>& indices = mThreadIndices[threadIndex];
+        unsigned* scratch = &mThreadScratch[threadIndex][0];
+        unsigned* wordIndices = scratch + count;
+        uint64_t* tileWords = &mThreadWords[threadIndex][0];
+        for (unsigned tile = begin; tile < end; ++tile) {
+            const uint64_t* columnMask = &mMasks[(size_t)(tile % mTilesX) * mWords];
+            const uint64_t* rowMask = &mMasks[(size_t)(mTilesX + tile / mTilesX) * mWords];
+            unsigned words = 0;
+            for (unsigned word = 0; word < mWords; ++word) {
+                const uint64_t bits = columnMask[word] & rowMask[word];
+                if (bits != 0) {
+                    tileWords[words] = bits;
+                    wordIndices[words] = word;
+                    ++words;
+                }
+            }
+
+            for (unsigned slice = 0; slice < mSlices; ++slice) {
+                const unsigned cluster = tile + tileCount * slice;
+                unsigned clusterLights = 0;
+                if (!occupied || occupied[cluster]) {
+                    const uint64_t* sliceMask = &mMasks[(size_t)(sideMasks + slice) * mWords];
+                    for (unsigned i = 0; i < words; ++i) {
+                        clusterLights += AppendLightBits(tileWords[i] & sliceMask[wordIndices[i]],
+                                                         wordIndices[i] * kLightBinWordBits, scratch + clusterLights);
+                    }
+                    wordTests[threadIndex] += words;
+                    builtClusters[threadIndex]++;
+                }
+                mClusterSources[cluster * 2] = threadIndex;
+                mClusterSources[cluster * 2 + 1] = (unsigned)indices.size();
+                mClusterRanges[cluster * 2 + 1] = clusterLights;
+                indices.insert(indices.end(), scratch, scratch + clusterLights);
+            }
+        }
+    });
+    stats.clusterSeconds += timer.GetSeconds();
+
+    // Lists in cluster order
+    timer.Reset();
+    unsigned offset = 0;
+    for (unsigned cluster = 0; cluster < clusterCount; ++cluster) {
+        mClusterRanges[cluster * 2] = offset;
+        offset += mClusterRanges[cluster * 2 + 1];
+    }
+    mLightIndices.resize(offset);
+    threadPool->ParallelFor(clusterCount, 64, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned cluster = begin; cluster < end; ++cluster) {
+            const unsigned clusterLights = mClusterRanges[cluster * 2 + 1];
+            if (clusterLights > 0) {
+                const std::vector<unsigned>& indices = mThreadIndices[mClusterSources[cluster * 2]];
+                memcpy(&mLightIndices[mClusterRanges[cluster * 2]], &indices[mClusterSources[cluster * 2 + 1]],
+                       clusterLights * sizeof(unsigned));
+            }
+        }
+    });
+    stats.flattenSeconds += timer.GetSeconds();
+
+    stats.builds++;
+    stats.clusters += clusterCount;
+    stats.clusterLights += offset;
+    stats.planeTests += (uint64_t)(sideMasks + mSlices) * lightCount;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        stats.wordTests += wordTests[i];
+        stats.builtClusters += builtClusters[i];
+    }
+}
+
+void GetClusterDepthBounds(unsigned slice, unsigned slices, const ViewConstants& view, float& minZ, float& maxZ)
+{
+    minZ = slice == 0 ? 0.0f :
+        GetClusterSliceStart(slice, view.nearZ, view.farZ, slices) * (1.0f - STREAMING_CLUSTER_MARGIN);
+    maxZ = GetClusterSliceStart(slice + 1, view.nearZ, view.farZ, slices) * (1.0f + STREAMING_CLUSTER_MARGIN);
+}
+
+void GetOccupiedClusters(const MergeBuffers& buffers, const ViewConstants& view, unsigned tileDim,
+                         unsigned slices, std::vector<unsigned char>& occupied)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    const unsigned tileCount = GetClusterTilesX(width, tileDim) * GetClusterTilesY(height, tileDim);
+
+    occupied.assign(tileCount * slices, 0);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                const float zView = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]).zView;
+                if (zView < view.farZ) {
+                    const unsigned slice = GetClusterSlice(zView, view.nearZ, view.farZ, slices);
+                    occupied[GetClusterIndex(x, y, width, tileDim) + tileCount * slice] = 1;
+                }
+            }
+        }
+    }
+}
+
+ClusteredShadingStats::ClusteredShadingStats()
+    : nodes(0), tiledLights(0), clusteredLights(0), shadedNodes(0), mismatches(0)
+    , tiledSeconds(0.0), clusteredSeconds(0.0)
+{
+}
+
+void ClusteredShadingStats::Add(const ClusteredShadingStats& other)
+{
+    nodes += other.nodes;
+    tiledLights += other.tiledLights;
+    clusteredLights += other.clusteredLights;
+    shadedNodes += other.shadedNodes;
+    mismatches += other.mismatches;
+    tiledSeconds += other.tiledSeconds;
+    clusteredSeconds += other.clusteredSeconds;
+}
+
+void CompareClusteredShading(const MergeBuffers& buffers, const ViewConstants& view, const PointLight* lights,
+                             const LightBins& bins, const LightClusters& clusters, unsigned shadeRowStride,
+                             ThreadPool* threadPool, ClusteredShadingStats& stats)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    const unsigned surfacesPerPixel = buffers.GetSurfacesPerPixel();
+    const unsigned tileDim = bins.GetTileDim();
+    std::vector<ClusteredShadingStats> threadStats(threadPool->GetThreadCount());
+
+    threadPool->ParallelFor(height, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+        ClusteredShadingStats& local = threadStats[threadIndex];
+        for (unsigned y = begin; y < end; ++y) {
+            for (unsigned x = 0; x < width; ++x) {
+                for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                    const float zView = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]).zView;
+                    if (zView < view.farZ) {
+                        local.nodes++;
+                        local.tiledLights += bins.GetLightCount(x / tileDim, y / tileDim);
+                        local.clusteredLights += clusters.GetLightCount(clusters.GetCluster(x, y, zView));
+                    }
+                }
+            }
+        }
+    });
+    if (shadeRowStride == 0) {
+        for (size_t i = 0; i < threadStats.size(); ++i) {
+            stats.Add(threadStats[i]);
+        }
+        return;
+    }
+
+    // Shades the nodes in use of the sampled rows with the lights of list(x, y, zView)
+    const unsigned shadedRows = (height + shadeRowStride - 1) / shadeRowStride;
+    std::vector<float> lit[2];
+    for (int pass = 0; pass < 2; ++pass) {
+        lit[pass].resize((size_t)width * shadedRows * surfacesPerPixel * 3);
+        Timer timer;
+        threadPool->ParallelFor(shadedRows, 1, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+            for (unsigned row = begin; row < end; ++row) {
+                const unsigned y = row * shadeRowStride;
+                for (unsigned x = 0; x < width; ++x) {
+                    for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                        MergeNode merge = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]);
+                        const size_t offset = (((size_t)row * width + x) * surfacesPerPixel + i) * 3;
+                        float* result = &lit[pass][offset];
+                        result[0] = result[1] = result[2] = 0.0f;
+                        if (merge.zView < view.farZ) {
+                            unsigned numLights;
+                            const unsigned* listLights;
+                            if (pass == 0) {
+                                numLights = bins.GetLightCount(x / tileDim, y / tileDim);
+                                listLights = bins.GetLights(x / tileDim, y / tileDim);
+                            } else {
+                                const unsigned cluster = clusters.GetCluster(x, y, merge.zView);
+                                numLights = clusters.GetLightCount(cluster);
+                                listLights = clusters.GetLights(cluster);
+                            }
+                            SurfaceData surface = ComputeSurfaceData(x, y, merge, view);
+                            for (unsigned listIndex = 0; listIndex < numLights; ++listIndex) {
+                                AccumulateBRDF(surface, lights[listLights[listIndex]], result);
+                            }
+                        }
+                        if (pass == 1) {
+                            ClusteredShadingStats& local = threadStats[threadIndex];
+                            local.shadedNodes += merge.zView < view.farZ ? 1 : 0;
+                            local.mismatches += memcmp(result, &lit[0][offset], 3 * sizeof(float)) != 0 ? 1 : 0;
+                        }
+                    }
+                }
+            }
+        });
+        (pass == 0 ? stats.tiledSeconds : stats.clusteredSeconds) += timer.GetSeconds();
+    }
+
+    for (size_t i = 0; i < threadStats.size(); ++i) {
+        stats.Add(threadStats[i]);
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,143 @@
+#ifndef STREAMINGCPU_LIGHTCLUSTERS_H
+#define STREAMINGCPU_LIGHTCLUSTERS_H
+
+// Clustered light lists for CULL_STREAMING_SBAA_NDI_CLUSTERED. A tile's list
+// has to hold every light between its nearest and farthest surface, which at
+// the edges the streaming technique keeps several surfaces for spans most of
+// the scene. Cutting each tile into the exponential depth slices of
+// StreamingClusters.h gives each surface the lights of its own slice instead.
+//
+// The lists are built like LightBins: each light is tested against the side
+// planes of every column and row and against the depth planes of every slice
+// once, in SoA lanes, into bit masks. A cluster ANDs the masks of its column,
+// row and slice. Nothing depends on the frame's depths, so the app builds the
+// lists from the lights alone before the resolve. Every test is conservative,
+// so shading a surface with its cluster's list gives exactly what its tile's
+// list, and BasicLoop over every light, give.
+//
+// The lists are flat like those of LightBins: a uint2 of offset and count per
+// cluster, numbered as GetClusterIndex() does, into one array of light
+// indices, each list ascending.
+
+#include "../ShaderDefines.h"
+#include "../Shaders/StreamingClusters.h"
+#include "CpuFeatures.h"
+#include "Lighting.h"
+#include "MergeBuffers.h"
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class LightBins;
+class ThreadPool;
+
+struct LightClusterStats
+{
+    uint64_t builds;
+    uint64_t clusters;
+    uint64_t builtClusters;     // clusters whose list was built, the others are left empty
+    uint64_t clusterLights;     // sum of the list lengths
+    uint64_t planeTests;        // lights tested against a column's, a row's or a slice's planes
+    uint64_t wordTests;         // mask words ANDed for a cluster
+    double planeSeconds;        // column, row and slice masks
+    double clusterSeconds;      // cluster lists
+    double flattenSeconds;      // gathering the lists into one array
+
+    LightClusterStats()
+        : builds(0), clusters(0), builtClusters(0), clusterLights(0), planeTests(0), wordTests(0)
+        , planeSeconds(0.0), clusterSeconds(0.0), flattenSeconds(0.0) {}
+
+    double GetSeconds() const { return planeSeconds + clusterSeconds + flattenSeconds; }
+};
+
+class LightClusters
+{
+public:
+    explicit LightClusters(unsigned tileDim = STREAMING_CLUSTER_TILE_DIM, unsigned slices = STREAMING_CLUSTER_SLICES);
+
+    // occupied, if not null, has a byte per cluster and only the clusters
+    // with a non-zero one get a list, as GetOccupiedClusters() marks them
+    void Build(const ViewConstants& view, const PointLight* lights, unsigned lightCount,
+               const unsigned char* occupied, SimdLevel level, ThreadPool* threadPool, LightClusterStats& stats);
+
+    unsigned GetTileDim() const { return mTileDim; }
+    unsigned GetSlices() const { return mSlices; }
+    unsigned GetTilesX() const { return mTilesX; }
+    unsigned GetTilesY() const { return mTilesY; }
+    unsigned GetClusterCount() const { return mTilesX * mTilesY * mSlices; }
+
+    // Cluster of a surface of pixel (x, y) at view depth zView
+    unsigned GetCluster(unsigned x, unsigned y, float zView) const
+    {
+        return GetClusterIndex(x, y, mView.width, mTileDim) +
+               mTilesX * mTilesY * GetClusterSlice(zView, mView.nearZ, mView.farZ, mSlices);
+    }
+
+    unsigned GetLightCount(unsigned cluster) const { return mClusterRanges[cluster * 2 + 1]; }
+    const unsigned* GetLights(unsigned cluster) const
+    {
+        return mLightIndices.empty() ? 0 : &mLightIndices[0] + mClusterRanges[cluster * 2];
+    }
+
+    // What the resolve reads: offset and count per cluster, and the indices
+    const std::vector<unsigned>& GetClusterRanges() const { return mClusterRanges; }
+    const std::vector<unsigned>& GetLightIndices() const { return mLightIndices; }
+
+private:
+    // Not implemented
+    LightClusters(const LightClusters&);
+    LightClusters& operator=(const LightClusters&);
+
+    unsigned mTileDim;
+    unsigned mSlices;
+    unsigned mTilesX;
+    unsigned mTilesY;
+    unsigned mWords;                                // mask words per column, row or slice
+    ViewConstants mView;
+    std::vector<float> mLightPlanes;                // SetLightBinLights()
+    std::vector<uint64_t> mMasks;                   // columns, then rows, then slices
+    std::vector<unsigned> mClusterRanges;
+    std::vector<unsigned> mLightIndices;
+    std::vector<unsigned> mClusterSources;          // thread and offset of each list before flattening
+    std::vector<std::vector<unsigned> > mThreadIndices;
+    std::vector<std::vector<unsigned> > mThreadScratch; // room for every light
+    std::vector<std::vector<uint64_t> > mThreadWords;   // a tile's column and row masks ANDed
+};
+
+// View depths the lists of slice are built for: the slice widened by
+// STREAMING_CLUSTER_MARGIN, the first reaching back to the eye. With the side
+// planes of GetTileFrustumPlanes() these bound a cluster.
+void GetClusterDepthBounds(unsigned slice, unsigned slices, const ViewConstants& view, float& minZ, float& maxZ);
+
+// Sets the byte of every cluster of clusters' grid holding a node in use in
+// front of the far plane
+void GetOccupiedClusters(const MergeBuffers& buffers, const ViewConstants& view, unsigned tileDim,
+                         unsigned slices, std::vector<unsigned char>& occupied);
+
+struct ClusteredShadingStats
+{
+    uint64_t nodes;             // nodes in use in front of the far plane
+    uint64_t tiledLights;       // list lengths of their tiles
+    uint64_t clusteredLights;   // and of their clusters
+    uint64_t shadedNodes;       // nodes shaded with both lists
+    uint64_t mismatches;        // of those, nodes whose results differ in any bit
+    double tiledSeconds;
+    double clusteredSeconds;
+
+    ClusteredShadingStats();
+
+    void Add(const ClusteredShadingStats& other);
+};
+
+// Counts the lights each node in use would loop over with the lists of bins
+// and with those of clusters, which must have been built for view. The nodes
+// of every shadeRowStride-th row, none if 0, are also shaded with both lists
+// and compared bit for bit.
+void CompareClusteredShading(const MergeBuffers& buffers, const ViewConstants& view, const PointLight* lights,
+                             const LightBins& bins, const LightClusters& clusters, unsigned shadeRowStride,
+                             ThreadPool* threadPool, ClusteredShadingStats& stats);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTCLUSTERS_H
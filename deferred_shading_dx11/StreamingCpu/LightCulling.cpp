@@ -0,0 +1,202 @@
+#include "LightCulling.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <string.h>
+
+namespace StreamingCpu {
+
+TileLightLists::TileLightLists(unsigned width, unsigned height, unsigned maxLights, unsigned tileDim)
+    : mWidth(width)
+    , mHeight(height)
+    , mMaxLights(maxLights)
+    , mTileDim(tileDim)
+    , mBuffer(GetTilesX() * GetTilesY() * (maxLights + 1), 0)
+{
+}
+
+void TileLightLists::Build(const MergeBuffers& buffers, const ViewConstants& view,
+                           const PointLight* lights, unsigned lightCount, ThreadPool* threadPool)
+{
+    const unsigned tilesX = GetTilesX();
+    threadPool->ParallelFor(tilesX * GetTilesY(), 16, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned tile = begin; tile < end; ++tile) {
+            BuildTile(tile % tilesX, tile / tilesX, buffers, view, lights, lightCount);
+        }
+    });
+}
+
+void TileLightLists::BuildTile(unsigned tileX, unsigned tileY, const MergeBuffers& buffers,
+                               const ViewConstants& view, const PointLight* lights, unsigned lightCount)
+{
+    const unsigned x0 = tileX * mTileDim;
+    const unsigned y0 = tileY * mTileDim;
+    const unsigned x1 = x0 + mTileDim < mWidth ? x0 + mTileDim : mWidth;
+    const unsigned y1 = y0 + mTileDim < mHeight ? y0 + mTileDim : mHeight;
+
+    // Z bounds of the nodes in use, empty tiles keep bounds that reject every light
+    float minTileZ = 3.40282347e+38f;
+    float maxTileZ = 0.0f;
+    for (unsigned y = y0; y < y1; ++y) {
+        for (unsigned x = x0; x < x1; ++x) {
+            for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                float viewSpaceZ = buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)].zView;
+                if (viewSpaceZ >= view.nearZ && viewSpaceZ < view.farZ) {
+                    minTileZ = viewSpaceZ < minTileZ ? viewSpaceZ : minTileZ;
+                    maxTileZ = viewSpaceZ > maxTileZ ? viewSpaceZ : maxTileZ;
+                }
+            }
+        }
+    }
+
+    unsigned* list = &mBuffer[GetAddress(x0, y0)];
+    list[0] = CullTileLights(tileX, tileY, mTileDim, minTileZ, maxTileZ, view, lights, lightCount, &list[1]);
+}
+
+void GetTileFrustumPlanes(unsigned tileX, unsigned tileY, unsigned tileDim, float minTileZ, float maxTileZ,
+                          const ViewConstants& view, float frustumPlanes[6][4])
+{
+    // Same planes as StreamingLightCullCS
+    const float tileScaleX = (float)view.width / (float)(2 * tileDim);
+    const float tileScaleY = (float)view.height / (float)(2 * tileDim);
+    const float tileBiasX = tileScaleX - (float)tileX;
+    const float tileBiasY = tileScaleY - (float)tileY;
+    const float c1[4] = { view.proj11 * tileScaleX, 0.0f, tileBiasX, 0.0f };
+    const float c2[4] = { 0.0f, -view.proj22 * tileScaleY, tileBiasY, 0.0f };
+    const float c4[4] = { 0.0f, 0.0f, 1.0f, 0.0f };
+
+    for (int i = 0; i < 4; ++i) {
+        frustumPlanes[0][i] = c4[i] - c1[i];
+        frustumPlanes[1][i] = c4[i] + c1[i];
+        frustumPlanes[2][i] = c4[i] - c2[i];
+        frustumPlanes[3][i] = c4[i] + c2[i];
+    }
+    const float nearPlane[4] = { 0.0f, 0.0f, 1.0f, -minTileZ };
+    const float farPlane[4] = { 0.0f, 0.0f, -1.0f, maxTileZ };
+    memcpy(frustumPlanes[4], nearPlane, sizeof(nearPlane));
+    memcpy(frustumPlanes[5], farPlane, sizeof(farPlane));
+    for (int i = 0; i < 4; ++i) {
+        float rcpLength = 1.0f / sqrtf(Dot3(frustumPlanes[i], frustumPlanes[i]));
+        for (int j = 0; j < 4; ++j) {
+            frustumPlanes[i][j] *= rcpLength;
+        }
+    }
+}
+
+unsigned CullTileLights(unsigned tileX, unsigned tileY, unsigned tileDim, float minTileZ, float maxTileZ,
+                        const ViewConstants& view, const PointLight* lights, unsigned lightCount,
+                        unsigned* tileLights)
+{
+    float frustumPlanes[6][4];
+    GetTileFrustumPlanes(tileX, tileY, tileDim, minTileZ, maxTileZ, view, frustumPlanes);
+
+    unsigned count = 0;
+    for (unsigned lightIndex = 0; lightIndex < lightCount; ++lightIndex) {
+        const PointLight& light = lights[lightIndex];
+        bool inFrustum = true;
+        for (int i = 0; i < 6; ++i) {
+            float d = Dot3(frustumPlanes[i], light.positionView) + frustumPlanes[i][3];
+            inFrustum = inFrustum && (d >= -light.attenuationEnd);
+        }
+        if (inFrustum) {
+            tileLights[count++] = lightIndex;
+        }
+    }
+    return count;
+}
+
+TiledShadingStats::TiledShadingStats()
+    : tiles(0), tileLights(0), nodes(0), mismatches(0), bruteForceLights(0), tiledLights(0)
+    , cullSeconds(0.0), bruteForceSeconds(0.0), tiledSeconds(0.0)
+{
+}
+
+void TiledShadingStats::Add(const TiledShadingStats& other)
+{
+    tiles += other.tiles;
+    tileLights += other.tileLights;
+    nodes += other.nodes;
+    mismatches += other.mismatches;
+    bruteForceLights += other.bruteForceLights;
+    tiledLights += other.tiledLights;
+    cullSeconds += other.cullSeconds;
+    bruteForceSeconds += other.bruteForceSeconds;
+    tiledSeconds += other.tiledSeconds;
+}
+
+void CompareTiledShading(const MergeBuffers& buffers, const ViewConstants& view,
+                         const PointLight* lights, unsigned lightCount,
+                         TileLightLists& lists, ThreadPool* threadPool, TiledShadingStats& stats)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    const unsigned surfacesPerPixel = buffers.GetSurfacesPerPixel();
+
+    Timer timer;
+    lists.Build(buffers, view, lights, lightCount, threadPool);
+    stats.cullSeconds += timer.GetSeconds();
+
+    stats.tiles += lists.GetTilesX() * lists.GetTilesY();
+    for (unsigned tileY = 0; tileY < lists.GetTilesY(); ++tileY) {
+        for (unsigned tileX = 0; tileX < lists.GetTilesX(); ++tileX) {
+            stats.tileLights += lists.GetLightCount(tileX * lists.GetTileDim(), tileY * lists.GetTileDim());
+        }
+    }
+
+    // BasicLoop over every light, kept per node for the comparison
+    std::vector<float> reference((size_t)width * height * surfacesPerPixel * 3);
+    std::vector<TiledShadingStats> threadStats(threadPool->GetThreadCount());
+    timer.Reset();
+    threadPool->ParallelFor(height, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+        TiledShadingStats& local = threadStats[threadIndex];
+        for (unsigned y = begin; y < end; ++y) {
+            for (unsigned x = 0; x < width; ++x) {
+                for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                    MergeNode merge = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]);
+                    float* lit = &reference[((size_t)buffers.GetNodeCountIndex(x, y) * surfacesPerPixel + i) * 3];
+                    lit[0] = lit[1] = lit[2] = 0.0f;
+                    if (merge.zView < view.farZ) {
+                        SurfaceData surface = ComputeSurfaceData(x, y, merge, view);
+                        for (unsigned lightIndex = 0; lightIndex < lightCount; ++lightIndex) {
+                            AccumulateBRDF(surface, lights[lightIndex], lit);
+                        }
+                        local.nodes++;
+                        local.bruteForceLights += lightCount;
+                    }
+                }
+            }
+        }
+    });
+    stats.bruteForceSeconds += timer.GetSeconds();
+
+    // BasicLoopTiled
+    timer.Reset();
+    threadPool->ParallelFor(height, 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+        TiledShadingStats& local = threadStats[threadIndex];
+        for (unsigned y = begin; y < end; ++y) {
+            for (unsigned x = 0; x < width; ++x) {
+                const unsigned numLights = lists.GetLightCount(x, y);
+                const unsigned* tileLights = lists.GetLights(x, y);
+                for (unsigned i = 0; i < buffers.GetNodeCount(x, y); ++i) {
+                    MergeNode merge = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, i)]);
+                    float lit[3] = { 0.0f, 0.0f, 0.0f };
+                    if (merge.zView < view.farZ) {
+                        SurfaceData surface = ComputeSurfaceData(x, y, merge, view);
+                        for (unsigned tileLightIndex = 0; tileLightIndex < numLights; ++tileLightIndex) {
+                            AccumulateBRDF(surface, lights[tileLights[tileLightIndex]], lit);
+                        }
+                        local.tiledLights += numLights;
+                    }
+                    const float* expected = &reference[((size_t)buffers.GetNodeCountIndex(x, y) * surfacesPerPixel + i) * 3];
+                    local.mismatches += memcmp(lit, expected, sizeof(lit)) != 0 ? 1 : 0;
+                }
+            }
+        }
+    });
+    stats.tiledSeconds += timer.GetSeconds();
+
+    for (size_t i = 0; i < threadStats.size(); ++i) {
+        stats.Add(threadStats[i]);
+    }
+}
+
+} // namespace StreamingCpu
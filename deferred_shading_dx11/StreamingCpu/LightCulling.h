@@ -0,0 +1,102 @@
+#ifndef STREAMINGCPU_LIGHTCULLING_H
+#define STREAMINGCPU_LIGHTCULLING_H
+
+// CPU reference of StreamingLightCullCS and of the two light loops of the
+// streaming resolve. Shading a node with the lights of its tile has to give
+// exactly what BasicLoop over every light gives; CompareTiledShading checks
+// that for every node in use.
+
+#include "../ShaderDefines.h"
+#include "Lighting.h"
+#include "MergeBuffers.h"
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+// Planes of StreamingLightCullCS for the tileDim tile (tileX, tileY) with view
+// depths [minTileZ, maxTileZ]: left, right, top, bottom, near, far. The side
+// planes only depend on tileX or tileY.
+void GetTileFrustumPlanes(unsigned tileX, unsigned tileY, unsigned tileDim, float minTileZ, float maxTileZ,
+                          const ViewConstants& view, float frustumPlanes[6][4]);
+
+// Frustum test of StreamingLightCullCS for the tileDim tile (tileX, tileY)
+// with view depths [minTileZ, maxTileZ]. Writes the indices of the lights
+// that pass in ascending order and returns how many did.
+unsigned CullTileLights(unsigned tileX, unsigned tileY, unsigned tileDim, float minTileZ, float maxTileZ,
+                        const ViewConstants& view, const PointLight* lights, unsigned lightCount,
+                        unsigned* tileLights);
+
+// Per-tile light lists in the layout StreamingLightCullCS writes, see
+// GetTileLightListAddress()
+class TileLightLists
+{
+public:
+    // maxLights is the room per tile, MAX_LIGHTS on the GPU
+    TileLightLists(unsigned width, unsigned height, unsigned maxLights,
+                   unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM);
+
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    unsigned GetTileDim() const { return mTileDim; }
+    unsigned GetTilesX() const { return (mWidth + mTileDim - 1) / mTileDim; }
+    unsigned GetTilesY() const { return (mHeight + mTileDim - 1) / mTileDim; }
+    unsigned GetMaxLights() const { return mMaxLights; }
+
+    // Culls against the nodes in use, like StreamingLightCullCS. lightCount
+    // must not exceed GetMaxLights().
+    void Build(const MergeBuffers& buffers, const ViewConstants& view,
+               const PointLight* lights, unsigned lightCount, ThreadPool* threadPool);
+
+    // List of the tile holding pixel (x, y)
+    unsigned GetLightCount(unsigned x, unsigned y) const { return mBuffer[GetAddress(x, y)]; }
+    const unsigned* GetLights(unsigned x, unsigned y) const { return &mBuffer[GetAddress(x, y) + 1]; }
+
+    const std::vector<unsigned>& GetBuffer() const { return mBuffer; }
+
+private:
+    unsigned GetAddress(unsigned x, unsigned y) const
+    {
+        return GetTileLightListAddress(x, y, mWidth, mTileDim, mMaxLights);
+    }
+
+    void BuildTile(unsigned tileX, unsigned tileY, const MergeBuffers& buffers, const ViewConstants& view,
+                   const PointLight* lights, unsigned lightCount);
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mMaxLights;
+    unsigned mTileDim;
+    std::vector<unsigned> mBuffer;
+};
+
+struct TiledShadingStats
+{
+    uint64_t tiles;
+    uint64_t tileLights;        // sum of the list lengths
+    uint64_t nodes;             // nodes in use in front of the far plane
+    uint64_t mismatches;        // nodes whose tiled result differs in any bit
+    uint64_t bruteForceLights;  // light evaluations of each loop
+    uint64_t tiledLights;
+    double cullSeconds;
+    double bruteForceSeconds;
+    double tiledSeconds;
+
+    TiledShadingStats();
+
+    void Add(const TiledShadingStats& other);
+};
+
+// Builds the lists and shades every node in use with BasicLoop and with the
+// tile loop of StreamingResolveTiledPS, comparing the results bit for bit.
+// The resolve weights nodes the same way in both cases, so equal nodes give
+// equal pixels.
+void CompareTiledShading(const MergeBuffers& buffers, const ViewConstants& view,
+                         const PointLight* lights, unsigned lightCount,
+                         TileLightLists& lists, ThreadPool* threadPool, TiledShadingStats& stats);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTCULLING_H
@@ -0,0 +1,108 @@
+#ifndef STREAMINGCPU_LIGHTING_H
+#define STREAMINGCPU_LIGHTING_H
+
+// C++ versions of the surface reconstruction in GBuffer.hlsl and of
+// AccumulateBRDF from Rendering.hlsl, as StreamingResolvePS runs them on a
+// merge node. The operation order follows the shader source.
+
+#include "../Shaders/StreamingStructs.h"
+#include "SphereMap.h"
+#include <math.h>
+
+namespace StreamingCpu {
+
+// NOTE: Must match PointLight in Rendering.hlsl
+struct PointLight
+{
+    float positionView[3];
+    float attenuationBegin;
+    float color[3];
+    float attenuationEnd;
+};
+
+// The parts of PerFrameConstants the resolve reads
+struct ViewConstants
+{
+    float proj11;               // mCameraProj._11
+    float proj22;               // mCameraProj._22
+    float nearZ;                // mCameraNearFar
+    float farZ;
+    unsigned width;             // mFramebufferDimensions
+    unsigned height;
+};
+
+struct SurfaceData
+{
+    float positionView[3];
+    float normal[3];
+    float albedo[3];
+    float specularAmount;
+    float specularPower;
+};
+
+// ComputeSurfaceDataFromGBufferData with GetGBufferFromShadeAndMergeNodes,
+// leaving out the position derivatives
+inline SurfaceData ComputeSurfaceData(unsigned x, unsigned y, const MergeNode& merge, const ViewConstants& view)
+{
+    float screenPixelOffsetX = 2.0f / (float)view.width;
+    float screenPixelOffsetY = -2.0f / (float)view.height;
+    float positionScreenX = ((float)x + 0.5f) * screenPixelOffsetX + -1.0f;
+    float positionScreenY = ((float)y + 0.5f) * screenPixelOffsetY + 1.0f;
+
+    SurfaceData surface;
+    surface.positionView[0] = positionScreenX / view.proj11 * merge.zView;
+    surface.positionView[1] = positionScreenY / view.proj22 * merge.zView;
+    surface.positionView[2] = merge.zView;
+    DecodeSphereMap(merge.normal, surface.normal);
+    for (int i = 0; i < 3; ++i) {
+        surface.albedo[i] = merge.shade.albedo[i];
+    }
+    surface.specularAmount = merge.shade.specular[0];
+    surface.specularPower = merge.shade.specular[1];
+    return surface;
+}
+
+inline void AccumulateBRDF(const SurfaceData& surface, const PointLight& light, float lit[3])
+{
+    float directionToLight[3];
+    for (int i = 0; i < 3; ++i) {
+        directionToLight[i] = light.positionView[i] - surface.positionView[i];
+    }
+    float distanceToLight = sqrtf(Dot3(directionToLight, directionToLight));
+
+    if (distanceToLight < light.attenuationEnd) {
+        float attenuation = (distanceToLight - light.attenuationEnd) / (light.attenuationBegin - light.attenuationEnd);
+        attenuation = attenuation < 0.0f ? 0.0f : (attenuation > 1.0f ? 1.0f : attenuation);
+        float rcpDistance = 1.0f / distanceToLight;
+        for (int i = 0; i < 3; ++i) {
+            directionToLight[i] *= rcpDistance;
+        }
+
+        // AccumulatePhongBRDF
+        float NdotL = Dot3(surface.normal, directionToLight);
+        if (NdotL > 0.0f) {
+            float r[3];
+            for (int i = 0; i < 3; ++i) {
+                r[i] = directionToLight[i] - 2.0f * NdotL * surface.normal[i];
+            }
+            float rcpLength = 1.0f / sqrtf(Dot3(surface.positionView, surface.positionView));
+            float viewDir[3] = { surface.positionView[0] * rcpLength,
+                                 surface.positionView[1] * rcpLength,
+                                 surface.positionView[2] * rcpLength };
+            float RdotV = Dot3(r, viewDir);
+            RdotV = RdotV > 0.0f ? RdotV : 0.0f;
+            float specular = powf(RdotV, surface.specularPower);
+
+            for (int i = 0; i < 3; ++i) {
+                float lightContrib = attenuation * light.color[i];
+                float litDiffuse = lightContrib * NdotL;
+                float litSpecular = lightContrib * specular;
+                lit[i] += surface.albedo[i] * (litDiffuse + surface.specularAmount * litSpecular);
+            }
+        }
+    }
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LIGHTING_H
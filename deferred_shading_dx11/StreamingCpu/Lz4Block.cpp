@@ -0,0 +1,199 @@
+#include "Lz4Block.h"
+#include <string.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+// Format limits
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;     // the block always ends with this many literals
+static const size_t kMatchFindLimit = 12;  // no match may start in the last 12 bytes
+static const size_t kMaxOffset = 65535;
+
+static const unsigned kHashLog = 12;
+static const unsigned kNoPosition = 0xFFFFFFFF;
+
+static unsigned Read32(const unsigned char* p)
+{
+    unsigned value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned Hash(unsigned sequence)
+{
+    return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+// Writes the 255 continuation bytes of a length that did not fit in the token
+static unsigned char* WriteLength(unsigned char* op, size_t length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static bool ReadLength(const unsigned char*& ip, const unsigned char* iend, size_t& length)
+{
+    unsigned char b;
+    do {
+        if (ip >= iend) {
+            return false;
+        }
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+// Room needed for a sequence with this many literals, excluding the literals
+static size_t GetSequenceOverhead(size_t literalCount, size_t matchLength)
+{
+    return 1 + 2 + (literalCount >= 15 ? literalCount / 255 + 1 : 0) +
+           (matchLength - kMinMatch >= 15 ? (matchLength - kMinMatch) / 255 + 1 : 0);
+}
+
+size_t Lz4Compress(const void* src, size_t srcSize, void* dst, size_t dstCapacity)
+{
+    const unsigned char* const base = (const unsigned char*)src;
+    const unsigned char* const iend = base + srcSize;
+    unsigned char* op = (unsigned char*)dst;
+    unsigned char* const oend = op + dstCapacity;
+
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;
+
+    if (srcSize > kMatchFindLimit) {
+        const unsigned char* const mflimit = iend - kMatchFindLimit;
+        const unsigned char* const matchlimit = iend - kLastLiterals;
+        std::vector<unsigned> table(1 << kHashLog, kNoPosition);
+
+        while (ip < mflimit) {
+            const unsigned sequence = Read32(ip);
+            const unsigned h = Hash(sequence);
+            const unsigned position = (unsigned)(ip - base);
+            const unsigned candidate = table[h];
+            table[h] = position;
+
+            if (candidate == kNoPosition || position - candidate > kMaxOffset ||
+                Read32(base + candidate) != sequence) {
+                ++ip;
+                continue;
+            }
+
+            const unsigned char* match = base + candidate;
+            size_t matchLength = kMinMatch;
+            while (ip + matchLength < matchlimit && ip[matchLength] == match[matchLength]) {
+                ++matchLength;
+            }
+
+            const size_t literalCount = (size_t)(ip - anchor);
+            if ((size_t)(oend - op) < literalCount + GetSequenceOverhead(literalCount, matchLength)) {
+                return 0;
+            }
+
+            unsigned char* token = op++;
+            const size_t matchCode = matchLength - kMinMatch;
+            *token = (unsigned char)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+            if (literalCount >= 15) {
+                op = WriteLength(op, literalCount - 15);
+            }
+            memcpy(op, anchor, literalCount);
+            op += literalCount;
+
+            const size_t offset = (size_t)(ip - match);
+            *op++ = (unsigned char)(offset & 0xFF);
+            *op++ = (unsigned char)(offset >> 8);
+            if (matchCode >= 15) {
+                op = WriteLength(op, matchCode - 15);
+            }
+
+            ip += matchLength;
+            anchor = ip;
+        }
+    }
+
+    // Last literals
+    const size_t literalCount = (size_t)(iend - anchor);
+    const size_t overhead = 1 + (literalCount >= 15 ? literalCount / 255 + 1 : 0);
+    if ((size_t)(oend - op) < literalCount + overhead) {
+        return 0;
+    }
+    *op++ = (unsigned char)((literalCount < 15 ? literalCount : 15) << 4);
+    if (literalCount >= 15) {
+        op = WriteLength(op, literalCount - 15);
+    }
+    memcpy(op, anchor, literalCount);
+    op += literalCount;
+
+    return (size_t)(op - (unsigned char*)dst);
+}
+
+bool Lz4Decompress(const void* src, size_t srcSize, void* dst, size_t dstSize)
+{
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* const iend = ip + srcSize;
+    unsigned char* const obase = (unsigned char*)dst;
+    unsigned char* op = obase;
+    unsigned char* const oend = op + dstSize;
+
+    for (;;) {
+        if (ip >= iend) {
+            return false;
+        }
+        const unsigned token = *ip++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !ReadLength(ip, iend, literalCount)) {
+            return false;
+        }
+        if (literalCount > (size_t)(iend - ip) || literalCount > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        // The last sequence has no match
+        if (ip == iend) {
+            return op == oend;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        const size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - obase)) {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(ip, iend, matchLength)) {
+            return false;
+        }
+        matchLength += kMinMatch;
+        if (matchLength > (size_t)(oend - op)) {
+            return false;
+        }
+
+        const unsigned char* match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+        } else if (offset == 1) {
+            // Byte runs are the common case for shuffled fragments
+            memset(op, *match, matchLength);
+        } else {
+            // Overlapping copy repeats the last offset bytes
+            for (size_t i = 0; i < matchLength; ++i) {
+                op[i] = match[i];
+            }
+        }
+        op += matchLength;
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,35 @@
+#ifndef STREAMINGCPU_LZ4BLOCK_H
+#define STREAMINGCPU_LZ4BLOCK_H
+
+// Small compressor that writes the LZ4 block format (token, literals, 16 bit
+// offset, extended lengths), so chunks can also be inspected with stock lz4
+// tools. Greedy single-probe matching: fast rather than tight.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace StreamingCpu {
+
+// Worst case output size for srcSize bytes of input
+inline size_t Lz4CompressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+// Most bytes srcSize bytes of compressed input can decode to. Past the token,
+// each extra length byte adds at most 255 bytes of match.
+inline uint64_t Lz4DecompressBound(uint64_t srcSize)
+{
+    return srcSize * 255;
+}
+
+// Returns the compressed size, or 0 if the output does not fit in dstCapacity.
+size_t Lz4Compress(const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+
+// Decodes exactly dstSize bytes. Returns false on malformed input instead of
+// reading or writing out of bounds.
+bool Lz4Decompress(const void* src, size_t srcSize, void* dst, size_t dstSize);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_LZ4BLOCK_H
@@ -0,0 +1,126 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace StreamingCpu {
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile()
+    : mData(0), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(0)
+{
+}
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (mFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0 ||
+        (unsigned long long)size.QuadPart > (size_t)-1) {
+        Close();
+        return false;
+    }
+
+    mMapping = CreateFileMappingA(mFile, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mMapping) {
+        Close();
+        return false;
+    }
+
+    mData = (const unsigned char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mData) {
+        Close();
+        return false;
+    }
+    mSize = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData) {
+        UnmapViewOfFile(mData);
+        mData = 0;
+    }
+    if (mMapping) {
+        CloseHandle(mMapping);
+        mMapping = 0;
+    }
+    if (mFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(mFile);
+        mFile = INVALID_HANDLE_VALUE;
+    }
+    mSize = 0;
+}
+
+#else // !defined(_WIN32)
+
+MappedFile::MappedFile()
+    : mData(0), mSize(0)
+{
+}
+
+bool MappedFile::Open(const char* path)
+{
+    Close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    mData = (const unsigned char*)data;
+    mSize = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData) {
+        munmap((void*)mData, mSize);
+        mData = 0;
+    }
+    mSize = 0;
+}
+
+#endif // !defined(_WIN32)
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,37 @@
+#ifndef STREAMINGCPU_MAPPEDFILE_H
+#define STREAMINGCPU_MAPPEDFILE_H
+
+#include <stddef.h>
+
+namespace StreamingCpu {
+
+// Read-only view of a whole file. The OS pages data in on demand.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const char* path);
+    void Close();
+
+    bool IsOpen() const { return mData != 0; }
+    const unsigned char* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+
+private:
+    // Not implemented
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* mData;
+    size_t mSize;
+#if defined(_WIN32)
+    void* mFile;
+    void* mMapping;
+#endif // defined(_WIN32)
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MAPPEDFILE_H
@@ -0,0 +1,133 @@
+#include "MergeAccessTrace.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// MergeBuffers::Pixel that reports what it touches
+template <unsigned SurfacesPerPixel>
+class TracingPixel
+{
+public:
+    typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+    TracingPixel(MergeBuffers& buffers, unsigned x, unsigned y, MergeAccessSink& sink)
+        : mPixel(buffers, x, y), mSink(sink), mX(x), mY(y) {}
+
+    unsigned GetNodeCount() const
+    {
+        mSink.OnAccess(MERGE_RESOURCE_COUNT, mX, mY, 0, false);
+        return mPixel.GetNodeCount();
+    }
+
+    void SetNodeCount(unsigned value)
+    {
+        mSink.OnAccess(MERGE_RESOURCE_COUNT, mX, mY, 0, true);
+        mPixel.SetNodeCount(value);
+    }
+
+    unsigned GetNodeList() const
+    {
+        mSink.OnAccess(MERGE_RESOURCE_LIST, mX, mY, 0, false);
+        return mPixel.GetNodeList();
+    }
+
+    void SetNodeList(unsigned nodeList)
+    {
+        mSink.OnAccess(MERGE_RESOURCE_LIST, mX, mY, 0, true);
+        mPixel.SetNodeList(nodeList);
+    }
+
+    MergeNode GetMergeNode(unsigned index) const
+    {
+        mSink.OnAccess(MERGE_RESOURCE_NODE, mX, mY, index, false);
+        return mPixel.GetMergeNode(index);
+    }
+
+    void SetMergeNode(unsigned index, const MergeNode& merge)
+    {
+        mSink.OnAccess(MERGE_RESOURCE_NODE, mX, mY, index, true);
+        mPixel.SetMergeNode(index, merge);
+    }
+
+    bool AllocatePoolBlock() { return mPixel.AllocatePoolBlock(); }
+
+    void SetDiscardedSamples(unsigned discardedSamples)
+    {
+        mSink.OnAccess(MERGE_RESOURCE_COUNT, mX, mY, 0, true);
+        mPixel.SetDiscardedSamples(discardedSamples);
+    }
+
+    void AddHiZOccluder(unsigned, float) {}
+    unsigned PredictNode(unsigned, float, float) const { return STREAMING_PREDICTION_LOAD; }
+
+private:
+    MergeBuffers::Pixel<SurfacesPerPixel> mPixel;
+    MergeAccessSink& mSink;
+    unsigned mX;
+    unsigned mY;
+};
+
+template <unsigned SurfacesPerPixel>
+void TraceMergeAccesses(MergeBuffers& buffers, const Fragment* fragments, size_t count,
+                        MergeAccessSink& sink, MergeStats& stats)
+{
+    for (size_t i = 0; i < count; ++i) {
+        TracingPixel<SurfacesPerPixel> pixel(buffers, fragments[i].x, fragments[i].y, sink);
+        MergeFragment(pixel, GetIncomingMergeNode(fragments[i]), stats);
+    }
+}
+
+uint64_t AlignToPage(uint64_t value, unsigned pageBytes)
+{
+    return (value + pageBytes - 1) / pageBytes * pageBytes;
+}
+
+} // namespace
+
+void TraceMergeAccesses(MergeBuffers& buffers, const Fragment* fragments, size_t count,
+                        MergeAccessSink& sink, MergeStats& stats)
+{
+    switch (buffers.GetSurfacesPerPixel()) {
+        case 1: TraceMergeAccesses<1>(buffers, fragments, count, sink, stats); break;
+        case 2: TraceMergeAccesses<2>(buffers, fragments, count, sink, stats); break;
+        case 3: TraceMergeAccesses<3>(buffers, fragments, count, sink, stats); break;
+        case 4: TraceMergeAccesses<4>(buffers, fragments, count, sink, stats); break;
+        case 5: TraceMergeAccesses<5>(buffers, fragments, count, sink, stats); break;
+        case 6: TraceMergeAccesses<6>(buffers, fragments, count, sink, stats); break;
+        case 7: TraceMergeAccesses<7>(buffers, fragments, count, sink, stats); break;
+        case 8: TraceMergeAccesses<8>(buffers, fragments, count, sink, stats); break;
+        default: assert(!"unsupported surfaces per pixel"); break;
+    }
+}
+
+MergeCacheModel::MergeCacheModel(unsigned width, unsigned height, unsigned surfacesPerPixel,
+                                 const AddressMapping& mapping, const CacheSimulatorDesc& desc)
+    : mWidth(width), mSurfacesPerPixel(surfacesPerPixel), mPlaneSize(mapping.GetPlaneSize(width, height))
+    , mMapping(mapping), mCache(desc)
+{
+    const uint64_t textureBytes = (uint64_t)width * height * sizeof(unsigned);
+    mCountBase = AlignToPage((uint64_t)mPlaneSize * surfacesPerPixel * sizeof(MergeNodePacked), desc.pageBytes);
+    mListBase = AlignToPage(mCountBase + textureBytes, desc.pageBytes);
+}
+
+void MergeCacheModel::OnAccess(MergeResource resource, unsigned x, unsigned y, unsigned index, bool write)
+{
+    switch (resource) {
+        case MERGE_RESOURCE_NODE: {
+            unsigned node = mMapping.GetNodeAddress(mMapping.GetPixelAddress(x, y, mWidth), index, mPlaneSize,
+                                                    mSurfacesPerPixel);
+            mCache.Access((uint64_t)node * sizeof(MergeNodePacked), sizeof(MergeNodePacked), write);
+            break;
+        }
+        case MERGE_RESOURCE_COUNT:
+            mCache.Access(mCountBase + ((uint64_t)x + (uint64_t)mWidth * y) * sizeof(unsigned), sizeof(unsigned), write);
+            break;
+        case MERGE_RESOURCE_LIST:
+            mCache.Access(mListBase + ((uint64_t)x + (uint64_t)mWidth * y) * sizeof(unsigned), sizeof(unsigned), write);
+            break;
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,66 @@
+#ifndef STREAMINGCPU_MERGEACCESSTRACE_H
+#define STREAMINGCPU_MERGEACCESSTRACE_H
+
+// Records the count, list and node accesses StreamingGBufferPS makes, so
+// buffer layouts can be compared on the same access stream. Which accesses
+// happen does not depend on the layout, only their addresses do.
+
+#include "AddressMapping.h"
+#include "CacheSimulator.h"
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include <stddef.h>
+
+namespace StreamingCpu {
+
+enum MergeResource
+{
+    MERGE_RESOURCE_NODE,        // gMergeBuffer, index is the node index
+    MERGE_RESOURCE_COUNT,       // gCountTexture
+    MERGE_RESOURCE_LIST,        // gListTexture
+};
+
+class MergeAccessSink
+{
+public:
+    virtual ~MergeAccessSink() {}
+    virtual void OnAccess(MergeResource resource, unsigned x, unsigned y, unsigned index, bool write) = 0;
+};
+
+// Merges the fragments one by one in submission order, the order a single
+// pixel shader unit would see them, reporting every access to sink. Results
+// in buffers and stats are the same as MergeEngine's.
+void TraceMergeAccesses(MergeBuffers& buffers, const Fragment* fragments, size_t count,
+                        MergeAccessSink& sink, MergeStats& stats);
+
+// Feeds accesses into a CacheSimulator with the node addresses of one
+// mapping. The count and list textures follow the merge buffer, row-major,
+// since their layout is up to the driver.
+class MergeCacheModel : public MergeAccessSink
+{
+public:
+    MergeCacheModel(unsigned width, unsigned height, unsigned surfacesPerPixel,
+                    const AddressMapping& mapping, const CacheSimulatorDesc& desc);
+
+    virtual void OnAccess(MergeResource resource, unsigned x, unsigned y, unsigned index, bool write);
+
+    // Starts the next frame cold, keeping the statistics
+    void Flush() { mCache.Flush(); }
+
+    const AddressMapping& GetMapping() const { return mMapping; }
+    const CacheSimulator& GetCache() const { return mCache; }
+
+private:
+    unsigned mWidth;
+    unsigned mSurfacesPerPixel;
+    unsigned mPlaneSize;
+    AddressMapping mMapping;
+    uint64_t mCountBase;
+    uint64_t mListBase;
+    CacheSimulator mCache;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGEACCESSTRACE_H
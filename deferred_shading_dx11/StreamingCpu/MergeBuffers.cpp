@@ -0,0 +1,49 @@
+#include "MergeBuffers.h"
+#include <algorithm>
+#include <assert.h>
+
+namespace StreamingCpu {
+
+MergeBuffers::MergeBuffers(unsigned width, unsigned height, unsigned surfacesPerPixel,
+                           MergeStorage storage, unsigned poolBlocks, const AddressMapping& addressing)
+    : mWidth(width), mHeight(height), mSurfacesPerPixel(surfacesPerPixel)
+    , mStorage(storage), mAddressing(addressing), mPoolBlocks(0), mPoolBlocksRequested(0)
+{
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+
+    mNodeCountMask = surfacesPerPixel < 4 ? 0x3 : (surfacesPerPixel < 8 ? 0x7 : 0xF);
+
+    mPlaneSize = addressing.GetPlaneSize(width, height);
+
+    if (storage == MERGE_STORAGE_POOLED) {
+        // Like the GPU the pool index texture is never cleared, a pixel only
+        // reads it after writing it this frame.
+        mPoolBlocks = poolBlocks ? poolBlocks : width * height;
+        mMergeBuffer.resize(mPlaneSize + mPoolBlocks * (surfacesPerPixel - 1), MergeNodePacked());
+        mPoolIndexTexture.resize(width * height, 0);
+    } else {
+        mMergeBuffer.resize(mPlaneSize * surfacesPerPixel, MergeNodePacked());
+    }
+    mCountTexture.resize(width * height, 0);
+    mListTexture.resize(width * height, 0);
+}
+
+void MergeBuffers::Clear()
+{
+    std::fill(mCountTexture.begin(), mCountTexture.end(), 0);
+    std::fill(mListTexture.begin(), mListTexture.end(), 0);
+    mPoolBlocksRequested = 0;
+}
+
+bool MergeBuffers::AllocatePoolBlock(unsigned countIndex)
+{
+    unsigned block = mPoolBlocksRequested++;
+    if (block >= mPoolBlocks) {
+        return false;
+    }
+    mPoolIndexTexture[countIndex] = block;
+    return true;
+}
+
+} // namespace StreamingCpu
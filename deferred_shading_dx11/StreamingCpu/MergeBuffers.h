@@ -0,0 +1,182 @@
+#ifndef STREAMINGCPU_MERGEBUFFERS_H
+#define STREAMINGCPU_MERGEBUFFERS_H
+
+#include "AddressMapping.h"
+#include "MergeNodeCodec.h"
+#include <atomic>
+#include <vector>
+
+namespace StreamingCpu {
+
+enum MergeStorage
+{
+    MERGE_STORAGE_FIXED,        // surfacesPerPixel planes of nodes
+    MERGE_STORAGE_POOLED,       // STREAMING_NODE_POOL
+};
+
+// CPU copy of gMergeBuffer, gCountTexture and gListTexture with the same
+// layout the GPU uses, so the buffers can be compared word for word.
+// With MERGE_STORAGE_POOLED, gMergeBuffer is the first node plane followed by
+// poolBlocks blocks of surfacesPerPixel-1 nodes. A pixel takes a block when it
+// stores its second node, so which block depends on thread timing like on the
+// GPU; compare nodes through GetNodeIndex.
+class MergeBuffers
+{
+public:
+    // poolBlocks of 0 gives every pixel a block, so the pool never runs out
+    MergeBuffers(unsigned width, unsigned height,
+                 unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL,
+                 MergeStorage storage = MERGE_STORAGE_FIXED, unsigned poolBlocks = 0,
+                 const AddressMapping& addressing = AddressMapping());
+
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    unsigned GetSurfacesPerPixel() const { return mSurfacesPerPixel; }
+    MergeStorage GetStorage() const { return mStorage; }
+    const AddressMapping& GetAddressing() const { return mAddressing; }
+    unsigned GetPoolBlocks() const { return mPoolBlocks; }
+
+    // Blocks asked for since Clear(), including requests that found the pool
+    // exhausted (what the gMergeBuffer counter holds at the end of the frame)
+    unsigned GetPoolBlocksRequested() const { return mPoolBlocksRequested; }
+
+    // Zeroes the count and list textures, which is what the resolve does
+    // without STREAMING_EPOCH_COUNTS (see EpochCounts.h). Also empties the pool.
+    void Clear();
+
+    // Same addressing as StreamingBuffers.hlsl
+    unsigned GetNodeIndex(unsigned x, unsigned y) const
+    {
+        return mAddressing.GetPixelAddress(x, y, mWidth);
+    }
+    unsigned GetNodeIndex(unsigned x, unsigned y, unsigned index) const
+    {
+        return GetPixelNodeIndex(GetNodeIndex(x, y), GetNodeCountIndex(x, y), index);
+    }
+    unsigned GetNodeCountIndex(unsigned x, unsigned y) const { return x + mWidth * y; }
+
+    // What StreamingResolvePS reads for the pixel
+    unsigned GetNodeCount(unsigned x, unsigned y) const
+    {
+        unsigned nodeCount = mCountTexture[GetNodeCountIndex(x, y)] & mNodeCountMask;
+        return nodeCount < mSurfacesPerPixel ? nodeCount : mSurfacesPerPixel;
+    }
+    bool GetDiscardedSamples(unsigned x, unsigned y) const
+    {
+        return (mCountTexture[GetNodeCountIndex(x, y)] & (0x1u << 9)) != 0;
+    }
+
+    const std::vector<MergeNodePacked>& GetMergeBuffer() const { return mMergeBuffer; }
+    const std::vector<unsigned>& GetCountTexture() const { return mCountTexture; }
+    const std::vector<unsigned>& GetListTexture() const { return mListTexture; }
+
+    // Per-pixel view with the accessors StreamingGBufferPS uses. SurfacesPerPixel
+    // must match the buffers.
+    template <unsigned SurfacesPerPixel>
+    class Pixel
+    {
+    public:
+        typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+        Pixel(MergeBuffers& buffers, unsigned x, unsigned y)
+            : mBuffers(buffers), mPixelAddress(buffers.GetNodeIndex(x, y)), mCountIndex(buffers.GetNodeCountIndex(x, y)) {}
+
+        unsigned GetNodeCount() const
+        {
+            unsigned nodeCount = mBuffers.mCountTexture[mCountIndex] & Layout::kNodeCountMask;
+            return nodeCount < SurfacesPerPixel ? nodeCount : SurfacesPerPixel;
+        }
+
+        void SetNodeCount(unsigned value)
+        {
+            unsigned& count = mBuffers.mCountTexture[mCountIndex];
+            count = (count & ~(unsigned)Layout::kNodeCountMask) | (value & Layout::kNodeCountMask);
+        }
+
+        unsigned GetNodeList() const { return mBuffers.mListTexture[mCountIndex]; }
+        void SetNodeList(unsigned nodeList) { mBuffers.mListTexture[mCountIndex] = nodeList; }
+
+        MergeNode GetMergeNode(unsigned index) const
+        {
+            return UnpackMergeNode(mBuffers.mMergeBuffer[mBuffers.GetPixelNodeIndex(mPixelAddress, mCountIndex, index)]);
+        }
+
+        void SetMergeNode(unsigned index, const MergeNode& merge)
+        {
+            mBuffers.mMergeBuffer[mBuffers.GetPixelNodeIndex(mPixelAddress, mCountIndex, index)] = PackMergeNode(merge);
+        }
+
+        const MergeNodePacked& GetPackedMergeNode(unsigned index) const
+        {
+            return mBuffers.mMergeBuffer[mBuffers.GetPixelNodeIndex(mPixelAddress, mCountIndex, index)];
+        }
+
+        void SetPackedMergeNode(unsigned index, const MergeNodePacked& packed)
+        {
+            mBuffers.mMergeBuffer[mBuffers.GetPixelNodeIndex(mPixelAddress, mCountIndex, index)] = packed;
+        }
+
+        // Where GetPackedMergeNode reads, in nodes from the start of GetMergeBuffer()
+        unsigned GetMergeNodeAddress(unsigned index) const
+        {
+            return mBuffers.GetPixelNodeIndex(mPixelAddress, mCountIndex, index);
+        }
+
+        // AllocatePoolBlock from StreamingBuffers.hlsl
+        bool AllocatePoolBlock()
+        {
+            return mBuffers.mStorage == MERGE_STORAGE_FIXED || mBuffers.AllocatePoolBlock(mCountIndex);
+        }
+
+        void SetDiscardedSamples(unsigned discardedSamples)
+        {
+            unsigned& count = mBuffers.mCountTexture[mCountIndex];
+            count = (count & ~(0x1u << 9)) | (discardedSamples << 9);
+        }
+
+        void AddHiZOccluder(unsigned, float) {}
+        unsigned PredictNode(unsigned, float, float) const { return STREAMING_PREDICTION_LOAD; }
+
+    private:
+        MergeBuffers& mBuffers;
+        unsigned mPixelAddress;
+        unsigned mCountIndex;
+    };
+
+private:
+    // Not implemented
+    MergeBuffers(const MergeBuffers&);
+    MergeBuffers& operator=(const MergeBuffers&);
+
+    bool AllocatePoolBlock(unsigned countIndex);
+
+    // Pixels look up their address once, the mapping is not free
+    unsigned GetPixelNodeIndex(unsigned pixelAddress, unsigned countIndex, unsigned index) const
+    {
+        if (mStorage == MERGE_STORAGE_POOLED) {
+            if (index > 0) {
+                return mPlaneSize + mPoolIndexTexture[countIndex] * (mSurfacesPerPixel - 1) + index - 1;
+            }
+            return pixelAddress;
+        }
+        return mAddressing.GetNodeAddress(pixelAddress, index, mPlaneSize, mSurfacesPerPixel);
+    }
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mSurfacesPerPixel;
+    unsigned mNodeCountMask;
+    unsigned mPlaneSize;
+    MergeStorage mStorage;
+    AddressMapping mAddressing;
+    unsigned mPoolBlocks;
+    std::atomic<unsigned> mPoolBlocksRequested;
+    std::vector<MergeNodePacked> mMergeBuffer;
+    std::vector<unsigned> mCountTexture;
+    std::vector<unsigned> mListTexture;
+    std::vector<unsigned> mPoolIndexTexture;    // pooled storage only
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGEBUFFERS_H
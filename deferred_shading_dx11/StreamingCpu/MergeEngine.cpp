@@ -0,0 +1,121 @@
+#include "MergeEngine.h"
+#include "Timer.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+// Binning splits the input into this many chunks per thread
+static const unsigned kChunksPerThread = 4;
+
+MergeEngine::MergeEngine(unsigned width, unsigned height, ThreadPool* threadPool,
+                         unsigned surfacesPerPixel, unsigned tileWidth, unsigned tileHeight,
+                         MergeStorage storage, unsigned poolBlocks, const AddressMapping& addressing)
+    : mBuffers(width, height, surfacesPerPixel, storage, poolBlocks, addressing), mThreadPool(threadPool)
+    , mTileWidth(tileWidth), mTileHeight(tileHeight)
+    , mBinSeconds(0.0), mMergeSeconds(0.0)
+{
+    assert(threadPool && tileWidth > 0 && tileHeight > 0);
+    mTilesX = (width + tileWidth - 1) / tileWidth;
+    mTilesY = (height + tileHeight - 1) / tileHeight;
+    mTileOffsets.resize(mTilesX * mTilesY + 1, 0);
+    mTileStats.resize(mTilesX * mTilesY);
+    SetSimdLevel(SIMD_LEVEL_SCALAR);
+}
+
+void MergeEngine::SetSimdLevel(SimdLevel level)
+{
+    mSimdLevel = level > GetMaxSimdLevel() ? GetMaxSimdLevel() : level;
+    mMergeFragments = GetMergeFragmentsFunction(mSimdLevel, mBuffers.GetSurfacesPerPixel());
+}
+
+void MergeEngine::Clear()
+{
+    mBuffers.Clear();
+}
+
+void MergeEngine::ResetStats()
+{
+    mStats.Reset();
+    mBinSeconds = 0.0;
+    mMergeSeconds = 0.0;
+}
+
+void MergeEngine::BinFragments(const Fragment* fragments, size_t fragmentCount)
+{
+    const unsigned tileCount = mTilesX * mTilesY;
+    const unsigned chunkCount = mThreadPool->GetThreadCount() * kChunksPerThread;
+    const size_t chunkSize = (fragmentCount + chunkCount - 1) / chunkCount;
+
+    mChunkTileCounts.assign((size_t)chunkCount * tileCount, 0);
+    mBinnedFragments.resize(fragmentCount);
+
+    // Histogram each chunk
+    mThreadPool->ParallelFor(chunkCount, 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned chunk = begin; chunk < end; ++chunk) {
+            size_t* counts = &mChunkTileCounts[(size_t)chunk * tileCount];
+            size_t first = chunk * chunkSize;
+            size_t last = first + chunkSize < fragmentCount ? first + chunkSize : fragmentCount;
+            for (size_t i = first; i < last; ++i) {
+                counts[GetTile(fragments[i])]++;
+            }
+        }
+    });
+
+    // Exclusive scan in (tile, chunk) order. Chunks of a tile are laid out in
+    // input order so every pixel still sees its fragments in submission order.
+    size_t offset = 0;
+    for (unsigned tile = 0; tile < tileCount; ++tile) {
+        mTileOffsets[tile] = offset;
+        for (unsigned chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t& count = mChunkTileCounts[(size_t)chunk * tileCount + tile];
+            size_t chunkTileCount = count;
+            count = offset;
+            offset += chunkTileCount;
+        }
+    }
+    mTileOffsets[tileCount] = offset;
+
+    // Scatter
+    mThreadPool->ParallelFor(chunkCount, 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned chunk = begin; chunk < end; ++chunk) {
+            size_t* offsets = &mChunkTileCounts[(size_t)chunk * tileCount];
+            size_t first = chunk * chunkSize;
+            size_t last = first + chunkSize < fragmentCount ? first + chunkSize : fragmentCount;
+            for (size_t i = first; i < last; ++i) {
+                mBinnedFragments[offsets[GetTile(fragments[i])]++] = fragments[i];
+            }
+        }
+    });
+}
+
+void MergeEngine::Merge(const Fragment* fragments, size_t fragmentCount)
+{
+    if (fragmentCount == 0) {
+        return;
+    }
+
+    Timer timer;
+    BinFragments(fragments, fragmentCount);
+    mBinSeconds += timer.GetSeconds();
+
+    timer.Reset();
+    const unsigned tileCount = mTilesX * mTilesY;
+    mThreadPool->ParallelFor(tileCount, 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned tile = begin; tile < end; ++tile) {
+            MergeStats& stats = mTileStats[tile];
+            stats.Reset();
+            size_t first = mTileOffsets[tile];
+            size_t count = mTileOffsets[tile + 1] - first;
+            if (count > 0) {
+                mMergeFragments(mBuffers, &mBinnedFragments[first], count, stats);
+            }
+        }
+    });
+    mMergeSeconds += timer.GetSeconds();
+
+    for (unsigned tile = 0; tile < tileCount; ++tile) {
+        mStats.Add(mTileStats[tile]);
+    }
+}
+
+} // namespace StreamingCpu
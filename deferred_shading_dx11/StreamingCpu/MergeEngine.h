@@ -0,0 +1,84 @@
+#ifndef STREAMINGCPU_MERGEENGINE_H
+#define STREAMINGCPU_MERGEENGINE_H
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernelSimd.h"
+#include "ThreadPool.h"
+#include <assert.h>
+#include <stddef.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+// Headless version of the streaming g-buffer pass. Fragments are binned into
+// screen tiles keeping submission order, then tiles are merged in parallel.
+// Pixel shader ordering only guarantees order per pixel, so the result is the
+// same for any thread count and matches what the GPU writes.
+class MergeEngine
+{
+public:
+    // surfacesPerPixel picks the kernel instantiation at runtime (1 to 8).
+    // storage, poolBlocks and addressing are passed on to MergeBuffers.
+    MergeEngine(unsigned width, unsigned height, ThreadPool* threadPool,
+                unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL,
+                unsigned tileWidth = 32, unsigned tileHeight = 32,
+                MergeStorage storage = MERGE_STORAGE_FIXED, unsigned poolBlocks = 0,
+                const AddressMapping& addressing = AddressMapping());
+
+    // Start of a new frame (what the resolve pass does to count/list).
+    void Clear();
+
+    // Defaults to SIMD_LEVEL_SCALAR. The lane kernels only win by a little and
+    // not on every CPU, so pick one after running StreamingBench --simd all.
+    // Unsupported levels fall back.
+    void SetSimdLevel(SimdLevel level);
+    SimdLevel GetSimdLevel() const { return mSimdLevel; }
+
+    // Runs StreamingGBufferPS on the fragments in the order given. Fragments
+    // must lie inside width x height, they are not checked.
+    void Merge(const Fragment* fragments, size_t fragmentCount);
+
+    const MergeBuffers& GetBuffers() const { return mBuffers; }
+
+    // Totals since the last ResetStats
+    const MergeStats& GetStats() const { return mStats; }
+    double GetBinSeconds() const { return mBinSeconds; }
+    double GetMergeSeconds() const { return mMergeSeconds; }
+    void ResetStats();
+
+private:
+    // Not implemented
+    MergeEngine(const MergeEngine&);
+    MergeEngine& operator=(const MergeEngine&);
+
+    unsigned GetTile(const Fragment& fragment) const
+    {
+        assert(fragment.x < mBuffers.GetWidth() && fragment.y < mBuffers.GetHeight());
+        return (fragment.x / mTileWidth) + mTilesX * (fragment.y / mTileHeight);
+    }
+
+    void BinFragments(const Fragment* fragments, size_t fragmentCount);
+
+    MergeBuffers mBuffers;
+    ThreadPool* mThreadPool;
+    unsigned mTileWidth;
+    unsigned mTileHeight;
+    unsigned mTilesX;
+    unsigned mTilesY;
+    SimdLevel mSimdLevel;
+    MergeFragmentsFunction mMergeFragments;
+
+    std::vector<Fragment> mBinnedFragments;
+    std::vector<size_t> mTileOffsets;       // mTilesX * mTilesY + 1
+    std::vector<size_t> mChunkTileCounts;   // per input chunk histograms
+    std::vector<MergeStats> mTileStats;
+
+    MergeStats mStats;
+    double mBinSeconds;
+    double mMergeSeconds;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGEENGINE_H
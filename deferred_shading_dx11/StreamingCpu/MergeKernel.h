@@ -0,0 +1,368 @@
+#ifndef STREAMINGCPU_MERGEKERNEL_H
+#define STREAMINGCPU_MERGEKERNEL_H
+
+// C++ version of the ordered section of StreamingGBufferPS together with the
+// parts of Merge.hlsl and DepthTests.hlsl it calls. Only the non-debug paths
+// are modeled. PixelT provides the per-pixel accessors from
+// StreamingBuffers.hlsl and the StreamingSurfaceLayout they use (see
+// MergeBuffers::Pixel). AddHiZOccluder is a no-op but for the Hi-Z model, and
+// PredictNode returns STREAMING_PREDICTION_LOAD but for the node prediction
+// experiment (see NodePrediction.h), which StreamingGBufferPS does not have
+// and which confirms a skip against the node's depth itself. DiscardT picks
+// what OccluderFusion throws away when nothing is occluded,
+// LeastCoverageDiscard unless given (see DiscardPolicy.h).
+
+#include "MergeNodeCodec.h"
+#include "SphereMap.h"
+#include <stdint.h>
+
+namespace StreamingCpu {
+
+struct MergeStats
+{
+    uint64_t fragments;     // StreamingGBufferPS executions
+    uint64_t firsts;        // stored into an empty pixel
+    uint64_t merges;        // merged with an existing node
+    uint64_t inserts;       // stored into a free node
+    uint64_t occlusions;    // pixel full, a node was fully occluded and replaced
+    uint64_t discards;      // pixel full, nothing occluded so the discard policy dropped a node
+    uint64_t nodeLoads;
+    uint64_t nodeStores;
+
+    MergeStats() { Reset(); }
+
+    void Reset()
+    {
+        fragments = firsts = merges = inserts = occlusions = discards = nodeLoads = nodeStores = 0;
+    }
+
+    void Add(const MergeStats& other)
+    {
+        fragments += other.fragments;
+        firsts += other.firsts;
+        merges += other.merges;
+        inserts += other.inserts;
+        occlusions += other.occlusions;
+        discards += other.discards;
+        nodeLoads += other.nodeLoads;
+        nodeStores += other.nodeStores;
+    }
+};
+
+//--------------------------------------------------------------------------------------
+inline void GetDepthRange(const MergeNode& merge, float& start, float& end)
+{
+    const float dx = merge.zViewDerivatives[0];
+    const float dy = merge.zViewDerivatives[1];
+    start = merge.zView + (dx < 0 ? dx : -dx);
+    start = start + (dy < 0 ? dy : -dy);
+    end = merge.zView + (dx > 0 ? dx : -dx);
+    end = end + (dy > 0 ? dy : -dy);
+}
+
+//--------------------------------------------------------------------------------------
+inline bool Compare(const MergeNode& existing, const MergeNode& incoming,
+                    float incomingMin, float incomingMax)
+{
+    if ((existing.coverage & incoming.coverage) != 0) {
+        return false;
+    }
+
+    float existingMin, existingMax;
+    GetDepthRange(existing, existingMin, existingMax);
+    if (!(existingMin <= incomingMax && incomingMin <= existingMax)) {
+        return false;
+    }
+
+    float n0[3], n1[3];
+    DecodeSphereMap(existing.normal, n0);
+    DecodeSphereMap(incoming.normal, n1);
+    return fabsf(Dot3(n0, n1)) >= STREAMING_COS_THETA;
+}
+
+//--------------------------------------------------------------------------------------
+inline void AverageNormals(MergeNode& existing, const MergeNode& incoming)
+{
+    float existingNormal[3], incomingNormal[3];
+    DecodeSphereMap(existing.normal, existingNormal);
+    DecodeSphereMap(incoming.normal, incomingNormal);
+
+    float average[3];
+    for (int i = 0; i < 3; ++i) {
+        average[i] = (existingNormal[i] + incomingNormal[i]) / 2.0f;
+    }
+    EncodeSphereMap(average, existing.normal);
+}
+
+// Merge() once Compare() has passed
+//--------------------------------------------------------------------------------------
+inline void CombineMergeNodes(MergeNode& existing, const MergeNode& incoming)
+{
+    SetCoverage(existing, GetCoverage(existing) | GetCoverage(incoming));
+    SetDepthTestedCoverage(existing, GetDepthTestedCoverage(existing) | GetDepthTestedCoverage(incoming));
+    AverageNormals(existing, incoming);
+    existing.zViewDerivatives[0] = (existing.zViewDerivatives[0] + incoming.zViewDerivatives[0]) / 2.0f;
+    existing.zViewDerivatives[1] = (existing.zViewDerivatives[1] + incoming.zViewDerivatives[1]) / 2.0f;
+    existing.zView = existing.zView < incoming.zView ? existing.zView : incoming.zView;
+}
+
+// Always combine coverage. Conditionally combine normals, depths, and derivatives.
+//--------------------------------------------------------------------------------------
+inline bool Merge(MergeNode& existing, const MergeNode& incoming,
+                  float incomingMin, float incomingMax)
+{
+    if (!Compare(existing, incoming, incomingMin, incomingMax)) {
+        return false;
+    }
+    CombineMergeNodes(existing, incoming);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+inline void AverageShadeNodes(ShadeNode& existing, const ShadeNode& incoming)
+{
+    for (int i = 0; i < 4; ++i) {
+        existing.albedo[i] = (existing.albedo[i] + incoming.albedo[i]) / 2.0f;
+    }
+    existing.specular[0] = (existing.specular[0] + incoming.specular[0]) / 2.0f;
+    existing.specular[1] = (existing.specular[1] + incoming.specular[1]) / 2.0f;
+}
+
+// If "merge" is completely occluded by "occluder" returns true.
+//--------------------------------------------------------------------------------------
+inline bool OcclusionCheck(MergeNode& merge, float& occluderStart,
+                           float& occluderEnd, unsigned& occluderCoverage,
+                           unsigned& newInfo)
+{
+    bool occluded = false;
+    float mergeStart, mergeEnd;
+    GetDepthRange(merge, mergeStart, mergeEnd);
+
+    const unsigned mergeCoverage = merge.coverage;
+    const unsigned mergeAndOccluderCoverage = mergeCoverage & occluderCoverage;
+    const unsigned mergeDTC = GetDepthTestedCoverage(merge);
+    const unsigned newDTC = mergeDTC ^ (mergeAndOccluderCoverage & mergeDTC);
+    newInfo = newDTC;
+
+    // Are the two fragments not interpenetrating?
+    if (occluderStart < mergeStart && occluderEnd < mergeStart) {
+        occluded = mergeAndOccluderCoverage == mergeCoverage;
+        SetDepthTestedCoverage(merge, newDTC);
+    }
+
+    occluderStart = occluderStart < mergeStart ? occluderStart : mergeStart;
+    occluderEnd = occluderEnd > mergeEnd ? occluderEnd : mergeEnd;
+    occluderCoverage = mergeCoverage | occluderCoverage;
+    return occluded;
+}
+
+// UpdateMinCoverage. A discard policy scores every candidate of
+// OccluderFusion, the incoming node with index kIncomingNodeIndex, and the
+// lowest score is thrown away, the farther one on ties. OnStore is called for
+// every node the fragment writes with the samples it brought, OnReplace when
+// a slot is handed to another surface.
+//--------------------------------------------------------------------------------------
+enum { kIncomingNodeIndex = 0xFFFFFFFF };
+
+struct LeastCoverageDiscard
+{
+    float Score(const MergeNode&, unsigned newInfo, unsigned, unsigned) const { return (float)CountBits(newInfo); }
+    void OnStore(unsigned, unsigned) {}
+    void OnReplace(unsigned, unsigned) {}
+};
+
+//--------------------------------------------------------------------------------------
+template <typename Layout>
+inline unsigned GetNodeListEntry(unsigned nodeList, unsigned position)
+{
+    return GetBitsInUint<Layout::kNodeIndexBits>(nodeList, position);
+}
+
+template <typename Layout>
+inline void SetNodeListEntry(unsigned& nodeList, unsigned position, unsigned index)
+{
+    SetBitsInUint<Layout::kNodeIndexBits>(nodeList, position, index);
+}
+
+// Returns the removedPosition in the nodeList.
+//--------------------------------------------------------------------------------------
+template <typename PixelT, typename DiscardT>
+unsigned OccluderFusion(PixelT& pixel, const MergeNode& incoming, unsigned nodeList,
+                        unsigned incomingPosition, const DiscardT& discard, MergeStats& stats)
+{
+    float occluderStart = 0.0f;
+    float occluderEnd = 0.0f;
+    unsigned occluderCoverage = 0;
+    float minScore = 0.0f;
+    unsigned minScorePosition = 0;
+    unsigned newInfo = 0;
+
+    for (unsigned i = 0; i < PixelT::Layout::kSurfacesPerPixel + 1; i++) {
+        MergeNode temp;
+        unsigned tempIndex = 0;
+        if (i == incomingPosition) {
+            temp = incoming;
+        } else {
+            tempIndex = GetNodeListEntry<typename PixelT::Layout>(nodeList, i);
+            temp = pixel.GetMergeNode(tempIndex);
+            stats.nodeLoads++;
+        }
+
+        if (OcclusionCheck(temp, occluderStart, occluderEnd, occluderCoverage, newInfo)) {
+            pixel.AddHiZOccluder(occluderCoverage, occluderEnd);
+            stats.occlusions++;
+            return i;
+        }
+        if (i != incomingPosition) {
+            pixel.SetMergeNode(tempIndex, temp);
+            stats.nodeStores++;
+        }
+
+        // UpdateMinCoverage
+        float score = discard.Score(temp, newInfo, i, i == incomingPosition ? kIncomingNodeIndex : tempIndex);
+        if (i == 0 || score <= minScore) {
+            minScore = score;
+            minScorePosition = i;
+        }
+    }
+
+    // nothing got entirely occluded. we need to throw away a surface
+    stats.discards++;
+    pixel.SetDiscardedSamples(1);
+    return minScorePosition;
+}
+
+// Inserts incomingIndex at incomingPosition and pushes everything behind it back one slot.
+//--------------------------------------------------------------------------------------
+template <typename Layout>
+unsigned InsertIntoNodeList(unsigned nodeList, unsigned nodeCount,
+                            unsigned incomingPosition, unsigned incomingIndex)
+{
+    unsigned tempIndex = GetNodeListEntry<Layout>(nodeList, incomingPosition);
+    SetNodeListEntry<Layout>(nodeList, incomingPosition, incomingIndex);
+    for (unsigned j = incomingPosition + 1; j < nodeCount + 1; j++) {
+        unsigned temp2 = GetNodeListEntry<Layout>(nodeList, j);
+        SetNodeListEntry<Layout>(nodeList, j, tempIndex);
+        tempIndex = temp2;
+    }
+    return nodeList;
+}
+
+// Drops removedPosition from a full list after incoming has taken over the
+// removed surface's slot in the merge buffer (returned in incomingIndex).
+//--------------------------------------------------------------------------------------
+template <typename Layout>
+unsigned CompactNodeList(unsigned nodeList, unsigned nodeCount, unsigned incomingPosition,
+                         unsigned removedPosition, unsigned& incomingIndex)
+{
+    incomingIndex = GetNodeListEntry<Layout>(nodeList, removedPosition);
+    SetNodeListEntry<Layout>(nodeList, incomingPosition, incomingIndex);
+
+    unsigned j = 0;
+    unsigned newList = 0;
+    for (unsigned i = 0; i < nodeCount + 1; i++) {
+        if (i != removedPosition) {
+            SetNodeListEntry<Layout>(newList, j++, GetNodeListEntry<Layout>(nodeList, i));
+        }
+    }
+    return newList;
+}
+
+//--------------------------------------------------------------------------------------
+template <typename PixelT, typename DiscardT>
+void StoreAfterOccluderFusion(PixelT& pixel, const MergeNode& merge, unsigned nodeList,
+                              unsigned nodeCount, unsigned incomingPosition,
+                              unsigned removedPosition, DiscardT& discard, MergeStats& stats)
+{
+    // if the surface we're throwing away is the incoming surface there is nothing to store
+    if (removedPosition != incomingPosition) {
+        unsigned incomingIndex;
+        pixel.SetNodeList(CompactNodeList<typename PixelT::Layout>(nodeList, nodeCount, incomingPosition,
+                                                                   removedPosition, incomingIndex));
+        pixel.SetMergeNode(incomingIndex, merge);
+        discard.OnReplace(incomingIndex, GetCoverage(merge));
+        stats.nodeStores++;
+    }
+}
+
+// Ordered section of StreamingGBufferPS for one fragment.
+//--------------------------------------------------------------------------------------
+template <typename PixelT, typename DiscardT>
+void MergeFragment(PixelT& pixel, const MergeNode& merge, DiscardT& discard, MergeStats& stats)
+{
+    stats.fragments++;
+
+    unsigned nodeCount = pixel.GetNodeCount();
+    if (nodeCount == 0) {
+        pixel.SetNodeCount(nodeCount + 1);
+        pixel.SetMergeNode(0, merge);
+        discard.OnStore(0, GetCoverage(merge));
+        stats.firsts++;
+        stats.nodeStores++;
+        return;
+    }
+
+    unsigned nodeList = pixel.GetNodeList();
+    unsigned incomingIndex = nodeCount;
+    unsigned incomingPosition = nodeCount;
+
+    float incomingMin = 0.0f;
+    float incomingMax = 0.0f;
+    GetDepthRange(merge, incomingMin, incomingMax);
+    for (unsigned i = 0; i < nodeCount; i++) {
+        unsigned tempIndex = GetNodeListEntry<typename PixelT::Layout>(nodeList, i);
+        unsigned prediction = pixel.PredictNode(tempIndex, incomingMin, incomingMax);
+        if (prediction != STREAMING_PREDICTION_LOAD) {
+            if (prediction == STREAMING_PREDICTION_BEHIND && incomingPosition == nodeCount) {
+                incomingPosition = i;
+            }
+            continue;
+        }
+        MergeNode temp = pixel.GetMergeNode(tempIndex);
+        stats.nodeLoads++;
+
+        if (Merge(temp, merge, incomingMin, incomingMax)) {
+            AverageShadeNodes(temp.shade, merge.shade);
+            pixel.SetMergeNode(tempIndex, temp);
+            discard.OnStore(tempIndex, GetCoverage(merge));
+            stats.merges++;
+            stats.nodeStores++;
+            return;
+        }
+        if (temp.zView - merge.zView > 0.0f && incomingPosition == nodeCount) {
+            incomingPosition = i;
+        }
+    }
+
+    nodeList = InsertIntoNodeList<typename PixelT::Layout>(nodeList, nodeCount, incomingPosition, incomingIndex);
+
+    if (nodeCount == PixelT::Layout::kSurfacesPerPixel) {
+        unsigned removedPosition = OccluderFusion(pixel, merge, nodeList, incomingPosition, discard, stats);
+        StoreAfterOccluderFusion(pixel, merge, nodeList, nodeCount, incomingPosition, removedPosition, discard,
+                                 stats);
+    } else {
+        if (nodeCount == 1 && !pixel.AllocatePoolBlock()) {
+            // Node pool exhausted, the fragment is dropped
+            pixel.SetDiscardedSamples(1);
+            stats.discards++;
+            return;
+        }
+        pixel.SetNodeCount(nodeCount + 1);
+        pixel.SetNodeList(nodeList);
+        pixel.SetMergeNode(incomingIndex, merge);
+        discard.OnStore(incomingIndex, GetCoverage(merge));
+        stats.inserts++;
+        stats.nodeStores++;
+    }
+}
+
+template <typename PixelT>
+void MergeFragment(PixelT& pixel, const MergeNode& merge, MergeStats& stats)
+{
+    LeastCoverageDiscard discard;
+    MergeFragment(pixel, merge, discard, stats);
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGEKERNEL_H
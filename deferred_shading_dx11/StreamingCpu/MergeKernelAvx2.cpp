@@ -0,0 +1,49 @@
+// Everything that is shared with other translation units must be included
+// before the target pragma so no AVX2 code leaks into common inline functions.
+// Contraction is off because the wider ISAs bring FMA, and a fused multiply add
+// rounds differently from the scalar build.
+#include "MergeKernelSimd.h"
+
+#if defined(STREAMINGCPU_X86)
+
+#include <immintrin.h>
+#include <string.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,f16c"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,f16c")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "SimdLanesAvx2.h"
+#include "MergeKernelLanes.inl"
+
+namespace StreamingCpu {
+
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsAvx2(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats)
+{
+    MergeKernelLanes<Avx2Lanes, SurfacesPerPixel>::MergeFragments(buffers, fragments, count, stats);
+}
+
+template void MergeFragmentsAvx2<1>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<2>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<3>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<4>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<5>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<6>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<7>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx2<8>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+
+} // namespace StreamingCpu
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // defined(STREAMINGCPU_X86)
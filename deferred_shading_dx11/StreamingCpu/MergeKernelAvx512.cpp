@@ -0,0 +1,46 @@
+// See MergeKernelAvx2.cpp for why the includes come before the pragma.
+#include "MergeKernelSimd.h"
+
+#if defined(STREAMINGCPU_AVX512)
+
+#include <immintrin.h>
+#include <string.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "SimdLanesAvx512.h"
+#include "MergeKernelLanes.inl"
+
+namespace StreamingCpu {
+
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsAvx512(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats)
+{
+    MergeKernelLanes<Avx512Lanes, SurfacesPerPixel>::MergeFragments(buffers, fragments, count, stats);
+}
+
+template void MergeFragmentsAvx512<1>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<2>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<3>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<4>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<5>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<6>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<7>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+template void MergeFragmentsAvx512<8>(MergeBuffers&, const Fragment*, size_t, MergeStats&);
+
+} // namespace StreamingCpu
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // defined(STREAMINGCPU_AVX512)
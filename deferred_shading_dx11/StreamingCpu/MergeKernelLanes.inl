@@ -0,0 +1,401 @@
+// Lane parallel version of MergeFragment(). V is one of the *Lanes structs
+// (SimdLanesAvx2.h, SimdLanesAvx512.h), SurfacesPerPixel matches the buffers. Included by the per-ISA translation
+// units after their target pragma, so everything in here must be a template
+// on V to keep the ISA specific code out of shared inline functions, and
+// scalar float work goes through the out of line *Scalar helpers.
+//
+// Consecutive fragments that hit different pixels form a wave with one pixel
+// per lane. The fragments and every pixel's nodes are gathered straight into
+// vectors, the incoming nodes are packed across lanes, and Compare() against
+// every node and the whole OcclusionCheck() chain run across lanes too. The
+// per-pixel bookkeeping (node list, stores, stats) and merging two nodes stay
+// scalar, so buffers and stats come out identical to the scalar path.
+
+namespace StreamingCpu {
+
+template <typename V>
+struct NodeLanes
+{
+    typename V::Int coverage;
+    typename V::Float zView;
+    typename V::Float zViewDerivativesX;
+    typename V::Float zViewDerivativesY;
+    typename V::Float normalX;
+    typename V::Float normalY;
+};
+
+template <typename V, unsigned SurfacesPerPixel>
+class MergeKernelLanes
+{
+public:
+    typedef typename V::Float Float;
+    typedef typename V::Int Int;
+    typedef typename V::Mask Mask;
+    typedef MergeBuffers::Pixel<SurfacesPerPixel> Pixel;
+    typedef typename Pixel::Layout Layout;
+    enum { kWidth = V::kWidth, kMaxSurfaces = SurfacesPerPixel };
+
+    static void MergeFragments(MergeBuffers& buffers, const Fragment* fragments, size_t count,
+                               MergeStats& stats)
+    {
+        // Lanes a wave leaves empty keep what earlier waves wrote, which the
+        // gathers can still read and the lane masks ignore, so the wave is
+        // only cleared once
+        Wave wave;
+        memset(&wave, 0, sizeof(wave));
+
+        const Int laneIndices = V::LaneIndices();
+        size_t i = 0;
+        while (i < count) {
+            // Extend the wave until it is full or a pixel repeats
+            Int pixels = V::SplatInt(0);
+            unsigned laneCount = 0;
+            size_t first = i;
+            while (i < count && laneCount < kWidth) {
+                Int pixel = V::SplatInt(fragments[i].x | ((unsigned)fragments[i].y << 16));
+                if (V::Equal(pixels, pixel) & ((1u << laneCount) - 1)) {
+                    break;
+                }
+                pixels = V::SelectInt(V::EqualIntMask(laneIndices, V::SplatInt(laneCount)), pixel, pixels);
+                ++laneCount;
+                ++i;
+            }
+            MergeWave(buffers, fragments + first, laneCount, wave, stats);
+        }
+        V::End();
+    }
+
+private:
+    // Word offsets of the fields gathered from fragments and packed nodes
+    enum
+    {
+        kFragmentWords = sizeof(Fragment) / 4,
+        kFragmentCoverage = offsetof(Fragment, coverage) / 4,
+        kFragmentZView = offsetof(Fragment, zView) / 4,
+        kFragmentDerivatives = offsetof(Fragment, zViewDerivatives) / 4,
+        kFragmentNormal = offsetof(Fragment, normal) / 4,
+        kFragmentAlbedo = offsetof(Fragment, albedo) / 4,
+        kFragmentSpecular = offsetof(Fragment, specular) / 4,
+        kPackedWords = sizeof(MergeNodePacked) / 4,
+        kPackedCoverage = offsetof(MergeNodePacked, coverage) / 4,
+        kPackedDerivatives = offsetof(MergeNodePacked, zViewDerivatives) / 4,
+        kPackedZView = offsetof(MergeNodePacked, zView) / 4,
+        kPackedNormal = offsetof(MergeNodePacked, normal) / 4,
+        kPackedAlbedo = offsetof(MergeNodePacked, albedo) / 4
+    };
+
+    struct Wave
+    {
+        unsigned nodeCount[kWidth];
+        unsigned nodeList[kWidth];
+        unsigned incomingPosition[kWidth];
+        unsigned nodeWords[kMaxSurfaces][kWidth];       // word offsets of the nodes in list order
+        unsigned incomingPacked[kPackedWords][kWidth];  // PackMergeNode() of the incoming nodes
+    };
+
+    static void GetDepthRange(Float zView, Float dx, Float dy, Float& start, Float& end)
+    {
+        // z + (dx < 0 ? dx : -dx) is z - |dx|, bit for bit
+        Float absDx = V::Abs(dx);
+        Float absDy = V::Abs(dy);
+        start = V::Sub(V::Sub(zView, absDx), absDy);
+        end = V::Add(V::Add(zView, absDx), absDy);
+    }
+
+    static void DecodeSphereMap(Float ex, Float ey, Float& nx, Float& ny, Float& nz)
+    {
+        Float tmpX = V::Sub(ex, V::Mul(ex, ex));
+        Float tmpY = V::Sub(ey, V::Mul(ey, ey));
+        Float f = V::Add(tmpX, tmpY);
+        Float m = V::Sqrt(V::Sub(V::Mul(V::Splat(4.0f), f), V::Splat(1.0f)));
+        nx = V::Mul(m, V::Sub(V::Mul(ex, V::Splat(4.0f)), V::Splat(2.0f)));
+        ny = V::Mul(m, V::Sub(V::Mul(ey, V::Splat(4.0f)), V::Splat(2.0f)));
+        nz = V::Sub(V::Splat(3.0f), V::Mul(V::Splat(8.0f), f));
+    }
+
+    static Int PackHalves(Float low, Float high)
+    {
+        return V::Or(V::FloatToHalf(low), V::ShiftLeft16(V::FloatToHalf(high)));
+    }
+
+    // GetIncomingMergeNode() of every lane, unpacked for the tests and packed
+    // for the stores. Lanes past laneCount repeat the last fragment.
+    static void LoadIncoming(const Fragment* fragments, unsigned laneCount, Wave& wave, NodeLanes<V>& incoming)
+    {
+        const unsigned* words = (const unsigned*)fragments;
+        const Int offsets = V::MulInt(V::MinInt(V::LaneIndices(), V::SplatInt(laneCount - 1)),
+                                      V::SplatInt(kFragmentWords));
+
+        const Int coverage = V::And(V::Gather(words + kFragmentCoverage, offsets), V::SplatInt(0xFF));
+        incoming.coverage = V::Or(coverage, V::ShiftLeft8(coverage));
+        incoming.zView = V::AsFloat(V::Gather(words + kFragmentZView, offsets));
+        incoming.zViewDerivativesX = V::AsFloat(V::Gather(words + kFragmentDerivatives, offsets));
+        incoming.zViewDerivativesY = V::AsFloat(V::Gather(words + kFragmentDerivatives + 1, offsets));
+        incoming.normalX = V::AsFloat(V::Gather(words + kFragmentNormal, offsets));
+        incoming.normalY = V::AsFloat(V::Gather(words + kFragmentNormal + 1, offsets));
+
+        Int albedo = V::FloatToUnorm8(V::AsFloat(V::Gather(words + kFragmentAlbedo, offsets)));
+        albedo = V::Or(albedo, V::ShiftLeft8(V::FloatToUnorm8(V::AsFloat(V::Gather(words + kFragmentAlbedo + 1, offsets)))));
+        albedo = V::Or(albedo, V::ShiftLeft16(V::FloatToUnorm8(V::AsFloat(V::Gather(words + kFragmentAlbedo + 2, offsets)))));
+        albedo = V::Or(albedo, V::ShiftLeft24(V::FloatToUnorm8(V::AsFloat(V::Gather(words + kFragmentSpecular, offsets)))));
+        const Float specularY = V::AsFloat(V::Gather(words + kFragmentSpecular + 1, offsets));
+
+        V::StoreInt(wave.incomingPacked[kPackedCoverage],
+                    V::Or(incoming.coverage, V::ShiftLeft16(V::FloatToHalf(specularY))));
+        V::StoreInt(wave.incomingPacked[kPackedDerivatives],
+                    PackHalves(incoming.zViewDerivativesX, incoming.zViewDerivativesY));
+        V::StoreInt(wave.incomingPacked[kPackedZView], V::AsInt(incoming.zView));
+        V::StoreInt(wave.incomingPacked[kPackedNormal], PackHalves(incoming.normalX, incoming.normalY));
+        V::StoreInt(wave.incomingPacked[kPackedAlbedo], albedo);
+    }
+
+    static MergeNodePacked GetIncomingPacked(const Wave& wave, unsigned lane)
+    {
+        MergeNodePacked packed;
+        packed.coverage = wave.incomingPacked[kPackedCoverage][lane];
+        packed.zViewDerivatives = wave.incomingPacked[kPackedDerivatives][lane];
+        packed.zView = AsFloat(wave.incomingPacked[kPackedZView][lane]);
+        packed.normal = wave.incomingPacked[kPackedNormal][lane];
+        packed.albedo = wave.incomingPacked[kPackedAlbedo][lane];
+        return packed;
+    }
+
+    // UnpackMergeNode() of the fields the tests need, for the node at position
+    // i of every lane's list
+    static void LoadExisting(const unsigned* mergeWords, const Wave& wave, unsigned i, NodeLanes<V>& existing)
+    {
+        const Int offsets = V::LoadInt(wave.nodeWords[i]);
+        const Int derivatives = V::Gather(mergeWords + kPackedDerivatives, offsets);
+        const Int normal = V::Gather(mergeWords + kPackedNormal, offsets);
+        existing.coverage = V::And(V::Gather(mergeWords + kPackedCoverage, offsets), V::SplatInt(0xFFFF));
+        existing.zView = V::AsFloat(V::Gather(mergeWords + kPackedZView, offsets));
+        existing.zViewDerivativesX = V::HalfToFloat(V::And(derivatives, V::SplatInt(0xFFFF)));
+        existing.zViewDerivativesY = V::HalfToFloat(V::ShiftRight16(derivatives));
+        existing.normalX = V::HalfToFloat(V::And(normal, V::SplatInt(0xFFFF)));
+        existing.normalY = V::HalfToFloat(V::ShiftRight16(normal));
+    }
+
+    static void MergeWave(MergeBuffers& buffers, const Fragment* fragments, unsigned laneCount,
+                          Wave& wave, MergeStats& stats)
+    {
+        NodeLanes<V> incoming;
+        LoadIncoming(fragments, laneCount, wave, incoming);
+
+        // Stores into empty pixels, and the node addresses of the rest
+        unsigned activeLanes = 0;
+        unsigned maxNodeCount = 0;
+        for (unsigned lane = 0; lane < laneCount; ++lane) {
+            Pixel pixel(buffers, fragments[lane].x, fragments[lane].y);
+            stats.fragments++;
+
+            const unsigned nodeCount = pixel.GetNodeCount();
+            wave.nodeCount[lane] = nodeCount;
+            if (nodeCount == 0) {
+                pixel.SetNodeCount(1);
+                pixel.SetPackedMergeNode(0, GetIncomingPacked(wave, lane));
+                stats.firsts++;
+                stats.nodeStores++;
+                continue;
+            }
+
+            activeLanes |= 1 << lane;
+            maxNodeCount = nodeCount > maxNodeCount ? nodeCount : maxNodeCount;
+            const unsigned nodeList = pixel.GetNodeList();
+            wave.nodeList[lane] = nodeList;
+            for (unsigned i = 0; i < nodeCount; ++i) {
+                wave.nodeWords[i][lane] = pixel.GetMergeNodeAddress(GetNodeListEntry<Layout>(nodeList, i)) * kPackedWords;
+            }
+        }
+        if (activeLanes == 0) {
+            return;
+        }
+
+        // Compare() against every node, plus the "is behind incoming" test used for insertion
+        const unsigned* mergeWords = (const unsigned*)&buffers.GetMergeBuffer()[0];
+        NodeLanes<V> existing[kMaxSurfaces];
+        unsigned mergeMasks[kMaxSurfaces] = {};
+        unsigned behindMasks[kMaxSurfaces] = {};
+        {
+            Float incomingMin, incomingMax;
+            GetDepthRange(incoming.zView, incoming.zViewDerivativesX, incoming.zViewDerivativesY,
+                          incomingMin, incomingMax);
+            Float n1x, n1y, n1z;
+            DecodeSphereMap(incoming.normalX, incoming.normalY, n1x, n1y, n1z);
+
+            for (unsigned i = 0; i < maxNodeCount; ++i) {
+                NodeLanes<V>& lanes = existing[i];
+                LoadExisting(mergeWords, wave, i, lanes);
+                unsigned exclusive = V::Equal(V::And(lanes.coverage, incoming.coverage), V::SplatInt(0));
+
+                Float existingMin, existingMax;
+                GetDepthRange(lanes.zView, lanes.zViewDerivativesX, lanes.zViewDerivativesY,
+                              existingMin, existingMax);
+                unsigned overlap = V::LessEqual(existingMin, incomingMax) & V::LessEqual(incomingMin, existingMax);
+
+                Float n0x, n0y, n0z;
+                DecodeSphereMap(lanes.normalX, lanes.normalY, n0x, n0y, n0z);
+                Float dot = V::Add(V::Add(V::Mul(n0x, n1x), V::Mul(n0y, n1y)), V::Mul(n0z, n1z));
+                unsigned similar = V::GreaterEqual(V::Abs(dot), V::Splat(STREAMING_COS_THETA));
+
+                mergeMasks[i] = exclusive & overlap & similar;
+                behindMasks[i] = V::Greater(V::Sub(lanes.zView, incoming.zView), V::Splat(0.0f));
+            }
+        }
+
+        unsigned fusionLanes = 0;
+        for (unsigned lane = 0; lane < laneCount; ++lane) {
+            const unsigned bit = 1 << lane;
+            if (!(activeLanes & bit)) {
+                continue;
+            }
+            Pixel pixel(buffers, fragments[lane].x, fragments[lane].y);
+            const unsigned count = wave.nodeCount[lane];
+
+            unsigned incomingPosition = count;
+            bool merged = false;
+            for (unsigned i = 0; i < count; ++i) {
+                stats.nodeLoads++;
+                if (mergeMasks[i] & bit) {
+                    const unsigned index = GetNodeListEntry<Layout>(wave.nodeList[lane], i);
+                    MergeNodePacked packed = pixel.GetPackedMergeNode(index);
+                    MergePackedNodeScalar(packed, GetIncomingMergeNode(fragments[lane]));
+                    pixel.SetPackedMergeNode(index, packed);
+                    stats.merges++;
+                    stats.nodeStores++;
+                    merged = true;
+                    break;
+                }
+                if ((behindMasks[i] & bit) && incomingPosition == count) {
+                    incomingPosition = i;
+                }
+            }
+            if (merged) {
+                continue;
+            }
+
+            wave.nodeList[lane] = InsertIntoNodeList<Layout>(wave.nodeList[lane], count, incomingPosition, count);
+            wave.incomingPosition[lane] = incomingPosition;
+            if (count == kMaxSurfaces) {
+                fusionLanes |= bit;
+            } else if (count == 1 && !pixel.AllocatePoolBlock()) {
+                // Node pool exhausted, the fragment is dropped
+                pixel.SetDiscardedSamples(1);
+                stats.discards++;
+            } else {
+                pixel.SetNodeCount(count + 1);
+                pixel.SetNodeList(wave.nodeList[lane]);
+                pixel.SetPackedMergeNode(count, GetIncomingPacked(wave, lane));
+                stats.inserts++;
+                stats.nodeStores++;
+            }
+        }
+
+        // Only full pixels fuse, so every slot of existing was loaded
+        if (fusionLanes != 0) {
+            OccluderFusionWave(buffers, fragments, laneCount, fusionLanes, wave, incoming, existing, stats);
+        }
+    }
+
+    static void OccluderFusionWave(MergeBuffers& buffers, const Fragment* fragments, unsigned laneCount,
+                                   unsigned fusionLanes, const Wave& wave, const NodeLanes<V>& incoming,
+                                   const NodeLanes<V> existing[kMaxSurfaces], MergeStats& stats)
+    {
+        // OcclusionCheck() down the list with incoming inserted. The occluder
+        // keeps accumulating past the point where a lane returns, that lane
+        // just ignores the rest.
+        unsigned occludedMasks[kMaxSurfaces + 1];
+        unsigned separatedMasks[kMaxSurfaces + 1];
+        unsigned newInfo[kMaxSurfaces + 1][kWidth];
+        {
+            const Int incomingPositions = V::LoadInt(wave.incomingPosition);
+            Float occluderStart = V::Splat(0.0f);
+            Float occluderEnd = V::Splat(0.0f);
+            Int occluderCoverage = V::SplatInt(0);
+            for (unsigned i = 0; i < kMaxSurfaces + 1; ++i) {
+                // Position i holds existing[i] in front of incoming, existing[i - 1] behind it
+                const Int position = V::SplatInt(i);
+                const Mask isFront = V::GreaterIntMask(incomingPositions, position);
+                const Mask isIncoming = V::EqualIntMask(incomingPositions, position);
+                const NodeLanes<V>& front = existing[i < kMaxSurfaces ? i : kMaxSurfaces - 1];
+                const NodeLanes<V>& behind = existing[i > 0 ? i - 1 : 0];
+
+                Float zView = V::Select(isIncoming, incoming.zView, V::Select(isFront, front.zView, behind.zView));
+                Float dx = V::Select(isIncoming, incoming.zViewDerivativesX,
+                                     V::Select(isFront, front.zViewDerivativesX, behind.zViewDerivativesX));
+                Float dy = V::Select(isIncoming, incoming.zViewDerivativesY,
+                                     V::Select(isFront, front.zViewDerivativesY, behind.zViewDerivativesY));
+                Int mergeCoverage = V::SelectInt(isIncoming, incoming.coverage,
+                                                 V::SelectInt(isFront, front.coverage, behind.coverage));
+                Float mergeStart, mergeEnd;
+                GetDepthRange(zView, dx, dy, mergeStart, mergeEnd);
+
+                Int mergeAndOccluderCoverage = V::And(mergeCoverage, occluderCoverage);
+                Int mergeDTC = V::And(V::ShiftRight8(mergeCoverage), V::SplatInt(0xFF));
+                V::StoreInt(newInfo[i], V::Xor(mergeDTC, V::And(mergeAndOccluderCoverage, mergeDTC)));
+
+                separatedMasks[i] = V::Less(occluderStart, mergeStart) & V::Less(occluderEnd, mergeStart);
+                occludedMasks[i] = separatedMasks[i] & V::Equal(mergeAndOccluderCoverage, mergeCoverage);
+
+                occluderStart = V::Min(occluderStart, mergeStart);
+                occluderEnd = V::Max(occluderEnd, mergeEnd);
+                occluderCoverage = V::Or(mergeCoverage, occluderCoverage);
+            }
+        }
+
+        for (unsigned lane = 0; lane < laneCount; ++lane) {
+            const unsigned bit = 1 << lane;
+            if (!(fusionLanes & bit)) {
+                continue;
+            }
+            Pixel pixel(buffers, fragments[lane].x, fragments[lane].y);
+            const unsigned incomingPosition = wave.incomingPosition[lane];
+            const unsigned nodeList = wave.nodeList[lane];
+
+            unsigned minCoverageCount = CountBits(0xFF);
+            unsigned minCoveragePosition = 0;
+            unsigned removedPosition = kMaxSurfaces + 1;
+            for (unsigned i = 0; i < kMaxSurfaces + 1; ++i) {
+                const bool isIncoming = i == incomingPosition;
+                if (!isIncoming) {
+                    stats.nodeLoads++;
+                }
+                if (occludedMasks[i] & bit) {
+                    stats.occlusions++;
+                    removedPosition = i;
+                    break;
+                }
+                if (!isIncoming) {
+                    // Only the depth tested coverage byte changes, and only
+                    // when the node is separated from the occluder. The scalar
+                    // path stores the node either way.
+                    if (separatedMasks[i] & bit) {
+                        const unsigned index = GetNodeListEntry<Layout>(nodeList, i);
+                        MergeNodePacked packed = pixel.GetPackedMergeNode(index);
+                        SetByteInUint(packed.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, newInfo[i][lane]);
+                        pixel.SetPackedMergeNode(index, packed);
+                    }
+                    stats.nodeStores++;
+                }
+                unsigned newInfoCount = CountBits(newInfo[i][lane]);
+                if (newInfoCount <= minCoverageCount) {
+                    minCoverageCount = newInfoCount;
+                    minCoveragePosition = i;
+                }
+            }
+            if (removedPosition == kMaxSurfaces + 1) {
+                stats.discards++;
+                pixel.SetDiscardedSamples(1);
+                removedPosition = minCoveragePosition;
+            }
+
+            if (removedPosition != incomingPosition) {
+                unsigned incomingIndex;
+                pixel.SetNodeList(CompactNodeList<Layout>(nodeList, kMaxSurfaces, incomingPosition, removedPosition, incomingIndex));
+                pixel.SetPackedMergeNode(incomingIndex, GetIncomingPacked(wave, lane));
+                stats.nodeStores++;
+            }
+        }
+    }
+};
+
+} // namespace StreamingCpu
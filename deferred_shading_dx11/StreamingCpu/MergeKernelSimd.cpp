@@ -0,0 +1,65 @@
+#include "MergeKernelSimd.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsScalar(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats)
+{
+    for (size_t i = 0; i < count; ++i) {
+        MergeBuffers::Pixel<SurfacesPerPixel> pixel(buffers, fragments[i].x, fragments[i].y);
+        MergeFragment(pixel, GetIncomingMergeNode(fragments[i]), stats);
+    }
+}
+
+void MergePackedNodeScalar(MergeNodePacked& existing, const MergeNode& incoming)
+{
+    MergeNode temp = UnpackMergeNode(existing);
+    CombineMergeNodes(temp, incoming);
+    AverageShadeNodes(temp.shade, incoming.shade);
+    existing = PackMergeNode(temp);
+}
+
+// Indexed by surfacesPerPixel - 1
+static const MergeFragmentsFunction kScalarFunctions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+    MergeFragmentsScalar<1>, MergeFragmentsScalar<2>, MergeFragmentsScalar<3>, MergeFragmentsScalar<4>,
+    MergeFragmentsScalar<5>, MergeFragmentsScalar<6>, MergeFragmentsScalar<7>, MergeFragmentsScalar<8>
+};
+
+#if defined(STREAMINGCPU_X86)
+static const MergeFragmentsFunction kAvx2Functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+    MergeFragmentsAvx2<1>, MergeFragmentsAvx2<2>, MergeFragmentsAvx2<3>, MergeFragmentsAvx2<4>,
+    MergeFragmentsAvx2<5>, MergeFragmentsAvx2<6>, MergeFragmentsAvx2<7>, MergeFragmentsAvx2<8>
+};
+#endif // defined(STREAMINGCPU_X86)
+
+#if defined(STREAMINGCPU_AVX512)
+static const MergeFragmentsFunction kAvx512Functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+    MergeFragmentsAvx512<1>, MergeFragmentsAvx512<2>, MergeFragmentsAvx512<3>, MergeFragmentsAvx512<4>,
+    MergeFragmentsAvx512<5>, MergeFragmentsAvx512<6>, MergeFragmentsAvx512<7>, MergeFragmentsAvx512<8>
+};
+#endif // defined(STREAMINGCPU_AVX512)
+
+MergeFragmentsFunction GetMergeFragmentsFunction(SimdLevel level, unsigned surfacesPerPixel)
+{
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+    const unsigned slot = surfacesPerPixel - 1;
+
+    SimdLevel maxLevel = GetMaxSimdLevel();
+    if (level > maxLevel) {
+        level = maxLevel;
+    }
+
+    switch (level) {
+#if defined(STREAMINGCPU_AVX512)
+        case SIMD_LEVEL_AVX512: return kAvx512Functions[slot];
+#endif // defined(STREAMINGCPU_AVX512)
+#if defined(STREAMINGCPU_X86)
+        case SIMD_LEVEL_AVX2: return kAvx2Functions[slot];
+#endif // defined(STREAMINGCPU_X86)
+        default: return kScalarFunctions[slot];
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,36 @@
+#ifndef STREAMINGCPU_MERGEKERNELSIMD_H
+#define STREAMINGCPU_MERGEKERNELSIMD_H
+
+#include "CpuFeatures.h"
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include <stddef.h>
+
+namespace StreamingCpu {
+
+// Runs MergeFragment() on fragments in order. All variants produce identical
+// buffers and stats. Each is instantiated for every supported surface count.
+typedef void (*MergeFragmentsFunction)(MergeBuffers& buffers, const Fragment* fragments,
+                                       size_t count, MergeStats& stats);
+
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsScalar(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats);
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsAvx2(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats);
+#if defined(STREAMINGCPU_AVX512)
+template <unsigned SurfacesPerPixel>
+void MergeFragmentsAvx512(MergeBuffers& buffers, const Fragment* fragments, size_t count, MergeStats& stats);
+#endif // defined(STREAMINGCPU_AVX512)
+
+// Scalar float work the lane kernels need. This lives out of line so it is
+// never compiled with the wider ISA, where FMA contraction would change results.
+void MergePackedNodeScalar(MergeNodePacked& existing, const MergeNode& incoming);
+
+// Falls back to the best level below the one requested that is supported.
+// surfacesPerPixel must be in [STREAMING_SURFACES_PER_PIXEL_MIN, STREAMING_SURFACES_PER_PIXEL_MAX_CPU].
+MergeFragmentsFunction GetMergeFragmentsFunction(SimdLevel level, unsigned surfacesPerPixel);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGEKERNELSIMD_H
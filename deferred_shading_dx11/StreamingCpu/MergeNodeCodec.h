@@ -0,0 +1,215 @@
+#ifndef STREAMINGCPU_MERGENODECODEC_H
+#define STREAMINGCPU_MERGENODECODEC_H
+
+// MergeNode helpers from Shaders/StreamingStructs.h and the packing done by
+// GetMergeNode/SetMergeNode in Shaders/StreamingBuffers.hlsl.
+
+#include "../Shaders/StreamingStructs.h"
+#include "FormatConvert.h"
+#include "SphereMap.h"
+#include "UintByteArray.h"
+
+#if defined(STREAMING_DEBUG_OPTIONS)
+#error The CPU streaming code only models the non-debug MergeNode layout
+#endif // defined(STREAMING_DEBUG_OPTIONS)
+
+static_assert(sizeof(MergeNodePacked) == 20, "MergeNodePacked is 5 uints");
+static_assert(sizeof(MergeNodeCompact) == 16, "MergeNodeCompact is 4 uints");
+
+namespace StreamingCpu {
+
+inline MergeNode GetEmptyMergeNode()
+{
+    MergeNode merge;
+    merge.coverage = 0;
+    merge.zViewDerivatives[0] = 0.0f;
+    merge.zViewDerivatives[1] = 0.0f;
+    merge.zView = 100000.0f; // far plane distance
+    merge.normal[0] = 0.0f;
+    merge.normal[1] = 0.0f;
+    merge.shade.albedo[0] = 0.0f;
+    merge.shade.albedo[1] = 0.0f;
+    merge.shade.albedo[2] = 0.0f;
+    merge.shade.albedo[3] = 0.0f;
+    merge.shade.specular[0] = 0.0f;
+    merge.shade.specular[1] = 0.0f;
+    return merge;
+}
+
+inline unsigned GetCoverage(const MergeNode& merge)
+{
+    return GetByteInUint(merge.coverage, MERGENODE_COVERAGE_BYTE);
+}
+
+inline void SetCoverage(MergeNode& merge, unsigned coverage)
+{
+    SetByteInUint(merge.coverage, MERGENODE_COVERAGE_BYTE, coverage);
+}
+
+inline unsigned GetDepthTestedCoverage(const MergeNode& merge)
+{
+    return GetByteInUint(merge.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE);
+}
+
+inline void SetDepthTestedCoverage(MergeNode& merge, unsigned coverage)
+{
+    SetByteInUint(merge.coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, coverage);
+}
+
+// SetMergeNode
+inline MergeNodePacked PackMergeNode(const MergeNode& merge)
+{
+    MergeNodePacked packed;
+    packed.normal = FLOAT2_to_R16G16_FLOAT(merge.normal);
+    packed.zViewDerivatives = FLOAT2_to_R16G16_FLOAT(merge.zViewDerivatives);
+    packed.zView = merge.zView;
+
+    float albedo[4] = { merge.shade.albedo[0], merge.shade.albedo[1], merge.shade.albedo[2],
+                        merge.shade.specular[0] };
+    packed.albedo = FLOAT4_to_R8G8B8A8_UNORM(albedo);
+    packed.coverage = merge.coverage | (F32ToF16(merge.shade.specular[1]) << 16);
+    return packed;
+}
+
+// GetMergeNode
+inline MergeNode UnpackMergeNode(const MergeNodePacked& packed)
+{
+    MergeNode merge;
+    R16G16_FLOAT_to_FLOAT2(packed.normal, merge.normal);
+    R16G16_FLOAT_to_FLOAT2(packed.zViewDerivatives, merge.zViewDerivatives);
+    merge.zView = packed.zView;
+
+    merge.coverage = packed.coverage & 0xFFFF;
+    merge.shade.specular[1] = F16ToF32(packed.coverage >> 16);
+
+    float temp[4];
+    R8G8B8A8_UNORM_to_FLOAT4(packed.albedo, temp);
+    merge.shade.albedo[0] = temp[0];
+    merge.shade.albedo[1] = temp[1];
+    merge.shade.albedo[2] = temp[2];
+    merge.shade.albedo[3] = 1.0f;
+    merge.shade.specular[0] = temp[3];
+    return merge;
+}
+
+// Helpers for the STREAMING_COMPACT_MERGE_NODE layout in StreamingStructs.h
+
+inline unsigned PackZView22(float zView)
+{
+    unsigned packed = (AsUint(zView > 0.0f ? zView : 0.0f) + 0x100) >> 9;
+    return packed < 0x3FBFFF ? packed : 0x3FBFFF;
+}
+
+inline float UnpackZView22(unsigned packed)
+{
+    return AsFloat(packed << 9);
+}
+
+inline unsigned PackDerivative11(float derivative)
+{
+    unsigned bits = F32ToF16(derivative);
+    unsigned magnitude = (bits & 0x7FFF) + 0x10;
+    magnitude = magnitude < 0x7BFF ? magnitude : 0x7BFF;
+    return ((bits >> 15) << 10) | (magnitude >> 5);
+}
+
+inline float UnpackDerivative11(unsigned packed)
+{
+    return F16ToF32(((packed >> 10) << 15) | ((packed & 0x3FF) << 5));
+}
+
+inline float SignNotZero(float value)
+{
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+inline void EncodeOctahedral(const float n[3], float e[2])
+{
+    float sum = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float x = n[0] / sum;
+    float y = n[1] / sum;
+    if (n[2] < 0.0f) {
+        float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+        float foldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+        x = foldedX;
+        y = foldedY;
+    }
+    e[0] = x * 0.5f + 0.5f;
+    e[1] = y * 0.5f + 0.5f;
+}
+
+inline void DecodeOctahedral(const float e[2], float n[3])
+{
+    n[0] = e[0] * 2.0f - 1.0f;
+    n[1] = e[1] * 2.0f - 1.0f;
+    n[2] = 1.0f - fabsf(n[0]) - fabsf(n[1]);
+    if (n[2] < 0.0f) {
+        float x = (1.0f - fabsf(n[1])) * SignNotZero(n[0]);
+        float y = (1.0f - fabsf(n[0])) * SignNotZero(n[1]);
+        n[0] = x;
+        n[1] = y;
+    }
+    float length = sqrtf(Dot3(n, n));
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+}
+
+// round(saturate(value) * 1023). NaN, e.g. from the normal of an empty node,
+// gives 0 like the shader's float to uint conversion.
+inline unsigned FloatToUnorm10(float value)
+{
+    value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+    return (unsigned)(value * 1023.0f + 0.5f);
+}
+
+// SetMergeNode with STREAMING_COMPACT_MERGE_NODE
+inline MergeNodeCompact PackMergeNodeCompact(const MergeNode& merge)
+{
+    float normal[3];
+    float octahedral[2];
+    DecodeSphereMap(merge.normal, normal);
+    EncodeOctahedral(normal, octahedral);
+
+    MergeNodeCompact packed;
+    packed.zViewNormalX = (PackZView22(merge.zView) << 10) | FloatToUnorm10(octahedral[0]);
+    packed.derivativesNormalY = (PackDerivative11(merge.zViewDerivatives[0]) << 21) |
+                                (PackDerivative11(merge.zViewDerivatives[1]) << 10) |
+                                FloatToUnorm10(octahedral[1]);
+
+    float albedo[4] = { merge.shade.albedo[0], merge.shade.albedo[1], merge.shade.albedo[2],
+                        merge.shade.specular[0] };
+    packed.albedo = FLOAT4_to_R8G8B8A8_UNORM(albedo);
+    packed.coverage = merge.coverage | (F32ToF16(merge.shade.specular[1]) << 16);
+    return packed;
+}
+
+// GetMergeNode with STREAMING_COMPACT_MERGE_NODE
+inline MergeNode UnpackMergeNodeCompact(const MergeNodeCompact& packed)
+{
+    MergeNode merge;
+    float octahedral[2] = { (packed.zViewNormalX & 0x3FF) / 1023.0f,
+                            (packed.derivativesNormalY & 0x3FF) / 1023.0f };
+    float normal[3];
+    DecodeOctahedral(octahedral, normal);
+    EncodeSphereMap(normal, merge.normal);
+    merge.zViewDerivatives[0] = UnpackDerivative11(packed.derivativesNormalY >> 21);
+    merge.zViewDerivatives[1] = UnpackDerivative11((packed.derivativesNormalY >> 10) & 0x7FF);
+    merge.zView = UnpackZView22(packed.zViewNormalX >> 10);
+
+    merge.coverage = packed.coverage & 0xFFFF;
+    merge.shade.specular[1] = F16ToF32(packed.coverage >> 16);
+
+    float temp[4];
+    R8G8B8A8_UNORM_to_FLOAT4(packed.albedo, temp);
+    merge.shade.albedo[0] = temp[0];
+    merge.shade.albedo[1] = temp[1];
+    merge.shade.albedo[2] = temp[2];
+    merge.shade.albedo[3] = 1.0f;
+    merge.shade.specular[0] = temp[3];
+    return merge;
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_MERGENODECODEC_H
@@ -0,0 +1,190 @@
+#include "NodePrediction.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// The summary packs a range into one uint as the top 16 bits of its start,
+// rounded down, and of its end, rounded up, so the packed range always holds
+// the widened one. STREAMING_PREDICTION_UNKNOWN unpacks to NaNs, which never
+// skip a node.
+// Depth range of a node (GetDepthRange) as the summary stores it
+float GetPredictedStart(float start)
+{
+    return (start > 0.0f ? start : 0.0f) * (1.0f - STREAMING_PREDICTION_MARGIN);
+}
+
+float GetPredictedEnd(float end)
+{
+    return end * (1.0f + STREAMING_PREDICTION_MARGIN);
+}
+
+// Bits of the positive floats GetPredictedStart and GetPredictedEnd return
+unsigned PackPredictedRange(unsigned startBits, unsigned endBits)
+{
+    return (startBits >> 16) | ((endBits + 0xFFFFu) & 0xFFFF0000u);
+}
+
+unsigned UnpackPredictedStart(unsigned packed)
+{
+    return packed << 16;
+}
+
+unsigned UnpackPredictedEnd(unsigned packed)
+{
+    return packed & 0xFFFF0000u;
+}
+
+// A node entirely in front of the incoming range fails the depth test of
+// Compare and has a smaller zView. One entirely behind it fails the depth
+// test and is where incoming goes if no node before it took it.
+unsigned ClassifyPredictedRange(float start, float end, float incomingMin, float incomingMax)
+{
+    if (end < incomingMin) {
+        return STREAMING_PREDICTION_FRONT;
+    }
+    if (start > incomingMax) {
+        return STREAMING_PREDICTION_BEHIND;
+    }
+    return STREAMING_PREDICTION_LOAD;
+}
+
+// MergeBuffers::Pixel that counts the search loop and, given buffers, looks
+// its nodes up in their summary. A node the summary would skip is confirmed
+// against its depth range this frame first, loading only the depth.
+template <unsigned SurfacesPerPixel>
+class PredictionPixel
+{
+public:
+    typedef StreamingSurfaceLayout<SurfacesPerPixel> Layout;
+
+    PredictionPixel(MergeBuffers& merge, const PredictedMergeBuffers* buffers, NodeSearchStats& stats,
+                    unsigned x, unsigned y)
+        : mPixel(merge, x, y), mBuffers(buffers), mStats(stats), mX(x), mY(y) {}
+
+    unsigned GetNodeCount() const { return mPixel.GetNodeCount(); }
+    void SetNodeCount(unsigned value) { mPixel.SetNodeCount(value); }
+    unsigned GetNodeList() const { return mPixel.GetNodeList(); }
+    void SetNodeList(unsigned nodeList) { mPixel.SetNodeList(nodeList); }
+    MergeNode GetMergeNode(unsigned index) const { return mPixel.GetMergeNode(index); }
+    void SetMergeNode(unsigned index, const MergeNode& merge) { mPixel.SetMergeNode(index, merge); }
+    bool AllocatePoolBlock() { return mPixel.AllocatePoolBlock(); }
+    void SetDiscardedSamples(unsigned discardedSamples) { mPixel.SetDiscardedSamples(discardedSamples); }
+    void AddHiZOccluder(unsigned, float) {}
+
+    unsigned PredictNode(unsigned index, float incomingMin, float incomingMax)
+    {
+        mStats.steps++;
+        unsigned prediction = STREAMING_PREDICTION_LOAD;
+        if (mBuffers) {
+            mStats.summaryReads++;
+            prediction = mBuffers->PredictNode(mX, mY, index, incomingMin, incomingMax);
+        }
+        if (prediction != STREAMING_PREDICTION_LOAD) {
+            // Only zView and its derivatives
+            float start, end;
+            GetDepthRange(mPixel.GetMergeNode(index), start, end);
+            mStats.depthLoads++;
+            prediction = ClassifyPredictedRange(start, end, incomingMin, incomingMax);
+            mStats.mispredicted += prediction == STREAMING_PREDICTION_LOAD;
+        }
+        mStats.loads += prediction == STREAMING_PREDICTION_LOAD;
+        mStats.skippedFront += prediction == STREAMING_PREDICTION_FRONT;
+        mStats.skippedBehind += prediction == STREAMING_PREDICTION_BEHIND;
+        return prediction;
+    }
+
+private:
+    MergeBuffers::Pixel<SurfacesPerPixel> mPixel;
+    const PredictedMergeBuffers* mBuffers;
+    NodeSearchStats& mStats;
+    unsigned mX;
+    unsigned mY;
+};
+
+} // namespace
+
+template <unsigned SurfacesPerPixel>
+void PredictedMergeBuffers::MergeFragments(PredictedMergeBuffers& buffers, const Fragment* fragments, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const Fragment& fragment = fragments[i];
+        const MergeNode incoming = GetIncomingMergeNode(fragment);
+        buffers.mSearchStats.fragments += buffers.mBuffers.GetNodeCount(fragment.x, fragment.y) > 0;
+        PredictionPixel<SurfacesPerPixel> pixel(buffers.mBuffers, 0, buffers.mSearchStats,
+                                                fragment.x, fragment.y);
+        MergeFragment(pixel, incoming, buffers.mStats);
+
+        buffers.mPredictedSearchStats.fragments += buffers.mPredictedBuffers.GetNodeCount(fragment.x, fragment.y) > 0;
+        PredictionPixel<SurfacesPerPixel> predictedPixel(buffers.mPredictedBuffers, &buffers,
+                                                         buffers.mPredictedSearchStats, fragment.x, fragment.y);
+        MergeFragment(predictedPixel, incoming, buffers.mPredictedMergeStats);
+    }
+}
+
+PredictedMergeBuffers::PredictedMergeBuffers(unsigned width, unsigned height, unsigned surfacesPerPixel)
+    : mWidth(width), mHeight(height), mSurfacesPerPixel(surfacesPerPixel)
+    , mBuffers(width, height, surfacesPerPixel)
+    , mPredictedBuffers(width, height, surfacesPerPixel)
+    , mPrediction((size_t)width * height * surfacesPerPixel, STREAMING_PREDICTION_UNKNOWN)
+{
+    assert(surfacesPerPixel >= STREAMING_SURFACES_PER_PIXEL_MIN &&
+           surfacesPerPixel <= STREAMING_SURFACES_PER_PIXEL_MAX_CPU);
+
+    // Indexed by surfacesPerPixel - 1
+    static const MergeFunction functions[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {
+        MergeFragments<1>, MergeFragments<2>, MergeFragments<3>, MergeFragments<4>,
+        MergeFragments<5>, MergeFragments<6>, MergeFragments<7>, MergeFragments<8>
+    };
+    mMergeFunction = functions[surfacesPerPixel - 1];
+}
+
+void PredictedMergeBuffers::Merge(const Fragment* fragments, size_t fragmentCount)
+{
+    // What the app clears every frame. The summary is kept.
+    mBuffers.Clear();
+    mPredictedBuffers.Clear();
+
+    mMergeFunction(*this, fragments, fragmentCount);
+
+    StorePrediction();
+}
+
+unsigned PredictedMergeBuffers::PredictNode(unsigned x, unsigned y, unsigned index,
+                                            float incomingMin, float incomingMax) const
+{
+    const uint32_t packed = mPrediction[(x + (size_t)mWidth * y) * mSurfacesPerPixel + index];
+    return ClassifyPredictedRange(AsFloat(UnpackPredictedStart(packed)), AsFloat(UnpackPredictedEnd(packed)),
+                                  incomingMin, incomingMax);
+}
+
+void PredictedMergeBuffers::StorePrediction()
+{
+    // The slots below the node count are the ones in use. Every slot is
+    // written, like the resolve does.
+    mPredictedSearchStats.summaryWrites += mPrediction.size();
+    for (unsigned y = 0; y < mHeight; ++y) {
+        for (unsigned x = 0; x < mWidth; ++x) {
+            const unsigned nodeCount = mPredictedBuffers.GetNodeCount(x, y);
+            uint32_t* prediction = &mPrediction[(x + (size_t)mWidth * y) * mSurfacesPerPixel];
+            for (unsigned i = 0; i < mSurfacesPerPixel; ++i) {
+                if (i >= nodeCount || nodeCount == mSurfacesPerPixel) {
+                    prediction[i] = STREAMING_PREDICTION_UNKNOWN;
+                    continue;
+                }
+                MergeNode merge = UnpackMergeNode(mPredictedBuffers.GetMergeBuffer()[mPredictedBuffers.GetNodeIndex(x, y, i)]);
+                float start, end;
+                GetDepthRange(merge, start, end);
+                prediction[i] = PackPredictedRange(AsUint(GetPredictedStart(start)), AsUint(GetPredictedEnd(end)));
+            }
+        }
+    }
+}
+
+void CheckNodePrediction(const PredictedMergeBuffers& buffers, unsigned msaaSamples, MergedBuffersCheck& check)
+{
+    CheckMergedBuffers(buffers.GetPredictedBuffers(), buffers.GetBuffers(), msaaSamples, check);
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,108 @@
+#ifndef STREAMINGCPU_NODEPREDICTION_H
+#define STREAMINGCPU_NODEPREDICTION_H
+
+// Node prediction, a bench experiment that is not in StreamingGBufferPS. At
+// the end of every frame the depth range of the node in each slot of a pixel
+// is packed into a summary, but for full pixels, as a resolve pass would. The
+// next frame's merge looks a node up in it before loading the node. When the
+// summary puts it entirely in front of or behind the incoming fragment, only
+// the node's depth is loaded, and the node is skipped if its range this frame
+// agrees.
+//
+// Every frame is merged twice in submission order, once as is and once with
+// the prediction, which alone writes the summary. The search loop of
+// MergeFragment is counted both ways: the positions it visits, the nodes it
+// loads and compares, and the bytes that moves including the summary.
+// CheckNodePrediction counts the pixels that differ, which must be none.
+
+#include "Fragment.h"
+#include "MergeBuffers.h"
+#include "MergeKernel.h"
+#include "ResolveWeights.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+// The search loop of MergeFragment
+struct NodeSearchStats
+{
+    uint64_t fragments;         // fragments that found nodes in their pixel
+    uint64_t steps;             // list positions visited
+    uint64_t loads;             // nodes loaded and compared
+    uint64_t depthLoads;        // depths loaded to confirm a predicted skip
+    uint64_t mispredicted;      // predicted skips the depth overturned, also in loads
+    uint64_t skippedFront;      // confirmed in front of the fragment
+    uint64_t skippedBehind;     // confirmed behind the fragment
+    uint64_t summaryReads;      // summary words looked up, one per step
+    uint64_t summaryWrites;     // summary words stored after each frame
+
+    NodeSearchStats()
+        : fragments(0), steps(0), loads(0), depthLoads(0), mispredicted(0), skippedFront(0), skippedBehind(0)
+        , summaryReads(0), summaryWrites(0) {}
+
+    // Memory traffic of the search and its summary: a whole node per load,
+    // zView and its derivatives per depth load, 4 bytes per summary word
+    uint64_t GetBytes() const
+    {
+        return loads * sizeof(MergeNodePacked) + depthLoads * (sizeof(uint32_t) + sizeof(float)) +
+               (summaryReads + summaryWrites) * sizeof(uint32_t);
+    }
+};
+
+class PredictedMergeBuffers
+{
+public:
+    PredictedMergeBuffers(unsigned width, unsigned height,
+                          unsigned surfacesPerPixel = STREAMING_MAX_SURFACES_PER_PIXEL);
+
+    // Merges a frame both ways, starting from empty buffers, then stores the
+    // summary the next frame predicts from
+    void Merge(const Fragment* fragments, size_t fragmentCount);
+
+    // Buffers of the last frame without and with the prediction
+    const MergeBuffers& GetBuffers() const { return mBuffers; }
+    const MergeBuffers& GetPredictedBuffers() const { return mPredictedBuffers; }
+
+    // Totals over all frames
+    const MergeStats& GetStats() const { return mStats; }
+    const MergeStats& GetPredictedMergeStats() const { return mPredictedMergeStats; }
+    const NodeSearchStats& GetSearchStats() const { return mSearchStats; }
+    const NodeSearchStats& GetPredictedSearchStats() const { return mPredictedSearchStats; }
+
+    // Where the summary puts the node in slot index against the incoming range
+    unsigned PredictNode(unsigned x, unsigned y, unsigned index, float incomingMin, float incomingMax) const;
+
+private:
+    // Not implemented
+    PredictedMergeBuffers(const PredictedMergeBuffers&);
+    PredictedMergeBuffers& operator=(const PredictedMergeBuffers&);
+
+    typedef void (*MergeFunction)(PredictedMergeBuffers& buffers, const Fragment* fragments, size_t count);
+
+    template <unsigned SurfacesPerPixel>
+    static void MergeFragments(PredictedMergeBuffers& buffers, const Fragment* fragments, size_t count);
+
+    // Packs every slot of every pixel, like a resolve pass would
+    void StorePrediction();
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mSurfacesPerPixel;
+    MergeFunction mMergeFunction;
+    MergeBuffers mBuffers;
+    MergeBuffers mPredictedBuffers;
+    std::vector<uint32_t> mPrediction;      // the summary, surfacesPerPixel per pixel
+    MergeStats mStats;
+    MergeStats mPredictedMergeStats;
+    NodeSearchStats mSearchStats;
+    NodeSearchStats mPredictedSearchStats;
+};
+
+// Last frame with the prediction against the one without
+void CheckNodePrediction(const PredictedMergeBuffers& buffers, unsigned msaaSamples, MergedBuffersCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_NODEPREDICTION_H
@@ -0,0 +1,377 @@
+#include "Relight.h"
+#include "FormatConvertSimd.h"
+#include "MergeNodeCodec.h"
+#include "ResolveWeights.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+namespace StreamingCpu {
+
+namespace {
+
+// Every pixel of a snapshot decoded up front, so Load() can read them in any
+// order
+class DecodedSnapshotSource : public GBufferSnapshotSource
+{
+public:
+    DecodedSnapshotSource() : mWidth(0) {}
+
+    bool Decode(const GBufferSnapshotReader& reader, ThreadPool* threadPool)
+    {
+        const GBufferSnapshotHeader& header = reader.GetHeader();
+        const unsigned maxNodes = (unsigned)header.surfacesPerPixel;
+        mWidth = header.width;
+        mPixels.assign((size_t)header.width * header.height, 0);
+        mNodes.resize((size_t)header.width * header.height * maxNodes);
+
+        std::vector<GBufferSnapshotScratch> scratch(threadPool->GetThreadCount());
+        std::vector<unsigned char> failed(threadPool->GetThreadCount(), 0);
+        threadPool->ParallelFor(reader.GetTileCount(), 4, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+            for (unsigned i = begin; i < end; ++i) {
+                GBufferSnapshotTile tile;
+                if (!reader.GetTile(i, scratch[threadIndex], tile)) {
+                    failed[threadIndex] = 1;
+                    continue;
+                }
+                for (unsigned y = 0; y < tile.height; ++y) {
+                    for (unsigned x = 0; x < tile.width; ++x) {
+                        const unsigned p = x + tile.width * y;
+                        const size_t pixel = tile.x + x + (size_t)mWidth * (tile.y + y);
+                        unsigned nodeCount = tile.pixels[p] & GBUFFER_SNAPSHOT_COUNT_MASK;
+                        nodeCount = nodeCount < maxNodes ? nodeCount : maxNodes;
+                        mPixels[pixel] = (unsigned char)(nodeCount | (tile.pixels[p] & GBUFFER_SNAPSHOT_DISCARDED));
+                        memcpy(&mNodes[pixel * maxNodes], &tile.nodes[tile.firstNodes[p]],
+                               nodeCount * sizeof(MergeNodePacked));
+                    }
+                }
+            }
+        });
+        mMaxNodes = maxNodes;
+        for (size_t i = 0; i < failed.size(); ++i) {
+            if (failed[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    unsigned GetPixel(unsigned x, unsigned y, MergeNodePacked* nodes, bool& discardedSamples) const
+    {
+        const size_t pixel = x + (size_t)mWidth * y;
+        const unsigned nodeCount = mPixels[pixel] & GBUFFER_SNAPSHOT_COUNT_MASK;
+        memcpy(nodes, &mNodes[pixel * mMaxNodes], nodeCount * sizeof(MergeNodePacked));
+        discardedSamples = (mPixels[pixel] & GBUFFER_SNAPSHOT_DISCARDED) != 0;
+        return nodeCount;
+    }
+
+private:
+    unsigned mWidth;
+    unsigned mMaxNodes;
+    std::vector<unsigned char> mPixels;     // snapshot pixel bytes
+    std::vector<MergeNodePacked> mNodes;    // surfacesPerPixel per pixel
+};
+
+} // namespace
+
+void RelightNodesScalar(const RelightNodes& nodes)
+{
+    const float* planes = nodes.planes;
+    const unsigned count = nodes.count;
+    for (unsigned i = 0; i < count; ++i) {
+        SurfaceData surface;
+        for (unsigned c = 0; c < 3; ++c) {
+            surface.positionView[c] = planes[(RELIGHT_PLANE_POSITION_X + c) * count + i];
+            surface.normal[c] = planes[(RELIGHT_PLANE_NORMAL_X + c) * count + i];
+            surface.albedo[c] = planes[(RELIGHT_PLANE_ALBEDO_R + c) * count + i];
+        }
+        surface.specularAmount = planes[RELIGHT_PLANE_SPECULAR_AMOUNT * count + i];
+        surface.specularPower = planes[RELIGHT_PLANE_SPECULAR_POWER * count + i];
+
+        // BasicLoopTiled
+        float lit[3] = { 0.0f, 0.0f, 0.0f };
+        if (surface.positionView[2] < nodes.farZ) {
+            for (unsigned l = 0; l < nodes.lightCount; ++l) {
+                AccumulateBRDF(surface, nodes.lights[nodes.lightIndices[l]], lit);
+            }
+        }
+        for (unsigned c = 0; c < 3; ++c) {
+            nodes.lit[c][i] = lit[c];
+        }
+    }
+}
+
+RelightFunction GetRelightFunction(SimdLevel level)
+{
+    SimdLevel maxLevel = GetMaxSimdLevel();
+    if (level > maxLevel) {
+        level = maxLevel;
+    }
+
+    switch (level) {
+#if defined(STREAMINGCPU_AVX512)
+        case SIMD_LEVEL_AVX512: return RelightNodesAvx512;
+#endif // defined(STREAMINGCPU_AVX512)
+#if defined(STREAMINGCPU_X86)
+        case SIMD_LEVEL_AVX2: return RelightNodesAvx2;
+#endif // defined(STREAMINGCPU_X86)
+        default: return RelightNodesScalar;
+    }
+}
+
+RelightEngine::RelightEngine(unsigned tileDim)
+    : mTileDim(tileDim), mWidth(0), mHeight(0), mMsaaSamples(1), mTilesX(0), mBins(tileDim)
+{
+    // Tile pixels are indexed with 16 bits
+    assert(tileDim > 0 && tileDim <= 256);
+    memset(&mView, 0, sizeof(mView));
+}
+
+void RelightEngine::Load(const GBufferSnapshotSource& source, unsigned width, unsigned height,
+                         unsigned msaaSamples, const ViewConstants& view, ThreadPool* threadPool)
+{
+    assert(msaaSamples >= 1 && msaaSamples <= 8);
+    mWidth = width;
+    mHeight = height;
+    mMsaaSamples = msaaSamples;
+    mView = view;
+    mTilesX = (width + mTileDim - 1) / mTileDim;
+    const unsigned tilesY = (height + mTileDim - 1) / mTileDim;
+
+    mTiles.clear();
+    mTiles.resize(mTilesX * tilesY);
+    mTileBounds.resize(mTiles.size());
+    for (unsigned i = 0; i < mTiles.size(); ++i) {
+        Tile& tile = mTiles[i];
+        tile.x = (i % mTilesX) * mTileDim;
+        tile.y = (i / mTilesX) * mTileDim;
+        tile.width = width - tile.x < mTileDim ? width - tile.x : mTileDim;
+        tile.height = height - tile.y < mTileDim ? height - tile.y : mTileDim;
+    }
+
+    threadPool->ParallelFor((unsigned)mTiles.size(), 4, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned i = begin; i < end; ++i) {
+            LoadTile(source, mTiles[i], mTileBounds[i]);
+        }
+    });
+    mOutput.assign((size_t)width * height * 3, 0.0f);
+}
+
+bool RelightEngine::Load(const GBufferSnapshotReader& reader, ThreadPool* threadPool)
+{
+    DecodedSnapshotSource source;
+    if (!source.Decode(reader, threadPool)) {
+        return false;
+    }
+    const GBufferSnapshotHeader& header = reader.GetHeader();
+    Load(source, header.width, header.height, header.msaaSamples, GetSnapshotViewConstants(header), threadPool);
+    return true;
+}
+
+uint64_t RelightEngine::GetNodeCount() const
+{
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < mTiles.size(); ++i) {
+        nodes += mTiles[i].nodeCount;
+    }
+    return nodes;
+}
+
+void RelightEngine::LoadTile(const GBufferSnapshotSource& source, Tile& tile, TileDepthBounds& bounds) const
+{
+    // Nodes that cover a sample, in list order, so the pixels add them up in
+    // the order of ShadeWeightedSurfaces
+    std::vector<SurfaceData> surfaces;
+    tile.weights.clear();
+    tile.pixels.clear();
+    tile.divisors.resize(tile.width * tile.height);
+
+    // Empty tiles keep bounds that reject every light
+    bounds.minZ = 3.40282347e+38f;
+    bounds.maxZ = 0.0f;
+
+    for (unsigned y = 0; y < tile.height; ++y) {
+        for (unsigned x = 0; x < tile.width; ++x) {
+            const unsigned pixelX = tile.x + x;
+            const unsigned pixelY = tile.y + y;
+            MergeNodePacked packed[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+            bool discardedSamples;
+            const unsigned nodeCount = source.GetPixel(pixelX, pixelY, packed, discardedSamples);
+
+            MergeNode nodes[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+            UnpackMergeNodes(packed, nodeCount, nodes);
+            for (unsigned i = 0; i < nodeCount; ++i) {
+                float viewSpaceZ = nodes[i].zView;
+                if (viewSpaceZ >= mView.nearZ && viewSpaceZ < mView.farZ) {
+                    bounds.minZ = viewSpaceZ < bounds.minZ ? viewSpaceZ : bounds.minZ;
+                    bounds.maxZ = viewSpaceZ > bounds.maxZ ? viewSpaceZ : bounds.maxZ;
+                }
+            }
+
+            unsigned weights[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = { 0 };
+            unsigned weightSum = 0;
+            if (nodeCount > 0 && mMsaaSamples == 1) {
+                // The closest node, first one on ties
+                unsigned closest = 0;
+                float closestDepth = 100000.0f;
+                for (unsigned i = 0; i < nodeCount; ++i) {
+                    if (nodes[i].zView < closestDepth) {
+                        closest = i;
+                        closestDepth = nodes[i].zView;
+                    }
+                }
+                weights[closest] = 1;
+                weightSum = 1;
+            } else if (nodeCount > 0) {
+                ResolveSurface resolveSurfaces[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+                for (unsigned i = 0; i < nodeCount; ++i) {
+                    resolveSurfaces[i].depthTestedCoverage = GetDepthTestedCoverage(nodes[i]);
+                    resolveSurfaces[i].zView = nodes[i].zView;
+                    resolveSurfaces[i].zViewDerivatives[0] = nodes[i].zViewDerivatives[0];
+                    resolveSurfaces[i].zViewDerivatives[1] = nodes[i].zViewDerivatives[1];
+                }
+                weightSum = ResolveSurfaceWeightsPairwise(resolveSurfaces, nodeCount, mMsaaSamples, weights);
+            }
+
+            for (unsigned i = 0; i < nodeCount; ++i) {
+                if (weights[i] > 0) {
+                    surfaces.push_back(ComputeSurfaceData(pixelX, pixelY, nodes[i], mView));
+                    tile.weights.push_back((float)weights[i]);
+                    tile.pixels.push_back((unsigned short)(x + tile.width * y));
+                }
+            }
+
+            // FinishPixel
+            const bool averageKnown = discardedSamples && nodeCount != 0;
+            tile.divisors[x + tile.width * y] = averageKnown ? (float)weightSum : (float)mMsaaSamples;
+        }
+    }
+
+    tile.nodeCount = (unsigned)surfaces.size();
+    tile.paddedCount = (tile.nodeCount + kRelightNodeAlignment - 1) & ~(kRelightNodeAlignment - 1u);
+
+    // Padding nodes face the camera in front of it, so the lanes stay finite
+    tile.planes.assign(RELIGHT_PLANE_COUNT * tile.paddedCount, 0.0f);
+    for (unsigned i = tile.nodeCount; i < tile.paddedCount; ++i) {
+        tile.planes[RELIGHT_PLANE_POSITION_Z * tile.paddedCount + i] = 1.0f;
+        tile.planes[RELIGHT_PLANE_NORMAL_Z * tile.paddedCount + i] = -1.0f;
+        tile.planes[RELIGHT_PLANE_SPECULAR_POWER * tile.paddedCount + i] = 1.0f;
+    }
+    for (unsigned i = 0; i < tile.nodeCount; ++i) {
+        const SurfaceData& surface = surfaces[i];
+        float* planes = &tile.planes[i];
+        const unsigned stride = tile.paddedCount;
+        for (unsigned c = 0; c < 3; ++c) {
+            planes[(RELIGHT_PLANE_POSITION_X + c) * stride] = surface.positionView[c];
+            planes[(RELIGHT_PLANE_NORMAL_X + c) * stride] = surface.normal[c];
+            planes[(RELIGHT_PLANE_ALBEDO_R + c) * stride] = surface.albedo[c];
+        }
+        planes[RELIGHT_PLANE_SPECULAR_AMOUNT * stride] = surface.specularAmount;
+        planes[RELIGHT_PLANE_SPECULAR_POWER * stride] = surface.specularPower;
+    }
+}
+
+void RelightEngine::Shade(const PointLight* lights, unsigned lightCount, SimdLevel level, ThreadPool* threadPool,
+                          RelightStats& stats)
+{
+    const RelightFunction function = GetRelightFunction(level);
+    std::vector<Scratch> scratch(threadPool->GetThreadCount());
+    std::vector<RelightStats> threadStats(threadPool->GetThreadCount());
+
+    Timer timer;
+    mBins.Build(mView, mTileBounds.empty() ? 0 : &mTileBounds[0], lights, lightCount, level, threadPool,
+                stats.binning);
+    unsigned steals = threadPool->ParallelForStealing((unsigned)mTiles.size(), 1,
+        [&](unsigned begin, unsigned end, unsigned threadIndex) {
+            for (unsigned i = begin; i < end; ++i) {
+                ShadeTile(i, lights, function, scratch[threadIndex], threadStats[threadIndex]);
+            }
+        });
+    stats.seconds += timer.GetSeconds();
+    stats.steals += steals;
+
+    for (size_t i = 0; i < threadStats.size(); ++i) {
+        stats.tiles += threadStats[i].tiles;
+        stats.nodes += threadStats[i].nodes;
+        stats.tileLights += threadStats[i].tileLights;
+        stats.lightEvaluations += threadStats[i].lightEvaluations;
+    }
+}
+
+void RelightEngine::ShadeTile(unsigned tileIndex, const PointLight* lights, RelightFunction function,
+                              Scratch& scratch, RelightStats& stats)
+{
+    const Tile& tile = mTiles[tileIndex];
+    const unsigned tileLights = mBins.GetLightCount(tileIndex % mTilesX, tileIndex / mTilesX);
+    stats.tiles++;
+    stats.nodes += tile.nodeCount;
+    stats.tileLights += tileLights;
+    stats.lightEvaluations += (uint64_t)tile.nodeCount * tileLights;
+
+    scratch.lit.resize(3 * tile.paddedCount + 1);
+    if (tile.nodeCount > 0) {
+        RelightNodes nodes;
+        nodes.planes = &tile.planes[0];
+        nodes.count = tile.paddedCount;
+        nodes.farZ = mView.farZ;
+        nodes.lights = lights;
+        nodes.lightIndices = mBins.GetLights(tileIndex % mTilesX, tileIndex / mTilesX);
+        nodes.lightCount = tileLights;
+        for (unsigned c = 0; c < 3; ++c) {
+            nodes.lit[c] = &scratch.lit[c * tile.paddedCount];
+        }
+        function(nodes);
+    }
+
+    // ShadeWeightedSurfaces and FinishPixel
+    scratch.output.assign(3 * tile.width * tile.height, 0.0f);
+    for (unsigned i = 0; i < tile.nodeCount; ++i) {
+        float* output = &scratch.output[3 * tile.pixels[i]];
+        for (unsigned c = 0; c < 3; ++c) {
+            output[c] += scratch.lit[c * tile.paddedCount + i] * tile.weights[i];
+        }
+    }
+    for (unsigned y = 0; y < tile.height; ++y) {
+        for (unsigned x = 0; x < tile.width; ++x) {
+            const unsigned p = x + tile.width * y;
+            float* pixel = &mOutput[3 * (tile.x + x + (size_t)mWidth * (tile.y + y))];
+            for (unsigned c = 0; c < 3; ++c) {
+                pixel[c] = scratch.output[3 * p + c] / tile.divisors[p];
+            }
+        }
+    }
+}
+
+ViewConstants GetSnapshotViewConstants(const GBufferSnapshotHeader& header)
+{
+    ViewConstants view;
+    view.proj11 = header.camera.proj[0];
+    view.proj22 = header.camera.proj[5];
+    view.nearZ = header.camera.nearFar[1];
+    view.farZ = header.camera.nearFar[0];
+    view.width = header.width;
+    view.height = header.height;
+    return view;
+}
+
+void CompareRelight(const std::vector<float>& output, const std::vector<float>& reference, RelightError& error)
+{
+    assert(output.size() == reference.size());
+    for (size_t p = 0; p < output.size(); p += 3) {
+        error.pixels++;
+        if (memcmp(&output[p], &reference[p], 3 * sizeof(float)) == 0) {
+            continue;
+        }
+        error.differingPixels++;
+        for (unsigned c = 0; c < 3; ++c) {
+            double magnitude = fabs((double)reference[p + c]);
+            double difference = fabs((double)output[p + c] - reference[p + c]) / (magnitude > 1.0 ? magnitude : 1.0);
+            // NaN in one of them counts as the largest error
+            error.maxError = difference > error.maxError || difference != difference ? difference : error.maxError;
+        }
+    }
+}
+
+} // namespace StreamingCpu
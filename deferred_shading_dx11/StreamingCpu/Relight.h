@@ -0,0 +1,174 @@
+#ifndef STREAMINGCPU_RELIGHT_H
+#define STREAMINGCPU_RELIGHT_H
+
+// CPU version of the lighting of StreamingResolveTiledPS, for measuring what
+// thousands of lights cost without a GPU. Load() resolves the sample weights
+// of every pixel once and keeps the nodes that cover a sample, as
+// ComputeSurfaceData() sees them, in SoA planes per tile. Shade() culls the
+// lights of each tile like StreamingLightCullCS with LightBins, runs
+// AccumulateBRDF on the tile's nodes and finishes the pixels like FinishPixel
+// with a black skybox.
+// Tiles cost their nodes times their lights, so they go to the threads with
+// ParallelForStealing().
+//
+// The scalar kernel is BasicLoopTiled. The lane kernels evaluate one light
+// on a lane of nodes at a time, which keeps the order every node adds its
+// lights in, so they only differ from it by approximating powf().
+
+#include "../ShaderDefines.h"
+#include "CpuFeatures.h"
+#include "GBufferSnapshot.h"
+#include "LightBinning.h"
+#include "Lighting.h"
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+enum RelightPlane
+{
+    RELIGHT_PLANE_POSITION_X,
+    RELIGHT_PLANE_POSITION_Y,
+    RELIGHT_PLANE_POSITION_Z,
+    RELIGHT_PLANE_NORMAL_X,
+    RELIGHT_PLANE_NORMAL_Y,
+    RELIGHT_PLANE_NORMAL_Z,
+    RELIGHT_PLANE_ALBEDO_R,
+    RELIGHT_PLANE_ALBEDO_G,
+    RELIGHT_PLANE_ALBEDO_B,
+    RELIGHT_PLANE_SPECULAR_AMOUNT,
+    RELIGHT_PLANE_SPECULAR_POWER,
+    RELIGHT_PLANE_COUNT
+};
+
+// Node counts are padded to this, the widest lane count
+enum { kRelightNodeAlignment = 16 };
+
+// What a kernel shades: count nodes (a multiple of kRelightNodeAlignment)
+// in RELIGHT_PLANE_COUNT planes of count floats, with the lights listed in
+// lightIndices. Writes the BasicLoopTiled result of every node to lit.
+struct RelightNodes
+{
+    const float* planes;
+    unsigned count;
+    float farZ;                         // nodes at or behind it stay black
+    const PointLight* lights;
+    const unsigned* lightIndices;
+    unsigned lightCount;
+    float* lit[3];
+};
+
+typedef void (*RelightFunction)(const RelightNodes& nodes);
+
+void RelightNodesScalar(const RelightNodes& nodes);
+#if defined(STREAMINGCPU_X86)
+void RelightNodesAvx2(const RelightNodes& nodes);
+#endif // defined(STREAMINGCPU_X86)
+#if defined(STREAMINGCPU_AVX512)
+void RelightNodesAvx512(const RelightNodes& nodes);
+#endif // defined(STREAMINGCPU_AVX512)
+
+// Falls back to the best supported level below the one requested
+RelightFunction GetRelightFunction(SimdLevel level);
+
+struct RelightStats
+{
+    uint64_t tiles;
+    uint64_t nodes;             // nodes that cover a sample
+    uint64_t tileLights;        // sum of the list lengths
+    uint64_t lightEvaluations;  // nodes times the lights of their tile
+    uint64_t steals;            // tile ranges split between threads
+    double seconds;             // culling and shading
+    LightBinningStats binning;
+
+    RelightStats() : tiles(0), nodes(0), tileLights(0), lightEvaluations(0), steals(0), seconds(0.0) {}
+};
+
+class RelightEngine
+{
+public:
+    explicit RelightEngine(unsigned tileDim = COMPUTE_SHADER_TILE_GROUP_DIM);
+
+    // msaaSamples of 1 to 8, what the nodes were merged with. The source is
+    // read from several threads.
+    void Load(const GBufferSnapshotSource& source, unsigned width, unsigned height, unsigned msaaSamples,
+              const ViewConstants& view, ThreadPool* threadPool);
+
+    // Same for a snapshot, with the view of its camera. Returns false if a
+    // tile does not decode.
+    bool Load(const GBufferSnapshotReader& reader, ThreadPool* threadPool);
+
+    unsigned GetWidth() const { return mWidth; }
+    unsigned GetHeight() const { return mHeight; }
+    const ViewConstants& GetView() const { return mView; }
+
+    // Nodes that cover a sample
+    uint64_t GetNodeCount() const;
+
+    void Shade(const PointLight* lights, unsigned lightCount, SimdLevel level, ThreadPool* threadPool,
+               RelightStats& stats);
+
+    // RGB of every pixel after the last Shade(), row-major
+    const std::vector<float>& GetOutput() const { return mOutput; }
+
+private:
+    // Not implemented
+    RelightEngine(const RelightEngine&);
+    RelightEngine& operator=(const RelightEngine&);
+
+    struct Tile
+    {
+        unsigned x;                         // first pixel
+        unsigned y;
+        unsigned width;
+        unsigned height;
+        unsigned nodeCount;
+        unsigned paddedCount;
+        std::vector<float> planes;          // RELIGHT_PLANE_COUNT planes of paddedCount
+        std::vector<float> weights;         // samples each node covers
+        std::vector<unsigned short> pixels; // pixel of each node, row-major in the tile
+        std::vector<float> divisors;        // what FinishPixel divides each pixel by
+    };
+
+    struct Scratch
+    {
+        std::vector<float> lit;
+        std::vector<float> output;
+    };
+
+    void LoadTile(const GBufferSnapshotSource& source, Tile& tile, TileDepthBounds& bounds) const;
+    void ShadeTile(unsigned tileIndex, const PointLight* lights, RelightFunction function, Scratch& scratch,
+                   RelightStats& stats);
+
+    unsigned mTileDim;
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mMsaaSamples;
+    unsigned mTilesX;
+    ViewConstants mView;
+    std::vector<Tile> mTiles;
+    std::vector<TileDepthBounds> mTileBounds;   // StreamingLightCullCS bounds of the nodes in use
+    LightBins mBins;
+    std::vector<float> mOutput;
+};
+
+// The parts of a snapshot camera the resolve reads
+ViewConstants GetSnapshotViewConstants(const GBufferSnapshotHeader& header);
+
+// One Shade() result against another
+struct RelightError
+{
+    uint64_t pixels;
+    uint64_t differingPixels;   // any channel differs in any bit
+    double maxError;            // relative above 1, absolute below
+
+    RelightError() : pixels(0), differingPixels(0), maxError(0.0) {}
+};
+
+void CompareRelight(const std::vector<float>& output, const std::vector<float>& reference, RelightError& error);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_RELIGHT_H
@@ -0,0 +1,35 @@
+// See MergeKernelAvx2.cpp for why the includes come before the pragma.
+#include "Relight.h"
+
+#if defined(STREAMINGCPU_AVX512)
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "SimdLanesAvx512.h"
+#include "RelightKernelLanes.inl"
+
+namespace StreamingCpu {
+
+void RelightNodesAvx512(const RelightNodes& nodes)
+{
+    RelightKernelLanes<Avx512Lanes>::Relight(nodes);
+}
+
+} // namespace StreamingCpu
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // defined(STREAMINGCPU_AVX512)
@@ -0,0 +1,159 @@
+// Lane parallel version of RelightNodesScalar(). V is one of the *Lanes
+// structs (SimdLanesAvx2.h, SimdLanesAvx512.h). Included by the per-ISA
+// translation units after their target pragma, like MergeKernelLanes.inl.
+//
+// Each lane is a node, and the lights of the tile go over a group of nodes one
+// at a time, so every node adds up its lights in list order with the
+// operations of AccumulateBRDF(). Lanes that fail one of its branches keep
+// their sum through a select. powf() is the only function without a lane
+// version; Pow() below is exp2(y * log2(x)) with polynomials that stay within
+// a few float ulps of log2 and exp2.
+
+namespace StreamingCpu {
+
+template <typename V>
+struct RelightKernelLanes
+{
+    typedef typename V::Float Float;
+    typedef typename V::Int Int;
+    typedef typename V::Mask Mask;
+
+    static Float Dot3(Float ax, Float ay, Float az, Float bx, Float by, Float bz)
+    {
+        return V::Add(V::Add(V::Mul(ax, bx), V::Mul(ay, by)), V::Mul(az, bz));
+    }
+
+    // x > 0
+    static Float Log2(Float x)
+    {
+        const Int bits = V::AsInt(x);
+        Float exponent = V::IntToFloat(V::SubInt(V::ShiftRight23(bits), V::SplatInt(127)));
+        Float mantissa = V::AsFloat(V::Or(V::And(bits, V::SplatInt(0x007FFFFF)), V::SplatInt(0x3F800000)));
+
+        // Mantissa in [sqrt(0.5), sqrt(2)) keeps the series short
+        const Mask high = V::GreaterMask(mantissa, V::Splat(1.41421356f));
+        mantissa = V::Select(high, V::Mul(mantissa, V::Splat(0.5f)), mantissa);
+        exponent = V::Select(high, V::Add(exponent, V::Splat(1.0f)), exponent);
+
+        // ln(m) = 2 atanh((m - 1) / (m + 1))
+        const Float t = V::Div(V::Sub(mantissa, V::Splat(1.0f)), V::Add(mantissa, V::Splat(1.0f)));
+        const Float t2 = V::Mul(t, t);
+        Float series = V::Splat(1.0f / 9.0f);
+        series = V::Add(V::Mul(series, t2), V::Splat(1.0f / 7.0f));
+        series = V::Add(V::Mul(series, t2), V::Splat(1.0f / 5.0f));
+        series = V::Add(V::Mul(series, t2), V::Splat(1.0f / 3.0f));
+        series = V::Add(V::Mul(series, t2), V::Splat(1.0f));
+        const Float ln = V::Mul(V::Mul(series, t), V::Splat(2.0f));
+        return V::Add(exponent, V::Mul(ln, V::Splat(1.44269504f)));
+    }
+
+    static Float Exp2(Float y)
+    {
+        const Float clamped = V::Min(V::Max(y, V::Splat(-127.0f)), V::Splat(127.0f));
+        const Float whole = V::Floor(clamped);
+        const Float f = V::Sub(clamped, whole);
+
+        // Taylor series of 2^f on [0, 1)
+        Float p = V::Splat(1.321548e-6f);
+        p = V::Add(V::Mul(p, f), V::Splat(1.525273e-5f));
+        p = V::Add(V::Mul(p, f), V::Splat(1.540353e-4f));
+        p = V::Add(V::Mul(p, f), V::Splat(1.333356e-3f));
+        p = V::Add(V::Mul(p, f), V::Splat(9.618129e-3f));
+        p = V::Add(V::Mul(p, f), V::Splat(5.550411e-2f));
+        p = V::Add(V::Mul(p, f), V::Splat(0.2402265f));
+        p = V::Add(V::Mul(p, f), V::Splat(0.6931472f));
+        p = V::Add(V::Mul(p, f), V::Splat(1.0f));
+
+        // Scale by 2^whole in the exponent field, flushing what would be denormal
+        const Float scaled = V::AsFloat(V::AddInt(V::AsInt(p), V::ShiftLeft23(V::FloatToInt(whole))));
+        return V::Select(V::LessMask(clamped, V::Splat(-126.0f)), V::Splat(0.0f), scaled);
+    }
+
+    // powf for x >= 0
+    static Float Pow(Float x, Float y)
+    {
+        const Float zero = V::Splat(0.0f);
+        const Float atZero = V::Select(V::GreaterMask(y, zero), zero, V::Splat(1.0f));
+        const Float positive = V::Max(x, V::Splat(1.17549435e-38f));
+        return V::Select(V::GreaterMask(x, zero), Exp2(V::Mul(y, Log2(positive))), atZero);
+    }
+
+    static void Relight(const RelightNodes& nodes)
+    {
+        const unsigned count = nodes.count;
+        const Float zero = V::Splat(0.0f);
+        const Float one = V::Splat(1.0f);
+        for (unsigned i = 0; i < count; i += V::kWidth) {
+            const float* planes = nodes.planes + i;
+            const Float px = V::LoadFloat(planes + RELIGHT_PLANE_POSITION_X * count);
+            const Float py = V::LoadFloat(planes + RELIGHT_PLANE_POSITION_Y * count);
+            const Float pz = V::LoadFloat(planes + RELIGHT_PLANE_POSITION_Z * count);
+            const Float nx = V::LoadFloat(planes + RELIGHT_PLANE_NORMAL_X * count);
+            const Float ny = V::LoadFloat(planes + RELIGHT_PLANE_NORMAL_Y * count);
+            const Float nz = V::LoadFloat(planes + RELIGHT_PLANE_NORMAL_Z * count);
+            const Float albedo[3] = {
+                V::LoadFloat(planes + RELIGHT_PLANE_ALBEDO_R * count),
+                V::LoadFloat(planes + RELIGHT_PLANE_ALBEDO_G * count),
+                V::LoadFloat(planes + RELIGHT_PLANE_ALBEDO_B * count)
+            };
+            const Float specularAmount = V::LoadFloat(planes + RELIGHT_PLANE_SPECULAR_AMOUNT * count);
+            const Float specularPower = V::LoadFloat(planes + RELIGHT_PLANE_SPECULAR_POWER * count);
+
+            // The same for every light, so it is hoisted out of AccumulateBRDF
+            const Float rcpLength = V::Div(one, V::Sqrt(Dot3(px, py, pz, px, py, pz)));
+            const Float vx = V::Mul(px, rcpLength);
+            const Float vy = V::Mul(py, rcpLength);
+            const Float vz = V::Mul(pz, rcpLength);
+
+            const Mask inFrustum = V::LessMask(pz, V::Splat(nodes.farZ));
+            Float lit[3] = { zero, zero, zero };
+            for (unsigned l = 0; l < nodes.lightCount && V::MaskBits(inFrustum); ++l) {
+                const PointLight& light = nodes.lights[nodes.lightIndices[l]];
+                Float dx = V::Sub(V::Splat(light.positionView[0]), px);
+                Float dy = V::Sub(V::Splat(light.positionView[1]), py);
+                Float dz = V::Sub(V::Splat(light.positionView[2]), pz);
+                const Float distance = V::Sqrt(Dot3(dx, dy, dz, dx, dy, dz));
+                const Float end = V::Splat(light.attenuationEnd);
+                Mask mask = V::AndMask(inFrustum, V::LessMask(distance, end));
+                if (!V::MaskBits(mask)) {
+                    continue;
+                }
+
+                Float attenuation = V::Div(V::Sub(distance, end), V::Splat(light.attenuationBegin - light.attenuationEnd));
+                attenuation = V::Min(one, V::Max(zero, attenuation));
+                const Float rcpDistance = V::Div(one, distance);
+                dx = V::Mul(dx, rcpDistance);
+                dy = V::Mul(dy, rcpDistance);
+                dz = V::Mul(dz, rcpDistance);
+
+                // AccumulatePhongBRDF
+                const Float NdotL = Dot3(nx, ny, nz, dx, dy, dz);
+                mask = V::AndMask(mask, V::GreaterMask(NdotL, zero));
+                if (!V::MaskBits(mask)) {
+                    continue;
+                }
+                const Float twoNdotL = V::Mul(V::Splat(2.0f), NdotL);
+                const Float rx = V::Sub(dx, V::Mul(twoNdotL, nx));
+                const Float ry = V::Sub(dy, V::Mul(twoNdotL, ny));
+                const Float rz = V::Sub(dz, V::Mul(twoNdotL, nz));
+                const Float RdotV = V::Max(Dot3(rx, ry, rz, vx, vy, vz), zero);
+                const Float specular = Pow(RdotV, specularPower);
+
+                for (unsigned c = 0; c < 3; ++c) {
+                    const Float lightContrib = V::Mul(attenuation, V::Splat(light.color[c]));
+                    const Float litDiffuse = V::Mul(lightContrib, NdotL);
+                    const Float litSpecular = V::Mul(lightContrib, specular);
+                    const Float brdf = V::Mul(albedo[c], V::Add(litDiffuse, V::Mul(specularAmount, litSpecular)));
+                    lit[c] = V::Select(mask, V::Add(lit[c], brdf), lit[c]);
+                }
+            }
+
+            for (unsigned c = 0; c < 3; ++c) {
+                V::StoreFloat(nodes.lit[c] + i, lit[c]);
+            }
+        }
+        V::End();
+    }
+};
+
+} // namespace StreamingCpu
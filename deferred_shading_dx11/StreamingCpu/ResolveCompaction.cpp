@@ -0,0 +1,129 @@
+#include "ResolveCompaction.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+namespace StreamingCpu {
+
+ComplexPixelList::ComplexPixelList()
+{
+    for (unsigned i = 0; i < STREAMING_COMPLEX_ARGS_COUNT; ++i) {
+        mArgs[i] = 0;
+    }
+}
+
+void ComplexPixelList::Build(const MergeBuffers& buffers, ThreadPool* threadPool)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+
+    // Rows in parallel, then joined in order
+    mRows.resize(height);
+    threadPool->ParallelFor(height, 16, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned y = begin; y < end; ++y) {
+            std::vector<unsigned>& row = mRows[y];
+            row.clear();
+            for (unsigned x = 0; x < width; ++x) {
+                if (buffers.GetNodeCount(x, y) > 1) {
+                    row.push_back(PackPixelCoords(x, y));
+                }
+            }
+        }
+    });
+
+    mPixels.clear();
+    for (unsigned y = 0; y < height; ++y) {
+        mPixels.insert(mPixels.end(), mRows[y].begin(), mRows[y].end());
+    }
+
+    // Same counting as StreamingResolveSimplePS, starting from the values
+    // the app resets the buffer to
+    const unsigned initialArgs[STREAMING_COMPLEX_ARGS_COUNT] = {0, 1, 0, 0, 0, 1, 1};
+    for (unsigned i = 0; i < STREAMING_COMPLEX_ARGS_COUNT; ++i) {
+        mArgs[i] = initialArgs[i];
+    }
+    for (size_t i = 0; i < mPixels.size(); ++i) {
+        unsigned index = mArgs[STREAMING_COMPLEX_ARGS_VERTEX_COUNT]++;
+        if ((index % STREAMING_COMPLEX_PIXEL_GROUP_SIZE) == 0) {
+            mArgs[STREAMING_COMPLEX_ARGS_GROUPS_X]++;
+        }
+    }
+}
+
+ResolveCompactionStats::ResolveCompactionStats()
+    : frames(0), pixels(0), coveredPixels(0), complexPixels(0), complexNodes(0), complexGroups(0)
+    , idleThreads(0), mismatchedFrames(0), blocks(0), complexBlocks(0), waitingPixels(0)
+    , minComplexFraction(1.0), maxComplexFraction(0.0), buildSeconds(0.0)
+{
+}
+
+void ResolveCompactionStats::Add(const ResolveCompactionStats& other)
+{
+    frames += other.frames;
+    pixels += other.pixels;
+    coveredPixels += other.coveredPixels;
+    complexPixels += other.complexPixels;
+    complexNodes += other.complexNodes;
+    complexGroups += other.complexGroups;
+    idleThreads += other.idleThreads;
+    mismatchedFrames += other.mismatchedFrames;
+    blocks += other.blocks;
+    complexBlocks += other.complexBlocks;
+    waitingPixels += other.waitingPixels;
+    minComplexFraction = other.minComplexFraction < minComplexFraction ? other.minComplexFraction : minComplexFraction;
+    maxComplexFraction = other.maxComplexFraction > maxComplexFraction ? other.maxComplexFraction : maxComplexFraction;
+    buildSeconds += other.buildSeconds;
+}
+
+void GatherResolveCompaction(const MergeBuffers& buffers, unsigned blockDim, ComplexPixelList& list,
+                             ThreadPool* threadPool, ResolveCompactionStats& stats)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+
+    ResolveCompactionStats frame;
+    Timer timer;
+    list.Build(buffers, threadPool);
+    frame.buildSeconds = timer.GetSeconds();
+
+    frame.frames = 1;
+    frame.pixels = (uint64_t)width * height;
+    for (unsigned blockY = 0; blockY < height; blockY += blockDim) {
+        for (unsigned blockX = 0; blockX < width; blockX += blockDim) {
+            uint64_t blockPixels = 0;
+            uint64_t blockComplexPixels = 0;
+            for (unsigned y = blockY; y < blockY + blockDim && y < height; ++y) {
+                for (unsigned x = blockX; x < blockX + blockDim && x < width; ++x) {
+                    unsigned nodeCount = buffers.GetNodeCount(x, y);
+                    frame.coveredPixels += nodeCount > 0 ? 1 : 0;
+                    if (nodeCount > 1) {
+                        blockComplexPixels++;
+                        frame.complexNodes += nodeCount;
+                    }
+                    blockPixels++;
+                }
+            }
+            frame.blocks++;
+            frame.complexPixels += blockComplexPixels;
+            if (blockComplexPixels > 0) {
+                frame.complexBlocks++;
+                frame.waitingPixels += blockPixels - blockComplexPixels;
+            }
+        }
+    }
+
+    const unsigned* args = list.GetArgs();
+    frame.complexGroups = args[STREAMING_COMPLEX_ARGS_GROUPS_X];
+    frame.idleThreads = frame.complexGroups * STREAMING_COMPLEX_PIXEL_GROUP_SIZE - frame.complexPixels;
+    frame.minComplexFraction = frame.GetComplexFraction();
+    frame.maxComplexFraction = frame.minComplexFraction;
+
+    const uint64_t groups = (frame.complexPixels + STREAMING_COMPLEX_PIXEL_GROUP_SIZE - 1) /
+                            STREAMING_COMPLEX_PIXEL_GROUP_SIZE;
+    bool argsMatch = list.GetPixels().size() == frame.complexPixels &&
+                     args[STREAMING_COMPLEX_ARGS_VERTEX_COUNT] == frame.complexPixels &&
+                     args[STREAMING_COMPLEX_ARGS_GROUPS_X] == groups;
+    frame.mismatchedFrames = argsMatch ? 0 : 1;
+    stats.Add(frame);
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,73 @@
+#ifndef STREAMINGCPU_RESOLVECOMPACTION_H
+#define STREAMINGCPU_RESOLVECOMPACTION_H
+
+// CPU reference of the first pass of the compacted resolve: the complex pixel
+// list StreamingResolveSimplePS appends to and the indirect arguments it
+// counts up for StreamingResolveComplexCS and StreamingComplexPixelVS.
+
+#include "MergeBuffers.h"
+#include <stdint.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+// The GPU appends pixels in whatever order they finish, the list here is in
+// scanline order. Compare it as a set.
+class ComplexPixelList
+{
+public:
+    ComplexPixelList();
+
+    // Pixels with more than one node, as StreamingResolveSimplePS finds them
+    void Build(const MergeBuffers& buffers, ThreadPool* threadPool);
+
+    // PackPixelCoords of each complex pixel
+    const std::vector<unsigned>& GetPixels() const { return mPixels; }
+
+    // The argument buffer after the first pass, see STREAMING_COMPLEX_ARGS_COUNT
+    const unsigned* GetArgs() const { return mArgs; }
+
+private:
+    std::vector<std::vector<unsigned> > mRows;
+    std::vector<unsigned> mPixels;
+    unsigned mArgs[STREAMING_COMPLEX_ARGS_COUNT];
+};
+
+struct ResolveCompactionStats
+{
+    uint64_t frames;
+    uint64_t pixels;
+    uint64_t coveredPixels;     // at least one node
+    uint64_t complexPixels;     // more than one node, left to StreamingResolveComplexCS
+    uint64_t complexNodes;
+    uint64_t complexGroups;     // thread groups of the indirect dispatch
+    uint64_t idleThreads;       // threads of those groups past the end of the list
+    uint64_t mismatchedFrames;  // frames whose counted arguments do not describe the list
+
+    // The single pass resolve in blockDim x blockDim blocks, about the pixels
+    // one pixel shader thread covers. Simple pixels in a block with a complex
+    // pixel wait on its ResolveSurfaceWeights.
+    uint64_t blocks;
+    uint64_t complexBlocks;     // blocks with at least one complex pixel
+    uint64_t waitingPixels;     // simple pixels in those blocks
+
+    double minComplexFraction;  // of the pixels of one frame
+    double maxComplexFraction;
+    double buildSeconds;
+
+    ResolveCompactionStats();
+
+    double GetComplexFraction() const { return pixels ? (double)complexPixels / pixels : 0.0; }
+
+    void Add(const ResolveCompactionStats& other);
+};
+
+// Builds the list for one frame and adds it to stats
+void GatherResolveCompaction(const MergeBuffers& buffers, unsigned blockDim, ComplexPixelList& list,
+                             ThreadPool* threadPool, ResolveCompactionStats& stats);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_RESOLVECOMPACTION_H
@@ -0,0 +1,350 @@
+#include "ResolveWeights.h"
+#include "FormatConvertSimd.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "UintByteArray.h"
+#include "../Shaders/SamplePositions.hlsl"
+#include <string.h>
+#include <vector>
+
+namespace StreamingCpu {
+
+const float (*GetSampleOffsets(unsigned msaaSamples))[2]
+{
+    switch (msaaSamples) {
+        case 1: return g1SampleOffsets;
+        case 2: return g2SampleOffsets;
+        case 4: return g4SampleOffsets;
+        case 8: return g8SampleOffsets;
+        case 16: return g16SampleOffsets;
+        case 32: return g32SampleOffsets;
+        default: return 0;
+    }
+}
+
+// EstimateDepthAtSample
+static inline float EstimateDepthAtSample(const ResolveSurface& surface, const float offset[2])
+{
+    return surface.zView + (surface.zViewDerivatives[0] * offset[0]) + (surface.zViewDerivatives[1] * offset[1]);
+}
+
+// GetDepthRange
+static void GetDepthRange(const ResolveSurface& surface, float& start, float& end)
+{
+    const float dx = surface.zViewDerivatives[0];
+    const float dy = surface.zViewDerivatives[1];
+    start = surface.zView + (dx < 0 ? dx : -dx);
+    start = start + (dy < 0 ? dy : -dy);
+    end = surface.zView + (dx > 0 ? dx : -dx);
+    end = end + (dy > 0 ? dy : -dy);
+}
+
+unsigned ResolveSurfaceWeightsPerSample(const ResolveSurface* surfaces, unsigned count, unsigned msaaSamples,
+                                        unsigned* weights)
+{
+    const float (*offsets)[2] = GetSampleOffsets(msaaSamples);
+    unsigned weightSum = 0;
+    for (unsigned j = 0; j < count; ++j) {
+        weights[j] = 0;
+    }
+    for (unsigned i = 0; i < msaaSamples; ++i) {
+        float closestDepth = 10000.0f;
+        unsigned closest = count;
+        for (unsigned j = 0; j < count; ++j) {
+            if (surfaces[j].depthTestedCoverage & (1u << i)) {
+                float sampleDepth = EstimateDepthAtSample(surfaces[j], offsets[i]);
+                if (closestDepth > sampleDepth) {
+                    closestDepth = sampleDepth;
+                    closest = j;
+                }
+            }
+        }
+        if (closest < count) {
+            weights[closest]++;
+            weightSum++;
+        }
+    }
+    return weightSum;
+}
+
+// GetVisibleSamples
+static unsigned GetVisibleSamples(const ResolveSurface& surface, const float (*offsets)[2], unsigned msaaSamples)
+{
+    unsigned visible = surface.depthTestedCoverage;
+    float start, end;
+    GetDepthRange(surface, start, end);
+    if (!(end < 10000.0f)) {
+        unsigned inFront = 0;
+        for (unsigned i = 0; i < msaaSamples; ++i) {
+            inFront |= EstimateDepthAtSample(surface, offsets[i]) < 10000.0f ? (1u << i) : 0;
+        }
+        visible &= inFront;
+    }
+    return visible;
+}
+
+// GetCloserSamples. perSample tells whether the depth ranges left it to the
+// per-sample test.
+static unsigned GetCloserSamples(const ResolveSurface& a, const ResolveSurface& b, unsigned samples,
+                                 const float (*offsets)[2], unsigned msaaSamples, bool& perSample)
+{
+    float aStart, aEnd, bStart, bEnd;
+    GetDepthRange(a, aStart, aEnd);
+    GetDepthRange(b, bStart, bEnd);
+
+    unsigned closer = 0;
+    perSample = false;
+    if (aEnd < bStart) {
+        closer = samples;
+    } else if (!(bEnd < aStart)) {
+        perSample = true;
+        for (unsigned i = 0; i < msaaSamples; ++i) {
+            closer |= EstimateDepthAtSample(a, offsets[i]) <= EstimateDepthAtSample(b, offsets[i]) ? (1u << i) : 0;
+        }
+    }
+    return closer & samples;
+}
+
+static unsigned ResolveSurfaceWeightsPairwise(const ResolveSurface* surfaces, unsigned count, unsigned msaaSamples,
+                                              unsigned* weights, ResolveWeightsStats* stats)
+{
+    const float (*offsets)[2] = GetSampleOffsets(msaaSamples);
+    unsigned visible[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+    for (unsigned j = 0; j < count; ++j) {
+        visible[j] = GetVisibleSamples(surfaces[j], offsets, msaaSamples);
+    }
+
+    for (unsigned a = 0; a < count; ++a) {
+        for (unsigned b = a + 1; b < count; ++b) {
+            unsigned shared = visible[a] & visible[b];
+            if (shared != 0) {
+                bool perSample;
+                unsigned aCloser = GetCloserSamples(surfaces[a], surfaces[b], shared, offsets, msaaSamples, perSample);
+                visible[a] &= ~(shared & ~aCloser);
+                visible[b] &= ~aCloser;
+                if (stats) {
+                    stats->sharedPairs++;
+                    stats->perSamplePairs += perSample ? 1 : 0;
+                }
+            }
+        }
+    }
+
+    unsigned weightSum = 0;
+    for (unsigned j = 0; j < count; ++j) {
+        weights[j] = CountBits(visible[j]);
+        weightSum += weights[j];
+    }
+    return weightSum;
+}
+
+unsigned ResolveSurfaceWeightsPairwise(const ResolveSurface* surfaces, unsigned count, unsigned msaaSamples,
+                                       unsigned* weights)
+{
+    return ResolveSurfaceWeightsPairwise(surfaces, count, msaaSamples, weights, 0);
+}
+
+ResolveWeightsStats::ResolveWeightsStats()
+    : pixels(0), surfaces(0), samples(0), sharedPairs(0), perSamplePairs(0), mismatches(0)
+    , perSampleSeconds(0.0), pairwiseSeconds(0.0)
+{
+}
+
+void ResolveWeightsStats::Add(const ResolveWeightsStats& other)
+{
+    pixels += other.pixels;
+    surfaces += other.surfaces;
+    samples += other.samples;
+    sharedPairs += other.sharedPairs;
+    perSamplePairs += other.perSamplePairs;
+    mismatches += other.mismatches;
+    perSampleSeconds += other.perSampleSeconds;
+    pairwiseSeconds += other.pairwiseSeconds;
+}
+
+// Resolves the pixels count surfaces at a time both ways, timing each
+static void CompareSurfaces(const std::vector<ResolveSurface>& surfaces, unsigned count, unsigned msaaSamples,
+                            ResolveWeightsStats& stats)
+{
+    const size_t pixels = surfaces.size() / count;
+    std::vector<unsigned> perSample(surfaces.size());
+    std::vector<unsigned> pairwise(surfaces.size());
+
+    Timer timer;
+    for (size_t p = 0; p < pixels; ++p) {
+        ResolveSurfaceWeightsPerSample(&surfaces[p * count], count, msaaSamples, &perSample[p * count]);
+    }
+    stats.perSampleSeconds += timer.GetSeconds();
+
+    timer.Reset();
+    for (size_t p = 0; p < pixels; ++p) {
+        stats.samples += ResolveSurfaceWeightsPairwise(&surfaces[p * count], count, msaaSamples,
+                                                       &pairwise[p * count], &stats);
+    }
+    stats.pairwiseSeconds += timer.GetSeconds();
+
+    stats.pixels += pixels;
+    stats.surfaces += surfaces.size();
+    for (size_t p = 0; p < pixels; ++p) {
+        bool match = true;
+        for (unsigned j = 0; j < count; ++j) {
+            match = match && perSample[p * count + j] == pairwise[p * count + j];
+        }
+        stats.mismatches += match ? 0 : 1;
+    }
+}
+
+void CompareResolveWeights(const MergeBuffers& buffers, unsigned msaaSamples, ThreadPool* threadPool,
+                           ResolveWeightsStats& stats)
+{
+    const unsigned width = buffers.GetWidth();
+    const unsigned height = buffers.GetHeight();
+    const unsigned indexBits = buffers.GetSurfacesPerPixel() < 4 ? 2 : 3;
+    const unsigned indexMask = (1u << indexBits) - 1;
+
+    // Surfaces of the pixels with a given node count, in list order
+    std::vector<std::vector<ResolveSurface> > surfaces(STREAMING_SURFACES_PER_PIXEL_MAX_CPU + 1);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            const unsigned nodeCount = buffers.GetNodeCount(x, y);
+            if (nodeCount < 2) {
+                continue;
+            }
+            const unsigned nodeList = buffers.GetListTexture()[buffers.GetNodeCountIndex(x, y)];
+            for (unsigned j = 0; j < nodeCount; ++j) {
+                unsigned index = (nodeList >> (j * indexBits)) & indexMask;
+                MergeNode merge = UnpackMergeNode(buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, index)]);
+                ResolveSurface surface;
+                surface.depthTestedCoverage = GetDepthTestedCoverage(merge);
+                surface.zView = merge.zView;
+                surface.zViewDerivatives[0] = merge.zViewDerivatives[0];
+                surface.zViewDerivatives[1] = merge.zViewDerivatives[1];
+                surfaces[nodeCount].push_back(surface);
+            }
+        }
+    }
+
+    // One node count per task
+    std::vector<ResolveWeightsStats> countStats(surfaces.size());
+    threadPool->ParallelFor((unsigned)surfaces.size(), 1, [&](unsigned begin, unsigned end, unsigned) {
+        for (unsigned count = begin; count < end; ++count) {
+            if (!surfaces[count].empty()) {
+                CompareSurfaces(surfaces[count], count, msaaSamples, countStats[count]);
+            }
+        }
+    });
+    for (size_t i = 0; i < countStats.size(); ++i) {
+        stats.Add(countStats[i]);
+    }
+}
+
+static float NextFloat(uint32_t& state, float low, float high)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return low + (high - low) * ((state >> 8) * (1.0f / 16777216.0f));
+}
+
+void CompareRandomResolveWeights(unsigned msaaSamples, unsigned surfacesPerPixel, unsigned pixelCount,
+                                 unsigned seed, ResolveWeightsStats& stats)
+{
+    const unsigned sampleMask = msaaSamples < 32 ? (1u << msaaSamples) - 1 : 0xFFFFFFFFu;
+    uint32_t state = seed * 2654435761u + msaaSamples;
+    state = state ? state : 1;
+
+    // Surfaces around the same depth with slopes that make them cross inside
+    // the pixel, some pushed against the skybox depth
+    std::vector<ResolveSurface> surfaces((size_t)pixelCount * surfacesPerPixel);
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+        ResolveSurface& surface = surfaces[i];
+        uint32_t coverage = (uint32_t)(NextFloat(state, 0.0f, 65536.0f)) << 16 |
+                            (uint32_t)(NextFloat(state, 0.0f, 65536.0f));
+        surface.depthTestedCoverage = coverage & sampleMask;
+        surface.zView = NextFloat(state, 0.0f, 1.0f) < 0.05f ? NextFloat(state, 9999.0f, 10001.0f)
+                                                              : NextFloat(state, 10.0f, 11.0f);
+        surface.zViewDerivatives[0] = NextFloat(state, -2.0f, 2.0f);
+        surface.zViewDerivatives[1] = NextFloat(state, -2.0f, 2.0f);
+    }
+    CompareSurfaces(surfaces, surfacesPerPixel, msaaSamples, stats);
+}
+
+unsigned GetResolvedNodes(const MergeBuffers& buffers, unsigned x, unsigned y, unsigned msaaSamples,
+                          MergeNodePacked* nodes, unsigned* weights)
+{
+    const unsigned indexBits = buffers.GetSurfacesPerPixel() < 4 ? 2 : 3;
+    const unsigned indexMask = (1u << indexBits) - 1;
+    const unsigned nodeCount = buffers.GetNodeCount(x, y);
+    const unsigned nodeList = buffers.GetListTexture()[buffers.GetNodeCountIndex(x, y)];
+
+    ResolveSurface surfaces[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {};
+    MergeNodePacked listed[STREAMING_SURFACES_PER_PIXEL_MAX_CPU] = {};
+    for (unsigned i = 0; i < nodeCount; ++i) {
+        unsigned index = (nodeList >> (i * indexBits)) & indexMask;
+        listed[i] = buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, index)];
+    }
+    MergeNode merged[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+    UnpackMergeNodes(listed, nodeCount, merged);
+    for (unsigned i = 0; i < nodeCount; ++i) {
+        surfaces[i].depthTestedCoverage = GetDepthTestedCoverage(merged[i]);
+        surfaces[i].zView = merged[i].zView;
+        surfaces[i].zViewDerivatives[0] = merged[i].zViewDerivatives[0];
+        surfaces[i].zViewDerivatives[1] = merged[i].zViewDerivatives[1];
+    }
+
+    unsigned listedWeights[STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+    ResolveSurfaceWeightsPerSample(surfaces, nodeCount, msaaSamples, listedWeights);
+    unsigned visible = 0;
+    for (unsigned i = 0; i < nodeCount; ++i) {
+        if (listedWeights[i] > 0) {
+            nodes[visible] = listed[i];
+            weights[visible++] = listedWeights[i];
+        }
+    }
+    return visible;
+}
+
+void CheckMergedBuffers(const MergeBuffers& buffers, const MergeBuffers& reference, unsigned msaaSamples,
+                        MergedBuffersCheck& check)
+{
+    const unsigned indexBits = reference.GetSurfacesPerPixel() < 4 ? 2 : 3;
+    const unsigned indexMask = (1u << indexBits) - 1;
+
+    for (unsigned y = 0; y < reference.GetHeight(); ++y) {
+        for (unsigned x = 0; x < reference.GetWidth(); ++x) {
+            const unsigned nodeCount = buffers.GetNodeCount(x, y);
+            const unsigned nodeList = buffers.GetListTexture()[buffers.GetNodeCountIndex(x, y)];
+            const unsigned referenceList = reference.GetListTexture()[reference.GetNodeCountIndex(x, y)];
+
+            bool matches = nodeCount == reference.GetNodeCount(x, y) &&
+                           buffers.GetDiscardedSamples(x, y) == reference.GetDiscardedSamples(x, y);
+            for (unsigned i = 0; i < nodeCount && matches; ++i) {
+                unsigned index = (nodeList >> (i * indexBits)) & indexMask;
+                unsigned referenceIndex = (referenceList >> (i * indexBits)) & indexMask;
+                matches = memcmp(&buffers.GetMergeBuffer()[buffers.GetNodeIndex(x, y, index)],
+                                 &reference.GetMergeBuffer()[reference.GetNodeIndex(x, y, referenceIndex)],
+                                 sizeof(MergeNodePacked)) == 0;
+            }
+            check.pixels++;
+            if (matches) {
+                continue;
+            }
+            check.differingPixels++;
+
+            MergeNodePacked nodes[2][STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+            unsigned weights[2][STREAMING_SURFACES_PER_PIXEL_MAX_CPU];
+            unsigned visible = GetResolvedNodes(buffers, x, y, msaaSamples, nodes[0], weights[0]);
+            bool resolveMatches = visible == GetResolvedNodes(reference, x, y, msaaSamples, nodes[1], weights[1]);
+            for (unsigned i = 0; i < visible && resolveMatches; ++i) {
+                // The resolve only sees the depth tested coverage through the weights
+                SetByteInUint(nodes[0][i].coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, 0);
+                SetByteInUint(nodes[1][i].coverage, MERGENODE_DEPTHTESTEDCOVERAGE_BYTE, 0);
+                resolveMatches = weights[0][i] == weights[1][i] &&
+                                 memcmp(&nodes[0][i], &nodes[1][i], sizeof(MergeNodePacked)) == 0;
+            }
+            check.resolveDiffers += resolveMatches ? 0 : 1;
+        }
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,85 @@
+#ifndef STREAMINGCPU_RESOLVEWEIGHTS_H
+#define STREAMINGCPU_RESOLVEWEIGHTS_H
+
+// CPU reference of ResolveSurfaceWeights from DepthTests.hlsl. The shader
+// used to track the closest depth of every sample; it now has each pair of
+// surfaces remove their losing samples from coverage masks, which is what
+// lets STREAMING_WIDE_COVERAGE go to 16 and 32 samples. Both versions are
+// kept here so they can be compared sample for sample.
+
+#include "MergeBuffers.h"
+#include <stdint.h>
+
+namespace StreamingCpu {
+
+class ThreadPool;
+
+// The parts of a merge node the weights depend on
+struct ResolveSurface
+{
+    unsigned depthTestedCoverage;
+    float zView;
+    float zViewDerivatives[2];
+};
+
+// Offsets of SamplePositions.hlsl for 1, 2, 4, 8, 16 or 32 samples, 0 for
+// other counts
+const float (*GetSampleOffsets(unsigned msaaSamples))[2];
+
+// Samples covered by each of count surfaces, in list order. The weight sum
+// is returned. Ties go to the surface earlier in the list, depths at or
+// behind 10000 go to the skybox.
+unsigned ResolveSurfaceWeightsPerSample(const ResolveSurface* surfaces, unsigned count, unsigned msaaSamples,
+                                        unsigned* weights);
+unsigned ResolveSurfaceWeightsPairwise(const ResolveSurface* surfaces, unsigned count, unsigned msaaSamples,
+                                       unsigned* weights);
+
+struct ResolveWeightsStats
+{
+    uint64_t pixels;            // pixels resolved with more than one surface
+    uint64_t surfaces;
+    uint64_t samples;           // weight sum
+    uint64_t sharedPairs;       // surface pairs with a sample in common
+    uint64_t perSamplePairs;    // of those, the ones the depth ranges do not decide
+    uint64_t mismatches;        // pixels whose weights differ in any surface
+    double perSampleSeconds;
+    double pairwiseSeconds;
+
+    ResolveWeightsStats();
+
+    void Add(const ResolveWeightsStats& other);
+};
+
+// Resolves every pixel of buffers with more than one node both ways.
+// msaaSamples is what the buffers were merged with.
+void CompareResolveWeights(const MergeBuffers& buffers, unsigned msaaSamples, ThreadPool* threadPool,
+                           ResolveWeightsStats& stats);
+
+// Same on pixelCount random pixels of interpenetrating surfaces, for sample
+// counts the CPU merge does not produce
+void CompareRandomResolveWeights(unsigned msaaSamples, unsigned surfacesPerPixel, unsigned pixelCount,
+                                 unsigned seed, ResolveWeightsStats& stats);
+
+// Visible nodes of a pixel in list order with their sample weights, which
+// leave the skybox the rest of msaaSamples. Returns the node count.
+unsigned GetResolvedNodes(const MergeBuffers& buffers, unsigned x, unsigned y, unsigned msaaSamples,
+                          MergeNodePacked* nodes, unsigned* weights);
+
+// Buffers merged with a shortcut against the same frame merged without it
+struct MergedBuffersCheck
+{
+    uint64_t pixels;
+    uint64_t differingPixels;   // count, discard bit or a node in list order differs
+    uint64_t resolveDiffers;    // the visible nodes (but for their depth tested
+                                // coverage) or their sample weights differ
+
+    MergedBuffersCheck() : pixels(0), differingPixels(0), resolveDiffers(0) {}
+};
+
+// Both with the same size and surfacesPerPixel, merged with msaaSamples
+void CheckMergedBuffers(const MergeBuffers& buffers, const MergeBuffers& reference, unsigned msaaSamples,
+                        MergedBuffersCheck& check);
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_RESOLVEWEIGHTS_H
@@ -0,0 +1,99 @@
+#ifndef STREAMINGCPU_SIMDLANESAVX2_H
+#define STREAMINGCPU_SIMDLANESAVX2_H
+
+// 8 wide lane operations for MergeKernelLanes.inl. Only include this from a
+// translation unit compiled for AVX2 and F16C (see MergeKernelAvx2.cpp). Comparisons
+// return lane bitmasks and use ordered predicates like the scalar C++ code.
+
+#include <immintrin.h>
+
+namespace StreamingCpu {
+
+struct Avx2Lanes
+{
+    enum { kWidth = 8 };
+    typedef __m256 Float;
+    typedef __m256i Int;
+    typedef __m256 Mask;
+
+    static Float LoadFloat(const float* p) { return _mm256_loadu_ps(p); }
+    static Int LoadInt(const unsigned* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void StoreInt(unsigned* p, Int v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static void StoreFloat(float* p, Float v) { _mm256_storeu_ps(p, v); }
+    static Int Gather(const unsigned* base, Int offsets) { return _mm256_i32gather_epi32((const int*)base, offsets, 4); }
+    static Float Splat(float v) { return _mm256_set1_ps(v); }
+    static Int SplatInt(unsigned v) { return _mm256_set1_epi32((int)v); }
+    static Int LaneIndices() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float Sqrt(Float a) { return _mm256_sqrt_ps(a); }
+    static Float Min(Float a, Float b) { return _mm256_min_ps(a, b); }
+    static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    static Float Abs(Float a) { return _mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF))); }
+    static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float Floor(Float a) { return _mm256_floor_ps(a); }
+
+    static unsigned Less(Float a, Float b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+    static unsigned LessEqual(Float a, Float b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+    static unsigned Greater(Float a, Float b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+    static unsigned GreaterEqual(Float a, Float b) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+
+    static Int And(Int a, Int b) { return _mm256_and_si256(a, b); }
+    static Int Or(Int a, Int b) { return _mm256_or_si256(a, b); }
+    static Int Xor(Int a, Int b) { return _mm256_xor_si256(a, b); }
+    static Int ShiftRight8(Int a) { return _mm256_srli_epi32(a, 8); }
+    static Int ShiftRight16(Int a) { return _mm256_srli_epi32(a, 16); }
+    static Int ShiftLeft8(Int a) { return _mm256_slli_epi32(a, 8); }
+    static Int ShiftLeft16(Int a) { return _mm256_slli_epi32(a, 16); }
+    static Int ShiftLeft24(Int a) { return _mm256_slli_epi32(a, 24); }
+    static Int MinInt(Int a, Int b) { return _mm256_min_epu32(a, b); }
+    static Int MulInt(Int a, Int b) { return _mm256_mullo_epi32(a, b); }
+    static unsigned Equal(Int a, Int b) { return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))); }
+
+    // Formats of the packed merge node, with the same bits as FormatConvert.h.
+    // Halves sit in the low 16 bits of a lane, the rest of the lane is zero.
+    static Float HalfToFloat(Int a)
+    {
+        __m256i halves = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, _mm256_setzero_si256()), _MM_SHUFFLE(3, 1, 2, 0));
+        return _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+    }
+    static Int FloatToHalf(Float a) { return _mm256_cvtepu16_epi32(_mm256_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT)); }
+    // max returns its second operand for NaN, so NaN saturates to 0 like Saturate()
+    static Int FloatToUnorm8(Float a)
+    {
+        a = _mm256_min_ps(_mm256_max_ps(a, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+        a = _mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f));
+        return _mm256_cvttps_epi32(_mm256_floor_ps(a));
+    }
+
+    // Bit patterns and exponent fields, for RelightKernelLanes.inl
+    static Int AddInt(Int a, Int b) { return _mm256_add_epi32(a, b); }
+    static Int SubInt(Int a, Int b) { return _mm256_sub_epi32(a, b); }
+    static Int ShiftLeft23(Int a) { return _mm256_slli_epi32(a, 23); }
+    static Int ShiftRight23(Int a) { return _mm256_srli_epi32(a, 23); }
+    static Int AsInt(Float a) { return _mm256_castps_si256(a); }
+    static Float AsFloat(Int a) { return _mm256_castsi256_ps(a); }
+    static Int FloatToInt(Float a) { return _mm256_cvttps_epi32(a); }
+    static Float IntToFloat(Int a) { return _mm256_cvtepi32_ps(a); }
+
+    // Lane masks for blending, with the predicates of the comparisons above
+    static Mask LessMask(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask GreaterMask(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static Mask EqualIntMask(Int a, Int b) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+    static Mask GreaterIntMask(Int a, Int b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b)); }
+    static Mask AndMask(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static unsigned MaskBits(Mask a) { return (unsigned)_mm256_movemask_ps(a); }
+    static Float Select(Mask mask, Float a, Float b) { return _mm256_blendv_ps(b, a, mask); }
+    static Int SelectInt(Mask mask, Int a, Int b)
+    {
+        return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), mask));
+    }
+
+    static void End() { _mm256_zeroupper(); }
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_SIMDLANESAVX2_H
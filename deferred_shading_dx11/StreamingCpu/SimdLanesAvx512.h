@@ -0,0 +1,89 @@
+#ifndef STREAMINGCPU_SIMDLANESAVX512_H
+#define STREAMINGCPU_SIMDLANESAVX512_H
+
+// 16 wide version of Avx2Lanes. Only include this from a translation unit
+// compiled for AVX-512F (see MergeKernelAvx512.cpp).
+
+#include <immintrin.h>
+
+namespace StreamingCpu {
+
+struct Avx512Lanes
+{
+    enum { kWidth = 16 };
+    typedef __m512 Float;
+    typedef __m512i Int;
+    typedef __mmask16 Mask;
+
+    static Float LoadFloat(const float* p) { return _mm512_loadu_ps(p); }
+    static Int LoadInt(const unsigned* p) { return _mm512_loadu_si512((const void*)p); }
+    static void StoreInt(unsigned* p, Int v) { _mm512_storeu_si512((void*)p, v); }
+    static void StoreFloat(float* p, Float v) { _mm512_storeu_ps(p, v); }
+    static Int Gather(const unsigned* base, Int offsets) { return _mm512_i32gather_epi32(offsets, (const void*)base, 4); }
+    static Float Splat(float v) { return _mm512_set1_ps(v); }
+    static Int SplatInt(unsigned v) { return _mm512_set1_epi32((int)v); }
+    static Int LaneIndices() { return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+
+    static Float Add(Float a, Float b) { return _mm512_add_ps(a, b); }
+    static Float Sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+    static Float Mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+    static Float Sqrt(Float a) { return _mm512_sqrt_ps(a); }
+    static Float Min(Float a, Float b) { return _mm512_min_ps(a, b); }
+    static Float Max(Float a, Float b) { return _mm512_max_ps(a, b); }
+    static Float Abs(Float a)
+    {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7FFFFFFF)));
+    }
+    static Float Div(Float a, Float b) { return _mm512_div_ps(a, b); }
+    static Float Floor(Float a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+
+    static unsigned Less(Float a, Float b) { return (unsigned)_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static unsigned LessEqual(Float a, Float b) { return (unsigned)_mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static unsigned Greater(Float a, Float b) { return (unsigned)_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static unsigned GreaterEqual(Float a, Float b) { return (unsigned)_mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+
+    static Int And(Int a, Int b) { return _mm512_and_si512(a, b); }
+    static Int Or(Int a, Int b) { return _mm512_or_si512(a, b); }
+    static Int Xor(Int a, Int b) { return _mm512_xor_si512(a, b); }
+    static Int ShiftRight8(Int a) { return _mm512_srli_epi32(a, 8); }
+    static Int ShiftRight16(Int a) { return _mm512_srli_epi32(a, 16); }
+    static Int ShiftLeft8(Int a) { return _mm512_slli_epi32(a, 8); }
+    static Int ShiftLeft16(Int a) { return _mm512_slli_epi32(a, 16); }
+    static Int ShiftLeft24(Int a) { return _mm512_slli_epi32(a, 24); }
+    static Int MinInt(Int a, Int b) { return _mm512_min_epu32(a, b); }
+    static Int MulInt(Int a, Int b) { return _mm512_mullo_epi32(a, b); }
+    static unsigned Equal(Int a, Int b) { return (unsigned)_mm512_cmpeq_epi32_mask(a, b); }
+
+    static Float HalfToFloat(Int a) { return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(a)); }
+    static Int FloatToHalf(Float a) { return _mm512_cvtepu16_epi32(_mm512_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT)); }
+    static Int FloatToUnorm8(Float a)
+    {
+        a = _mm512_min_ps(_mm512_max_ps(a, _mm512_setzero_ps()), _mm512_set1_ps(1.0f));
+        a = _mm512_add_ps(_mm512_mul_ps(a, _mm512_set1_ps(255.0f)), _mm512_set1_ps(0.5f));
+        return _mm512_cvttps_epi32(Floor(a));
+    }
+
+    static Int AddInt(Int a, Int b) { return _mm512_add_epi32(a, b); }
+    static Int SubInt(Int a, Int b) { return _mm512_sub_epi32(a, b); }
+    static Int ShiftLeft23(Int a) { return _mm512_slli_epi32(a, 23); }
+    static Int ShiftRight23(Int a) { return _mm512_srli_epi32(a, 23); }
+    static Int AsInt(Float a) { return _mm512_castps_si512(a); }
+    static Float AsFloat(Int a) { return _mm512_castsi512_ps(a); }
+    static Int FloatToInt(Float a) { return _mm512_cvttps_epi32(a); }
+    static Float IntToFloat(Int a) { return _mm512_cvtepi32_ps(a); }
+
+    static Mask LessMask(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask GreaterMask(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static Mask EqualIntMask(Int a, Int b) { return _mm512_cmpeq_epi32_mask(a, b); }
+    static Mask GreaterIntMask(Int a, Int b) { return _mm512_cmpgt_epi32_mask(a, b); }
+    static Mask AndMask(Mask a, Mask b) { return (Mask)(a & b); }
+    static unsigned MaskBits(Mask a) { return (unsigned)a; }
+    static Float Select(Mask mask, Float a, Float b) { return _mm512_mask_blend_ps(mask, b, a); }
+    static Int SelectInt(Mask mask, Int a, Int b) { return _mm512_mask_blend_epi32(mask, b, a); }
+
+    static void End() { _mm256_zeroupper(); }
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_SIMDLANESAVX512_H
@@ -0,0 +1,38 @@
+#ifndef STREAMINGCPU_SPHEREMAP_H
+#define STREAMINGCPU_SPHEREMAP_H
+
+// C++ versions of EncodeSphereMap/DecodeSphereMap from GBuffer.hlsl. The
+// operation order follows the shader source so results are reproducible.
+
+#include <math.h>
+
+namespace StreamingCpu {
+
+inline void EncodeSphereMap(const float n[3], float e[2])
+{
+    float oneMinusZ = 1.0f - n[2];
+    float p = sqrtf(n[0] * n[0] + n[1] * n[1] + oneMinusZ * oneMinusZ);
+    e[0] = n[0] / p * 0.5f + 0.5f;
+    e[1] = n[1] / p * 0.5f + 0.5f;
+}
+
+inline void DecodeSphereMap(const float e[2], float n[3])
+{
+    float tmpX = e[0] - e[0] * e[0];
+    float tmpY = e[1] - e[1] * e[1];
+    float f = tmpX + tmpY;
+    float m = sqrtf(4.0f * f - 1.0f);
+
+    n[0] = m * (e[0] * 4.0f - 2.0f);
+    n[1] = m * (e[1] * 4.0f - 2.0f);
+    n[2] = 3.0f - 8.0f * f;
+}
+
+inline float Dot3(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_SPHEREMAP_H
@@ -0,0 +1,191 @@
+#include "ThreadPool.h"
+
+namespace StreamingCpu {
+
+ThreadPool::ThreadPool(unsigned threadCount)
+    : mThreadCount(threadCount), mGeneration(0), mBusyWorkers(0), mQuit(false)
+    , mTask(0), mCount(0), mGrainSize(1), mNextIndex(0), mStealing(false), mSteals(0)
+{
+    if (mThreadCount == 0) {
+        mThreadCount = std::thread::hardware_concurrency();
+        if (mThreadCount == 0) {
+            mThreadCount = 1;
+        }
+    }
+    mShares.reset(new Share[mThreadCount]);
+
+    for (unsigned i = 1; i < mThreadCount; ++i) {
+        mWorkers.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mStartCondition.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        mWorkers[i].join();
+    }
+}
+
+void ThreadPool::ParallelFor(unsigned count, unsigned grainSize, const RangeTask& task)
+{
+    Run(count, grainSize, task, false);
+}
+
+unsigned ThreadPool::ParallelForStealing(unsigned count, unsigned grainSize, const RangeTask& task)
+{
+    mSteals = 0;
+    Run(count, grainSize, task, true);
+    return mSteals;
+}
+
+void ThreadPool::Run(unsigned count, unsigned grainSize, const RangeTask& task, bool stealing)
+{
+    if (count == 0) {
+        return;
+    }
+    if (grainSize == 0) {
+        grainSize = 1;
+    }
+
+    // Not worth waking anybody up
+    if (mWorkers.empty() || count <= grainSize) {
+        for (unsigned begin = 0; begin < count; begin += grainSize) {
+            task(begin, count - begin < grainSize ? count : begin + grainSize, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTask = &task;
+        mCount = count;
+        mGrainSize = grainSize;
+        mNextIndex = 0;
+        mStealing = stealing;
+        for (unsigned i = 0; i < mThreadCount; ++i) {
+            unsigned begin = (unsigned)((uint64_t)count * i / mThreadCount);
+            unsigned end = (unsigned)((uint64_t)count * (i + 1) / mThreadCount);
+            mShares[i].range = MakeRange(begin, end);
+        }
+        mBusyWorkers = (unsigned)mWorkers.size();
+        ++mGeneration;
+    }
+    mStartCondition.notify_all();
+
+    if (stealing) {
+        RunShares(0);
+    } else {
+        RunRanges(0);
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mBusyWorkers > 0) {
+        mDoneCondition.wait(lock);
+    }
+    mTask = 0;
+}
+
+void ThreadPool::WorkerMain(unsigned threadIndex)
+{
+    unsigned generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (!mQuit && mGeneration == generation) {
+                mStartCondition.wait(lock);
+            }
+            if (mQuit) {
+                return;
+            }
+            generation = mGeneration;
+        }
+
+        if (mStealing) {
+            RunShares(threadIndex);
+        } else {
+            RunRanges(threadIndex);
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mBusyWorkers == 0) {
+            mDoneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunRanges(unsigned threadIndex)
+{
+    for (;;) {
+        unsigned begin = mNextIndex.fetch_add(mGrainSize);
+        if (begin >= mCount) {
+            break;
+        }
+        unsigned end = mCount - begin < mGrainSize ? mCount : begin + mGrainSize;
+        (*mTask)(begin, end, threadIndex);
+    }
+}
+
+void ThreadPool::RunShares(unsigned threadIndex)
+{
+    Share& share = mShares[threadIndex];
+    for (;;) {
+        uint64_t range = share.range.load();
+        unsigned begin = (unsigned)range;
+        unsigned end = (unsigned)(range >> 32);
+        if (begin >= end) {
+            if (!Steal(threadIndex)) {
+                break;
+            }
+            continue;
+        }
+        unsigned next = end - begin < mGrainSize ? end : begin + mGrainSize;
+        if (share.range.compare_exchange_weak(range, MakeRange(next, end))) {
+            (*mTask)(begin, next, threadIndex);
+        }
+    }
+}
+
+bool ThreadPool::Steal(unsigned threadIndex)
+{
+    // Split the largest share, unless none is worth splitting and the owners
+    // can finish the rest
+    unsigned victim = threadIndex;
+    unsigned largest = 0;
+    for (unsigned i = 1; i < mThreadCount; ++i) {
+        unsigned other = (threadIndex + i) % mThreadCount;
+        uint64_t range = mShares[other].range.load();
+        unsigned begin = (unsigned)range;
+        unsigned end = (unsigned)(range >> 32);
+        if (begin < end && end - begin > largest) {
+            victim = other;
+            largest = end - begin;
+        }
+    }
+    if (largest <= mGrainSize) {
+        return false;
+    }
+
+    Share& share = mShares[victim];
+    uint64_t range = share.range.load();
+    for (;;) {
+        unsigned begin = (unsigned)range;
+        unsigned end = (unsigned)(range >> 32);
+        if (begin >= end || end - begin <= mGrainSize) {
+            // Taken in the meantime, look again
+            return true;
+        }
+        unsigned middle = begin + (end - begin) / 2;
+        if (share.range.compare_exchange_weak(range, MakeRange(begin, middle))) {
+            mShares[threadIndex].range = MakeRange(middle, end);
+            ++mSteals;
+            return true;
+        }
+    }
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,81 @@
+#ifndef STREAMINGCPU_THREADPOOL_H
+#define STREAMINGCPU_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace StreamingCpu {
+
+// Fixed set of worker threads that run one ParallelFor at a time. The calling
+// thread takes part, so a pool with one thread runs everything inline.
+class ThreadPool
+{
+public:
+    // task(begin, end, threadIndex) is called for consecutive ranges of at most
+    // grainSize items. threadIndex is in [0, GetThreadCount()).
+    typedef std::function<void (unsigned, unsigned, unsigned)> RangeTask;
+
+    // threadCount == 0 uses one thread per hardware thread.
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    unsigned GetThreadCount() const { return mThreadCount; }
+
+    void ParallelFor(unsigned count, unsigned grainSize, const RangeTask& task);
+
+    // Like ParallelFor, but every thread starts on its own contiguous share of
+    // the items and takes half of the largest share left once it runs out, so
+    // neighbouring items stay on one thread unless their cost is uneven.
+    // Returns how many shares were split.
+    unsigned ParallelForStealing(unsigned count, unsigned grainSize, const RangeTask& task);
+
+private:
+    // Not implemented
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    // Items [begin, end) a thread has left, begin in the low half. Owners take
+    // from the front and thieves split off the back with compare exchanges.
+    struct Share
+    {
+        std::atomic<uint64_t> range;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    static uint64_t MakeRange(unsigned begin, unsigned end) { return ((uint64_t)end << 32) | begin; }
+
+    void Run(unsigned count, unsigned grainSize, const RangeTask& task, bool stealing);
+    void WorkerMain(unsigned threadIndex);
+    void RunRanges(unsigned threadIndex);
+    void RunShares(unsigned threadIndex);
+    bool Steal(unsigned threadIndex);
+
+    unsigned mThreadCount;
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mMutex;
+    std::condition_variable mStartCondition;
+    std::condition_variable mDoneCondition;
+    unsigned mGeneration;
+    unsigned mBusyWorkers;
+    bool mQuit;
+
+    const RangeTask* mTask;
+    unsigned mCount;
+    unsigned mGrainSize;
+    std::atomic<unsigned> mNextIndex;
+
+    bool mStealing;
+    std::unique_ptr<Share[]> mShares;
+    std::atomic<unsigned> mSteals;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_THREADPOOL_H
@@ -0,0 +1,47 @@
+#ifndef STREAMINGCPU_TIMER_H
+#define STREAMINGCPU_TIMER_H
+
+// std::chrono clocks only have millisecond resolution in VS2012, so use the
+// performance counter on Windows.
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
+namespace StreamingCpu {
+
+class Timer
+{
+public:
+    Timer() { Reset(); }
+
+    void Reset() { mStart = Now(); }
+
+    double GetSeconds() const { return Now() - mStart; }
+
+    static double Now()
+    {
+#if defined(_WIN32)
+        LARGE_INTEGER frequency, counter;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&counter);
+        return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+private:
+    double mStart;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_TIMER_H
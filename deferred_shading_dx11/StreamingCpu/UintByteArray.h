@@ -0,0 +1,58 @@
+#ifndef STREAMINGCPU_UINTBYTEARRAY_H
+#define STREAMINGCPU_UINTBYTEARRAY_H
+
+// C++ versions of the helpers in Shaders/UintByteArray.hlsl plus the HLSL
+// bit intrinsics they rely on.
+
+namespace StreamingCpu {
+
+inline unsigned CountBits(unsigned value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+inline unsigned GetByteInUint(unsigned arr, unsigned index)
+{
+    index = index * 8;
+    return (arr & (0xFF << index)) >> index;
+}
+
+inline void SetByteInUint(unsigned& arr, unsigned index, unsigned value)
+{
+    index = index * 8;
+    arr = arr & ~(0xFF << index);
+    arr = arr | ((value & 0xFF) << index);
+}
+
+// Node list entries. Bits comes from StreamingSurfaceLayout::kNodeIndexBits.
+template <unsigned Bits>
+inline unsigned GetBitsInUint(unsigned arr, unsigned index)
+{
+    index = index * Bits;
+    return (arr & (((1u << Bits) - 1) << index)) >> index;
+}
+
+template <unsigned Bits>
+inline void SetBitsInUint(unsigned& arr, unsigned index, unsigned value)
+{
+    index = index * Bits;
+    arr = arr & ~(((1u << Bits) - 1) << index);
+    arr = arr | ((value & ((1u << Bits) - 1)) << index);
+}
+
+// The 2 bit entries the shaders use for up to 3 surfaces
+inline unsigned Get2BitsInByte(unsigned arr, unsigned index)
+{
+    return GetBitsInUint<2>(arr, index);
+}
+
+inline void Set2BitsInByte(unsigned& arr, unsigned index, unsigned value)
+{
+    SetBitsInUint<2>(arr, index, value);
+}
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_UINTBYTEARRAY_H
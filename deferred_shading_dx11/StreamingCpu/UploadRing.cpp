@@ -0,0 +1,181 @@
+#include "UploadRing.h"
+#include <assert.h>
+
+namespace StreamingCpu {
+
+UploadRing::UploadRing(UploadBackend* backend, unsigned framesInFlight)
+    : mBackend(backend)
+    , mCapacity(backend->GetCapacity())
+    , mFramesInFlight(framesInFlight > 0 ? framesInFlight : 1)
+    , mHead(0)
+    , mTail(0)
+    , mFence(1)
+    , mFrameOpen(false)
+    , mMapped(0)
+{
+}
+
+void UploadRing::Retire(uint64_t completedFence)
+{
+    while (!mFrames.empty() && mFrames.front().fence <= completedFence) {
+        mTail = mFrames.front().end;
+        mFrames.pop_front();
+    }
+}
+
+void UploadRing::BeginFrame()
+{
+    assert(!mFrameOpen);
+    Retire(mBackend->GetCompletedFence());
+    while (mFrames.size() >= mFramesInFlight) {
+        mBackend->WaitForFence(mFrames.front().fence);
+        mStats.frameWaits++;
+        Retire(mBackend->GetCompletedFence());
+    }
+    mFrameOpen = true;
+}
+
+unsigned char* UploadRing::Allocate(unsigned size, unsigned alignment, unsigned& offset)
+{
+    assert(mFrameOpen && alignment > 0);
+    bool polled = false;
+    for (;;) {
+        const unsigned head = (unsigned)(mHead % mCapacity);
+        uint64_t aligned = ((uint64_t)head + alignment - 1) / alignment * alignment;
+        const bool wrap = aligned + size > mCapacity;
+        if (wrap) {
+            // Skip the rest of the ring, offset 0 is aligned to anything
+            aligned = mCapacity;
+        }
+        const uint64_t padding = aligned - head;
+        if (size <= mCapacity && mHead + padding + size - mTail <= mCapacity) {
+            offset = wrap ? 0 : (unsigned)aligned;
+            mHead += padding + size;
+            mStats.allocations++;
+            mStats.bytes += size;
+            mStats.paddingBytes += padding;
+            mStats.wraps += wrap ? 1 : 0;
+            if (mHead - mTail > mStats.peakBytes) {
+                mStats.peakBytes = (unsigned)(mHead - mTail);
+            }
+            if (!mMapped) {
+                mMapped = mBackend->Map();
+                mStats.maps++;
+            }
+            return mMapped + offset;
+        }
+
+        // Take what has finished, then wait for the oldest frame
+        if (mFrames.empty() || size > mCapacity) {
+            mStats.failures++;
+            return 0;
+        }
+        if (!polled) {
+            polled = true;
+            Retire(mBackend->GetCompletedFence());
+        } else {
+            mBackend->WaitForFence(mFrames.front().fence);
+            mStats.spaceWaits++;
+            Retire(mBackend->GetCompletedFence());
+        }
+    }
+}
+
+void UploadRing::Unmap()
+{
+    if (mMapped) {
+        mBackend->Unmap();
+        mMapped = 0;
+    }
+}
+
+void UploadRing::EndFrame()
+{
+    assert(mFrameOpen);
+    Unmap();
+    mBackend->SignalFence(mFence);
+    Frame frame = { mFence, mHead };
+    mFrames.push_back(frame);
+    mFence++;
+    mFrameOpen = false;
+    mStats.frames++;
+}
+
+CpuUploadBackend::CpuUploadBackend(unsigned capacity, unsigned latencyFrames)
+    : mMemory(capacity, 0)
+    , mLatencyFrames(latencyFrames)
+    , mMapped(false)
+    , mSignaledFence(0)
+    , mCompletedFence(0)
+{
+}
+
+unsigned char* CpuUploadBackend::Map()
+{
+    mStats.misuses += mMapped ? 1 : 0;
+    mStats.maps++;
+    mMapped = true;
+    return mMemory.empty() ? 0 : &mMemory[0];
+}
+
+void CpuUploadBackend::Unmap()
+{
+    mStats.misuses += mMapped ? 0 : 1;
+    mMapped = false;
+}
+
+void CpuUploadBackend::SignalFence(uint64_t fence)
+{
+    mStats.misuses += mMapped || fence <= mSignaledFence ? 1 : 0;
+    mStats.fences++;
+    mSignaledFence = fence;
+    for (size_t i = 0; i < mRecordedReads.size(); ++i) {
+        mRecordedReads[i].fence = fence;
+        mPendingReads.push_back(mRecordedReads[i]);
+    }
+    mRecordedReads.clear();
+    if (fence > mLatencyFrames) {
+        Complete(fence - mLatencyFrames);
+    }
+}
+
+void CpuUploadBackend::WaitForFence(uint64_t fence)
+{
+    assert(fence <= mSignaledFence);
+    if (fence > mCompletedFence) {
+        mStats.waits++;
+        Complete(fence);
+    }
+}
+
+void CpuUploadBackend::Read(unsigned offset, unsigned size)
+{
+    assert((uint64_t)offset + size <= mMemory.size());
+    mStats.misuses += mMapped ? 1 : 0;
+    mStats.reads++;
+    mStats.readBytes += size;
+    PendingRead read = { 0, offset, size, Hash(offset, size) };
+    mRecordedReads.push_back(read);
+}
+
+uint64_t CpuUploadBackend::Hash(unsigned offset, unsigned size) const
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned i = 0; i < size; ++i) {
+        hash = (hash ^ mMemory[offset + i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void CpuUploadBackend::Complete(uint64_t fence)
+{
+    while (!mPendingReads.empty() && mPendingReads.front().fence <= fence) {
+        const PendingRead& read = mPendingReads.front();
+        mStats.corruptReads += Hash(read.offset, read.size) != read.hash ? 1 : 0;
+        mPendingReads.pop_front();
+    }
+    mCompletedFence = fence > mCompletedFence ? fence : mCompletedFence;
+}
+
+} // namespace StreamingCpu
@@ -0,0 +1,167 @@
+#ifndef STREAMINGCPU_UPLOADRING_H
+#define STREAMINGCPU_UPLOADRING_H
+
+// Sub-allocates per-frame uploads from one buffer used as a ring, instead of
+// a WRITE_DISCARD map of a buffer per upload. Each allocation is aligned and
+// bound by its offset. The buffer is only ever mapped NO_OVERWRITE, which is
+// safe as long as nothing the GPU may still read is written: every frame
+// ends with a fence, and the bytes of a frame are reused only once the
+// backend reports its fence finished. With framesInFlight frames unfinished
+// BeginFrame() waits for the oldest, and so does Allocate() when the ring is
+// full.
+//
+// The backend is an interface so the same ring runs on D3D11
+// (StructuredRingBuffer in Buffer.h) and on CpuUploadBackend, which stands in
+// for a GPU lagging some frames behind and checks that nothing it reads was
+// overwritten before its frame finished.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+namespace StreamingCpu {
+
+// Fences are frame numbers: they start at 1 and go up by one per frame
+class UploadBackend
+{
+public:
+    virtual ~UploadBackend() {}
+    virtual unsigned GetCapacity() const = 0;
+
+    // Maps the whole buffer without discarding what the GPU may still read
+    virtual unsigned char* Map() = 0;
+    virtual void Unmap() = 0;
+
+    // Follows every command recorded so far, which must not use the buffer
+    // while it is mapped
+    virtual void SignalFence(uint64_t fence) = 0;
+    virtual uint64_t GetCompletedFence() = 0;
+    virtual void WaitForFence(uint64_t fence) = 0;
+};
+
+struct UploadRingStats
+{
+    uint64_t frames;
+    uint64_t allocations;
+    uint64_t bytes;             // allocated
+    uint64_t paddingBytes;      // skipped for alignment or at the end of the ring
+    uint64_t wraps;
+    uint64_t maps;
+    uint64_t frameWaits;        // BeginFrame() waits with framesInFlight frames unfinished
+    uint64_t spaceWaits;        // Allocate() waits for a frame's bytes
+    uint64_t failures;          // allocations that did not fit next to their own frame's
+    unsigned peakBytes;         // most bytes in use by unfinished frames and the open one
+
+    UploadRingStats()
+        : frames(0), allocations(0), bytes(0), paddingBytes(0), wraps(0), maps(0), frameWaits(0), spaceWaits(0)
+        , failures(0), peakBytes(0) {}
+};
+
+class UploadRing
+{
+public:
+    UploadRing(UploadBackend* backend, unsigned framesInFlight);
+
+    void BeginFrame();
+
+    // Returns where the caller writes size bytes, at offset bytes into the
+    // buffer, a multiple of alignment. Returns 0 if the open frame's
+    // allocations leave no room. The buffer stays mapped until Unmap().
+    unsigned char* Allocate(unsigned size, unsigned alignment, unsigned& offset);
+
+    // Before any command that reads the allocations
+    void Unmap();
+
+    // After every command that reads the frame's allocations
+    void EndFrame();
+
+    bool IsFrameOpen() const { return mFrameOpen; }
+    uint64_t GetFence() const { return mFence; }     // of the open or next frame
+    unsigned GetCapacity() const { return mCapacity; }
+    unsigned GetBytesInUse() const { return (unsigned)(mHead - mTail); }
+    const UploadRingStats& GetStats() const { return mStats; }
+
+private:
+    // Not implemented
+    UploadRing(const UploadRing&);
+    UploadRing& operator=(const UploadRing&);
+
+    struct Frame
+    {
+        uint64_t fence;
+        uint64_t end;           // mHead at EndFrame()
+    };
+
+    void Retire(uint64_t completedFence);
+
+    UploadBackend* mBackend;
+    unsigned mCapacity;
+    unsigned mFramesInFlight;
+    uint64_t mHead;             // bytes allocated since the start, padding included
+    uint64_t mTail;             // where the oldest unfinished frame starts
+    uint64_t mFence;
+    bool mFrameOpen;
+    unsigned char* mMapped;
+    std::deque<Frame> mFrames;  // unfinished, oldest first
+    UploadRingStats mStats;
+};
+
+struct CpuUploadStats
+{
+    uint64_t maps;
+    uint64_t fences;
+    uint64_t waits;             // WaitForFence() calls that had to finish frames early
+    uint64_t reads;
+    uint64_t readBytes;
+    uint64_t corruptReads;      // reads whose bytes changed before their frame finished
+    uint64_t misuses;           // mapping twice, or fences and reads while mapped
+
+    CpuUploadStats() : maps(0), fences(0), waits(0), reads(0), readBytes(0), corruptReads(0), misuses(0) {}
+};
+
+// A GPU finishing each frame latencyFrames fences after it was signaled, or
+// early when waited for
+class CpuUploadBackend : public UploadBackend
+{
+public:
+    CpuUploadBackend(unsigned capacity, unsigned latencyFrames);
+
+    virtual unsigned GetCapacity() const { return (unsigned)mMemory.size(); }
+    virtual unsigned char* Map();
+    virtual void Unmap();
+    virtual void SignalFence(uint64_t fence);
+    virtual uint64_t GetCompletedFence() { return mCompletedFence; }
+    virtual void WaitForFence(uint64_t fence);
+
+    // A command of the frame being recorded reads size bytes at offset. They
+    // are checked against what they hold now when the frame finishes.
+    void Read(unsigned offset, unsigned size);
+
+    const CpuUploadStats& GetStats() const { return mStats; }
+
+private:
+    struct PendingRead
+    {
+        uint64_t fence;
+        unsigned offset;
+        unsigned size;
+        uint64_t hash;
+    };
+
+    uint64_t Hash(unsigned offset, unsigned size) const;
+    void Complete(uint64_t fence);
+
+    std::vector<unsigned char> mMemory;
+    unsigned mLatencyFrames;
+    bool mMapped;
+    uint64_t mSignaledFence;
+    uint64_t mCompletedFence;
+    std::vector<PendingRead> mRecordedReads;    // since the last fence
+    std::deque<PendingRead> mPendingReads;      // of signaled frames
+    CpuUploadStats mStats;
+};
+
+} // namespace StreamingCpu
+
+#endif // STREAMINGCPU_UPLOADRING_H
@@ -23,10 +23,19 @@
 #include <sstream>
 #include "Shaders\StreamingDefines.h"
 #include "CameraPath.h"
+#include "DirectXTex\DirectXTex\DirectXTex.h"
 
 // Constants
 static const float kLightRotationSpeed = 0.05f;
 static const float kSliderFactorResolution = 10000.0f;
+// 16 lights; MAX_LIGHTS is sized for the tiled streaming resolve
+static const int kDefaultLightsPower = 4;
+
+// Quality analysis: the reference is per-sample shaded at no fewer samples
+// than this (or the streaming MSAA level, if higher), edges are where its
+// luminance gradient exceeds the threshold
+static const unsigned int kQualityReferenceSamples = 8;
+static const float kQualityEdgeThreshold = 0.25f;
 
 
 enum SCENE_SELECTION {
@@ -48,10 +57,16 @@ enum {
     UI_LIGHTINGONLY,
     UI_LIGHTS,
     UI_LIGHTSTEXT,
+    UI_TILEDLIGHTCULLING,
+    UI_RESOLVECOMPACTION,
     UI_LIGHTSPERPASS,
     UI_LIGHTSPERPASSTEXT,
     UI_CULLTECHNIQUE,
     UI_MSAA,
+    UI_SURFACESPERPIXEL,
+    UI_COMPACTMERGENODES,
+    UI_NODEPOOL,
+    UI_HIZ,
     UI_CAMERASPEEDTEXT,
     UI_CAMERASPEED,
     UI_SHOWMEMORY,
@@ -95,9 +110,15 @@ CD3DSettingsDlg gD3DSettingsDlg;
 CDXUTDialog gHUD[HUD_NUM];
 CDXUTCheckBox* gAnimateLightCheck = 0;
 CDXUTComboBox* gMSAACombo = 0;
+CDXUTComboBox* gSurfacesPerPixelCombo = 0;
+CDXUTCheckBox* gCompactMergeNodesCheck = 0;
+CDXUTComboBox* gNodePoolCombo = 0;
+CDXUTCheckBox* gHiZCheck = 0;
 CDXUTComboBox* gSceneSelectCombo = 0;
 CDXUTComboBox* gCullTechniqueCombo = 0;
 CDXUTSlider* gLightsSlider = 0;
+CDXUTCheckBox* gTiledLightCullingCheck = 0;
+CDXUTCheckBox* gResolveCompactionCheck = 0;
 CDXUTTextHelper* gTextHelper = 0;
 CDXUTSlider* gCameraSpeedSlider = 0;
 #if defined(STREAMING_DEBUG_OPTIONS)
@@ -114,6 +135,7 @@ float gAspectRatio;
 bool gDisplayUI = true;
 bool gZeroNextFrameTime = true;
 int gNumCaptures = 0;
+int gNumSnapshots = 0;
 int gPrevLightCullTechnique;
 
 // Any UI state passed directly to rendering shaders
@@ -145,8 +167,10 @@ void CALLBACK OnMouse(bool leftButtonDown, bool rightButtonDown, bool middleButt
 
 void LoadSkybox(LPCWSTR fileName);
 
+App* CreateApp(ID3D11Device* d3dDevice, unsigned int msaaSamples);
 void InitApp(ID3D11Device* d3dDevice);
 void DestroyApp();
+void RemoveUnsupportedMSAALevels(ID3D11Device* d3dDevice);
 void InitScene(ID3D11Device* d3dDevice);
 void DestroyScene();
 
@@ -156,6 +180,7 @@ void UpdateUIState();
 void SaveCameraToFile();
 void LoadCameraFromFile();
 void PlayBackCameraPath(bool capture);
+void AnalyzeCameraPathQuality();
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, INT nCmdShow)
 {
@@ -243,8 +268,35 @@ void InitUI()
         gMSAACombo->AddItem(L"2x MSAA", ULongToPtr(2));
         gMSAACombo->AddItem(L"4x MSAA", ULongToPtr(4));
         gMSAACombo->AddItem(L"8x MSAA", ULongToPtr(8));
+        gMSAACombo->AddItem(L"16x MSAA", ULongToPtr(16));
+        gMSAACombo->AddItem(L"32x MSAA", ULongToPtr(32));
         gMSAACombo->SetSelectedByData(ULongToPtr(8));
 
+        HUD->AddComboBox(UI_SURFACESPERPIXEL, 0, y, width, 23, 0, false, &gSurfacesPerPixelCombo);
+        y += 26;
+        gSurfacesPerPixelCombo->AddItem(L"1 surface/pixel", ULongToPtr(1));
+        gSurfacesPerPixelCombo->AddItem(L"2 surfaces/pixel", ULongToPtr(2));
+        gSurfacesPerPixelCombo->AddItem(L"3 surfaces/pixel", ULongToPtr(3));
+        gSurfacesPerPixelCombo->AddItem(L"4 surfaces/pixel", ULongToPtr(4));
+        gSurfacesPerPixelCombo->SetSelectedByData(ULongToPtr(STREAMING_MAX_SURFACES_PER_PIXEL));
+
+#if !defined(STREAMING_DEBUG_OPTIONS)
+        HUD->AddCheckBox(UI_COMPACTMERGENODES, L"Compact merge nodes", 0, y, width, 23, false, 0, false, &gCompactMergeNodesCheck);
+        y += 26;
+
+        // Pool sizes are the share of pixels that can hold more than one node
+        HUD->AddComboBox(UI_NODEPOOL, 0, y, width, 23, 0, false, &gNodePoolCombo);
+        y += 26;
+        gNodePoolCombo->AddItem(L"Fixed nodes", ULongToPtr(0));
+        gNodePoolCombo->AddItem(L"Node pool 100%", ULongToPtr(100));
+        gNodePoolCombo->AddItem(L"Node pool 50%", ULongToPtr(50));
+        gNodePoolCombo->AddItem(L"Node pool 25%", ULongToPtr(25));
+        gNodePoolCombo->SetSelectedByData(ULongToPtr(0));
+
+        HUD->AddCheckBox(UI_HIZ, L"Hi-Z fragment rejection", 0, y, width, 23, false, 0, false, &gHiZCheck);
+        y += 26;
+#endif // !defined(STREAMING_DEBUG_OPTIONS)
+
         HUD->AddComboBox(UI_SELECTEDSCENE, 0, y, width, 23, 0, false, &gSceneSelectCombo);
         y += 26;
         gSceneSelectCombo->AddItem(L"Power Plant", ULongToPtr(POWER_PLANT_SCENE));
@@ -270,8 +322,13 @@ void InitUI()
 
         HUD->AddStatic(UI_LIGHTSTEXT, L"Lights:", 0, y, width, 23);
         y += 26;
-        HUD->AddSlider(UI_LIGHTS, 0, y, width, 23, 0, MAX_LIGHTS_POWER, MAX_LIGHTS_POWER, false, &gLightsSlider);
-        gLightsSlider->SetValue(0);
+        HUD->AddSlider(UI_LIGHTS, 0, y, width, 23, 0, MAX_LIGHTS_POWER, kDefaultLightsPower, false, &gLightsSlider);
+        y += 26;
+
+        HUD->AddCheckBox(UI_TILEDLIGHTCULLING, L"Streaming tiled light culling", 0, y, width, 23, true, 0, false, &gTiledLightCullingCheck);
+        y += 26;
+
+        HUD->AddCheckBox(UI_RESOLVECOMPACTION, L"Streaming resolve compaction", 0, y, width, 23, true, 0, false, &gResolveCompactionCheck);
         y += 26;
 
         HUD->AddStatic(UI_CAMERASPEEDTEXT, L"Camera speed:", 0, y, width, 23);
@@ -290,6 +347,7 @@ void InitUI()
         gCullTechniqueCombo->AddItem(L"Compute Shader Tile", ULongToPtr(CULL_COMPUTE_SHADER_TILE));
         gCullTechniqueCombo->AddItem(L"Streaming SBAA", ULongToPtr(CULL_STREAMING_SBAA));
         gCullTechniqueCombo->AddItem(L"Streaming SBAA NDI", ULongToPtr(CULL_STREAMING_SBAA_NDI));
+        gCullTechniqueCombo->AddItem(L"Streaming SBAA NDI Clustered", ULongToPtr(CULL_STREAMING_SBAA_NDI_CLUSTERED));
         gUIConstants.lightCullTechnique = CULL_STREAMING_SBAA_NDI;
         gCullTechniqueCombo->SetSelectedByData(ULongToPtr(gUIConstants.lightCullTechnique));
 
@@ -380,16 +438,31 @@ void UpdateUIState()
 }
 
 
+// Creates an app with the current UI settings, except for the MSAA level
+App* CreateApp(ID3D11Device* d3dDevice, unsigned int msaaSamples)
+{
+    unsigned int surfacesPerPixel = PtrToUint(gSurfacesPerPixelCombo->GetSelectedData());
+    bool compactMergeNodes = gCompactMergeNodesCheck && gCompactMergeNodesCheck->GetChecked();
+    unsigned int nodePoolPercent = gNodePoolCombo ? PtrToUint(gNodePoolCombo->GetSelectedData()) : 0;
+    bool hiZ = gHiZCheck && gHiZCheck->GetChecked();
+    App* app = new App(d3dDevice, 1 << gLightsSlider->GetValue(), msaaSamples, surfacesPerPixel,
+                       compactMergeNodes, nodePoolPercent, hiZ);
+    app->SetTiledLightCulling(gTiledLightCullingCheck->GetChecked());
+    app->SetResolveCompaction(gResolveCompactionCheck->GetChecked());
+
+    // Initialize with the current surface description
+    app->OnD3D11ResizedSwapChain(d3dDevice, DXUTGetDXGIBackBufferSurfaceDesc());
+    return app;
+}
+
+
 void InitApp(ID3D11Device* d3dDevice)
 {
     DestroyApp();
     
     // Get current UI settings
     unsigned int msaaSamples = PtrToUint(gMSAACombo->GetSelectedData());
-    gApp = new App(d3dDevice, 1 << gLightsSlider->GetValue(), msaaSamples);
-
-    // Initialize with the current surface description
-    gApp->OnD3D11ResizedSwapChain(d3dDevice, DXUTGetDXGIBackBufferSurfaceDesc());
+    gApp = CreateApp(d3dDevice, msaaSamples);
 
     // Zero out the elapsed time for the next frame
     gZeroNextFrameTime = true;
@@ -586,6 +659,12 @@ void CALLBACK OnKeyboard(UINT character, bool keyDown, bool altDown, void* userC
                                        filename,
                                        DXGI_FORMAT_UNKNOWN);
             break;
+        case 'G': {
+            char filename[128];
+            sprintf_s(filename, "snapshot%d.sgbs", gNumSnapshots++);
+            gApp->SaveGBufferSnapshot(DXUTGetD3D11DeviceContext(), filename);
+            break;
+        }
         case 'T':
             gUIConstants.lightCullTechnique = gPrevLightCullTechnique;
             gPrevLightCullTechnique = static_cast<unsigned int>(PtrToUlong(gCullTechniqueCombo->GetSelectedData()));
@@ -619,6 +698,9 @@ void CALLBACK OnKeyboard(UINT character, bool keyDown, bool altDown, void* userC
         case 'B':
             PlayBackCameraPath(true);
             break;
+        case 'N':
+            AnalyzeCameraPathQuality();
+            break;
         }
     }
 }
@@ -645,6 +727,10 @@ void CALLBACK OnGUIEvent(UINT eventID, INT controlID, CDXUTControl* control, voi
             DestroyScene(); break;
         case UI_LIGHTS:
             gApp->SetActiveLights(DXUTGetD3D11Device(), 1 << gLightsSlider->GetValue()); break;
+        case UI_TILEDLIGHTCULLING:
+            gApp->SetTiledLightCulling(gTiledLightCullingCheck->GetChecked()); break;
+        case UI_RESOLVECOMPACTION:
+            gApp->SetResolveCompaction(gResolveCompactionCheck->GetChecked()); break;
         case UI_CULLTECHNIQUE:
             gPrevLightCullTechnique = gUIConstants.lightCullTechnique;
             gUIConstants.lightCullTechnique = static_cast<unsigned int>(PtrToUlong(gCullTechniqueCombo->GetSelectedData())); break;
@@ -681,6 +767,10 @@ void CALLBACK OnGUIEvent(UINT eventID, INT controlID, CDXUTControl* control, voi
         // (i.e. recreating resources and such), so we'll just clean up the app here and let it be
         // lazily recreated next render.
         case UI_MSAA:
+        case UI_SURFACESPERPIXEL:
+        case UI_COMPACTMERGENODES:
+        case UI_NODEPOOL:
+        case UI_HIZ:
             DestroyApp(); break;
 
         default:
@@ -704,6 +794,37 @@ void CALLBACK OnD3D11DestroyDevice(void* userContext)
 }
 
 
+// Drops the MSAA levels the device can not render the G-buffer and depth
+// formats with. No feature level requires 16x or 32x.
+void RemoveUnsupportedMSAALevels(ID3D11Device* d3dDevice)
+{
+    static const DXGI_FORMAT formats[] = {
+        DXGI_FORMAT_R16G16B16A16_FLOAT,
+        DXGI_FORMAT_R8G8B8A8_UNORM,
+        DXGI_FORMAT_R16G16_FLOAT,
+        DXGI_FORMAT_D32_FLOAT_S8X24_UINT,
+        DXGI_FORMAT_D32_FLOAT,
+    };
+
+    for (int i = (int)gMSAACombo->GetNumItems() - 1; i >= 0; --i) {
+        unsigned int samples = PtrToUint(gMSAACombo->GetItemData(i));
+        bool supported = true;
+        for (UINT f = 0; f < ARRAYSIZE(formats); ++f) {
+            UINT qualityLevels = 0;
+            HRESULT hr = d3dDevice->CheckMultisampleQualityLevels(formats[f], samples, &qualityLevels);
+            supported = supported && SUCCEEDED(hr) && qualityLevels > 0;
+        }
+        if (!supported) {
+            bool selected = PtrToUint(gMSAACombo->GetSelectedData()) == samples;
+            gMSAACombo->RemoveItem(i);
+            if (selected) {
+                gMSAACombo->SetSelectedByData(ULongToPtr(8));
+            }
+        }
+    }
+}
+
+
 HRESULT CALLBACK OnD3D11CreateDevice(ID3D11Device* d3dDevice, const DXGI_SURFACE_DESC* backBufferSurfaceDesc,
                                      void* userContext)
 {    
@@ -716,6 +837,8 @@ HRESULT CALLBACK OnD3D11CreateDevice(ID3D11Device* d3dDevice, const DXGI_SURFACE
     gViewerCamera.SetDrag(true);
     gViewerCamera.SetEnableYAxisMovement(true);
 
+    RemoveUnsupportedMSAALevels(d3dDevice);
+
     return S_OK;
 }
 
@@ -949,4 +1072,102 @@ void PlayBackCameraPath(bool capture)
     }
     fclose(statsFile);
     gDisplayUI = true;
-}
\ No newline at end of file
+}
+
+
+// Renders every camera path frame twice: per-sample shaded at the larger of
+// kQualityReferenceSamples and the current MSAA level (the tiled compute
+// shader path) as the reference,
+// and with the current MSAA level and streaming technique. Writes PSNR, SSIM
+// and the error on reference edges per frame to quality.csv, and the edge
+// error maps to video/edges%d.tga.
+void AnalyzeCameraPathQuality()
+{
+    if (!gCameraPath || gCameraPath->GetFrameCount() == 0) {
+        return;
+    }
+
+    ID3D11Device* d3dDevice = DXUTGetD3D11Device();
+    ID3D11DeviceContext* d3dDeviceContext = DXUTGetD3D11DeviceContext();
+    ID3D11RenderTargetView* pRTV = DXUTGetD3D11RenderTargetView();
+
+    gLightsSlider->SetValue(gCameraPath->GetActiveLights());
+
+    // Fresh apps, so light animation matches between the two
+    unsigned int msaaSamples = PtrToUint(gMSAACombo->GetSelectedData());
+    unsigned int surfacesPerPixel = PtrToUint(gSurfacesPerPixelCombo->GetSelectedData());
+    unsigned int referenceSamples = msaaSamples > kQualityReferenceSamples ? msaaSamples : kQualityReferenceSamples;
+    std::tr1::shared_ptr<App> reference(CreateApp(d3dDevice, referenceSamples));
+    std::tr1::shared_ptr<App> streaming(CreateApp(d3dDevice, msaaSamples));
+
+    UIConstants referenceUI = gUIConstants;
+    referenceUI.lightCullTechnique = CULL_COMPUTE_SHADER_TILE;
+    UIConstants streamingUI = gUIConstants;
+    if (streamingUI.lightCullTechnique != CULL_STREAMING_SBAA_NDI &&
+        streamingUI.lightCullTechnique != CULL_STREAMING_SBAA_NDI_CLUSTERED) {
+        streamingUI.lightCullTechnique = CULL_STREAMING_SBAA;
+    }
+
+    D3D11_VIEWPORT viewport;
+    viewport.Width    = static_cast<float>(DXUTGetDXGIBackBufferSurfaceDesc()->Width);
+    viewport.Height   = static_cast<float>(DXUTGetDXGIBackBufferSurfaceDesc()->Height);
+    viewport.MinDepth = 0.0f;
+    viewport.MaxDepth = 1.0f;
+    viewport.TopLeftX = 0.0f;
+    viewport.TopLeftY = 0.0f;
+
+    FILE *qualityFile = 0;
+    fopen_s(&qualityFile, "quality.csv", "w");
+    if (!qualityFile) {
+        return;
+    }
+    fprintf(qualityFile, "frame, technique, msaa, surfaces, lights, streaming ms, reference ms, "
+                         "psnr, ssim, edge psnr, edge pixels, mse, edge mse, edge map\n");
+
+    for (unsigned i = 0; i < gCameraPath->GetFrameCount(); i++) {
+        CameraParams params = gCameraPath->GetFrame(i);
+        gViewerCamera.SetViewParams(&params.eye, &params.at);
+
+        DirectX::ScratchImage referenceImage;
+        reference->Render(d3dDeviceContext, pRTV, gMeshOpaque, gMeshAlpha, gSkyboxSRV,
+                          gWorldMatrix, &gViewerCamera, &viewport, &referenceUI);
+        float referenceTime = reference->GetFrameTime(d3dDeviceContext, &referenceUI);
+        HRESULT hr = reference->CaptureBackbuffer(d3dDeviceContext, pRTV, referenceImage);
+
+        DirectX::ScratchImage streamingImage;
+        streaming->Render(d3dDeviceContext, pRTV, gMeshOpaque, gMeshAlpha, gSkyboxSRV,
+                          gWorldMatrix, &gViewerCamera, &viewport, &streamingUI);
+        float streamingTime = streaming->GetFrameTime(d3dDeviceContext, &streamingUI);
+        if (SUCCEEDED(hr)) {
+            hr = streaming->CaptureBackbuffer(d3dDeviceContext, pRTV, streamingImage);
+        }
+
+        DirectX::ImageQuality quality;
+        DirectX::ScratchImage edgeMap;
+        if (SUCCEEDED(hr)) {
+            hr = DirectX::ComputeImageQuality(*referenceImage.GetImage(0, 0, 0), *streamingImage.GetImage(0, 0, 0),
+                                              DirectX::CMSE_IGNORE_ALPHA | DirectX::CMSE_PARALLEL,
+                                              kQualityEdgeThreshold, quality, &edgeMap);
+        }
+        if (FAILED(hr)) {
+            fprintf(qualityFile, "%u, failed (0x%08x)\n", i, static_cast<unsigned>(hr));
+            continue;
+        }
+
+        WCHAR filename[128];
+        swprintf_s(filename, L"video/edges%u.tga", i);
+        hr = DirectX::SaveToTGAFile(*edgeMap.GetImage(0, 0, 0), filename);
+
+        fprintf(qualityFile, "%u, %u, %u, %u, %u, %f, %f, %f, %f, %f, %u, %g, %g, ",
+                i, streamingUI.lightCullTechnique, msaaSamples, surfacesPerPixel,
+                streaming->GetActiveLights(), streamingTime, referenceTime, quality.psnr, quality.ssim,
+                quality.edgePsnr, static_cast<unsigned>(quality.edgePixels), quality.mse, quality.edgeMse);
+        if (SUCCEEDED(hr)) {
+            fprintf(qualityFile, "saved\n");
+        } else {
+            fprintf(qualityFile, "failed (0x%08x)\n", static_cast<unsigned>(hr));
+        }
+    }
+
+    fclose(qualityFile);
+}